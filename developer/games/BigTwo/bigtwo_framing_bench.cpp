@@ -0,0 +1,307 @@
+// Loopback benchmark for the two TCP framings of the game session: messages
+// and bytes per second one way, and round-trip latency percentiles, over TCP
+// on 127.0.0.1 (TCP_NODELAY) and a UNIX stream socketpair.
+//
+//   bigtwo_framing_bench [--sizes 16,256,4096,65536] [--conns 1,4,16] [--ms N]
+//                        [--filter TEXT] [--label NAME] [--out FILE]
+//
+// Stacks:
+//   frame  send_frame out (4-byte length and body in one sendmsg), recv_frame
+//          in (through the per-fd receive buffer), as player A and B talk
+//   line   send_msg of the body and '\n' out, recv_line in (same buffer,
+//          TIMEOUT ms per call, retried), as the lobby protocol runs
+// Modes, for every stack x transport x payload size x connection count:
+//   stream    each connection sends for --ms (default 500) while its peer
+//             reads; the rates are totals over all connections
+//   pingpong  each connection sends a message and waits for its echo; the
+//             rates count round trips and the bytes of both directions
+// Every case runs on its own sockets, one thread per end of a connection.
+// Every result is one JSON object per line:
+//   {"label":"...","stack":"frame","transport":"tcp","mode":"pingpong","payload":256,"conns":4,
+//    "msgs_per_s":41234,"bytes_per_s":21111808,"p50_us":21.3,"p90_us":30.1,"p99_us":55.0,"max_us":410.2}
+// (the percentiles only for pingpong), so runs before and after a change to
+// tools.cpp can be kept side by side.
+// Build: g++ -std=c++20 -O2 -pthread -o bigtwo_framing_bench bigtwo_framing_bench.cpp game.cpp tools.cpp game_record.cpp bot.cpp ../core/common.cpp
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "config.h"
+#include "game_engine.h"
+using namespace std;
+
+namespace {
+    using Clock = chrono::steady_clock;
+    constexpr size_t kMaxPayload = 1u << 20; // send_frame's limit
+
+    struct Options {
+        vector<size_t> sizes{16, 256, 4096, 65536};
+        vector<int> conns{1, 4, 16};
+        int ms = 500;
+        string filter;
+        string label = "run";
+        string out;
+    };
+
+    // One end of a connection speaking one stack; blocking calls, false once
+    // the peer is gone
+    class Endpoint {
+    public:
+        explicit Endpoint(int fd) : fd_(fd) {}
+        virtual ~Endpoint() { close(fd_); }
+        virtual bool send(const string& body) = 0;
+        virtual bool recv(string& out) = 0;
+        // No more messages from this end; the peer's recv then fails
+        void finish() { shutdown(fd_, SHUT_WR); }
+
+    protected:
+        int fd_;
+    };
+
+    class FrameEndpoint : public Endpoint {
+    public:
+        using Endpoint::Endpoint;
+        bool send(const string& body) override { return send_frame(fd_, body); }
+        bool recv(string& out) override { return recv_frame(fd_, out); }
+    };
+
+    class LineEndpoint : public Endpoint {
+    public:
+        using Endpoint::Endpoint;
+        bool send(const string& body) override {
+            line_.assign(body).push_back('\n');
+            return send_msg(fd_, line_);
+        }
+        bool recv(string& out) override {
+            for (;;) {
+                if (recv_line(fd_, out)) return true;
+                if (errno != EAGAIN) return false; // TIMEOUT passed with no line: keep waiting
+            }
+        }
+
+    private:
+        string line_;
+    };
+
+    struct Stack {
+        const char* name;
+        unique_ptr<Endpoint> (*make)(int fd);
+    };
+
+    const Stack kStacks[] = {
+        {"frame", [](int fd) -> unique_ptr<Endpoint> { return make_unique<FrameEndpoint>(fd); }},
+        {"line", [](int fd) -> unique_ptr<Endpoint> { return make_unique<LineEndpoint>(fd); }},
+    };
+    const char* const kTransports[] = {"tcp", "unix"};
+    const char* const kModes[] = {"stream", "pingpong"};
+
+    // A connected pair of sockets; false if the transport is unavailable
+    bool connectPair(const string& transport, int& a, int& b) {
+        if (transport == "unix") {
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) return false;
+            a = sv[0];
+            b = sv[1];
+            return true;
+        }
+        static int listenFd = -1;
+        static uint16_t port = 0;
+        if (listenFd < 0 && (listenFd = start_tcp_server_in_range("127.0.0.1", port)) < 0) return false;
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        a = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (a < 0) return false;
+        if (connect(a, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            (b = accept(listenFd, nullptr, nullptr)) < 0) {
+            close(a);
+            return false;
+        }
+        const int one = 1;
+        setsockopt(a, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(b, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return true;
+    }
+
+    struct CaseResult {
+        double msgsPerS = 0;
+        double bytesPerS = 0;
+        vector<double> rttUs; // pingpong only
+    };
+
+    // Runs one case on conns fresh connections; false if they could not be made
+    bool runCase(const Stack& stack, const string& transport, const string& mode, size_t payload,
+                 int conns, int ms, CaseResult& result) {
+        vector<unique_ptr<Endpoint>> senders, receivers;
+        for (int i = 0; i < conns; ++i) {
+            int a = -1, b = -1;
+            if (!connectPair(transport, a, b)) return false;
+            senders.push_back(stack.make(a));
+            receivers.push_back(stack.make(b));
+        }
+        const string body(payload, 'x'); // no '\n', so the line stack can carry it too
+        const bool pingpong = mode == "pingpong";
+        atomic<int> ready{0};
+        atomic<bool> go{false};
+        vector<uint64_t> counts(static_cast<size_t>(conns), 0);
+        vector<vector<double>> rtts(static_cast<size_t>(conns));
+        Clock::time_point start, deadline;
+
+        vector<thread> threads;
+        for (size_t i = 0; i < static_cast<size_t>(conns); ++i) {
+            // The far end: counts a stream, or echoes each ping
+            threads.emplace_back([&, i] {
+                string in;
+                Endpoint& e = *receivers[i];
+                while (e.recv(in)) {
+                    if (pingpong) {
+                        if (!e.send(in)) break;
+                    } else {
+                        ++counts[i];
+                    }
+                }
+                if (pingpong) e.finish();
+            });
+            threads.emplace_back([&, i] {
+                Endpoint& e = *senders[i];
+                string in;
+                ready.fetch_add(1);
+                while (!go.load()) this_thread::yield();
+                while (Clock::now() < deadline) {
+                    if (pingpong) {
+                        const auto t0 = Clock::now();
+                        if (!e.send(body) || !e.recv(in)) break;
+                        rtts[i].push_back(chrono::duration<double, micro>(Clock::now() - t0).count());
+                        ++counts[i];
+                    } else if (!e.send(body)) {
+                        break;
+                    }
+                }
+                e.finish();
+                if (pingpong) {
+                    while (e.recv(in)) {} // until the echo side closes too
+                }
+            });
+        }
+        while (ready.load() < conns) this_thread::yield();
+        start = Clock::now();
+        deadline = start + chrono::milliseconds(ms);
+        go.store(true);
+        for (auto& t : threads) t.join();
+        const double secs = chrono::duration<double>(Clock::now() - start).count();
+
+        uint64_t msgs = 0;
+        for (uint64_t c : counts) msgs += c;
+        result.msgsPerS = static_cast<double>(msgs) / secs;
+        result.bytesPerS = result.msgsPerS * static_cast<double>(payload) * (pingpong ? 2 : 1);
+        result.rttUs.clear();
+        for (auto& r : rtts) result.rttUs.insert(result.rttUs.end(), r.begin(), r.end());
+        sort(result.rttUs.begin(), result.rttUs.end());
+        return true;
+    }
+
+    double percentile(const vector<double>& sorted, double p) {
+        if (sorted.empty()) return 0;
+        const size_t i = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[min(i, sorted.size() - 1)];
+    }
+
+    void runAll(const Options& opt, FILE* out) {
+        for (const Stack& stack : kStacks) {
+            for (const char* transport : kTransports) {
+                for (const char* mode : kModes) {
+                    const string id = string(stack.name) + "/" + transport + "/" + mode;
+                    if (!opt.filter.empty() && id.find(opt.filter) == string::npos) continue;
+                    for (size_t size : opt.sizes) {
+                        for (int conns : opt.conns) {
+                            CaseResult r;
+                            if (!runCase(stack, transport, mode, size, conns, opt.ms, r)) {
+                                fprintf(stderr, "cannot connect over %s, skipping %s\n", transport, id.c_str());
+                                continue;
+                            }
+                            fprintf(out, "{\"label\":\"%s\",\"stack\":\"%s\",\"transport\":\"%s\",\"mode\":\"%s\","
+                                         "\"payload\":%zu,\"conns\":%d,\"msgs_per_s\":%.0f,\"bytes_per_s\":%.0f",
+                                    opt.label.c_str(), stack.name, transport, mode, size, conns, r.msgsPerS,
+                                    r.bytesPerS);
+                            if (!r.rttUs.empty()) {
+                                fprintf(out, ",\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f",
+                                        percentile(r.rttUs, 0.5), percentile(r.rttUs, 0.9),
+                                        percentile(r.rttUs, 0.99), r.rttUs.back());
+                            }
+                            fprintf(out, "}\n");
+                            fflush(out);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    bool parseList(const string& text, vector<T>& out) {
+        out.clear();
+        stringstream ss(text);
+        for (string item; getline(ss, item, ',');) {
+            const long long v = atoll(item.c_str());
+            if (v <= 0) return false;
+            out.push_back(static_cast<T>(v));
+        }
+        return !out.empty();
+    }
+
+    void usage() {
+        fprintf(stderr, "usage: bigtwo_framing_bench [--sizes 16,256,4096,65536] [--conns 1,4,16] [--ms N]\n"
+                        "                            [--filter TEXT] [--label NAME] [--out FILE]\n");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        string val = argv[++i];
+        bool ok = true;
+        if (arg == "--sizes") ok = parseList(val, opt.sizes);
+        else if (arg == "--conns") ok = parseList(val, opt.conns);
+        else if (arg == "--ms") ok = (opt.ms = atoi(val.c_str())) > 0;
+        else if (arg == "--filter") opt.filter = val;
+        else if (arg == "--label") opt.label = val;
+        else if (arg == "--out") opt.out = val;
+        else ok = false;
+        if (!ok) {
+            usage();
+            return 2;
+        }
+    }
+    for (size_t size : opt.sizes) {
+        if (size > kMaxPayload) {
+            fprintf(stderr, "payload %zu is over the frame limit of %zu\n", size, kMaxPayload);
+            return 2;
+        }
+    }
+    FILE* out = stdout;
+    if (!opt.out.empty() && !(out = fopen(opt.out.c_str(), "a"))) {
+        fprintf(stderr, "cannot open %s\n", opt.out.c_str());
+        return 1;
+    }
+    runAll(opt, out);
+    if (out != stdout) fclose(out);
+    return 0;
+}
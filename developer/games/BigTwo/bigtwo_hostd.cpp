@@ -0,0 +1,460 @@
+// Tournament host: one process running many BigTwo tables at once on a single
+// reactor (../core/reactor.hpp), instead of playerA's one game per terminal.
+//
+//   bigtwo_hostd [--ip IP] [--port PORT] [--pair-wait-ms MS] [--budget-ms MS] [--metrics-port P]
+//
+// Clients connect over TCP and speak player B's side of the game protocol:
+// a "USER <name> [version]" hello, then STATE/ASK (or MSG/PROMPT for version
+// 1) frames answered with indices, pass or surrender, ending in GAMESESS.
+// Clients are seated in pairs as they arrive. One left waiting longer than
+// --pair-wait-ms plays the practice bot; 0 seats everyone against the bot.
+// Each table is a state machine advanced by the frames that arrive for it;
+// bot searches run on the shared bot pool and never hold up the loop.
+// Every finished table is appended to GAME_RECORD_FILE (see game_record.h).
+// Clients are FramedConnections: a client that stops reading costs its own
+// send queue, and is dropped (forfeiting) once that passes the hard limit.
+//
+// Build: g++ -std=c++20 -O2 -pthread -o bigtwo_hostd bigtwo_hostd.cpp game.cpp tools.cpp game_record.cpp bot.cpp \
+//            ../core/common.cpp ../core/metrics.cpp ../core/reactor.cpp
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "config.h"
+#include "game_engine.h"
+#include "game_record.h"
+#include "../core/framed_connection.hpp"
+#include "../core/metrics.hpp"
+#include "../core/reactor.hpp"
+using namespace std;
+
+namespace {
+    constexpr uint32_t kMaxAnswer = 4096;   // an answer is a handful of indices
+    constexpr int kBotPollMs = 20;          // how often thinking bots are checked
+    constexpr int kCloseDrainMs = 1000;     // a finished seat gets this long to take its last frames
+
+    struct HostMetrics {
+        MetricGauge& clients = metrics().gauge("bigtwo_hostd_clients", "Connected clients, seated or not");
+        MetricGauge& tables = metrics().gauge("bigtwo_hostd_tables", "Tables in play");
+        MetricCounter& finished = metrics().counter("bigtwo_hostd_games_total", "Tables played to the end");
+        MetricCounter& forfeits =
+            metrics().counter("bigtwo_hostd_forfeits_total", "Tables lost by a seat that left or stopped reading");
+    };
+
+    HostMetrics& host_metrics() {
+        static HostMetrics m;
+        return m;
+    }
+
+    using Clock = chrono::steady_clock;
+
+    struct Seat {
+        int fd = -1;        // -1 is the bot
+        string name;
+        int proto = 1;
+    };
+
+    struct Table {
+        int id = 0;
+        uint64_t seed = 0;  // init(.., seed) deals this table again
+        state world;
+        Seat seat[2];
+        future<hand_mask> thinking; // valid while the bot is on move
+        bool over = false;
+        game_record record;
+    };
+
+    struct Waiting {
+        int fd;
+        string name;
+        int proto;
+        Clock::time_point since;
+    };
+
+    struct Options {
+        string ip = "0.0.0.0";
+        string port = "16000";
+        int pair_wait_ms = 15000;
+        int budget_ms = BOT_BUDGET_MS;
+        int metrics_port = -1;
+    };
+
+    bool parseArgs(int argc, char** argv, Options& opt) {
+        for (int i = 1; i < argc; i++) {
+            string a = argv[i];
+            if (i + 1 >= argc) return false;
+            string v = argv[++i];
+            if (a == "--ip") opt.ip = v;
+            else if (a == "--port") opt.port = v;
+            else if (a == "--pair-wait-ms") opt.pair_wait_ms = atoi(v.c_str());
+            else if (a == "--budget-ms") opt.budget_ms = atoi(v.c_str());
+            else if (a == "--metrics-port") opt.metrics_port = atoi(v.c_str());
+            else return false;
+        }
+        return opt.pair_wait_ms >= 0 && opt.budget_ms > 0;
+    }
+
+    class Host {
+    public:
+        explicit Host(const Options& opt) : opt_(opt) {}
+
+        int run() {
+            listener_ = getListeningSocket(opt_.ip, opt_.port, "TCP");
+            if (listener_ == -1) {
+                fprintf(stderr, "[hostd] unable to listen on %s:%s\n", opt_.ip.c_str(), opt_.port.c_str());
+                return 1;
+            }
+            if (!reactor_.ok() || !reactor_.add(listener_, EPOLLIN, [this](uint32_t) { accept_client(); })) {
+                fprintf(stderr, "[hostd] unable to start the reactor\n");
+                close(listener_);
+                return 1;
+            }
+            cout << "[hostd] Hosting tables on " << opt_.ip << ":" << opt_.port << endl;
+            while (running) {
+                reactor_.run_once(pollTimeout());
+                seat_waiting();
+                collect_bots();
+                reap();
+                trace_poll_signal();
+            }
+            for (auto& [fd, conn] : conns_) conn->close();
+            host_metrics().clients.add(-static_cast<int64_t>(conns_.size()));
+            conns_.clear();
+            reactor_.remove(listener_);
+            close(listener_);
+            cout << "[hostd] " << finished_ << " games finished." << endl;
+            return 0;
+        }
+
+    private:
+        // who an fd belongs to: a table seat, or nobody yet (hello or queue)
+        struct Owner {
+            Table* table = nullptr;
+            int seat = -1;
+        };
+
+        int pollTimeout() const {
+            if (bots_thinking_ > 0) return kBotPollMs;
+            if (!queue_.empty() && opt_.pair_wait_ms > 0) {
+                auto due = queue_.front().since + chrono::milliseconds(opt_.pair_wait_ms);
+                auto left = chrono::duration_cast<chrono::milliseconds>(due - Clock::now()).count();
+                return left > 0 ? static_cast<int>(left) : 0;
+            }
+            return 1000;
+        }
+
+        void accept_client() {
+            int fd = accept(listener_, nullptr, nullptr);
+            if (fd < 0) {
+                fprintf(stderr, "[hostd] accept error: %s\n", strerror(errno));
+                return;
+            }
+            auto conn = FramedConnection::open(
+                reactor_, fd, [this](FramedConnection& c, const string& frame) { readable(c.fd(), frame); },
+                [this](FramedConnection& c) { disconnected(c.fd()); });
+            if (!conn) return;
+            conns_[fd] = std::move(conn);
+            owners_[fd] = {};
+            host_metrics().clients.add(1);
+        }
+
+        void readable(int fd, const string& frame) {
+            auto it = owners_.find(fd);
+            if (it == owners_.end()) return; // dropped while handling an earlier frame
+            if (frame.size() > kMaxAnswer) {
+                disconnected(fd);
+                return;
+            }
+            Owner owner = it->second;
+            if (owner.table) answer(*owner.table, owner.seat, frame);
+            else hello(fd, frame);
+        }
+
+        // false once the client is gone or too far behind
+        bool send_to(int fd, const string& frame) {
+            auto it = conns_.find(fd);
+            return it != conns_.end() && it->second->send(frame);
+        }
+
+        void hello(int fd, const string& frame) {
+            for (const Waiting& w : queue_) {
+                if (w.fd == fd) return; // already queued, nothing to say until seated
+            }
+            string act, content, name;
+            parse_frame(frame, act, content);
+            if (act != "USER") {
+                drop(fd);
+                return;
+            }
+            int version = 1;
+            parse_hello(content, name, version);
+            int proto = std::min(version, BIGTWO_PROTO);
+            string reply = "USER hostd";
+            if (proto >= 2) reply += " " + to_string(proto);
+            if (!send_to(fd, reply)) {
+                drop(fd);
+                return;
+            }
+            queue_.push_back({fd, name, proto, Clock::now()});
+            if (proto < 2) send_to(fd, "MSG Waiting for an opponent...\n");
+        }
+
+        void seat_waiting() {
+            while (opt_.pair_wait_ms > 0 && queue_.size() >= 2) {
+                Waiting a = queue_.front(); queue_.pop_front();
+                Waiting b = queue_.front(); queue_.pop_front();
+                open_table({a.fd, a.name, a.proto}, {b.fd, b.name, b.proto});
+            }
+            const auto now = Clock::now();
+            while (!queue_.empty() && now - queue_.front().since >= chrono::milliseconds(opt_.pair_wait_ms)) {
+                Waiting a = queue_.front(); queue_.pop_front();
+                open_table({a.fd, a.name, a.proto}, {-1, "Bot", BIGTWO_PROTO});
+            }
+        }
+
+        void open_table(const Seat& a, const Seat& b) {
+            auto t = make_unique<Table>();
+            t->id = ++next_table_;
+            t->seat[0] = a;
+            t->seat[1] = b;
+            t->seed = new_deal_seed();
+            hand_mask dealt[3];
+            state& w = t->world;
+            w.whose_turn = init(dealt, t->seed);
+            w.playerHand[0] = dealt[0];
+            w.playerHand[1] = dealt[1];
+            w.field = {-1, make_card(0, 3)};
+            w.pass = false;
+            t->record.hand[0] = dealt[0];
+            t->record.hand[1] = dealt[1];
+            t->record.first = w.whose_turn;
+            t->record.bot = b.fd < 0;
+            for (int s = 0; s < 2; s++) {
+                w.players[s] = t->seat[s].name;
+                if (t->seat[s].fd >= 0) owners_[t->seat[s].fd] = {t.get(), s};
+            }
+            cout << "[hostd] table " << t->id << ": " << a.name << " vs " << b.name << " (seed " << t->seed << ")" << endl;
+            Table& table = *t;
+            tables_.push_back(std::move(t));
+            host_metrics().tables.add(1);
+            for (int s = 0; s < 2; s++) {
+                tell(table, s, "MSG You are seated at table " + to_string(table.id) + " against " +
+                               table.seat[1 - s].name + ".\n");
+            }
+            begin_turn(table);
+        }
+
+        void tell(Table& t, int s, const string& frame) {
+            if (t.over || t.seat[s].fd < 0) return;
+            if (!send_to(t.seat[s].fd, frame)) forfeit(t, s);
+        }
+
+        void begin_turn(Table& t) {
+            if (t.over) return;
+            state& w = t.world;
+            const int me = w.whose_turn;
+            const int opp_cards = hand_size(w.playerHand[1 - me]);
+            if (t.seat[me].fd < 0) {
+                bot_view view{w.playerHand[me], w.played, opp_cards, w.field};
+                t.thinking = bot_choose(view, opt_.budget_ms);
+                bots_thinking_++;
+                return;
+            }
+            if (t.seat[me].proto >= 2) {
+                tell(t, me, encode_state_frame(w.playerHand[me], w.field, opp_cards));
+                tell(t, me, "ASK");
+            } else {
+                tell(t, me, "MSG " + render_state(w.playerHand[me], w.field, opp_cards));
+                tell(t, me, "PROMPT " MOVE_PROMPT);
+            }
+        }
+
+        void reject(Table& t, int s, const string& code) {
+            if (t.seat[s].proto >= 2) tell(t, s, "REJECT " + code);
+            else tell(t, s, "MSG " + reject_text(code));
+        }
+
+        // the seat on move answered; same rules as host_game
+        void answer(Table& t, int s, const string& input) {
+            state& w = t.world;
+            if (t.over) return;
+            if (s != w.whose_turn) {
+                if (input == "surrender") finish(t, 1 - s, "MSG " + w.players[s] + " surrendered. " + w.players[1 - s] + " wins!\n");
+                else reject(t, s, "turn");
+                return;
+            }
+            if (input == "surrender") {
+                finish(t, 1 - s, "MSG " + w.players[s] + " surrendered. " + w.players[1 - s] + " wins!\n");
+                return;
+            }
+            if (input == "pass") {
+                apply(t, 0);
+                return;
+            }
+            hand_mask move = 0;
+            if (!parse_move_indices(w.playerHand[s], input, move) || !move) {
+                reject(t, s, "index");
+                begin_turn(t);
+                return;
+            }
+            combo kind = checkMove(move);
+            if (kind.mode == -1) {
+                reject(t, s, "combo");
+                begin_turn(t);
+                return;
+            }
+            if (w.field.mode != -1 && !combo_beats(kind.strength, w.field.strength)) {
+                reject(t, s, "field");
+                begin_turn(t);
+                return;
+            }
+            apply(t, move, kind);
+        }
+
+        // cards == 0 is a pass, which clears the field
+        void apply(Table& t, hand_mask cards, const combo& kind = {-1, 0}) {
+            state& w = t.world;
+            const int me = w.whose_turn;
+            t.record.moves.push_back(cards);
+            if (!cards) {
+                w.field = {-1, 0};
+                tell(t, 1 - me, "MSG " + w.players[me] + " passes.\n");
+            } else {
+                w.playerHand[me] &= ~cards;
+                w.played |= cards;
+                w.field = kind;
+                string shown = "MSG " + w.players[me] + " plays:\n";
+                for (hand_mask c = cards; c; c &= c - 1) shown += introduceCard(lowest_card(c));
+                tell(t, 1 - me, shown);
+                if (!w.playerHand[me]) {
+                    finish(t, me, "MSG " + w.players[me] + " wins!\n");
+                    return;
+                }
+            }
+            w.whose_turn = 1 - me;
+            begin_turn(t);
+        }
+
+        void collect_bots() {
+            if (!bots_thinking_) return;
+            for (auto& t : tables_) {
+                if (!t->thinking.valid()) continue;
+                if (t->thinking.wait_for(chrono::seconds(0)) != future_status::ready) continue;
+                hand_mask cards = t->thinking.get();
+                bots_thinking_--;
+                if (t->over) continue;
+                apply(*t, cards, cards ? checkMove(cards) : combo{-1, 0});
+            }
+        }
+
+        void finish(Table& t, int winner, const string& banner) {
+            if (t.over) return;
+            // a failed send forfeits that seat, which finishes the table itself
+            for (int s = 0; s < 2 && !t.over; s++) tell(t, s, banner);
+            for (int s = 0; s < 2 && !t.over; s++) tell(t, s, s == winner ? "GAMESESS WIN B\n" : "GAMESESS LOSE B\n");
+            if (t.over) return;
+            t.over = true;
+            t.world.winner = winner;
+            t.record.winner = winner;
+            t.record.surrender = t.world.playerHand[winner] != 0;
+            game_records().append(t.record);
+            cout << "[hostd] table " << t.id << ": " << t.world.players[winner] << " beat "
+                 << t.world.players[1 - winner] << endl;
+            finished_++;
+            host_metrics().finished.add();
+        }
+
+        // a seat that can't be reached any more loses the table
+        void forfeit(Table& t, int s) {
+            if (t.over) return;
+            Seat gone = t.seat[s];
+            t.seat[s].fd = -2; // no more frames to it; not the bot either
+            host_metrics().forfeits.add();
+            finish(t, 1 - s, "MSG Your opponent disconnected. You win by surrender.\n");
+            if (gone.fd >= 0) drop(gone.fd);
+        }
+
+        void disconnected(int fd) {
+            auto it = owners_.find(fd);
+            if (it != owners_.end() && it->second.table) {
+                Table& t = *it->second.table;
+                forfeit(t, it->second.seat);
+                return;
+            }
+            drop(fd);
+        }
+
+        // drain_ms > 0 lets what is queued for fd go out first
+        void drop(int fd, int drain_ms = 0) {
+            for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+                if (it->fd == fd) { queue_.erase(it); break; }
+            }
+            owners_.erase(fd);
+            auto it = conns_.find(fd);
+            if (it == conns_.end()) return;
+            if (drain_ms > 0) it->second->close_after_flush(drain_ms);
+            else it->second->close();
+            conns_.erase(it);
+            host_metrics().clients.add(-1);
+        }
+
+        // finished tables whose bot is not still searching
+        void reap() {
+            for (size_t i = 0; i < tables_.size();) {
+                Table& t = *tables_[i];
+                if (!t.over || t.thinking.valid()) { i++; continue; }
+                for (const Seat& seat : t.seat) {
+                    if (seat.fd >= 0) drop(seat.fd, kCloseDrainMs);
+                }
+                tables_[i] = std::move(tables_.back());
+                tables_.pop_back();
+                host_metrics().tables.add(-1);
+            }
+        }
+
+        Options opt_;
+        Reactor reactor_;
+        int listener_ = -1;
+        unordered_map<int, shared_ptr<FramedConnection>> conns_;
+        unordered_map<int, Owner> owners_;
+        deque<Waiting> queue_;
+        vector<unique_ptr<Table>> tables_;
+        int next_table_ = 0;
+        int bots_thinking_ = 0;
+        int finished_ = 0;
+    };
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        fprintf(stderr, "usage: %s [--ip IP] [--port PORT] [--pair-wait-ms MS] [--budget-ms MS] [--metrics-port P]\n",
+                argv[0]);
+        return 2;
+    }
+    install_signal_handlers();
+    MetricsHttpServer metrics_http;
+    if (opt.metrics_port >= 0) {
+        uint16_t mport = static_cast<uint16_t>(opt.metrics_port);
+        if (!metrics_http.start(opt.ip.c_str(), mport)) {
+            fprintf(stderr, "[hostd] unable to open the metrics port\n");
+            return 1;
+        }
+    }
+    Host host(opt);
+    return host.run();
+}
@@ -0,0 +1,123 @@
+// CPython extension "bigtwo_native": the engine's combo rules for server.py,
+// on the same card labels its JSON protocol uses ("3C", "10H", "AS").
+//
+//   classify(cards)          -> {"kind", "cards", "strength"} or None if no combo
+//   beats(a, b)              -> True if play a may follow play b
+//   legal_moves(hand, field) -> every play from hand that may follow field
+//                               (field None or [] leads), each a sorted label list
+//
+// A bad label raises ValueError with server.py's message. Build next to server.py:
+//   g++ -std=c++20 -O2 -shared -fPIC $(python3-config --includes) -pthread
+//       -o bigtwo_native$(python3-config --extension-suffix)
+//       bigtwo_native.cpp game.cpp tools.cpp game_record.cpp bot.cpp ../core/common.cpp
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <string>
+#include <vector>
+#include "game_engine.h"
+using namespace std;
+
+namespace {
+    // a list (or any sequence) of labels to a hand; false with a Python error set
+    bool to_mask(PyObject* seq, hand_mask& out) {
+        out = 0;
+        if (seq == Py_None) return true;
+        PyObject* items = PySequence_Fast(seq, "cards must be a sequence of labels");
+        if (!items) return false;
+        const Py_ssize_t n = PySequence_Fast_GET_SIZE(items);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            const char* label = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(items, i));
+            card c;
+            string error;
+            if (!label || !parse_card_label(label, c, error)) {
+                if (label) PyErr_SetString(PyExc_ValueError, error.c_str());
+                Py_DECREF(items);
+                return false;
+            }
+            if (out & card_bit(c)) {
+                PyErr_Format(PyExc_ValueError, "duplicate card %s", card_label(c).c_str());
+                Py_DECREF(items);
+                return false;
+            }
+            out |= card_bit(c);
+        }
+        Py_DECREF(items);
+        return true;
+    }
+
+    PyObject* to_list(hand_mask h) {
+        PyObject* list = PyList_New(hand_size(h));
+        if (!list) return nullptr;
+        Py_ssize_t i = 0;
+        for (; h; h &= h - 1) PyList_SET_ITEM(list, i++, PyUnicode_FromString(card_label(lowest_card(h)).c_str()));
+        return list;
+    }
+
+    PyObject* classify(PyObject*, PyObject* arg) {
+        hand_mask cards;
+        if (!to_mask(arg, cards)) return nullptr;
+        const combo c = checkMove(cards);
+        if (!cards || c.mode == -1) Py_RETURN_NONE;
+        PyObject* list = to_list(cards);
+        if (!list) return nullptr;
+        return Py_BuildValue("{s:s,s:N,s:I}", "kind", combo_kind(c.mode), "cards", list, "strength", c.strength);
+    }
+
+    // a play that must be a combo; false with ValueError otherwise
+    bool to_combo(PyObject* seq, combo& out) {
+        hand_mask cards;
+        if (!to_mask(seq, cards)) return false;
+        out = checkMove(cards);
+        if (cards && out.mode != -1) return true;
+        PyErr_SetString(PyExc_ValueError, "invalid combo");
+        return false;
+    }
+
+    PyObject* beats(PyObject*, PyObject* args) {
+        PyObject *a, *b;
+        if (!PyArg_ParseTuple(args, "OO", &a, &b)) return nullptr;
+        combo ca, cb;
+        if (!to_combo(a, ca) || !to_combo(b, cb)) return nullptr;
+        return PyBool_FromLong(combo_beats(ca.strength, cb.strength));
+    }
+
+    PyObject* legal_moves(PyObject*, PyObject* args) {
+        PyObject* hand_arg;
+        PyObject* field_arg = Py_None;
+        if (!PyArg_ParseTuple(args, "O|O", &hand_arg, &field_arg)) return nullptr;
+        hand_mask hand, field_cards;
+        if (!to_mask(hand_arg, hand) || !to_mask(field_arg, field_cards)) return nullptr;
+        combo field{-1, 0};
+        if (field_cards && !to_combo(field_arg, field)) return nullptr;
+        static thread_local vector<play> moves(kMaxMoves);
+        int n;
+        Py_BEGIN_ALLOW_THREADS
+        n = generate_moves(hand, field, moves.data(), kMaxMoves);
+        Py_END_ALLOW_THREADS
+        PyObject* list = PyList_New(n);
+        if (!list) return nullptr;
+        for (int i = 0; i < n; i++) {
+            PyObject* cards = to_list(moves[i].cards);
+            if (!cards) {
+                Py_DECREF(list);
+                return nullptr;
+            }
+            PyList_SET_ITEM(list, i, cards);
+        }
+        return list;
+    }
+
+    PyMethodDef kMethods[] = {
+        {"classify", classify, METH_O, "classify(cards) -> {kind, cards, strength} or None"},
+        {"beats", beats, METH_VARARGS, "beats(a, b) -> whether play a may follow play b"},
+        {"legal_moves", legal_moves, METH_VARARGS, "legal_moves(hand, field=None) -> list of plays"},
+        {nullptr, nullptr, 0, nullptr},
+    };
+
+    PyModuleDef kModule = {PyModuleDef_HEAD_INIT, "bigtwo_native", "BigTwo combo rules from game.cpp", -1, kMethods,
+                         nullptr, nullptr, nullptr, nullptr};
+}
+
+PyMODINIT_FUNC PyInit_bigtwo_native() {
+    return PyModule_Create(&kModule);
+}
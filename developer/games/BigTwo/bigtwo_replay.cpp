@@ -0,0 +1,142 @@
+// Reads game record files (game_record.h), replays every game under the
+// rules and reports how many were valid and how fast they went through.
+//
+//   bigtwo_replay [--dump N] FILE...
+//
+// --dump prints the first N games move by move. Exits 1 if any game broke
+// the rules or a file holds a damaged record; a record cut short at the end
+// of a file (a host still writing) is only reported.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "game_engine.h"
+#include "game_record.h"
+using namespace std;
+
+namespace {
+    struct Stats {
+        uint64_t games = 0, moves = 0, invalid = 0, damaged = 0, truncated = 0, bytes = 0;
+        uint64_t wins[2] = {0, 0};
+    };
+
+    string labels(hand_mask cards) {
+        static const char* rankLabel[13] = {"3", "4", "5", "6", "7", "8", "9", "10", "J", "Q", "K", "A", "2"};
+        static const char suitLabel[4] = {'C', 'D', 'H', 'S'};
+        string out;
+        for (; cards; cards &= cards - 1) {
+            card c = lowest_card(cards);
+            if (!out.empty()) out += ' ';
+            out += rankLabel[card_rank(c)];
+            out += suitLabel[card_suit(c)];
+        }
+        return out;
+    }
+
+    void dump(const game_record& rec, uint64_t index, bool valid) {
+        printf("game %llu: seat %d first, seat %d won%s%s%s\n", static_cast<unsigned long long>(index),
+               rec.first, rec.winner, rec.surrender ? " by surrender" : "", rec.bot ? ", seat 1 the bot" : "",
+               valid ? "" : "  ** INVALID **");
+        printf("  deal 0: %s\n  deal 1: %s\n", labels(rec.hand[0]).c_str(), labels(rec.hand[1]).c_str());
+        int turn = rec.first;
+        for (hand_mask cards : rec.moves) {
+            printf("  %d: %s\n", turn, cards ? labels(cards).c_str() : "pass");
+            turn ^= 1;
+        }
+    }
+
+    bool replayFile(const char* path, Stats& stats, uint64_t dumpLeft) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        size_t len = static_cast<size_t>(st.st_size);
+        if (len == 0) {
+            close(fd);
+            return true;
+        }
+        void* map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+            return false;
+        }
+        madvise(map, len, MADV_SEQUENTIAL);
+        const uint8_t* p = static_cast<const uint8_t*>(map);
+        const uint8_t* end = p + len;
+        game_record rec;
+        while (p < end) {
+            long used = decode_game_record(p, static_cast<size_t>(end - p), rec);
+            if (used == 0) {
+                stats.truncated++;
+                break;
+            }
+            if (used < 0) {
+                // lengths cannot be trusted past this point
+                fprintf(stderr, "%s: damaged record at byte %zu\n", path, static_cast<size_t>(p - static_cast<const uint8_t*>(map)));
+                stats.damaged++;
+                break;
+            }
+            p += used;
+            bool valid = validate_game_record(rec);
+            if (stats.games < dumpLeft) dump(rec, stats.games, valid);
+            stats.games++;
+            stats.moves += rec.moves.size();
+            if (valid) stats.wins[rec.winner]++;
+            else stats.invalid++;
+        }
+        stats.bytes += len;
+        munmap(map, len);
+        return true;
+    }
+
+    void usage() {
+        fprintf(stderr, "usage: bigtwo_replay [--dump N] FILE...\n");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t dumpGames = 0;
+    vector<const char*> files;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--dump")) {
+            if (i + 1 >= argc) {
+                usage();
+                return 2;
+            }
+            dumpGames = strtoull(argv[++i], nullptr, 10);
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty()) {
+        usage();
+        return 2;
+    }
+
+    Stats stats;
+    bool ok = true;
+    auto t0 = chrono::steady_clock::now();
+    for (const char* f : files) ok = replayFile(f, stats, dumpGames) && ok;
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    double games = static_cast<double>(stats.games);
+    printf("%llu games, %llu moves, %llu bytes (%.1f per game) in %.3fs: %.0f games/s\n",
+           static_cast<unsigned long long>(stats.games), static_cast<unsigned long long>(stats.moves),
+           static_cast<unsigned long long>(stats.bytes), games ? static_cast<double>(stats.bytes) / games : 0.0,
+           secs, secs > 0 ? games / secs : 0.0);
+    printf("seat 0 won %llu, seat 1 won %llu; invalid %llu, damaged %llu, cut short %llu\n",
+           static_cast<unsigned long long>(stats.wins[0]), static_cast<unsigned long long>(stats.wins[1]),
+           static_cast<unsigned long long>(stats.invalid), static_cast<unsigned long long>(stats.damaged),
+           static_cast<unsigned long long>(stats.truncated));
+    return ok && !stats.invalid && !stats.damaged ? 0 : 1;
+}
@@ -0,0 +1,573 @@
+// Room server for the platform launcher: the manifest's server.command, with
+// the arguments, token environment, newline-JSON protocol and rules of
+// server.py, played on the bitmask hands of the engine (game.cpp).
+//
+//   bigtwo_server --port PORT --room ID --p1 NAME --p2 NAME
+//                 [--report_host HOST --report_port PORT] [--bind_host IP] [--match_id ID]
+//                 [--client_token T | --client_token_path F] [--report_token T | --report_token_path F]
+//                 [--rules server|engine]
+//
+// Tokens and the match id fall back to CLIENT_TOKEN(_PATH), REPORT_TOKEN(_PATH)
+// and MATCH_ID; a server missing any of them exits with 2.
+//
+// Clients send a hello {"client_token","match_id","room_id","role","player_name"}
+// and get {"ok":true,..} or {"ok":false,"reason"}. Once both named players are
+// in, the seat on move gets {"type":"state",..,"your_turn":true} and answers
+// {"type":"play","cards":["3C","10H"]}, {"type":"pass"} or {"type":"surrender"};
+// a refused answer gets {"type":"error","message"} and the state again. After
+// every move both players and all spectators get the new state, and at the end
+// {"type":"game_over","winner","reason"}. Progress goes to the report port as
+// GAME.REPORT lines (STARTED, HEARTBEAT every 10 s, END, ERROR).
+//
+// The rules are server.py's unless --rules engine asks otherwise. Each seat
+// gets 13 cards of a shuffled deck, and the holder of the 3 of Clubs (else
+// p1) leads. Plays are singles, pairs, full houses, four of a kind with a
+// kicker, straights of five consecutive ranks from 34567 to JQKA2, and
+// straight flushes; a flush is not a play. A play follows one of its own kind
+// with a higher top card, and four of a kind or a straight flush beat any
+// lower kind of five but never one of their own. With --rules engine the deal
+// and the combos are init() and checkMove() instead: 17 cards a seat plus the
+// 52nd to the seat without the 3 of Clubs, flushes are a play, and a
+// five-card play may beat a lower five-card category.
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "config.h"
+#include "game_engine.h"
+#include "../core/json_lines.hpp"
+using namespace std;
+
+namespace {
+    constexpr int kHeartbeatMs = 10000;
+    constexpr int kHelloTimeoutMs = 5000;   // a connection that says nothing this long is closed
+    constexpr int kReportTimeoutS = 3;
+    constexpr size_t kMaxLine = 4096;
+    constexpr int kServerPyHand = 13;
+    constexpr hand_mask kSuitMask = 0x1111111111111ull; // one bit per rank
+
+    using Clock = chrono::steady_clock;
+
+    // ["3C", "10H"] of the cards of a mask, lowest first
+    void write_cards(jsonl::JsonWriter& w, hand_mask h) {
+        w.begin_array();
+        for (; h; h &= h - 1) w.str(card_label(lowest_card(h)));
+        w.end();
+    }
+
+    // server.py's deal: Fisher-Yates on the 52 ids, the first 13 to p1 and the
+    // next 13 to p2; returns the seat holding the 3 of Clubs, 0 if neither does
+    int deal_server_py(hand_mask (&hands)[2], uint64_t seed) {
+        deal_rng rng{seed};
+        array<card, 52> deck;
+        for (int i = 0; i < 52; i++) deck[i] = static_cast<card>(i);
+        for (uint32_t i = 51; i > 0; i--) std::swap(deck[i], deck[rng.below(i + 1)]);
+        for (int s = 0; s < 2; s++) {
+            hands[s] = 0;
+            for (int i = kServerPyHand * s; i < kServerPyHand * (s + 1); i++) hands[s] |= card_bit(deck[i]);
+        }
+        return (hands[1] & card_bit(make_card(0, 0))) ? 1 : 0;
+    }
+
+    // server.py's classify_combo. Its kinds and COMBO_ORDER happen to be
+    // checkMove's modes 1-6, and its weight (rank, suit) orders as the card id,
+    // so strength is the card count over the id of the top card.
+    combo classify_server_py(hand_mask move) {
+        const int n = hand_size(move);
+        auto make = [n](int mode, card top) { return combo{mode, top, (static_cast<uint32_t>(n) << 29) | top}; };
+        if (n == 1) return make(1, lowest_card(move));
+        if (n == 2) {
+            if (card_rank(lowest_card(move)) != card_rank(highest_card(move))) return {-1, 0};
+            return make(2, highest_card(move));
+        }
+        if (n != 5) return {-1, 0};
+        unsigned present = 0;
+        int top_count = 0, top_rank = 0;
+        for (int r = 0; r < 13; r++) {
+            const int cnt = std::popcount((move >> (4 * r)) & 0xF);
+            if (!cnt) continue;
+            present |= 1u << r;
+            if (cnt > top_count) { top_count = cnt; top_rank = r; }
+        }
+        const hand_mask top_rank_cards = move & (hand_mask{0xF} << (4 * top_rank));
+        if (top_count == 3 && std::popcount(present) == 2) return make(3, highest_card(top_rank_cards));
+        if (top_count == 4) return make(5, highest_card(top_rank_cards));
+        if (top_count == 1 && (present >> std::countr_zero(present)) == 0x1F) { // nothing wraps past the 2
+            const card top = highest_card(move);
+            const bool flush = (move & (kSuitMask << card_suit(top))) == move;
+            return make(flush ? 6 : 4, top);
+        }
+        return {-1, 0};
+    }
+
+    // server.py's beats(), the card counts already equal
+    bool beats_server_py(const combo& play, const combo& field) {
+        if (play.mode > 4) return play.mode > field.mode;
+        return play.mode == field.mode && play.strength > field.strength;
+    }
+
+    struct Options {
+        string bind_host = "0.0.0.0";
+        string port;
+        int room_id = 0;
+        string players[2];
+        string match_id, client_token, report_token;
+        string report_host, report_port;
+        bool engine_rules = false; // --rules engine
+    };
+
+    string read_secret_file(const string& path) {
+        ifstream in(path);
+        string line;
+        getline(in, line);
+        const size_t b = line.find_first_not_of(" \t\r\n");
+        if (b == string::npos) return "";
+        return line.substr(b, line.find_last_not_of(" \t\r\n") - b + 1);
+    }
+
+    // as server.py: the flag, the file named by the path flag, the variable, the file named by *_PATH
+    string resolve_secret(const string& flag, const string& flag_path, const char* env, const char* path_env) {
+        if (!flag.empty()) return flag;
+        if (!flag_path.empty()) return read_secret_file(flag_path);
+        if (const char* v = getenv(env); v && *v) return v;
+        if (const char* p = getenv(path_env); p && *p) return read_secret_file(p);
+        return "";
+    }
+
+    bool parseArgs(int argc, char** argv, Options& opt) {
+        map<string, string> args;
+        for (int i = 1; i < argc; i++) {
+            string a = argv[i];
+            if (a.rfind("--", 0) != 0) return false;
+            a = a.substr(2);
+            if (size_t eq = a.find('='); eq != string::npos) {
+                args[a.substr(0, eq)] = a.substr(eq + 1);
+            } else {
+                if (i + 1 >= argc) return false;
+                args[a] = argv[++i];
+            }
+        }
+        auto arg = [&](const string& k) { return args.count(k) ? args[k] : string(); };
+        const char* bind = getenv("BIND_HOST");
+        const char* match = getenv("MATCH_ID");
+        opt.port = arg("port");
+        opt.room_id = atoi(arg("room").c_str());
+        opt.players[0] = arg("p1");
+        opt.players[1] = arg("p2");
+        opt.bind_host = args.count("bind_host") ? args["bind_host"] : bind && *bind ? bind : "0.0.0.0";
+        opt.match_id = args.count("match_id") ? args["match_id"] : match ? match : "";
+        opt.client_token = resolve_secret(arg("client_token"), arg("client_token_path"), "CLIENT_TOKEN", "CLIENT_TOKEN_PATH");
+        opt.report_token = resolve_secret(arg("report_token"), arg("report_token_path"), "REPORT_TOKEN", "REPORT_TOKEN_PATH");
+        opt.report_host = arg("report_host");
+        opt.report_port = arg("report_port");
+        const string rules = args.count("rules") ? args["rules"] : "server";
+        if (rules != "server" && rules != "engine") return false;
+        opt.engine_rules = rules == "engine";
+        return !opt.port.empty() && args.count("room") && !opt.players[0].empty() && !opt.players[1].empty();
+    }
+
+    // one connection per report line, as server.py does
+    bool send_report(const string& host, const string& port, const string& line) {
+        addrinfo hints{}, *res = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return false;
+        bool sent = false;
+        for (addrinfo* ai = res; ai && !sent; ai = ai->ai_next) {
+            int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) continue;
+            timeval tv{kReportTimeoutS, 0};
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv); // connect() honours it too
+            sent = connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 && send_msg(fd, line);
+            close(fd);
+        }
+        freeaddrinfo(res);
+        return sent;
+    }
+
+    class Room {
+    public:
+        explicit Room(const Options& opt) : opt_(opt) {
+            w_.players = {opt.players[0], opt.players[1]};
+            w_.playerHand[0] = w_.playerHand[1] = 0;
+            w_.field = {-1, 0};
+            w_.whose_turn = 0;
+            w_.pass = false;
+        }
+
+        int run() {
+            listener_ = getListeningSocket(opt_.bind_host, opt_.port, "TCP");
+            if (listener_ == -1) {
+                fprintf(stderr, "[bigtwo_server] unable to listen on %s:%s\n", opt_.bind_host.c_str(), opt_.port.c_str());
+                report("ERROR", -1, "", "unable to listen", false);
+                return 1;
+            }
+            cout << "[bigtwo_server] BigTwo listening on " << opt_.bind_host << ":" << opt_.port << " room=" << opt_.room_id << endl;
+            report("STARTED", -1, "", "", true);
+            auto next_heartbeat = Clock::now() + chrono::milliseconds(kHeartbeatMs);
+            vector<pollfd> pfds;
+            while (running && !over_) {
+                pfds.clear();
+                pfds.push_back({listener_, POLLIN, 0});
+                for (const auto& c : conns_) pfds.push_back({c->fd, POLLIN, 0});
+                const auto left = chrono::duration_cast<chrono::milliseconds>(next_heartbeat - Clock::now()).count();
+                int rc = poll(pfds.data(), pfds.size(), static_cast<int>(std::clamp<long long>(left, 0, 1000)));
+                if (rc < 0 && errno != EINTR) {
+                    perror("poll");
+                    break;
+                }
+                for (size_t i = 1; rc > 0 && i < pfds.size(); i++) {
+                    if (pfds[i].revents) readable(*conns_[i - 1]);
+                }
+                if (rc > 0 && (pfds[0].revents & POLLIN)) accept_client();
+                const auto now = Clock::now();
+                for (auto& c : conns_) {
+                    if (c->seat < 0 && !c->spectator && now - c->since > chrono::milliseconds(kHelloTimeoutMs)) c->dead = true;
+                }
+                reap();
+                if (!over_ && now >= next_heartbeat) {
+                    next_heartbeat = now + chrono::milliseconds(kHeartbeatMs);
+                    report("HEARTBEAT", -1, "heartbeat", "", true);
+                }
+            }
+            if (!over_) report("ERROR", -1, "", "interrupted", false);
+            for (auto& c : conns_) close(c->fd);
+            close(listener_);
+            return 0;
+        }
+
+    private:
+        struct Conn {
+            int fd = -1;
+            int seat = -1;          // 0 or 1 once a player
+            bool spectator = false;
+            string name;
+            jsonl::LineBuffer in;
+            Clock::time_point since;
+            bool dead = false;
+        };
+
+        void accept_client() {
+            int fd = accept(listener_, nullptr, nullptr);
+            if (fd < 0) {
+                fprintf(stderr, "[bigtwo_server] accept error: %s\n", strerror(errno));
+                return;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one); // an error and its state go out as two writes
+            auto c = make_unique<Conn>();
+            c->fd = fd;
+            c->since = Clock::now();
+            conns_.push_back(std::move(c));
+        }
+
+        void readable(Conn& c) {
+            char buf[2048];
+            ssize_t n = recv(c.fd, buf, sizeof buf, 0);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) return;
+                c.dead = true;
+                return;
+            }
+            c.in.append(buf, static_cast<size_t>(n));
+            for (string_view text; !c.dead && !over_ && c.in.next(text);) line(c, text);
+            c.in.compact();
+            if (c.in.pending() > kMaxLine) c.dead = true;
+        }
+
+        // json is a whole line, newline included
+        void send(Conn& c, const string& json) {
+            if (!c.dead && !send_msg(c.fd, json)) c.dead = true;
+        }
+
+        void refuse(Conn& c, const char* reason) {
+            line_.clear();
+            jsonl::JsonWriter(line_).begin_object().key("ok").boolean(false).key("reason").str(reason).end().end_line();
+            send(c, line_);
+            c.dead = true;
+        }
+
+        void line(Conn& c, string_view text) {
+            jsonl::Value type;
+            if (!jsonl::ObjectReader::find(text, "type", type)) {
+                if (c.seat < 0 && !c.spectator) c.dead = true;
+                return;
+            }
+            if (c.seat < 0 && !c.spectator) hello(c, text);
+            else if (c.seat >= 0) answer(c, text, type);
+        }
+
+        // fields are read straight out of the line; a view of scratch_ lasts until the next read
+        void hello(Conn& c, string_view msg) {
+            using jsonl::ObjectReader;
+            if (ObjectReader::text(msg, "client_token", scratch_) != opt_.client_token) return refuse(c, "invalid client token");
+            if (ObjectReader::text(msg, "match_id", scratch_) != opt_.match_id) return refuse(c, "invalid match_id");
+            jsonl::Value room;
+            int64_t room_id = 0;
+            ObjectReader::find(msg, "room_id", room);
+            if (!room.to_int(room_id) || room_id != opt_.room_id) return refuse(c, "invalid room_id");
+            string role(ObjectReader::text(msg, "role", scratch_));
+            for (char& ch : role) ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+            const string name(ObjectReader::text(msg, "player_name", scratch_));
+            if (name.empty()) return refuse(c, "player_name required");
+            if (role == "spectator") {
+                for (const auto& o : conns_) {
+                    if (o->spectator && !o->dead && o->name == name) return refuse(c, "spectator already connected");
+                }
+                c.spectator = true;
+                c.name = name;
+                send(c, "{\"ok\": true, \"game_protocol_version\": 1}\n");
+                cout << "[bigtwo_server] spectator " << name << " connected" << endl;
+                return;
+            }
+            if (started_) return refuse(c, "spectators only");
+            int seat = -1;
+            for (int s = 0; s < 2; s++) {
+                if (name == w_.players[s] && !seat_conn(s)) { seat = s; break; }
+            }
+            if (seat < 0) return refuse(c, "bad player");
+            c.seat = seat;
+            c.name = name;
+            send(c, "{\"ok\": true, \"assigned_player_index\": " + to_string(seat) + ", \"game_protocol_version\": 1}\n");
+            cout << "[bigtwo_server] " << name << " connected" << endl;
+            if (seat_conn(0) && seat_conn(1)) start();
+        }
+
+        Conn* seat_conn(int s) {
+            for (auto& c : conns_) {
+                if (c->seat == s && !c->dead) return c.get();
+            }
+            return nullptr;
+        }
+
+        void start() {
+            started_ = true;
+            seed_ = new_deal_seed();
+            if (opt_.engine_rules) {
+                hand_mask dealt[3];
+                w_.whose_turn = init(dealt, seed_);
+                w_.playerHand[0] = dealt[0];
+                w_.playerHand[1] = dealt[1];
+            } else {
+                w_.whose_turn = deal_server_py(w_.playerHand, seed_);
+            }
+            cout << "[bigtwo_server] " << w_.players[0] << " vs " << w_.players[1] << " (seed " << seed_
+                 << (opt_.engine_rules ? ", engine rules" : "") << ")" << endl;
+            begin_turn();
+        }
+
+        void begin_turn() {
+            if (Conn* c = seat_conn(w_.whose_turn)) send(*c, state_line(w_.whose_turn, true));
+        }
+
+        void write_hand_counts(jsonl::JsonWriter& w) const {
+            w.begin_object();
+            for (int s = 0; s < 2; s++) w.key(w_.players[s]).num(int64_t{hand_size(w_.playerHand[s])});
+            w.end();
+        }
+
+        // "last_combo" and "last_player"
+        void write_field(jsonl::JsonWriter& w) const {
+            if (w_.field.mode == -1) {
+                w.key("last_combo").null().key("last_player").null();
+                return;
+            }
+            w.key("last_combo").begin_object().key("kind").str(combo_kind(w_.field.mode)).key("cards");
+            write_cards(w, field_cards_);
+            w.end().key("last_player").str(w_.players[field_seat_]);
+        }
+
+        // built in line_, which keeps its capacity from move to move
+        const string& state_line(int s, bool your_turn) {
+            line_.clear();
+            jsonl::JsonWriter w(line_);
+            w.begin_object().key("type").str("state").key("you").str(w_.players[s]).key("your_turn").boolean(your_turn);
+            w.key("hand");
+            write_cards(w, w_.playerHand[s]);
+            w.key("hand_counts");
+            write_hand_counts(w);
+            write_field(w);
+            w.key("first_turn").boolean(moves_ == 0).end().end_line();
+            return line_;
+        }
+
+        void error(Conn& c, const string& message) {
+            line_.clear();
+            jsonl::JsonWriter(line_).begin_object().key("type").str("error").key("message").str(message).end().end_line();
+            send(c, line_);
+            if (c.seat == w_.whose_turn) send(c, state_line(c.seat, true));
+        }
+
+        // same checks as host_game, with server.py's messages
+        void answer(Conn& c, string_view msg, const jsonl::Value& type_value) {
+            if (!started_ || over_) return;
+            const string type = type_value.kind == jsonl::Kind::String ? string(type_value.str(scratch_)) : string();
+            if (type == "surrender") return finish(1 - c.seat, "surrender");
+            if (c.seat != w_.whose_turn) return error(c, "not your turn");
+            if (type == "pass") return apply(0, {-1, 0});
+            if (type != "play") return error(c, "unknown command");
+            hand_mask move = 0;
+            int named = 0;
+            jsonl::Value cards, label;
+            jsonl::ObjectReader::find(msg, "cards", cards);
+            for (jsonl::ArrayReader it(cards.kind == jsonl::Kind::Array ? cards.raw : "[]"); it.next(label);) {
+                card id;
+                string why;
+                if (label.kind != jsonl::Kind::String) return error(c, "bad card");
+                if (!parse_card_label(string(label.str(scratch_)), id, why)) return error(c, why);
+                move |= card_bit(id);
+                named++;
+            }
+            if (hand_size(move) != named || (move & ~w_.playerHand[c.seat])) return error(c, "cards not in hand");
+            const combo kind = opt_.engine_rules ? checkMove(move) : classify_server_py(move);
+            if (kind.mode == -1) return error(c, "invalid combo");
+            if (w_.field.mode != -1) {
+                if ((kind.strength >> 29) != (w_.field.strength >> 29)) return error(c, "must match card count");
+                const bool beats = opt_.engine_rules ? combo_beats(kind.strength, w_.field.strength)
+                                                     : beats_server_py(kind, w_.field);
+                if (!beats) return error(c, "does not beat current combo");
+            }
+            apply(move, kind);
+        }
+
+        // cards == 0 is a pass, which clears the field
+        void apply(hand_mask cards, const combo& kind) {
+            const int me = w_.whose_turn;
+            moves_++;
+            w_.field = kind;
+            field_cards_ = cards;
+            field_seat_ = me;
+            if (cards) {
+                w_.playerHand[me] &= ~cards;
+                w_.played |= cards;
+            }
+            w_.whose_turn = 1 - me;
+            broadcast();
+            if (!w_.playerHand[me]) return finish(me, "normal");
+            begin_turn();
+        }
+
+        void broadcast() {
+            string spectator;
+            jsonl::JsonWriter w(spectator);
+            w.begin_object().key("type").str("state").key("room").str(to_string(opt_.room_id)).key("hand_counts");
+            write_hand_counts(w);
+            write_field(w);
+            w.key("next_player").str(w_.players[w_.whose_turn]).end().end_line();
+            for (auto& c : conns_) {
+                if (c->seat >= 0) send(*c, state_line(c->seat, c->seat == w_.whose_turn));
+                else if (c->spectator) send(*c, spectator);
+            }
+        }
+
+        void finish(int winner, const string& reason) {
+            if (over_) return;
+            over_ = true;
+            w_.winner = winner;
+            string msg;
+            jsonl::JsonWriter(msg).begin_object().key("type").str("game_over").key("winner").str(w_.players[winner])
+                .key("reason").str(reason).end().end_line();
+            for (auto& c : conns_) {
+                if (c->seat >= 0 || c->spectator) send(*c, msg);
+            }
+            cout << "[bigtwo_server] game over, winner=" << w_.players[winner] << ", reason=" << reason << endl;
+            report("END", winner, reason, "", false);
+        }
+
+        // a player gone mid-game loses it
+        void reap() {
+            for (size_t i = 0; i < conns_.size();) {
+                if (!conns_[i]->dead) { i++; continue; }
+                const int seat = conns_[i]->seat;
+                close(conns_[i]->fd);
+                conns_.erase(conns_.begin() + static_cast<ptrdiff_t>(i));
+                if (seat >= 0 && started_) {
+                    cout << "[bigtwo_server] " << w_.players[seat] << " disconnected" << endl;
+                    finish(1 - seat, "disconnect");
+                }
+            }
+        }
+
+        // STARTED and HEARTBEAT go from a thread of their own so a slow report
+        // host never holds up a turn; END and ERROR are sent before exiting
+        void report(const string& status, int winner, const string& reason, const string& err, bool async) {
+            if (opt_.report_host.empty() || opt_.report_port.empty() || opt_.report_port == "0") return;
+            string line;
+            jsonl::JsonWriter w(line);
+            w.begin_object().key("type").str("GAME.REPORT").key("status").str(status).key("game").str("BigTwo");
+            w.key("room_id").num(int64_t{opt_.room_id}).key("match_id").str(opt_.match_id);
+            w.key("report_token").str(opt_.report_token).key("timestamp").num(
+                chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count(), 3);
+            if (status == "STARTED") w.key("port").num(int64_t{atoi(opt_.port.c_str())});
+            if (winner >= 0) w.key("winner").str(w_.players[winner]).key("loser").str(w_.players[1 - winner]);
+            if (!err.empty()) w.key("err_msg").str(err);
+            if (!reason.empty()) w.key("reason").str(reason);
+            if (status == "END") {
+                w.key("results").begin_array();
+                w.begin_object().key("player").str(w_.players[winner]).key("outcome").str("WIN").key("rank").num(int64_t{1})
+                    .key("score").null().end();
+                w.begin_object().key("player").str(w_.players[1 - winner]).key("outcome").str("LOSE").key("rank").num(int64_t{2})
+                    .key("score").null().end();
+                w.end();
+            }
+            w.key("hand_counts");
+            write_hand_counts(w);
+            w.end().end_line();
+            auto deliver = [host = opt_.report_host, port = opt_.report_port, status, line] {
+                if (!send_report(host, port, line)) {
+                    fprintf(stderr, "[bigtwo_server] report %s to %s:%s failed\n", status.c_str(), host.c_str(), port.c_str());
+                }
+            };
+            if (async) thread(deliver).detach();
+            else deliver();
+        }
+
+        Options opt_;
+        int listener_ = -1;
+        vector<unique_ptr<Conn>> conns_;
+        state w_{};
+        uint64_t seed_ = 0;         // deals this game again, with the same rules
+        hand_mask field_cards_ = 0; // the cards on the field, for last_combo
+        int field_seat_ = 0;
+        int moves_ = 0;
+        bool started_ = false;
+        bool over_ = false;
+        string line_;               // outgoing player lines, reused
+        string scratch_;            // unescaped strings of the line being read
+    };
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        fprintf(stderr, "usage: %s --port PORT --room ID --p1 NAME --p2 NAME [--report_host HOST --report_port PORT] [--rules server|engine]\n", argv[0]);
+        return 2;
+    }
+    if (opt.client_token.empty() || opt.report_token.empty() || opt.match_id.empty()) {
+        fprintf(stderr, "[bigtwo_server] missing required client_token/report_token/match_id; aborting\n");
+        return 2;
+    }
+    install_signal_handlers();
+    Room room(opt);
+    return room.run();
+}
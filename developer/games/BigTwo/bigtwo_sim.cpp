@@ -0,0 +1,607 @@
+// Headless BigTwo driver: plays seeded games between bots with no sockets or
+// terminal, reports throughput and engine latency, and can cross-check the
+// combo rules against server.py.
+//
+//   bigtwo_sim [--games N] [--threads T] [--seed S] [--a POLICY] [--b POLICY]
+//              [--budget-ms MS] [--diff-python N] [--server-py PATH] [--record PATH]
+//   bigtwo_sim --tournament POLICY,POLICY,... [--games N] [--threads T] [--seed S]
+//
+// POLICY is greedy, random or mc (the practice bot, --budget-ms per move);
+// mc:MS gives that bot its own budget. Game i always uses seed S+i, so a run
+// is reproducible at any thread count.
+// --record appends every finished game to PATH in the game_record.h format.
+// --tournament plays every pair of policies on N deals, each deal twice with
+// the hands swapped so the luck of the deal cancels, and reports Elo with a
+// bootstrap 95% interval beside each policy's think time per move. There mc
+// searches on its table's thread, so its strength does not depend on how many
+// tables share the machine.
+// Exits 1 if any play broke the rules or the Python check found an
+// unexplained disagreement.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "game_engine.h"
+#include "game_record.h"
+using namespace std;
+
+namespace {
+    constexpr int kMaxPlies = 1000;     // a game still going after this is counted unfinished
+    constexpr unsigned kSampleEvery = 32; // time one engine call in this many
+
+    enum class Policy { Greedy, Random, Mc };
+
+    bool parsePolicy(const string& s, Policy& out) {
+        if (s == "greedy") out = Policy::Greedy;
+        else if (s == "random") out = Policy::Random;
+        else if (s == "mc") out = Policy::Mc;
+        else return false;
+        return true;
+    }
+
+    // One side of a game: a policy and, for mc, its budget per move
+    struct Entrant {
+        Policy policy;
+        int budgetMs;
+        string name;
+        int id;             // index into Stats::thinkNs and friends
+        bool inlineSearch;  // mc searches on the table's thread (bot_search)
+    };
+
+    // "mc:20" or a plain policy, which takes defaultBudget
+    bool parseEntrant(const string& s, int defaultBudget, Entrant& out) {
+        const size_t colon = s.find(':');
+        out.budgetMs = defaultBudget;
+        if (!parsePolicy(s.substr(0, colon), out.policy)) return false;
+        if (colon != string::npos) {
+            if (out.policy != Policy::Mc) return false;
+            out.budgetMs = atoi(s.c_str() + colon + 1);
+            if (out.budgetMs <= 0) return false;
+        }
+        out.name = s;
+        return true;
+    }
+
+    const char* policyName(Policy p) {
+        switch (p) {
+            case Policy::Greedy: return "greedy";
+            case Policy::Random: return "random";
+            case Policy::Mc: return "mc";
+        }
+        return "?";
+    }
+
+    struct Options {
+        uint64_t games = 10000;
+        unsigned threads = 0;
+        uint64_t seed = 1;
+        Policy seat[2] = {Policy::Greedy, Policy::Random};
+        int budgetMs = 50;
+        uint64_t diffCases = 0;
+        string serverPy = "server.py";
+        string recordPath;
+        string tournament;
+    };
+
+    struct Stats {
+        uint64_t games = 0, plies = 0, unfinished = 0, violations = 0;
+        uint64_t wins[2] = {0, 0};
+        vector<uint32_t> checkNs, generateNs;
+        vector<vector<uint32_t>> thinkNs; // every move, by entrant
+        explicit Stats(size_t entrants = 2) : thinkNs(entrants) {}
+        void add(const Stats& s) {
+            games += s.games;
+            plies += s.plies;
+            unfinished += s.unfinished;
+            violations += s.violations;
+            wins[0] += s.wins[0];
+            wins[1] += s.wins[1];
+            checkNs.insert(checkNs.end(), s.checkNs.begin(), s.checkNs.end());
+            generateNs.insert(generateNs.end(), s.generateNs.begin(), s.generateNs.end());
+            for (size_t i = 0; i < thinkNs.size(); i++)
+                thinkNs[i].insert(thinkNs[i].end(), s.thinkNs[i].begin(), s.thinkNs[i].end());
+        }
+    };
+
+    uint32_t elapsedNs(chrono::steady_clock::time_point since) {
+        return static_cast<uint32_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - since).count());
+    }
+
+    class Table {
+    public:
+        Table(Stats& stats, GameRecordWriter* records)
+            : stats_(stats), records_(records), moves_(kMaxMoves) {}
+
+        // Returns the winning seat, -1 if the game broke a rule or ran too long
+        int run(uint64_t seed, const Entrant* const seats[2]) {
+            hand_mask pd[3];
+            int turn = init(pd, seed);
+            rng_.seed(seed ^ 0x9E3779B97F4A7C15ull);
+            hand_mask hands[2] = {pd[0], pd[1]};
+            hand_mask played = 0;
+            combo field = {-1, 0};
+            stats_.games++;
+            record_.hand[0] = hands[0];
+            record_.hand[1] = hands[1];
+            record_.first = turn;
+            record_.moves.clear();
+            for (int ply = 0; ply < kMaxPlies; ply++) {
+                const auto t0 = chrono::steady_clock::now();
+                hand_mask cards = choose(*seats[turn], turn, hands, played, field);
+                stats_.thinkNs[seats[turn]->id].push_back(elapsedNs(t0));
+                stats_.plies++;
+                record_.moves.push_back(cards);
+                if (!cards) {
+                    field = {-1, 0};
+                } else {
+                    combo c = timedCheck(cards);
+                    bool legal = (cards & ~hands[turn]) == 0 && c.mode != -1 &&
+                                 (field.mode == -1 || combo_beats(c.strength, field.strength));
+                    if (!legal) {
+                        stats_.violations++;
+                        return -1;
+                    }
+                    hands[turn] &= ~cards;
+                    played |= cards;
+                    field = c;
+                    if (!hands[turn]) {
+                        stats_.wins[turn]++;
+                        if (records_) {
+                            record_.winner = turn;
+                            records_->append(record_);
+                        }
+                        return turn;
+                    }
+                }
+                turn ^= 1;
+            }
+            stats_.unfinished++;
+            return -1;
+        }
+
+    private:
+        int timedGenerate(hand_mask hand, const combo& field) {
+            if (++calls_ % kSampleEvery) return generate_moves(hand, field, moves_.data());
+            auto t0 = chrono::steady_clock::now();
+            int n = generate_moves(hand, field, moves_.data());
+            stats_.generateNs.push_back(elapsedNs(t0));
+            return n;
+        }
+
+        combo timedCheck(hand_mask cards) {
+            if (++calls_ % kSampleEvery) return checkMove(cards);
+            auto t0 = chrono::steady_clock::now();
+            combo c = checkMove(cards);
+            stats_.checkNs.push_back(elapsedNs(t0));
+            return c;
+        }
+
+        hand_mask choose(const Entrant& who, int turn, const hand_mask hands[2], hand_mask played, const combo& field) {
+            const bool lead = field.mode == -1;
+            if (who.policy == Policy::Mc) {
+                bot_view view{hands[turn], played, hand_size(hands[turn ^ 1]), field};
+                return who.inlineSearch ? bot_search(view, who.budgetMs) : bot_choose(view, who.budgetMs).get();
+            }
+            int n = timedGenerate(hands[turn], field);
+            if (who.policy == Policy::Random) {
+                int pick = static_cast<int>(rng_.below(static_cast<uint32_t>(n + (lead ? 0 : 1))));
+                return pick == n ? 0 : moves_[pick].cards;
+            }
+            // greedy: shed the most cards at once, as cheaply as possible
+            if (!n) return 0;
+            int best = 0;
+            for (int i = 1; i < n; i++) {
+                uint32_t a = moves_[i].kind.strength, b = moves_[best].kind.strength;
+                if ((a >> 29) > (b >> 29) || ((a >> 29) == (b >> 29) && a < b)) best = i;
+            }
+            return moves_[best].cards;
+        }
+
+        Stats& stats_;
+        GameRecordWriter* records_;
+        game_record record_;
+        vector<play> moves_;
+        deal_rng rng_{0};
+        unsigned calls_ = 0;
+    };
+
+    void printLatency(const char* name, vector<uint32_t>& ns) {
+        if (ns.empty()) {
+            printf("%-15s no samples\n", name);
+            return;
+        }
+        sort(ns.begin(), ns.end());
+        auto at = [&](double q) { return ns[min(ns.size() - 1, static_cast<size_t>(q * static_cast<double>(ns.size())))]; };
+        printf("%-15s ns p50 %u  p90 %u  p99 %u  p99.9 %u  max %u  (%zu samples)\n",
+               name, at(0.5), at(0.9), at(0.99), at(0.999), ns.back(), ns.size());
+    }
+
+    unsigned threadCount(const Options& opt) {
+        return opt.threads ? opt.threads : max(1u, thread::hardware_concurrency());
+    }
+
+    int runGames(const Options& opt) {
+        unsigned threads = threadCount(opt);
+        const Entrant a{opt.seat[0], opt.budgetMs, policyName(opt.seat[0]), 0, false};
+        const Entrant b{opt.seat[1], opt.budgetMs, policyName(opt.seat[1]), 1, false};
+        const Entrant* const seats[2] = {&a, &b};
+        vector<Stats> stats(threads);
+        vector<thread> workers;
+        unique_ptr<GameRecordWriter> records;
+        if (!opt.recordPath.empty()) records = make_unique<GameRecordWriter>(opt.recordPath);
+        auto t0 = chrono::steady_clock::now();
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                Table table(stats[t], records.get());
+                for (uint64_t g = t; g < opt.games; g += threads) table.run(opt.seed + g, seats);
+            });
+        }
+        for (auto& w : workers) w.join();
+        if (records) records->flush();
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+        Stats total;
+        for (auto& s : stats) total.add(s);
+        double games = static_cast<double>(total.games);
+        printf("%llu games in %.2fs on %u threads: %.0f games/s, %.0f moves/s\n",
+               static_cast<unsigned long long>(total.games), secs, threads,
+               games / secs, static_cast<double>(total.plies) / secs);
+        printf("A (%s) won %.1f%%, B (%s) won %.1f%%, unfinished %llu\n",
+               policyName(opt.seat[0]), 100.0 * static_cast<double>(total.wins[0]) / games,
+               policyName(opt.seat[1]), 100.0 * static_cast<double>(total.wins[1]) / games,
+               static_cast<unsigned long long>(total.unfinished));
+        printLatency("checkMove", total.checkNs);
+        printLatency("generate_moves", total.generateNs);
+        printLatency("A move", total.thinkNs[0]);
+        printLatency("B move", total.thinkNs[1]);
+        printf("rule violations: %llu\n", static_cast<unsigned long long>(total.violations));
+        return total.violations ? 1 : 0;
+    }
+
+    // ---------------- round-robin tournament ----------------
+
+    // points[m][d]: what the first entrant of matchup m scored over both games
+    // of deal d, 0..2 with a game that ran too long counted as half each
+    struct Matchup {
+        int a, b;
+        vector<double> points;
+    };
+
+    // Bradley-Terry ratings by minorization-maximization, as Elo with the
+    // first entrant at 0. Every pairing gets half a win each way first, so a
+    // clean sweep still has a finite rating.
+    vector<double> fitElo(size_t entrants, const vector<Matchup>& matchups, const vector<double>& score,
+                          const vector<double>& games) {
+        vector<double> wins(entrants, 0), r(entrants, 1);
+        for (size_t m = 0; m < matchups.size(); m++) {
+            wins[static_cast<size_t>(matchups[m].a)] += score[m] + 0.5;
+            wins[static_cast<size_t>(matchups[m].b)] += games[m] - score[m] + 0.5;
+        }
+        for (int iter = 0; iter < 200; iter++) {
+            vector<double> next(entrants);
+            for (size_t i = 0; i < entrants; i++) {
+                double denom = 0;
+                for (size_t m = 0; m < matchups.size(); m++) {
+                    const size_t a = static_cast<size_t>(matchups[m].a), b = static_cast<size_t>(matchups[m].b);
+                    if (a == i || b == i) denom += (games[m] + 1) / (r[a] + r[b]);
+                }
+                next[i] = wins[i] / denom;
+            }
+            r = next;
+        }
+        vector<double> elo(entrants);
+        for (size_t i = 0; i < entrants; i++) elo[i] = 400.0 * log10(r[i] / r[0]);
+        return elo;
+    }
+
+    int runTournament(const Options& opt) {
+        vector<Entrant> entrants;
+        for (size_t start = 0; start <= opt.tournament.size();) {
+            size_t comma = opt.tournament.find(',', start);
+            if (comma == string::npos) comma = opt.tournament.size();
+            Entrant e{};
+            if (!parseEntrant(opt.tournament.substr(start, comma - start), opt.budgetMs, e)) {
+                fprintf(stderr, "tournament: bad policy '%s'\n", opt.tournament.substr(start, comma - start).c_str());
+                return 2;
+            }
+            e.id = static_cast<int>(entrants.size());
+            e.inlineSearch = true;
+            entrants.push_back(e);
+            start = comma + 1;
+        }
+        if (entrants.size() < 2 || opt.games == 0) {
+            fprintf(stderr, "tournament: needs at least two policies and one game\n");
+            return 2;
+        }
+        vector<Matchup> matchups;
+        for (size_t i = 0; i < entrants.size(); i++)
+            for (size_t j = i + 1; j < entrants.size(); j++)
+                matchups.push_back({static_cast<int>(i), static_cast<int>(j), vector<double>(opt.games)});
+
+        // every matchup plays the same deals, so they differ only in who plays
+        const unsigned threads = threadCount(opt);
+        const uint64_t jobs = matchups.size() * opt.games;
+        atomic<uint64_t> next{0};
+        vector<Stats> stats(threads, Stats(entrants.size()));
+        vector<thread> workers;
+        auto t0 = chrono::steady_clock::now();
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                Table table(stats[t], nullptr);
+                for (uint64_t job; (job = next.fetch_add(1)) < jobs;) {
+                    Matchup& m = matchups[job / opt.games];
+                    const uint64_t deal = job % opt.games;
+                    const Entrant* a = &entrants[static_cast<size_t>(m.a)];
+                    const Entrant* b = &entrants[static_cast<size_t>(m.b)];
+                    const Entrant* const ab[2] = {a, b};
+                    const Entrant* const ba[2] = {b, a};
+                    const int first = table.run(opt.seed + deal, ab), second = table.run(opt.seed + deal, ba);
+                    m.points[deal] = (first == 0 ? 1 : first == -1 ? 0.5 : 0) + (second == 1 ? 1 : second == -1 ? 0.5 : 0);
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        Stats total(entrants.size());
+        for (auto& s : stats) total.add(s);
+
+        vector<double> score(matchups.size(), 0), games(matchups.size(), 2.0 * static_cast<double>(opt.games));
+        for (size_t m = 0; m < matchups.size(); m++)
+            for (double p : matchups[m].points) score[m] += p;
+        const vector<double> elo = fitElo(entrants.size(), matchups, score, games);
+
+        // bootstrap: refit on deals drawn with replacement, per matchup
+        constexpr int kResamples = 200;
+        vector<vector<double>> draws(entrants.size());
+        deal_rng rng(opt.seed ^ 0xB007ull);
+        for (int rep = 0; rep < kResamples; rep++) {
+            vector<double> resampled(matchups.size(), 0);
+            for (size_t m = 0; m < matchups.size(); m++)
+                for (uint64_t d = 0; d < opt.games; d++)
+                    resampled[m] += matchups[m].points[rng.below(static_cast<uint32_t>(opt.games))];
+            const vector<double> e = fitElo(entrants.size(), matchups, resampled, games);
+            for (size_t i = 0; i < entrants.size(); i++) draws[i].push_back(e[i]);
+        }
+
+        printf("tournament: %zu policies, %zu pairings x %llu deals x 2 seats, %llu games in %.2fs on %u threads: "
+               "%.0f games/s, %.0f moves/s\n",
+               entrants.size(), matchups.size(), static_cast<unsigned long long>(opt.games),
+               static_cast<unsigned long long>(total.games), secs, threads,
+               static_cast<double>(total.games) / secs, static_cast<double>(total.plies) / secs);
+        printf("%-12s %7s  %-17s %8s  %10s %10s %10s %10s\n", "policy", "elo", "95% interval", "moves",
+               "think p50", "p90", "p99", "max us");
+        for (size_t i = 0; i < entrants.size(); i++) {
+            sort(draws[i].begin(), draws[i].end());
+            vector<uint32_t>& ns = total.thinkNs[i];
+            sort(ns.begin(), ns.end());
+            auto at = [&](double q) {
+                return ns.empty() ? 0.0 : ns[min(ns.size() - 1, static_cast<size_t>(q * static_cast<double>(ns.size())))] / 1000.0;
+            };
+            printf("%-12s %+7.0f  [%+6.0f, %+6.0f] %8zu  %10.1f %10.1f %10.1f %10.1f\n", entrants[i].name.c_str(), elo[i],
+                   draws[i][kResamples / 40], draws[i][kResamples - 1 - kResamples / 40], ns.size(),
+                   at(0.5), at(0.9), at(0.99), at(1.0));
+        }
+        for (size_t m = 0; m < matchups.size(); m++) {
+            printf("  %s vs %s: %.1f of %.0f\n", entrants[static_cast<size_t>(matchups[m].a)].name.c_str(),
+                   entrants[static_cast<size_t>(matchups[m].b)].name.c_str(), score[m], games[m]);
+        }
+        printf("rule violations: %llu, unfinished: %llu\n", static_cast<unsigned long long>(total.violations),
+               static_cast<unsigned long long>(total.unfinished));
+        return total.violations ? 1 : 0;
+    }
+
+    // ---------------- differential check against server.py ----------------
+
+    // Reads pairs "cards|cards" and answers "kindA kindB beats" per line,
+    // '-' where server.py rejects the combo or the comparison does not apply
+    const char* kPyChecker = R"PY(
+import importlib.util, sys
+spec = importlib.util.spec_from_file_location("bigtwo_server", sys.argv[1])
+m = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(m)
+with open(sys.argv[2]) as src, open(sys.argv[3], "w") as dst:
+    for line in src:
+        a, b = line.rstrip("\n").split("|")
+        ca = m.classify_combo(m.parse_cards(a.split()))
+        cb = m.classify_combo(m.parse_cards(b.split()))
+        beats = "-"
+        if ca and cb and len(ca.cards) == len(cb.cards):
+            beats = str(int(m.beats(ca, cb)))
+        dst.write(f"{ca.kind if ca else '-'} {cb.kind if cb else '-'} {beats}\n")
+)PY";
+
+    const char* pyKind(const combo& c) {
+        switch (c.mode) {
+            case 1: return "single";
+            case 2: return "pair";
+            case 3: return "fullhouse";
+            case 4: return "straight";
+            case 5: return "fourofkind";
+            case 6: return "straightflush";
+        }
+        return "-"; // flushes (7) have no server.py counterpart
+    }
+
+    string labels(hand_mask cards) {
+        static const char* rankLabel[13] = {"3", "4", "5", "6", "7", "8", "9", "10", "J", "Q", "K", "A", "2"};
+        static const char suitLabel[4] = {'C', 'D', 'H', 'S'};
+        string out;
+        for (; cards; cards &= cards - 1) {
+            card c = lowest_card(cards);
+            if (!out.empty()) out += ' ';
+            out += rankLabel[card_rank(c)];
+            out += suitLabel[card_suit(c)];
+        }
+        return out;
+    }
+
+    unsigned rankPresence(hand_mask cards) {
+        unsigned present = 0;
+        for (; cards; cards &= cards - 1) present |= 1u << card_rank(lowest_card(cards));
+        return present;
+    }
+
+    // A2345 and 23456 are straights here but not in server.py; JQKA2 the other way round
+    bool wrapStraight(hand_mask cards) {
+        unsigned p = rankPresence(cards);
+        return p == ((1u << 11) | (1u << 12) | 0x7) || p == ((1u << 12) | 0xF) || p == (0x1Fu << 8);
+    }
+
+    // Known, intended rule differences get a name; anything else is a bug
+    const char* explain(hand_mask a, const combo& ca, const string& pa, hand_mask b, const combo& cb,
+                        const string& pb, const string& pyBeats) {
+        if (pa != pyKind(ca)) return ca.mode == 7 ? "flush" : wrapStraight(a) ? "wrap straight" : nullptr;
+        if (pb != pyKind(cb)) return cb.mode == 7 ? "flush" : wrapStraight(b) ? "wrap straight" : nullptr;
+        if (pyBeats == "-") return "";
+        bool ours = combo_beats(ca.strength, cb.strength);
+        if ((pyBeats == "1") == ours) return "";
+        // server.py ranks five-card kinds only by letting four of a kind and
+        // straight flush beat lower kinds, so it never compares two of those
+        if (hand_size(a) == 5 && (ca.mode != cb.mode || ca.mode == 5 || ca.mode == 6)) return "five-card ladder";
+        return nullptr;
+    }
+
+    // A play from a random 13-card hand dealt from outside taken, so the two
+    // sides of a comparison never share a card, as in a real game
+    hand_mask randomPlay(mt19937_64& rng, vector<play>& moves, hand_mask taken) {
+        hand_mask pool = ((hand_mask{1} << 52) - 1) & ~taken, hand = 0;
+        for (int i = 0; i < 13; i++) {
+            int skip = static_cast<int>(rng() % static_cast<uint64_t>(hand_size(pool)));
+            hand_mask m = pool;
+            while (skip--) m &= m - 1;
+            hand |= m & -m;
+            pool &= ~(m & -m);
+        }
+        if (rng() % 2) {
+            int n = generate_moves(hand, {-1, 0}, moves.data());
+            return moves[rng() % static_cast<uint64_t>(n)].cards;
+        }
+        // an arbitrary subset, mostly not a combo at all
+        static const int sizes[3] = {1, 2, 5};
+        int k = sizes[rng() % 3];
+        hand_mask out = 0;
+        for (; k; k--) {
+            int skip = static_cast<int>(rng() % static_cast<uint64_t>(hand_size(hand)));
+            hand_mask m = hand;
+            while (skip--) m &= m - 1;
+            out |= m & -m;
+            hand &= ~(m & -m);
+        }
+        return out;
+    }
+
+    int diffPython(const Options& opt) {
+        mt19937_64 rng(opt.seed);
+        vector<play> moves(kMaxMoves);
+        vector<pair<hand_mask, hand_mask>> cases;
+        char inPath[] = "/tmp/bigtwo_diff_in_XXXXXX";
+        char outPath[] = "/tmp/bigtwo_diff_out_XXXXXX";
+        int inFd = mkstemp(inPath), outFd = mkstemp(outPath);
+        if (inFd < 0 || outFd < 0) {
+            perror("mkstemp");
+            return 1;
+        }
+        close(outFd);
+        FILE* in = fdopen(inFd, "w");
+        for (uint64_t i = 0; i < opt.diffCases; i++) {
+            hand_mask a = randomPlay(rng, moves, 0), b;
+            do b = randomPlay(rng, moves, a); while (hand_size(b) != hand_size(a));
+            cases.emplace_back(a, b);
+            fprintf(in, "%s|%s\n", labels(a).c_str(), labels(b).c_str());
+        }
+        fclose(in);
+
+        string cmd = "python3 - '" + opt.serverPy + "' " + inPath + " " + outPath;
+        FILE* py = popen(cmd.c_str(), "w");
+        if (!py) {
+            perror("popen");
+            return 1;
+        }
+        fputs(kPyChecker, py);
+        int status = pclose(py);
+        unlink(inPath);
+        FILE* out = fopen(outPath, "r");
+        if (status != 0 || !out) {
+            fprintf(stderr, "diff: python3 checker failed (status %d)\n", status);
+            if (out) fclose(out);
+            unlink(outPath);
+            return 1;
+        }
+
+        uint64_t agree = 0, flush = 0, wrap = 0, ladder = 0, unexplained = 0;
+        char ka[32], kb[32], kbeats[8];
+        for (auto& [a, b] : cases) {
+            if (fscanf(out, "%31s %31s %7s", ka, kb, kbeats) != 3) {
+                fprintf(stderr, "diff: python3 checker output ended early\n");
+                unexplained++;
+                break;
+            }
+            combo ca = checkMove(a), cb = checkMove(b);
+            const char* why = explain(a, ca, ka, b, cb, kb, kbeats);
+            if (!why) {
+                if (unexplained++ < 10) {
+                    printf("mismatch: [%s] ours %s / py %s  vs  [%s] ours %s / py %s  beats py %s ours %d\n",
+                           labels(a).c_str(), pyKind(ca), ka, labels(b).c_str(), pyKind(cb), kb, kbeats,
+                           combo_beats(ca.strength, cb.strength));
+                }
+            } else if (!*why) agree++;
+            else if (!strcmp(why, "flush")) flush++;
+            else if (!strcmp(why, "wrap straight")) wrap++;
+            else ladder++;
+        }
+        fclose(out);
+        unlink(outPath);
+        printf("server.py diff: %llu cases, %llu agree, known differences: flush %llu, wrap straight %llu, "
+               "five-card ladder %llu; unexplained %llu\n",
+               static_cast<unsigned long long>(cases.size()), static_cast<unsigned long long>(agree),
+               static_cast<unsigned long long>(flush), static_cast<unsigned long long>(wrap),
+               static_cast<unsigned long long>(ladder), static_cast<unsigned long long>(unexplained));
+        return unexplained ? 1 : 0;
+    }
+
+    void usage() {
+        fprintf(stderr, "usage: bigtwo_sim [--games N] [--threads T] [--seed S] [--a greedy|random|mc]\n"
+                        "                  [--b greedy|random|mc] [--budget-ms MS] [--diff-python N] [--server-py PATH]\n"
+                        "                  [--record PATH]\n"
+                        "       bigtwo_sim --tournament POLICY,POLICY,... (greedy, random, mc or mc:MS)\n"
+                        "                  [--games N] [--threads T] [--seed S] [--budget-ms MS]\n");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        string val = argv[++i];
+        if (arg == "--games") opt.games = strtoull(val.c_str(), nullptr, 10);
+        else if (arg == "--threads") opt.threads = static_cast<unsigned>(atoi(val.c_str()));
+        else if (arg == "--seed") opt.seed = strtoull(val.c_str(), nullptr, 10);
+        else if (arg == "--budget-ms") opt.budgetMs = atoi(val.c_str());
+        else if (arg == "--diff-python") opt.diffCases = strtoull(val.c_str(), nullptr, 10);
+        else if (arg == "--server-py") opt.serverPy = val;
+        else if (arg == "--record") opt.recordPath = val;
+        else if (arg == "--tournament") opt.tournament = val;
+        else if ((arg == "--a" && parsePolicy(val, opt.seat[0])) || (arg == "--b" && parsePolicy(val, opt.seat[1]))) {}
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (!opt.tournament.empty()) return runTournament(opt);
+    int rc = runGames(opt);
+    if (opt.diffCases && diffPython(opt)) rc = 1;
+    return rc;
+}
@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include "game_engine.h"
+using namespace std;
+namespace {
+    constexpr hand_mask kFullDeck = (hand_mask{1} << 52) - 1;
+    constexpr int kMaxPlies = 300; // a playout that runs this long counts as a loss
+
+    // One shared set of threads for every table, so many practice tables
+    // split the cores instead of each spawning its own searchers
+    class BotPool {
+    public:
+        BotPool() {
+            unsigned n = std::max(1u, std::thread::hardware_concurrency());
+            // searchers inherit a full signal mask so Ctrl-C always lands on
+            // the thread blocked in poll and wakes it with EINTR
+            sigset_t all, old;
+            sigfillset(&all);
+            pthread_sigmask(SIG_SETMASK, &all, &old);
+            for (unsigned i = 0; i < n; i++) threads_.emplace_back([this] { run(); });
+            pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        }
+        ~BotPool() {
+            {
+                lock_guard<mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            cv_.notify_all();
+            for (auto& t : threads_) t.join();
+        }
+        size_t size() const { return threads_.size(); }
+        void post(function<void()> task) {
+            {
+                lock_guard<mutex> lock(mutex_);
+                queue_.push_back(std::move(task));
+            }
+            cv_.notify_one();
+        }
+
+    private:
+        void run() {
+            unique_lock<mutex> lock(mutex_);
+            for (;;) {
+                cv_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+                if (queue_.empty()) return;
+                function<void()> task = std::move(queue_.front());
+                queue_.pop_front();
+                lock.unlock();
+                task();
+                lock.lock();
+            }
+        }
+
+        mutex mutex_;
+        condition_variable cv_;
+        deque<function<void()>> queue_;
+        bool stopping_ = false;
+        vector<thread> threads_;
+    };
+
+    BotPool& botPool() {
+        static BotPool pool;
+        return pool;
+    }
+
+    mt19937_64& rng() {
+        thread_local mt19937_64 r{random_device{}() ^ hash<thread::id>{}(this_thread::get_id())};
+        return r;
+    }
+
+    // Picks k random cards out of pool
+    hand_mask sampleCards(hand_mask pool, int k) {
+        card cards[52];
+        int n = 0;
+        for (; pool; pool &= pool - 1) cards[n++] = lowest_card(pool);
+        hand_mask out = 0;
+        for (int i = 0; i < k && i < n; i++) {
+            int j = i + static_cast<int>(rng()() % static_cast<uint64_t>(n - i));
+            std::swap(cards[i], cards[j]);
+            out |= card_bit(cards[i]);
+        }
+        return out;
+    }
+
+    // Plays both hands out with random legal moves under host_game's rules: a
+    // pass clears the field and the turn alternates. Returns whether seat 0 won.
+    bool playout(hand_mask hands[2], combo field, int turn) {
+        thread_local vector<play> moves(kMaxMoves);
+        for (int ply = 0; ply < kMaxPlies; ply++) {
+            int n = generate_moves(hands[turn], field, moves.data());
+            bool lead = field.mode == -1;
+            int pick = static_cast<int>(rng()() % static_cast<uint64_t>(n + (lead ? 0 : 1)));
+            if (pick == n) {
+                field = {-1, 0};
+            } else {
+                hands[turn] &= ~moves[pick].cards;
+                if (!hands[turn]) return turn == 0;
+                field = moves[pick].kind;
+            }
+            turn ^= 1;
+        }
+        return false;
+    }
+
+    // Endgame search. Values are from the side to move: won, lost, or not
+    // proven within the depth limit (or before the deadline).
+    constexpr int8_t kLost = 0, kWon = 1, kUnproven = -1;
+    constexpr int kTableBits = 16;         // 64k entries, 1.5 MB per searching thread
+    constexpr unsigned kClockEvery = 1024; // nodes between deadline checks
+
+    // Zobrist keys: one per (seat, card) plus the seat to move; the field is
+    // folded in by mixing its strength, which a lead leaves at 0
+    struct Zobrist {
+        uint64_t card[2][52];
+        uint64_t turn;
+        Zobrist() {
+            deal_rng r{0xB16E0D6A3Eull};
+            for (auto& seat : card)
+                for (uint64_t& k : seat) k = r();
+            turn = r();
+        }
+    };
+    const Zobrist& zobrist() {
+        static const Zobrist z;
+        return z;
+    }
+
+    uint64_t fieldKey(const combo& field) {
+        if (field.mode == -1) return 0;
+        uint64_t z = field.strength + 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Upper bound on generate_moves for an n-card hand: its 5-card subsets,
+    // pairs and singles
+    size_t moveBound(int n) {
+        size_t fives = n >= 5 ? static_cast<size_t>(n) * (n - 1) * (n - 2) * (n - 3) * (n - 4) / 120 : 0;
+        return fives + static_cast<size_t>(n) * (n - 1) / 2 + static_cast<size_t>(n);
+    }
+
+    class Endgame {
+    public:
+        endgame_result solve(hand_mask mover, hand_mask other, const combo& field,
+                             chrono::steady_clock::time_point deadline) {
+            if (table_.empty()) table_.resize(size_t{1} << kTableBits);
+            deadline_ = deadline;
+            nodes_ = 0;
+            aborted_ = false;
+            const Zobrist& z = zobrist();
+            Node root{{mover, other}, field, 0, 0};
+            for (hand_mask m = mover; m; m &= m - 1) root.cards ^= z.card[0][lowest_card(m)];
+            for (hand_mask m = other; m; m &= m - 1) root.cards ^= z.card[1][lowest_card(m)];
+
+            // every play takes a card and passes never follow passes, so this
+            // many plies plays the game out
+            const int limit = 2 * (hand_size(mover) + hand_size(other));
+            endgame_result out{kUnproven, 0};
+            play first;
+            if (field.mode == -1 && generate_moves(mover, field, &first, 1) == 1) out.cards = first.cards;
+            for (int depth = 1; depth <= limit && out.value == kUnproven; depth++) {
+                rootDepth_ = depth;
+                const int8_t v = search(root, depth);
+                if (aborted_) break;
+                out.value = v;
+                out.cards = rootBest_;
+            }
+            return out;
+        }
+
+    private:
+        struct Node {
+            hand_mask hands[2]; // by seat; seat turn moves
+            combo field;
+            int turn;
+            uint64_t cards;     // Zobrist of both hands
+            uint64_t key() const { return cards ^ fieldKey(field) ^ (turn ? zobrist().turn : 0); }
+        };
+        struct Entry {
+            uint64_t key = 0;
+            hand_mask best = 0;   // the play that proved a win, or the first one tried
+            int16_t depth = -1;   // limit an unproven value was searched to
+            int8_t value = kUnproven;
+            bool bestPass = false;
+        };
+
+        size_t mask() const { return table_.size() - 1; }
+
+        int8_t search(const Node& node, int depth) {
+            if (++nodes_ % kClockEvery == 0 && chrono::steady_clock::now() >= deadline_) aborted_ = true;
+            if (aborted_) return kUnproven;
+            const uint64_t key = node.key();
+            Entry& slot = table_[key & mask()];
+            hand_mask hint = 0;
+            bool hintPass = false;
+            if (slot.key == key) {
+                if (slot.value != kUnproven || slot.depth >= depth) {
+                    if (depth == rootDepth_) rootBest_ = slot.best;
+                    return slot.value;
+                }
+                hint = slot.best;
+                hintPass = slot.bestPass;
+            }
+            if (depth == 0) return kUnproven;
+
+            const hand_mask mine = node.hands[node.turn];
+            const size_t base = top_;
+            const size_t need = moveBound(hand_size(mine));
+            if (moves_.size() < base + need) moves_.resize(base + need);
+            const int n = generate_moves(mine, node.field, moves_.data() + base, static_cast<int>(need));
+            for (int i = 0; i < n; i++) {
+                if (moves_[base + i].cards == mine) {
+                    store(key, depth, kWon, mine, false);
+                    if (depth == rootDepth_) rootBest_ = mine;
+                    return kWon;
+                }
+            }
+            // dump the most cards first, keeping high cards back; then the
+            // table's move from a shallower pass ahead of everything
+            sort(moves_.begin() + base, moves_.begin() + base + n, [](const play& a, const play& b) {
+                const int na = hand_size(a.cards), nb = hand_size(b.cards);
+                return na != nb ? na > nb : a.kind.strength < b.kind.strength;
+            });
+            if (hint) {
+                for (int i = 0; i < n; i++) {
+                    if (moves_[base + i].cards != hint) continue;
+                    rotate(moves_.begin() + base, moves_.begin() + base + i, moves_.begin() + base + i + 1);
+                    break;
+                }
+            }
+            top_ = base + n;
+
+            const bool canPass = node.field.mode != -1;
+            int8_t result = kLost;
+            hand_mask best = n ? moves_[base].cards : 0;
+            bool bestPass = n == 0;
+            auto tryChild = [&](const Node& child, hand_mask cards, bool pass) {
+                const int8_t v = search(child, depth - 1);
+                if (v == kLost) {
+                    result = kWon;
+                    best = cards;
+                    bestPass = pass;
+                    return true;
+                }
+                if (v == kUnproven) result = kUnproven;
+                return false;
+            };
+            const Zobrist& z = zobrist();
+            bool won = false;
+            if (canPass && hintPass) won = tryChild(Node{{node.hands[0], node.hands[1]}, {-1, 0}, node.turn ^ 1, node.cards}, 0, true);
+            for (int i = 0; i < n && !won && !aborted_; i++) {
+                const play p = moves_[base + i];
+                Node child{{node.hands[0], node.hands[1]}, p.kind, node.turn ^ 1, node.cards};
+                child.hands[node.turn] &= ~p.cards;
+                for (hand_mask m = p.cards; m; m &= m - 1) child.cards ^= z.card[node.turn][lowest_card(m)];
+                won = tryChild(child, p.cards, false);
+            }
+            if (canPass && !hintPass && !won && !aborted_)
+                won = tryChild(Node{{node.hands[0], node.hands[1]}, {-1, 0}, node.turn ^ 1, node.cards}, 0, true);
+            top_ = base;
+            if (aborted_) return kUnproven;
+            store(key, depth, result, best, bestPass);
+            if (depth == rootDepth_) rootBest_ = best; // only the root searches this deep
+            return result;
+        }
+
+        // always replace: the newest pass of iterative deepening is the one
+        // that will probe these positions again
+        void store(uint64_t key, int depth, int8_t value, hand_mask best, bool bestPass) {
+            Entry& e = table_[key & mask()];
+            e.key = key;
+            e.best = best;
+            e.depth = static_cast<int16_t>(depth);
+            e.value = value;
+            e.bestPass = bestPass;
+        }
+
+        vector<Entry> table_;
+        vector<play> moves_; // one slice per ply of the current line
+        size_t top_ = 0;
+        int rootDepth_ = 0;
+        hand_mask rootBest_ = 0;
+        chrono::steady_clock::time_point deadline_;
+        unsigned nodes_ = 0;
+        bool aborted_ = false;
+    };
+
+    struct Search {
+        bot_view view;
+        vector<play> candidates; // cards == 0 stands for pass
+        chrono::steady_clock::time_point deadline;
+        mutex guard;
+        vector<uint64_t> wins, plays;
+        size_t pending = 0;
+        promise<hand_mask> done;
+    };
+
+    void searchTask(const shared_ptr<Search>& s) {
+        const size_t n = s->candidates.size();
+        vector<uint64_t> wins(n, 0), plays(n, 0);
+        const hand_mask unseen = kFullDeck & ~s->view.hand & ~s->view.played;
+        const bool endgame = hand_size(s->view.hand) + s->view.opponent_cards <= kEndgameCards;
+        for (size_t i = rng()() % n; chrono::steady_clock::now() < s->deadline; i = (i + 1) % n) {
+            // a fresh guess at the opponent's hand for every playout
+            hand_mask hands[2] = {s->view.hand, sampleCards(unseen, s->view.opponent_cards)};
+            const play& c = s->candidates[i];
+            combo field = s->view.field;
+            if (c.cards) {
+                hands[0] &= ~c.cards;
+                field = c.kind;
+            } else {
+                field = {-1, 0};
+            }
+            if (endgame) {
+                // few enough cards to play this guess perfectly instead of at random
+                const endgame_result r = endgame_solve(hands[1], hands[0], field, s->deadline);
+                if (r.value == -1) break;
+                wins[i] += r.value == 0;
+            } else {
+                wins[i] += playout(hands, field, 1);
+            }
+            plays[i]++;
+        }
+        lock_guard<mutex> lock(s->guard);
+        for (size_t i = 0; i < n; i++) {
+            s->wins[i] += wins[i];
+            s->plays[i] += plays[i];
+        }
+        if (--s->pending) return;
+        size_t best = 0;
+        double bestRate = -1;
+        for (size_t i = 0; i < n; i++) {
+            double rate = s->plays[i] ? static_cast<double>(s->wins[i]) / static_cast<double>(s->plays[i]) : 0;
+            if (rate > bestRate) { bestRate = rate; best = i; }
+        }
+        s->done.set_value(s->candidates[best].cards);
+    }
+}
+
+endgame_result endgame_solve(hand_mask mover, hand_mask other, const combo& field,
+                             chrono::steady_clock::time_point deadline) {
+    thread_local Endgame solver;
+    return solver.solve(mover, other, field, deadline);
+}
+
+namespace {
+    // A search with its candidates listed, or already resolved when there is
+    // nothing to think about: one option, or a play that empties the hand
+    shared_ptr<Search> newSearch(const bot_view& view, int budget_ms) {
+        auto s = make_shared<Search>();
+        s->view = view;
+        s->candidates.resize(kMaxMoves);
+        int n = generate_moves(view.hand, view.field, s->candidates.data());
+        s->candidates.resize(static_cast<size_t>(n));
+        if (view.field.mode != -1) s->candidates.push_back({0, {-1, 0}});
+
+        for (const play& c : s->candidates) {
+            if (c.cards == view.hand) { s->done.set_value(c.cards); return s; }
+        }
+        if (s->candidates.size() == 1 || view.opponent_cards == 0) {
+            s->done.set_value(s->candidates.front().cards);
+            return s;
+        }
+        s->wins.assign(s->candidates.size(), 0);
+        s->plays.assign(s->candidates.size(), 0);
+        s->deadline = chrono::steady_clock::now() + chrono::milliseconds(budget_ms);
+        return s;
+    }
+}
+
+future<hand_mask> bot_choose(const bot_view& view, int budget_ms) {
+    auto s = newSearch(view, budget_ms);
+    future<hand_mask> result = s->done.get_future();
+    if (s->wins.empty()) return result;
+    BotPool& pool = botPool();
+    s->pending = pool.size();
+    for (size_t i = 0; i < pool.size(); i++) pool.post([s] { searchTask(s); });
+    return result;
+}
+
+hand_mask bot_search(const bot_view& view, int budget_ms) {
+    auto s = newSearch(view, budget_ms);
+    future<hand_mask> result = s->done.get_future();
+    if (!s->wins.empty()) {
+        s->pending = 1;
+        searchTask(s);
+    }
+    return result.get();
+}
@@ -1,4 +1,8 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
 #include <cstring>
 #include <iostream>
 #include <cstring>
@@ -8,44 +12,30 @@
 #include <string_view>
 #include <cstdint>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 #include <cstdio>
 #include "game_engine.h"
 #include "config.h"
+#include "spectator_hub.h"
+#include "game_record.h"
 #include <random>
 using namespace std;
 namespace {
     // Upper bound to protect memory / protocol abuse. Tune as you like.
     constexpr uint32_t MAX_FRAME = 1u << 20; // 1 MiB
 
-    // Read exactly n bytes from a blocking TCP socket.
-    bool recv_n(int fd, void* buf, size_t n) {
-        char* p = static_cast<char*>(buf);
-        while (n) {
-            ssize_t r = recv(fd, p, n, 0);
-            if (r < 0) { if (errno == EINTR) continue; return false; }
-            if (r == 0) return false; // peer closed mid-frame
-            p += r; n -= static_cast<size_t>(r);
-        }
-        return true;
-    }
-
-    // Same as above, but directly into a std::string (resizes it).
-    bool recv_n_string(int fd, std::string& out, size_t n) {
-        out.resize(n);
-        return recv_n(fd, out.data(), n);
-    }
-
-    // Parse a decimal length (header line you got via recv_line).
+    // Parse a decimal length (header line of a UDP frame).
     // Returns true on success and writes the length to out_len.
-    bool parse_len_header(const std::string& line, uint32_t& out_len) {
+    bool parse_len_header(std::string_view line, uint32_t& out_len) {
         if (line.empty()) return false;
         // strict decimal digits only
-        for (char c : line) if (c < '0' || c > '9') return false;
-
-        // convert and range-check
-        unsigned long long ull = strtoull(line.c_str(), nullptr, 10);
-        if (ull > MAX_FRAME) return false;
-        out_len = static_cast<uint32_t>(ull);
+        uint64_t v = 0;
+        for (char c : line) {
+            if (c < '0' || c > '9') return false;
+            v = v * 10 + static_cast<uint64_t>(c - '0');
+            if (v > MAX_FRAME) return false;   // range-check as we go, no overflow
+        }
+        out_len = static_cast<uint32_t>(v);
         return true;
     }
 } // namespace
@@ -56,41 +46,28 @@ void parse_frame(const std::string& s, std::string& action, std::string& content
     if (sp == std::string::npos) { action = s; content.clear(); }
     else { action = s.substr(0, sp); content = s.substr(sp + 1); }
 }
+// TCP frames carry a 4-byte big-endian length, as in the Tetris lp_framing.hpp
 bool send_frame(int fd, const std::string& payload) {
-    // Header is ASCII "<len>\n" so we can reuse your recv_line()
-    std::string header = std::to_string(payload.size()) + "\n";
-    // Reuse your existing writer for simplicity
-    if(!send_msg(fd, header)){
-        fprintf(stderr, "GAMESESS: Failure to send header %s\n", header.c_str());
+    if (payload.size() > MAX_FRAME) {
+        fprintf(stderr, "GAMESESS: Frame too large (%zu bytes)\n", payload.size());
         return false;
     }
-    if(!send_msg(fd, payload)){
-        fprintf(stderr, "GAMESESS: Failure to send payload %s\n", payload.c_str());
+    uint32_t len = htonl(static_cast<uint32_t>(payload.size()));
+    // header and payload leave in one sendmsg
+    struct iovec iov[2];
+    iov[0].iov_base = &len;
+    iov[0].iov_len = 4;
+    iov[1].iov_base = const_cast<char*>(payload.data());
+    iov[1].iov_len = payload.size();
+    if(!send_msg_iov(fd, iov, 2)){
+        fprintf(stderr, "GAMESESS: Failure to send frame %s\n", payload.c_str());
         return false;
     }
-    return true; // (If you want error reporting, add a "send_all" that returns bool.)
+    return true;
 }
 
 bool recv_frame(int fd, std::string& payload) {
-    // 1) Read "<len>\n" using your line reader
-    std::string header;
-    for (;;) {
-        if (recv_line(fd, header)) break;
-        if (errno == EINTR) continue;
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            if (!running) return false;   // interrupted shutdown
-            header.clear();               // poll again for more data
-            continue;
-        }
-        return false;
-    }
-
-    // 2) Parse decimal length with validation and cap
-    uint32_t len = 0;
-    if (!parse_len_header(header, len)) return false;
-
-    // 3) Read exactly len bytes into payload
-    return recv_n_string(fd, payload, len);
+    return recv_lp_frame(fd, payload, MAX_FRAME);
 }
 
 // ------------------------ UDP framed I/O ------------------------
@@ -99,63 +76,104 @@ bool recv_frame(int fd, std::string& payload) {
 bool udp_send_frame(int fd, const std::string& payload,
                     const sockaddr* to, socklen_t tolen)
 {
-    std::string frame;
-    frame.reserve(16 + payload.size());   // avoid extra allocs
-    frame.append(std::to_string(payload.size()));
-    frame.push_back('\n');
-    frame.append(payload);
+    char header[16];
+    int hlen = snprintf(header, sizeof(header), "%zu\n", payload.size());
 
-    return udp_send_msg(fd, frame, to, tolen);
+    // header and payload go out as one datagram without being joined first
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = static_cast<size_t>(hlen);
+    iov[1].iov_base = const_cast<char*>(payload.data());
+    iov[1].iov_len = payload.size();
+    msghdr msg{};
+    msg.msg_name = const_cast<sockaddr*>(to);
+    msg.msg_namelen = tolen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    for (;;) {
+        ssize_t w = sendmsg(fd, &msg, 0);
+        if (w < 0) {
+            if (errno == EINTR) continue;    // interrupted: retry
+            return false;
+        }
+        return static_cast<size_t>(w) == iov[0].iov_len + iov[1].iov_len;
+    }
 }
 
 bool udp_recv_frame(int fd, std::string& payload,
                     sockaddr_storage* src, socklen_t* srclen)
 {
-    std::string frame;
-    if (!recv_udp(fd, frame, src, srclen)) return false;
+    std::string_view frame;
+    if (!recv_udp_view(fd, frame, src, srclen)) return false;
 
     // Find the first '\n' to split header and payload
     auto nl = frame.find('\n');
-    if (nl == std::string::npos) return false;
+    if (nl == std::string_view::npos) return false;
 
-    std::string header = frame.substr(0, nl);
     uint32_t len = 0;
-    if (!parse_len_header(header, len)) return false;
-
-    // Remaining bytes after the '\n'
-    std::string body = frame.substr(nl + 1);
+    if (!parse_len_header(frame.substr(0, nl), len)) return false;
 
     // Validate exact length match (strict framing)
+    std::string_view body = frame.substr(nl + 1);
     if (body.size() != len) return false;
 
-    payload.swap(body);
+    payload.assign(body);
     return true;
 }
 
 
-void createDeck(vector<card>& deck){
-    deck.reserve(52);
-    for (auto& s : suits)
-        for (auto& r : ranks)
-            deck.push_back({r, s});          // aggregate init
+// Fills out with the cards of h in ascending order, returns how many
+int handCards(hand_mask h, card* out) {
+    int n = 0;
+    for (; h; h &= h - 1) out[n++] = lowest_card(h);
+    return n;
 }
 
-void shuffleDeck(vector<card>& deck){
-    static std::mt19937 rng{std::random_device{}()};
-    std::shuffle(deck.begin(), deck.end(), rng);
+namespace {
+    const std::array<string, 52> kCardText = [] {
+        std::array<string, 52> t;
+        for (int c = 0; c < 52; c++) t[c] = ranks[card_rank(c)] + " of " + suits[card_suit(c)] + "\n";
+        return t;
+    }();
+
+    // The last few hands rendered on this thread. A re-prompt after a rejected
+    // move shows the same hand again; so does every turn of the other seat.
+    struct HandTextCache {
+        static constexpr int kSlots = 4;
+        hand_mask hand[kSlots] = {};
+        bool used[kSlots] = {};
+        string text[kSlots];
+        int next = 0;
+    };
 }
 
+const string& introduceCard(card c) {
+   return kCardText[c];
+}
 
-string displayHand(vector<card> &deck) {
-    string str;
+// The reference stays valid until this thread renders kSlots other hands
+const string& displayHand(hand_mask hand) {
+    thread_local HandTextCache cache;
+    for (int s = 0; s < HandTextCache::kSlots; s++) {
+        if (cache.used[s] && cache.hand[s] == hand) return cache.text[s];
+    }
+    const int s = cache.next;
+    cache.next = (s + 1) % HandTextCache::kSlots;
+    string& str = cache.text[s];
+    str.clear();
     str += "Hand:\n";
-    for (int i = 0 ; i < deck.size(); i++) {
-        str += ("[" + to_string(i + 1) + "] " + deck[i].rank + " of " + deck[i].suit + "\n");
+    int i = 0;
+    for (hand_mask rest = hand; rest; rest &= rest - 1) {
+        str += '[';
+        str += to_string(++i);
+        str += "] ";
+        str += introduceCard(lowest_card(rest));
     }
+    cache.hand[s] = hand;
+    cache.used[s] = true;
     return str;
 }
 
-
 string playerBegin(state& world) {
     string str = "It's ";
     str += world.players[world.whose_turn];
@@ -163,101 +181,248 @@ string playerBegin(state& world) {
     return str;
 }
 
-string translateSuit(char s) {
-    if (s == 'S') {
-        return "Spade";
-    }
-    if (s == 'H') {
-        return "Hearts";
+string displayMove(hand_mask move) {
+    string str;
+    str += "Your Move:\n";
+    for (; move; move &= move - 1) {
+        str += introduceCard(lowest_card(move));
     }
-    if (s == 'C') {
-        return "Clubs";
+    return str;
+}
+namespace {
+    // Which straight of Rules a 13-bit rank-presence mask is, -1 if none
+    template <typename Rules>
+    const std::array<int8_t, 1 << 13> kStraightWindow = [] {
+        std::array<int8_t, 1 << 13> t{};
+        t.fill(-1);
+        for (int w = 0; w < static_cast<int>(Rules::kStraights.size()); w++) t[Rules::kStraights[w]] = static_cast<int8_t>(w);
+        return t;
+    }();
+    constexpr hand_mask kSuitMask = 0x1111111111111ull; // one bit per rank
+
+    // Card ids already sort in the classic suit order; other orders rank by key
+    template <typename Rules>
+    constexpr bool kIdOrder = Rules::kSuitOrder == std::array<int, 4>{0, 1, 2, 3};
+    template <typename Rules>
+    constexpr uint32_t cardKey(card c) {
+        if constexpr (kIdOrder<Rules>) return c;
+        else return static_cast<uint32_t>(card_rank(c) * 4 + Rules::kSuitOrder[card_suit(c)]);
     }
-    if (s == 'D') {
-        return "Diamond";
+    // The highest card of a non-empty set under Rules
+    template <typename Rules>
+    card topCard(hand_mask cards) {
+        if constexpr (kIdOrder<Rules>) {
+            return highest_card(cards);
+        } else {
+            card top = lowest_card(cards);
+            for (cards &= cards - 1; cards; cards &= cards - 1)
+                if (cardKey<Rules>(lowest_card(cards)) > cardKey<Rules>(top)) top = lowest_card(cards);
+            return top;
+        }
     }
-    return "Invalid";
-}
 
-int translateRank(string c) {
-    if (c == "Ace") return 14;
-    if (c == "10") return 10;
-    if (c == "J") return 11;
-    if (c == "Q") return 12;
-    if (c == "K") return 13;
-    if (c == "2") return 15;
-    return c[0] - '0';
+    // five-card category order: straight < flush < full house < four < straight flush
+    int fiveCardCategory(int mode) {
+        switch (mode) {
+            case 4: return 0;
+            case 7: return 1;
+            case 3: return 2;
+            case 5: return 3;
+            case 6: return 4;
+        }
+        return 0;
+    }
+    combo makeCombo(int mode, card dominating, int count, uint32_t key) {
+        uint32_t category = count == 5 ? static_cast<uint32_t>(fiveCardCategory(mode)) : 0;
+        return {mode, dominating, (static_cast<uint32_t>(count) << 29) | (category << 26) | key};
+    }
 }
 
-int digitaliseSuit(string c) {
-    if (c == "Spade") return 4;
-    if (c == "Hearts") return 3;
-    if (c == "Diamond") return 2;
-    if (c == "Clubs") return 1;
-    return -1;
-}
+/* Mode: 1: Single Card | 2: 對子 | 3: 葫蘆 | 4: 順子 | 5: 鐡枝 | 6: 同花順 | 7: 同花*/
+template <typename Rules>
+combo checkMove(hand_mask move) {
+    int n = hand_size(move);
+    if (n == 1) { //單張
+        card c = lowest_card(move);
+        return makeCombo(1, c, 1, cardKey<Rules>(c));
+    }
+    if (n == 2) { //對子
+        card lo = lowest_card(move), hi = highest_card(move);
+        if (card_rank(lo) != card_rank(hi)) return {-1, lo};
+        hi = topCard<Rules>(move);
+        return makeCombo(2, hi, 2, cardKey<Rules>(hi));
+    }
+    if (n != 5) return {-1, 0};
 
-bool sortCards(card &a, card &b) {
-    if (a.rank != b.rank) {
-        return translateRank(a.rank) < translateRank(b.rank);
+    unsigned present = 0;
+    int topCount = 0, topRank = 0;
+    for (int r = 0; r < 13; r++) {
+        int cnt = std::popcount((move >> (4 * r)) & 0xF);
+        if (!cnt) continue;
+        present |= 1u << r;
+        if (cnt > topCount) { topCount = cnt; topRank = r; }
+    }
+    hand_mask topRankCards = move & (hand_mask{0xF} << (4 * topRank));
+    if (topCount == 4) { //鐡枝
+        return makeCombo(5, topCard<Rules>(topRankCards), 5, topRank);
+    }
+    if (topCount == 3 && std::popcount(present) == 2) { //葫蘆
+        return makeCombo(3, topCard<Rules>(topRankCards), 5, topRank);
+    }
+    if (topCount != 1) return {-1, lowest_card(move)};
 
+    card top = highest_card(move);
+    int suit = card_suit(top);
+    bool flush = (move & (kSuitMask << suit)) == move;
+    int window = kStraightWindow<Rules>[present];
+    if (window >= 0) {
+        // one card per rank, so the tiebreak rank names a single card
+        card decider = lowest_card(move & (hand_mask{0xF} << (4 * Rules::kStraightTop[window])));
+        uint32_t key = (static_cast<uint32_t>(window) << 6) | cardKey<Rules>(decider);
+        return flush ? makeCombo(6, decider, 5, key)  //同花順
+                     : makeCombo(4, decider, 5, key); //順子
     }
-    return digitaliseSuit(a.suit) < digitaliseSuit(b.suit);
-}
-bool findDominatingCard(const card& a, const card& b) {
-    /* Determines whether card a is greater than card b.*/
-    if (a.rank != b.rank) {
-        return translateRank(a.rank) > translateRank(b.rank);
+    if (flush) { //同花: ranks high to low, then suit
+        uint32_t key = 0;
+        for (int r = 12; r >= 0; r--)
+            if (present & (1u << r)) key = (key << 4) | static_cast<uint32_t>(r);
+        return makeCombo(7, top, 5, (key << 2) | static_cast<uint32_t>(Rules::kSuitOrder[suit]));
     }
-    return digitaliseSuit(a.suit) > digitaliseSuit(b.suit);
+    return {-1, lowest_card(move)};
 }
 
-
-string introduceCard(const card& c) {
-   return c.rank + " of " + c.suit + "\n";
-}
-string displayMove(vector <card>&move) {
-    string str;
-    str += "Your Move:\n";
-    for (int i = 0; i < move.size(); i++) {
-        str += introduceCard(move[i]);
-    }
-    return str;
+combo checkMove(hand_mask move) {
+    return checkMove<ClassicRules>(move);
 }
-/* Mode: 1: Single Card | 2: 對子 | 3: 葫蘆 | 4: 鐡枝 | 5: 順子*/
-combo checkMove(vector<card> &move) {
-    sort(move.begin(), move.end(), sortCards);
-    displayMove(move);
-    if (move.size() == 1) {
-        return {1, move[0]}; //單張
+
+namespace {
+    hand_mask rankCards(hand_mask hand, int rank) {
+        return hand & (hand_mask{0xF} << (4 * rank));
     }
-    if (move.size() == 2) { //對子
-        if (move[0].rank == move[1].rank) {
-            return {2, move[1]};
+
+    template <typename Rules>
+    struct MoveSink {
+        play* out;
+        int capacity;
+        int count = 0;
+        uint32_t field;
+        bool lead;
+        bool full() const { return count >= capacity; }
+        // only: accept just this mode, so flush enumeration skips straight flushes
+        void offer(hand_mask cards, int only = 0) {
+            if (full()) return;
+            combo c = checkMove<Rules>(cards);
+            if (c.mode == -1 || (only && c.mode != only)) return;
+            if (!lead && !combo_beats(c.strength, field)) return;
+            out[count++] = {cards, c};
         }
+    };
+
+    template <typename F>
+    void forEachPair(hand_mask cards, F&& f) {
+        for (hand_mask a = cards; a; a &= a - 1)
+            for (hand_mask b = a & (a - 1); b; b &= b - 1)
+                f((a & -a) | (b & -b));
     }
-    if (move.size() == 5) {
-        if ((move[0].rank == move[1].rank && move[1].rank == move[2].rank && move[3].rank == move[4].rank) ||
-            (move[0].rank == move[1].rank && move[3].rank == move[2].rank && move[3].rank == move[4].rank)) {
-            return {3, move[2]}; //葫蘆
+
+    template <typename Rules>
+    void genStraights(hand_mask hand, MoveSink<Rules>& sink) {
+        for (unsigned window : Rules::kStraights) {
+            hand_mask n[5];
+            int k = 0;
+            for (int r = 0; r < 13 && k < 5; r++)
+                if (window & (1u << r)) n[k++] = rankCards(hand, r);
+            if (!n[0] || !n[1] || !n[2] || !n[3] || !n[4]) continue;
+            for (hand_mask a = n[0]; a; a &= a - 1)
+            for (hand_mask b = n[1]; b; b &= b - 1)
+            for (hand_mask c = n[2]; c; c &= c - 1)
+            for (hand_mask d = n[3]; d; d &= d - 1)
+            for (hand_mask e = n[4]; e; e &= e - 1) {
+                if (sink.full()) return;
+                sink.offer((a & -a) | (b & -b) | (c & -c) | (d & -d) | (e & -e));
+            }
         }
-        if ((move[0].rank == move[1].rank && move[1].rank == move[2].rank && move[2].rank == move[3].rank) ||
-            (move[1].rank == move[2].rank && move[2].rank == move[3].rank && move[3].rank == move[4].rank)) {
-            return {5, move[2]}; //鐡枝
+    }
+
+    template <typename Rules>
+    void genFlushes(hand_mask hand, MoveSink<Rules>& sink) {
+        for (int suit = 0; suit < 4; suit++) {
+            card cards[13];
+            int n = 0;
+            for (hand_mask m = hand & (kSuitMask << suit); m; m &= m - 1) cards[n++] = lowest_card(m);
+            if (n < 5) continue;
+            // Gosper's hack walks every 5-of-n index set
+            for (unsigned x = 0x1F; x < (1u << n);) {
+                if (sink.full()) return;
+                hand_mask pick = 0;
+                for (unsigned i = x; i; i &= i - 1) pick |= card_bit(cards[std::countr_zero(i)]);
+                sink.offer(pick, 7);
+                unsigned c = x & -x, r = x + c;
+                x = (((r ^ x) >> 2) / c) | r;
+            }
         }
-        if (translateRank(move[0].rank) + 1 == translateRank(move[1].rank) &&
-            translateRank(move[1].rank) + 1 == translateRank(move[2].rank) &&
-            translateRank(move[2].rank) + 1 == translateRank(move[3].rank) &&
-            translateRank(move[3].rank) + 1 == translateRank(move[4].rank)) {
-            if (move[0].suit == move[1].suit && move[1].suit == move[2].suit && move[2].suit == move[3].suit && move[3].suit == move[4].suit) {
-                return {6, move[4]}; //同花順
+    }
+
+    template <typename Rules>
+    void genFullHouses(hand_mask hand, MoveSink<Rules>& sink) {
+        for (int t = 0; t < 13; t++) {
+            hand_mask trips = rankCards(hand, t);
+            if (std::popcount(trips) < 3) continue;
+            for (hand_mask drop = trips; drop; drop &= drop - 1) {
+                // with four of the rank, each one left out is a triple; with three, the one triple
+                hand_mask triple = std::popcount(trips) == 4 ? trips & ~(drop & -drop) : trips;
+                for (int p = 0; p < 13; p++) {
+                    if (p == t) continue;
+                    forEachPair(rankCards(hand, p), [&](hand_mask pair) { sink.offer(triple | pair); });
+                }
+                if (sink.full() || std::popcount(trips) == 3) break;
             }
-            return {4, move[4]}; //順子
         }
     }
-    return {-1, move[0]};
+
+    template <typename Rules>
+    void genFours(hand_mask hand, MoveSink<Rules>& sink) {
+        for (int r = 0; r < 13; r++) {
+            hand_mask quad = rankCards(hand, r);
+            if (std::popcount(quad) != 4) continue;
+            for (hand_mask k = hand & ~quad; k; k &= k - 1) sink.offer(quad | (k & -k));
+        }
+    }
+}
+
+template <typename Rules>
+int generate_moves(hand_mask hand, const combo& field, play* out, int capacity) {
+    MoveSink<Rules> sink{out, capacity, 0, field.strength, field.mode == -1};
+    uint32_t size = sink.lead ? 0 : field.strength >> 29;
+    if (size == 0 || size == 1) {
+        for (hand_mask m = hand; m && !sink.full(); m &= m - 1) sink.offer(m & -m);
+    }
+    if (size == 0 || size == 2) {
+        for (int r = 0; r < 13 && !sink.full(); r++)
+            forEachPair(rankCards(hand, r), [&](hand_mask pair) { sink.offer(pair); });
+    }
+    if ((size == 0 || size == 5) && hand_size(hand) >= 5) {
+        // categories below the field's cannot beat it
+        int category = size ? static_cast<int>((field.strength >> 26) & 7) : 0;
+        genStraights(hand, sink);
+        if (category <= 1) genFlushes(hand, sink);
+        if (category <= 2) genFullHouses(hand, sink);
+        if (category <= 3) genFours(hand, sink);
+    }
+    return sink.count;
+}
+
+int generate_moves(hand_mask hand, const combo& field, play* out, int capacity) {
+    return generate_moves<ClassicRules>(hand, field, out, capacity);
 }
 
+template combo checkMove<ClassicRules>(hand_mask);
+template combo checkMove<DiamondsOverHeartsRules>(hand_mask);
+template combo checkMove<LowTwoStraightRules>(hand_mask);
+template int generate_moves<ClassicRules>(hand_mask, const combo&, play*, int);
+template int generate_moves<DiamondsOverHeartsRules>(hand_mask, const combo&, play*, int);
+template int generate_moves<LowTwoStraightRules>(hand_mask, const combo&, play*, int);
+
 string introduceField(const combo& field) {
     string str;
     if (field.mode == -1) {
@@ -281,6 +446,9 @@ string introduceField(const combo& field) {
     if (field.mode == 6) {
         str +="Field status: Five consecutive numbers with same suit";
     }
+    if (field.mode == 7) {
+        str +="Field status: Five cards of the same suit";
+    }
     if (field.mode != -1) {
         str += "Dominating Card: ";
         str += introduceCard(field.dominatingCard);
@@ -289,17 +457,69 @@ string introduceField(const combo& field) {
 }
 
 bool checkComboIsGreaterThanField(const combo &player, const combo &field) {
-    if (player.mode > 4) return player.mode > field.mode;
-    if (player.mode != field.mode) return false;
-    return findDominatingCard(player.dominatingCard, field.dominatingCard);
+    return combo_beats(player.strength, field.strength);
+}
+
+void removeCardFromHand(hand_mask& hand, hand_mask move) {
+    hand &= ~move;
+}
+
+string encode_state_frame(hand_mask hand, const combo& field, int opponent_cards) {
+    char buf[96];
+    snprintf(buf, sizeof buf, "STATE hand=%llx field=%d,%x,%d opp=%d",
+             static_cast<unsigned long long>(hand), field.mode, field.strength, field.dominatingCard, opponent_cards);
+    return buf;
+}
+
+bool decode_state_frame(const string& content, hand_mask& hand, combo& field, int& opponent_cards) {
+    unsigned long long h = 0;
+    unsigned strength = 0;
+    int mode = 0, dominating = 0, opp = 0;
+    if (sscanf(content.c_str(), "hand=%llx field=%d,%x,%d opp=%d", &h, &mode, &strength, &dominating, &opp) != 5) return false;
+    if (dominating < 0 || dominating > 51) return false;
+    hand = h;
+    field = {mode, static_cast<card>(dominating), strength};
+    opponent_cards = opp;
+    return true;
 }
 
-void removeCardFromHand(vector<card>& hand, const vector<card>& move) {
-    for (const auto& m : move) {
-        hand.erase(remove_if(hand.begin(), hand.end(),
-                   [&](const card& c){ return c.rank==m.rank && c.suit==m.suit; }),
-                   hand.end());
+string encode_spectator_frame(const state& world, uint32_t seq, const string& last) {
+    char buf[160];
+    snprintf(buf, sizeof buf, "SPEC seq=%u turn=%d cards=%d,%d field=%d,%x,%d played=%llx last=",
+             seq, world.whose_turn, hand_size(world.playerHand[0]), hand_size(world.playerHand[1]),
+             world.field.mode, world.field.strength, world.field.dominatingCard,
+             static_cast<unsigned long long>(world.played));
+    return buf + last + " winner=" + to_string(world.winner) + " names=" + world.players[0] + "," + world.players[1];
+}
+
+string render_state(hand_mask hand, const combo& field, int opponent_cards) {
+    string str = "}--------------------------=========================< [TURN BEGINS] >--------------------------========================={\n";
+    str += "It's your turn. Your opponent holds " + to_string(opponent_cards) + " cards.\n";
+    str += displayHand(hand);
+    str += introduceField(field);
+    play any;
+    if (field.mode != -1 && !generate_moves(hand, field, &any, 1)) {
+        str += "\nNothing in your hand beats the field; you can only pass.";
     }
+    str += "\n";
+    return str;
+}
+
+string reject_text(const string& code) {
+    if (code == "index") return "Invalid move. Please make your move again.\n";
+    if (code == "combo") return "Invalid move. The move you made does not adhere to the game rules. Please make your move again.\n";
+    if (code == "field") return "The move you made is not greater than what is currently on the field. Please reconsider your move.\n";
+    return "Move rejected: " + code + "\n";
+}
+
+void parse_hello(const string& content, string& name, int& version) {
+    name = content;
+    version = 1;
+    size_t sp = content.rfind(' ');
+    if (sp == string::npos || sp + 1 == content.size()) return;
+    for (size_t i = sp + 1; i < content.size(); i++) if (content[i] < '0' || content[i] > '9') return;
+    name = content.substr(0, sp);
+    version = atoi(content.c_str() + sp + 1);
 }
 
 string get_begin_state_string(state &world) {
@@ -307,6 +527,10 @@ string get_begin_state_string(state &world) {
     str += playerBegin(world);
     str += displayHand(world.playerHand[world.whose_turn]);
     str += introduceField(world.field);
+    play any;
+    if (world.field.mode != -1 && !generate_moves(world.playerHand[world.whose_turn], world.field, &any, 1)) {
+        str += "\nNothing in your hand beats the field; you can only pass.";
+    }
     return str;
 }
 
@@ -327,46 +551,124 @@ bool deliver(int currPlayer, string msg, int fd) { //1: playerA, 2: playerB
         }
         std::cout.flush();
     }
-    else if(!send_frame(fd, msg)){
+    else if (fd >= 0 && !send_frame(fd, msg)) {
         fprintf(stderr, "Error Sending Frame to player.\n");
         return false;
     }
     return true;
 }
 
-int init(vector<card>&deck, vector<card>(&playerDeck)[3]) {
-    /*Game Settings*/
-    int player = -1;
-    createDeck(deck);
-    shuffleDeck(deck);
+namespace {
+    constexpr std::array<card, 52> kDeck = [] {
+        std::array<card, 52> d{};
+        for (int c = 0; c < 52; c++) d[c] = static_cast<card>(c);
+        return d;
+    }();
+}
 
-    /*distribute the cards*/
-    for (int i = 0 ; i < 51; i++) {
-        playerDeck[i % 3].push_back(deck[i]);
-    }
-    for (int i = 0; i < 3; i++) {
-        sort(playerDeck[i].begin(), playerDeck[i].end(), sortCards);
+uint64_t new_deal_seed() {
+    // one random_device read per process, then a splitmix64 stream of seeds
+    static std::atomic<uint64_t> next{(static_cast<uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}() ^
+                                      static_cast<uint64_t>(chrono::steady_clock::now().time_since_epoch().count())};
+    uint64_t z = next.fetch_add(0x9E3779B97F4A7C15ull, std::memory_order_relaxed);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+int init(hand_mask(&playerDeck)[3], deal_rng& rng) {
+    // Fisher-Yates on a stack copy of the deck, then each third of it is a hand
+    std::array<card, 52> deck = kDeck;
+    for (uint32_t i = 51; i > 0; i--) std::swap(deck[i], deck[rng.below(i + 1)]);
+    for (int h = 0; h < 3; h++) {
+        hand_mask m = 0;
+        for (int i = 17 * h; i < 17 * h + 17; i++) m |= card_bit(deck[i]);
+        playerDeck[h] = m;
     }
 
     /*Find who goes first*/
-    for (auto & i : playerDeck[0]) {
-        if (i.suit == "Clubs" && i.rank == "3") {
-            player = 1;
-            break;
-        }
+    const hand_mask threeOfClubs = card_bit(make_card(0, 0));
+    int player;
+    if (playerDeck[0] & threeOfClubs) player = 1;
+    else if (playerDeck[1] & threeOfClubs) player = 0;
+    else player = static_cast<int>(rng() >> 63);
+    playerDeck[player] |= card_bit(deck[51]);
+    return player;
+}
+
+int init(hand_mask(&playerDeck)[3], uint64_t seed) {
+    deal_rng rng{seed};
+    return init(playerDeck, rng);
+}
+
+bool structuredTurn(const state& world) {
+    return world.whose_turn == 1 && world.remote_proto >= 2;
+}
+
+// Banners are display only; a protocol 2 client draws its own
+bool deliverBanner(const state& world, const string& banner, int fd) {
+    if (structuredTurn(world)) return true;
+    return deliver(world.whose_turn, banner, fd);
+}
+
+bool deliverState(state& world, int fd) {
+    const int me = world.whose_turn;
+    if (structuredTurn(world)) {
+        return deliver(me, encode_state_frame(world.playerHand[me], world.field, hand_size(world.playerHand[(me + 1) % 2])), fd);
     }
-    for (auto & i : playerDeck[1]) {
-        if (i.suit == "Clubs" && i.rank == "3") {
-            player = 0;
-            break;
+    return deliver(me, get_begin_state_string(world), fd);
+}
+
+bool deliverReject(const state& world, const string& code, int fd) {
+    if (structuredTurn(world)) return deliver(world.whose_turn, "REJECT " + code, fd);
+    return deliver(world.whose_turn, "MSG " + reject_text(code), fd);
+}
+
+// cards as the 1-based indices into the sorted hand that a player types
+string move_indices(hand_mask hand, hand_mask cards) {
+    card sorted[52];
+    int n = handCards(hand, sorted);
+    string indices;
+    for (int i = 0; i < n; i++) {
+        if (!(cards & card_bit(sorted[i]))) continue;
+        if (!indices.empty()) indices += ' ';
+        indices += to_string(i + 1);
+    }
+    return indices;
+}
+
+// The bot answers in the same index syntax a remote player sends
+string bot_response(state &world) {
+    const int me = world.whose_turn;
+    bot_view view{world.playerHand[me], world.played, hand_size(world.playerHand[(me + 1) % 2]), world.field};
+    auto pick = bot_choose(view, BOT_BUDGET_MS);
+    while (pick.wait_for(std::chrono::milliseconds(50)) != std::future_status::ready) {
+        if (!running) {
+            world.local_aborted = true;
+            return "LOCAL_INTERRUPT";
         }
     }
-    if (player == -1) {
-        srand(time(nullptr));
-        player = rand() % 2;
+    hand_mask cards = pick.get();
+    if (!cards) {
+        deliver(0, "MSG " + world.players[me] + " passes.\n", -1);
+        return "pass";
     }
-    playerDeck[player].push_back(deck[51]);
-    return player;
+    string shown = "MSG " + world.players[me] + " plays:\n";
+    for (hand_mask m = cards; m; m &= m - 1) shown += introduceCard(lowest_card(m));
+    deliver(0, shown, -1);
+    return move_indices(world.playerHand[me], cards);
+}
+
+// "hint" asks the bot what it would play from the asking seat, seeing only
+// what that player sees; near the end that is an exact endgame answer
+string hint_text(const state& world) {
+    const int me = world.whose_turn;
+    bot_view view{world.playerHand[me], world.played, hand_size(world.playerHand[(me + 1) % 2]), world.field};
+    hand_mask cards = bot_choose(view, HINT_BUDGET_MS).get();
+    if (!cards) return "MSG Hint: pass\n";
+    string text = "MSG Hint: " + move_indices(world.playerHand[me], cards) + "\n";
+    for (; cards; cards &= cards - 1) text += introduceCard(lowest_card(cards));
+    return text;
 }
 
 string get_Response(state &world, int fd) {
@@ -383,6 +685,9 @@ string get_Response(state &world, int fd) {
             return "LOCAL_INTERRUPT";
         }
     }
+    else if (fd < 0) {
+        return bot_response(world);
+    }
     else {
         if (!recv_frame(fd, input)) {
             if (!running) {
@@ -396,12 +701,67 @@ string get_Response(state &world, int fd) {
     return input;
 }
 
+namespace {
+    constexpr const char* kRankLabel[13] = {"3", "4", "5", "6", "7", "8", "9", "10", "J", "Q", "K", "A", "2"};
+    constexpr char kSuitLabel[4] = {'C', 'D', 'H', 'S'};
+}
+
+string card_label(card c) {
+    return string(kRankLabel[card_rank(c)]) + kSuitLabel[card_suit(c)];
+}
+
+bool parse_card_label(string label, card& out, string& error) {
+    for (char& ch : label) ch = static_cast<char>(toupper(static_cast<unsigned char>(ch)));
+    while (!label.empty() && isspace(static_cast<unsigned char>(label.back()))) label.pop_back();
+    while (!label.empty() && isspace(static_cast<unsigned char>(label.front()))) label.erase(0, 1);
+    if (label.size() < 2) { error = "bad card " + label; return false; }
+    const char* suit = static_cast<const char*>(memchr(kSuitLabel, label.back(), 4));
+    if (!suit) { error = "bad suit " + label; return false; }
+    const string rank = label.substr(0, label.size() - 1);
+    for (int r = 0; r < 13; r++) {
+        if (rank == kRankLabel[r]) {
+            out = make_card(r, static_cast<int>(suit - kSuitLabel));
+            return true;
+        }
+    }
+    error = "bad rank " + label;
+    return false;
+}
+
+const char* combo_kind(int mode) {
+    switch (mode) {
+        case 1: return "single";
+        case 2: return "pair";
+        case 3: return "fullhouse";
+        case 4: return "straight";
+        case 5: return "fourofkind";
+        case 6: return "straightflush";
+        case 7: return "flush";
+    }
+    return "none";
+}
+
+bool parse_move_indices(hand_mask hand, const string& input, hand_mask& move) {
+    card cards[52];
+    int handCount = handCards(hand, cards);
+    move = 0;
+    std::istringstream iss(input);
+    for (std::string tok; iss >> tok; ) {
+        int index = atoi(tok.c_str());
+        if (index > handCount || index < 1 || (move & card_bit(cards[index - 1]))) {
+            move = 0;
+            return false;
+        }
+        move |= card_bit(cards[index - 1]);
+    }
+    return true;
+}
+
 //indexify
-bool parsePlayer(vector<card> &move, state& world, int fd) {
+bool parsePlayer(hand_mask &move, state& world, int fd) {
     world.pass = false;
-    vector<bool> chosenCards(world.playerHand[world.whose_turn].size(), false);
-    string promptMsg =  "PROMPT You may either make a move, pass, or surrender.\nYou may enter the indices that are displayed above. The accepted format is as follows: <number><space><number>...\nE.g. A valid input would be 1 2 3 10 11.\nYou may also enter pass if no moves are desired, or surrender to concede.\n";
-    if(!deliver(world.whose_turn, promptMsg.c_str(), fd)){
+    move = 0;
+    if(!deliver(world.whose_turn, structuredTurn(world) ? "ASK" : "PROMPT " MOVE_PROMPT, fd)){
         fprintf(stderr, "parsePlayer: Deliver Error.\n");
         world.whose_turn = 3;
         return true;
@@ -431,24 +791,20 @@ bool parsePlayer(vector<card> &move, state& world, int fd) {
         world.pass = true;
         return true;
     }
+    if (input == "hint") {
+        if (!deliver(world.whose_turn, hint_text(world), fd)) {
+            fprintf(stderr, "parsePlayer: Deliver Error.\n");
+            world.whose_turn = 3;
+            return true;
+        }
+        return false;
+    }
     if (input == "ERROR") {
         world.whose_turn = 2;
         return true;
     }
-    std::istringstream iss(input);
-    bool validInput = true;
-    for (std::string tok; iss >> tok; ) {
-        int index = atoi(tok.c_str());
-        if (index > world.playerHand[world.whose_turn].size() || index < 1 || chosenCards[index - 1]) {
-            validInput = false;
-            break;
-        }
-        move.push_back(world.playerHand[world.whose_turn][index - 1]);
-        chosenCards[index - 1] = true;
-    }
-    if (!validInput) {
-        string msg = "MSG Invalid move. Please make your move again.\n";
-        if(!deliver(world.whose_turn, promptMsg.c_str(), fd)){
+    if (!parse_move_indices(world.playerHand[world.whose_turn], input, move)) {
+        if(!deliverReject(world, "index", fd)){
             fprintf(stderr, "parsePlayer: Deliver Error.\n");
             world.whose_turn = 3;
             return true;
@@ -459,11 +815,10 @@ bool parsePlayer(vector<card> &move, state& world, int fd) {
 }
 int host_game(int clientFD, int lobbyFD, int udp_invite_fd, int& win, bool& remote_aborted) {
     state world;
-    vector<card> deck;
-    vector<card> playerDeck[3];//Lovelace = 0, Furina = 1, Bot = 2;
-    combo field = {-1, {"3", "Spade"}};
-    vector<card> move;
-    int player = init(deck, playerDeck);
+    hand_mask playerDeck[3];//Lovelace = 0, Furina = 1, Bot = 2;
+    combo field = {-1, make_card(0, 3)};
+    hand_mask move = 0;
+    int player = init(playerDeck, new_deal_seed());
     bool gameEnd = false;
     bool pass = false;
     world.field = field;
@@ -475,27 +830,51 @@ int host_game(int clientFD, int lobbyFD, int udp_invite_fd, int& win, bool& remo
     world.surrenderer = -1;
     world.connection_lost = false;
     world.local_aborted = false;
-    world.players[0] = sock_to_user[lobbyFD];
-    world.players[1] = sock_to_user[clientFD];
+    const std::string* host_name = sessions.name_at(lobbyFD);
+    world.players[0] = host_name ? *host_name : "";
+    if (clientFD < 0) {
+        world.players[1] = "Bot";
+    }
+    else {
+        std::string hello, act, name;
+        if (!recv_frame(clientFD, hello)) {
+            fprintf(stderr, "host_game: Failure receiving client HELLO MSG.\n");
+            return 1;
+        }
+        parse_frame(hello, act, name);
+        if (act == "USER") {
+            int version = 1;
+            parse_hello(name, world.players[1], version);
+            world.remote_proto = std::min(version, BIGTWO_PROTO);
+        }
 
-    std::string hello, act, name;
-    if (!recv_frame(clientFD, hello)) {
-        fprintf(stderr, "host_game: Failure receiving client HELLO MSG.\n");
-        return 1;
+        // (optional, also send your name back); a protocol 2 peer gets ours
+        string reply = "USER " + world.players[0];
+        if (world.remote_proto >= 2) reply += " " + to_string(world.remote_proto);
+        if(!send_frame(clientFD, reply)){
+            fprintf(stderr, "host_game: Failure to send USER_INFO.\n");
+            return 1;
+        }
     }
-    parse_frame(hello, act, name);
-    if (act == "USER") world.players[1] = name;
 
-    // (optional, also send your name back)
-    if(!send_frame(clientFD, "USER " + world.players[0])){
-        fprintf(stderr, "host_game: Failure to send USER_INFO.\n");
-        return 1;
+    // spectators are served from the hub's own thread; publish only queues
+    SpectatorHub spectators;
+    uint32_t spectator_seq = 0;
+    uint16_t spectator_port = 0;
+    if (SPECTATORS_ENABLED && spectators.start(PLAYERA_IP, spectator_port)) {
+        deliver(0, "MSG Spectators can watch this match on port " + to_string(spectator_port) + ".\n", clientFD);
     }
+    spectators.publish(encode_spectator_frame(world, spectator_seq++, "deal"));
+    game_record record;
+    record.hand[0] = world.playerHand[0];
+    record.hand[1] = world.playerHand[1];
+    record.first = world.whose_turn;
+    record.bot = clientFD < 0;
 
     /*Play Game*/
     while (world.winner == -1) {
         string banner = "MSG }--------------------------=========================< [TURN BEGINS] >--------------------------========================={\n";
-        if(!deliver(world.whose_turn, banner, clientFD)){
+        if(!deliverBanner(world, banner, clientFD)){
             fprintf(stderr, "host_game: Deliver Error: %s\n", banner.c_str());
             return 1;
         }
@@ -504,14 +883,13 @@ int host_game(int clientFD, int lobbyFD, int udp_invite_fd, int& win, bool& remo
         bool validMove = false;
         while (!validMove) {
             do {
-                move.clear();
-                string payload = get_begin_state_string(world);
-                if(!deliver(world.whose_turn, payload, clientFD)){
-                    fprintf(stderr, "host_game: Error sending payload to [player%s]: %s\n",world.players[world.whose_turn].c_str(), payload.c_str());
+                move = 0;
+                if(!deliverState(world, clientFD)){
+                    fprintf(stderr, "host_game: Error sending state to [player%s]\n",world.players[world.whose_turn].c_str());
                     return 1;
                 }
                 banner = "MSG }--------------------------=========================< [STAGE: CHOOSE YOUR MOVE] >--------------------------========================={\n";
-                if(!deliver(world.whose_turn, banner, clientFD)){
+                if(!deliverBanner(world, banner, clientFD)){
                     fprintf(stderr, "host_game: Error sending banner to [player%s]: %s\n",world.players[world.whose_turn].c_str(), banner.c_str());
                     return 1;
                 }
@@ -541,15 +919,14 @@ int host_game(int clientFD, int lobbyFD, int udp_invite_fd, int& win, bool& remo
                 }
                 world.pass = false;
                 banner = "MSG }--------------------------=========================< [MOVE VERIFICATION] >--------------------------========================={\n";
-                if(!deliver(world.whose_turn, banner, clientFD)){
+                if(!deliverBanner(world, banner, clientFD)){
                     fprintf(stderr, "host_game: Error sending banner to [player%s]: %s\n",world.players[world.whose_turn].c_str(), banner.c_str());
                     return 1;
                 }
                 playerMove = checkMove(move);
                 if (playerMove.mode == -1) {
-                    string errMsg = "Invalid move. The move you made does not adhere to the game rules. Please make your move again.\n";
-                    if(!deliver(world.whose_turn, errMsg.c_str(), clientFD)){
-                        fprintf(stderr, "host_game: Error sending errMsg to [player%s]: %s\n", world.players[world.whose_turn].c_str(), errMsg.c_str());
+                    if(!deliverReject(world, "combo", clientFD)){
+                        fprintf(stderr, "host_game: Error sending rejection to [player%s]\n", world.players[world.whose_turn].c_str());
                         return 1;
                     }
                 }
@@ -566,7 +943,7 @@ int host_game(int clientFD, int lobbyFD, int udp_invite_fd, int& win, bool& remo
                 }
                 world.field.mode = -1;
                 banner = "MSG }--------------------------=========================< [TURN ENDS] >--------------------------========================={\n";
-                if(!deliver(world.whose_turn, banner, clientFD)){
+                if(!deliverBanner(world, banner, clientFD)){
                     fprintf(stderr, "host_game: Error sending banner to [player%s]: %s\n",world.players[world.whose_turn].c_str(), banner.c_str());
                     return 1;
                 }
@@ -578,14 +955,13 @@ int host_game(int clientFD, int lobbyFD, int udp_invite_fd, int& win, bool& remo
             }
             else {
                 banner = "MSG }--------------------------=========================< [FIELD VERIFICATION] >--------------------------========================={\n";
-                if(!deliver(world.whose_turn, banner, clientFD)){
+                if(!deliverBanner(world, banner, clientFD)){
                     fprintf(stderr, "host_game: Error sending banner to [player%s]: %s\n",world.players[world.whose_turn].c_str(), banner.c_str());
                     return 1;
                 }
                 if (!checkComboIsGreaterThanField(playerMove, world.field)) {
-                    string msg = "MSG The move you made is not greater than what is currently on the field. Please reconsider your move.\n";
-                    if(!deliver(world.whose_turn, msg.c_str(), clientFD)){
-                        fprintf(stderr, "host_game: Error sending Msg to [player%s]: %s\n", world.players[world.whose_turn].c_str(), msg.c_str());
+                    if(!deliverReject(world, "field", clientFD)){
+                        fprintf(stderr, "host_game: Error sending rejection to [player%s]\n", world.players[world.whose_turn].c_str());
                         return 1;
                     }
                 }
@@ -615,20 +991,22 @@ int host_game(int clientFD, int lobbyFD, int udp_invite_fd, int& win, bool& remo
             }
             break;
         }
+        const bool passed = world.pass;
         banner = "MSG }--------------------------=========================< [CARD REMOVAL] >--------------------------========================={\n";
-        if(!deliver(world.whose_turn, banner, clientFD)){
+        if(!deliverBanner(world, banner, clientFD)){
             fprintf(stderr, "host_game: Error sending banner to [player%s]: %s\n",world.players[world.whose_turn].c_str(), banner.c_str());
             return 1;
         }
         removeCardFromHand(world.playerHand[world.whose_turn], move);
+        world.played |= move;
         banner = "MSG }--------------------------=========================< [TURN ENDS] >--------------------------========================={\n";
-        if(!deliver(world.whose_turn, banner, clientFD)){
+        if(!deliverBanner(world, banner, clientFD)){
             fprintf(stderr, "host_game: Error sending banner to [player%s]: %s\n",world.players[world.whose_turn].c_str(), banner.c_str());
             return 1;
         }
         world.field = playerMove;
         world.pass = false;
-        if (world.playerHand[world.whose_turn].empty()) {
+        if (world.playerHand[world.whose_turn] == 0) {
             string msg = "MSG " + world.players[world.whose_turn] + " wins!\n";
             if(!deliver(world.whose_turn, msg.c_str(), clientFD)){
                 fprintf(stderr, "host_game: Error sending Msg to [player%s]: %s\n", world.players[world.whose_turn].c_str(), msg.c_str());
@@ -640,9 +1018,19 @@ int host_game(int clientFD, int lobbyFD, int udp_invite_fd, int& win, bool& remo
             }
             world.winner = world.whose_turn;
         }
+        record.moves.push_back(passed ? 0 : move);
         world.whose_turn = (world.whose_turn + 1) % 2;
+        char shown[20];
+        snprintf(shown, sizeof shown, "%llx", static_cast<unsigned long long>(move));
+        spectators.publish(encode_spectator_frame(world, spectator_seq++, passed ? "pass" : shown));
     }
-    bool remote_alive = !world.connection_lost;
+    if (world.surrenderer != -1) spectators.publish(encode_spectator_frame(world, spectator_seq++, "surrender"));
+    record.winner = world.winner;
+    record.surrender = world.surrenderer != -1;
+    // games here are minutes apart, so each one is written out as it ends
+    game_records().append(record);
+    game_records().flush();
+    bool remote_alive = !world.connection_lost && clientFD >= 0;
     remote_aborted = world.connection_lost;
     if(world.winner == 1){
         if(remote_alive){
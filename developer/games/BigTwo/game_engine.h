@@ -7,34 +7,210 @@
 #include <vector>
 #include <string>
 #include <array>
+#include <cstdint>
+#include <bit>
+#include <chrono>
+#include <future>
 using namespace std;
-struct card {
-    string rank;
-    string suit;
-};
+// A card is its id rank*4 + suit, with ranks ordered 3..K, Ace, 2 and suits
+// Clubs < Diamond < Hearts < Spade, so ids compare in Big Two order (that of
+// ClassicRules below). A hand is a bitmask of ids; walking its set bits from
+// low to high gives it sorted.
+using card = uint8_t;
+using hand_mask = uint64_t;
+
+inline constexpr card make_card(int rank, int suit) { return static_cast<card>(rank * 4 + suit); }
+inline constexpr int card_rank(card c) { return c >> 2; }
+inline constexpr int card_suit(card c) { return c & 3; }
+inline constexpr hand_mask card_bit(card c) { return hand_mask{1} << c; }
+inline int hand_size(hand_mask h) { return std::popcount(h); }
+inline card lowest_card(hand_mask h) { return static_cast<card>(std::countr_zero(h)); }
+inline card highest_card(hand_mask h) { return static_cast<card>(63 - std::countl_zero(h)); }
+
+// strength packs card count (bits 29-31), five-card category (bits 26-28) and
+// a tiebreak key, so two plays that may follow each other compare as integers
 struct combo {
     int mode;
     card dominatingCard;
+    uint32_t strength = 0;
 };
+inline bool combo_beats(uint32_t player, uint32_t field) {
+    return (player >> 29) == (field >> 29) && player > field;
+}
 
 struct state {
     array<string, 2> players;
-    vector<card> playerHand[2];
+    hand_mask playerHand[2];
     combo field;
     int whose_turn;
     int winner = -1;
     bool pass;
     int surrenderer = -1;
+    hand_mask played = 0; // every card that has left a hand so far
+    int remote_proto = 1; // protocol player 1 speaks, see BIGTWO_PROTO
     bool connection_lost = false;
     bool local_aborted = false;
 };
-// game_engine.h
-inline const std::array<std::string,4> suits = {"Spade","Hearts","Clubs","Diamond"};
-inline const std::array<std::string,13> ranks = {"Ace","2","3","4","5","6","7","8","9","10","J","Q","K"};
+// Display names indexed by card_suit / card_rank
+inline const std::array<std::string,4> suits = {"Clubs","Diamond","Hearts","Spade"};
+inline const std::array<std::string,13> ranks = {"3","4","5","6","7","8","9","10","J","Q","K","Ace","2"};
+
+// xoshiro256** seeded through splitmix64: a few cycles per draw and no heap,
+// so every table can own one and replay its games from the seed alone
+class deal_rng {
+public:
+    using result_type = uint64_t;
+    explicit deal_rng(uint64_t seed) { this->seed(seed); }
+    void seed(uint64_t seed) {
+        for (uint64_t& w : s_) {
+            seed += 0x9E3779B97F4A7C15ull;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            w = z ^ (z >> 31);
+        }
+    }
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+    result_type operator()() {
+        const uint64_t out = rotl(s_[1] * 5, 7) * 9;
+        const uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 45);
+        return out;
+    }
+    // uniform in [0, n) by multiply-shift (Lemire), without the modulo bias
+    uint32_t below(uint32_t n) {
+        uint64_t m = ((*this)() >> 32) * n;
+        if (static_cast<uint32_t>(m) < n) {
+            const uint32_t floor = static_cast<uint32_t>(-n) % n;
+            while (static_cast<uint32_t>(m) < floor) m = ((*this)() >> 32) * n;
+        }
+        return static_cast<uint32_t>(m >> 32);
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+    uint64_t s_[4];
+};
+// A fresh seed for a live table; log it and init(.., seed) deals the same game again
+uint64_t new_deal_seed();
+// Deals 17 cards to each of the three hands and the 52nd to the seat that
+// does not hold the 3 of Clubs; returns the seat that moves first
+int init(hand_mask(&playerDeck)[3], deal_rng& rng);
+// same deal every time for a given seed
+int init(hand_mask(&playerDeck)[3], uint64_t seed);
+
+// Rule variants from RULES, one type per table: checkMove<Rules> and
+// generate_moves<Rules> are compiled for each, so the variant costs no branch
+// per comparison. The untemplated checkMove and generate_moves are ClassicRules.
+//   kSuitOrder    rank of each suit (indexed by card_suit), lowest 0
+//   kStraights    the straights as 13-bit rank masks, lowest first
+//   kStraightTop  the rank whose card breaks a tie between equal straights
+struct ClassicRules {
+    static constexpr std::array<int, 4> kSuitOrder = {0, 1, 2, 3};
+    // 34567 up to 10JQKA, then A2345 and 23456 as the top two; A may only
+    // sit at either end, so JQKA2 is not a straight
+    static constexpr std::array<unsigned, 10> kStraights = {
+        0x1F, 0x1F << 1, 0x1F << 2, 0x1F << 3, 0x1F << 4, 0x1F << 5, 0x1F << 6, 0x1F << 7,
+        (1 << 11) | (1 << 12) | 0x7, (1 << 12) | 0xF};
+    static constexpr std::array<int, 10> kStraightTop = {4, 5, 6, 7, 8, 9, 10, 11, 12, 12};
+};
+// Diamonds above hearts, as some tables play
+struct DiamondsOverHeartsRules : ClassicRules {
+    static constexpr std::array<int, 4> kSuitOrder = {0, 2, 1, 3};
+};
+// 2 counts low in straights: A2345 and 23456 are the lowest two, decided by
+// their 5 and 6
+struct LowTwoStraightRules : ClassicRules {
+    static constexpr std::array<unsigned, 10> kStraights = {
+        (1 << 11) | (1 << 12) | 0x7, (1 << 12) | 0xF,
+        0x1F, 0x1F << 1, 0x1F << 2, 0x1F << 3, 0x1F << 4, 0x1F << 5, 0x1F << 6, 0x1F << 7};
+    static constexpr std::array<int, 10> kStraightTop = {2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+};
+// Instantiated in game.cpp for the three rule types above
+template <typename Rules>
+combo checkMove(hand_mask move);
+combo checkMove(hand_mask move);
+// one "<rank> of <suit>" line, as the hands and plays are shown
+const string& introduceCard(card c);
+// Short labels as the JSON protocol of server.py writes them: "3C", "10H", "AS", "2D"
+string card_label(card c);
+// Case and surrounding spaces do not matter; false with server.py's error
+// ("bad card/suit/rank <label>") for anything else
+bool parse_card_label(string label, card& out, string& error);
+// checkMove's mode as server.py names it: single, pair, fullhouse, straight,
+// fourofkind, straightflush, flush
+const char* combo_kind(int mode);
+// "1 3 4" style answer (1-based, into the sorted hand) to the cards it names;
+// false on an index out of range or repeated
+bool parse_move_indices(hand_mask hand, const string& input, hand_mask& move);
+
+// One legal play: the cards and how they classify
+struct play {
+    hand_mask cards;
+    combo kind;
+};
+// every 5-card subset of the largest dealt hand (18) plus its singles and pairs
+inline constexpr int kMaxMoves = 8568 + 153 + 18;
+// Writes every play from hand that beats field (any play when field.mode is
+// -1) into out and returns how many; stops once capacity plays are written
+template <typename Rules>
+int generate_moves(hand_mask hand, const combo& field, play* out, int capacity = kMaxMoves);
+int generate_moves(hand_mask hand, const combo& field, play* out, int capacity = kMaxMoves);
+// bot.cpp: Monte Carlo opponent. It sees its own hand, what has been played
+// and how many cards the opponent holds, never the opponent's hand.
+struct bot_view {
+    hand_mask hand;
+    hand_mask played;
+    int opponent_cards;
+    combo field;
+};
+// Searches on the shared bot thread pool for about budget_ms; resolves to the
+// cards to play, 0 meaning pass
+std::future<hand_mask> bot_choose(const bot_view& view, int budget_ms);
+// The same search on the calling thread alone, for drivers that run many games
+// side by side and give each bot one core
+hand_mask bot_search(const bot_view& view, int budget_ms);
+// Exact play once both hands are known: iterative deepening over (mover's
+// hand, other hand, field) with a per-thread transposition table, under
+// host_game's rules. value is 1 when the side to move wins with best play, 0
+// when it loses whatever it does, -1 when deadline came first; cards is the
+// play to make (0 meaning pass), the best one found so far when unproven.
+struct endgame_result {
+    int value;
+    hand_mask cards;
+};
+endgame_result endgame_solve(hand_mask mover, hand_mask other, const combo& field,
+                             std::chrono::steady_clock::time_point deadline);
+// bot_choose switches its playouts to endgame_solve at this many cards in
+// both hands together
+inline constexpr int kEndgameCards = 12;
 
-int init(vector<card>&deck, vector<card>(&playerDeck)[3]);
+// clientFD < 0 seats the bot as player 1 (practice table)
 int host_game(int clientFD, int lobbyFD, int udp_invite_fd, int& win, bool& remote_aborted);
 bool fetch_stats(int lobbyFD, const std::string& player, int& wins, int& losses);
+// Protocol 2 replaces the per-turn text sent to player B with structured
+// frames and leaves the rendering to B:
+//   STATE hand=<hex mask> field=<mode>,<hex strength>,<card id> opp=<cards>
+//   ASK                          answer with indices, pass, surrender or hint
+//   REJECT index|combo|field     the last answer was refused
+// Each side appends its version to the USER hello; text is used unless both say 2.
+inline constexpr int BIGTWO_PROTO = 2;
+string encode_state_frame(hand_mask hand, const combo& field, int opponent_cards);
+bool decode_state_frame(const string& content, hand_mask& hand, combo& field, int& opponent_cards);
+string render_state(hand_mask hand, const combo& field, int opponent_cards);
+// Spectators get the public side of the same state, never a hand:
+//   SPEC seq=<n> turn=<seat> cards=<n0>,<n1> field=<mode>,<hex strength>,<card id>
+//        played=<hex mask> last=deal|pass|surrender|<hex mask> winner=<seat or -1> names=<p0>,<p1>
+string encode_spectator_frame(const state& world, uint32_t seq, const string& last);
+string reject_text(const string& code);
+// "name [version]" from a USER hello; version is 1 when absent
+void parse_hello(const string& content, string& name, int& version);
 bool recv_frame(int fd, std::string& payload);
 bool send_frame(int fd, const std::string& payload);
 void parse_frame(const std::string& s, std::string& action, std::string& content);
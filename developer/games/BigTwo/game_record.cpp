@@ -0,0 +1,202 @@
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "config.h"
+#include "game_record.h"
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+namespace {
+    constexpr hand_mask kDeck = (hand_mask{1} << 52) - 1;
+    constexpr int kMaskBytes = 7;
+
+    void put_varint(string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    // false if the varint runs past end or over 64 bits
+    bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p == end) return false;
+            uint8_t b = *p++;
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    // The cards of hand picked by the set bits of rel (bit i = i-th lowest card) and back
+    hand_mask deposit(uint64_t rel, hand_mask hand) {
+#if defined(__BMI2__)
+        return _pdep_u64(rel, hand);
+#else
+        hand_mask out = 0;
+        for (; hand && rel; hand &= hand - 1, rel >>= 1) {
+            if (rel & 1) out |= hand & -hand;
+        }
+        return out;
+#endif
+    }
+    uint64_t extract(hand_mask cards, hand_mask hand) {
+#if defined(__BMI2__)
+        return _pext_u64(cards, hand);
+#else
+        uint64_t out = 0;
+        for (int i = 0; hand; hand &= hand - 1, i++) {
+            if (cards & hand & -hand) out |= uint64_t{1} << i;
+        }
+        return out;
+#endif
+    }
+}
+
+void encode_game_record(const game_record& rec, string& out) {
+    string body;
+    body.reserve(16 + rec.moves.size() * 2);
+    body.push_back(static_cast<char>((rec.first & 1) | (rec.winner == 1) << 1 | rec.surrender << 2 | rec.bot << 3));
+    for (hand_mask h : rec.hand) {
+        for (int i = 0; i < kMaskBytes; i++) body.push_back(static_cast<char>(h >> (8 * i)));
+    }
+    hand_mask hand[2] = {rec.hand[0], rec.hand[1]};
+    int turn = rec.first;
+    for (hand_mask cards : rec.moves) {
+        if (!cards) put_varint(body, 0);
+        else put_varint(body, extract(cards, hand[turn]) << 3 | static_cast<uint64_t>(checkMove(cards).mode & 7));
+        hand[turn] &= ~cards;
+        turn ^= 1;
+    }
+    put_varint(out, body.size());
+    out += body;
+}
+
+long decode_game_record(const uint8_t* data, size_t len, game_record& rec) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    uint64_t body = 0;
+    if (!get_varint(p, end, body)) return p == end ? 0 : -1;
+    if (body < 1 + 2 * kMaskBytes) return -1;
+    if (body > static_cast<uint64_t>(end - p)) return 0;
+    end = p + body;
+
+    const uint8_t flags = *p++;
+    rec.first = flags & 1;
+    rec.winner = (flags >> 1) & 1;
+    rec.surrender = flags & 4;
+    rec.bot = flags & 8;
+    for (hand_mask& h : rec.hand) {
+        h = 0;
+        for (int i = 0; i < kMaskBytes; i++) h |= static_cast<hand_mask>(p[i]) << (8 * i);
+        p += kMaskBytes;
+    }
+    hand_mask hand[2] = {rec.hand[0], rec.hand[1]};
+    int turn = rec.first;
+    rec.moves.clear();
+    rec.modes.clear();
+    while (p < end) {
+        uint64_t v;
+        if (!get_varint(p, end, v)) return -1;
+        hand_mask cards = deposit(v >> 3, hand[turn]);
+        // bits past the hand, or a mode with no cards, mean a damaged record
+        if (hand_size(cards) != std::popcount(v >> 3) || (!cards && v)) return -1;
+        rec.moves.push_back(cards);
+        rec.modes.push_back(static_cast<uint8_t>(v & 7));
+        hand[turn] &= ~cards;
+        turn ^= 1;
+    }
+    return static_cast<long>(end - data);
+}
+
+bool validate_game_record(const game_record& rec) {
+    if ((rec.hand[0] | rec.hand[1]) & ~kDeck || rec.hand[0] & rec.hand[1]) return false;
+    if (!rec.hand[0] || !rec.hand[1] || rec.winner < 0 || rec.winner > 1) return false;
+    const bool checkModes = rec.modes.size() == rec.moves.size();
+    hand_mask hand[2] = {rec.hand[0], rec.hand[1]};
+    combo field = {-1, 0};
+    int turn = rec.first;
+    for (size_t i = 0; i < rec.moves.size(); i++) {
+        hand_mask cards = rec.moves[i];
+        if (!cards) {
+            field = {-1, 0};
+        } else {
+            if (cards & ~hand[turn]) return false;
+            combo c = checkMove(cards);
+            if (c.mode == -1 || (checkModes && c.mode != rec.modes[i])) return false;
+            if (field.mode != -1 && !combo_beats(c.strength, field.strength)) return false;
+            field = c;
+            hand[turn] &= ~cards;
+            if (!hand[turn]) return !rec.surrender && rec.winner == turn && i + 1 == rec.moves.size();
+        }
+        turn ^= 1;
+    }
+    return rec.surrender;
+}
+
+GameRecordWriter::GameRecordWriter(string path) : path_(std::move(path)) {}
+
+GameRecordWriter::~GameRecordWriter() { flush(); }
+
+void GameRecordWriter::append(const game_record& rec) {
+    lock_guard<mutex> lock(mutex_);
+    encode_game_record(rec, buffer_);
+    if (buffer_.size() >= GAME_RECORD_BUFFER) flush_locked();
+}
+
+bool GameRecordWriter::flush() {
+    lock_guard<mutex> lock(mutex_);
+    return flush_locked();
+}
+
+bool GameRecordWriter::flush_locked() {
+    if (buffer_.empty()) return true;
+    // looked up every time: other hosts in the same directory append too
+    struct stat st{};
+    long long size = stat(path_.c_str(), &st) == 0 ? st.st_size : 0;
+    if (size > 0 && size + static_cast<long long>(buffer_.size()) > GAME_RECORD_ROTATE_BYTES) rotate_locked();
+    int fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "[records] cannot open %s: %s\n", path_.c_str(), strerror(errno));
+        return false;
+    }
+    size_t done = 0;
+    while (done < buffer_.size()) {
+        ssize_t w = write(fd, buffer_.data() + done, buffer_.size() - done);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "[records] write to %s failed: %s\n", path_.c_str(), strerror(errno));
+            break;
+        }
+        done += static_cast<size_t>(w);
+    }
+    close(fd);
+    // one write per flush, so with O_APPEND hosts never interleave records;
+    // a failed tail is dropped rather than written later behind newer games
+    bool ok = done == buffer_.size();
+    buffer_.clear();
+    return ok;
+}
+
+void GameRecordWriter::rotate_locked() {
+    for (int i = GAME_RECORD_KEEP; i > 1; i--) {
+        string from = path_ + "." + to_string(i - 1);
+        rename(from.c_str(), (path_ + "." + to_string(i)).c_str());
+    }
+    if (GAME_RECORD_KEEP > 0) rename(path_.c_str(), (path_ + ".1").c_str());
+    else unlink(path_.c_str());
+}
+
+GameRecordWriter& game_records() {
+    static GameRecordWriter writer(GAME_RECORD_FILE);
+    return writer;
+}
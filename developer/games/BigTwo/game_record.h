@@ -0,0 +1,64 @@
+//
+// Compact binary record of finished BigTwo games, for bot training and replay.
+//
+
+#ifndef GAME_RECORD_H
+#define GAME_RECORD_H
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "game_engine.h"
+
+// A file is a plain concatenation of records:
+//   varint  body length
+//   u8      flags: bit 0 seat that moved first, bit 1 winner, bit 2 ended by
+//           surrender or disconnect, bit 3 seat 1 was the bot
+//   7 bytes seat 0's deal, 7 bytes seat 1's deal (little-endian card masks)
+//   varint  per move, seats alternating from the first mover:
+//           (cards as a mask over the mover's current hand, lowest card = bit 0) << 3 | combo mode,
+//           0 for a pass
+// A single or pair from the low end of a hand takes one byte, a typical game
+// 40 to 60 in all.
+struct game_record {
+    hand_mask hand[2] = {0, 0};
+    int first = 0;
+    int winner = -1;
+    bool surrender = false;
+    bool bot = false;
+    std::vector<hand_mask> moves; // absolute card masks, 0 a pass
+    std::vector<uint8_t> modes;   // combo mode per move as read back, 0 a pass; writers leave it empty
+};
+
+void encode_game_record(const game_record& rec, std::string& out);
+// Bytes of data taken by the record at its front, 0 if it is cut short and
+// -1 if it is malformed; rec's move buffer is reused between calls
+long decode_game_record(const uint8_t* data, size_t len, game_record& rec);
+// Replays rec under host_game's rules: disjoint deals, every play a real combo
+// (of the mode recorded, if any) from the mover's hand that beats the field,
+// and a winner that fits the end
+bool validate_game_record(const game_record& rec);
+
+// Appends records to path through an in-memory buffer. The file is written
+// once GAME_RECORD_BUFFER bytes are waiting, on flush() and on destruction;
+// past GAME_RECORD_ROTATE_BYTES it becomes path.1 (path.1 path.2, and so on
+// up to GAME_RECORD_KEEP) and a new file starts. Safe to share between threads.
+class GameRecordWriter {
+public:
+    explicit GameRecordWriter(std::string path);
+    ~GameRecordWriter();
+    void append(const game_record& rec);
+    bool flush();
+
+private:
+    bool flush_locked();
+    void rotate_locked();
+
+    std::string path_;
+    std::mutex mutex_;
+    std::string buffer_;
+};
+// The process-wide writer to GAME_RECORD_FILE
+GameRecordWriter& game_records();
+#endif //GAME_RECORD_H
@@ -4,7 +4,7 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <string>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <iostream>
 #include <cstring>
 #include <unistd.h>
@@ -16,7 +16,13 @@
 #include <algorithm>
 #include <csignal>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
 #include "config.h"
+#include "../core/reactor.hpp"
 using namespace std;
 // lobby.cpp (top-level)
 namespace {
@@ -29,7 +35,7 @@ namespace {
     }
 }
 
-bool save_file_atomic(const std::string& path, unordered_map<string, user>& username_to_info) {
+bool save_file_atomic(const std::string& path, unordered_map<string, user>& accounts) {
     const std::string tmp = path + ".tmp";
     {
         std::ofstream out(tmp, std::ios::trunc);
@@ -37,12 +43,12 @@ bool save_file_atomic(const std::string& path, unordered_map<string, user>& user
 
         // deterministic order: sort keys
         std::vector<std::string> keys;
-        keys.reserve(username_to_info.size());
-        for (auto const& kv : username_to_info) keys.push_back(kv.first);
+        keys.reserve(accounts.size());
+        for (auto const& kv : accounts) keys.push_back(kv.first);
         std::sort(keys.begin(), keys.end());
 
         for (auto const& name : keys) {
-            auto const& u = username_to_info.at(name);
+            auto const& u = accounts.at(name);
             out << name << ' ' << u.password << ' '
                 << u.wins << ' ' << u.losses << ' '
                 << 0 << '\n';
@@ -58,23 +64,175 @@ bool save_file_atomic(const std::string& path, unordered_map<string, user>& user
     }
     return true;
 }
-void pfds_add(int fd, struct pollfd **pfds, int* fd_count, int* fd_size) {
-    if (*fd_count == *fd_size) {
-        *fd_size *= 2;
-        *pfds = static_cast<struct pollfd *>(realloc(*pfds, *fd_size * sizeof(**pfds)));
+
+// Account changes go to an append-only journal of absolute values, written
+// by a background thread so the poll loop never waits on the disk. Every
+// JOURNAL_COMPACT_EVERY records the writer folds them into the sorted
+// snapshot and starts the journal over. Replaying a record twice is harmless,
+// so a crash between the snapshot rename and the truncate loses nothing.
+namespace {
+    constexpr const char* ACCOUNT_FILE = "AccountInfo.txt";
+    constexpr const char* JOURNAL_FILE = "AccountInfo.journal";
+    constexpr int JOURNAL_COMPACT_EVERY = 256;
+
+    // "register <name> <password>" or "record <name> <wins> <losses>"
+    bool apply_journal_line(const std::string& line, unordered_map<string, user>& accounts) {
+        std::istringstream iss(line);
+        string kind, name;
+        if (!(iss >> kind >> name)) return false;
+        if (kind == "register") {
+            string password;
+            if (!(iss >> password)) return false;
+            accounts[name] = {password, 0, 0, false};
+            return true;
+        }
+        if (kind == "record") {
+            int wins, losses;
+            if (!(iss >> wins >> losses)) return false;
+            auto it = accounts.find(name);
+            if (it == accounts.end()) return false;
+            it->second.wins = wins;
+            it->second.losses = losses;
+            return true;
+        }
+        return false;
     }
-    (*pfds)[*fd_count].fd = fd;
-    (*pfds)[*fd_count].events = POLLIN;
-    (*pfds)[*fd_count].revents = 0;
-    (*fd_count)++;
+
+    class AccountJournal {
+    public:
+        ~AccountJournal() { stop(); }
+
+        // Replays what an earlier run left in the journal into accounts,
+        // folds it into the snapshot and starts the writer from there
+        void start(unordered_map<string, user>& accounts) {
+            ifstream in(JOURNAL_FILE);
+            string line;
+            int replayed = 0;
+            while (std::getline(in, line)) replayed += apply_journal_line(line, accounts);
+            in.close();
+            accounts_ = accounts;
+            if (replayed > 0) compact();
+            // SIGINT/SIGTERM stay with the poll loop
+            sigset_t all, old;
+            sigfillset(&all);
+            pthread_sigmask(SIG_SETMASK, &all, &old);
+            writer_ = std::thread([this] { run(); });
+            pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        }
+
+        void add_user(const string& name, const user& u) {
+            push("register " + name + ' ' + u.password);
+        }
+        void set_record(const string& name, const user& u) {
+            push("record " + name + ' ' + std::to_string(u.wins) + ' ' + std::to_string(u.losses));
+        }
+
+        // Writes out everything queued, compacts once more and joins the writer
+        void stop() {
+            if (!writer_.joinable()) return;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            cv_.notify_one();
+            writer_.join();
+        }
+
+    private:
+        void push(string line) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                pending_.push_back(std::move(line));
+            }
+            cv_.notify_one();
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;) {
+                cv_.wait(lock, [&] { return stopping_ || !pending_.empty(); });
+                std::vector<string> batch;
+                batch.swap(pending_);
+                bool last = stopping_;
+                lock.unlock();
+
+                if (!batch.empty()) {
+                    std::ofstream out(JOURNAL_FILE, std::ios::app);
+                    for (const string& line : batch) {
+                        out << line << '\n';
+                        apply_journal_line(line, accounts_);
+                    }
+                    out.flush();
+                    if (!out) fprintf(stderr, "[Lobby] journal write failed: %s\n", strerror(errno));
+                    records_ += static_cast<int>(batch.size());
+                }
+                if (records_ >= JOURNAL_COMPACT_EVERY || (last && records_ > 0)) compact();
+
+                lock.lock();
+                if (last && pending_.empty()) return;
+            }
+        }
+
+        void compact() {
+            if (!save_file_atomic(ACCOUNT_FILE, accounts_)) {
+                fprintf(stderr, "[Lobby] snapshot write failed, keeping the journal\n");
+                return;
+            }
+            std::ofstream(JOURNAL_FILE, std::ios::trunc);
+            records_ = 0;
+        }
+
+        unordered_map<string, user> accounts_; // the writer's own copy, never shared with the poll loop
+        int records_ = 0;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::vector<string> pending_;
+        bool stopping_ = false;
+        std::thread writer_;
+    };
+
+    AccountJournal account_journal;
 }
 
-void pfds_del(int whichFD, struct pollfd **pfds, int* fd_count) {
-    (*pfds)[whichFD] = (*pfds)[*fd_count-1];
-    (*fd_count)--;
+// The listener and every client sit on a core Reactor with a callback per fd.
+// Connection state lives in a vector indexed by fd, so registering and
+// dropping a client are each one registration plus a slot reset, whatever the
+// number connected.
+void serve(int fd);
+namespace {
+    struct lobby_conn {
+        bool open = false;
+        bool queued = false;     // a task to serve its next buffered line is already posted
+        bool heartbeats = false; // the client has sent one, so its silence means it is gone
+        std::chrono::steady_clock::time_point heard{};
+    };
+
+    struct lobby_state {
+        int listener = -1;
+        std::vector<lobby_conn> conns;
+    };
+
+    Reactor reactor;
+    lobby_state lobby;
+
+    bool conn_add(int fd) {
+        if (!reactor.add(fd, EPOLLIN | EPOLLRDHUP, [fd](uint32_t) { serve(fd); })) {
+            perror("[Lobby] epoll_ctl");
+            return false;
+        }
+        if (static_cast<size_t>(fd) >= lobby.conns.size()) lobby.conns.resize(fd + 1);
+        lobby.conns[fd] = {true, false, false, std::chrono::steady_clock::now()};
+        return true;
+    }
+
+    void conn_close(int fd) {
+        reactor.remove(fd);
+        close(fd);
+        lobby.conns[fd] = {};
+    }
 }
 
-void new_connection(int listeningSocket, int *fd_count, int *fd_size, pollfd **pfds) {
+void new_connection(int listeningSocket) {
     sockaddr_storage connectionQueue{};
     socklen_t connectionQueueLen = sizeof(connectionQueue);
 
@@ -86,7 +244,10 @@ void new_connection(int listeningSocket, int *fd_count, int *fd_size, pollfd **p
         return;
     }
     else {
-        pfds_add(newFD, pfds, fd_count, fd_size);
+        if (!conn_add(newFD)) {
+            close(newFD);
+            return;
+        }
         int status = getnameinfo(reinterpret_cast<sockaddr*>(&connectionQueue), connectionQueueLen, host, sizeof(host), serv, sizeof(serv), NI_NUMERICHOST | NI_NUMERICSERV);
         if (status != 0) {
             fprintf(stderr, "getnameinfo error: %s\n", gai_strerror(status));
@@ -96,119 +257,107 @@ void new_connection(int listeningSocket, int *fd_count, int *fd_size, pollfd **p
         cout << "[Lobby] New " << family << " Connection established: from " << host << ": " << serv << ", fd = " << newFD << endl;
     }
 }
-void clean_up_lobby(int senderFD, int* fd_count, struct pollfd **pfds, int* whichPfd, const string& username, const string& object){
+// the user on fd (if any) goes offline and loses its socket and listing
+void release_session(int fd) {
+    uint32_t id = sessions.user_at(fd);
+    if (id == SessionStore::kNone) return;
+    if (user* u = sessions.account(sessions.name(id))) u->online = false;
+    sessions.unbind(fd);
+}
+void clean_up_lobby(int senderFD, const string& username, const string& object){
     string errMsg = "ERR UNKNOWN " + object + "\n";
     cout << errMsg;
     fflush(stdout);
     if(!send_msg(senderFD, errMsg)){
         fprintf(stderr, "clean_up_lobby: [player%s] ERROR SENDING ERR MESSAGE\n", username.c_str());
     }
-    user_to_sock.erase(username);
-    sock_to_user.erase(senderFD);
-    close(senderFD);
-    erase_fd(senderFD, pfds, fd_count);
-    (*whichPfd)--;
+    release_session(senderFD);
+    conn_close(senderFD);
 }
-void clean_up_lobby_nameless(int senderFD, int* fd_count, struct pollfd **pfds, int* whichPfd, const string& object){
+void clean_up_lobby_nameless(int senderFD, const string& object){
     string errMsg = "ERR UNKNOWN " + object + "\n";
     cout << errMsg;
     fflush(stdout);
     if(!send_msg(senderFD, errMsg)){
         fprintf(stderr, "clean_up_lobby_nameless: ERROR SENDING ERR MESSAGE\n");
     }
-    close(senderFD);
-    erase_fd(senderFD, pfds, fd_count);
-    (*whichPfd)--;
+    conn_close(senderFD);
+}
+// A client that vanished without LOGOUT: its match ends as an INTERRUPT
+// logout would end it, telling the opponent, and its socket is closed
+void drop_client(int fd) {
+    uint32_t id = sessions.user_at(fd);
+    if (id != SessionStore::kNone) {
+        uint32_t opponent_id = sessions.end_match(id);
+        int opponent_fd = sessions.fd_of(opponent_id);
+        if (opponent_id != SessionStore::kNone && opponent_fd != -1) {
+            string opponent = sessions.name(opponent_id);
+            if(!send_msg(opponent_fd, opponent + " LOGOUT INTERRUPT\n")){
+                fprintf(stderr, "drop_client: Lobby Failure to send INTERRUPT LOGOUT Message to [player%s]\n", opponent.c_str());
+            }
+        }
+    }
+    release_session(fd);
+    conn_close(fd);
 }
-void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct pollfd **pfds, int* whichPfd) {
+void client_connection(int senderFD) {
     string msg;
     string arr[3];
-    int senderFD = (*pfds)[*whichPfd].fd;
     if (!recv_line(senderFD, msg)) {
-        if (auto it = sock_to_user.find(senderFD); it != sock_to_user.end()) {
-            const string& uname = it->second;
-            username_to_info[uname].online = false;
-            user_to_sock.erase(uname);
-            sock_to_user.erase(it);
-        }
         if (errno) perror("recv"); else std::cerr << "peer closed\n";
-        close(senderFD);
-        erase_fd(senderFD, pfds, fd_count);
-        (*whichPfd)--;
+        drop_client(senderFD);
         return;
     }
 
     if (msg.empty()) {
-        if (auto it = sock_to_user.find(senderFD); it != sock_to_user.end()) {
-            const string& uname = it->second;
-            username_to_info[uname].online = false;
-            user_to_sock.erase(uname);
-            sock_to_user.erase(it);
-        }
         cout << "[Lobby] socket " << senderFD << " connection closed.\n";
-        close(senderFD);
-        pfds_del(*whichPfd, pfds, fd_count);
-        (*whichPfd)--; //go back to the previous fd so that in the next iteration, we would not miss the original (*pfds[fd_count]).
+        drop_client(senderFD);
         return;
     }
     else {
         parse_line(msg, arr);
+        if (arr[1] == "HEARTBEAT") {
+            // echoed as is, and not logged: one arrives every HEARTBEAT_INTERVAL_MS
+            lobby.conns[senderFD].heartbeats = true;
+            if (!send_msg(senderFD, msg + "\n")) drop_client(senderFD);
+            return;
+        }
         cout << "[Lobby] Received data from socket " << senderFD << ": " << msg << endl;
         if (arr[1] == "WIN") {
-            auto it = sock_to_user.find(senderFD);
-            if(it == sock_to_user.end()){
-                clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "SOCKET");
+            const string* winner = sessions.name_at(senderFD);
+            if(!winner){
+                clean_up_lobby_nameless(senderFD, "SOCKET");
                 return;
             }
-            string winner = sock_to_user[senderFD];
-
-            if (auto it = username_to_info.find(winner); it != username_to_info.end()) {
-                it->second.wins++;
-                string ret = winner + " WIN RECORDED\n";
+            if (user* u = sessions.account(*winner)) {
+                u->wins++;
+                account_journal.set_record(*winner, *u);
+                string ret = *winner + " WIN RECORDED\n";
                 if(!send_msg(senderFD, ret)){
-                    fprintf(stderr, "client_connection: Lobby Failure to send win message to [player%s]\n", winner.c_str());
-                }
-                if (auto match_it = active_match.find(winner); match_it != active_match.end()) {
-                    string opponent = match_it->second;
-                    active_match.erase(match_it);
-                    if (!opponent.empty()) {
-                        if (auto opp_it = active_match.find(opponent); opp_it != active_match.end()) {
-                            active_match.erase(opp_it);
-                        }
-                    }
+                    fprintf(stderr, "client_connection: Lobby Failure to send win message to [player%s]\n", winner->c_str());
                 }
-
-                save_file_atomic("AccountInfo.txt", username_to_info);
+                sessions.end_match(sessions.user_at(senderFD));
             } else {
-                clean_up_lobby(senderFD, fd_count, pfds, whichPfd, winner, "USER");
+                clean_up_lobby(senderFD, *winner, "USER");
                 return;
             }
         }
         else if (arr[1] == "LOSE") {
-            auto it = sock_to_user.find(senderFD);
-            if(it == sock_to_user.end()){
-                clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "SOCKET");
+            const string* loser = sessions.name_at(senderFD);
+            if(!loser){
+                clean_up_lobby_nameless(senderFD, "SOCKET");
                 return;
             }
-            string loser = sock_to_user[senderFD];
-            if (auto it = username_to_info.find(loser); it != username_to_info.end()) {
-                it->second.losses++;
-                string ret = loser + " LOSS RECORDED\n";
+            if (user* u = sessions.account(*loser)) {
+                u->losses++;
+                account_journal.set_record(*loser, *u);
+                string ret = *loser + " LOSS RECORDED\n";
                 if(!send_msg(senderFD, ret)){
-                    fprintf(stderr, "client_connection: Lobby Failure to send loss message to [player%s]\n", loser.c_str());
-                }
-                if (auto match_it = active_match.find(loser); match_it != active_match.end()) {
-                    string opponent = match_it->second;
-                    active_match.erase(match_it);
-                    if (!opponent.empty()) {
-                        if (auto opp_it = active_match.find(opponent); opp_it != active_match.end()) {
-                            active_match.erase(opp_it);
-                        }
-                    }
+                    fprintf(stderr, "client_connection: Lobby Failure to send loss message to [player%s]\n", loser->c_str());
                 }
-                save_file_atomic("AccountInfo.txt", username_to_info);
+                sessions.end_match(sessions.user_at(senderFD));
             } else {
-                clean_up_lobby(senderFD, fd_count, pfds, whichPfd, loser, "USER");
+                clean_up_lobby(senderFD, *loser, "USER");
                 return;
             }
         }
@@ -222,7 +371,7 @@ void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct
                 }
             }
             else{
-                clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "CONNECTION");
+                clean_up_lobby_nameless(senderFD, "CONNECTION");
                 return;
             }
         }
@@ -231,7 +380,7 @@ void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct
              * <player> <findUsername> <username>
              */
             if(!arr[2].empty()){
-                if (username_to_info.contains(arr[2])){
+                if (sessions.has_account(arr[2])){
                     if(!send_msg(senderFD, arr[0] + " " + arr[1] + " EXIST\n")){
                         fprintf(stderr, "client_connection: Lobby Failure to send findUsername message to player.\n");
                     }
@@ -243,7 +392,7 @@ void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct
                 }
             }
             else{
-                clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "USER");
+                clean_up_lobby_nameless(senderFD, "USER");
                 return;
             }
         }
@@ -251,7 +400,7 @@ void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct
             user newUser;
             auto pos = arr[2].find(' ');
             if(pos == std::string::npos){
-                clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "MSG");
+                clean_up_lobby_nameless(senderFD, "MSG");
                 return;
             }
             else{
@@ -259,14 +408,14 @@ void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct
                 newUser.losses = 0;
                 newUser.online = false;
                 newUser.wins = 0;
-                if (username_to_info.contains(arr[2].substr(0, pos))) {
+                if (sessions.has_account(arr[2].substr(0, pos))) {
                     if(!send_msg(senderFD, arr[0] + " " + arr[1] + " EXIST\n")){
                         fprintf(stderr, "client_connection: Lobby Failure to send registration message to player.\n");
                     }
                     return;
                 }
-                username_to_info[arr[2].substr(0, pos)] = newUser;
-                save_file_atomic("AccountInfo.txt", username_to_info);
+                sessions.add_account(arr[2].substr(0, pos), newUser);
+                account_journal.add_user(arr[2].substr(0, pos), newUser);
                 if(!send_msg(senderFD, arr[0] + " " + arr[1] + " OK\n")){
                     fprintf(stderr, "client_connection: Lobby Failure to send registration confirmation message to player.\n");
                 }
@@ -275,15 +424,15 @@ void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct
         else if (arr[1] == "login") {
             auto pos = arr[2].find(' ');
             if(pos == std::string::npos){
-                clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "MSG");
+                clean_up_lobby_nameless(senderFD, "MSG");
                 return;
             }
             else{
                 string username = arr[2].substr(0, pos);
                 string password = arr[2].substr(pos + 1);
-                auto it = username_to_info.find(username);
-                if (it != username_to_info.end() && username_to_info[username].password == password) {
-                    if (username_to_info[username].online) {
+                user* account = sessions.account(username);
+                if (account && account->password == password) {
+                    if (account->online) {
                         if(!send_msg(senderFD, arr[0] + " login ONLINE\n")){
                             fprintf(stderr, "client_connection: Lobby Failure to send duplicate login message to [player%s]\n", username.c_str());
                         }
@@ -292,9 +441,8 @@ void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct
                     if(!send_msg(senderFD, arr[0] + " " + arr[1] + " OK\n")){
                         fprintf(stderr, "client_connection: Lobby Failure to send Login_ACK message to [player%s]\n", username.c_str());
                     }
-                    username_to_info[username].online = true;
-                    sock_to_user[senderFD] = username;
-                    user_to_sock[username] = senderFD;
+                    account->online = true;
+                    sessions.bind(senderFD, username);
                 }
                 else {
                     if(!send_msg(senderFD, arr[0] + " " + arr[1] + " Invalid Username/Password.\n")){
@@ -304,11 +452,12 @@ void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct
             }
         }
         else if (arr[1] == "STATS") {
-            if(!username_to_info.contains(arr[0])){
-                clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "USER");
+            const user* account = sessions.account(arr[0]);
+            if(!account){
+                clean_up_lobby_nameless(senderFD, "USER");
                 return;
             }
-            auto const& info = username_to_info[arr[0]];
+            auto const& info = *account;
             std::ostringstream oss;
             oss << arr[0] << " STATS " << info.wins << ' ' << info.losses << "\n";
             if(!send_msg(senderFD, oss.str())){
@@ -316,36 +465,22 @@ void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct
             }
         }
         else if(arr[1] == "LOGOUT"){
-            if(!sock_to_user.contains(senderFD)){
-                clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "SOCKET");
-                return;
-            }
-            if(!user_to_sock.contains(arr[0])){
-                clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "USER");
+            if(sessions.user_at(senderFD) == SessionStore::kNone){
+                clean_up_lobby_nameless(senderFD, "SOCKET");
                 return;
             }
-            if(!username_to_info.contains(arr[0])){
-                clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "USER");
+            uint32_t id = sessions.find(arr[0]);
+            int fd = sessions.fd_of(id);
+            user* account = sessions.account(arr[0]);
+            if(fd == -1 || !account){
+                clean_up_lobby_nameless(senderFD, "USER");
                 return;
             }
-            int fd = user_to_sock[arr[0]];
-            string opponent;
-            int opponent_fd = -1;
-            if (auto match_it = active_match.find(arr[0]); match_it != active_match.end()) {
-                opponent = match_it->second;
-                active_match.erase(match_it);
-                if (!opponent.empty()) {
-                    if (auto opp_it = active_match.find(opponent); opp_it != active_match.end()) {
-                        active_match.erase(opp_it);
-                    }
-                    if (auto opp_fd_it = user_to_sock.find(opponent); opp_fd_it != user_to_sock.end()) {
-                        opponent_fd = opp_fd_it->second;
-                    }
-                }
-            }
-            username_to_info[arr[0]].online = false;
-            sock_to_user.erase(fd);
-            user_to_sock.erase(arr[0]);
+            uint32_t opponent_id = sessions.end_match(id);
+            string opponent = opponent_id == SessionStore::kNone ? "" : sessions.name(opponent_id);
+            int opponent_fd = sessions.fd_of(opponent_id);
+            account->online = false;
+            sessions.unbind(fd);
             /*differentiate MANUAL and INTERRUPT*/
             if(arr[2] == "INTERRUPT" && !opponent.empty() && opponent_fd != -1){
                 if(!send_msg(opponent_fd, opponent + " " + arr[1] + " " + arr[2] + "\n")){
@@ -354,38 +489,107 @@ void client_connection(int listeningSocket, int* fd_count, int* fd_size, struct
             }
         }
         else if(arr[1] == "MATCH"){
-            if(!active_match.contains(arr[0]) && !active_match.contains(arr[2])){
-                active_match[arr[0]] = arr[2];
-                active_match[arr[2]] = arr[0];
+            uint32_t a = sessions.intern(arr[0]);
+            uint32_t b = sessions.intern(arr[2]);
+            sessions.start_match(a, b);
+            sessions.clear_waiting(a);
+            sessions.clear_waiting(b);
+        }
+        else if(arr[1] == "WAITING"){
+            /*
+             * <player> WAITING <udp port>  |  <player> WAITING DONE
+             */
+            uint32_t id = sessions.user_at(senderFD);
+            if(id == SessionStore::kNone){
+                clean_up_lobby_nameless(senderFD, "SOCKET");
+                return;
+            }
+            if(arr[2] == "DONE"){
+                sessions.clear_waiting(id);
+                return;
+            }
+            char* end = nullptr;
+            unsigned long port = strtoul(arr[2].c_str(), &end, 10);
+            sockaddr_storage peer{};
+            socklen_t plen = sizeof(peer);
+            if(arr[2].empty() || *end != '\0' || port == 0 || port > 65535 ||
+               getpeername(senderFD, reinterpret_cast<sockaddr*>(&peer), &plen) != 0){
+                clean_up_lobby(senderFD, sessions.name(id), "MSG");
+                return;
+            }
+            // B's invites arrive on the address it reaches the lobby from
+            IpPort addr = ip_port_from_sockaddr(peer);
+            addr.port = arr[2];
+            sessions.set_waiting(id, {addr, std::chrono::steady_clock::now()});
+        }
+        else if(arr[1] == "DIRECTORY"){
+            /*
+             * <player> DIRECTORY REQUEST -> <player> DIRECTORY <count> [<name> <ip> <port>]...
+             */
+            const auto now = std::chrono::steady_clock::now();
+            std::ostringstream entries;
+            int count = 0;
+            const std::vector<uint32_t>& listed = sessions.waiting();
+            for (size_t i = 0; i < listed.size();) {
+                uint32_t id = listed[i];
+                const waiting_player& w = sessions.waiting_entry(id);
+                if (now - w.since > std::chrono::seconds(WAITING_EXPIRY_S)) {
+                    sessions.clear_waiting(id); // moves the last entry into slot i
+                    continue;
+                }
+                if (sessions.name(id) != arr[0]) {
+                    entries << ' ' << sessions.name(id) << ' ' << w.addr.ip << ' ' << w.addr.port;
+                    count++;
+                }
+                ++i;
+            }
+            if(!send_msg(senderFD, arr[0] + " DIRECTORY " + std::to_string(count) + entries.str() + "\n")){
+                fprintf(stderr, "client_connection: Lobby Failure to send directory to [%s]\n", arr[0].c_str());
             }
         }
         else{
-            clean_up_lobby_nameless(senderFD, fd_count, pfds, whichPfd, "MSG");
+            clean_up_lobby_nameless(senderFD, "MSG");
             return;
         }
     }
 
 }
 
-void process_connections(int listeningSocket, int *fd_count, int *fd_size, pollfd **pfds) {
-    for (int i = 0; i < *fd_count; i++) {
-        if ((*pfds)[i].revents & (POLLIN | POLLHUP | POLLERR)) {
-            if ((*pfds)[i].fd == listeningSocket) {
-                new_connection(listeningSocket, fd_count, fd_size, pfds);
-            }
-            else {
-                client_connection(listeningSocket, fd_count, fd_size, pfds, &i);
-            }
-        }
+// Serves one line from fd. A client with more lines already buffered gets a
+// posted task for the next one, so the others are served in between and the
+// next wait does not sleep on lines that are no longer in the socket.
+void serve(int fd) {
+    lobby.conns[fd].heard = std::chrono::steady_clock::now();
+    client_connection(fd);
+    lobby_conn& c = lobby.conns[fd];
+    if (!c.open || c.queued || !recv_line_ready(fd)) return;
+    c.queued = true;
+    reactor.post([fd] {
+        lobby_conn& c = lobby.conns[fd];
+        if (!c.open || !c.queued) return; // closed, or a stale task for a reused fd
+        c.queued = false;
+        serve(fd);
+    });
+}
+
+// Drops every heartbeating client silent for LIVENESS_TIMEOUT_MS
+void sweep_silent() {
+    const auto now = std::chrono::steady_clock::now();
+    for (size_t fd = 0; fd < lobby.conns.size(); fd++) {
+        const lobby_conn& c = lobby.conns[fd];
+        if (!c.open || !c.heartbeats || now - c.heard <= std::chrono::milliseconds(LIVENESS_TIMEOUT_MS)) continue;
+        cout << "[Lobby] socket " << fd << " silent for " << LIVENESS_TIMEOUT_MS << " ms, dropping.\n";
+        drop_client(static_cast<int>(fd));
     }
+    reactor.after(HEARTBEAT_INTERVAL_MS, sweep_silent);
 }
 
-void parse_file(ifstream &file) {
+void parse_file(ifstream &file, unordered_map<string, user>& accounts) {
     string username, password;
     int wins, losses, online;
     while (file >> username >> password >> wins >> losses >> online) {
         user u = {password, wins, losses, false};
-        username_to_info[username] = u;
+        accounts[username] = u;
     }
 }
 
@@ -394,9 +598,8 @@ void parse_file(ifstream &file) {
 int main(int argc, char *argv[]) {
     std::signal(SIGINT, lobby_signal_handler);
     std::signal(SIGTERM, lobby_signal_handler);
-    sock_to_user.clear();
-    user_to_sock.clear();
-    active_match.clear();
+    sessions.reset_sessions();
+    unordered_map<string, user> accounts;
     ifstream read("AccountInfo.txt");
     if (!read.is_open()) {
         ofstream create("AccountInfo.txt", ios::app); // create if missing
@@ -406,8 +609,10 @@ int main(int argc, char *argv[]) {
         }
         // newly created file => empty DB
     } else {
-        parse_file(read);
+        parse_file(read, accounts);
     }
+    account_journal.start(accounts);
+    for (auto const& [name, info] : accounts) sessions.add_account(name, info);
 
     //get listening socket and begin listening
     int listeningSocket = getListeningSocket(LOBBY_IP, LOBBY_PORT, "TCP");
@@ -418,27 +623,22 @@ int main(int argc, char *argv[]) {
     if(!lobby_running){
         close(listeningSocket);
         listeningSocket = -1;
-        if(read.peek() != std::ifstream::traits_type::eof())save_file_atomic("AccountInfo.txt", username_to_info);
+        account_journal.stop();
         return 1;
     }
-    //begin polling for connections
-    int fd_size = 5;
-    int fd_count = 1;
-    pollfd *pfds = (pollfd*)malloc(fd_size * sizeof(pollfd));
-    pfds[0].fd = listeningSocket;
-    pfds[0].events = POLLIN;
-    cout << "Waiting for connections..." << endl;
-    while (lobby_running.load(std::memory_order_relaxed)) {
-        int poll_count = poll(pfds, fd_count, 1000);
-        if (poll_count < 0) {
-            if (errno == EINTR) continue;  // loop; lobby_running may now be false
-            perror("poll");
-            break;
-        }
-        process_connections(listeningSocket, &fd_count, &fd_size, &pfds);
+    lobby.listener = listeningSocket;
+    if (!reactor.ok() || !reactor.add(listeningSocket, EPOLLIN, [](uint32_t) { new_connection(lobby.listener); })) {
+        perror("[Lobby] epoll");
+        close(listeningSocket);
+        account_journal.stop();
+        return 1;
     }
-    free(pfds);
-    save_file_atomic("AccountInfo.txt", username_to_info);
+    reactor.after(HEARTBEAT_INTERVAL_MS, sweep_silent);
+    cout << "Waiting for connections..." << endl;
+    // a signal cuts the wait short, so lobby_running is seen at once
+    while (lobby_running.load(std::memory_order_relaxed)) reactor.run_once(HEARTBEAT_INTERVAL_MS);
+    close(listeningSocket);
+    account_journal.stop();
     return 0;
 }
 
@@ -28,7 +28,7 @@ int lobby(int& lobbyFD, const string& player) {
             cout << "Record: " << wins << " win" << (wins == 1 ? "" : "s")
                  << ", " << losses << " loss" << (losses == 1 ? "" : "es") << "\n";
         }
-        cout << "What would you like to do today?\n1. Find Opponents\n2. Learn the rules\n3. Log out\nPlease enter a number (1~3) to choose your action." << endl;
+        cout << "What would you like to do today?\n1. Find Opponents\n2. Learn the rules\n3. Log out\n4. Practice against the bot\nPlease enter a number (1~4) to choose your action." << endl;
         if (!running || !check_opponent(lobbyFD)) {
             clean_up(tcp_conn_to_B, playerA_FD, lobbyFD, player, "INTERRUPT");
             return 2;
@@ -46,7 +46,9 @@ int lobby(int& lobbyFD, const string& player) {
                     }
 
                     std::vector<endpoint> activeB;
-                    int status = discover_waiting_players(playerA_FD, player, activeB);
+                    // the lobby answers in one round trip; scan only if it can't
+                    int status = DISCOVER_VIA_LOBBY ? lookup_waiting_players(lobbyFD, player, activeB) : -1;
+                    if (status == -1) status = discover_waiting_players(playerA_FD, player, activeB);
                     if (status == -1) {
                         if (!running || !check_opponent(lobbyFD)) {
                             clean_up(tcp_conn_to_B, playerA_FD, lobbyFD, player, "INTERRUPT");
@@ -239,7 +241,7 @@ int lobby(int& lobbyFD, const string& player) {
 
                     std::cout << "Your invitation was accepted. Starting the match!" << std::endl;
                     uint16_t out_port = 0;
-                    int listeningFD = start_tcp_server(PLAYERA_IP, out_port);
+                    int listeningFD = start_tcp_server_in_range(PLAYERA_IP, out_port);
                     if (listeningFD == -1) {
                         fprintf(stderr, "[%s] listening B error: %s\n", player.c_str(), strerror(errno));
                         close(playerA_FD);
@@ -264,6 +266,8 @@ int lobby(int& lobbyFD, const string& player) {
                         close(listeningFD);
                         return 2;
                     }
+                    // the kernel probes a silent peer, so a vanished B fails the next recv
+                    if (!enable_keepalive(tcp_conn_to_B)) perror("[playerA] keepalive");
                     has_found_opponents = true;
                     if(!send_msg(lobbyFD, player + " MATCH " + opponent_name + "\n")){
                         cout << "Error sending match message to lobby server." << endl;
@@ -401,16 +405,27 @@ int lobby(int& lobbyFD, const string& player) {
                 if (lobbyFD != -1) close(lobbyFD);
                 lobbyFD = -1;
                 if (oldLobbyFD != -1) {
-                    sock_to_user.erase(oldLobbyFD);
-                }
-                user_to_sock.erase(player);
-                if (username_to_info.contains(player)) {
-                    username_to_info[player].online = false;
+                    sessions.unbind(oldLobbyFD);
                 }
                 logout = true;
                 return 2;
                 break;
             }
+            case 4: {
+                // practice games are not reported to the lobby
+                int win = 0;
+                bool remote_aborted = false;
+                if (host_game(-1, lobbyFD, -1, win, remote_aborted) == 1) {
+                    cout << "Game Runtime Error." << endl;
+                    break;
+                }
+                if (!running) {
+                    clean_up(tcp_conn_to_B, playerA_FD, lobbyFD, player, "INTERRUPT");
+                    return 2;
+                }
+                cout << (win == 1 ? "You beat the bot!" : "The bot wins this one.") << endl;
+                break;
+            }
 
             default:
                 break;
@@ -456,7 +471,7 @@ int main(int argc, char *argv[]){
             }
         }
         if (loggedIn) {
-            string player = sock_to_user[lobbyFD];
+            string player = *sessions.name_at(lobbyFD);
             if (!running || !check_opponent(lobbyFD)){
                 clean_up(tcp_conn_to_B, playerA_FD, lobbyFD, player, "INTERRUPT");
                 break;
@@ -35,13 +35,22 @@ int lobby(int& lobbyFD, const string& player) { //0: success 1: return to lobby
             case 1: {
                 tcp_to_A_sock = -1;
                 std::uint16_t udp_port = 0;
-                playerB_FD = bind_udp_port_range(PLAYERB_BIND_IP, PLAYERB_PORT_MIN, PLAYERB_PORT_MAX, udp_port);
+                // an ephemeral port is only reachable through the lobby's directory
+                playerB_FD = bind_udp_port_range(PLAYERB_BIND_IP, PLAYERB_PORT_MIN, PLAYERB_PORT_MAX, udp_port,
+                                                 DISCOVER_VIA_LOBBY);
                 if (playerB_FD == -1) {
                     fprintf(stderr, "[%s] unable to bind UDP listener: %s\n", player.c_str(), strerror(errno));
                     break;
                 }
 
+                // listed in the lobby's directory for as long as the socket is open
+                bool listed = DISCOVER_VIA_LOBBY &&
+                              send_msg(lobbyFD, player + " WAITING " + std::to_string(udp_port) + "\n");
                 auto close_udp = [&]() {
+                    if (listed) {
+                        (void)send_msg(lobbyFD, player + " WAITING DONE\n");
+                        listed = false;
+                    }
                     if (playerB_FD != -1) {
                         close(playerB_FD);
                         playerB_FD = -1;
@@ -160,12 +169,14 @@ int lobby(int& lobbyFD, const string& player) { //0: success 1: return to lobby
                         close_udp();
                         return 1;
                     }
+                    // the kernel probes a silent peer, so a vanished A fails the next recv
+                    if (!enable_keepalive(tcp_to_A_sock)) perror("[playerB] keepalive");
                     if (!running || !check_opponent(lobbyFD)) {
                         close_udp();
                         clean_up(tcp_to_A_sock, playerB_FD, lobbyFD, player, "INTERRUPT");
                         return 2;
                     }
-                    if(!send_frame(tcp_to_A_sock, "USER " + sock_to_user[lobbyFD])){
+                    if(!send_frame(tcp_to_A_sock, "USER " + player + " " + to_string(BIGTWO_PROTO))){
                         fprintf(stderr, "playerB Lobby: Failure sending info to opponent.\n");
                         close_udp();
                         clean_up(tcp_to_A_sock, playerB_FD, lobbyFD, player, "INTERRUPT");
@@ -180,7 +191,24 @@ int lobby(int& lobbyFD, const string& player) { //0: success 1: return to lobby
                                 return 2;
                             }
                             parse_frame(msg, action, content);
-                            cout << content;
+                            hand_mask hand = 0;
+                            combo field{-1, 0};
+                            int opponent_cards = 0;
+                            if (action == "USER") {
+                                // host's name and protocol; frames speak for themselves from here
+                            }
+                            else if (action == "STATE" && decode_state_frame(content, hand, field, opponent_cards)) {
+                                cout << render_state(hand, field, opponent_cards);
+                            }
+                            else if (action == "ASK") {
+                                cout << MOVE_PROMPT;
+                            }
+                            else if (action == "REJECT") {
+                                cout << reject_text(content);
+                            }
+                            else {
+                                cout << content;
+                            }
                             fflush(stdout);
                         }
                         else{
@@ -189,7 +217,7 @@ int lobby(int& lobbyFD, const string& player) { //0: success 1: return to lobby
                             clean_up(tcp_to_A_sock, playerB_FD, lobbyFD, player, "INTERRUPT");
                             return 2;
                         }
-                        if (action ==  "PROMPT") {
+                        if (action == "PROMPT" || action == "ASK") {
                             cout << "> " << std::flush;
                             getline(cin >> ws, input);
                             if(!send_frame(tcp_to_A_sock, input)){
@@ -342,11 +370,7 @@ int lobby(int& lobbyFD, const string& player) { //0: success 1: return to lobby
                 if (lobbyFD != -1) close(lobbyFD);
                 lobbyFD = -1;
                 if (oldLobbyFD != -1) {
-                    sock_to_user.erase(oldLobbyFD);
-                }
-                user_to_sock.erase(player);
-                if (username_to_info.contains(player)) {
-                    username_to_info[player].online = false;
+                    sessions.unbind(oldLobbyFD);
                 }
                 logout = true;
                 return 2;
@@ -394,7 +418,7 @@ int main(int argc, char *argv[]) {
             }
         }
         if (loggedIn) {
-            string player = sock_to_user[lobbyFD];
+            string player = *sessions.name_at(lobbyFD);
             if (!running || !check_opponent(lobbyFD)) {
                 clean_up(tcp_to_A_sock, playerB_FD, lobbyFD, player, "INTERRUPT");
                 break;
@@ -0,0 +1,194 @@
+//
+// Accounts, connections, matches and the waiting directory in one place.
+//
+
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct user {
+    std::string password;
+    int wins;
+    int losses;
+    bool online;
+};
+struct IpPort {
+    std::string ip;    // e.g. "203.0.113.7" or "2001:db8::1%en0"
+    std::string port;  // e.g. "443"
+};
+struct waiting_player {
+    IpPort addr;       // lobby-connection IP of B plus its UDP invite port
+    std::chrono::steady_clock::time_point since;
+};
+
+// Every username is interned once into a dense id; everything known about a
+// name (account, socket, opponent, directory entry) lives in one record at
+// that id, so a lookup is one probe of an open-addressing table and the rest
+// is array indexing. Sockets map back through a vector indexed by fd. Ids are
+// never reused, which keeps the table free of tombstones and lets a future
+// multi-threaded lobby shard records by id without rehashing names.
+class SessionStore {
+public:
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    // id of name, created on first sight
+    uint32_t intern(std::string_view name) {
+        if ((names_ + 1) * 2 > slots_.size()) grow();
+        const size_t h = std::hash<std::string_view>{}(name);
+        for (size_t i = h & mask_;; i = (i + 1) & mask_) {
+            uint32_t id = slots_[i];
+            if (id == kNone) {
+                id = static_cast<uint32_t>(records_.size());
+                records_.push_back({});
+                records_.back().name = name;
+                records_.back().hash = h;
+                slots_[i] = id;
+                names_++;
+                return id;
+            }
+            if (records_[id].hash == h && records_[id].name == name) return id;
+        }
+    }
+    // kNone if the name was never seen
+    uint32_t find(std::string_view name) const {
+        if (slots_.empty()) return kNone;
+        const size_t h = std::hash<std::string_view>{}(name);
+        for (size_t i = h & mask_;; i = (i + 1) & mask_) {
+            uint32_t id = slots_[i];
+            if (id == kNone) return kNone;
+            if (records_[id].hash == h && records_[id].name == name) return id;
+        }
+    }
+    const std::string& name(uint32_t id) const { return records_[id].name; }
+
+    // ---- accounts ----
+    user* account(std::string_view name) {
+        uint32_t id = find(name);
+        return id != kNone && records_[id].registered ? &records_[id].info : nullptr;
+    }
+    bool has_account(std::string_view name) const {
+        uint32_t id = find(name);
+        return id != kNone && records_[id].registered;
+    }
+    user& add_account(std::string_view name, const user& u) {
+        Record& r = records_[intern(name)];
+        r.registered = true;
+        r.info = u;
+        return r.info;
+    }
+
+    // ---- connections ----
+    void bind(int fd, std::string_view name) {
+        uint32_t id = intern(name);
+        if (fd >= static_cast<int>(by_fd_.size())) by_fd_.resize(static_cast<size_t>(fd) + 1, kNone);
+        by_fd_[fd] = id;
+        records_[id].fd = fd;
+    }
+    uint32_t user_at(int fd) const {
+        return fd >= 0 && fd < static_cast<int>(by_fd_.size()) ? by_fd_[fd] : kNone;
+    }
+    // the logged-in name on fd, nullptr if none
+    const std::string* name_at(int fd) const {
+        uint32_t id = user_at(fd);
+        return id == kNone ? nullptr : &records_[id].name;
+    }
+    int fd_of(uint32_t id) const { return id == kNone ? -1 : records_[id].fd; }
+    // forgets fd and takes its user off the waiting directory
+    void unbind(int fd) {
+        uint32_t id = user_at(fd);
+        if (id == kNone) return;
+        by_fd_[fd] = kNone;
+        if (records_[id].fd == fd) records_[id].fd = -1;
+        clear_waiting(id);
+    }
+
+    // ---- matches ----
+    uint32_t opponent(uint32_t id) const { return id == kNone ? kNone : records_[id].opponent; }
+    // false if either side is already playing someone
+    bool start_match(uint32_t a, uint32_t b) {
+        if (records_[a].opponent != kNone || records_[b].opponent != kNone) return false;
+        records_[a].opponent = b;
+        records_[b].opponent = a;
+        return true;
+    }
+    // clears both sides, returns who id was playing (kNone if nobody)
+    uint32_t end_match(uint32_t id) {
+        if (id == kNone) return kNone;
+        uint32_t other = records_[id].opponent;
+        records_[id].opponent = kNone;
+        if (other != kNone && records_[other].opponent == id) records_[other].opponent = kNone;
+        return other;
+    }
+
+    // ---- waiting directory ----
+    void set_waiting(uint32_t id, const waiting_player& w) {
+        Record& r = records_[id];
+        r.wait = w;
+        if (r.wait_slot < 0) {
+            r.wait_slot = static_cast<int>(waiting_.size());
+            waiting_.push_back(id);
+        }
+    }
+    void clear_waiting(uint32_t id) {
+        if (id == kNone) return;
+        Record& r = records_[id];
+        if (r.wait_slot < 0) return;
+        uint32_t last = waiting_.back();
+        waiting_[r.wait_slot] = last;
+        records_[last].wait_slot = r.wait_slot;
+        waiting_.pop_back();
+        r.wait_slot = -1;
+    }
+    // ids currently listed; clear_waiting reorders it
+    const std::vector<uint32_t>& waiting() const { return waiting_; }
+    const waiting_player& waiting_entry(uint32_t id) const { return records_[id].wait; }
+
+    // drops every connection, match and listing; accounts stay
+    void reset_sessions() {
+        by_fd_.clear();
+        waiting_.clear();
+        for (Record& r : records_) {
+            r.fd = -1;
+            r.opponent = kNone;
+            r.wait_slot = -1;
+        }
+    }
+
+private:
+    struct Record {
+        std::string name;
+        size_t hash = 0;
+        bool registered = false;
+        user info{};
+        int fd = -1;
+        uint32_t opponent = kNone;
+        int wait_slot = -1;     // index into waiting_, -1 when not listed
+        waiting_player wait;
+    };
+
+    void grow() {
+        size_t size = slots_.empty() ? 64 : slots_.size() * 2;
+        slots_.assign(size, kNone);
+        mask_ = size - 1;
+        for (uint32_t id = 0; id < records_.size(); id++) {
+            size_t i = records_[id].hash & mask_;
+            while (slots_[i] != kNone) i = (i + 1) & mask_;
+            slots_[i] = id;
+        }
+    }
+
+    std::vector<Record> records_;   // indexed by id
+    std::vector<uint32_t> slots_;   // open addressing, linear probing, by name hash
+    size_t mask_ = 0;
+    size_t names_ = 0;
+    std::vector<uint32_t> by_fd_;   // fd -> id
+    std::vector<uint32_t> waiting_;
+};
+
+inline SessionStore sessions;
+#endif //SESSION_STORE_H
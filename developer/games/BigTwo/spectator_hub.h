@@ -0,0 +1,213 @@
+//
+// Fans the public state of one hosted match out to any number of spectators.
+//
+
+#ifndef SPECTATOR_HUB_H
+#define SPECTATOR_HUB_H
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "config.h"
+
+// The host hands every public event to publish(), which frames it once into a
+// shared buffer and wakes the hub thread; it never touches a spectator socket,
+// so the turn loop costs the same with none watching or hundreds. The hub
+// thread accepts spectators and writes the shared buffers out non-blocking.
+// Every frame is a full snapshot, so a spectator that falls SPECTATOR_MAX_QUEUED
+// frames behind only keeps the newest, and one that takes nothing for
+// SPECTATOR_STALL_MS is dropped.
+class SpectatorHub {
+public:
+    using frame_ptr = std::shared_ptr<const std::string>;
+
+    ~SpectatorHub() { stop(); }
+
+    // Listens on ip (port written to out_port) and starts the hub thread
+    bool start(const std::string& ip, uint16_t& out_port) {
+        if (thread_.joinable()) return false;
+        listener_ = start_tcp_server_in_range(ip, out_port);
+        if (listener_ == -1) return false;
+        if (pipe(wake_) != 0) {
+            close(listener_);
+            listener_ = -1;
+            return false;
+        }
+        fcntl(wake_[1], F_SETFL, fcntl(wake_[1], F_GETFL) | O_NONBLOCK);
+        stopping_ = false;
+        // SIGINT/SIGTERM stay with the game thread
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        thread_ = std::thread([this] { run(); });
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        return true;
+    }
+
+    // Queues payload for every spectator, and for late joiners as the latest state
+    void publish(const std::string& payload) {
+        if (!thread_.joinable()) return;
+        auto framed = std::make_shared<std::string>();
+        framed->resize(4);
+        uint32_t len = htonl(static_cast<uint32_t>(payload.size()));
+        memcpy(framed->data(), &len, 4);
+        framed->append(payload);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.push_back(std::move(framed));
+        }
+        wake();
+    }
+
+    // Sends what it can without waiting, then closes every spectator
+    void stop() {
+        if (!thread_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake();
+        thread_.join();
+        close(wake_[0]);
+        close(wake_[1]);
+        close(listener_);
+        listener_ = -1;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Viewer {
+        int fd;
+        std::deque<frame_ptr> out;
+        size_t sent = 0;               // bytes of out.front() already written
+        Clock::time_point progress;    // last time it took any bytes
+        bool dead = false;
+    };
+
+    void wake() {
+        char b = 0;
+        (void) !write(wake_[1], &b, 1); // a full pipe already means "wake up"
+    }
+
+    void run() {
+        std::vector<pollfd> pfds;
+        std::vector<frame_ptr> batch;
+        for (;;) {
+            pfds.clear();
+            pfds.push_back({wake_[0], POLLIN, 0});
+            pfds.push_back({listener_, POLLIN, 0});
+            for (const Viewer& v : viewers_) {
+                pfds.push_back({v.fd, static_cast<short>(v.out.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+            }
+            if (poll(pfds.data(), pfds.size(), 1000) < 0 && errno != EINTR) break;
+
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                batch.swap(pending_);
+                last = stopping_;
+            }
+            for (size_t i = 0; i + 2 < pfds.size(); i++) {
+                if (pfds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) viewers_[i].dead = hung_up(viewers_[i].fd);
+            }
+            if (pfds[0].revents & POLLIN) {
+                char drain[64];
+                while (read(wake_[0], drain, sizeof drain) == static_cast<ssize_t>(sizeof drain)) {}
+            }
+            for (frame_ptr& f : batch) {
+                for (Viewer& v : viewers_) enqueue(v, f);
+                latest_ = std::move(f);
+            }
+            batch.clear();
+            if (pfds[1].revents & POLLIN) accept_viewer();
+
+            const auto now = Clock::now();
+            for (size_t i = 0; i < viewers_.size();) {
+                Viewer& v = viewers_[i];
+                bool keep = !v.dead && flush(v, now);
+                if (keep && !v.out.empty() &&
+                    now - v.progress > std::chrono::milliseconds(SPECTATOR_STALL_MS)) keep = false;
+                if (keep) { i++; continue; }
+                close(v.fd);
+                viewers_[i] = std::move(viewers_.back());
+                viewers_.pop_back();
+            }
+            if (last) break;
+        }
+        for (Viewer& v : viewers_) close(v.fd);
+        viewers_.clear();
+        latest_.reset();
+    }
+
+    void accept_viewer() {
+        int fd = accept(listener_, nullptr, nullptr);
+        if (fd < 0) return;
+        if (viewers_.size() >= SPECTATOR_MAX) {
+            close(fd);
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        viewers_.push_back({fd, {}, 0, Clock::now(), false});
+        if (latest_) viewers_.back().out.push_back(latest_);
+    }
+
+    // A snapshot supersedes everything queued behind a partly written frame
+    static void enqueue(Viewer& v, const frame_ptr& f) {
+        if (v.out.size() >= SPECTATOR_MAX_QUEUED) {
+            v.out.resize(v.sent > 0 ? 1 : 0);
+        }
+        if (v.out.empty()) v.progress = Clock::now(); // the stall clock runs only while it owes bytes
+        v.out.push_back(f);
+    }
+
+    // false once the socket failed
+    static bool flush(Viewer& v, Clock::time_point now) {
+        while (!v.out.empty()) {
+            const std::string& f = *v.out.front();
+            ssize_t n = send(v.fd, f.data() + v.sent, f.size() - v.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            v.progress = now;
+            v.sent += static_cast<size_t>(n);
+            if (v.sent < f.size()) return true;
+            v.sent = 0;
+            v.out.pop_front();
+        }
+        return true;
+    }
+
+    // Spectators only listen; whatever they send is discarded
+    static bool hung_up(int fd) {
+        char junk[256];
+        ssize_t n = recv(fd, junk, sizeof junk, MSG_DONTWAIT);
+        if (n > 0) return false;
+        if (n == 0) return true;
+        return errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+    }
+
+    int listener_ = -1;
+    int wake_[2] = {-1, -1};
+    std::thread thread_;
+    std::mutex mutex_;                // guards pending_ and stopping_
+    std::vector<frame_ptr> pending_;
+    bool stopping_ = false;
+    // owned by the hub thread
+    std::vector<Viewer> viewers_;
+    frame_ptr latest_;
+};
+#endif //SPECTATOR_HUB_H
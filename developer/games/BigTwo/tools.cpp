@@ -17,29 +17,21 @@
 #include <cerrno>
 #include <sstream>
 #include <unordered_set>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <condition_variable>
+#include <csignal>
+#include <thread>
+#include <pthread.h>
 using namespace std;
-volatile std::sig_atomic_t running = 1;
-void handle_signal(int /*signo*/) {
-    running = 0;
-}
-void install_signal_handlers() {
-    struct sigaction sa{};
-    sa.sa_handler = handle_signal;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;            
-
-    sigaction(SIGINT,  &sa, nullptr);  // Ctrl-C
-    sigaction(SIGTERM, &sa, nullptr);  // polite kill (e.g., from system)
-
-    // Optional but recommended for socket apps: ignore SIGPIPE so writes to a
-    // closed peer don’t kill the process. You’ll get EPIPE on send/write instead.
-    struct sigaction ign{};
-    ign.sa_handler = SIG_IGN;
-    sigemptyset(&ign.sa_mask);
-    ign.sa_flags = 0;
-    sigaction(SIGPIPE, &ign, nullptr);
-}
-
 
 IpPort ip_port_from_sockaddr(const sockaddr_storage& ss) {
     char host[NI_MAXHOST]{};
@@ -126,9 +118,85 @@ bool construct_udp_addr(const char* ip, const char* port, sockaddr_storage& out,
     return true;
 }
 
+namespace {
+    // Bytes read from a socket but not handed out yet. recv_line fills this in
+    // large reads so a line costs one recv instead of one per byte. Entries are
+    // tagged with the socket's inode: a closed fd number that gets reused by a
+    // new connection must not see the old connection's leftovers.
+    struct RecvBuffer {
+        std::mutex mutex; // held by the one reader of this fd, so blocking here is fine
+        ino_t inode = 0;
+        std::string data;
+        size_t pos = 0;
+        std::atomic<long long> heard_ms{0}; // steady clock of the last byte in, read without the lock
+        size_t available() const { return data.size() - pos; }
+    };
+
+    long long steady_ms() {
+        return duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    constexpr size_t RECV_CHUNK = 4096;
+    std::unordered_map<int, RecvBuffer> recv_buffers; // nodes are never erased, references stay valid
+    std::mutex recv_buffers_mutex;                     // guards the map itself only
+
+    // Locks and returns fd's buffer, emptied if fd now names a different socket;
+    // with try_only, nullptr while another thread is reading fd
+    RecvBuffer& buffer_of(int fd) {
+        std::lock_guard<std::mutex> map_lock(recv_buffers_mutex);
+        return recv_buffers[fd];
+    }
+
+    RecvBuffer* recv_buffer(int fd, std::unique_lock<std::mutex>& lock, bool try_only) {
+        RecvBuffer& b = buffer_of(fd);
+        lock = try_only ? std::unique_lock<std::mutex>(b.mutex, std::try_to_lock) : std::unique_lock<std::mutex>(b.mutex);
+        if (!lock.owns_lock()) return nullptr;
+        struct stat st{};
+        ino_t inode = fstat(fd, &st) == 0 ? st.st_ino : 0;
+        if (b.inode != inode) {
+            b.inode = inode;
+            b.data.clear();
+            b.pos = 0;
+        }
+        return &b;
+    }
+
+    RecvBuffer& recv_buffer(int fd, std::unique_lock<std::mutex>& lock) {
+        return *recv_buffer(fd, lock, false);
+    }
+
+    // One recv of up to RECV_CHUNK bytes appended to b; false on EOF or error
+    bool recv_fill(int fd, RecvBuffer& b) {
+        if (b.pos == b.data.size()) {
+            b.data.clear();
+            b.pos = 0;
+        } else if (b.pos > RECV_CHUNK) {
+            b.data.erase(0, b.pos);
+            b.pos = 0;
+        }
+        size_t old = b.data.size();
+        b.data.resize(old + RECV_CHUNK);
+        ssize_t r;
+        do { r = ::recv(fd, &b.data[old], RECV_CHUNK, MSG_DONTWAIT); } while (r < 0 && errno == EINTR);
+        b.data.resize(old + (r > 0 ? static_cast<size_t>(r) : 0));
+        if (r > 0) b.heard_ms.store(steady_ms(), std::memory_order_relaxed);
+        if (r == 0) { errno = ECONNRESET; return false; } // peer closed
+        return r > 0;
+    }
+}
+
+namespace {
+    // The lobby socket the heartbeat runs on, -1 when none
+    std::atomic<int> heartbeat_fd{-1};
+
+    // "<name> HEARTBEAT <n>"
+    bool is_heartbeat_line(std::string_view line) {
+        const size_t sp = line.find(' ');
+        return sp != std::string_view::npos && line.compare(sp + 1, 10, "HEARTBEAT ") == 0;
+    }
+}
+
 bool recv_line(int fd, std::string& out) {
     out.clear();
-    char c;
     const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(TIMEOUT);
 
     auto remaining_ms = [&]() -> int {
@@ -136,8 +204,23 @@ bool recv_line(int fd, std::string& out) {
         return left > 0 ? static_cast<int>(left) : 0;
     };
 
+    std::unique_lock<std::mutex> lock;
+    RecvBuffer& b = recv_buffer(fd, lock);
+    const bool heartbeat = fd == heartbeat_fd.load(std::memory_order_relaxed);
+    size_t scanned = 0; // bytes past b.pos already known to hold no newline
     for (;;) {
-        // Wait for readability up to the remaining time
+        size_t nl = b.data.find('\n', b.pos + scanned);
+        if (nl != std::string::npos) {
+            out.assign(b.data, b.pos, nl - b.pos);
+            b.pos = nl + 1;
+            scanned = 0;
+            if (heartbeat && is_heartbeat_line(out)) continue; // the lobby's echo, not an answer
+            if (!out.empty() && out.back() == '\r') out.pop_back();      // CRLF
+            return true;
+        }
+        scanned = b.available();
+
+        // Wait for readability up to the remaining time; a partial line stays buffered
         int ms = remaining_ms();
         if (ms == 0) { errno = EAGAIN; return false; }
 
@@ -147,62 +230,202 @@ bool recv_line(int fd, std::string& out) {
 
         if (pr == 0)               { errno = EAGAIN; return false; } // overall timeout
         if (pr < 0)                { /* errno set by poll */ return false; }
-        if (!(pfd.revents & POLLIN)) continue; // spurious wakeup
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) continue; // spurious wakeup
 
-        // Now actually read one byte
-        ssize_t r;
-        do { r = ::recv(fd, &c, 1, 0); } while (r < 0 && errno == EINTR);
+        if (!recv_fill(fd, b)) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) continue;       // race, re-poll
+            return false;                                                // closed or hard error
+        }
+    }
+}
 
-        if (r == 0)                { errno = ECONNRESET; return false; } // peer closed
-        if (r < 0) {
+bool recv_lp_frame(int fd, std::string& out, uint32_t max_len) {
+    std::unique_lock<std::mutex> lock;
+    RecvBuffer& b = recv_buffer(fd, lock);
+    for (;;) {
+        if (b.available() >= 4) {
+            uint32_t netlen = 0;
+            memcpy(&netlen, b.data.data() + b.pos, 4);
+            uint32_t len = ntohl(netlen);
+            if (len > max_len) { errno = EMSGSIZE; return false; }
+            if (b.available() >= 4 + static_cast<size_t>(len)) {
+                out.assign(b.data, b.pos + 4, len);
+                b.pos += 4 + len;
+                return true;
+            }
+        }
+        // No timeout: a signal that clears running interrupts the poll instead
+        struct pollfd pfd{fd, POLLIN, 0};
+        int pr = ::poll(&pfd, 1, -1);
+        if (pr < 0) {
+            if (errno == EINTR && running) continue;
+            return false;
+        }
+        if (!recv_fill(fd, b)) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) continue;       // race, re-poll
-            return false;                                                // hard error
+            return false;                                                // closed or hard error
         }
+    }
+}
 
-        if (c == '\n') {
-            if (!out.empty() && out.back() == '\r') out.pop_back();      // CRLF
-            return true;
+int try_recv_lp_frame(int fd, std::string& out, uint32_t max_len) {
+    std::unique_lock<std::mutex> lock;
+    RecvBuffer& b = recv_buffer(fd, lock);
+    for (bool filled = false;; filled = true) {
+        if (b.available() >= 4) {
+            uint32_t netlen = 0;
+            memcpy(&netlen, b.data.data() + b.pos, 4);
+            uint32_t len = ntohl(netlen);
+            if (len > max_len) { errno = EMSGSIZE; return -1; }
+            if (b.available() >= 4 + static_cast<size_t>(len)) {
+                out.assign(b.data, b.pos + 4, len);
+                b.pos += 4 + len;
+                return 1;
+            }
         }
-        out.push_back(c);
+        if (filled) return 0;
+        if (!recv_fill(fd, b)) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
     }
 }
 
-bool recv_udp(int fd, std::string& out, sockaddr_storage* src, socklen_t* srclen) {
-    out.clear();
+bool send_msg_iov(int fd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = static_cast<size_t>(iovcnt);
+        ssize_t w = ::sendmsg(fd, &msg,
+#ifdef MSG_NOSIGNAL
+                              MSG_NOSIGNAL
+#else
+                              0
+#endif
+        );
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd{fd, POLLOUT, 0};
+                (void) ::poll(&pfd, 1, 100);
+                continue;
+            }
+            return false;
+        }
+        // drop what went out, possibly part of one buffer
+        size_t n = static_cast<size_t>(w);
+        while (iovcnt > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
 
-    sockaddr_storage peer{};
-    socklen_t plen = sizeof(peer);
-    char buf[2048];
+bool recv_line_ready(int fd) {
+    {
+        std::lock_guard<std::mutex> map_lock(recv_buffers_mutex);
+        if (!recv_buffers.count(fd)) return false;
+    }
+    std::unique_lock<std::mutex> lock;
+    RecvBuffer& b = recv_buffer(fd, lock);
+    return b.data.find('\n', b.pos) != std::string::npos;
+}
+
+namespace {
+    // Receive slots reused by every call on the thread, so datagrams are read
+    // straight into place and handed out as views
+    struct UdpSlots {
+        char data[UDP_BATCH][UDP_MAX_DGRAM];
+        sockaddr_storage peers[UDP_BATCH];
+    };
+    UdpSlots& udp_slots() {
+        // on the heap so threads that never touch UDP don't pay for it
+        thread_local std::unique_ptr<UdpSlots> slots(new UdpSlots);
+        return *slots;
+    }
+}
+
+bool recv_udp_view(int fd, std::string_view& out, sockaddr_storage* src, socklen_t* srclen) {
+    UdpSlots& slots = udp_slots();
+    sockaddr_storage& peer = slots.peers[0];
     for (;;) {
-        ssize_t r = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr*)&peer, &plen);
+        socklen_t plen = sizeof(peer);
+        ssize_t r = recvfrom(fd, slots.data[0], UDP_MAX_DGRAM, 0, (sockaddr*)&peer, &plen);
         if (r < 0) {
             if (errno == EINTR) continue;                   // retry on signal
             return false;                                   // error (EAGAIN if non-blocking w/o data)
         }
         // r == 0 is a valid *empty* UDP datagram; treat as success
-        out.assign(buf, buf + r);
-
-        // Trim trailing CRLF for convenience (optional)
-        while (!out.empty() && (out.back() == '\n' || out.back() == '\r'))
-            out.pop_back();
-
+        out = std::string_view(slots.data[0], static_cast<size_t>(r));
         if (src)    *src    = peer;
         if (srclen) *srclen = plen;
         return true;
     }
 }
 
-void erase_fd(int fd, struct pollfd **pfds, int *fd_count)
-{
-    for (int i = 0; i < *fd_count; ++i) {
-        if ((*pfds)[i].fd == fd) {
-            // Move the last entry into this slot
-            (*pfds)[i] = (*pfds)[*fd_count - 1];
-            (*fd_count)--;
-            return;
+bool recv_udp(int fd, std::string& out, sockaddr_storage* src, socklen_t* srclen) {
+    out.clear();
+    std::string_view view;
+    if (!recv_udp_view(fd, view, src, srclen)) return false;
+
+    // Trim trailing CRLF for convenience (optional)
+    while (!view.empty() && (view.back() == '\n' || view.back() == '\r'))
+        view.remove_suffix(1);
+    out.assign(view);
+    return true;
+}
+
+int recv_udp_batch(int fd, udp_datagram* out, int max) {
+    if (max > UDP_BATCH) max = UDP_BATCH;
+    UdpSlots& slots = udp_slots();
+    iovec iov[UDP_BATCH];
+    mmsghdr msgs[UDP_BATCH];
+    memset(msgs, 0, sizeof(msgs[0]) * static_cast<size_t>(max));
+    for (int i = 0; i < max; ++i) {
+        iov[i].iov_base = slots.data[i];
+        iov[i].iov_len = UDP_MAX_DGRAM;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &slots.peers[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(slots.peers[i]);
+    }
+    int n;
+    do { n = recvmmsg(fd, msgs, static_cast<unsigned>(max), MSG_DONTWAIT, nullptr); } while (n < 0 && errno == EINTR);
+    for (int i = 0; i < n; ++i) {
+        out[i].data = std::string_view(slots.data[i], msgs[i].msg_len);
+        out[i].addr = slots.peers[i];
+        out[i].addrlen = msgs[i].msg_hdr.msg_namelen;
+    }
+    return n;
+}
+
+int udp_send_batch(int fd, std::string_view msg, const endpoint* dests, size_t count) {
+    iovec iov{const_cast<char*>(msg.data()), msg.size()};
+    mmsghdr msgs[UDP_BATCH];
+    size_t sent = 0;
+    while (sent < count) {
+        unsigned chunk = static_cast<unsigned>(std::min<size_t>(count - sent, UDP_BATCH));
+        memset(msgs, 0, sizeof(msgs[0]) * chunk);
+        for (unsigned i = 0; i < chunk; ++i) {
+            const endpoint& d = dests[sent + i];
+            msgs[i].msg_hdr.msg_iov = &iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = const_cast<sockaddr_storage*>(&d.addr);
+            msgs[i].msg_hdr.msg_namelen = d.addrlen;
         }
+        int n = sendmmsg(fd, msgs, chunk, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // one bad destination (e.g. unreachable) would stall the rest: skip it
+            if (errno != EAGAIN && errno != EWOULDBLOCK) { ++sent; continue; }
+            break;
+        }
+        sent += static_cast<size_t>(n);
     }
-    // not found -> no-op
+    return static_cast<int>(sent);
 }
 
 int clientRecvError(int fd, const std::string& player, const std::string& why) {
@@ -321,6 +544,7 @@ int login(int fd, const string& player, string* user) {
     }
     cout << "Welcome, " << username << "!" << endl;
     *user = username;
+    start_lobby_heartbeat(fd, username);
     return 0;
 }
 
@@ -433,9 +657,7 @@ int welcome(int fd, const string& player, bool& isLoggedIn) {
                 validInput = true;
                 exit = true;
                 isLoggedIn = true;
-                sock_to_user[fd] = name;
-                user_to_sock[name] = fd;
-                username_to_info[name].online = true;
+                sessions.bind(fd, name);
             }
             else if (status == 1) {
                 cout << "Back to welcome menu..." << endl;
@@ -518,66 +740,116 @@ int getUDPSocket() {
 
 
 
+namespace {
+    string addr_text(const addrinfo* p) {
+        char ip_str[INET6_ADDRSTRLEN] = "?";
+        if (p->ai_family == AF_INET) {
+            inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(p->ai_addr)->sin_addr, ip_str, sizeof(ip_str));
+        } else if (p->ai_family == AF_INET6) {
+            inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6*>(p->ai_addr)->sin6_addr, ip_str, sizeof(ip_str));
+        }
+        return ip_str;
+    }
+}
+
 int tcp_connect_to(const string &player, const string& to, const string& IP, const string& PORT) {
     /*setting up getaddrinfo()*/
     struct addrinfo hints{};
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_flags = 0;
+    hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_protocol = IPPROTO_TCP;
-    struct addrinfo *res, *p;
+    hints.ai_flags = AI_ADDRCONFIG;
+    struct addrinfo *res;
     int status = getaddrinfo(IP.c_str(), PORT.c_str(), &hints, &res);
     if (status != 0) {
         fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
         return -1;
     }
+    // one address per family in turn, the resolver's first family leading
+    vector<const addrinfo*> first, other, order;
+    for (const addrinfo* p = res; p; p = p->ai_next) (p->ai_family == res->ai_family ? first : other).push_back(p);
+    for (size_t i = 0; i < max(first.size(), other.size()); i++) {
+        if (i < first.size()) order.push_back(first[i]);
+        if (i < other.size()) order.push_back(other[i]);
+    }
 
-    int sockfd = 0;
-    char ip_str[INET_ADDRSTRLEN];
-    for (p = res; p != NULL; p = p->ai_next) {
-        sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (sockfd == -1) {
-            fprintf(stderr, "[player%s to %s] socket error: %s\n", player.c_str(), to.c_str(), strerror(errno));
-            continue;
+    // Happy eyeballs: a new attempt every CONNECT_STAGGER_MS, or at once when
+    // the last one fails; the first to complete wins and the rest are closed
+    const auto start = chrono::steady_clock::now();
+    const auto deadline = start + chrono::milliseconds(CONNECT_TIMEOUT_MS);
+    auto next_attempt = start;
+    vector<pollfd> pending;
+    vector<const addrinfo*> pending_addr;
+    size_t next = 0;
+    int sockfd = -1, error = ETIMEDOUT;
+    const addrinfo* won = nullptr;
+    auto fail = [&](int fd, const addrinfo* p, int err) {
+        error = err;
+        fprintf(stderr, "[player%s to %s] connect error (%s): %s\n", player.c_str(), to.c_str(), addr_text(p).c_str(), strerror(err));
+        if (fd >= 0) close(fd);
+    };
+    while (sockfd < 0) {
+        const auto now = chrono::steady_clock::now();
+        if (now >= deadline) break;
+        if (next < order.size() && (pending.empty() || now >= next_attempt)) {
+            const addrinfo* p = order[next++];
+            int fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK, p->ai_protocol);
+            if (fd == -1) {
+                fprintf(stderr, "[player%s to %s] socket error: %s\n", player.c_str(), to.c_str(), strerror(errno));
+                error = errno;
+                continue;
+            }
+            cout << "[player" << player << " to " << to << "]: Attempting connection " << addr_text(p) << "..."<< endl;
+            if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+                sockfd = fd;
+                won = p;
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                fail(fd, p, errno);
+                continue;
+            }
+            pending.push_back(pollfd{fd, POLLOUT, 0});
+            pending_addr.push_back(p);
+            next_attempt = now + chrono::milliseconds(CONNECT_STAGGER_MS);
         }
-        const void* src = nullptr;
-        int family = p->ai_family;
-        if (family == AF_INET) {
-            const sockaddr_in* sin = reinterpret_cast<const sockaddr_in*>(p->ai_addr);
-            src = &sin->sin_addr;
-        } else if (family == AF_INET6) {
-            const sockaddr_in6* sin6 = reinterpret_cast<const sockaddr_in6*>(p->ai_addr);
-            src = &sin6->sin6_addr;
-        }
-        inet_ntop(p->ai_family, src, ip_str, INET_ADDRSTRLEN);
-        cout << "[player" << player << " to " << to << "]: Attempting connection " << ip_str << "..."<< endl;
-
-        status = connect(sockfd, p->ai_addr, p->ai_addrlen);
-        if (status != 0) {
-            fprintf(stderr, "[player%s to %s] connect error: %s\n", player.c_str(), to.c_str(), strerror(errno));
-            close(sockfd);
+        if (pending.empty()) {
+            if (next == order.size()) break;
             continue;
         }
-        cout << "[player" << player << " to " << to << "]: Connection established" << endl;
-        break;
+        const auto until = next < order.size() ? min(next_attempt, deadline) : deadline;
+        const int wait = static_cast<int>(max<long long>(0, duration_cast<chrono::milliseconds>(until - now).count() + 1));
+        if (poll(pending.data(), pending.size(), wait) < 0 && errno != EINTR) {
+            error = errno;
+            break;
+        }
+        for (size_t i = 0; i < pending.size();) {
+            if (pending[i].revents == 0) { i++; continue; }
+            int so_error = 0;
+            socklen_t len = sizeof(so_error);
+            getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+            if (so_error == 0) {
+                sockfd = pending[i].fd;
+                won = pending_addr[i];
+            } else {
+                fail(pending[i].fd, pending_addr[i], so_error);
+                next_attempt = chrono::steady_clock::now();
+            }
+            pending.erase(pending.begin() + static_cast<long>(i));
+            pending_addr.erase(pending_addr.begin() + static_cast<long>(i));
+            if (sockfd >= 0) break;
+        }
     }
-    if (p == nullptr) {
-        fprintf(stderr, "[player%s to %s] failed to connect: %s\n", player.c_str(), to.c_str(), strerror(errno));
-        close(sockfd);
+    for (const pollfd& p : pending) close(p.fd);
+    if (sockfd < 0) {
+        fprintf(stderr, "[player%s to %s] failed to connect: %s\n", player.c_str(), to.c_str(), strerror(error));
         freeaddrinfo(res);
         return -1;
     }
-    const void* src = nullptr;
-    int family = p->ai_family;
-    if (family == AF_INET) {
-        const sockaddr_in* sin = reinterpret_cast<const sockaddr_in*>(p->ai_addr);
-        src = &sin->sin_addr;
-    } else if (family == AF_INET6) {
-        const sockaddr_in6* sin6 = reinterpret_cast<const sockaddr_in6*>(p->ai_addr);
-        src = &sin6->sin6_addr;
-    }
-    inet_ntop(p->ai_family, src, ip_str, INET_ADDRSTRLEN);
-    cout << "[player" << player << " to " << to << "]: Connected to " << ip_str << "!"<< endl;
+    // the game and lobby code read and write this socket blocking
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK);
+    cout << "[player" << player << " to " << to << "]: Connection established" << endl;
+    cout << "[player" << player << " to " << to << "]: Connected to " << addr_text(won) << "!"<< endl;
     freeaddrinfo(res);
     return sockfd;
 }
@@ -600,51 +872,92 @@ bool query_bound_port(int fd, std::uint16_t& out_port) {
     return false;
 }
 
-int bind_udp_port_range(const char* ip, std::uint16_t min_port, std::uint16_t max_port, std::uint16_t& out_port) {
+namespace {
+    std::atomic<std::uint32_t> last_bound_udp_port{0}; // 0: nothing bound yet
+}
+
+int bind_udp_port_range(const char* ip, std::uint16_t min_port, std::uint16_t max_port, std::uint16_t& out_port,
+                        bool allow_ephemeral) {
     if (min_port > max_port) {
         errno = EINVAL;
         return -1;
     }
 
-    int last_errno = 0;
-    for (std::uint32_t port = min_port; port <= max_port; ++port) {
-        int fd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (fd < 0) {
-            return -1;
-        }
-
-        int yes = 1;
-        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-#ifdef SO_REUSEPORT
-        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
-#endif
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    if (!ip || std::strcmp(ip, "0.0.0.0") == 0) {
+        addr.sin_addr.s_addr = INADDR_ANY;
+    } else if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
 
-        sockaddr_in addr{};
-        addr.sin_family = AF_INET;
+    // No SO_REUSEADDR/SO_REUSEPORT: on UDP either lets a second B bind the
+    // same port and silently split the invitations. A failed bind leaves
+    // the socket unbound, so the one socket is retried port after port.
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    auto try_bind = [&](std::uint32_t port) {
         addr.sin_port = htons(static_cast<std::uint16_t>(port));
-        if (!ip || std::strcmp(ip, "0.0.0.0") == 0) {
-            addr.sin_addr.s_addr = INADDR_ANY;
-        } else if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
-            close(fd);
-            last_errno = EINVAL;
-            continue;
-        }
+        return bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    };
 
-        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
-            timeval tv{0, 500000};
-            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-            out_port = static_cast<std::uint16_t>(port);
-            return fd;
+    // the port that worked last time first, then the range from a random
+    // offset so instances started together don't all fight over min_port
+    const std::uint32_t span = static_cast<std::uint32_t>(max_port) - min_port + 1;
+    std::uint32_t last = last_bound_udp_port.load(std::memory_order_relaxed);
+    bool bound = last >= min_port && last <= max_port && try_bind(last);
+    int last_errno = bound ? 0 : errno;
+    if (!bound) {
+        std::uint32_t start = std::random_device{}() % span;
+        for (std::uint32_t i = 0; i < span && !bound; ++i) {
+            std::uint32_t port = min_port + (start + i) % span;
+            if (port == last) continue;
+            bound = try_bind(port);
+            if (!bound) last_errno = errno;
         }
+    }
+    // every port in the range is taken: let the kernel pick one
+    if (!bound && allow_ephemeral) bound = try_bind(0);
 
-        last_errno = errno;
+    std::uint16_t port = 0;
+    if (!bound || !query_bound_port(fd, port)) {
+        if (!bound && last_errno != 0) errno = last_errno;
         close(fd);
+        return -1;
+    }
+    if (port >= min_port && port <= max_port) {
+        last_bound_udp_port.store(port, std::memory_order_relaxed);
     }
+    timeval tv{0, 500000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    out_port = port;
+    return fd;
+}
 
-    if (last_errno != 0) {
-        errno = last_errno;
+namespace {
+    // Every host x port of the scan, resolved once; the addresses never change
+    const std::vector<endpoint>& probe_targets() {
+        static const std::vector<endpoint> targets = [] {
+            std::vector<endpoint> out;
+            out.reserve(PLAYERB_SCAN_HOSTS.size() * (PLAYERB_PORT_MAX - PLAYERB_PORT_MIN + 1));
+            for (const auto& host : PLAYERB_SCAN_HOSTS) {
+                for (std::uint32_t port = PLAYERB_PORT_MIN; port <= PLAYERB_PORT_MAX; ++port) {
+                    endpoint dest{};
+                    dest.addrlen = sizeof(dest.addr);
+                    const std::string port_str = std::to_string(port);
+                    if (!construct_udp_addr(host.c_str(), port_str.c_str(), dest.addr, dest.addrlen)) {
+                        continue;
+                    }
+                    out.push_back(dest);
+                }
+            }
+            return out;
+        }();
+        return targets;
     }
-    return -1;
 }
 
 int discover_waiting_players(int fd, const std::string& player, std::vector<endpoint>& opponents) {
@@ -655,53 +968,58 @@ int discover_waiting_players(int fd, const std::string& player, std::vector<endp
     }
 
     const std::string probe = player + " DISCOVER WHO\n";
-    for (const auto& host : PLAYERB_SCAN_HOSTS) {
-        for (std::uint32_t port = PLAYERB_PORT_MIN; port <= PLAYERB_PORT_MAX; ++port) {
-            sockaddr_storage dest{};
-            socklen_t destlen = sizeof(dest);
-            const std::string port_str = std::to_string(port);
-            if (!construct_udp_addr(host.c_str(), port_str.c_str(), dest, destlen)) {
-                continue;
-            }
-            (void)udp_send_msg(fd, probe, reinterpret_cast<const sockaddr*>(&dest), destlen);
-        }
-    }
+    const std::vector<endpoint>& targets = probe_targets();
+    (void)udp_send_batch(fd, probe, targets.data(), targets.size());
 
     const auto deadline = std::chrono::steady_clock::now() +
                           std::chrono::milliseconds(PLAYERB_SCAN_TOTAL_WINDOW_MS);
+    // pushed back whenever a new player shows up
+    auto quiet_until = std::chrono::steady_clock::now() +
+                       std::chrono::milliseconds(PLAYERB_SCAN_QUIET_MS);
     std::unordered_set<std::string> seen;
+    udp_datagram replies[UDP_BATCH];
+    std::string reply;
 
-    while (std::chrono::steady_clock::now() < deadline) {
+    for (;;) {
         auto now = std::chrono::steady_clock::now();
+        auto until = std::min(deadline, quiet_until);
         int remaining_ms = static_cast<int>(
-            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count());
+            std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count());
         if (remaining_ms <= 0) break;
         int timeout_ms = PLAYERB_SCAN_SLICE_MS;
         if (timeout_ms > remaining_ms) timeout_ms = remaining_ms;
 
-        std::string reply;
-        sockaddr_storage src{};
-        socklen_t srclen = sizeof(src);
-        if (!recv_udp_with_timeout(fd, reply, &src, &srclen, timeout_ms)) {
-            if (errno == EAGAIN || errno == EINTR) {
-                continue;
-            }
+        struct pollfd pfd{fd, POLLIN, 0};
+        int rc = poll(&pfd, 1, timeout_ms);
+        if (rc == 0) continue;
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        int n = recv_udp_batch(fd, replies, UDP_BATCH);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
             return -1;
         }
 
-        std::string arr[3];
-        parse_line(reply, arr);
-        if (arr[1] != "HERE") continue;
+        for (int i = 0; i < n; ++i) {
+            std::string_view data = replies[i].data;
+            while (!data.empty() && (data.back() == '\n' || data.back() == '\r')) data.remove_suffix(1);
+            reply.assign(data);
+            std::string arr[3];
+            parse_line(reply, arr);
+            if (arr[1] != "HERE" || arr[2] != "WAITING") continue;
 
-        if (arr[2] == "WAITING") {
-            IpPort ip_port = ip_port_from_sockaddr(src);
+            IpPort ip_port = ip_port_from_sockaddr(replies[i].addr);
             std::string key = ip_port.ip + ":" + ip_port.port;
             if (seen.insert(key).second) {
                 endpoint entry{};
-                entry.addr = src;
-                entry.addrlen = srclen;
+                entry.addr = replies[i].addr;
+                entry.addrlen = replies[i].addrlen;
                 entry.label = arr[0].empty() ? key : arr[0] + " (" + key + ")";
                 opponents.push_back(entry);
+                quiet_until = std::chrono::steady_clock::now() +
+                              std::chrono::milliseconds(PLAYERB_SCAN_QUIET_MS);
             }
         }
     }
@@ -719,7 +1037,7 @@ std::string visualise_sockaddr_storage(const sockaddr_storage& ss) {
 }
 
 // tools.cpp
-int start_tcp_server(std::string ip, uint16_t &out_port) {
+int start_tcp_server_in_range(std::string ip, uint16_t &out_port) {
     addrinfo hints{}, *res=nullptr;
     memset(&hints,0,sizeof(hints));
     hints.ai_family = AF_INET;
@@ -755,6 +1073,7 @@ bool recv_udp_with_timeout(int fd, std::string& out, sockaddr_storage* src, sock
 
 
 void clean_up(int& game_tcp_fd, int& invite_udp_fd, int& sockfd, const string& player, const string& reason) {
+    if (sockfd != -1 && sockfd == heartbeat_fd.load()) stop_lobby_heartbeat();
     if(reason == "INTERRUPT") cout << "[player" << player << "] An interrupt has been detected. Ending connection." << endl;
     else if(reason == "MANUAL") cout << "[player" << player << "] has quit the game. Ending connection." << endl;
     if(sockfd != -1) {
@@ -771,52 +1090,130 @@ void clean_up(int& game_tcp_fd, int& invite_udp_fd, int& sockfd, const string& p
 }
 
 
-bool check_opponent(int fd) {
-    if (fd < 0) return true;
+namespace {
+    // Keeps the lobby link honest from a thread of its own: every
+    // HEARTBEAT_INTERVAL_MS it sends a heartbeat, which the lobby echoes, and
+    // takes in whatever has arrived unless the main thread is reading the
+    // socket already. Echoes are dropped and opponent disconnects reported
+    // here; the link is dead on EOF or after LIVENESS_TIMEOUT_MS of silence.
+    class LobbyHeartbeat {
+    public:
+        ~LobbyHeartbeat() { stop(); }
 
-    struct pollfd pfd{fd, POLLIN, 0};
-    int rc;
-    do { rc = poll(&pfd, 1, 0); } while (rc < 0 && errno == EINTR);
-    if (rc < 0) return false;
-    if (rc == 0) return true;
-
-    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) return false;
-    if (!(pfd.revents & POLLIN)) return true;
-
-    char buf[BUFFER_SIZE];
-    const ssize_t peeked = recv(fd, buf, sizeof(buf), MSG_PEEK);
-    if (peeked <= 0) {
-        if (peeked == 0) return false;
-        if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
-        return false;
-    }
+        void start(int fd, const string& player) {
+            stop();
+            player_ = player;
+            alive_.store(true);
+            stopping_ = false;
+            buffer_of(fd).heard_ms.store(steady_ms(), std::memory_order_relaxed);
+            heartbeat_fd.store(fd);
+            // a full signal mask, so Ctrl-C still lands on the main thread
+            sigset_t all, old;
+            sigfillset(&all);
+            pthread_sigmask(SIG_SETMASK, &all, &old);
+            thread_ = std::thread([this, fd] { run(fd); });
+            pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        }
 
-    size_t newline = 0;
-    bool has_newline = false;
-    for (; newline < static_cast<size_t>(peeked); ++newline) {
-        if (buf[newline] == '\n') {
-            has_newline = true;
-            break;
+        void stop() {
+            if (!thread_.joinable()) return;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_all();
+            thread_.join();
+            heartbeat_fd.store(-1);
         }
-    }
-    if (!has_newline) return true;
 
-    std::string line(buf, buf + newline);
-    if (!line.empty() && line.back() == '\r') line.pop_back();
+        bool alive(int fd) const {
+            return fd != heartbeat_fd.load(std::memory_order_relaxed) || alive_.load(std::memory_order_relaxed);
+        }
 
-    std::string arr[3];
-    parse_line(line, arr);
-    if (arr[1] == "LOGOUT" && arr[2] == "INTERRUPT") {
-        std::string discard;
-        if (!recv_line(fd, discard)) return false;
-        std::cout << "[Info] Opponent " << arr[0] << " has disconnected." << std::endl;
-        return true;
-    }
+    private:
+        void run(int fd) {
+            std::unique_lock<std::mutex> wait_lock(mutex_);
+            for (uint64_t seq = 0; !stopping_; seq++) {
+                wait_lock.unlock();
+                if (!send_msg(fd, player_ + " HEARTBEAT " + to_string(seq) + "\n") || !take_in(fd)) {
+                    alive_.store(false);
+                    return;
+                }
+                wait_lock.lock();
+                wake_.wait_for(wait_lock, chrono::milliseconds(HEARTBEAT_INTERVAL_MS), [&] { return stopping_; });
+            }
+        }
+
+        // false once the lobby is gone; a reader holding the buffer keeps
+        // heard_ms fresh itself, so it is only skipped
+        bool take_in(int fd) {
+            std::unique_lock<std::mutex> lock;
+            if (RecvBuffer* b = recv_buffer(fd, lock, true)) {
+                struct pollfd pfd{fd, POLLIN, 0};
+                while (::poll(&pfd, 1, 0) > 0) {
+                    if (!recv_fill(fd, *b)) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                        return false;
+                    }
+                }
+                strip(*b);
+            }
+            return steady_ms() - buffer_of(fd).heard_ms.load(std::memory_order_relaxed) <= LIVENESS_TIMEOUT_MS;
+        }
+
+        // Drops every whole echo line; an opponent disconnect is taken only
+        // from the front, where the main thread would read it next
+        void strip(RecvBuffer& b) {
+            size_t at = b.pos;
+            for (size_t nl; (nl = b.data.find('\n', at)) != std::string::npos;) {
+                std::string_view line(b.data.data() + at, nl - at);
+                if (is_heartbeat_line(line)) {
+                    b.data.erase(at, nl + 1 - at);
+                    continue;
+                }
+                if (at == b.pos) {
+                    std::string arr[3];
+                    parse_line(std::string(line.substr(0, line.size() - (line.ends_with('\r') ? 1 : 0))), arr);
+                    if (arr[1] == "LOGOUT" && arr[2] == "INTERRUPT") {
+                        std::cout << "[Info] Opponent " << arr[0] << " has disconnected." << std::endl;
+                        b.pos = at = nl + 1;
+                        continue;
+                    }
+                }
+                at = nl + 1;
+            }
+        }
 
-    return true;
+        string player_;
+        std::atomic<bool> alive_{true};
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        bool stopping_ = false;
+        std::thread thread_;
+    };
+
+    LobbyHeartbeat lobby_heartbeat;
 }
 
+void start_lobby_heartbeat(int fd, const string& player) {
+    lobby_heartbeat.start(fd, player);
+}
 
+void stop_lobby_heartbeat() {
+    lobby_heartbeat.stop();
+}
+
+bool check_opponent(int fd) {
+    return fd < 0 || lobby_heartbeat.alive(fd);
+}
+
+bool enable_keepalive(int fd) {
+    int on = 1, idle = GAME_KEEPALIVE_IDLE_S, interval = GAME_KEEPALIVE_INTERVAL_S, probes = GAME_KEEPALIVE_PROBES;
+    return setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) == 0 &&
+           setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) == 0 &&
+           setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) == 0 &&
+           setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes)) == 0;
+}
 
 bool fetch_stats(int lobbyFD, const std::string& player, int& wins, int& losses) {
     wins = 0;
@@ -841,3 +1238,34 @@ bool fetch_stats(int lobbyFD, const std::string& player, int& wins, int& losses)
 }
 
 
+
+int lookup_waiting_players(int lobbyFD, const std::string& player, std::vector<endpoint>& opponents) {
+    opponents.clear();
+    if(!send_msg(lobbyFD, player + " DIRECTORY REQUEST\n")){
+        return -1;
+    }
+    std::string reply;
+    if(!recv_line(lobbyFD, reply)){
+        return -1;
+    }
+    std::string arr[3];
+    parse_line(reply, arr);
+    if(arr[0] != player || arr[1] != "DIRECTORY"){
+        return -1;
+    }
+    // "<count> <name> <ip> <port> ..."
+    std::istringstream iss(arr[2]);
+    int count = 0;
+    if(!(iss >> count)){
+        return -1;
+    }
+    std::string name, ip, port;
+    for (int i = 0; i < count && iss >> name >> ip >> port; i++) {
+        endpoint entry{};
+        entry.addrlen = sizeof(entry.addr);
+        if (!construct_udp_addr(ip.c_str(), port.c_str(), entry.addr, entry.addrlen)) continue;
+        entry.label = name + " (" + ip + ":" + port + ")";
+        opponents.push_back(entry);
+    }
+    return 0;
+}
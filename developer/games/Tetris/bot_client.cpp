@@ -0,0 +1,187 @@
+// Placement-search bots (tetris_bot.hpp), headless or over the game protocol.
+//
+//   bot_client --bench GAMES [--pieces N] [--preview K] [--threads T] [--beam W] [--budget-us U]
+//       plays GAMES local games of up to N pieces each and reports the speed
+//   bot_client HOST PORT TOKEN NAME... [--pace-ms P] [--threads T] [--beam W] [--budget-us U]
+//       one bot per NAME joins the room at HOST:PORT, e.g. to fill empty seats
+//       or to load-test a tetris server; runs until every match is over.
+//       --pace-ms spaces placements out (a seat filler wants a human pace, a
+//       load test none)
+//
+// A networked bot (BotSeat) plans once a snapshot of its board acks its last DROP.
+#include "../core/common.hpp"
+#include "../core/lp_framing.hpp"
+#include "tetris_bot.hpp"
+#include "tetris_command.hpp"
+#include "tetris_snapshot.hpp"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Options {
+    int games = 0;
+    int pieces = 1000;
+    int preview = 1;
+    size_t threads = 0;
+    int pace_ms = 0;
+    BotConfig bot;
+};
+
+int run_bench(const Options& opt, BotThreadPool* pool) {
+    TetrisBot bot(opt.bot, pool);
+    long long pieces = 0, lines = 0, score = 0;
+    int survived = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int g = 0; g < opt.games; ++g) {
+        TetrisGame game(g + 1);
+        pieces += bot.play(game, opt.pieces, opt.preview);
+        lines += game.lines_cleared;
+        score += game.score;
+        survived += !game.game_over;
+    }
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << opt.games << " games, " << pieces << " pieces, " << lines << " lines, score " << score << ", "
+              << survived << " reached " << opt.pieces << " pieces\n"
+              << secs << "s: " << (pieces ? secs * 1e6 / static_cast<double>(pieces) : 0.0) << " us per piece, "
+              << (secs > 0 ? static_cast<double>(pieces) / secs : 0.0) << " pieces/s\n";
+    return 0;
+}
+
+// One networked bot: plays its seat until GAME_OVER or the connection drops
+class BotSession {
+public:
+    BotSession(std::string host, uint16_t port, std::string token, std::string name, const Options& opt,
+               BotThreadPool* pool)
+        : host_(std::move(host)), port_(port), token_(std::move(token)), name_(std::move(name)),
+          pace_(opt.pace_ms), seat_bot_(opt.bot, pool) {}
+
+    void run() {
+        const int fd = connect_tcp(host_, port_);
+        if (fd < 0) {
+            log_message(LogLevel::Error, "Bot", name_ + ": cannot connect to " + host_ + ":" + std::to_string(port_));
+            return;
+        }
+        if (!lp_send_frame(fd, "HELLO username=" + name_ + " token=" + token_ + " snap=" + SNAP_BIN_TAG)) {
+            ::close(fd);
+            return;
+        }
+        std::string frame;
+        while (lp_recv_frame(fd, frame)) {
+            if (is_binary_snapshot(frame)) {
+                int player = -1;
+                if (!apply_binary_snapshot(frame, views_, player) || player != seat_) continue;
+                if (!move(fd)) break;
+            } else if (frame.rfind("WELCOME", 0) == 0) {
+                welcome(frame);
+                if (seat_ < 0) break; // seats taken, a bot has nothing to watch for
+            } else if (frame.rfind("GAME_OVER", 0) == 0 || frame.rfind("ERR", 0) == 0) {
+                log_checkpoint("Bot", "FINISHED", name_ + " " + frame);
+                break;
+            }
+        }
+        ::close(fd);
+    }
+
+private:
+    void welcome(const std::string& frame) {
+        std::istringstream iss(frame);
+        std::string kv;
+        while (iss >> kv) {
+            if (kv.rfind("role=P", 0) == 0) seat_ = std::atoi(kv.c_str() + 6) - 1;
+            else if (kv.rfind("seed=", 0) == 0) seat_bot_.start(static_cast<int>(std::atoll(kv.c_str() + 5)));
+            else if (kv == std::string("cmd=") + CMD_BIN_TAG) binary_inputs_ = true;
+        }
+        log_checkpoint("Bot", "SEATED", name_ + " seat=" + std::to_string(seat_ + 1));
+    }
+
+    // Plans and sends the next placement once the server has applied every input so far
+    bool move(int fd) {
+        const SnapshotView& view = views_[seat_];
+        if (view.gameover) return false;
+        if (view.ack != sent_) return true; // the last placement is still on its way
+        // Too early: a later snapshot (gravity keeps them coming) tries again
+        const auto now = std::chrono::steady_clock::now();
+        if (now < next_move_) return true;
+        next_move_ = now + pace_;
+
+        actions_.clear();
+        if (!seat_bot_.next_move(view, actions_)) return true; // nothing fits: gravity will end it
+        for (const char* action : actions_) {
+            const std::string frame =
+                binary_inputs_ ? encode_input_command(static_cast<InputAction>(input_action_code(action)), ++sent_)
+                               : std::string("INPUT ") + action + " seq=" + std::to_string(++sent_);
+            if (!lp_send_frame(fd, frame)) return false;
+        }
+        return true;
+    }
+
+    std::string host_;
+    uint16_t port_;
+    std::string token_;
+    std::string name_;
+    std::chrono::milliseconds pace_;
+    std::chrono::steady_clock::time_point next_move_{};
+    BotSeat seat_bot_;
+    SnapshotView views_[2];
+    std::vector<const char*> actions_;
+    int seat_ = -1;
+    bool binary_inputs_ = false; // the room reads binary INPUT commands
+    uint32_t sent_ = 0; // seq of the last INPUT sent
+};
+
+void usage() {
+    std::cerr << "usage: bot_client --bench GAMES [--pieces N] [--preview K] [options]\n"
+              << "       bot_client HOST PORT TOKEN NAME... [options]\n"
+              << "options: --pace-ms P  --threads T  --beam W  --budget-us U\n";
+}
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (a == "--bench" && has_value) opt.games = std::atoi(argv[++i]);
+        else if (a == "--pieces" && has_value) opt.pieces = std::atoi(argv[++i]);
+        else if (a == "--preview" && has_value) opt.preview = std::atoi(argv[++i]);
+        else if (a == "--pace-ms" && has_value) opt.pace_ms = std::atoi(argv[++i]);
+        else if (a == "--threads" && has_value) opt.threads = static_cast<size_t>(std::atoi(argv[++i]));
+        else if (a == "--beam" && has_value) opt.bot.beam_width = std::atoi(argv[++i]);
+        else if (a == "--budget-us" && has_value) opt.bot.budget = std::chrono::microseconds(std::atoll(argv[++i]));
+        else if (a.rfind("--", 0) == 0) {
+            usage();
+            return 2;
+        } else args.push_back(a);
+    }
+
+    BotThreadPool pool;
+    if (opt.threads > 0) pool.start(opt.threads);
+    BotThreadPool* shared = opt.threads > 0 ? &pool : nullptr;
+    if (opt.games > 0) return run_bench(opt, shared);
+    if (args.size() < 4) {
+        usage();
+        return 2;
+    }
+
+    install_signal_handlers();
+    const uint16_t port = static_cast<uint16_t>(std::atoi(args[1].c_str()));
+    std::vector<std::unique_ptr<BotSession>> sessions;
+    std::vector<std::thread> threads;
+    for (size_t i = 3; i < args.size(); ++i) {
+        sessions.push_back(std::make_unique<BotSession>(args[0], port, args[2], args[i], opt, shared));
+    }
+    for (auto& s : sessions) threads.emplace_back([&s] { s->run(); });
+    for (auto& t : threads) t.join();
+    return 0;
+}
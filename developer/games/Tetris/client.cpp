@@ -14,34 +14,39 @@
 #include <algorithm>
 
 #include <array>
-#include <atomic>
+#include <charconv>
 #include <chrono>
-#include <condition_variable>
 #include <csignal>
 #include <cctype>
 #include <cstring>
-#include <iomanip>
+#include <deque>
+#include <functional>
 #include <iostream>
-#include <map>
 #include <memory>
-#include <mutex>
 #include <optional>
+#include <random>
+#include <set>
 #include <sstream>
 #include <string>
-#include <thread>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
-#include "common.hpp"
-#include "lp_framing.hpp"
+#include "../core/common.hpp"
+#include "../core/lp_framing.hpp"
+#include "tetris_command.hpp"
 #include "tetris_game.hpp"
+#include "tetris_lockstep.hpp"
+#include "tetris_snapshot.hpp"
+#include "udp_channel.hpp"
 
 namespace {
-std::mutex g_console_mutex;
+// Everything runs on ClientApp's one poll loop, so console output needs no lock
+unsigned g_console_writes = 0; // bumped by every safe_print
 
 void safe_print(const std::string& text) {
-    std::lock_guard<std::mutex> lock(g_console_mutex);
     std::cout << text << std::flush;
+    ++g_console_writes;
 }
 
 void safe_print_notice(const std::string& text) {
@@ -51,6 +56,15 @@ void safe_print_notice(const std::string& text) {
     safe_print(msg);
 }
 
+constexpr int kNoTimeout = -1; // poll() waits for as long as it takes
+
+// The earlier of two poll timeouts, either of which may be kNoTimeout
+int sooner(int a, int b) {
+    if (a < 0) return b;
+    if (b < 0) return a;
+    return std::min(a, b);
+}
+
 struct TerminalRawMode {
     termios old{};
     bool active = false;
@@ -80,24 +94,75 @@ struct TerminalRawMode {
     }
 };
 
+// One board as drawn: a color digit '0'..'7' per cell, row by row
 struct SnapshotData {
-    std::string board;
+    std::array<char, BOARD_ROWS * BOARD_COLS> board{};
+    bool have_board = false; // board holds a frame; drawn empty until then
     int score = 0;
     int lines = 0;
     bool gameover = false;
 };
 
+// The two boards of a match, by seat (0 for P1, 1 for P2). Binary snapshots
+// and lockstep events name the seat; a text SNAPSHOT only names the player,
+// who keeps the seat they were first given. A name is copied only when a seat
+// changes hands, so updating a board allocates nothing.
+struct MatchBoards {
+    std::array<std::string, 2> names;
+    std::array<SnapshotData, 2> boards;
+
+    // The board of seat, now held by name
+    SnapshotData& at(int seat, std::string_view name) {
+        if (names[seat] != name) names[seat] = name;
+        return boards[seat];
+    }
+    // name's seat, or the first free one; -1 when both are someone else's
+    int seat_of(std::string_view name) {
+        for (int s = 0; s < 2; ++s) {
+            if (names[s] == name) return s;
+        }
+        for (int s = 0; s < 2; ++s) {
+            if (names[s].empty()) {
+                names[s] = name;
+                return s;
+            }
+        }
+        return -1;
+    }
+    bool empty() const { return names[0].empty() && names[1].empty(); }
+};
+
 #if defined(HAVE_X11_GUI)
+// One tile of a spectator grid as X11Renderer::render_grid draws it
+struct GridCell {
+    std::string_view title;
+    const MatchBoards* match = nullptr; // null: an empty slot
+    bool focused = false;
+};
+
 class X11Renderer {
    public:
-    static std::unique_ptr<X11Renderer> Create(const std::string& local_user, bool spectator) {
-        std::unique_ptr<X11Renderer> renderer(new X11Renderer(local_user, spectator));
+    static constexpr int kGridCols = 4; // tiles per page of a grid window
+    static constexpr int kGridRows = 3;
+
+    static std::unique_ptr<X11Renderer> Create(bool spectator) {
+        std::unique_ptr<X11Renderer> renderer(
+            new X11Renderer(spectator ? "Tetris Spectator" : "Tetris Match", 700, 520, spectator, false));
+        if (!renderer->ready()) return nullptr;
+        return renderer;
+    }
+
+    // A window of kGridCols x kGridRows small match tiles
+    static std::unique_ptr<X11Renderer> CreateGrid() {
+        std::unique_ptr<X11Renderer> renderer(new X11Renderer(
+            "Tetris Grid", kGridCols * kTileWidth, kStatusHeight + kGridRows * kTileHeight, true, true));
         if (!renderer->ready()) return nullptr;
         return renderer;
     }
 
     ~X11Renderer() {
         if (display_) {
+            if (back_) XFreePixmap(display_, back_);
             if (gc_) XFreeGC(display_, gc_);
             if (window_) XDestroyWindow(display_, window_);
             XCloseDisplay(display_);
@@ -105,32 +170,78 @@ class X11Renderer {
     }
 
     bool is_open() const { return display_ && window_ && running_; }
+    // False while the window is unmapped (minimized): nothing in it can be seen
+    bool mapped() const { return mapped_; }
+
+    // The X server connection, for the session's poll set
+    int connection_fd() const { return display_ ? ConnectionNumber(display_) : -1; }
+    // Events Xlib has already read off that fd: poll would not report them
+    bool has_queued_events() const { return display_ && XEventsQueued(display_, QueuedAlready) > 0; }
 
     void set_status(const std::string& text) {
         status_text_ = text;
         redraw_pending_ = true;
     }
 
-    void render(const std::vector<std::pair<std::string, SnapshotData>>& players,
-                const std::string& local_user) {
+    // Seat left_seat is drawn on the left; with boards 1, only that seat
+    void render(const MatchBoards& match, int left_seat, const std::string& local_user, int boards = 2) {
         if (!ready()) return;
 
-        std::vector<std::pair<std::string, SnapshotData>> ordered = players;
-        while (ordered.size() < 2) ordered.emplace_back("(waiting)", SnapshotData{});
-
-        XSetForeground(display_, gc_, bg_color_);
-        XFillRectangle(display_, window_, gc_, 0, 0, width_, height_);
+        // Everything is drawn into back_ and only what changed since the last
+        // frame is painted there, then copied to the window
+        const bool first = !painted_;
+        if (first) {
+            XSetForeground(display_, gc_, bg_color_);
+            XFillRectangle(display_, back_, gc_, 0, 0, width_, height_);
+            for (BoardCache& cache : shown_) cache = BoardCache{};
+            shown_status_.clear();
+        }
 
-        XSetForeground(display_, gc_, text_color_);
-        XDrawString(display_, window_, gc_, 20, 30,
-                    status_text_.c_str(), static_cast<int>(status_text_.size()));
+        if (first || status_text_ != shown_status_) {
+            XSetForeground(display_, gc_, bg_color_);
+            XFillRectangle(display_, back_, gc_, 0, 0, width_, kStatusHeight);
+            XSetForeground(display_, gc_, text_color_);
+            XDrawString(display_, back_, gc_, 20, 30, status_text_.c_str(), static_cast<int>(status_text_.size()));
+            XCopyArea(display_, back_, window_, gc_, 0, 0, width_, kStatusHeight, 0, 0);
+            shown_status_ = status_text_;
+        }
 
-        draw_board(ordered[0], 40, 70, ordered[0].first == local_user ? "You" : ordered[0].first);
-        draw_board(ordered[1], width_ / 2 + 20, 70,
-                   ordered[1].first == local_user ? "You" : ordered[1].first);
+        for (int i = 0; i < boards; ++i) {
+            const int seat = i == 0 ? left_seat : 1 - left_seat;
+            const std::string& name = match.names[seat];
+            std::string caption = name.empty() ? "(waiting)" : name == local_user ? "You" : name;
+            caption += " | Score: " + std::to_string(match.boards[seat].score);
+            draw_board(shown_[i], match.boards[seat], i == 0 ? 40 : width_ / 2 + 20, 70, caption, cell_size_);
+        }
+        finish_frame(first);
+    }
 
-        XFlush(display_);
-        redraw_pending_ = false;
+    // cells fill the grid row by row; like render(), only what changed since
+    // the last frame is painted
+    void render_grid(const std::vector<GridCell>& cells, const std::string& status) {
+        if (!ready()) return;
+        const bool first = !painted_;
+        if (first) {
+            XSetForeground(display_, gc_, bg_color_);
+            XFillRectangle(display_, back_, gc_, 0, 0, width_, height_);
+            grid_shown_.assign(kGridCols * kGridRows, TileCache{});
+            shown_status_.clear();
+        }
+        status_text_ = status;
+        if (first || status_text_ != shown_status_) {
+            XSetForeground(display_, gc_, bg_color_);
+            XFillRectangle(display_, back_, gc_, 0, 0, width_, kStatusHeight);
+            XSetForeground(display_, gc_, text_color_);
+            XDrawString(display_, back_, gc_, 10, 25, status_text_.c_str(), static_cast<int>(status_text_.size()));
+            XCopyArea(display_, back_, window_, gc_, 0, 0, width_, kStatusHeight, 0, 0);
+            shown_status_ = status_text_;
+        }
+        for (size_t slot = 0; slot < grid_shown_.size(); ++slot) {
+            const GridCell cell = slot < cells.size() ? cells[slot] : GridCell{};
+            draw_tile(grid_shown_[slot], cell, static_cast<int>(slot % kGridCols) * kTileWidth,
+                      kStatusHeight + static_cast<int>(slot / kGridCols) * kTileHeight);
+        }
+        finish_frame(first);
     }
 
     std::optional<std::string> poll_action() {
@@ -145,12 +256,27 @@ class X11Renderer {
             } else if (ev.type == DestroyNotify) {
                 running_ = false;
                 break;
+            } else if (ev.type == MapNotify || ev.type == UnmapNotify) {
+                mapped_ = ev.type == MapNotify;
+            } else if (ev.type == ButtonPress && grid_) {
+                const int col = ev.xbutton.x / kTileWidth;
+                const int row = (ev.xbutton.y - kStatusHeight) / kTileHeight;
+                if (ev.xbutton.y >= kStatusHeight && col < kGridCols && row < kGridRows) {
+                    return "FOCUS " + std::to_string(row * kGridCols + col);
+                }
             } else if (ev.type == KeyPress) {
                 KeySym sym = XLookupKeysym(&ev.xkey, 0);
                 if (sym == XK_Escape || sym == XK_q || sym == XK_Q) {
                     running_ = false;
                     break;
                 }
+                if (grid_) {
+                    if (sym == XK_n || sym == XK_Next) return std::string("NEXT_PAGE");
+                    if (sym == XK_p || sym == XK_Prior) return std::string("PREV_PAGE");
+                    if (sym == XK_Right || sym == XK_Tab) return std::string("FOCUS_NEXT");
+                    if (sym == XK_Left) return std::string("FOCUS_PREV");
+                    continue;
+                }
                 if (spectator_) continue;
                 if (sym == XK_Left) return std::string("LEFT");
                 if (sym == XK_Right) return std::string("RIGHT");
@@ -158,8 +284,15 @@ class X11Renderer {
                 if (sym == XK_Up) return std::string("ROTATE");
                 if (sym == XK_space) return std::string("DROP");
                 if (sym == XK_h || sym == XK_H) return std::string("HOLD");
-            } else if (ev.type == Expose || ev.type == ConfigureNotify) {
-                redraw_pending_ = true;
+            } else if (ev.type == Expose) {
+                // The back buffer already holds the frame, just show that part again
+                if (painted_) {
+                    XCopyArea(display_, back_, window_, gc_, ev.xexpose.x, ev.xexpose.y,
+                              static_cast<unsigned>(ev.xexpose.width), static_cast<unsigned>(ev.xexpose.height),
+                              ev.xexpose.x, ev.xexpose.y);
+                } else {
+                    redraw_pending_ = true;
+                }
             }
         }
         return std::nullopt;
@@ -172,13 +305,11 @@ class X11Renderer {
     }
 
    private:
-    X11Renderer(const std::string& local_user, bool spectator)
-        : spectator_(spectator), local_user_(local_user) {
+    X11Renderer(const char* title, int width, int height, bool spectator, bool grid)
+        : spectator_(spectator), grid_(grid), width_(width), height_(height) {
         display_ = XOpenDisplay(nullptr);
         if (!display_) return;
         int screen = DefaultScreen(display_);
-        width_ = 700;
-        height_ = 520;
         window_ = XCreateSimpleWindow(display_, RootWindow(display_, screen), 0, 0, width_, height_, 1,
                                       BlackPixel(display_, screen), BlackPixel(display_, screen));
         if (!window_) {
@@ -186,8 +317,9 @@ class X11Renderer {
             display_ = nullptr;
             return;
         }
-        XStoreName(display_, window_, spectator ? "Tetris Spectator" : "Tetris Match");
-        XSelectInput(display_, window_, ExposureMask | KeyPressMask | StructureNotifyMask);
+        XStoreName(display_, window_, title);
+        XSelectInput(display_, window_,
+                     ExposureMask | KeyPressMask | StructureNotifyMask | (grid ? ButtonPressMask : 0));
         wm_delete_window_ = XInternAtom(display_, "WM_DELETE_WINDOW", False);
         XSetWMProtocols(display_, window_, &wm_delete_window_, 1);
         gc_ = XCreateGC(display_, window_, 0, nullptr);
@@ -198,6 +330,8 @@ class X11Renderer {
             window_ = 0;
             return;
         }
+        back_ = XCreatePixmap(display_, window_, static_cast<unsigned>(width_), static_cast<unsigned>(height_),
+                              static_cast<unsigned>(DefaultDepth(display_, screen)));
         colormap_ = DefaultColormap(display_, screen);
         allocate_palette();
         XMapWindow(display_, window_);
@@ -205,7 +339,14 @@ class X11Renderer {
         redraw_pending_ = true;
     }
 
-    bool ready() const { return display_ && window_ && gc_; }
+    bool ready() const { return display_ && window_ && gc_ && back_; }
+
+    void finish_frame(bool first) {
+        if (first) XCopyArea(display_, back_, window_, gc_, 0, 0, width_, height_, 0, 0);
+        painted_ = true;
+        XFlush(display_);
+        redraw_pending_ = false;
+    }
 
     unsigned long alloc_color(unsigned char r, unsigned char g, unsigned char b) {
         XColor color;
@@ -238,52 +379,133 @@ class X11Renderer {
         }
     }
 
-    void draw_board(const std::pair<std::string, SnapshotData>& player,
+    // What one board panel currently shows in back_
+    struct BoardCache {
+        bool panel = false;
+        std::string caption;
+        std::string cells; // color index per cell, empty until the first frame
+    };
+
+    // What one grid tile currently shows in back_
+    struct TileCache {
+        bool drawn = false;
+        bool empty = false;
+        bool focused = false;
+        std::string title;
+        BoardCache boards[2];
+    };
+
+    // A tile: a title line over both boards at thumbnail size, framed when it
+    // has the focus. A slot that changes from empty to a match or back is
+    // cleared and drawn again; otherwise only what differs is painted.
+    void draw_tile(TileCache& cache, const GridCell& cell, int x, int y) {
+        const bool empty = cell.match == nullptr;
+        if (!cache.drawn || cache.empty != empty) {
+            XSetForeground(display_, gc_, bg_color_);
+            XFillRectangle(display_, back_, gc_, x, y, kTileWidth, kTileHeight);
+            XCopyArea(display_, back_, window_, gc_, x, y, kTileWidth, kTileHeight, x, y);
+            cache = TileCache{};
+            cache.drawn = true;
+            cache.empty = empty;
+        }
+        if (empty) return;
+        if (cell.focused != cache.focused || cache.title != cell.title) {
+            XSetForeground(display_, gc_, bg_color_);
+            XFillRectangle(display_, back_, gc_, x + 2, y + 2, kTileWidth - 4, 18);
+            XSetForeground(display_, gc_, cell.focused ? block_colors_[4] : text_color_);
+            XDrawString(display_, back_, gc_, x + 10, y + 15, cell.title.data(), static_cast<int>(cell.title.size()));
+            XSetForeground(display_, gc_, cell.focused ? block_colors_[4] : bg_color_);
+            XDrawRectangle(display_, back_, gc_, x + 1, y + 1, kTileWidth - 3, kTileHeight - 3);
+            XCopyArea(display_, back_, window_, gc_, x, y, kTileWidth, kTileHeight, x, y);
+            cache.focused = cell.focused;
+            cache.title.assign(cell.title);
+        }
+        for (int b = 0; b < 2; ++b) {
+            const std::string& name = cell.match->names[b];
+            std::string caption = name.empty() ? "(waiting)" : name.substr(0, 9);
+            caption += ' ' + std::to_string(cell.match->boards[b].score);
+            draw_board(cache.boards[b], cell.match->boards[b], x + 20 + b * (kThumbCell * BOARD_COLS + 30), y + 56,
+                       caption, kThumbCell);
+        }
+    }
+
+    // Repaints only the caption and the cells that differ from cache, one
+    // XFillRectangles per color, and copies the touched area to the window
+    void draw_board(BoardCache& cache,
+                    const SnapshotData& player,
                     int origin_x,
                     int origin_y,
-                    const std::string& label) {
-        const int board_w = cell_size_ * BOARD_COLS;
-        const int board_h = cell_size_ * BOARD_ROWS;
-
-        unsigned long panel = panel_color_;
-        XSetForeground(display_, gc_, panel);
-        XFillRectangle(display_, window_, gc_, origin_x - 10, origin_y - 36, board_w + 20, board_h + 56);
-
-        XSetForeground(display_, gc_, text_color_);
-        std::string caption = label.empty() ? "(waiting)" : label;
-        caption += " | Score: " + std::to_string(player.second.score);
-        XDrawString(display_, window_, gc_, origin_x, origin_y - 12,
-                    caption.c_str(), static_cast<int>(caption.size()));
-
-        XSetForeground(display_, gc_, block_colors_[0]);
-        XFillRectangle(display_, window_, gc_, origin_x, origin_y, board_w, board_h);
+                    const std::string& caption,
+                    int cell_size) {
+        const int board_w = cell_size * BOARD_COLS;
+        const int board_h = cell_size * BOARD_ROWS;
+
+        if (!cache.panel) {
+            XSetForeground(display_, gc_, panel_color_);
+            XFillRectangle(display_, back_, gc_, origin_x - 10, origin_y - 36, board_w + 20, board_h + 56);
+            XSetForeground(display_, gc_, block_colors_[0]);
+            XFillRectangle(display_, back_, gc_, origin_x, origin_y, board_w, board_h);
+            cache.panel = true; // only on a first frame, which render() copies whole
+            cache.cells.assign(BOARD_ROWS * BOARD_COLS, '\0'); // the board is all empty-colored now
+        }
 
-        const std::string& board = player.second.board;
-        if (board.size() != BOARD_ROWS * BOARD_COLS) {
-            return;
+        if (caption != cache.caption) {
+            XSetForeground(display_, gc_, panel_color_);
+            XFillRectangle(display_, back_, gc_, origin_x - 10, origin_y - 30, board_w + 20, 26);
+            XSetForeground(display_, gc_, text_color_);
+            XDrawString(display_, back_, gc_, origin_x, origin_y - 12, caption.c_str(), static_cast<int>(caption.size()));
+            XCopyArea(display_, back_, window_, gc_, origin_x - 10, origin_y - 30, board_w + 20, 26,
+                      origin_x - 10, origin_y - 30);
+            cache.caption = caption;
         }
 
+        const bool valid = player.have_board;
+        std::array<std::vector<XRectangle>, 8> dirty;
+        int min_r = BOARD_ROWS, max_r = -1, min_c = BOARD_COLS, max_c = -1;
         for (int r = 0; r < BOARD_ROWS; ++r) {
             for (int c = 0; c < BOARD_COLS; ++c) {
-                char ch = board[r * BOARD_COLS + c];
-                int idx = (ch >= '0' && ch <= '7') ? ch - '0' : 0;
-                XSetForeground(display_, gc_, block_colors_[idx]);
-                XFillRectangle(display_, window_, gc_,
-                               origin_x + c * cell_size_ + 1,
-                               origin_y + r * cell_size_ + 1,
-                               cell_size_ - 2, cell_size_ - 2);
+                const int i = r * BOARD_COLS + c;
+                char ch = valid ? player.board[i] : '0';
+                const char idx = static_cast<char>((ch >= '0' && ch <= '7') ? ch - '0' : 0);
+                if (cache.cells[i] == idx) continue;
+                cache.cells[i] = idx;
+                dirty[static_cast<size_t>(idx)].push_back(XRectangle{static_cast<short>(origin_x + c * cell_size + 1),
+                                                                      static_cast<short>(origin_y + r * cell_size + 1),
+                                                                      static_cast<unsigned short>(cell_size - 2),
+                                                                      static_cast<unsigned short>(cell_size - 2)});
+                min_r = std::min(min_r, r);
+                max_r = std::max(max_r, r);
+                min_c = std::min(min_c, c);
+                max_c = std::max(max_c, c);
             }
         }
+        if (max_r < 0) return;
+        for (size_t idx = 0; idx < dirty.size(); ++idx) {
+            if (dirty[idx].empty()) continue;
+            XSetForeground(display_, gc_, block_colors_[idx]);
+            XFillRectangles(display_, back_, gc_, dirty[idx].data(), static_cast<int>(dirty[idx].size()));
+        }
+        const int x = origin_x + min_c * cell_size;
+        const int y = origin_y + min_r * cell_size;
+        XCopyArea(display_, back_, window_, gc_, x, y, static_cast<unsigned>((max_c - min_c + 1) * cell_size),
+                  static_cast<unsigned>((max_r - min_r + 1) * cell_size), x, y);
     }
 
+    static constexpr int kStatusHeight = 40; // strip at the top holding the status line
+    static constexpr int kThumbCell = 8;     // cell size on grid tiles
+    static constexpr int kTileWidth = 2 * (kThumbCell * BOARD_COLS + 30) + 10;
+    static constexpr int kTileHeight = 56 + kThumbCell * BOARD_ROWS + 24;
+
     Display* display_{nullptr};
     Window window_{0};
+    Pixmap back_{0}; // off-screen copy of the window, so Expose never needs a redraw
     GC gc_{0};
     Colormap colormap_{0};
     Atom wm_delete_window_{0};
     bool spectator_ = false;
-    std::string local_user_;
+    bool grid_ = false; // a CreateGrid() window: keys page and focus instead of playing
     bool running_ = false;
+    bool mapped_ = true;
     bool redraw_pending_ = false;
     int width_ = 0;
     int height_ = 0;
@@ -293,14 +515,220 @@ class X11Renderer {
     unsigned long text_color_ = 0;
     std::array<unsigned long, 8> block_colors_{};
     std::string status_text_ = "Waiting for snapshots...";
+    std::string shown_status_;
+    BoardCache shown_[2];
+    std::vector<TileCache> grid_shown_; // per slot of a grid window
+    bool painted_ = false; // back_ holds a complete frame
 };
 #endif  // HAVE_X11_GUI
 
+// Text-mode match view. Keeps a shadow of what the terminal shows and writes
+// only cursor moves, color changes and the cells that differ, as one write()
+// per frame. Anything printed through safe_print in between may have scrolled
+// the screen, so the frame after it is drawn in full.
+class TerminalRenderer {
+   public:
+    struct Cell {
+        char ch = ' ';
+        uint8_t color = 0; // 0 terminal default, 1-7 piece colors
+        bool operator==(const Cell& o) const { return ch == o.ch && color == o.color; }
+    };
+    using Frame = std::vector<std::vector<Cell>>;
+
+    void present(const Frame& frame) {
+        std::string out;
+        const bool full = !valid_ || seen_writes_ != g_console_writes;
+        if (full) {
+            out = "\033[0m\033[2J\033[H";
+            shown_.clear();
+            row_ = col_ = 0;
+            pen_ = 0;
+        }
+        shown_.resize(std::max(shown_.size(), frame.size()));
+        for (size_t r = 0; r < shown_.size(); ++r) {
+            static const std::vector<Cell> kEmpty;
+            const std::vector<Cell>& want = r < frame.size() ? frame[r] : kEmpty;
+            std::vector<Cell>& have = shown_[r];
+            for (size_t c = 0; c < std::max(want.size(), have.size()); ++c) {
+                const Cell cell = c < want.size() ? want[c] : Cell{};
+                if (cell == (c < have.size() ? have[c] : Cell{})) continue; // a cleared screen is all blank
+                move_to(out, static_cast<int>(r), static_cast<int>(c));
+                set_pen(out, cell.color);
+                out.push_back(cell.ch);
+                ++col_;
+            }
+            have = want;
+        }
+        // Park below the frame so notices print there
+        move_to(out, static_cast<int>(frame.size()), 0);
+        set_pen(out, 0);
+        write_all(out);
+        valid_ = true;
+        seen_writes_ = g_console_writes;
+    }
+
+   private:
+    void move_to(std::string& out, int row, int col) {
+        if (row == row_ && col == col_) return;
+        out += "\033[" + std::to_string(row + 1) + ';' + std::to_string(col + 1) + 'H';
+        row_ = row;
+        col_ = col;
+    }
+
+    void set_pen(std::string& out, uint8_t color) {
+        static const char* const kPens[8] = {"\033[0m",    "\033[1;36m", "\033[1;35m", "\033[1;33m",
+                                             "\033[1;34m", "\033[1;93m", "\033[1;32m", "\033[1;31m"};
+        if (color == pen_ || color > 7) return;
+        out += kPens[color];
+        pen_ = color;
+    }
+
+    static void write_all(const std::string& out) {
+        std::cout << std::flush; // nothing of ours may be left in the stream buffer
+        size_t off = 0;
+        while (off < out.size()) {
+            ssize_t n = ::write(STDOUT_FILENO, out.data() + off, out.size() - off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            off += static_cast<size_t>(n);
+        }
+    }
+
+    Frame shown_;
+    bool valid_ = false;
+    unsigned seen_writes_ = 0;
+    int row_ = 0, col_ = 0; // where the terminal cursor is
+    uint8_t pen_ = 0;
+};
+
+void put_text(std::vector<TerminalRenderer::Cell>& line, int col, std::string_view text) {
+    if (line.size() < static_cast<size_t>(col) + text.size()) line.resize(static_cast<size_t>(col) + text.size());
+    for (size_t i = 0; i < text.size(); ++i) line[static_cast<size_t>(col) + i] = TerminalRenderer::Cell{text[i], 0};
+}
+
+// Calls f(key, value) for each key=value word after the first, as views into line
+template <typename F>
+void for_each_pair(std::string_view line, F&& f) {
+    size_t pos = line.find(' ');
+    while (pos != std::string_view::npos) {
+        const size_t start = pos + 1;
+        pos = line.find(' ', start);
+        const std::string_view word = line.substr(start, pos == std::string_view::npos ? pos : pos - start);
+        const size_t eq = word.find('=');
+        if (eq != std::string_view::npos) f(word.substr(0, eq), word.substr(eq + 1));
+    }
+}
+
+// Terminal keys as game actions: arrows move, rotate and soft drop, space or
+// Enter hard drops, h holds. Calls f(action) for each; false once q is read,
+// with the keys after it left alone.
+template <typename F>
+bool for_each_key_action(std::string_view keys, F&& f) {
+    while (!keys.empty()) {
+        size_t used = 1;
+        const char* action = nullptr;
+        if (keys[0] == '\x1b' && keys.size() >= 3 && keys[1] == '[') {
+            used = 3;
+            switch (keys[2]) {
+                case 'A': action = "ROTATE"; break;
+                case 'B': action = "DOWN"; break;
+                case 'C': action = "RIGHT"; break;
+                case 'D': action = "LEFT"; break;
+            }
+        } else if (keys[0] == ' ' || keys[0] == '\n') {
+            action = "DROP";
+        } else if (keys[0] == 'h' || keys[0] == 'H') {
+            action = "HOLD";
+        } else if (keys[0] == 'q' || keys[0] == 'Q') {
+            return false;
+        }
+        keys.remove_prefix(used);
+        if (action) f(action);
+    }
+    return true;
+}
+
 struct GameRequest {
     std::string host;
     uint16_t port = 0;
     std::string token;
     bool spectator = false;
+    int room = 0; // from the lobby's roomId=, 0 if it did not say
+};
+
+// Local copy of our own game, seeded from WELCOME, so key presses show at once
+// instead of a round trip later. confirmed_ replays exactly what the server
+// applied: every report (our snapshot or POSE) says how many gravity steps and
+// which inputs are in, and both games are deterministic. What we draw is
+// confirmed_ plus the inputs not acked yet. If the replay ever disagrees with
+// the server (frames coalesced on a slow link), prediction turns itself off and
+// the board is drawn from snapshots as before.
+class Predictor {
+   public:
+    void start(int seed) {
+        confirmed_ = std::make_unique<TetrisGame>(seed);
+        pending_.clear();
+        ticks_ = acked_ = 0;
+        synced_ = false;
+    }
+    bool active() const { return confirmed_ != nullptr; }
+    // The server has reported our board at least once, i.e. the match is on
+    bool synced() const { return confirmed_ && synced_; }
+    void stop() { confirmed_.reset(); }
+    // After a reconnect: inputs sent on the lost connection never arrived
+    void forget_pending() { pending_.clear(); }
+
+    void local_input(uint32_t seq, const std::string& action) {
+        if (active()) pending_.emplace_back(seq, action);
+    }
+
+    // Server state after `ticks` gravity steps and inputs up to `ack`; `matches`
+    // checks a candidate replay against what the server sent. False: diverged.
+    bool on_report(uint32_t ticks, uint32_t ack, const std::function<bool(const TetrisGame&)>& matches) {
+        if (!active()) return false;
+        if (ticks < ticks_ || ack < acked_) return false;
+        size_t inputs = 0;
+        while (inputs < pending_.size() && pending_[inputs].first <= ack) ++inputs;
+        const uint32_t steps = ticks - ticks_;
+        // Within one report gap the server order is only ambiguous when both
+        // gravity and inputs advanced; try inputs first, then gravity first
+        for (int order = 0; order < ((steps && inputs) ? 2 : 1); ++order) {
+            TetrisGame next = *confirmed_;
+            if (order == 0) {
+                apply_inputs(next, inputs);
+                for (uint32_t i = 0; i < steps; ++i) next.tick();
+            } else {
+                for (uint32_t i = 0; i < steps; ++i) next.tick();
+                apply_inputs(next, inputs);
+            }
+            if (!matches(next)) continue;
+            *confirmed_ = std::move(next);
+            pending_.erase(pending_.begin(), pending_.begin() + static_cast<long>(inputs));
+            ticks_ = ticks;
+            acked_ = ack;
+            synced_ = true;
+            return true;
+        }
+        return false;
+    }
+
+    // confirmed_ with the unacked inputs on top
+    TetrisGame predicted() const {
+        TetrisGame game = *confirmed_;
+        apply_inputs(game, pending_.size());
+        return game;
+    }
+
+   private:
+    void apply_inputs(TetrisGame& game, size_t count) const {
+        for (size_t i = 0; i < count; ++i) game.handle_input(pending_[i].second);
+    }
+
+    std::unique_ptr<TetrisGame> confirmed_;
+    std::deque<std::pair<uint32_t, std::string>> pending_; // sent, not yet acked
+    uint32_t ticks_ = 0;
+    uint32_t acked_ = 0;
+    bool synced_ = false;
 };
 
 class GameSession {
@@ -309,115 +737,275 @@ class GameSession {
                 uint16_t port,
                 std::string username,
                 std::string token,
-                bool spectator)
-        : host_(host), port_(port), username_(std::move(username)), token_(std::move(token)), spectator_(spectator) {}
-
-    void run() {
+                bool spectator,
+                int room)
+        : host_(host),
+          port_(port),
+          username_(std::move(username)),
+          token_(std::move(token)),
+          spectator_(spectator),
+          room_(room) {}
+
+    ~GameSession() { end(); }
+
+    // Connects and says HELLO. A session without a window of its own draws on
+    // the terminal (and reads keys from it), which only one session at a time
+    // may do: with may_use_terminal false it gives up instead.
+    bool start(bool may_use_terminal) {
+#if defined(HAVE_X11_GUI)
+        gui_ = X11Renderer::Create(spectator_);
+#endif
+        if (!has_window() && !may_use_terminal) {
+            safe_print("[game] Another match is on the terminal, ignoring new request.\n");
+            ended_ = true; // nothing was opened
+            return false;
+        }
         safe_print("\n[game] Connecting to match on " + host_ + ':' + std::to_string(port_) + "...\n");
-        int fd = connect_tcp(host_, port_);
-        if (fd < 0) {
+        fd_ = connect_tcp(host_, port_);
+        if (fd_ < 0) {
             safe_print("[game] Failed to connect to game server.\n");
-            return;
+            end();
+            return false;
         }
-
-        std::string hello = "HELLO username=" + username_ + " token=" + token_;
-        if (spectator_) hello += " role=SPEC";
-
-        if (!lp_send_frame(fd, hello)) {
+        if (!lp_send_frame(fd_, hello())) {
             safe_print("[game] Failed to send HELLO.\n");
-            ::close(fd);
-            return;
+            end();
+            return false;
         }
-
 #if defined(HAVE_X11_GUI)
-        gui_ = X11Renderer::Create(username_, spectator_);
-        if (gui_) {
-            gui_->set_status("Waiting for match snapshots...");
-        }
+        if (gui_) gui_->set_status("Waiting for match snapshots...");
 #endif
-        std::unique_ptr<TerminalRawMode> raw;
-#if defined(HAVE_X11_GUI)
-        if (!gui_) {
-            raw = std::make_unique<TerminalRawMode>(true);
+        if (!has_window()) {
+            raw_ = std::make_unique<TerminalRawMode>(true);
             render_header();
         }
-#else
-        raw = std::make_unique<TerminalRawMode>(true);
-        render_header();
-#endif
-
         running_ = true;
-        std::map<std::string, SnapshotData> snapshots;
-        std::string local_user = username_;
+        return true;
+    }
 
-        while (running_) {
-            struct pollfd pfds[2];
-            pfds[0].fd = fd;
-            pfds[0].events = POLLIN;
-            int nfds = 1;
+    bool done() const { return !running_; }
+    bool spectator() const { return spectator_; }
+    int room() const { return room_; }
+    // Draws on the terminal, so the client's stdin is this session's keyboard
+    bool uses_terminal() const { return running_ && !has_window(); }
+
+    // Appends what the session waits for to pfds and returns how long it may
+    // wait: sockets, the X connection, and the frame, UDP and resume timers
+    int watch(std::vector<pollfd>& pfds) {
+        int timeout = sooner(frame_due_ms(kNoTimeout), udp_timers(kNoTimeout));
+        tcp_idx_ = udp_idx_ = -1;
+        if (fd_ >= 0) {
+            tcp_idx_ = static_cast<int>(pfds.size());
+            pfds.push_back(pollfd{fd_, POLLIN, 0});
+        } else if (running_) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(retry_at_ - std::chrono::steady_clock::now());
+            timeout = sooner(std::max(0, static_cast<int>(left.count())), timeout);
+        }
+        if (udp_fd_ >= 0) {
+            udp_idx_ = static_cast<int>(pfds.size());
+            pfds.push_back(pollfd{udp_fd_, POLLIN, 0});
+        }
 #if defined(HAVE_X11_GUI)
-            if (!spectator_ && !gui_) {
-                pfds[1].fd = STDIN_FILENO;
-                pfds[1].events = POLLIN;
-                nfds = 2;
-            }
-#else
-            if (!spectator_) {
-                pfds[1].fd = STDIN_FILENO;
-                pfds[1].events = POLLIN;
-                nfds = 2;
-            }
+        if (gui_) {
+            pfds.push_back(pollfd{gui_->connection_fd(), POLLIN, 0});
+            if (gui_->has_queued_events()) timeout = 0;
+        }
 #endif
+        return timeout;
+    }
 
-            int rc = poll(pfds, nfds, 50);
-            if (rc < 0 && errno == EINTR) continue;
-            if (rc < 0) {
-                safe_print("[game] poll error.\n");
-                break;
-            }
-
-            if (pfds[0].revents & POLLIN) {
-                std::string msg;
-                if (!lp_recv_frame(fd, msg)) {
-                    safe_print("[game] Connection closed by server.\n");
-                    break;
+    // After poll(): handles whatever of the descriptors from watch() is ready,
+    // and any timer that is due
+    void step(const std::vector<pollfd>& pfds) {
+        present_if_due();
+        auto ready = [&pfds](int idx) { return idx >= 0 && (pfds[idx].revents & (POLLIN | POLLHUP | POLLERR)); };
+
+        if (ready(udp_idx_) && udp_fd_ >= 0) udp_receive(username_);
+
+        if (ready(tcp_idx_) && fd_ >= 0) {
+            size_t count = 0;
+            const FrameReader::ReadResult st = reader_.read_from(fd_, frames_, count);
+            for (size_t i = 0; i < count && running_ && fd_ >= 0; ++i) {
+                const std::string& msg = frames_[i];
+                if (is_lockstep_event(msg)) {
+                    on_lockstep_event(fd_, msg, username_);
+                    continue;
                 }
-                handle_message(msg, snapshots, local_user);
+                // Once datagrams bring the boards, what TCP had queued before the
+                // switch is older than what is shown
+                if (udp_frames_ && (is_binary_snapshot(msg) || msg.rfind("POSE", 0) == 0)) continue;
+                handle_message(msg, username_);
             }
+            if (st != FrameReader::ReadResult::Ok && running_) connection_lost();
+        } else if (fd_ < 0 && running_ && std::chrono::steady_clock::now() >= retry_at_) {
+            retry_resume();
+        }
 
-            if (!spectator_
 #if defined(HAVE_X11_GUI)
-                && !gui_
-#endif
-                && nfds == 2 && (pfds[1].revents & POLLIN)) {
-                handle_input(fd);
+        if (gui_ && running_) {
+            auto action = gui_->poll_action();
+            if (!gui_->is_open()) {
+                safe_print("[game] GUI window closed. Ending session.\n");
+                running_ = false;
+                return;
             }
-
-#if defined(HAVE_X11_GUI)
-            if (gui_) {
-                auto action = gui_->poll_action();
-                if (!gui_->is_open()) {
-                    safe_print("[game] GUI window closed. Ending session.\n");
-                    break;
-                }
-                if (action && !spectator_) {
-                    lp_send_frame(fd, "INPUT " + *action);
-                }
-                if (gui_->consume_redraw_request()) {
-                    gui_->render(latest_gui_state_, local_user);
-                }
+            if (action && !spectator_ && fd_ >= 0) {
+                send_input(fd_, *action, username_);
+            }
+            if (gui_->consume_redraw_request()) {
+                gui_->render(boards_, first_seat(username_), username_);
             }
+        }
 #endif
+    }
+
+    // Key presses typed on the terminal while it shows this session
+    void on_keys(std::string_view keys) {
+        if (!running_) return;
+        const bool more = for_each_key_action(keys, [this](const char* action) {
+            if (!spectator_ && fd_ >= 0) send_input(fd_, action, username_);
+        });
+        if (!more) {
+            running_ = false;
+            safe_print("[game] Exiting match...\n");
         }
+    }
 
-        safe_print("[game] Session ended. Press Enter to continue.\n");
-        ::close(fd);
+    // Closes everything and gives the terminal back; safe to call twice
+    void end() {
+        if (ended_) return;
+        ended_ = true;
+        running_ = false;
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        udp_close();
 #if defined(HAVE_X11_GUI)
         gui_.reset();
 #endif
+        raw_.reset();
+        safe_print("[game] Session ended.\n");
     }
 
    private:
+    bool has_window() const {
+#if defined(HAVE_X11_GUI)
+        return gui_ != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    // The match connection dropped: the server keeps the seat (board frozen)
+    // for resume_ms_, so with a resume token we reconnect on the retry timer
+    void connection_lost() {
+        ::close(fd_);
+        fd_ = -1;
+        reader_ = FrameReader{};
+        udp_close();
+        if (resume_token_.empty()) {
+            safe_print("[game] Connection closed by server.\n");
+            running_ = false;
+            return;
+        }
+        safe_print("[game] Connection lost, resuming...\n");
+        resume_until_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(resume_ms_);
+        retry_resume();
+    }
+
+    // One reconnect attempt, presenting the resume token
+    void retry_resume() {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= resume_until_) {
+            safe_print("[game] Connection closed by server.\n");
+            running_ = false;
+            return;
+        }
+        int fd = connect_tcp(host_, port_);
+        if (fd >= 0 && lp_send_frame(fd, hello() + " resume=" + resume_token_)) {
+            fd_ = fd;
+            return;
+        }
+        if (fd >= 0) ::close(fd);
+        retry_at_ = now + std::chrono::milliseconds(kResumeRetryMs);
+    }
+
+    // Inputs are numbered and timestamped; the server answers each batch with a
+    // POSE carrying the last seq it applied and echoing the timestamp. While
+    // predicting, the move is drawn right away.
+    void send_input(int fd,
+                    const std::string& action,
+                    const std::string& local_user) {
+        // Before the match starts the server drops inputs, which a replay could not know
+        if (predictor_.active() && !predictor_.synced()) return;
+        auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch()).count();
+        ++input_seq_;
+        if (udp_ready_) {
+            udp_unacked_.push_back(UdpInput{input_seq_, static_cast<uint32_t>(now_ms), action});
+            udp_send_inputs();
+        } else {
+            const int code = input_action_code(action);
+            const std::string frame =
+                binary_inputs_ && code >= 0
+                    ? encode_input_command(static_cast<InputAction>(code), input_seq_, static_cast<uint32_t>(now_ms))
+                    : "INPUT " + action + " seq=" + std::to_string(input_seq_) + " t=" + std::to_string(now_ms);
+            if (!lp_send_frame(fd, frame)) return;
+        }
+        predictor_.local_input(input_seq_, action);
+        if (predictor_.synced()) {
+            for (int seat = 0; seat < 2; ++seat) {
+                if (bin_views_[seat].have_keyframe && bin_views_[seat].name == local_user) show_binary_view(seat, local_user);
+            }
+            for (int b = 0; b < 2 && mirror_.active(); ++b) {
+                if (lock_names_[b] == local_user) show_lockstep_board(b, local_user);
+            }
+        }
+    }
+
+    // Lockstep (tetris_lockstep.hpp): the room sends what happened, we run both
+    // boards. Our own is also a report for the predictor, an exact one.
+    void on_lockstep_event(int fd,
+                           const std::string& msg,
+                           const std::string& local_user) {
+        int board = -1;
+        if (!mirror_.apply(msg, board)) return;
+        const std::string sum = mirror_.sum(board);
+        if (!sum.empty()) lp_send_frame(fd, sum);
+        if (lock_names_[board] == local_user) {
+            const TetrisGame& game = mirror_.game(board);
+            const uint64_t hash = lockstep_hash(game);
+            reconcile(game.ticks, mirror_.acked(board),
+                      [hash](const TetrisGame& replay) { return lockstep_hash(replay) == hash; });
+        }
+        show_lockstep_board(board, local_user);
+    }
+
+    void show_lockstep_board(int board, const std::string& local_user) {
+        const std::string& name = lock_names_[board];
+        SnapshotData& data = boards_.at(board, name);
+        if (name == local_user && predictor_.synced()) {
+            fill_board(data, predictor_.predicted());
+        } else {
+            fill_board(data, mirror_.game(board));
+        }
+        show_boards(local_user);
+    }
+
+    // Feeds one server report about our board to the predictor
+    void reconcile(uint32_t ticks, uint32_t ack, const std::function<bool(const TetrisGame&)>& matches) {
+        while (!udp_unacked_.empty() && udp_unacked_.front().seq <= ack) udp_unacked_.pop_front();
+        if (!predictor_.active() || predictor_.on_report(ticks, ack, matches)) return;
+        predictor_.stop();
+        safe_print("[game] Prediction out of step with the server, following its snapshots.\n");
+    }
+
+    std::string hello() const {
+        std::string msg = "HELLO username=" + username_ + " token=" + token_ + " snap=" + SNAP_BIN_TAG + " udp=1" +
+                          " lockstep=" + LOCK_TAG;
+        if (spectator_) msg += " role=SPEC";
+        return msg;
+    }
+
     void render_header() {
 #if defined(HAVE_X11_GUI)
         if (gui_) return;
@@ -426,30 +1014,96 @@ class GameSession {
         safe_print("==== Tetris Match ====" + std::string(spectator_ ? " (Spectator)\n" : "\n"));
     }
 
-    void handle_message(const std::string& msg,
-                        std::map<std::string, SnapshotData>& snapshots,
-                        std::string& local_user) {
-        if (msg.rfind("SNAPSHOT", 0) == 0) {
-            auto kv = parse_pairs(msg);
-            std::string user = kv["user"];
-            SnapshotData data;
-            data.board = kv["board"];
-            data.score = kv.count("score") ? std::stoi(kv["score"]) : 0;
-            data.lines = kv.count("lines") ? std::stoi(kv["lines"]) : 0;
-            data.gameover = kv.count("gameover") && kv["gameover"] == "1";
-            snapshots[user] = data;
-            render_boards(snapshots, local_user);
-#if defined(HAVE_X11_GUI)
-            if (gui_) {
-                gui_->set_status("Game in progress");
+    void handle_message(std::string_view msg, std::string& local_user) {
+        if (is_binary_snapshot(msg)) {
+            int idx = -1;
+            if (!apply_binary_snapshot(msg, bin_views_, idx)) return; // delta before keyframe or malformed
+            const SnapshotView& view = bin_views_[idx];
+            if (view.name == local_user) {
+                reconcile(view.tick, view.ack, [&](const TetrisGame& game) {
+                    return std::memcmp(game.colors, view.colors, sizeof(view.colors)) == 0 &&
+                           same_piece(game.current_piece, view.piece) && game.score == view.score &&
+                           game.lines_cleared == view.lines && game.game_over == view.gameover;
+                });
             }
-#endif
+            show_binary_view(idx, local_user);
+        } else if (msg.rfind("POSE", 0) == 0) {
+            // Our own piece moved: redraw it on the last board we have
+            int shape = 0, rot = 0, x = 0, y = 0, score = 0;
+            uint32_t seq = 0, ticks = 0;
+            for_each_pair(msg, [&](std::string_view key, std::string_view value) {
+                if (key == "shape") parse_number(value, shape);
+                else if (key == "rot") parse_number(value, rot);
+                else if (key == "x") parse_number(value, x);
+                else if (key == "y") parse_number(value, y);
+                else if (key == "score") parse_number(value, score);
+                else if (key == "seq") parse_number(value, seq);
+                else if (key == "g") parse_number(value, ticks);
+            });
+            for (int seat = 0; seat < 2; ++seat) {
+                SnapshotView& view = bin_views_[seat];
+                if (!view.have_keyframe || view.name != local_user) continue;
+                view.piece.shape_id = static_cast<int8_t>(shape);
+                view.piece.rotation = static_cast<int8_t>(rot);
+                view.piece.x = static_cast<int8_t>(x);
+                view.piece.y = static_cast<int8_t>(y);
+                view.score = score;
+                view.ack = seq;
+                reconcile(ticks, view.ack, [&](const TetrisGame& game) {
+                    return same_piece(game.current_piece, view.piece) && game.score == view.score;
+                });
+                show_binary_view(seat, local_user);
+            }
+        } else if (msg.rfind("SNAPSHOT", 0) == 0) {
+            std::string_view user, board;
+            int score = 0, lines = 0;
+            bool gameover = false;
+            for_each_pair(msg, [&](std::string_view key, std::string_view value) {
+                if (key == "user") user = value;
+                else if (key == "board") board = value;
+                else if (key == "score") parse_number(value, score);
+                else if (key == "lines") parse_number(value, lines);
+                else if (key == "gameover") gameover = value == "1";
+            });
+            const int seat = boards_.seat_of(user);
+            if (seat < 0) return;
+            SnapshotData& data = boards_.boards[seat];
+            data.have_board = board.size() == data.board.size();
+            if (data.have_board) std::memcpy(data.board.data(), board.data(), board.size());
+            data.score = score;
+            data.lines = lines;
+            data.gameover = gameover;
+            show_boards(local_user);
         } else if (msg.rfind("WELCOME", 0) == 0) {
             auto kv = parse_pairs(msg);
+            if (kv.count("resume")) {
+                resume_token_ = kv["resume"];
+                resume_ms_ = kv.count("resume_ms") ? std::stoi(kv["resume_ms"]) : 0;
+            }
+            // Players on binary snapshots predict their own board from the shared seed
+            const bool player = kv["role"] == "P1" || kv["role"] == "P2";
+            binary_inputs_ = kv["cmd"] == CMD_BIN_TAG;
+            if (kv.count("udp") && kv.count("udp_key")) udp_open(static_cast<uint16_t>(std::stoi(kv["udp"])), kv["udp_key"]);
+            // Never granted to a resumed session, which is back on snapshots; a
+            // spectator let in mid-match gets each board's catch-up frame next
+            if (kv["lockstep"] == LOCK_TAG && kv.count("seed")) {
+                mirror_.start(static_cast<int>(std::stoll(kv["seed"])));
+                lock_names_[0] = kv["p1"];
+                lock_names_[1] = kv["p2"];
+            } else {
+                mirror_.stop();
+            }
+            if (kv.count("resumed")) {
+                predictor_.forget_pending();
+            } else if (player && kv["snap"] == SNAP_BIN_TAG && kv.count("seed")) {
+                predictor_.start(static_cast<int>(std::stoll(kv["seed"])));
+            }
             if (kv.count("role")) {
-                std::lock_guard<std::mutex> lock(g_console_mutex);
-                std::cout << "[game] Connected as " << kv["role"] << "\n";
+                safe_print(std::string("[game] ") + (kv.count("resumed") ? "Resumed as " : "Connected as ") + kv["role"] + "\n");
             }
+        } else if (msg.rfind("LOCKSTEP_OFF", 0) == 0) {
+            mirror_.stop();
+            safe_print("[game] The server stopped lockstep (" + parse_pairs(msg)["reason"] + "), following its snapshots.\n");
         } else if (msg.rfind("GAME_OVER", 0) == 0) {
             auto kv = parse_pairs(msg);
             std::ostringstream oss;
@@ -457,122 +1111,742 @@ class GameSession {
                 << " P2=" << kv["p2_score"] << "\n";
             safe_print(oss.str());
 #if defined(HAVE_X11_GUI)
-            if (gui_) {
-                gui_->set_status("Game over");
-                gui_->render(latest_gui_state_, local_user);
+            if (gui_) {
+                gui_->set_status("Game over");
+                gui_->render(boards_, first_seat(local_user), local_user);
+            }
+#endif
+            running_ = false;
+        } else {
+            if (msg.rfind("ERR", 0) == 0) resume_token_.clear(); // e.g. the seat was already forfeited
+            safe_print("[game] " + std::string(msg) + '\n');
+        }
+    }
+
+    static bool same_piece(const Piece& a, const Piece& b) {
+        return a.shape_id == b.shape_id && a.rotation == b.rotation && a.x == b.x && a.y == b.y;
+    }
+
+    void show_binary_view(int seat, const std::string& local_user) {
+        const SnapshotView& view = bin_views_[seat];
+        SnapshotData& data = boards_.at(seat, view.name);
+        if (view.name == local_user && predictor_.synced()) {
+            fill_board(data, predictor_.predicted());
+        } else {
+            write_board_chars(data.board.data(), view.colors, view.piece);
+            data.have_board = true;
+            data.score = view.score;
+            data.lines = view.lines;
+            data.gameover = view.gameover;
+        }
+        show_boards(local_user);
+    }
+
+    static void fill_board(SnapshotData& data, const TetrisGame& game) {
+        write_board_chars(data.board.data(), game.colors, game.current_piece);
+        data.have_board = true;
+        data.score = game.score;
+        data.lines = game.lines_cleared;
+        data.gameover = game.game_over;
+    }
+
+    void show_boards(const std::string& local_user) {
+        render_boards(local_user);
+#if defined(HAVE_X11_GUI)
+        if (gui_) {
+            gui_->set_status("Game in progress");
+        }
+#endif
+    }
+
+    // A player sees their own board on the left
+    int first_seat(const std::string& local_user) const {
+        return !spectator_ && boards_.names[1] == local_user ? 1 : 0;
+    }
+
+    void render_boards(const std::string& local_user) {
+        if (boards_.empty()) return;
+        const int first = first_seat(local_user);
+
+#if defined(HAVE_X11_GUI)
+        if (gui_) {
+            gui_->render(boards_, first, local_user);
+            return;
+        }
+#endif
+
+        // Title, captions, then both boards side by side, written over the
+        // previous frame's lines so their storage is reused
+        static constexpr std::string_view kTitle = "==== Tetris Match ====";
+        term_frame_.resize(2 + BOARD_ROWS);
+        for (auto& line : term_frame_) line.clear();
+        put_text(term_frame_[0], 0, kTitle);
+        if (spectator_) put_text(term_frame_[0], static_cast<int>(kTitle.size()), " (Spectator)");
+        for (int b = 0; b < 2; ++b) {
+            const int seat = b == 0 ? first : 1 - first;
+            const SnapshotData& data = boards_.boards[seat];
+            const std::string_view name = boards_.names[seat].empty() ? "(waiting)" : boards_.names[seat];
+            char score[16];
+            const char* score_end = std::to_chars(score, score + sizeof(score), data.score).ptr;
+            int caption = b * kCaptionWidth;
+            put_text(term_frame_[1], caption, name);
+            caption += static_cast<int>(name.size());
+            put_text(term_frame_[1], caption, " Score: ");
+            put_text(term_frame_[1], caption + 8, std::string_view(score, static_cast<size_t>(score_end - score)));
+            const int col = b * (BOARD_COLS + kBoardGap);
+            for (int r = 0; r < BOARD_ROWS; ++r) {
+                std::vector<TerminalRenderer::Cell>& line = term_frame_[2 + r];
+                line.resize(static_cast<size_t>(col + BOARD_COLS));
+                if (!data.have_board) continue;
+                for (int c = 0; c < BOARD_COLS; ++c) {
+                    const char ch = data.board[r * BOARD_COLS + c];
+                    const uint8_t color = (ch >= '1' && ch <= '7') ? static_cast<uint8_t>(ch - '0') : 0;
+                    line[static_cast<size_t>(col + c)] = TerminalRenderer::Cell{ch == '0' ? '.' : ch, color};
+                }
+            }
+        }
+        term_dirty_ = true;
+        // Spectators may follow fast boards; they are held to the display rate
+        if (!spectator_) present_if_due(true);
+    }
+
+    // --- datagram channel (udp_channel.hpp) ---
+    // Offered in WELCOME. Hellos go out until the room answers (or we give up
+    // and stay on TCP); after that inputs go as datagrams, repeated until acked,
+    // and snapshots and POSE come back the same way.
+    void udp_open(uint16_t port, const std::string& key) {
+        udp_close();
+        udp_fd_ = connect_udp(host_, port);
+        if (udp_fd_ < 0) return;
+        udp_key_ = std::strtoull(key.c_str(), nullptr, 16);
+        udp_started_ = udp_heard_at_ = std::chrono::steady_clock::now();
+        udp_send_hello();
+    }
+
+    void udp_close() {
+        if (udp_fd_ >= 0) ::close(udp_fd_);
+        udp_fd_ = -1;
+        udp_ready_ = udp_frames_ = false;
+        udp_lane_seq_[0] = udp_lane_seq_[1] = 0;
+        udp_unacked_.clear();
+    }
+
+    void udp_send(const std::string& datagram) {
+        ssize_t n = ::send(udp_fd_, datagram.data(), datagram.size(), MSG_DONTWAIT);
+        (void)n; // lost like any datagram; hellos and inputs are repeated anyway
+    }
+
+    void udp_send_hello() {
+        std::string datagram;
+        udp_put_header(datagram, UDP_HELLO, udp_key_, ++udp_seq_);
+        datagram.push_back(udp_ready_ ? 1 : 0);
+        udp_send(datagram);
+        udp_hello_at_ = std::chrono::steady_clock::now();
+    }
+
+    void udp_send_inputs() {
+        udp_send(udp_encode_inputs(udp_key_, ++udp_seq_, udp_unacked_));
+        udp_inputs_at_ = std::chrono::steady_clock::now();
+    }
+
+    // Hello retries, keepalives and input repeats that are due; returns how long
+    // until the next one (at most idle_ms)
+    int udp_timers(int idle_ms) {
+        if (udp_fd_ < 0) return idle_ms;
+        using std::chrono::milliseconds;
+        const auto now = std::chrono::steady_clock::now();
+        if (!udp_ready_ && now - udp_started_ >= milliseconds(UDP_GIVE_UP_MS)) {
+            safe_print("[game] No UDP path to the server, staying on TCP.\n");
+            udp_close();
+            return idle_ms;
+        }
+        if (udp_ready_ && now - udp_heard_at_ >= milliseconds(UDP_SILENCE_MS)) {
+            safe_print("[game] UDP went quiet, back to TCP.\n");
+            udp_close();
+            return idle_ms;
+        }
+        const auto hello_every = milliseconds(udp_ready_ ? UDP_KEEPALIVE_MS : UDP_HELLO_RETRY_MS);
+        if (now - udp_hello_at_ >= hello_every) udp_send_hello();
+        auto next = udp_hello_at_ + hello_every;
+        if (!udp_unacked_.empty()) {
+            if (now - udp_inputs_at_ >= milliseconds(UDP_RESEND_MS)) udp_send_inputs();
+            next = std::min(next, udp_inputs_at_ + milliseconds(UDP_RESEND_MS));
+        }
+        auto left = std::chrono::ceil<milliseconds>(next - now).count();
+        return sooner(std::max(0, static_cast<int>(left)), idle_ms);
+    }
+
+    void udp_receive(std::string& local_user) {
+        char buf[UDP_MAX_DATAGRAM];
+        ssize_t n;
+        while (udp_fd_ >= 0 && (n = ::recv(udp_fd_, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+            UdpHeader h;
+            std::string_view payload;
+            if (!udp_parse(buf, static_cast<size_t>(n), h, payload) || h.key != udp_key_) continue;
+            udp_heard_at_ = std::chrono::steady_clock::now();
+            if (h.type == UDP_HELLO) {
+                if (udp_ready_) continue;
+                udp_ready_ = true;
+                udp_send_hello(); // ready=1: the room may switch us over
+            } else if (h.type == UDP_FRAME && payload.size() > 1) {
+                const uint8_t lane = static_cast<uint8_t>(payload[0]);
+                // A late datagram would undo a newer state of its board
+                if (lane >= 2 || h.seq <= udp_lane_seq_[lane]) continue;
+                udp_lane_seq_[lane] = h.seq;
+                udp_frames_ = true;
+                handle_message(payload.substr(1), local_user);
+            }
+        }
+    }
+
+    // Poll timeout that wakes up in time for a held-back frame
+    int frame_due_ms(int idle_ms) const {
+        if (!term_dirty_) return idle_ms;
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        last_frame_ + std::chrono::milliseconds(kFrameIntervalMs) - std::chrono::steady_clock::now());
+        return sooner(std::max(0, static_cast<int>(left.count())), idle_ms);
+    }
+
+    void present_if_due(bool now = false) {
+        if (!term_dirty_) return;
+        auto t = std::chrono::steady_clock::now();
+        if (!now && t - last_frame_ < std::chrono::milliseconds(kFrameIntervalMs)) return;
+        term_.present(term_frame_);
+        term_dirty_ = false;
+        last_frame_ = t;
+    }
+
+    // Leaves out as it was unless text is a number
+    template <typename T>
+    static void parse_number(std::string_view text, T& out) {
+        std::from_chars(text.data(), text.data() + text.size(), out);
+    }
+
+    // For the rarer messages, where a map is handier
+    static std::unordered_map<std::string, std::string> parse_pairs(std::string_view line) {
+        std::unordered_map<std::string, std::string> m;
+        for_each_pair(line, [&m](std::string_view key, std::string_view value) { m[std::string(key)] = value; });
+        return m;
+    }
+
+    std::string host_;
+    uint16_t port_{};
+    std::string username_;
+    std::string token_;
+    bool spectator_{};
+    int room_ = 0; // 0 when the lobby did not say
+    bool running_ = false;
+    bool ended_ = false;
+    int fd_ = -1; // the match connection; -1 while resuming
+    FrameReader reader_;
+    std::vector<std::string> frames_; // reused by every read
+    int tcp_idx_ = -1, udp_idx_ = -1; // where watch() put our sockets
+    static constexpr int kResumeRetryMs = 500;
+    std::chrono::steady_clock::time_point resume_until_, retry_at_;
+    std::unique_ptr<TerminalRawMode> raw_;
+    std::string resume_token_; // from WELCOME, empty when the server offers no resume
+    bool binary_inputs_ = false; // WELCOME said the room reads binary INPUT commands
+    int resume_ms_ = 0;
+    uint32_t input_seq_ = 0;
+    Predictor predictor_;
+    LockstepMirror mirror_;     // on while the room sends us events instead of boards
+    std::string lock_names_[2]; // whose each board is, from WELCOME
+    static constexpr int kFrameIntervalMs = 16; // about one display refresh
+    static constexpr int kCaptionWidth = 25;
+    static constexpr int kBoardGap = 4;
+    TerminalRenderer term_;
+    TerminalRenderer::Frame term_frame_;
+    bool term_dirty_ = false;
+    std::chrono::steady_clock::time_point last_frame_{};
+    SnapshotView bin_views_[2];
+    MatchBoards boards_; // what is on screen, whichever way it arrived
+    int udp_fd_ = -1;
+    uint64_t udp_key_ = 0;
+    uint32_t udp_seq_ = 0;
+    bool udp_ready_ = false;  // the room answered: inputs go as datagrams
+    bool udp_frames_ = false; // boards arrive as datagrams, TCP ones are stale
+    uint32_t udp_lane_seq_[2] = {};
+    std::deque<UdpInput> udp_unacked_;
+    std::chrono::steady_clock::time_point udp_started_, udp_hello_at_, udp_inputs_at_, udp_heard_at_;
+#if defined(HAVE_X11_GUI)
+    std::unique_ptr<X11Renderer> gui_;
+#endif
+};
+
+// Single-player practice: a local TetrisGame on the rooms' gravity schedule
+// (gravity_interval_ms, next step timed from the last), drawn by the match
+// renderers. One poll() waits for a key, the window or the next gravity step,
+// whichever is first, so a practice game takes no CPU between them.
+class PracticeSession {
+   public:
+    PracticeSession(int gravity_ms, int seed) : gravity_ms_(gravity_ms), game_(seed) {
+        boards_.names[0] = kPlayer;
+    }
+
+    // Plays until q, Escape or the window is closed; the final board stays up
+    // after a game over until then
+    void run() {
+#if defined(HAVE_X11_GUI)
+        gui_ = X11Renderer::Create(false);
+#endif
+        std::unique_ptr<TerminalRawMode> raw;
+        if (!has_window()) raw = std::make_unique<TerminalRawMode>(true);
+        due_ = std::chrono::steady_clock::now() + interval();
+        std::vector<pollfd> pfds;
+        while (running_) {
+            show();
+            pfds.clear();
+            int timeout = sooner(game_.game_over ? kNoTimeout : ms_until(due_), frame_due_ms());
+#if defined(HAVE_X11_GUI)
+            if (gui_) {
+                pfds.push_back(pollfd{gui_->connection_fd(), POLLIN, 0});
+                if (gui_->has_queued_events()) timeout = 0;
+            }
+#endif
+            if (!has_window()) pfds.push_back(pollfd{STDIN_FILENO, POLLIN, 0});
+            const int rc = ::poll(pfds.data(), pfds.size(), timeout);
+            if (rc < 0 && errno != EINTR) break;
+            const auto now = std::chrono::steady_clock::now();
+            if (!game_.game_over && now >= due_) {
+                game_.tick();
+                due_ += interval();
+                if (due_ < now) due_ = now + interval();
+            }
+            if (rc > 0) take_input();
+        }
+        raw.reset();
+        safe_print_notice("[practice] Score " + std::to_string(game_.score) + ", " +
+                          std::to_string(game_.lines_cleared) + " lines, level " + std::to_string(game_.level()) + '.');
+    }
+
+   private:
+    static constexpr const char* kPlayer = "practice";
+    static constexpr int kFrameIntervalMs = 16; // as GameSession's terminal
+
+    bool has_window() const {
+#if defined(HAVE_X11_GUI)
+        return gui_ != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    std::chrono::milliseconds interval() const {
+        return std::chrono::milliseconds(gravity_interval_ms(gravity_ms_, game_.level()));
+    }
+
+    static int ms_until(std::chrono::steady_clock::time_point t) {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(t - std::chrono::steady_clock::now());
+        return std::max(0, static_cast<int>(left.count()));
+    }
+
+    void take_input() {
+#if defined(HAVE_X11_GUI)
+        if (gui_) {
+            while (auto action = gui_->poll_action()) game_.handle_input(*action);
+            if (!gui_->is_open()) running_ = false;
+            if (gui_->consume_redraw_request()) shown_generation_ = 0;
+            return;
+        }
+#endif
+        char buf[64];
+        const ssize_t n = ::read(STDIN_FILENO, buf, sizeof(buf));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        if (n <= 0) {
+            running_ = false; // stdin closed
+            return;
+        }
+        if (!for_each_key_action(std::string_view(buf, static_cast<size_t>(n)),
+                                 [this](const char* action) { game_.handle_input(action); })) {
+            running_ = false;
+        }
+    }
+
+    // Builds the next frame when the game has changed; the terminal gets it at
+    // most every kFrameIntervalMs, the window at once
+    void show() {
+        if (game_.generation != shown_generation_) {
+            shown_generation_ = game_.generation;
+            SnapshotData& data = boards_.boards[0];
+            write_board_chars(data.board.data(), game_.colors, game_.current_piece);
+            data.have_board = true;
+            data.score = game_.score;
+            data.lines = game_.lines_cleared;
+            data.gameover = game_.game_over;
+            const std::string status = game_.game_over ? "Game over - q to close"
+                                                       : "Practice - level " + std::to_string(game_.level()) +
+                                                             ", lines " + std::to_string(game_.lines_cleared);
+#if defined(HAVE_X11_GUI)
+            if (gui_) {
+                gui_->set_status(status);
+                gui_->render(boards_, 0, kPlayer, 1);
+                return;
+            }
+#endif
+            build_frame(data, status);
+        }
+        if (dirty_ && frame_due_ms() == 0) {
+            term_.present(frame_);
+            dirty_ = false;
+            last_frame_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    void build_frame(const SnapshotData& data, const std::string& status) {
+        frame_.resize(3 + BOARD_ROWS);
+        for (auto& line : frame_) line.clear();
+        put_text(frame_[0], 0, "==== Tetris Practice ====");
+        put_text(frame_[1], 0, "Score: " + std::to_string(data.score) + "  " + status);
+        for (int r = 0; r < BOARD_ROWS; ++r) {
+            std::vector<TerminalRenderer::Cell>& line = frame_[2 + r];
+            line.resize(BOARD_COLS);
+            for (int c = 0; c < BOARD_COLS; ++c) {
+                const char ch = data.board[r * BOARD_COLS + c];
+                const uint8_t color = (ch >= '1' && ch <= '7') ? static_cast<uint8_t>(ch - '0') : 0;
+                line[static_cast<size_t>(c)] = TerminalRenderer::Cell{ch == '0' ? '.' : ch, color};
+            }
+        }
+        put_text(frame_[2 + BOARD_ROWS], 0, "arrows move/rotate/soft drop, space drops, h holds, q quits");
+        dirty_ = true;
+    }
+
+    int frame_due_ms() const {
+        if (!dirty_) return kNoTimeout;
+        return ms_until(last_frame_ + std::chrono::milliseconds(kFrameIntervalMs));
+    }
+
+    int gravity_ms_;
+    TetrisGame game_;
+    bool running_ = true;
+    std::chrono::steady_clock::time_point due_; // next gravity step
+    uint32_t shown_generation_ = 0;             // generation is never 0, so the first show() draws
+    MatchBoards boards_;
+    TerminalRenderer term_;
+    TerminalRenderer::Frame frame_;
+    bool dirty_ = false;
+    std::chrono::steady_clock::time_point last_frame_{};
+#if defined(HAVE_X11_GUI)
+    std::unique_ptr<X11Renderer> gui_;
+#endif
+};
+
+// Many matches watched at once: tiles of one X11 window or, without a display,
+// rows of a table on the terminal. Each tile is a spectator connection of its
+// own that asks the relay (spectator_relay.hpp) for no more than it shows: the
+// focused tile every frame, the other tiles of the page a keyframe every
+// kThumbnailMs, and on the terminal only the numbers ("detail=summary"). Tiles
+// on other pages, and all of them while the window is minimized, are paused
+// until they are back in view.
+class SpectatorGrid {
+   public:
+    explicit SpectatorGrid(std::string username) : username_(std::move(username)) {}
+    ~SpectatorGrid() { end(); }
+
+    // Opens the grid window or, with may_use_terminal, falls back to the terminal
+    bool start(bool may_use_terminal) {
+#if defined(HAVE_X11_GUI)
+        gui_ = X11Renderer::CreateGrid();
+#endif
+        if (!has_window()) {
+            if (!may_use_terminal) {
+                safe_print("[grid] Another match is on the terminal, cannot show the grid.\n");
+                return false;
+            }
+            raw_ = std::make_unique<TerminalRawMode>(true);
+        }
+        running_ = true;
+        dirty_ = true;
+        return true;
+    }
+
+    bool done() const { return !running_; }
+    // Draws on the terminal, so the client's stdin is the grid's keyboard
+    bool uses_terminal() const { return running_ && !has_window(); }
+
+    bool has_room(int room) const {
+        return std::any_of(tiles_.begin(), tiles_.end(), [room](const Tile& t) { return t.room == room; });
+    }
+
+    // Starts watching a room the lobby sent us to (SPECTATE_READY)
+    void add(int room, const std::string& host, uint16_t port, const std::string& token) {
+        if (has_room(room)) return;
+        tiles_.emplace_back();
+        Tile& tile = tiles_.back();
+        tile.room = room;
+        tile.asked = detail_for(tiles_.size() - 1);
+        tile.fd = connect_tcp(host, port);
+        if (tile.fd < 0 || !lp_send_frame(tile.fd, "HELLO username=" + username_ + " token=" + token +
+                                                       " role=SPEC snap=" + SNAP_BIN_TAG + view_fields(tile.asked))) {
+            close_tile(tile, "unreachable");
+        }
+        dirty_ = true;
+    }
+
+    // Rooms whose feed ended since the last call
+    void take_closed(std::vector<int>& rooms) {
+        rooms.swap(closed_rooms_);
+        closed_rooms_.clear();
+    }
+    // Every room still watched, for when the grid goes away
+    std::vector<int> open_rooms() const {
+        std::vector<int> rooms;
+        for (const Tile& t : tiles_) {
+            if (t.fd >= 0) rooms.push_back(t.room);
+        }
+        return rooms;
+    }
+
+    int watch(std::vector<pollfd>& pfds) {
+        int timeout = kNoTimeout;
+        for (Tile& t : tiles_) {
+            t.idx = -1;
+            if (t.fd < 0) continue;
+            t.idx = static_cast<int>(pfds.size());
+            pfds.push_back(pollfd{t.fd, POLLIN, 0});
+        }
+#if defined(HAVE_X11_GUI)
+        if (gui_) {
+            pfds.push_back(pollfd{gui_->connection_fd(), POLLIN, 0});
+            if (gui_->has_queued_events()) timeout = 0;
+        }
+#endif
+        return timeout;
+    }
+
+    void step(const std::vector<pollfd>& pfds) {
+        for (Tile& t : tiles_) {
+            if (t.idx < 0 || t.fd < 0 || !(pfds[t.idx].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            size_t count = 0;
+            const FrameReader::ReadResult st = t.reader.read_from(t.fd, frames_, count);
+            for (size_t i = 0; i < count; ++i) on_frame(t, frames_[i]);
+            if (st != FrameReader::ReadResult::Ok && t.fd >= 0) close_tile(t, "ended");
+        }
+#if defined(HAVE_X11_GUI)
+        if (gui_ && running_) {
+            while (auto action = gui_->poll_action()) on_action(*action);
+            if (!gui_->is_open()) {
+                running_ = false;
+                return;
             }
-#endif
-            running_ = false;
-        } else {
-            safe_print("[game] " + msg + '\n');
+            if (gui_->mapped() != visible_) {
+                visible_ = gui_->mapped();
+                relevel();
+            }
+            if (gui_->consume_redraw_request()) dirty_ = true;
         }
+#endif
+        if (dirty_ && running_) draw();
     }
 
-    void render_boards(const std::map<std::string, SnapshotData>& snapshots,
-                       const std::string& local_user) {
-        std::vector<std::pair<std::string, SnapshotData>> ordered;
-        for (auto const& kv : snapshots) ordered.push_back(kv);
-
-        if (!spectator_) {
-            auto it = snapshots.find(local_user);
-            if (it != snapshots.end()) {
-                ordered.erase(std::remove_if(ordered.begin(), ordered.end(), [&](auto const& p) {
-                                     return p.first == local_user;
-                                 }),
-                                ordered.end());
-                ordered.insert(ordered.begin(), *it);
+    // Keys typed on the terminal while it shows the grid
+    void on_keys(std::string_view keys) {
+        for (size_t i = 0; i < keys.size() && running_; ++i) {
+            if (keys[i] == '\x1b') {
+                i += 2; // arrow keys and the like mean nothing here
+            } else if (keys[i] == 'n' || keys[i] == 'N') {
+                on_action("NEXT_PAGE");
+            } else if (keys[i] == 'p' || keys[i] == 'P') {
+                on_action("PREV_PAGE");
+            } else if (keys[i] == 'q' || keys[i] == 'Q') {
+                running_ = false;
             }
         }
+    }
 
-        if (ordered.empty()) return;
-
-        while (ordered.size() < 2) ordered.emplace_back("(waiting)", SnapshotData{});
+    // Closes every feed and gives the screen back; safe to call twice
+    void end() {
+        if (ended_) return;
+        ended_ = true;
+        running_ = false;
+        for (Tile& t : tiles_) {
+            if (t.fd >= 0) ::close(t.fd);
+            t.fd = -1;
+        }
+#if defined(HAVE_X11_GUI)
+        gui_.reset();
+#endif
+        raw_.reset();
+        safe_print("[grid] Closed.\n");
+    }
 
+   private:
+    enum class Detail { Paused, Summary, Thumbnail, Full };
+
+    struct Tile {
+        int room = 0;
+        int fd = -1;
+        int idx = -1; // in the poll set, -1 when not watched
+        Detail asked = Detail::Paused; // what the relay was last told
+        FrameReader reader;
+        SnapshotView views[2];
+        MatchBoards boards;
+        std::string result; // final scores, or why the feed ended
+    };
+
+    bool has_window() const {
 #if defined(HAVE_X11_GUI)
-        latest_gui_state_ = ordered;
-        if (gui_) {
-            gui_->render(latest_gui_state_, local_user);
-            return;
-        }
+        return gui_ != nullptr;
+#else
+        return false;
 #endif
+    }
 
-        std::lock_guard<std::mutex> lock(g_console_mutex);
-        std::cout << "\033[2J\033[H";
-        std::cout << "==== Tetris Match ====" << (spectator_ ? " (Spectator)" : "") << "\n";
+    size_t per_page() const {
+#if defined(HAVE_X11_GUI)
+        if (gui_) return X11Renderer::kGridCols * X11Renderer::kGridRows;
+#endif
+        return kTerminalRows;
+    }
+    size_t pages() const { return std::max<size_t>(1, (tiles_.size() + per_page() - 1) / per_page()); }
 
-        std::cout << std::left << std::setw(25) << (ordered[0].first + " Score: " + std::to_string(ordered[0].second.score))
-                  << std::setw(25) << (ordered[1].first + " Score: " + std::to_string(ordered[1].second.score)) << "\n";
+    Detail detail_for(size_t i) const {
+        if (!visible_ || i / per_page() != page_) return Detail::Paused;
+        if (!has_window()) return Detail::Summary;
+        return i == focus_ ? Detail::Full : Detail::Thumbnail;
+    }
 
-        for (int r = 0; r < BOARD_ROWS; ++r) {
-            render_row(ordered[0].second.board, r);
-            std::cout << "    ";
-            render_row(ordered[1].second.board, r);
-            std::cout << '\n';
+    // HELLO and VIEW fields asking for a level of detail
+    static std::string view_fields(Detail detail) {
+        switch (detail) {
+            case Detail::Paused: return " detail=paused";
+            case Detail::Summary: return " detail=summary";
+            case Detail::Thumbnail: return " detail=full rate=" + std::to_string(kThumbnailMs);
+            case Detail::Full: return " detail=full";
         }
+        return {};
+    }
 
-        std::cout << std::flush;
+    // Tells the relay about every tile whose level of detail changed
+    void relevel() {
+        for (size_t i = 0; i < tiles_.size(); ++i) {
+            Tile& t = tiles_[i];
+            const Detail want = detail_for(i);
+            if (t.fd < 0 || want == t.asked) continue;
+            t.asked = want;
+            if (!lp_send_frame(t.fd, "VIEW" + view_fields(want))) close_tile(t, "ended");
+        }
+        dirty_ = true;
     }
 
-    void render_row(const std::string& board, int row) {
-        if (board.size() != BOARD_ROWS * BOARD_COLS) {
-            std::cout << std::string(BOARD_COLS, ' ');
+    void on_action(const std::string& action) {
+        const size_t first = page_ * per_page();
+        const size_t on_page = std::min(per_page(), tiles_.size() - std::min(first, tiles_.size()));
+        if (action == "NEXT_PAGE" || action == "PREV_PAGE") {
+            const size_t count = pages();
+            page_ = action == "NEXT_PAGE" ? (page_ + 1) % count : (page_ + count - 1) % count;
+            focus_ = page_ * per_page();
+        } else if ((action == "FOCUS_NEXT" || action == "FOCUS_PREV") && on_page > 0) {
+            const size_t at = focus_ - std::min(focus_, first);
+            focus_ = first + (action == "FOCUS_NEXT" ? (at + 1) % on_page : (at + on_page - 1) % on_page);
+        } else if (action.rfind("FOCUS ", 0) == 0) {
+            const size_t slot = static_cast<size_t>(std::atoi(action.c_str() + 6));
+            if (slot >= on_page) return;
+            focus_ = first + slot;
+        } else {
             return;
         }
-        for (int c = 0; c < BOARD_COLS; ++c) {
-            char ch = board[row * BOARD_COLS + c];
-            if (ch == '0') std::cout << '.';
-            else std::cout << ch;
-        }
+        relevel();
     }
 
-    void handle_input(int fd) {
-        char buf[8];
-        ssize_t n = ::read(STDIN_FILENO, buf, sizeof(buf));
-        if (n <= 0) return;
-        std::string action;
-        if (buf[0] == '\x1b' && n >= 3 && buf[1] == '[') {
-            switch (buf[2]) {
-                case 'A': action = "ROTATE"; break;
-                case 'B': action = "DOWN"; break;
-                case 'C': action = "RIGHT"; break;
-                case 'D': action = "LEFT"; break;
+    void on_frame(Tile& t, std::string_view msg) {
+        if (is_binary_snapshot(msg)) {
+            int seat = -1;
+            if (!apply_binary_snapshot(msg, t.views, seat)) return;
+            const SnapshotView& view = t.views[seat];
+            // Summaries carry no name and no board, only the numbers
+            SnapshotData& data = static_cast<uint8_t>(msg[1]) == SNAP_KIND_SUMMARY
+                                     ? t.boards.boards[seat]
+                                     : t.boards.at(seat, view.name);
+            if (static_cast<uint8_t>(msg[1]) != SNAP_KIND_SUMMARY) {
+                write_board_chars(data.board.data(), view.colors, view.piece);
+                data.have_board = true;
             }
-        } else if (buf[0] == ' ' || buf[0] == '\n') {
-            action = "DROP";
-        } else if (buf[0] == 'h' || buf[0] == 'H') {
-            action = "HOLD";
-        } else if (buf[0] == 'q' || buf[0] == 'Q') {
-            running_ = false;
-            safe_print("[game] Exiting match...\n");
+            data.score = view.score;
+            data.lines = view.lines;
+            data.gameover = view.gameover;
+            dirty_ = true;
+        } else if (msg.rfind("GAME_OVER", 0) == 0) {
+            std::string_view p1 = "?", p2 = "?";
+            for_each_pair(msg, [&](std::string_view key, std::string_view value) {
+                if (key == "p1_score") p1 = value;
+                else if (key == "p2_score") p2 = value;
+            });
+            t.result = "final " + std::string(p1) + ":" + std::string(p2);
+            dirty_ = true;
+        } else if (msg.rfind("ERR", 0) == 0) {
+            close_tile(t, std::string(msg));
         }
+    }
 
-        if (!action.empty()) {
-            lp_send_frame(fd, "INPUT " + action);
-        }
+    void close_tile(Tile& t, const std::string& why) {
+        if (t.fd >= 0) ::close(t.fd);
+        t.fd = -1;
+        if (t.result.empty()) t.result = why;
+        closed_rooms_.push_back(t.room);
+        dirty_ = true;
     }
 
-    static std::unordered_map<std::string, std::string> parse_pairs(const std::string& line) {
-        std::unordered_map<std::string, std::string> m;
-        std::istringstream iss(line);
-        std::string word;
-        iss >> word;  // consume command
-        while (iss >> word) {
-            auto eq = word.find('=');
-            if (eq == std::string::npos) continue;
-            m[word.substr(0, eq)] = word.substr(eq + 1);
+    void draw() {
+        dirty_ = false;
+        const size_t first = page_ * per_page();
+        const size_t last = std::min(tiles_.size(), first + per_page());
+        const std::string page = "page " + std::to_string(page_ + 1) + "/" + std::to_string(pages()) + ", " +
+                                 std::to_string(tiles_.size()) + " rooms";
+#if defined(HAVE_X11_GUI)
+        if (gui_) {
+            titles_.resize(per_page());
+            std::vector<GridCell> cells;
+            for (size_t i = first; i < last; ++i) {
+                const Tile& t = tiles_[i];
+                std::string& title = titles_[i - first];
+                title = "Room #" + std::to_string(t.room);
+                if (!t.result.empty()) title += " - " + t.result;
+                cells.push_back(GridCell{title, &t.boards, i == focus_});
+            }
+            gui_->render_grid(cells, "Grid: " + page + " | n/p page, Tab or click to focus, q close");
+            return;
         }
-        return m;
+#endif
+        // One row per room: both players' numbers, from summaries
+        frame_.resize(2 + per_page());
+        for (auto& line : frame_) line.clear();
+        put_text(frame_[0], 0, "==== Tetris Grid ==== " + page + " (n/p page, q close)");
+        put_text(frame_[1], 0, "Room    P1 score  lines height   P2 score  lines height");
+        for (size_t i = first; i < last; ++i) {
+            const Tile& t = tiles_[i];
+            std::vector<TerminalRenderer::Cell>& line = frame_[2 + i - first];
+            put_text(line, 0, "#" + std::to_string(t.room));
+            for (int seat = 0; seat < 2; ++seat) {
+                const SnapshotData& data = t.boards.boards[seat];
+                const int col = 8 + seat * 25;
+                put_text(line, col + 3, std::to_string(data.score));
+                put_text(line, col + 10, std::to_string(data.lines));
+                put_text(line, col + 17, std::to_string(t.views[seat].height));
+            }
+            put_text(line, 58, t.result);
+        }
+        term_.present(frame_);
     }
 
-    std::string host_;
-    uint16_t port_{};
+    static constexpr int kThumbnailMs = 250; // keyframe interval for unfocused tiles
+    static constexpr size_t kTerminalRows = 16;
+
     std::string username_;
-    std::string token_;
-    bool spectator_{};
-    bool running_ = true;
+    bool running_ = false;
+    bool ended_ = false;
+    bool dirty_ = false;
+    bool visible_ = true; // false while the window is minimized
+    std::vector<Tile> tiles_;
+    size_t page_ = 0;
+    size_t focus_ = 0; // index into tiles_
+    std::vector<std::string> frames_;
+    std::vector<int> closed_rooms_;
+    TerminalRenderer term_;
+    TerminalRenderer::Frame frame_;
+    std::unique_ptr<TerminalRawMode> raw_;
 #if defined(HAVE_X11_GUI)
     std::unique_ptr<X11Renderer> gui_;
-    std::vector<std::pair<std::string, SnapshotData>> latest_gui_state_;
+    std::vector<std::string> titles_; // backing the views render_grid gets
 #endif
 };
 
@@ -588,141 +1862,276 @@ class ClientApp {
             return false;
         }
         safe_print_notice("[client] Connected to lobby at " + lobby_host_ + ':' + std::to_string(lobby_port_) + '.');
-        lobby_thread_ = std::thread(&ClientApp::lobby_reader, this);
         return true;
     }
 
+    // The client's only loop: one poll() over the lobby connection, stdin and
+    // every game session's sockets, windows and timers. Lobby messages, typed
+    // lines and match traffic are handled one at a time in the order they
+    // come, and poll() returns only when one of them needs something.
     void run() {
-        prompt_login();
-        if (!running_) return;
-        menu_loop();
+        std::vector<pollfd> pfds;
+        while (running_) {
+            take_typed_lines();
+            if (!running_) break;
+            pfds.clear();
+            pfds.push_back(pollfd{lobby_fd_, POLLIN, 0});
+            int stdin_idx = -1;
+            if (!stdin_closed_) {
+                stdin_idx = static_cast<int>(pfds.size());
+                pfds.push_back(pollfd{STDIN_FILENO, POLLIN, 0});
+            }
+            int timeout = kNoTimeout;
+            const size_t watched = sessions_.size(); // sessions started below wait for the next round
+            for (auto& session : sessions_) timeout = sooner(session->watch(pfds), timeout);
+            SpectatorGrid* grid = grid_.get(); // one created below waits for the next round
+            if (grid) timeout = sooner(grid->watch(pfds), timeout);
+
+            int rc = ::poll(pfds.data(), pfds.size(), timeout);
+            if (rc < 0 && errno == EINTR) continue;
+            if (rc < 0) {
+                safe_print("[client] poll error.\n");
+                break;
+            }
+            if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) read_lobby();
+            if (stdin_idx >= 0 && (pfds[stdin_idx].revents & (POLLIN | POLLHUP | POLLERR))) read_stdin();
+            for (size_t i = 0; i < watched; ++i) sessions_[i]->step(pfds);
+            if (grid && grid == grid_.get()) grid->step(pfds);
+            reap_sessions();
+            reap_grid();
+        }
     }
 
     ~ClientApp() {
-        running_ = false;
-        if (lobby_thread_.joinable()) lobby_thread_.join();
+        sessions_.clear();
+        grid_.reset();
         if (lobby_fd_ >= 0) ::close(lobby_fd_);
     }
 
    private:
     enum class AuthAction { None, Register, Login };
 
-    void prompt_login() {
-        while (running_ && !logged_in_) {
-            render_login_prompt(false);
-            std::string choice;
-            if (!std::getline(std::cin, choice)) {
-                login_prompt_visible_ = false;
-                return;
-            }
-            login_prompt_visible_ = false;
-            if (choice == "0") {
-                running_ = false;
-                return;
-            } else if (choice == "1") {
-                std::string user, pass;
-                safe_print("Choose username: ");
-                if (!std::getline(std::cin, user)) return;
-                safe_print("Choose password: ");
-                if (!std::getline(std::cin, pass)) return;
-                if (user.empty() || pass.empty()) continue;
-                pending_auth_ = AuthAction::Register;
-                {
-                    std::unique_lock<std::mutex> lock(auth_mutex_);
-                    auth_waiting_ = true;
-                    auth_success_ = false;
-                }
-                lp_send_frame(lobby_fd_, "REGISTER " + user + ' ' + pass);
-                wait_for_auth();
-                if (auth_success_) {
-                    username_hint_ = user;
-                    password_hint_ = pass;
-                    pending_auth_ = AuthAction::Login;
-                    {
-                        std::unique_lock<std::mutex> lock(auth_mutex_);
-                        auth_waiting_ = true;
-                        auth_success_ = false;
-                    }
-                    lp_send_frame(lobby_fd_, "LOGIN " + user + ' ' + pass);
-                    wait_for_auth();
-                    if (!auth_success_) continue;
-                }
-            } else if (choice == "2") {
-                std::string user, pass;
-                safe_print("Username: ");
-                if (!std::getline(std::cin, user)) return;
-                safe_print("Password: ");
-                if (!std::getline(std::cin, pass)) return;
-                if (user.empty() || pass.empty()) continue;
-                username_hint_ = user;
-                password_hint_ = pass;
-                pending_auth_ = AuthAction::Login;
-                {
-                    std::unique_lock<std::mutex> lock(auth_mutex_);
-                    auth_waiting_ = true;
-                    auth_success_ = false;
-                }
-                lp_send_frame(lobby_fd_, "LOGIN " + user + ' ' + pass);
-                wait_for_auth();
-                if (!auth_success_) continue;
-            } else {
-                safe_print("Invalid selection.\n");
-            }
+    // What the next typed line answers
+    enum class Ask {
+        LoginChoice,
+        RegisterUser,
+        RegisterPass,
+        LoginUser,
+        LoginPass,
+        LobbyReply, // REGISTER or LOGIN sent; lines typed meanwhile wait for the answer
+        MenuChoice,
+        RoomName,
+        RoomVisibility,
+        JoinRoom,
+        InviteUser,
+        SpectateRoom,
+        GridRooms,
+    };
+
+    void read_lobby() {
+        size_t count = 0;
+        const FrameReader::ReadResult st = lobby_reader_.read_from(lobby_fd_, lobby_frames_, count);
+        for (size_t i = 0; i < count; ++i) handle_lobby_message(lobby_frames_[i]);
+        if (st != FrameReader::ReadResult::Ok) {
+            safe_print_notice("[client] Lobby connection closed.");
+            running_ = false;
         }
-        login_prompt_visible_ = false;
     }
 
-    void wait_for_auth() {
-        std::unique_lock<std::mutex> lock(auth_mutex_);
-        auth_cv_.wait(lock, [&] { return !auth_waiting_ || !running_; });
+    // Keys for the match on the terminal, if there is one, else menu lines
+    void read_stdin() {
+        char buf[256];
+        ssize_t n = ::read(STDIN_FILENO, buf, sizeof(buf));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        if (n <= 0) {
+            stdin_closed_ = true;
+            if (!typed_.empty() && typed_.back() != '\n') typed_.push_back('\n');
+            return;
+        }
+        if (GameSession* session = terminal_session()) {
+            session->on_keys(std::string_view(buf, static_cast<size_t>(n)));
+            return;
+        }
+        if (grid_ && grid_->uses_terminal()) {
+            grid_->on_keys(std::string_view(buf, static_cast<size_t>(n)));
+            return;
+        }
+        typed_.append(buf, static_cast<size_t>(n));
     }
 
-    void menu_loop() {
+    // Shows the prompt that is due and feeds it complete lines. Lines typed
+    // ahead wait while the lobby's answer to a login is pending or a match has
+    // the terminal. Once stdin is closed and nothing is left to do, the client
+    // exits.
+    void take_typed_lines() {
         while (running_) {
-            if (game_active_) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(200));
-                continue;
-            }
-            if (menu_dirty_.exchange(false)) {
-                render_menu();
+            show_prompt_if_due();
+            if (ask_ == Ask::LobbyReply || terminal_busy()) return;
+            const size_t eol = typed_.find('\n');
+            if (eol == std::string::npos) {
+                if (stdin_closed_ && sessions_.empty() && !grid_) running_ = false;
+                return;
             }
+            std::string line = typed_.substr(0, eol);
+            typed_.erase(0, eol + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            on_line(line);
+        }
+    }
 
-            std::string choice;
-            if (!std::getline(std::cin, choice)) break;
-            if (!running_) break;
-            if (choice == "0") {
-                running_ = false;
-                lp_send_frame(lobby_fd_, "LOGOUT");
+    void ask(Ask next, const std::string& question) {
+        ask_ = next;
+        safe_print(question);
+    }
+
+    void on_line(const std::string& line) {
+        switch (ask_) {
+            case Ask::LoginChoice:
+                if (line == "0") {
+                    running_ = false;
+                } else if (line == "1") {
+                    ask(Ask::RegisterUser, "Choose username: ");
+                } else if (line == "2") {
+                    ask(Ask::LoginUser, "Username: ");
+                } else {
+                    safe_print("Invalid selection.\n");
+                    prompt_due_ = true;
+                }
+                break;
+            case Ask::RegisterUser:
+                entered_user_ = line;
+                ask(Ask::RegisterPass, "Choose password: ");
+                break;
+            case Ask::LoginUser:
+                entered_user_ = line;
+                ask(Ask::LoginPass, "Password: ");
+                break;
+            case Ask::RegisterPass:
+            case Ask::LoginPass:
+                if (entered_user_.empty() || line.empty()) {
+                    back_to_login();
+                    break;
+                }
+                username_hint_ = entered_user_;
+                password_hint_ = line;
+                pending_auth_ = ask_ == Ask::RegisterPass ? AuthAction::Register : AuthAction::Login;
+                lp_send_frame(lobby_fd_, std::string(pending_auth_ == AuthAction::Register ? "REGISTER " : "LOGIN ") +
+                                             username_hint_ + ' ' + password_hint_);
+                ask_ = Ask::LobbyReply;
+                break;
+            case Ask::LobbyReply:
+                break;
+            case Ask::MenuChoice:
+                on_menu_choice(line);
+                break;
+            case Ask::RoomName:
+                entered_room_name_ = line;
+                ask(Ask::RoomVisibility, "Visibility [public/private]: ");
+                break;
+            case Ask::RoomVisibility: {
+                ask_ = Ask::MenuChoice;
+                std::string vis = trim_copy(line);
+                if (vis.empty()) {
+                    vis = "public";
+                } else {
+                    vis = to_lower_copy(vis);
+                    if (vis != "public" && vis != "private") {
+                        safe_print_notice("[lobby] Visibility must be 'public' or 'private'.");
+                        prompt_due_ = true;
+                        break;
+                    }
+                }
+                lp_send_frame(lobby_fd_, "CREATE_ROOM " + entered_room_name_ + ' ' + vis);
                 break;
             }
-
-            int sel = -1;
-            try {
-                sel = std::stoi(choice);
-            } catch (...) {
-                safe_print("Invalid selection.\n");
-                menu_dirty_ = true;
-                continue;
+            case Ask::JoinRoom:
+            case Ask::SpectateRoom: {
+                const bool join = ask_ == Ask::JoinRoom;
+                ask_ = Ask::MenuChoice;
+                if (line.empty()) {
+                    prompt_due_ = true;
+                    break;
+                }
+                auto parsed = parse_numeric_id(line);
+                if (!parsed) {
+                    safe_print_notice("[lobby] Room IDs must be numeric.");
+                    prompt_due_ = true;
+                    break;
+                }
+                if (join) {
+                    pending_join_ = *parsed;
+                    lp_send_frame(lobby_fd_, "JOIN_ROOM " + line);
+                } else {
+                    pending_spectate_ = *parsed;
+                    lp_send_frame(lobby_fd_, "SPECTATE " + line);
+                }
+                break;
             }
-
-            int action_code = -1;
-            {
-                std::lock_guard<std::mutex> lock(menu_mutex_);
-                if (sel < 1 || sel > static_cast<int>(menu_codes_.size())) {
-                    safe_print("Invalid selection.\n");
-                    menu_dirty_ = true;
-                    continue;
+            case Ask::GridRooms: {
+                ask_ = Ask::MenuChoice;
+                prompt_due_ = true;
+                std::istringstream ids(line);
+                std::string id;
+                while (ids >> id) {
+                    auto parsed = parse_numeric_id(id);
+                    if (!parsed) {
+                        safe_print_notice("[lobby] Room IDs must be numeric, skipping '" + id + "'.");
+                        continue;
+                    }
+                    if (grid_rooms_.insert(*parsed).second) lp_send_frame(lobby_fd_, "SPECTATE " + id);
                 }
-                action_code = menu_codes_[sel - 1];
+                break;
             }
+            case Ask::InviteUser:
+                ask_ = Ask::MenuChoice;
+                if (line.empty()) {
+                    prompt_due_ = true;
+                } else {
+                    lp_send_frame(lobby_fd_, "INVITE " + line);
+                }
+                break;
+        }
+    }
+
+    void back_to_login() {
+        ask_ = Ask::LoginChoice;
+        prompt_due_ = true;
+    }
+
+    void on_menu_choice(const std::string& choice) {
+        if (choice == "0") {
+            running_ = false;
+            lp_send_frame(lobby_fd_, "LOGOUT");
+            return;
+        }
+        int sel = -1;
+        try {
+            sel = std::stoi(choice);
+        } catch (...) {
+        }
+        if (sel < 1 || sel > static_cast<int>(menu_codes_.size())) {
+            safe_print("Invalid selection.\n");
+            prompt_due_ = true;
+            return;
+        }
+        execute_action(menu_codes_[sel - 1]);
+    }
 
-            execute_action(action_code);
+    // The login prompt or the menu, whichever is open, once something changed;
+    // in the middle of a question it waits for the answer
+    void show_prompt_if_due() {
+        if (!prompt_due_ || terminal_busy()) return;
+        if (ask_ == Ask::LoginChoice) {
+            safe_print(login_prompt_text_);
+        } else if (ask_ == Ask::MenuChoice) {
+            render_menu();
+        } else {
+            return;
         }
+        prompt_due_ = false;
     }
 
     void render_menu() {
-        if (!logged_in_ || game_active_) return;
-        std::lock_guard<std::mutex> lock(menu_mutex_);
         menu_codes_.clear();
         std::ostringstream oss;
         oss << "\n=== Lobby Menu ===\n";
@@ -748,33 +2157,14 @@ class ClientApp {
         }
         add_option(7);                // list invites
         add_option(9);                // spectate room
-        if (spectating_room_) add_option(10); // stop spectating
+        add_option(12);               // spectate rooms in a grid
+        if (!spectating_rooms_.empty()) add_option(10); // stop spectating
         add_option(11);               // logout
 
         oss << "0) Exit\nSelect action > ";
         safe_print(oss.str());
     }
 
-    void render_login_prompt(bool refresh) {
-        std::string prompt = login_prompt_text_;
-        if (refresh) prompt.insert(prompt.begin(), '\n');
-        safe_print(prompt);
-        login_prompt_visible_ = true;
-    }
-
-    void refresh_menu_async() {
-        if (!logged_in_) {
-            if (login_prompt_visible_) {
-                render_login_prompt(true);
-            }
-            return;
-        }
-        menu_dirty_ = true;
-        if (!game_active_) {
-            render_menu();
-        }
-    }
-
     bool maybe_handle_leave_ack(const std::string& msg) {
         if (!pending_leave_) return false;
         if (msg.rfind("OK", 0) == 0) {
@@ -793,7 +2183,6 @@ class ClientApp {
                              : "[lobby] You left the room.";
             }
             safe_print_notice(notice);
-            refresh_menu_async();
             return true;
         }
         if (msg.rfind("ERR", 0) == 0) {
@@ -815,6 +2204,7 @@ class ClientApp {
             case 9: return "Spectate room";
             case 10: return "Stop spectating";
             case 11: return "Logout";
+            case 12: return "Watch rooms in a grid";
             default: return "Unknown";
         }
     }
@@ -825,62 +2215,28 @@ class ClientApp {
                 last_command_ = "LIST_ONLINE";
                 lp_send_frame(lobby_fd_, "LIST_ONLINE");
                 break;
-            case 2: {  // create room
-                std::string name, vis;
-                safe_print("Room name (no spaces): ");
-                if (!std::getline(std::cin, name)) { running_ = false; return; }
-                safe_print("Visibility [public/private]: ");
-                if (!std::getline(std::cin, vis)) { running_ = false; return; }
-                vis = trim_copy(vis);
-                if (vis.empty()) {
-                    vis = "public";
-                } else {
-                    vis = to_lower_copy(vis);
-                    if (vis != "public" && vis != "private") {
-                        safe_print_notice("[lobby] Visibility must be 'public' or 'private'.");
-                        menu_dirty_ = true;
-                        break;
-                    }
-                }
-                lp_send_frame(lobby_fd_, "CREATE_ROOM " + name + ' ' + vis);
+            case 2:  // create room
+                ask(Ask::RoomName, "Room name (no spaces): ");
                 break;
-            }
             case 3:  // list rooms
                 last_command_ = "LIST_ROOMS";
                 lp_send_frame(lobby_fd_, "LIST_ROOMS");
                 break;
-            case 4: {  // join room
-                std::string rid;
-                safe_print("Room ID to join: ");
-                if (!std::getline(std::cin, rid)) { running_ = false; return; }
-                if (!rid.empty()) {
-                    auto parsed = parse_numeric_id(rid);
-                    if (!parsed) {
-                        safe_print_notice("[lobby] Room IDs must be numeric.");
-                        menu_dirty_ = true;
-                        break;
-                    }
-                    pending_join_ = *parsed;
-                    lp_send_frame(lobby_fd_, "JOIN_ROOM " + rid);
-                }
+            case 4:  // join room
+                ask(Ask::JoinRoom, "Room ID to join: ");
                 break;
-            }
             case 5:  // leave room
                 if (!current_room_) {
                     safe_print_notice("[lobby] You are not in a room.");
-                    menu_dirty_ = true;
+                    prompt_due_ = true;
                 } else {
                     pending_leave_ = true;
                     lp_send_frame(lobby_fd_, "LEAVE_ROOM");
                 }
                 break;
-            case 6: {  // invite user
-                std::string user;
-                safe_print("Invite username: ");
-                if (!std::getline(std::cin, user)) { running_ = false; return; }
-                if (!user.empty()) lp_send_frame(lobby_fd_, "INVITE " + user);
+            case 6:  // invite user
+                ask(Ask::InviteUser, "Invite username: ");
                 break;
-            }
             case 7:  // list invites
                 last_command_ = "LIST_INVITES";
                 lp_send_frame(lobby_fd_, "LIST_INVITES");
@@ -888,63 +2244,40 @@ class ClientApp {
             case 8:  // start game
                 if (!current_room_) {
                     safe_print_notice("[lobby] Join a room first.");
-                    menu_dirty_ = true;
+                    prompt_due_ = true;
                 } else if (room_host_ != username_hint_) {
                     safe_print_notice("[lobby] Only the host can start the match.");
-                    menu_dirty_ = true;
+                    prompt_due_ = true;
                 } else {
                     lp_send_frame(lobby_fd_, "START_GAME");
                 }
                 break;
-            case 9: {  // spectate room
-                std::string rid;
-                safe_print("Room ID to spectate: ");
-                if (!std::getline(std::cin, rid)) { running_ = false; return; }
-                if (!rid.empty()) {
-                    auto parsed = parse_numeric_id(rid);
-                    if (!parsed) {
-                        safe_print_notice("[lobby] Room IDs must be numeric.");
-                        menu_dirty_ = true;
-                        break;
-                    }
-                    pending_spectate_ = *parsed;
-                    lp_send_frame(lobby_fd_, "SPECTATE " + rid);
-                }
+            case 9:  // spectate room
+                ask(Ask::SpectateRoom, "Room ID to spectate: ");
                 break;
-            }
             case 10:  // stop spectating
                 lp_send_frame(lobby_fd_, "UNSPECTATE");
                 break;
-            case 11:  // logout
+            case 11:  // logout; OK LOGOUT brings the login prompt back
                 lp_send_frame(lobby_fd_, "LOGOUT");
-                logged_in_ = false;
                 current_room_.reset();
                 room_host_.clear();
-                spectating_room_.reset();
-                prompt_login();
-                menu_dirty_ = true;
+                spectating_rooms_.clear();
+                grid_rooms_.clear();
+                ask_ = Ask::LoginChoice;
+                break;
+            case 12:  // spectate rooms in a grid
+                ask(Ask::GridRooms, "Room IDs to watch (space separated): ");
                 break;
             default:
                 safe_print("Invalid selection.\n");
-                menu_dirty_ = true;
-                break;
-        }
-    }
-
-    void lobby_reader() {
-        while (running_) {
-            std::string frame;
-            if (!lp_recv_frame(lobby_fd_, frame)) {
-                safe_print_notice("[client] Lobby connection closed.");
-                running_ = false;
+                prompt_due_ = true;
                 break;
-            }
-            handle_lobby_message(frame);
         }
     }
 
     void handle_lobby_message(const std::string& msg) {
-        menu_dirty_ = true;
+        prompt_due_ = true; // whatever it was, the prompt is shown again below it
         if (maybe_handle_leave_ack(msg)) {
             return;
         }
@@ -954,83 +2287,93 @@ class ClientApp {
             std::string host = kv.count("host") ? kv["host"] : "someone";
             std::string name = kv.count("name") ? kv["name"] : "(unnamed)";
             safe_print_notice("[lobby] Invitation from " + host + " to room #" + rid + " \"" + name + "\".");
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("OK SPECTATE", 0) == 0) {
-            if (pending_spectate_) {
-                spectating_room_ = pending_spectate_;
-                pending_spectate_.reset();
-            }
+            auto kv = parse_pairs(msg);
+            const std::optional<int> room = kv.count("roomId") ? parse_numeric_id(kv["roomId"]) : pending_spectate_;
+            if (room && room == pending_spectate_) pending_spectate_.reset();
+            if (room && !is_spectating(*room)) spectating_rooms_.push_back(*room);
             safe_print_notice("[lobby] Spectating room " + spectate_status() + ".");
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("OK UNSPECTATE", 0) == 0) {
-            spectating_room_.reset();
+            auto kv = parse_pairs(msg);
+            if (auto room = kv.count("roomId") ? parse_numeric_id(kv["roomId"]) : std::nullopt) {
+                std::erase(spectating_rooms_, *room);
+                grid_rooms_.erase(*room);
+                safe_print_notice("[lobby] Stopped spectating room #" + std::to_string(*room) + ".");
+                return;
+            }
+            // All of them: close whatever still shows one
+            spectating_rooms_.clear();
+            grid_rooms_.clear();
+            grid_.reset();
+            for (auto& session : sessions_) {
+                if (session->spectator()) session->end();
+            }
             safe_print_notice("[lobby] Spectate session ended.");
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("OK LOGIN", 0) == 0) {
-            logged_in_ = true;
-            auth_success_ = true;
-            complete_auth();
+            pending_auth_ = AuthAction::None;
+            ask_ = Ask::MenuChoice;
             safe_print_notice("[lobby] Login successful.");
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("OK user=", 0) == 0) {
-            auth_success_ = true;
-            complete_auth();
             safe_print_notice("[lobby] Registration successful.");
-            refresh_menu_async();
+            if (pending_auth_ == AuthAction::Register) {
+                // Straight on to logging in with the new account
+                pending_auth_ = AuthAction::Login;
+                lp_send_frame(lobby_fd_, "LOGIN " + username_hint_ + ' ' + password_hint_);
+            }
             return;
         }
         if (msg.rfind("ERR bad_credentials", 0) == 0) {
-            auth_success_ = false;
-            complete_auth();
+            pending_auth_ = AuthAction::None;
+            back_to_login();
             safe_print_notice("[lobby] Login failed: bad credentials.");
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("ERR exists", 0) == 0) {
-            auth_success_ = false;
-            complete_auth();
+            pending_auth_ = AuthAction::None;
+            back_to_login();
             safe_print_notice("[lobby] That username is already taken.");
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("ERR already_online", 0) == 0) {
-            auth_success_ = false;
-            complete_auth();
+            pending_auth_ = AuthAction::None;
+            back_to_login();
             safe_print_notice("[lobby] This account is already logged in elsewhere.");
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("OK LOGOUT", 0) == 0) {
-            logged_in_ = false;
-            auth_success_ = true;
-            complete_auth();
+            ask_ = Ask::LoginChoice;
             safe_print_notice("[lobby] Logged out.");
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("GAME_READY", 0) == 0 || msg.rfind("SPECTATE_READY", 0) == 0) {
             auto kv = parse_pairs(msg);
             GameRequest req;
-            req.host = lobby_host_;
+            // A spectator may be sent to a relay on another host
+            req.host = kv.count("host") ? kv["host"] : lobby_host_;
             req.port = static_cast<uint16_t>(std::stoi(kv["port"]));
             req.token = kv["token"];
             req.spectator = msg.rfind("SPECTATE_READY", 0) == 0;
             if (req.spectator) {
-                if (!spectating_room_ && pending_spectate_) spectating_room_ = pending_spectate_;
+                auto room = kv.count("roomId") ? parse_numeric_id(kv["roomId"]) : pending_spectate_;
                 pending_spectate_.reset();
+                req.room = room.value_or(0);
+                if (room && !is_spectating(*room)) spectating_rooms_.push_back(*room);
+                if (room && grid_rooms_.count(*room)) {
+                    start_grid_tile(req);
+                    return;
+                }
             }
             safe_print_notice(std::string("[lobby] ") + (req.spectator ? "Spectator" : "Match") +
                               " ready on port " + std::to_string(req.port) + ".");
-            start_game_thread(req);
-            refresh_menu_async();
+            start_session(req);
             return;
         }
         if (msg.rfind("OK roomId=", 0) == 0) {
@@ -1039,7 +2382,6 @@ class ClientApp {
                 room_host_ = username_hint_;
                 safe_print_notice("[lobby] Room created. You are now host.");
             } catch (...) {}
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("OK joined", 0) == 0) {
@@ -1049,46 +2391,34 @@ class ClientApp {
                 pending_join_.reset();
             }
             safe_print_notice("[lobby] Joined room " + room_status());
-            refresh_menu_async();
             return;
         }
         if (msg == "OK" && last_command_ == "LIST_ROOMS") {
             safe_print_notice("[lobby] No rooms are available right now.");
             last_command_.clear();
-            refresh_menu_async();
             return;
         }
         if (msg == "OK" && last_command_ == "LIST_ONLINE") {
             safe_print_notice("[lobby] No players are currently online.");
             last_command_.clear();
-            refresh_menu_async();
             return;
         }
         if (msg == "OK" && last_command_ == "LIST_INVITES") {
             safe_print_notice("[lobby] You have no pending invitations.");
             last_command_.clear();
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("ERR", 0) == 0) {
             if (pending_spectate_) pending_spectate_.reset();
+            if (ask_ == Ask::LobbyReply) back_to_login();
             safe_print_notice("[lobby] " + msg);
-            refresh_menu_async();
             return;
         }
         if (msg.rfind("OK ", 0) == 0 && !last_command_.empty()) {
             format_ok_payload(msg.substr(3));
-            refresh_menu_async();
             return;
         }
         safe_print_notice("[lobby] " + msg);
-        refresh_menu_async();
-    }
-
-    void complete_auth() {
-        std::unique_lock<std::mutex> lock(auth_mutex_);
-        auth_waiting_ = false;
-        auth_cv_.notify_all();
     }
 
     void format_ok_payload(const std::string& body) {
@@ -1198,20 +2528,89 @@ class ClientApp {
         last_command_.clear();
     }
 
-    void start_game_thread(const GameRequest& req) {
-        if (game_active_.exchange(true)) {
-            safe_print("[game] Match already running, ignoring new request.\n");
-            return;
+    void start_session(const GameRequest& req) {
+        auto session =
+            std::make_unique<GameSession>(req.host, req.port, username_hint_, req.token, req.spectator, req.room);
+        if (session->start(!terminal_busy())) {
+            sessions_.push_back(std::move(session));
+        } else {
+            session_over(req.spectator, req.room);
         }
-        std::thread([this, req]() {
-            GameSession session(req.host, req.port, username_hint_, req.token, req.spectator);
-            session.run();
-            if (req.spectator && lobby_fd_ >= 0 && running_) {
-                lp_send_frame(lobby_fd_, "UNSPECTATE");
+    }
+
+    // A room asked for with "Watch rooms in a grid" becomes a tile; the grid
+    // opens with the first of them
+    void start_grid_tile(const GameRequest& req) {
+        if (!grid_) {
+            auto grid = std::make_unique<SpectatorGrid>(username_hint_);
+            if (!grid->start(!terminal_busy())) {
+                grid_rooms_.erase(req.room);
+                session_over(true, req.room);
+                return;
+            }
+            grid_ = std::move(grid);
+        }
+        grid_->add(req.room, req.host, req.port, req.token);
+    }
+
+    // Gives back the audience seats of tiles whose feed ended, and all of
+    // them once the grid is closed
+    void reap_grid() {
+        if (!grid_) return;
+        std::vector<int> closed;
+        grid_->take_closed(closed);
+        if (grid_->done()) {
+            for (int room : grid_->open_rooms()) closed.push_back(room);
+            grid_.reset();
+            prompt_due_ = true;
+        }
+        for (int room : closed) {
+            grid_rooms_.erase(room);
+            session_over(true, room);
+        }
+    }
+
+    // Sessions that finished; destroying one closes it and restores the terminal
+    void reap_sessions() {
+        for (size_t i = 0; i < sessions_.size();) {
+            if (!sessions_[i]->done()) {
+                ++i;
+                continue;
             }
-            game_active_ = false;
-            menu_dirty_ = true;
-        }).detach();
+            const bool spectator = sessions_[i]->spectator();
+            const int room = sessions_[i]->room();
+            sessions_.erase(sessions_.begin() + static_cast<long>(i));
+            session_over(spectator, room);
+        }
+    }
+
+    // The lobby keeps an audience seat per spectated room, given up when its
+    // view closes. Without a room id (an older lobby) the seat is all of them.
+    void session_over(bool spectator, int room) {
+        prompt_due_ = true;
+        if (!spectator || !running_) return;
+        if (room > 0) {
+            if (is_spectating(room)) lp_send_frame(lobby_fd_, "UNSPECTATE " + std::to_string(room));
+            return;
+        }
+        for (auto const& session : sessions_) {
+            if (session->spectator()) return;
+        }
+        if (grid_) return;
+        lp_send_frame(lobby_fd_, "UNSPECTATE");
+    }
+
+    // The session drawing on the terminal, which also gets the keyboard
+    GameSession* terminal_session() const {
+        for (auto const& session : sessions_) {
+            if (session->uses_terminal()) return session.get();
+        }
+        return nullptr;
+    }
+    bool terminal_busy() const { return terminal_session() || (grid_ && grid_->uses_terminal()); }
+
+    bool is_spectating(int room) const {
+        return std::find(spectating_rooms_.begin(), spectating_rooms_.end(), room) != spectating_rooms_.end();
     }
 
     std::string room_status() const {
@@ -1220,8 +2619,10 @@ class ClientApp {
     }
 
     std::string spectate_status() const {
-        if (!spectating_room_) return "No";
-        return std::to_string(*spectating_room_);
+        if (spectating_rooms_.empty()) return "No";
+        std::string rooms;
+        for (int room : spectating_rooms_) rooms += (rooms.empty() ? "" : ",") + std::to_string(room);
+        return rooms;
     }
 
     static std::string trim_copy(std::string s) {
@@ -1268,32 +2669,33 @@ class ClientApp {
     std::string lobby_host_;
     uint16_t lobby_port_;
     int lobby_fd_ = -1;
-    std::thread lobby_thread_;
-    std::atomic<bool> running_{true};
-
-    // Auth handling
-    std::mutex auth_mutex_;
-    std::condition_variable auth_cv_;
-    bool auth_waiting_ = false;
-    bool auth_success_ = false;
+    FrameReader lobby_reader_;
+    std::vector<std::string> lobby_frames_;
+    bool running_ = true;
+
+    // Console: what has been typed but not taken yet, and what it is for
+    std::string typed_;
+    bool stdin_closed_ = false;
+    Ask ask_ = Ask::LoginChoice;
+    bool prompt_due_ = true;
+    std::string entered_user_;
+    std::string entered_room_name_;
     AuthAction pending_auth_ = AuthAction::None;
 
     // Session state
     std::string username_hint_;
     std::string password_hint_;
-    std::atomic<bool> logged_in_{false};
     std::optional<int> current_room_;
     std::string room_host_;
-    std::optional<int> spectating_room_;
+    std::vector<int> spectating_rooms_; // as the lobby confirmed them
+    std::set<int> grid_rooms_;          // asked for as grid tiles
     std::optional<int> pending_join_;
     std::optional<int> pending_spectate_;
     bool pending_leave_ = false;
     std::string last_command_;
-    std::atomic<bool> game_active_{false};
-    std::mutex menu_mutex_;
     std::vector<int> menu_codes_;
-    std::atomic<bool> menu_dirty_{true};
-    std::atomic<bool> login_prompt_visible_{false};
+    std::vector<std::unique_ptr<GameSession>> sessions_; // at most one of them on the terminal
+    std::unique_ptr<SpectatorGrid> grid_;                // or this
     const std::string login_prompt_text_ = "Login menu: [1] Register  [2] Login  [0] Exit > ";
 };
 
@@ -1303,6 +2705,19 @@ int main(int argc, char** argv) {
     std::string host = "140.113.17.11";
     uint16_t port = 13472;
 
+    // "--practice [--gravity MS] [--seed N]" plays alone, without the lobby;
+    // gravity defaults to the rooms' 500 ms
+    if (argc >= 2 && std::string_view(argv[1]) == "--practice") {
+        int gravity_ms = 500;
+        int seed = static_cast<int>(std::random_device{}());
+        for (int i = 2; i + 1 < argc; i += 2) {
+            const std::string_view opt = argv[i];
+            if (opt == "--gravity") gravity_ms = std::max(MIN_GRAVITY_MS, std::atoi(argv[i + 1]));
+            else if (opt == "--seed") seed = std::atoi(argv[i + 1]);
+        }
+        PracticeSession(gravity_ms, seed).run();
+        return 0;
+    }
     if (argc >= 2) host = argv[1];
     if (argc >= 3) port = static_cast<uint16_t>(std::stoi(argv[2]));
 
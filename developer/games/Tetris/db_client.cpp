@@ -0,0 +1,555 @@
+#include "db_client.hpp"
+
+#include "../core/common.hpp"
+#include "../core/lp_framing.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <climits>
+#include <sstream>
+#include <tuple>
+#include <sys/socket.h>
+#include <unistd.h>
+
+DbClient::~DbClient() {
+    close();
+}
+
+bool DbClient::connect(const std::string& ip, uint16_t port, size_t connections) {
+    close();
+    peer_ = "db:" + ip + ":" + std::to_string(port);
+    if (connections == 0) connections = 1;
+    for (size_t i = 0; i < connections; ++i) {
+        int fd = connect_tcp(ip, port);
+        if (fd < 0) {
+            close();
+            return false;
+        }
+        // Pooled connections sit idle between matches; let the kernel notice a dead peer
+        int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        auto conn = std::make_unique<Conn>();
+        conn->fd = fd;
+        conn->alive = true;
+        conns_.push_back(std::move(conn));
+    }
+    for (auto& conn : conns_) {
+        Conn* raw = conn.get();
+        conn->reader = std::thread([this, raw]() { read_loop(*raw); });
+    }
+    return true;
+}
+
+void DbClient::close() {
+    for (auto& conn : conns_) {
+        if (conn->fd >= 0) ::shutdown(conn->fd, SHUT_RDWR);
+    }
+    for (auto& conn : conns_) {
+        if (conn->reader.joinable()) conn->reader.join();
+        if (conn->fd >= 0) ::close(conn->fd);
+        conn->fd = -1;
+    }
+    conns_.clear();
+}
+
+bool DbClient::connected() const {
+    for (auto const& conn : conns_) {
+        if (conn->alive.load()) return true;
+    }
+    return false;
+}
+
+std::future<DbReply> DbClient::submit(const std::string& cmd) {
+    std::promise<DbReply> promise;
+    std::future<DbReply> future = promise.get_future();
+
+    // Round robin over the live connections
+    Conn* conn = nullptr;
+    for (size_t tries = 0; tries < conns_.size() && !conn; ++tries) {
+        Conn* c = conns_[next_conn_.fetch_add(1) % conns_.size()].get();
+        if (c->alive.load()) conn = c;
+    }
+    if (!conn) {
+        promise.set_value(DbReply{});
+        return future;
+    }
+
+    const uint64_t id = next_id_.fetch_add(1);
+    {
+        // Checked under the lock so a reader that is failing everything cannot miss us
+        std::lock_guard<std::mutex> lock(conn->pending_mutex);
+        if (!conn->alive.load()) {
+            promise.set_value(DbReply{});
+            return future;
+        }
+        conn->pending.emplace(id, std::move(promise));
+    }
+    log_communication(category_, "TX", peer_, cmd);
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(conn->send_mutex);
+        sent = lp_send_frame(conn->fd, db_tag_request(id, cmd));
+    }
+    if (!sent) {
+        std::lock_guard<std::mutex> lock(conn->pending_mutex);
+        auto it = conn->pending.find(id);
+        if (it != conn->pending.end()) {
+            it->second.set_value(DbReply{});
+            conn->pending.erase(it);
+        }
+    }
+    return future;
+}
+
+bool DbClient::call(const std::string& cmd, std::string& reply, int timeout_ms) {
+    std::future<DbReply> future = submit(cmd);
+    if (future.wait_for(std::chrono::milliseconds(timeout_ms)) != std::future_status::ready) {
+        log_checkpoint(category_, "DB_TIMEOUT", cmd);
+        return false;
+    }
+    DbReply r = future.get();
+    if (!r.ok) return false;
+    reply = std::move(r.body);
+    return true;
+}
+
+void DbClient::read_loop(Conn& conn) {
+    std::string frame, tag, body;
+    while (lp_recv_frame(conn.fd, frame)) {
+        if (!db_split_tag(frame, tag, body)) {
+            log_communication_lazy(category_, "RX", [&]() -> const std::string& { return peer_; }, [&] { return frame + " (untagged, dropped)"; });
+            continue;
+        }
+        log_communication(category_, "RX", peer_, body);
+        uint64_t id = 0;
+        try { id = std::stoull(tag); } catch (...) { continue; }
+        std::lock_guard<std::mutex> lock(conn.pending_mutex);
+        auto it = conn.pending.find(id);
+        if (it == conn.pending.end()) continue;
+        it->second.set_value(DbReply{true, std::move(body)});
+        conn.pending.erase(it);
+    }
+    conn.alive = false;
+    fail_pending(conn);
+}
+
+void DbClient::fail_pending(Conn& conn) {
+    std::lock_guard<std::mutex> lock(conn.pending_mutex);
+    for (auto& [id, promise] : conn.pending) promise.set_value(DbReply{});
+    conn.pending.clear();
+}
+
+namespace {
+
+using Deadline = std::chrono::steady_clock::time_point;
+constexpr int kMergeTimeoutMs = 5000; // for all the shard replies behind one request
+
+Deadline merge_deadline() {
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(kMergeTimeoutMs);
+}
+
+// Value of key=... in a request; empty when absent
+std::string db_field(const std::string& cmd, const std::string& key) {
+    const std::string needle = " " + key + "=";
+    size_t pos = cmd.find(needle);
+    if (pos == std::string::npos) return std::string();
+    pos += needle.size();
+    size_t end = cmd.find_first_of(" \n", pos);
+    return cmd.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+}
+
+int db_int_field(const std::string& cmd, const std::string& key, int fallback) {
+    std::string text = db_field(cmd, key);
+    if (text.empty()) return fallback;
+    try { return std::stoi(text); } catch (...) { return fallback; }
+}
+
+// cmd with key=value set, replacing an existing value
+std::string db_with_field(const std::string& cmd, const std::string& key, const std::string& value) {
+    const std::string needle = " " + key + "=";
+    size_t pos = cmd.find(needle);
+    if (pos == std::string::npos) return cmd + needle + value;
+    size_t start = pos + needle.size();
+    size_t end = cmd.find(' ', start);
+    return cmd.substr(0, start) + value + (end == std::string::npos ? "" : cmd.substr(end));
+}
+
+std::future<DbReply> ready_reply(DbReply reply) {
+    std::promise<DbReply> promise;
+    promise.set_value(std::move(reply));
+    return promise.get_future();
+}
+
+DbReply wait_reply(std::future<DbReply>& future, Deadline deadline) {
+    if (future.wait_until(deadline) != std::future_status::ready) return DbReply{};
+    return future.get();
+}
+
+// The entries of an "OK a;b;c;" page
+std::vector<std::string> page_entries(const std::string& body, char sep) {
+    std::vector<std::string> out;
+    std::stringstream ss(body.size() > 3 ? body.substr(3) : std::string());
+    std::string entry;
+    while (std::getline(ss, entry, sep)) {
+        if (!entry.empty()) out.push_back(entry);
+    }
+    return out;
+}
+
+int entry_id(const std::string& entry) {
+    size_t start = entry.rfind("id=", 0) == 0 ? 3 : 0;
+    try { return std::stoi(entry.substr(start)); } catch (...) { return 0; }
+}
+
+// How the per-shard replies of a fanned-out request combine
+enum class MergeKind { Names, ById, Leaderboard, Buckets };
+
+DbReply merge_replies(std::vector<std::future<DbReply>>& futures, MergeKind kind, int limit, int after) {
+    Deadline deadline = merge_deadline();
+    std::vector<std::string> entries;
+    for (auto& f : futures) {
+        DbReply r = wait_reply(f, deadline);
+        if (!r.ok || r.body.rfind("OK", 0) != 0) return r;
+        auto part = page_entries(r.body, kind == MergeKind::Names ? ',' : ';');
+        entries.insert(entries.end(), part.begin(), part.end());
+    }
+
+    std::string body = "OK ";
+    if (kind == MergeKind::Names) {
+        for (size_t i = 0; i < entries.size(); ++i) body += (i ? "," : "") + entries[i];
+        return DbReply{true, body};
+    }
+    if (kind == MergeKind::ById) {
+        std::sort(entries.begin(), entries.end(),
+                  [](const std::string& a, const std::string& b) { return entry_id(a) < entry_id(b); });
+        for (size_t i = 0; i < entries.size() && static_cast<int>(i) < limit; ++i) body += entries[i] + ";";
+        return DbReply{true, body};
+    }
+
+    if (kind == MergeKind::Buckets) {
+        // <bucket start>:<count> from each shard; the same bucket adds up
+        std::map<long long, unsigned long long> buckets;
+        for (auto const& e : entries) {
+            size_t colon = e.find(':');
+            try {
+                buckets[std::stoll(e.substr(0, colon))] += std::stoull(e.substr(colon + 1));
+            } catch (...) {}
+        }
+        for (auto const& [start, count] : buckets) body += std::to_string(start) + ":" + std::to_string(count) + ";";
+        return DbReply{true, body};
+    }
+
+    // Leaderboard entries are Rank:User:Wins:Games:Best; re-rank the union
+    using Entry = std::tuple<int, int, std::string, int>; // -wins, -best, user, games
+    std::vector<Entry> board;
+    for (auto const& e : entries) {
+        std::stringstream es(e);
+        std::string rank, user, wins, games, best;
+        std::getline(es, rank, ':');
+        std::getline(es, user, ':');
+        std::getline(es, wins, ':');
+        std::getline(es, games, ':');
+        std::getline(es, best, ':');
+        try {
+            board.emplace_back(-std::stoi(wins), -std::stoi(best), user, std::stoi(games));
+        } catch (...) {}
+    }
+    std::sort(board.begin(), board.end());
+    for (int i = after; i < static_cast<int>(board.size()) && i - after < limit; ++i) {
+        auto const& [wins, best, user, games] = board[i];
+        body += std::to_string(i + 1) + ":" + user + ":" + std::to_string(-wins) + ":" +
+                std::to_string(games) + ":" + std::to_string(-best) + ";";
+    }
+    return DbReply{true, body};
+}
+
+} // namespace
+
+bool ShardedDbClient::connect(const std::vector<std::pair<std::string, uint16_t>>& shards, size_t connections) {
+    close();
+    ring_ = ShardRing(shards.size());
+    for (auto const& [ip, port] : shards) {
+        auto client = std::make_unique<DbClient>(category_);
+        if (!client->connect(ip, port, connections)) {
+            close();
+            return false;
+        }
+        clients_.push_back(std::move(client));
+    }
+    return !clients_.empty();
+}
+
+bool ShardedDbClient::connect_replicas(const std::vector<std::pair<std::string, uint16_t>>& replicas,
+                                       size_t connections) {
+    replicas_.clear();
+    if (replicas.size() != clients_.size()) return false;
+    for (auto const& [ip, port] : replicas) {
+        auto client = std::make_unique<DbClient>(category_);
+        if (!client->connect(ip, port, connections)) {
+            replicas_.clear();
+            return false;
+        }
+        replicas_.push_back(std::move(client));
+    }
+    return true;
+}
+
+void ShardedDbClient::close() {
+    for (auto& client : clients_) client->close();
+    for (auto& client : replicas_) client->close();
+    clients_.clear();
+    replicas_.clear();
+}
+
+bool ShardedDbClient::connected() const {
+    if (clients_.empty()) return false;
+    for (auto const& client : clients_) {
+        if (!client->connected()) return false;
+    }
+    return true;
+}
+
+DbClient& ShardedDbClient::shard(size_t index, bool read) {
+    if (read && index < replicas_.size() && replicas_[index]->connected()) return *replicas_[index];
+    return *clients_[index];
+}
+
+bool ShardedDbClient::call(const std::string& cmd, std::string& reply, int timeout_ms, bool read) {
+    std::future<DbReply> future = submit(cmd, read);
+    // Merged requests are deferred: they run (with their own deadline) inside get()
+    if (future.wait_for(std::chrono::milliseconds(timeout_ms)) == std::future_status::timeout) {
+        log_checkpoint(category_, "DB_TIMEOUT", cmd);
+        return false;
+    }
+    DbReply r = future.get();
+    if (!r.ok) return false;
+    reply = std::move(r.body);
+    return true;
+}
+
+size_t ShardedDbClient::route(const std::string& cmd) const {
+    if (cmd.rfind("User ", 0) == 0) return ring_.user_shard(db_field(cmd, "username"));
+    if (cmd.rfind("Stats ", 0) == 0) return ring_.user_shard(db_field(cmd, "username"));
+    // New rooms live with their host; the room shard hands out an id it owns
+    if (cmd.rfind("Room create", 0) == 0) return ring_.user_shard(db_field(cmd, "host"));
+    if (cmd.rfind("GameLog replicate", 0) == 0) return ring_.user_shard(db_field(cmd, "user1"));
+    std::string room = db_field(cmd, "roomId");
+    if (!room.empty()) {
+        try { return ring_.room_shard(std::stoi(room)); } catch (...) {}
+    }
+    return 0; // unkeyed or malformed: any shard gives the same error
+}
+
+std::vector<std::future<DbReply>> ShardedDbClient::submit_all(const std::string& cmd, bool read) {
+    std::vector<std::future<DbReply>> futures;
+    futures.reserve(clients_.size());
+    for (size_t i = 0; i < clients_.size(); ++i) futures.push_back(shard(i, read).submit(cmd));
+    return futures;
+}
+
+std::future<DbReply> ShardedDbClient::submit(const std::string& cmd, bool read) {
+    if (clients_.empty()) return ready_reply(DbReply{});
+    if (clients_.size() == 1) return shard(0, read).submit(cmd);
+    if (cmd.rfind("Batch\n", 0) == 0) return submit_batch(cmd, read);
+    if (cmd.rfind("Atomic\n", 0) == 0) return submit_atomic(cmd);
+
+    std::istringstream iss(cmd);
+    std::string coll, action;
+    iss >> coll >> action;
+    if (coll == "GameLog" && action == "create") return submit_gamelog_create(cmd);
+    if (coll == "Stats" && action == "get") return submit_stats_get(cmd, read);
+
+    if (coll == "User" && action == "lease") {
+        // The lobby's users may live on any shard; the lease holds on all of them
+        auto futures = std::make_shared<std::vector<std::future<DbReply>>>(submit_all(cmd, read));
+        return std::async(std::launch::deferred, [futures]() {
+            Deadline deadline = merge_deadline();
+            int users = 0;
+            for (auto& f : *futures) {
+                DbReply r = wait_reply(f, deadline);
+                if (!r.ok || r.body.rfind("OK", 0) != 0) return r;
+                users += db_int_field(r.body, "users", 0);
+            }
+            return DbReply{true, "OK users=" + std::to_string(users)};
+        });
+    }
+    const int limit = db_int_field(cmd, "limit", INT_MAX);
+    if (coll == "User" && action == "listOnline") {
+        if (cmd.find(" since=") != std::string::npos) return submit_presence(cmd, read);
+        auto futures = std::make_shared<std::vector<std::future<DbReply>>>(submit_all(cmd, read));
+        return std::async(std::launch::deferred, [futures]() {
+            return merge_replies(*futures, MergeKind::Names, INT_MAX, 0);
+        });
+    }
+    if ((coll == "Room" && (action == "list" || action == "listInvites")) || (coll == "GameLog" && action == "list")) {
+        // Each shard returns its own first page past the cursor; the global page is a prefix of their union
+        auto futures = std::make_shared<std::vector<std::future<DbReply>>>(submit_all(cmd, read));
+        return std::async(std::launch::deferred, [futures, limit]() {
+            return merge_replies(*futures, MergeKind::ById, limit, 0);
+        });
+    }
+    if (coll == "GameLog" && action == "scores") {
+        auto futures = std::make_shared<std::vector<std::future<DbReply>>>(submit_all(cmd, read));
+        return std::async(std::launch::deferred, [futures]() {
+            return merge_replies(*futures, MergeKind::Buckets, INT_MAX, 0);
+        });
+    }
+    if (coll == "Stats" && action == "top") {
+        // Ranks are global, so every shard sends its top after+limit
+        const int after = std::max(0, db_int_field(cmd, "after", 0));
+        const int page = db_field(cmd, "limit").empty() ? 10 : limit;
+        const std::string per_shard = "Stats top limit=" + std::to_string(after + page) + " after=0";
+        auto futures = std::make_shared<std::vector<std::future<DbReply>>>(submit_all(per_shard, read));
+        return std::async(std::launch::deferred, [futures, page, after]() {
+            return merge_replies(*futures, MergeKind::Leaderboard, page, after);
+        });
+    }
+    return shard(route(cmd), read).submit(cmd);
+}
+
+std::future<DbReply> ShardedDbClient::submit_batch(const std::string& cmd, bool read) {
+    // Commands may live on different shards: send each on its own, in order
+    auto futures = std::make_shared<std::vector<std::future<DbReply>>>();
+    std::istringstream lines(cmd.substr(6));
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (!line.empty()) futures->push_back(submit(line, read));
+    }
+    return std::async(std::launch::deferred, [futures]() {
+        Deadline deadline = merge_deadline();
+        std::string body = "OK batch=" + std::to_string(futures->size());
+        for (auto& f : *futures) {
+            DbReply r = wait_reply(f, deadline);
+            if (!r.ok) return DbReply{};
+            body += "\n" + r.body;
+        }
+        return DbReply{true, body};
+    });
+}
+
+std::future<DbReply> ShardedDbClient::submit_gamelog_create(const std::string& cmd) {
+    // Step one stores the game on the room's shard, step two copies it
+    size_t room_shard = route(cmd);
+    auto created = std::make_shared<std::future<DbReply>>(clients_[room_shard]->submit(cmd));
+    return std::async(std::launch::deferred, [this, cmd, created, room_shard]() {
+        Deadline deadline = merge_deadline();
+        DbReply r = wait_reply(*created, deadline);
+        if (r.ok) replicate_gamelog(cmd, room_shard, r.body, deadline);
+        return r;
+    });
+}
+
+// Copies a game the room's shard stored (created is its reply) to every
+// player's shard that is a different one
+void ShardedDbClient::replicate_gamelog(const std::string& cmd, size_t room_shard, const std::string& created,
+                                        std::chrono::steady_clock::time_point deadline) {
+    if (created.rfind("OK gameId=", 0) != 0) return;
+    std::vector<size_t> targets;
+    for (const char* key : {"user1", "user2"}) {
+        size_t shard = ring_.user_shard(db_field(cmd, key));
+        if (shard != room_shard && std::find(targets.begin(), targets.end(), shard) == targets.end()) {
+            targets.push_back(shard);
+        }
+    }
+    if (targets.empty()) return;
+    std::string replicate = "GameLog replicate gameId=" + created.substr(10) + cmd.substr(std::string("GameLog create").size());
+    std::vector<std::future<DbReply>> copies;
+    for (size_t shard : targets) copies.push_back(clients_[shard]->submit(replicate));
+    for (auto& f : copies) {
+        DbReply c = wait_reply(f, deadline);
+        if (!c.ok || c.body.rfind("OK", 0) != 0) {
+            log_checkpoint(category_, "REPLICATE_FAIL", replicate + " reply=" + c.body);
+        }
+    }
+}
+
+std::future<DbReply> ShardedDbClient::submit_atomic(const std::string& cmd) {
+    // Only one shard can run a batch atomically
+    std::vector<std::string> lines;
+    std::istringstream in(cmd.substr(7));
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty()) lines.push_back(line);
+    }
+    const size_t room_shard = lines.empty() ? 0 : route(lines[0]);
+    for (auto const& l : lines) {
+        if (route(l) != room_shard) return ready_reply(DbReply{true, "ERR cross_shard"});
+    }
+    auto done = std::make_shared<std::future<DbReply>>(clients_[room_shard]->submit(cmd));
+    return std::async(std::launch::deferred, [this, lines, done, room_shard]() {
+        Deadline deadline = merge_deadline();
+        DbReply r = wait_reply(*done, deadline);
+        if (!r.ok || r.body.rfind("OK", 0) != 0) return r;
+        // Games it stored still go to the players' shards, as for GameLog create
+        std::vector<std::string> replies = db_split_batch_reply(r.body);
+        for (size_t i = 0; i < lines.size() && i < replies.size(); ++i) {
+            if (lines[i].rfind("GameLog create", 0) == 0) replicate_gamelog(lines[i], room_shard, replies[i], deadline);
+        }
+        return r;
+    });
+}
+
+// since= carries one token per shard, joined with '/'. Deltas from the shards
+// add up, but a full list from one shard says nothing about who went offline
+// on the others, so when any shard answers full, every shard is asked for its
+// full list.
+std::future<DbReply> ShardedDbClient::submit_presence(const std::string& cmd, bool read) {
+    std::vector<std::string> since;
+    std::stringstream ss(db_field(cmd, "since"));
+    for (std::string token; std::getline(ss, token, '/');) since.push_back(token);
+    since.resize(clients_.size());
+    auto futures = std::make_shared<std::vector<std::future<DbReply>>>();
+    for (size_t i = 0; i < clients_.size(); ++i) {
+        const std::string& token = since[i].empty() ? "0.0" : since[i];
+        futures->push_back(shard(i, read).submit("User listOnline since=" + token));
+    }
+    return std::async(std::launch::deferred, [this, futures, read]() {
+        Deadline deadline = merge_deadline();
+        std::vector<DbReply> parts;
+        bool any_full = false;
+        for (auto& f : *futures) {
+            DbReply r = wait_reply(f, deadline);
+            if (!r.ok || r.body.rfind("OK", 0) != 0) return r;
+            any_full = any_full || db_field(r.body, "full") == "1";
+            parts.push_back(std::move(r));
+        }
+        for (size_t i = 0; any_full && i < parts.size(); ++i) {
+            if (db_field(parts[i].body, "full") == "1") continue;
+            auto full = shard(i, read).submit("User listOnline since=0.0");
+            parts[i] = wait_reply(full, deadline);
+            if (!parts[i].ok || parts[i].body.rfind("OK", 0) != 0) return parts[i];
+        }
+        std::string tokens, names;
+        for (size_t i = 0; i < parts.size(); ++i) {
+            const std::string& body = parts[i].body;
+            tokens += (i ? "/" : "") + db_field(body, "presence");
+            size_t pos = body.find(" full=");
+            pos = pos == std::string::npos ? std::string::npos : body.find(' ', pos + 1);
+            if (pos == std::string::npos || pos + 1 >= body.size()) continue;
+            names += (names.empty() ? "" : ",") + body.substr(pos + 1);
+        }
+        return DbReply{true, "OK presence=" + tokens + " full=" + (any_full ? "1" : "0") + " " + names};
+    });
+}
+
+std::future<DbReply> ShardedDbClient::submit_stats_get(const std::string& cmd, bool read) {
+    auto own = std::make_shared<std::future<DbReply>>(shard(route(cmd), read).submit(cmd));
+    return std::async(std::launch::deferred, [this, own, read]() {
+        Deadline deadline = merge_deadline();
+        DbReply r = wait_reply(*own, deadline);
+        if (!r.ok || r.body.rfind("OK", 0) != 0) return r;
+        // The shard's rank only counts its own users; add up who is ahead everywhere
+        std::string ahead = "Stats ahead wins=" + db_field(r.body, "wins") + " best=" + db_field(r.body, "best") +
+                            " username=" + db_field(r.body, "username");
+        auto counts = submit_all(ahead, read);
+        long long rank = 1;
+        for (auto& f : counts) {
+            DbReply c = wait_reply(f, deadline);
+            if (!c.ok || c.body.rfind("OK", 0) != 0) return DbReply{};
+            rank += db_int_field(c.body, "ahead", 0);
+        }
+        r.body = db_with_field(r.body, "rank", std::to_string(rank));
+        return r;
+    });
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "db_shard.hpp"
+
+// Request ids in the DB protocol: a request may start with "#<id> " and the DB
+// echoes the same tag in front of its reply. Untagged requests keep working.
+inline std::string db_tag_request(uint64_t id, const std::string& cmd) {
+    return "#" + std::to_string(id) + " " + cmd;
+}
+
+// Splits "#<id> body" into its parts; false (and body == frame) when untagged
+inline bool db_split_tag(const std::string& frame, std::string& tag, std::string& body) {
+    if (frame.size() < 3 || frame[0] != '#') {
+        body = frame;
+        return false;
+    }
+    size_t space = frame.find(' ');
+    if (space == std::string::npos || space == 1) {
+        body = frame;
+        return false;
+    }
+    tag = frame.substr(1, space - 1);
+    body = frame.substr(space + 1);
+    return true;
+}
+
+// Batches: "Batch\n<cmd>\n<cmd>..." runs the commands in order in one round
+// trip and answers "OK batch=<n>\n<reply>\n<reply>...", one reply per command.
+inline std::string db_batch_request(const std::vector<std::string>& cmds) {
+    std::string out = "Batch";
+    for (auto const& cmd : cmds) out += "\n" + cmd;
+    return out;
+}
+
+// "Atomic\n<cmd>\n<cmd>..." is a batch that applies all of its commands or
+// none: the first failure undoes the rest and the reply is
+// "ERR aborted at=<i>\n<reply>..." up to the failed command.
+inline std::string db_atomic_request(const std::vector<std::string>& cmds) {
+    std::string out = "Atomic";
+    for (auto const& cmd : cmds) out += "\n" + cmd;
+    return out;
+}
+
+// The per-command replies of a batch reply (or an aborted atomic one); empty
+// if it is neither
+inline std::vector<std::string> db_split_batch_reply(const std::string& reply) {
+    std::vector<std::string> parts;
+    if (reply.rfind("OK batch=", 0) != 0 && reply.rfind("ERR aborted", 0) != 0) return parts;
+    size_t pos = reply.find('\n');
+    while (pos != std::string::npos) {
+        size_t next = reply.find('\n', pos + 1);
+        parts.push_back(reply.substr(pos + 1, next == std::string::npos ? std::string::npos : next - pos - 1));
+        pos = next;
+    }
+    return parts;
+}
+
+struct DbReply {
+    bool ok = false;
+    std::string body;
+};
+
+// Pipelined DB client: any number of threads submit requests over a few shared
+// connections without waiting for each other. Each request gets an id and a
+// promise; one reader thread per connection resolves promises as replies arrive.
+class DbClient {
+public:
+    explicit DbClient(std::string log_category = "DB-Client") : category_(std::move(log_category)) {}
+    ~DbClient();
+    DbClient(const DbClient&) = delete;
+    DbClient& operator=(const DbClient&) = delete;
+
+    bool connect(const std::string& ip, uint16_t port, size_t connections = 1);
+    void close();
+
+    // Sends cmd and returns at once; the future fails (ok == false) when the
+    // connection is lost before the reply
+    std::future<DbReply> submit(const std::string& cmd);
+    // submit() and wait at most timeout_ms for the reply
+    bool call(const std::string& cmd, std::string& reply, int timeout_ms = 5000);
+
+    // False once every connection is gone
+    bool connected() const;
+
+private:
+    struct Conn {
+        int fd = -1;
+        std::atomic<bool> alive{false};
+        std::mutex send_mutex;
+        std::mutex pending_mutex;
+        std::unordered_map<uint64_t, std::promise<DbReply>> pending;
+        std::thread reader;
+    };
+
+    void read_loop(Conn& conn);
+    static void fail_pending(Conn& conn);
+
+    std::string category_;
+    std::string peer_;
+    std::vector<std::unique_ptr<Conn>> conns_;
+    std::atomic<uint64_t> next_id_{1};
+    std::atomic<size_t> next_conn_{0};
+};
+
+// DB client for a sharded deployment (db_server --shard k/n, see db_shard.hpp).
+// Keyed requests go to the shard owning the user or room; Room list,
+// Room listInvites, User listOnline, GameLog list and Stats top ask every shard
+// and merge the pages; GameLog create is stored by the room's shard and then
+// replicated to each player's shard for their stats; User lease is renewed on
+// every shard; Stats get sums the per-shard "ahead" counts into a global rank;
+// "User listOnline since=" joins the shards' presence tokens with '/'. An
+// Atomic batch must stay on one shard (else "ERR cross_shard"). With one shard every request goes
+// straight to it.
+//
+// Shards may have a read replica (db_server --replica-of). submit_read() sends
+// the same requests to the replicas instead, where a shard has a connected
+// one; they trail their primary by a commit or so, so only reads that may be
+// a little stale belong there. A shard whose replica is gone is read from its
+// primary.
+class ShardedDbClient {
+public:
+    explicit ShardedDbClient(std::string log_category = "DB-Client") : category_(std::move(log_category)) {}
+    ShardedDbClient(const ShardedDbClient&) = delete;
+    ShardedDbClient& operator=(const ShardedDbClient&) = delete;
+
+    // One endpoint per shard, in shard order
+    bool connect(const std::vector<std::pair<std::string, uint16_t>>& shards, size_t connections = 1);
+    // One replica per shard, in shard order, after connect(); false if any is unreachable
+    bool connect_replicas(const std::vector<std::pair<std::string, uint16_t>>& replicas, size_t connections = 1);
+    void close();
+
+    std::future<DbReply> submit(const std::string& cmd) { return submit(cmd, false); }
+    bool call(const std::string& cmd, std::string& reply, int timeout_ms = 5000) {
+        return call(cmd, reply, timeout_ms, false);
+    }
+    // The same on the replicas, for reads that may lag a little
+    std::future<DbReply> submit_read(const std::string& cmd) { return submit(cmd, true); }
+    bool call_read(const std::string& cmd, std::string& reply, int timeout_ms = 5000) {
+        return call(cmd, reply, timeout_ms, true);
+    }
+
+    // False once any shard is gone: part of the data would be unreachable
+    bool connected() const;
+    size_t shards() const { return clients_.size(); }
+
+private:
+    std::future<DbReply> submit(const std::string& cmd, bool read);
+    bool call(const std::string& cmd, std::string& reply, int timeout_ms, bool read);
+    std::future<DbReply> submit_batch(const std::string& cmd, bool read);
+    std::future<DbReply> submit_gamelog_create(const std::string& cmd);
+    std::future<DbReply> submit_atomic(const std::string& cmd);
+    void replicate_gamelog(const std::string& cmd, size_t room_shard, const std::string& created,
+                           std::chrono::steady_clock::time_point deadline);
+    std::future<DbReply> submit_stats_get(const std::string& cmd, bool read);
+    std::future<DbReply> submit_presence(const std::string& cmd, bool read);
+    std::vector<std::future<DbReply>> submit_all(const std::string& cmd, bool read);
+    size_t route(const std::string& cmd) const;
+    // The shard's replica for reads while it is connected, else its primary
+    DbClient& shard(size_t index, bool read);
+
+    std::string category_;
+    ShardRing ring_;
+    std::vector<std::unique_ptr<DbClient>> clients_;
+    std::vector<std::unique_ptr<DbClient>> replicas_; // empty, or one per shard
+};
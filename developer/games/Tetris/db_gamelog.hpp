@@ -0,0 +1,466 @@
+#pragma once
+#include "db_wal.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// One finished game. Users are ids from db_server's name table (NameId).
+struct GameLogRec {
+    int id = 0;
+    int roomId = 0;
+    uint32_t user1 = 0, user2 = 0;
+    int score1 = 0, score2 = 0;
+};
+
+// Columns of a log, as bits: a scan or block decode fills only the fields of
+// the columns it is asked for and leaves the others as they were
+enum GameLogColumn : unsigned {
+    kLogId = 1u << 0,
+    kLogRoom = 1u << 1,
+    kLogUser1 = 1u << 2,
+    kLogUser2 = 1u << 3,
+    kLogScore1 = 1u << 4,
+    kLogScore2 = 1u << 5,
+};
+constexpr unsigned kLogUsers = kLogUser1 | kLogUser2;
+constexpr unsigned kLogScores = kLogScore1 | kLogScore2;
+constexpr unsigned kLogAll = 0x3F;
+constexpr int kLogColumns = 6;
+
+// Up to kBlockRows rows of one segment, decoded
+struct GameLogBlock {
+    static constexpr size_t kBlockRows = 1024;
+    size_t count = 0;
+    GameLogRec row[kBlockRows];
+};
+
+// A sealed run of game logs: an immutable file, mapped read-only, holding one
+// column after another. Integers are little endian.
+//   header: "TGLS" | u32 version | u32 rows | u32 crc32 of everything after the header |
+//           u32 users | u32 blocks | i32 first id | i32 last id | i32 min room | i32 max room
+//   block index: per block, per column: u32 offset into the column data | i32 base
+//   dictionary: per user, u32 len | name
+//   column data: for each column in GameLogColumn order, its blocks one after another
+// Every block of a column decodes on its own, so a query reads only the
+// columns it filters on and fetches the rest for the blocks that matched.
+//   id, room: zigzag varint of the step from the previous row, from base
+//   user1, user2: varint index into the dictionary
+//   score1, score2: zigzag varint
+class GameLogSegment {
+public:
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kHeaderSize = 40;
+
+    ~GameLogSegment() {
+        if (map_) ::munmap(const_cast<unsigned char*>(map_), size_);
+    }
+    GameLogSegment(const GameLogSegment&) = delete;
+    GameLogSegment& operator=(const GameLogSegment&) = delete;
+
+    // Writes rows to path (through a .tmp renamed over it, synced first);
+    // name_of(user id) gives the name each user id is stored under
+    template <typename NameOf>
+    static bool write(const std::string& path, const GameLogRec* rows, size_t n, NameOf&& name_of) {
+        std::unordered_map<uint32_t, uint32_t> local;
+        std::string dict;
+        auto user_index = [&](uint32_t user) {
+            auto [it, fresh] = local.emplace(user, static_cast<uint32_t>(local.size()));
+            if (fresh) {
+                std::string_view name = name_of(user);
+                put_u32(dict, static_cast<uint32_t>(name.size()));
+                dict += name;
+            }
+            return it->second;
+        };
+        const size_t blocks = (n + GameLogBlock::kBlockRows - 1) / GameLogBlock::kBlockRows;
+        std::string index, data;
+        index.reserve(blocks * kLogColumns * 8);
+        data.reserve(n * 8);
+        std::vector<std::pair<uint32_t, int32_t>> entries(blocks * kLogColumns);
+        int min_room = n ? rows[0].roomId : 0, max_room = min_room;
+        for (int c = 0; c < kLogColumns; ++c) {
+            for (size_t b = 0; b < blocks; ++b) {
+                const size_t begin = b * GameLogBlock::kBlockRows;
+                const size_t end = std::min(n, begin + GameLogBlock::kBlockRows);
+                const int32_t base = c == 0 ? rows[begin].id : c == 1 ? rows[begin].roomId : 0;
+                entries[b * kLogColumns + c] = {static_cast<uint32_t>(data.size()), base};
+                int32_t prev = base;
+                for (size_t i = begin; i < end; ++i) {
+                    const GameLogRec& g = rows[i];
+                    switch (c) {
+                    case 0: put_zigzag(data, int64_t{g.id} - prev); prev = g.id; break;
+                    case 1:
+                        put_zigzag(data, int64_t{g.roomId} - prev);
+                        prev = g.roomId;
+                        min_room = std::min(min_room, g.roomId);
+                        max_room = std::max(max_room, g.roomId);
+                        break;
+                    case 2: put_varint(data, user_index(g.user1)); break;
+                    case 3: put_varint(data, user_index(g.user2)); break;
+                    case 4: put_zigzag(data, g.score1); break;
+                    default: put_zigzag(data, g.score2); break;
+                    }
+                }
+            }
+        }
+        for (const auto& [offset, base] : entries) {
+            put_u32(index, offset);
+            put_u32(index, static_cast<uint32_t>(base));
+        }
+
+        std::string body;
+        put_u32(body, static_cast<uint32_t>(local.size()));
+        put_u32(body, static_cast<uint32_t>(blocks));
+        put_u32(body, static_cast<uint32_t>(n ? rows[0].id : 0));
+        put_u32(body, static_cast<uint32_t>(n ? rows[n - 1].id : 0));
+        put_u32(body, static_cast<uint32_t>(min_room));
+        put_u32(body, static_cast<uint32_t>(max_room));
+        body += index;
+        body += dict;
+        body += data;
+        std::string file("TGLS", 4);
+        put_u32(file, kVersion);
+        put_u32(file, static_cast<uint32_t>(n));
+        put_u32(file, WriteAheadLog::crc32(body));
+        file += body;
+
+        const std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        const char* p = file.data();
+        size_t left = file.size();
+        while (left > 0) {
+            ssize_t w = ::write(fd, p, left);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                ::close(fd);
+                ::unlink(tmp.c_str());
+                return false;
+            }
+            p += w;
+            left -= static_cast<size_t>(w);
+        }
+        const bool synced = ::fsync(fd) == 0;
+        ::close(fd);
+        if (!synced || ::rename(tmp.c_str(), path.c_str()) < 0) {
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Maps and checks path; intern(name) turns each stored name back into a
+    // user id. nullptr (with error set) if the file is missing or damaged.
+    template <typename Intern>
+    static std::unique_ptr<GameLogSegment> open(const std::string& path, Intern&& intern, std::string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = std::strerror(errno);
+            return nullptr;
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(kHeaderSize)) {
+            ::close(fd);
+            error = "short file";
+            return nullptr;
+        }
+        std::unique_ptr<GameLogSegment> seg(new GameLogSegment);
+        seg->size_ = static_cast<size_t>(st.st_size);
+        void* map = ::mmap(nullptr, seg->size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            error = std::strerror(errno);
+            return nullptr;
+        }
+        seg->map_ = static_cast<const unsigned char*>(map);
+        if (!seg->parse(intern, error)) return nullptr;
+        return seg;
+    }
+
+    size_t rows() const { return rows_; }
+    size_t blocks() const { return blocks_; }
+    int first_id() const { return first_id_; }
+    int last_id() const { return last_id_; }
+    int min_room() const { return min_room_; }
+    int max_room() const { return max_room_; }
+    // Whether any row names user, from the dictionary alone
+    bool has_user(uint32_t user) const { return std::binary_search(present_.begin(), present_.end(), user); }
+
+    // The first block that may hold an id above after (ids ascend)
+    size_t block_after(int after) const {
+        size_t lo = 0, hi = blocks_;
+        while (lo < hi) {
+            const size_t mid = (lo + hi) / 2;
+            if (base(mid, 0) <= after) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo == 0 ? 0 : lo - 1;
+    }
+
+    // Decodes the given columns of block b into out
+    void decode(size_t b, unsigned columns, GameLogBlock& out) const {
+        const size_t begin = b * GameLogBlock::kBlockRows;
+        out.count = std::min(GameLogBlock::kBlockRows, rows_ - begin);
+        for (int c = 0; c < kLogColumns; ++c) {
+            if (!(columns & (1u << c))) continue;
+            const unsigned char* p = data_ + offset(b, c);
+            const unsigned char* end = data_ + column_end(b, c);
+            int64_t prev = base(b, c);
+            for (size_t i = 0; i < out.count; ++i) {
+                GameLogRec& g = out.row[i];
+                switch (c) {
+                case 0: g.id = static_cast<int>(prev += get_zigzag(p, end)); break;
+                case 1: g.roomId = static_cast<int>(prev += get_zigzag(p, end)); break;
+                case 2: g.user1 = user(get_varint(p, end)); break;
+                case 3: g.user2 = user(get_varint(p, end)); break;
+                case 4: g.score1 = static_cast<int>(get_zigzag(p, end)); break;
+                default: g.score2 = static_cast<int>(get_zigzag(p, end)); break;
+                }
+            }
+        }
+    }
+
+private:
+    GameLogSegment() = default;
+
+    template <typename Intern>
+    bool parse(Intern&& intern, std::string& error) {
+        if (std::memcmp(map_, "TGLS", 4) != 0 || u32(map_ + 4) != kVersion) {
+            error = "not a game log segment";
+            return false;
+        }
+        if (WriteAheadLog::crc32(map_ + 16, size_ - 16) != u32(map_ + 12)) {
+            error = "checksum mismatch";
+            return false;
+        }
+        rows_ = u32(map_ + 8);
+        const uint32_t users = u32(map_ + 16);
+        blocks_ = u32(map_ + 20);
+        first_id_ = static_cast<int32_t>(u32(map_ + 24));
+        last_id_ = static_cast<int32_t>(u32(map_ + 28));
+        min_room_ = static_cast<int32_t>(u32(map_ + 32));
+        max_room_ = static_cast<int32_t>(u32(map_ + 36));
+        index_ = map_ + kHeaderSize;
+        const unsigned char* p = index_ + blocks_ * kLogColumns * 8;
+        const unsigned char* end = map_ + size_;
+        if (blocks_ != (rows_ + GameLogBlock::kBlockRows - 1) / GameLogBlock::kBlockRows || p > end) {
+            error = "bad block index";
+            return false;
+        }
+        users_.reserve(users);
+        for (uint32_t i = 0; i < users; ++i) {
+            if (end - p < 4 || static_cast<size_t>(end - p - 4) < u32(p)) {
+                error = "truncated dictionary";
+                return false;
+            }
+            const uint32_t len = u32(p);
+            users_.push_back(intern(std::string_view(reinterpret_cast<const char*>(p + 4), len)));
+            p += 4 + len;
+        }
+        present_ = users_;
+        std::sort(present_.begin(), present_.end());
+        data_ = p;
+        data_size_ = static_cast<size_t>(end - p);
+        for (size_t b = 0; b < blocks_; ++b) {
+            for (int c = 0; c < kLogColumns; ++c) {
+                if (offset(b, c) > data_size_) {
+                    error = "bad block index";
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static uint32_t u32(const unsigned char* p) {
+        return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+    }
+    static void put_u32(std::string& out, uint32_t v) {
+        const char b[4] = {char(v), char(v >> 8), char(v >> 16), char(v >> 24)};
+        out.append(b, 4);
+    }
+    static void put_varint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+    static void put_zigzag(std::string& out, int64_t v) {
+        put_varint(out, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+    }
+    // 0 past end: a damaged column reads as zeros rather than out of bounds
+    static uint64_t get_varint(const unsigned char*& p, const unsigned char* end) {
+        uint64_t v = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7) {
+            const unsigned char byte = *p++;
+            v |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        return v;
+    }
+    static int64_t get_zigzag(const unsigned char*& p, const unsigned char* end) {
+        const uint64_t v = get_varint(p, end);
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+
+    uint32_t offset(size_t b, int c) const { return u32(index_ + (b * kLogColumns + c) * 8); }
+    int32_t base(size_t b, int c) const { return static_cast<int32_t>(u32(index_ + (b * kLogColumns + c) * 8 + 4)); }
+    // Where block b of column c stops: the next block, else the next column
+    size_t column_end(size_t b, int c) const {
+        if (b + 1 < blocks_) return offset(b + 1, c);
+        return c + 1 < kLogColumns ? offset(0, c + 1) : data_size_;
+    }
+    uint32_t user(uint64_t local) const { return local < users_.size() ? users_[local] : 0; }
+
+    const unsigned char* map_ = nullptr;
+    size_t size_ = 0;
+    const unsigned char* index_ = nullptr;
+    const unsigned char* data_ = nullptr;
+    size_t data_size_ = 0;
+    size_t rows_ = 0;
+    size_t blocks_ = 0;
+    int first_id_ = 0, last_id_ = 0, min_room_ = 0, max_room_ = 0;
+    std::vector<uint32_t> users_;   // dictionary index -> user id
+    std::vector<uint32_t> present_; // the same ids, sorted, for has_user
+};
+
+// Every game log of a shard, in id order: sealed segments (numbered, one
+// file each under a directory beside the state file) and then the unsealed
+// tail in memory. Once the tail holds kSegmentRows rows, seal() moves them
+// into a new segment; the state file stores only the tail and the list of
+// segment numbers, so a checkpoint costs the same however many games there
+// are, and the segments themselves stay in the page cache, not the heap.
+class GameLogStore {
+public:
+    static constexpr size_t kSegmentRows = 64 * 1024;
+
+    size_t size() const { return sealed_rows_ + tail_.size(); }
+    size_t sealed_rows() const { return sealed_rows_; }
+    const std::vector<std::unique_ptr<GameLogSegment>>& segments() const { return segments_; }
+    const std::vector<uint32_t>& segment_numbers() const { return numbers_; }
+    const std::vector<GameLogRec>& tail() const { return tail_; }
+    // Row pos (counting sealed rows too), which must be in the tail
+    const GameLogRec& tail_at(size_t pos) const { return tail_[pos - sealed_rows_]; }
+
+    void push_back(const GameLogRec& g) { tail_.push_back(g); }
+    // Drops rows from rows on; sealed rows stay
+    void truncate(size_t rows) {
+        if (rows >= sealed_rows_ && rows < size()) tail_.resize(rows - sealed_rows_);
+    }
+    void clear() {
+        segments_.clear();
+        numbers_.clear();
+        tail_.clear();
+        sealed_rows_ = 0;
+    }
+
+    static std::string segment_path(const std::string& dir, uint32_t number) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%08u.tgl", number);
+        return dir + name;
+    }
+
+    // Maps the segments a state file listed, in order, and deletes any other
+    // segment file in dir (one sealed for a checkpoint that never finished)
+    template <typename Intern>
+    bool open(const std::string& dir, const std::vector<uint32_t>& numbers, Intern&& intern, std::string& error) {
+        clear();
+        for (uint32_t number : numbers) {
+            const std::string path = segment_path(dir, number);
+            std::unique_ptr<GameLogSegment> seg = GameLogSegment::open(path, intern, error);
+            if (!seg) {
+                error = path + ": " + error;
+                return false;
+            }
+            sealed_rows_ += seg->rows();
+            segments_.push_back(std::move(seg));
+            numbers_.push_back(number);
+        }
+        if (DIR* d = ::opendir(dir.c_str())) {
+            while (const dirent* e = ::readdir(d)) {
+                unsigned number = 0;
+                char tail[8] = {};
+                if (std::sscanf(e->d_name, "%8u.%7s", &number, tail) != 2) continue;
+                if (std::string_view(tail) == "tgl" &&
+                    std::find(numbers.begin(), numbers.end(), number) != numbers.end()) {
+                    continue;
+                }
+                ::unlink((dir + "/" + e->d_name).c_str());
+            }
+            ::closedir(d);
+        }
+        return true;
+    }
+
+    // Seals every whole kSegmentRows of the tail into new segment files under
+    // dir; the rows sealed (0 if there were too few, or a write failed and
+    // the rows stay in the tail)
+    template <typename NameOf, typename Intern>
+    size_t seal(const std::string& dir, NameOf&& name_of, Intern&& intern, std::string& error) {
+        size_t sealed = 0;
+        while (tail_.size() - sealed >= kSegmentRows) {
+            if (::mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+                error = dir + ": " + std::strerror(errno);
+                break;
+            }
+            const uint32_t number = numbers_.empty() ? 1 : numbers_.back() + 1;
+            const std::string path = segment_path(dir, number);
+            if (!GameLogSegment::write(path, tail_.data() + sealed, kSegmentRows, name_of)) {
+                error = path + ": " + std::strerror(errno);
+                break;
+            }
+            std::unique_ptr<GameLogSegment> seg = GameLogSegment::open(path, intern, error);
+            if (!seg) {
+                ::unlink(path.c_str());
+                break;
+            }
+            segments_.push_back(std::move(seg));
+            numbers_.push_back(number);
+            sealed += kSegmentRows;
+        }
+        tail_.erase(tail_.begin(), tail_.begin() + static_cast<std::ptrdiff_t>(sealed));
+        sealed_rows_ += sealed;
+        return sealed;
+    }
+
+    // fn(const GameLogRec&) for every row in order, sealed ones decoded a
+    // block at a time with only the given columns filled in
+    template <typename Fn>
+    void scan(unsigned columns, Fn&& fn) const {
+        auto block = std::make_unique<GameLogBlock>();
+        for (const auto& seg : segments_) {
+            for (size_t b = 0; b < seg->blocks(); ++b) {
+                seg->decode(b, columns, *block);
+                for (size_t i = 0; i < block->count; ++i) fn(block->row[i]);
+            }
+        }
+        for (const GameLogRec& g : tail_) fn(g);
+    }
+
+    // Every row, decoded in full
+    void materialize(std::vector<GameLogRec>& out) const {
+        out.reserve(out.size() + size());
+        scan(kLogAll, [&out](const GameLogRec& g) { out.push_back(g); });
+    }
+
+private:
+    std::vector<std::unique_ptr<GameLogSegment>> segments_;
+    std::vector<uint32_t> numbers_; // file number of each segment
+    std::vector<GameLogRec> tail_;
+    size_t sealed_rows_ = 0;
+};
@@ -1,62 +1,357 @@
-#include "common.hpp"
-#include "lp_framing.hpp"
+#include "../core/common.hpp"
+#include "../core/lp_framing.hpp"
+#include "db_client.hpp"
+#include "db_wal.hpp"
+#include "db_shard.hpp"
+#include "db_gamelog.hpp"
+#include "../core/metrics.hpp"
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <string>
 #include <sstream>
 #include <iostream>
 #include <poll.h>
 #include <unistd.h>
-#include <set> // For inviteList
+#include <set>
+#include <map>
+#include <deque>
 #include <fstream>
 #include <iomanip>
 #include <limits>
 #include <cstdlib>
 #include <cerrno>
 #include <cctype>
+#include <charconv>
+#include <cstring>
 #include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <optional>
+#include <random>
+#include <bit>
+#include <tuple>
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
 
 // --- Data Models ---
+// Rooms and logs name users by a 32-bit id from g_names (below), never by a
+// string of their own: a name is stored once however many rows mention it.
+using NameId = uint32_t;
+constexpr NameId kNoName = 0;                 // the empty name, e.g. a free seat
+constexpr NameId kUnknownName = UINT32_MAX;   // NameTable::find() for a name never interned
+
+// Every User and Room row carries a version: 1 when created, bumped by each
+// successful write to it. A write with if_version=<v> applies only while the
+// row is still at v (see Versions below), so writers need no lock between them.
 struct UserRec {
     std::string username;
     std::string pass;
     bool online = false;
+    uint64_t version = 0;
 };
 
+enum class RoomStatus : uint8_t { Idle, Playing };
+enum class RoomVisibility : uint8_t { Public, Private };
+constexpr size_t kRoomStatusCount = 2;
+
+// Invites and spectators: a handful per room, kept sorted by id
+using NameList = std::vector<NameId>;
+
 struct RoomRec {
     int id = 0;
+    NameId host = kNoName;
+    NameId p1 = kNoName;
+    NameId p2 = kNoName;
+    RoomVisibility visibility = RoomVisibility::Public;
+    RoomStatus status = RoomStatus::Idle;
     std::string name;
-    std::string host; // username of host
-    std::string visibility = "public"; // public | private
-    std::string status = "idle"; // idle | playing
-    std::string p1;
-    std::string p2;
     std::string token; // For game server auth
-    std::set<std::string> inviteList; // For private rooms
-    std::set<std::string> spectators; // Current spectators
+    NameList inviteList; // For private rooms
+    NameList spectators; // Current spectators
+    uint64_t version = 0;
+    // Last request naming the room; not saved, so a loaded room starts over
+    std::chrono::steady_clock::time_point last_active = std::chrono::steady_clock::now();
 };
 
-struct GameLogRec {
-    int id = 0;
-    int roomId = 0;
-    std::string user1, user2;
-    int score1 = 0, score2 = 0;
-};
+static const char* room_status_name(RoomStatus s) { return s == RoomStatus::Playing ? "playing" : "idle"; }
+static const char* room_visibility_name(RoomVisibility v) { return v == RoomVisibility::Private ? "private" : "public"; }
+
+static bool parse_room_status(std::string_view text, RoomStatus& out) {
+    if (text == "idle") out = RoomStatus::Idle;
+    else if (text == "playing") out = RoomStatus::Playing;
+    else return false;
+    return true;
+}
+
+static bool name_list_has(const NameList& list, NameId id) {
+    return std::binary_search(list.begin(), list.end(), id);
+}
+
+static void name_list_insert(NameList& list, NameId id) {
+    auto it = std::lower_bound(list.begin(), list.end(), id);
+    if (it == list.end() || *it != id) list.insert(it, id);
+}
+
+static bool name_list_erase(NameList& list, NameId id) {
+    auto it = std::lower_bound(list.begin(), list.end(), id);
+    if (it == list.end() || *it != id) return false;
+    list.erase(it);
+    return true;
+}
 
 // --- In-Memory Database ---
-static std::unordered_map<std::string, UserRec> g_users;
+// Transparent hash so string-keyed tables can be searched with a string_view
+struct StringViewHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+};
+using UserTable = std::unordered_map<std::string, UserRec, StringViewHash, std::equal_to<>>;
+
+// Append-only name <-> id table. There is no user delete, so an id, once
+// handed out, names the same user for the life of the process; ids are not
+// persisted (the state file stores names) and may differ after a restart.
+class NameTable {
+public:
+    NameTable() { names_.emplace_back(); } // kNoName
+
+    NameId intern(std::string_view name) {
+        if (name.empty()) return kNoName;
+        auto it = ids_.find(name);
+        if (it != ids_.end()) return it->second;
+        const std::string& stored = names_.emplace_back(name);
+        const NameId id = static_cast<NameId>(names_.size() - 1);
+        ids_.emplace(stored, id);
+        return id;
+    }
+    // kUnknownName for a name no row has used, which then matches no row
+    NameId find(std::string_view name) const {
+        if (name.empty()) return kNoName;
+        auto it = ids_.find(name);
+        return it == ids_.end() ? kUnknownName : it->second;
+    }
+    const std::string& name(NameId id) const { return names_[id]; }
+
+private:
+    std::deque<std::string> names_; // never moves an element, so ids_ may view them
+    std::unordered_map<std::string_view, NameId> ids_;
+};
+static NameTable g_names;
+
+static UserTable g_users;
 static std::unordered_map<int, RoomRec> g_rooms;
-static std::vector<GameLogRec> g_gamelogs; // **FIX: Correctly defined**
+static GameLogStore g_gamelogs; // this shard's games, see db_gamelog.hpp
 static int g_next_room_id = 1;
 static int g_next_game_id = 1;
+
+// Sharding (--shard k/N): this server owns the users and rooms the ring maps
+// to shard k and hands out only room and game ids that map there, so ids stay
+// unique across shards. Games from rooms on other shards are kept as replicas
+// (GameLog replicate), only to feed the stats of the users owned here.
+static ShardRing g_ring;
+static size_t g_shard = 0;
+static std::vector<GameLogRec> g_replica_logs;
+
+static bool owns_user(std::string_view username) {
+    return g_ring.shards() == 1 || g_ring.user_shard(username) == g_shard;
+}
+
+static bool owns_room(int room_id) {
+    return g_ring.shards() == 1 || g_ring.room_shard(room_id) == g_shard;
+}
+
+static int take_room_id() {
+    while (!owns_room(g_next_room_id)) ++g_next_room_id;
+    return g_next_room_id++;
+}
+
+static int take_game_id() {
+    while (g_ring.shards() > 1 && g_ring.game_shard(g_next_game_id) != g_shard) ++g_next_game_id;
+    return g_next_game_id++;
+}
+
+// Local logs and replicas together, as the state file stores them: the
+// unsealed tail only (the segments are listed, not copied), or with sealed
+// every log decoded, for a replica's snapshot or a text export
+static std::vector<GameLogRec> all_gamelogs(bool sealed) {
+    std::vector<GameLogRec> all;
+    all.reserve((sealed ? g_gamelogs.size() : g_gamelogs.tail().size()) + g_replica_logs.size());
+    if (sealed) g_gamelogs.materialize(all);
+    else all.insert(all.end(), g_gamelogs.tail().begin(), g_gamelogs.tail().end());
+    all.insert(all.end(), g_replica_logs.begin(), g_replica_logs.end());
+    return all;
+}
+
+// Sealed game log segments live in a directory beside the state file
+static std::string gamelog_dir(const std::string& state_file) {
+    return state_file + ".logs";
+}
+
+// Secondary indexes over the tables above. Every mutation below keeps them in
+// step and a state load rebuilds them, so list queries touch only the rows they
+// return. Sets are ordered by room id and position lists follow g_gamelogs
+// (ascending game id), which is what the after= cursors page over. The log
+// indexes cover the unsealed tail only: a sealed segment answers for itself
+// from its user dictionary and room range.
+static std::set<int> g_public_rooms;
+static std::set<int> g_public_rooms_by_status[kRoomStatusCount];
+static std::unordered_map<NameId, std::vector<size_t>> g_logs_by_user;
+static std::unordered_map<int, std::vector<size_t>> g_logs_by_room;
+
+// Per-user aggregates over the game logs, updated on every GameLog create
+struct UserStats {
+    int games = 0;
+    int wins = 0;
+    int losses = 0;
+    int draws = 0;
+    long long total_score = 0;
+    int best_score = 0;
+};
+
+// Leaderboard order: most wins, then best score, then name. The order-statistic
+// tree answers "rank of user" and "the k-th entry" in O(log n).
+using LeaderKey = std::tuple<int, int, std::string>; // -wins, -best, username
+using Leaderboard = __gnu_pbds::tree<LeaderKey, __gnu_pbds::null_type, std::less<LeaderKey>,
+                                     __gnu_pbds::rb_tree_tag, __gnu_pbds::tree_order_statistics_node_update>;
+
+static std::unordered_map<NameId, UserStats> g_user_stats;
+static Leaderboard g_leaderboard;
+
+// Who is online: one bit per NameId plus the last kLogSize changes, numbered
+// by version, so "User listOnline since=" costs what changed instead of a pass
+// over every user. A rebuild from the tables (startup, a replica's snapshot)
+// starts a new epoch; a token from another epoch, or older than the log
+// reaches, is answered with the full list.
+class PresenceIndex {
+public:
+    static constexpr uint64_t kLogSize = 64 * 1024;
+
+    PresenceIndex() : log_(kLogSize) { reset(); }
+
+    void reset() {
+        words_.clear();
+        version_ = 0;
+        epoch_ = std::random_device{}() | 1; // never 0, so "since=0.0" is always stale
+    }
+
+    void set(NameId id, bool online) {
+        const size_t w = id / 64;
+        const uint64_t bit = uint64_t{1} << (id % 64);
+        if (w >= words_.size()) {
+            if (!online) return;
+            words_.resize(w + 1, 0);
+        }
+        if (((words_[w] & bit) != 0) == online) return;
+        words_[w] ^= bit;
+        log_[++version_ % kLogSize] = Change{id, online};
+    }
+
+    bool online(NameId id) const {
+        const size_t w = id / 64;
+        return w < words_.size() && (words_[w] >> (id % 64) & 1) != 0;
+    }
+    uint32_t epoch() const { return epoch_; }
+    uint64_t version() const { return version_; }
+
+    // "+name,-name,..." for the changes after version since, oldest first;
+    // false if the log no longer goes back that far
+    bool changes_since(uint64_t since, std::string& out) const {
+        if (since > version_ || version_ - since > kLogSize) return false;
+        for (uint64_t v = since + 1; v <= version_; ++v) {
+            const Change& c = log_[v % kLogSize];
+            if (v > since + 1) out += ',';
+            out += c.online ? '+' : '-';
+            out += g_names.name(c.user);
+        }
+        return true;
+    }
+
+    // "a,b,c": every user online now
+    void list(std::string& out) const {
+        bool first = true;
+        for (size_t w = 0; w < words_.size(); ++w) {
+            for (uint64_t bits = words_[w]; bits; bits &= bits - 1) {
+                if (!first) out += ',';
+                out += g_names.name(static_cast<NameId>(w * 64 + std::countr_zero(bits)));
+                first = false;
+            }
+        }
+    }
+
+private:
+    struct Change {
+        NameId user = kNoName;
+        bool online = false;
+    };
+    std::vector<uint64_t> words_;
+    std::vector<Change> log_; // ring: version v is at v % kLogSize
+    uint64_t version_ = 0;
+    uint32_t epoch_ = 0;
+};
+static PresenceIndex g_presence;
+
+// Lobby leases: a lobby logs users in with "User compareSetOnline ... lease=<id>"
+// and renews <id> with "User lease" every few seconds. When it stops (crashed,
+// cut off from here) the idle sweep sets its users offline once the lease runs
+// out, so no row stays online for a lobby that is gone. Leases are kept in
+// memory only: a restarted server marks everyone offline anyway.
+struct LobbyLease {
+    std::chrono::steady_clock::time_point expires;
+    std::unordered_set<NameId> users;
+};
+static std::unordered_map<std::string, LobbyLease> g_leases;
+static std::unordered_map<NameId, std::string> g_lease_of; // user -> the lease holding them online
+constexpr auto kLeaseFirstTtl = std::chrono::seconds(30);  // a lease named by a login before its first renewal
+constexpr int kLeaseMaxTtlMs = 10 * 60 * 1000;
+
+static void lease_release(NameId user) {
+    auto it = g_lease_of.find(user);
+    if (it == g_lease_of.end()) return;
+    auto lit = g_leases.find(it->second);
+    if (lit != g_leases.end()) lit->second.users.erase(user);
+    g_lease_of.erase(it);
+}
+
+static void lease_hold(NameId user, std::string_view lease) {
+    lease_release(user);
+    auto [it, fresh] = g_leases.try_emplace(std::string(lease));
+    if (fresh) it->second.expires = std::chrono::steady_clock::now() + kLeaseFirstTtl;
+    it->second.users.insert(user);
+    g_lease_of.emplace(user, it->first);
+}
+
+// Every change of UserRec::online goes through here so g_presence follows it
+static void set_user_online(UserRec& u, bool online) {
+    u.online = online;
+    const NameId id = g_names.intern(u.username);
+    g_presence.set(id, online);
+    if (!online) lease_release(id);
+}
 // --- End Database ---
 
-static bool load_state(const std::string& path,
-                       std::unordered_map<std::string, UserRec>& users,
+// Durability: every applied mutation goes to the WAL and is synced once per
+// poll round before its reply leaves; a background checkpoint rewrites the
+// state file every so often so startup only replays the WAL tail.
+static WriteAheadLog g_wal;
+static bool g_replaying = false; // applying WAL records at startup, do not log them again
+static bool g_read_only = false; // a read replica (--replica-of): only the primary's WAL changes anything
+static bool g_in_atomic = false; // inside an Atomic batch, which is logged as one record
+constexpr const char* kWalResetOnline = "System resetOnline"; // startup marks everyone offline
+constexpr size_t kCheckpointRecords = 10000;
+constexpr auto kCheckpointInterval = std::chrono::seconds(60);
+
+// Legacy text state file (also what --export-text writes)
+static bool load_state_text(const std::string& path,
+                       UserTable& users,
                        std::unordered_map<int, RoomRec>& rooms,
                        std::vector<GameLogRec>& gamelogs,
                        int& next_room_id,
-                       int& next_game_id)
+                       int& next_game_id,
+                       uint64_t& lsn)
 {
     std::ifstream in(path);
     if (!in.is_open()) {
@@ -65,44 +360,62 @@ static bool load_state(const std::string& path,
     std::string line;
     int max_room = 0;
     int max_log = 0;
+    int saved_next_room = 0;
+    int saved_next_game = 0;
+    lsn = 0;
     while (std::getline(in, line)) {
         if (line.empty() || line[0] == '#') continue;
         std::istringstream iss(line);
         std::string tag;
         iss >> tag;
-        if (tag == "USER") {
+        if (tag == "LSN") {
+            iss >> lsn;
+        } else if (tag == "NEXT") {
+            iss >> saved_next_room >> saved_next_game;
+        } else if (tag == "USER") {
             UserRec u;
             int online = 0;
             if (iss >> std::quoted(u.username) >> std::quoted(u.pass) >> online) {
                 u.online = (online != 0);
+                iss >> u.version; // absent from older files
                 users[u.username] = u;
             }
         } else if (tag == "ROOM") {
             RoomRec r;
+            std::string host, visibility, status, p1, p2;
             size_t invite_count = 0;
             size_t spec_count = 0;
-            if (!(iss >> r.id >> std::quoted(r.name) >> std::quoted(r.host)
-                  >> std::quoted(r.visibility) >> std::quoted(r.status)
-                  >> std::quoted(r.p1) >> std::quoted(r.p2) >> std::quoted(r.token))) {
+            if (!(iss >> r.id >> std::quoted(r.name) >> std::quoted(host)
+                  >> std::quoted(visibility) >> std::quoted(status)
+                  >> std::quoted(p1) >> std::quoted(p2) >> std::quoted(r.token))) {
                 continue;
             }
+            r.host = g_names.intern(host);
+            r.p1 = g_names.intern(p1);
+            r.p2 = g_names.intern(p2);
+            r.visibility = visibility == "private" ? RoomVisibility::Private : RoomVisibility::Public;
+            parse_room_status(status, r.status);
             if (iss >> invite_count) {
                 for (size_t i = 0; i < invite_count; ++i) {
                     std::string val;
-                    if (iss >> std::quoted(val)) r.inviteList.insert(val);
+                    if (iss >> std::quoted(val)) name_list_insert(r.inviteList, g_names.intern(val));
                 }
             }
             if (iss >> spec_count) {
                 for (size_t i = 0; i < spec_count; ++i) {
                     std::string val;
-                    if (iss >> std::quoted(val)) r.spectators.insert(val);
+                    if (iss >> std::quoted(val)) name_list_insert(r.spectators, g_names.intern(val));
                 }
             }
+            iss >> r.version; // absent from older files
             rooms[r.id] = r;
             if (r.id > max_room) max_room = r.id;
         } else if (tag == "LOG") {
             GameLogRec g;
-            if (iss >> g.id >> g.roomId >> std::quoted(g.user1) >> std::quoted(g.user2) >> g.score1 >> g.score2) {
+            std::string user1, user2;
+            if (iss >> g.id >> g.roomId >> std::quoted(user1) >> std::quoted(user2) >> g.score1 >> g.score2) {
+                g.user1 = g_names.intern(user1);
+                g.user2 = g_names.intern(user2);
                 gamelogs.push_back(g);
                 if (g.id > max_log) max_log = g.id;
             }
@@ -110,53 +423,580 @@ static bool load_state(const std::string& path,
     }
     if (max_room >= g_next_room_id) next_room_id = max_room + 1;
     if (max_log >= g_next_game_id) next_game_id = max_log + 1;
+    // WAL replay must hand out the same ids as the original run did
+    next_room_id = std::max(next_room_id, saved_next_room);
+    next_game_id = std::max(next_game_id, saved_next_game);
     return true;
 }
 
-static void mark_all_users_offline(std::unordered_map<std::string, UserRec>& users) {
-    for (auto& kv : users) {
-        kv.second.online = false;
+static void mark_all_users_offline() {
+    for (auto& kv : g_users) {
+        if (!kv.second.online) continue;
+        set_user_online(kv.second, false);
+        ++kv.second.version;
     }
 }
 
-static bool save_state(const std::string& path,
-                       const std::unordered_map<std::string, UserRec>& users,
+static bool export_state_text(const std::string& path,
+                       const UserTable& users,
                        const std::unordered_map<int, RoomRec>& rooms,
-                       const std::vector<GameLogRec>& gamelogs)
+                       const std::vector<GameLogRec>& gamelogs,
+                       int next_room_id,
+                       int next_game_id,
+                       uint64_t lsn)
 {
-    std::ofstream out(path, std::ios::trunc);
+    // Written beside the old file and renamed over it, so a crash mid-write
+    // leaves the previous checkpoint intact
+    const std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::trunc);
     if (!out.is_open()) {
-        std::cerr << "[DB] failed to write state file: " << path << "\n";
+        std::cerr << "[DB] failed to write state file: " << tmp << "\n";
         return false;
     }
+    out << "LSN " << lsn << '\n';
+    out << "NEXT " << next_room_id << ' ' << next_game_id << '\n';
     for (const auto& kv : users) {
         const auto& u = kv.second;
         out << "USER " << std::quoted(u.username) << ' ' << std::quoted(u.pass)
-            << ' ' << (u.online ? 1 : 0) << '\n';
+            << ' ' << (u.online ? 1 : 0) << ' ' << u.version << '\n';
     }
     for (const auto& kv : rooms) {
         const auto& r = kv.second;
-        out << "ROOM " << r.id << ' ' << std::quoted(r.name) << ' ' << std::quoted(r.host)
-            << ' ' << std::quoted(r.visibility) << ' ' << std::quoted(r.status)
-            << ' ' << std::quoted(r.p1) << ' ' << std::quoted(r.p2) << ' ' << std::quoted(r.token);
+        out << "ROOM " << r.id << ' ' << std::quoted(r.name) << ' ' << std::quoted(g_names.name(r.host))
+            << ' ' << std::quoted(std::string(room_visibility_name(r.visibility)))
+            << ' ' << std::quoted(std::string(room_status_name(r.status)))
+            << ' ' << std::quoted(g_names.name(r.p1)) << ' ' << std::quoted(g_names.name(r.p2))
+            << ' ' << std::quoted(r.token);
         out << ' ' << r.inviteList.size();
-        for (const auto& inv : r.inviteList) {
-            out << ' ' << std::quoted(inv);
+        for (NameId inv : r.inviteList) {
+            out << ' ' << std::quoted(g_names.name(inv));
         }
         out << ' ' << r.spectators.size();
-        for (const auto& spec : r.spectators) {
-            out << ' ' << std::quoted(spec);
+        for (NameId spec : r.spectators) {
+            out << ' ' << std::quoted(g_names.name(spec));
         }
-        out << '\n';
+        out << ' ' << r.version << '\n';
     }
     for (const auto& g : gamelogs) {
         out << "LOG " << g.id << ' ' << g.roomId << ' '
-            << std::quoted(g.user1) << ' ' << std::quoted(g.user2) << ' '
+            << std::quoted(g_names.name(g.user1)) << ' ' << std::quoted(g_names.name(g.user2)) << ' '
             << g.score1 << ' ' << g.score2 << '\n';
     }
+    out.close();
+    if (!out) {
+        std::cerr << "[DB] failed to write state file: " << tmp << "\n";
+        return false;
+    }
+    int fd = ::open(tmp.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+    if (::rename(tmp.c_str(), path.c_str()) < 0) {
+        perror("[DB] state rename");
+        return false;
+    }
+    return true;
+}
+
+// Binary checkpoint, the normal state file format. Integers are little endian.
+//   header: "TDBS" | u32 version | u32 crc32 of everything after the header |
+//           u32 reserved | u64 lsn | i32 next_room_id | i32 next_game_id
+//   then sections, each u32 tag | u32 record count | u64 payload bytes | payload:
+//   'S' string table: u32 len | bytes, per string; records below refer to strings by index
+//   'U' users: u32 name | u32 pass | u8 online
+//   'R' rooms: i32 id | u32 name, host, visibility, status, p1, p2, token |
+//              u32 n | n x u32 invite | u32 n | n x u32 spectator
+//   'L' game logs: i32 id | i32 room | u32 user1 | u32 user2 | i32 score1 | i32 score2
+//   'G' sealed game log segments, the logs before those in 'L': u32 file number
+//   'u' user row versions, after 'U': u32 name | u64 version
+//   'r' room row versions, after 'R': i32 id | u64 version
+// Loading mmaps the file, checks the crc, and bulk-inserts into reserved maps.
+// Unknown sections are skipped, so a newer writer can add some (a file from
+// before 'u' and 'r' loads every row at version 0).
+constexpr char kStateMagic[4] = {'T', 'D', 'B', 'S'};
+constexpr uint32_t kStateVersion = 1;
+constexpr size_t kStatePrefixSize = 16; // magic, version, crc, reserved; the crc covers the rest
+constexpr uint32_t kSectionStrings = 'S';
+constexpr uint32_t kSectionUsers = 'U';
+constexpr uint32_t kSectionRooms = 'R';
+constexpr uint32_t kSectionLogs = 'L';
+constexpr uint32_t kSectionSegments = 'G';
+constexpr uint32_t kSectionUserVersions = 'u';
+constexpr uint32_t kSectionRoomVersions = 'r';
+
+struct StateEncoder {
+    std::string strings;
+    uint32_t string_count = 0;
+    std::unordered_map<std::string_view, uint32_t> string_ids;
+
+    static void put_u32(std::string& out, uint32_t v) {
+        for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+    static void put_u64(std::string& out, uint64_t v) {
+        for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+    static void put_i32(std::string& out, int32_t v) { put_u32(out, static_cast<uint32_t>(v)); }
+
+    std::vector<uint32_t> name_index; // by NameId, UINT32_MAX until first used
+
+    // Interns s (which must outlive the encoder) and returns its index
+    uint32_t intern(std::string_view s) {
+        auto it = string_ids.find(s);
+        if (it != string_ids.end()) return it->second;
+        put_u32(strings, static_cast<uint32_t>(s.size()));
+        strings += s;
+        string_ids.emplace(s, string_count);
+        return string_count++;
+    }
+
+    // The same for a g_names entry, without hashing it again
+    uint32_t name(NameId id) {
+        if (id >= name_index.size()) name_index.resize(id + 1, UINT32_MAX);
+        if (name_index[id] == UINT32_MAX) name_index[id] = intern(g_names.name(id));
+        return name_index[id];
+    }
+
+    static void put_section(std::string& out, uint32_t tag, uint32_t count, const std::string& payload) {
+        put_u32(out, tag);
+        put_u32(out, count);
+        put_u64(out, payload.size());
+        out += payload;
+    }
+};
+
+struct StateDecoder {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok = true;
+
+    bool need(size_t n) {
+        if (!ok || static_cast<size_t>(end - p) < n) ok = false;
+        return ok;
+    }
+    uint32_t u32() {
+        if (!need(4)) return 0;
+        uint32_t v = uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+        p += 4;
+        return v;
+    }
+    uint64_t u64() {
+        uint64_t lo = u32();
+        return lo | uint64_t(u32()) << 32;
+    }
+    int32_t i32() { return static_cast<int32_t>(u32()); }
+    uint8_t u8() {
+        if (!need(1)) return 0;
+        return *p++;
+    }
+};
+
+// The whole state file image, also what a replica is bootstrapped from
+static std::string encode_state(const UserTable& users,
+                                const std::unordered_map<int, RoomRec>& rooms,
+                                const std::vector<GameLogRec>& gamelogs,
+                                const std::vector<uint32_t>& segments,
+                                int next_room_id,
+                                int next_game_id,
+                                uint64_t lsn)
+{
+    StateEncoder enc;
+    std::string user_bytes, room_bytes, log_bytes, user_versions, room_versions;
+    user_bytes.reserve(users.size() * 9);
+    user_versions.reserve(users.size() * 12);
+    for (const auto& [name, u] : users) {
+        const uint32_t name_index = enc.intern(u.username);
+        StateEncoder::put_u32(user_bytes, name_index);
+        StateEncoder::put_u32(user_bytes, enc.intern(u.pass));
+        user_bytes.push_back(u.online ? 1 : 0);
+        StateEncoder::put_u32(user_versions, name_index);
+        StateEncoder::put_u64(user_versions, u.version);
+    }
+    room_versions.reserve(rooms.size() * 12);
+    for (const auto& [id, r] : rooms) {
+        StateEncoder::put_i32(room_versions, r.id);
+        StateEncoder::put_u64(room_versions, r.version);
+        StateEncoder::put_i32(room_bytes, r.id);
+        for (uint32_t f : {enc.intern(r.name), enc.name(r.host), enc.intern(room_visibility_name(r.visibility)),
+                           enc.intern(room_status_name(r.status)), enc.name(r.p1), enc.name(r.p2),
+                           enc.intern(r.token)}) {
+            StateEncoder::put_u32(room_bytes, f);
+        }
+        StateEncoder::put_u32(room_bytes, static_cast<uint32_t>(r.inviteList.size()));
+        for (NameId inv : r.inviteList) StateEncoder::put_u32(room_bytes, enc.name(inv));
+        StateEncoder::put_u32(room_bytes, static_cast<uint32_t>(r.spectators.size()));
+        for (NameId spec : r.spectators) StateEncoder::put_u32(room_bytes, enc.name(spec));
+    }
+    log_bytes.reserve(gamelogs.size() * 24);
+    for (const auto& g : gamelogs) {
+        StateEncoder::put_i32(log_bytes, g.id);
+        StateEncoder::put_i32(log_bytes, g.roomId);
+        StateEncoder::put_u32(log_bytes, enc.name(g.user1));
+        StateEncoder::put_u32(log_bytes, enc.name(g.user2));
+        StateEncoder::put_i32(log_bytes, g.score1);
+        StateEncoder::put_i32(log_bytes, g.score2);
+    }
+
+    std::string body;
+    body.reserve(enc.strings.size() + user_bytes.size() + room_bytes.size() + log_bytes.size() +
+                 user_versions.size() + room_versions.size() + 96);
+    StateEncoder::put_u64(body, lsn);
+    StateEncoder::put_i32(body, next_room_id);
+    StateEncoder::put_i32(body, next_game_id);
+    StateEncoder::put_section(body, kSectionStrings, enc.string_count, enc.strings);
+    StateEncoder::put_section(body, kSectionUsers, static_cast<uint32_t>(users.size()), user_bytes);
+    StateEncoder::put_section(body, kSectionUserVersions, static_cast<uint32_t>(users.size()), user_versions);
+    StateEncoder::put_section(body, kSectionRooms, static_cast<uint32_t>(rooms.size()), room_bytes);
+    StateEncoder::put_section(body, kSectionRoomVersions, static_cast<uint32_t>(rooms.size()), room_versions);
+    StateEncoder::put_section(body, kSectionLogs, static_cast<uint32_t>(gamelogs.size()), log_bytes);
+    if (!segments.empty()) {
+        std::string segment_bytes;
+        for (uint32_t number : segments) StateEncoder::put_u32(segment_bytes, number);
+        StateEncoder::put_section(body, kSectionSegments, static_cast<uint32_t>(segments.size()), segment_bytes);
+    }
+
+    // The crc covers lsn, counters and sections; it sits before them in the header
+    std::string file(kStateMagic, 4);
+    StateEncoder::put_u32(file, kStateVersion);
+    StateEncoder::put_u32(file, WriteAheadLog::crc32(body));
+    StateEncoder::put_u32(file, 0);
+    file += body;
+    return file;
+}
+
+static bool save_state(const std::string& path,
+                       const UserTable& users,
+                       const std::unordered_map<int, RoomRec>& rooms,
+                       const std::vector<GameLogRec>& gamelogs,
+                       const std::vector<uint32_t>& segments,
+                       int next_room_id,
+                       int next_game_id,
+                       uint64_t lsn)
+{
+    const std::string file = encode_state(users, rooms, gamelogs, segments, next_room_id, next_game_id, lsn);
+
+    // Written beside the old file and renamed over it, so a crash mid-write
+    // leaves the previous checkpoint intact
+    const std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "[DB] failed to write state file: " << tmp << "\n";
+        return false;
+    }
+    const char* p = file.data();
+    size_t left = file.size();
+    while (left > 0) {
+        ssize_t w = ::write(fd, p, left);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            perror("[DB] state write");
+            ::close(fd);
+            return false;
+        }
+        p += w;
+        left -= static_cast<size_t>(w);
+    }
+    ::fsync(fd);
+    ::close(fd);
+    if (::rename(tmp.c_str(), path.c_str()) < 0) {
+        perror("[DB] state rename");
+        return false;
+    }
+    return true;
+}
+
+static bool load_state_binary(const unsigned char* data, size_t size,
+                              UserTable& users,
+                              std::unordered_map<int, RoomRec>& rooms,
+                              std::vector<GameLogRec>& gamelogs,
+                              std::vector<uint32_t>& segments,
+                              int& next_room_id,
+                              int& next_game_id,
+                              uint64_t& lsn)
+{
+    StateDecoder hdr{data + 4, data + size};
+    uint32_t version = hdr.u32();
+    uint32_t crc = hdr.u32();
+    hdr.u32(); // reserved
+    if (!hdr.ok || version != kStateVersion) {
+        std::cerr << "[DB] unsupported state file version " << version << "\n";
+        return false;
+    }
+    if (WriteAheadLog::crc32(data + kStatePrefixSize, size - kStatePrefixSize) != crc) {
+        std::cerr << "[DB] state file checksum mismatch\n";
+        return false;
+    }
+
+    StateDecoder in{data + kStatePrefixSize, data + size};
+    lsn = in.u64();
+    int saved_next_room = in.i32();
+    int saved_next_game = in.i32();
+
+    std::vector<std::string_view> strings;
+    auto str = [&](uint32_t idx) -> std::string {
+        if (idx >= strings.size()) {
+            in.ok = false;
+            return std::string();
+        }
+        return std::string(strings[idx]);
+    };
+    auto name = [&](uint32_t idx) -> NameId {
+        if (idx >= strings.size()) {
+            in.ok = false;
+            return kNoName;
+        }
+        return g_names.intern(strings[idx]);
+    };
+    int max_room = 0;
+    int max_log = 0;
+    while (in.ok && in.p < in.end) {
+        uint32_t tag = in.u32();
+        uint32_t count = in.u32();
+        uint64_t bytes = in.u64();
+        if (!in.need(bytes)) break;
+        StateDecoder sec{in.p, in.p + bytes};
+        in.p += bytes;
+        if (tag == kSectionStrings) {
+            strings.reserve(count);
+            for (uint32_t i = 0; i < count && sec.ok; ++i) {
+                uint32_t len = sec.u32();
+                if (!sec.need(len)) break;
+                strings.emplace_back(reinterpret_cast<const char*>(sec.p), len);
+                sec.p += len;
+            }
+        } else if (tag == kSectionUsers) {
+            users.reserve(users.size() + count);
+            for (uint32_t i = 0; i < count && sec.ok; ++i) {
+                UserRec u;
+                u.username = str(sec.u32());
+                u.pass = str(sec.u32());
+                u.online = sec.u8() != 0;
+                std::string key = u.username;
+                users.emplace(std::move(key), std::move(u));
+            }
+        } else if (tag == kSectionRooms) {
+            rooms.reserve(rooms.size() + count);
+            for (uint32_t i = 0; i < count && sec.ok; ++i) {
+                RoomRec r;
+                r.id = sec.i32();
+                r.name = str(sec.u32());
+                r.host = name(sec.u32());
+                r.visibility = str(sec.u32()) == "private" ? RoomVisibility::Private : RoomVisibility::Public;
+                parse_room_status(str(sec.u32()), r.status);
+                r.p1 = name(sec.u32());
+                r.p2 = name(sec.u32());
+                r.token = str(sec.u32());
+                uint32_t n = sec.u32();
+                for (uint32_t k = 0; k < n && sec.ok; ++k) name_list_insert(r.inviteList, name(sec.u32()));
+                n = sec.u32();
+                for (uint32_t k = 0; k < n && sec.ok; ++k) name_list_insert(r.spectators, name(sec.u32()));
+                if (r.id > max_room) max_room = r.id;
+                rooms.emplace(r.id, std::move(r));
+            }
+        } else if (tag == kSectionLogs) {
+            gamelogs.reserve(gamelogs.size() + count);
+            for (uint32_t i = 0; i < count && sec.ok; ++i) {
+                GameLogRec g;
+                g.id = sec.i32();
+                g.roomId = sec.i32();
+                g.user1 = name(sec.u32());
+                g.user2 = name(sec.u32());
+                g.score1 = sec.i32();
+                g.score2 = sec.i32();
+                if (g.id > max_log) max_log = g.id;
+                gamelogs.push_back(std::move(g));
+            }
+        } else if (tag == kSectionSegments) {
+            for (uint32_t i = 0; i < count && sec.ok; ++i) segments.push_back(sec.u32());
+        } else if (tag == kSectionUserVersions) {
+            for (uint32_t i = 0; i < count && sec.ok; ++i) {
+                const uint32_t idx = sec.u32();
+                const uint64_t version = sec.u64();
+                if (idx >= strings.size()) {
+                    in.ok = false;
+                    break;
+                }
+                auto it = users.find(strings[idx]);
+                if (it != users.end()) it->second.version = version;
+            }
+        } else if (tag == kSectionRoomVersions) {
+            for (uint32_t i = 0; i < count && sec.ok; ++i) {
+                const int id = sec.i32();
+                const uint64_t version = sec.u64();
+                auto it = rooms.find(id);
+                if (it != rooms.end()) it->second.version = version;
+            }
+        }
+        if (!sec.ok) in.ok = false;
+    }
+    if (!in.ok) {
+        std::cerr << "[DB] state file is truncated or corrupt\n";
+        return false;
+    }
+    next_room_id = std::max({next_room_id, max_room + 1, saved_next_room});
+    next_game_id = std::max({next_game_id, max_log + 1, saved_next_game});
     return true;
 }
 
+// Loads the binary checkpoint through mmap, or a legacy text state file;
+// segments gets the sealed game log segments it lists
+static bool load_state(const std::string& path,
+                       UserTable& users,
+                       std::unordered_map<int, RoomRec>& rooms,
+                       std::vector<GameLogRec>& gamelogs,
+                       std::vector<uint32_t>& segments,
+                       int& next_room_id,
+                       int& next_game_id,
+                       uint64_t& lsn)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st{};
+    if (::fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(kStatePrefixSize + 16)) {
+        ::close(fd);
+        return load_state_text(path, users, rooms, gamelogs, next_room_id, next_game_id, lsn);
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        perror("[DB] mmap state");
+        return false;
+    }
+    ::madvise(map, size, MADV_SEQUENTIAL);
+    const auto* data = static_cast<const unsigned char*>(map);
+    bool ok;
+    if (std::memcmp(data, kStateMagic, 4) == 0) {
+        ok = load_state_binary(data, size, users, rooms, gamelogs, segments, next_room_id, next_game_id, lsn);
+    } else {
+        ok = load_state_text(path, users, rooms, gamelogs, next_room_id, next_game_id, lsn);
+    }
+    ::munmap(map, size);
+    return ok;
+}
+
+static void index_tail();
+
+// Checkpoints are written by a fork()ed child from its copy-on-write view of
+// the tables: the poll thread only pays for the fork (copying page tables),
+// not for copying or serializing the rows, and keeps serving while the child
+// writes. Pages the parent changes meanwhile are copied by the kernel as they
+// are touched. The child is reaped on the poll thread; once it reports
+// success the WAL segment the checkpoint covers is deleted.
+// Whole segments of game logs are sealed just before the fork, so the state
+// file the child writes lists them instead of carrying their rows. A segment
+// sealed for a checkpoint that then fails is listed again by the next one.
+class Checkpointer {
+public:
+    explicit Checkpointer(std::string state_file)
+        : state_file_(std::move(state_file)), old_wal_(state_file_ + ".wal.1"), log_dir_(gamelog_dir(state_file_)) {}
+    ~Checkpointer() { wait(); }
+
+    // Starts a checkpoint when enough has changed; poll thread only
+    void maybe_start(bool force = false) {
+        reap(false);
+        if (child_ > 0 || g_wal.records_since_checkpoint() == 0) return;
+        auto now = std::chrono::steady_clock::now();
+        if (!force && g_wal.records_since_checkpoint() < kCheckpointRecords &&
+            now - last_ < kCheckpointInterval) {
+            return;
+        }
+        last_ = now;
+        // An old segment still on disk belongs to a checkpoint that failed; it
+        // must survive until one succeeds, so keep appending to the current one
+        if (::access(old_wal_.c_str(), F_OK) != 0 && !g_wal.rotate(old_wal_)) {
+            log_checkpoint("DB", "WAL_ROTATE_FAIL", old_wal_);
+        }
+        seal_gamelogs();
+        g_wal.checkpoint_started();
+        const uint64_t lsn = g_wal.last_lsn();
+        pid_t pid;
+        {
+            MetricTimer timer(fork_pause_);
+            pid = ::fork();
+        }
+        if (pid == 0) {
+            // Only this thread exists in the child, so nothing here may take a
+            // lock another thread could have held (the async log)
+            bool ok = save_state(state_file_, g_users, g_rooms, all_gamelogs(false), g_gamelogs.segment_numbers(),
+                                 g_next_room_id, g_next_game_id, lsn);
+            ::_exit(ok ? 0 : 1);
+        }
+        if (pid < 0) {
+            perror("[DB] checkpoint fork");
+            log_checkpoint("DB", "CHECKPOINT_FAIL", "lsn=" + std::to_string(lsn) + " reason=fork");
+            return;
+        }
+        child_ = pid;
+        lsn_ = lsn;
+    }
+
+    // Blocks until the running checkpoint (if any) has finished
+    void wait() { reap(true); }
+
+    const std::string& old_wal() const { return old_wal_; }
+
+private:
+    void seal_gamelogs() {
+        if (g_gamelogs.tail().size() < GameLogStore::kSegmentRows) return;
+        MetricTimer timer(seal_);
+        std::string error;
+        const size_t rows = g_gamelogs.seal(
+            log_dir_, [](uint32_t user) -> std::string_view { return g_names.name(user); },
+            [](std::string_view name) { return g_names.intern(name); }, error);
+        if (rows == 0) {
+            log_checkpoint("DB", "GAMELOG_SEAL_FAIL", error);
+            return;
+        }
+        index_tail();
+        log_checkpoint("DB", "GAMELOG_SEALED",
+                       "rows=" + std::to_string(rows) + " segments=" + std::to_string(g_gamelogs.segments().size()));
+    }
+
+    void reap(bool block) {
+        if (child_ <= 0) return;
+        int status = 0;
+        pid_t r;
+        do {
+            r = ::waitpid(child_, &status, block ? 0 : WNOHANG);
+        } while (r < 0 && errno == EINTR);
+        if (r == 0) return; // still writing
+        const bool ok = r == child_ && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (ok) ::unlink(old_wal_.c_str());
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - last_);
+        log_checkpoint("DB", ok ? "CHECKPOINT_DONE" : "CHECKPOINT_FAIL",
+                       "lsn=" + std::to_string(lsn_) + " ms=" + std::to_string(ms.count()));
+        child_ = -1;
+    }
+
+    std::string state_file_;
+    std::string old_wal_;
+    std::string log_dir_;
+    pid_t child_ = -1; // the checkpoint being written
+    uint64_t lsn_ = 0; // ... and the last record it covers
+    std::chrono::steady_clock::time_point last_ = std::chrono::steady_clock::now();
+    LatencyHistogram& fork_pause_ =
+        metrics().histogram("db_checkpoint_fork_seconds", "Poll thread pause to fork a checkpoint writer");
+    LatencyHistogram& seal_ =
+        metrics().histogram("db_gamelog_seal_seconds", "Poll thread pause to seal game log segments");
+};
+
+static std::string db_peer(int fd) {
+    return "client fd=" + std::to_string(fd);
+}
+
+// Replies are queued per client and flushed without blocking; a client that
+// stops reading only grows its own queue (and is dropped past the hard limit).
+// Queued replies leave only after the WAL commit that covers them.
+static std::unordered_map<int, FrameWriter> g_writers;
+
+static bool db_send_frame(int fd, const std::string& body) {
+    log_communication_lazy("DB", "TX", [&] { return db_peer(fd); }, body);
+    LpFrame frame = lp_prepare_frame(body);
+    if (!frame) return false;
+    return g_writers[fd].enqueue(frame) != FrameWriter::EnqueueResult::Overflow;
+}
+
 // Helper to find a room
 RoomRec* find_room(int rid) {
     auto it = g_rooms.find(rid);
@@ -164,429 +1004,1671 @@ RoomRec* find_room(int rid) {
     return &it->second;
 }
 
-// Helper to parse key-value pairs
-std::unordered_map<std::string, std::string> parse_kv(std::istringstream& iss) {
-    std::unordered_map<std::string, std::string> kv_map;
-    std::string kv;
-    while (iss >> kv) {
-        auto pos = kv.find('=');
-        if (pos == std::string::npos) continue;
-        kv_map[kv.substr(0, pos)] = kv.substr(pos + 1);
-    }
-    return kv_map;
-}
-
-bool parse_int_field(const std::unordered_map<std::string, std::string>& kv_map,
-                     const std::string& key,
-                     int& value,
-                     bool allow_negative = false) {
-    auto it = kv_map.find(key);
-    if (it == kv_map.end() || it->second.empty()) return false;
-    const std::string& text = it->second;
-    char* end = nullptr;
-    errno = 0;
-    long parsed = std::strtol(text.c_str(), &end, 10);
-    if (errno != 0 || end == text.c_str() || *end != '\0') return false;
-    if (!allow_negative && parsed < 0) return false;
-    if (parsed > std::numeric_limits<int>::max()) return false;
-    value = static_cast<int>(parsed);
-    return true;
+static void index_room(const RoomRec& r) {
+    if (r.visibility != RoomVisibility::Public) return;
+    g_public_rooms.insert(r.id);
+    g_public_rooms_by_status[static_cast<size_t>(r.status)].insert(r.id);
 }
 
-static std::string db_peer(int fd) {
-    return "client fd=" + std::to_string(fd);
+static void unindex_room(const RoomRec& r) {
+    if (r.visibility != RoomVisibility::Public) return;
+    g_public_rooms.erase(r.id);
+    g_public_rooms_by_status[static_cast<size_t>(r.status)].erase(r.id);
 }
 
-static bool db_send_frame(int fd, const std::string& body) {
-    log_communication("DB", "TX", db_peer(fd), body);
-    return lp_send_frame(fd, body);
+// All status changes go through here so the by-status index stays right
+static void set_room_status(RoomRec& r, RoomStatus status) {
+    if (r.status == status) return;
+    unindex_room(r);
+    r.status = status;
+    index_room(r);
+}
+
+static LeaderKey leader_key(NameId user, const UserStats& st) {
+    return LeaderKey{-st.wins, -st.best_score, g_names.name(user)};
+}
+
+static void record_game_stats(NameId user, int score, int opponent_score) {
+    if (!owns_user(g_names.name(user))) return; // counted by the user's own shard
+    UserStats& st = g_user_stats[user];
+    if (st.games > 0) g_leaderboard.erase(leader_key(user, st));
+    ++st.games;
+    if (score > opponent_score) ++st.wins;
+    else if (score < opponent_score) ++st.losses;
+    else ++st.draws;
+    st.total_score += score;
+    st.best_score = std::max(st.best_score, score);
+    g_leaderboard.insert(leader_key(user, st));
 }
 
-static bool db_recv_frame(int fd, std::string& out) {
-    bool ok = lp_recv_frame(fd, out);
-    if (ok) {
-        log_communication("DB", "RX", db_peer(fd), out);
+static void record_game(const GameLogRec& g) {
+    record_game_stats(g.user1, g.score1, g.score2);
+    if (g.user2 != g.user1) record_game_stats(g.user2, g.score2, g.score1);
+}
+
+static void index_gamelog(size_t pos) {
+    const GameLogRec& g = g_gamelogs.tail_at(pos);
+    g_logs_by_user[g.user1].push_back(pos);
+    if (g.user2 != g.user1) g_logs_by_user[g.user2].push_back(pos);
+    g_logs_by_room[g.roomId].push_back(pos);
+}
+
+// After a load or a seal: the log indexes again cover exactly the tail
+static void index_tail() {
+    g_logs_by_user.clear();
+    g_logs_by_room.clear();
+    for (size_t pos = g_gamelogs.sealed_rows(); pos < g_gamelogs.size(); ++pos) index_gamelog(pos);
+}
+
+static void rebuild_indexes() {
+    g_public_rooms.clear();
+    for (auto& ids : g_public_rooms_by_status) ids.clear();
+    g_user_stats.clear();
+    g_leaderboard.clear();
+    g_presence.reset();
+    for (auto const& [name, u] : g_users) {
+        if (u.online) g_presence.set(g_names.intern(name), true);
     }
-    return ok;
+    for (auto const& [id, r] : g_rooms) index_room(r);
+    // the stats need only the user and score columns of the sealed logs
+    g_gamelogs.scan(kLogUsers | kLogScores, [](const GameLogRec& g) { record_game(g); });
+    index_tail();
+    for (auto const& g : g_replica_logs) record_game(g);
 }
 
-int main(int argc, char** argv) {
-    install_signal_handlers();
+// The state file keeps replicas with the local logs; split them again by room
+// owner, the local ones going after the sealed segments
+static void split_replica_logs(std::vector<GameLogRec>& loaded) {
+    auto replicas = std::stable_partition(loaded.begin(), loaded.end(),
+                                          [](const GameLogRec& g) { return owns_room(g.roomId); });
+    g_replica_logs.assign(std::make_move_iterator(replicas), std::make_move_iterator(loaded.end()));
+    loaded.erase(replicas, loaded.end());
+    for (const GameLogRec& g : loaded) g_gamelogs.push_back(g);
+}
 
-    std::string ip = "0.0.0.0";
-    uint16_t port = 12977;
-    std::string state_file = "db_state.txt";
+// "<Collection> <action> key=value..." split in place: every field is a view
+// into the request, nothing is copied or allocated. A repeated key keeps its
+// last value, as before.
+struct DbArgs {
+    static constexpr int kMaxArgs = 16;
+    std::string_view coll;
+    std::string_view action;
+    std::pair<std::string_view, std::string_view> kv[kMaxArgs];
+    int count = 0;
 
-    // allow overrides but default is zero-config
-    if (argc >= 2) ip = argv[1];
-    if (argc >= 3) port = static_cast<uint16_t>(std::stoi(argv[2]));
-    if (argc >= 4) state_file = argv[3];
+    explicit DbArgs(std::string_view req) {
+        size_t pos = 0;
+        auto next_token = [&]() -> std::string_view {
+            while (pos < req.size() && std::isspace(static_cast<unsigned char>(req[pos]))) ++pos;
+            size_t start = pos;
+            while (pos < req.size() && !std::isspace(static_cast<unsigned char>(req[pos]))) ++pos;
+            return req.substr(start, pos - start);
+        };
+        coll = next_token();
+        action = next_token();
+        for (std::string_view tok = next_token(); !tok.empty(); tok = next_token()) {
+            size_t eq = tok.find('=');
+            if (eq == std::string_view::npos || count == kMaxArgs) continue;
+            kv[count++] = {tok.substr(0, eq), tok.substr(eq + 1)};
+        }
+    }
 
-    int listen_fd = start_tcp_server(ip.c_str(), port);
-    if (listen_fd < 0) return 1;
-    std::cerr << "[DB] listening on " << ip << ":" << port << "\n";
-    log_checkpoint("DB", "LISTENING", ip + ":" + std::to_string(port));
+    // Empty when missing
+    std::string_view get(std::string_view key) const {
+        for (int i = count - 1; i >= 0; --i) {
+            if (kv[i].first == key) return kv[i].second;
+        }
+        return {};
+    }
 
-    bool loaded = load_state(state_file, g_users, g_rooms, g_gamelogs, g_next_room_id, g_next_game_id);
-    if (loaded) {
-        mark_all_users_offline(g_users);
-        log_checkpoint("DB", "STATE_LOADED",
-                       "users=" + std::to_string(g_users.size()) +
-                       " rooms=" + std::to_string(g_rooms.size()) +
-                       " logs=" + std::to_string(g_gamelogs.size()));
-    } else {
-        log_checkpoint("DB", "STATE_NEW", state_file);
+    bool has(std::string_view key) const {
+        for (int i = 0; i < count; ++i) {
+            if (kv[i].first == key) return true;
+        }
+        return false;
     }
 
-    std::vector<pollfd> pfds;
-    pfds.push_back({listen_fd, POLLIN, 0});
+    bool get_int(std::string_view key, int& value, bool allow_negative = false) const {
+        std::string_view text = get(key);
+        if (text.empty()) return false;
+        long parsed = 0;
+        auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), parsed);
+        if (ec != std::errc() || end != text.data() + text.size()) return false;
+        if (!allow_negative && parsed < 0) return false;
+        if (parsed > std::numeric_limits<int>::max()) return false;
+        value = static_cast<int>(parsed);
+        return true;
+    }
+};
 
-    while (running) {
-        int rc = ::poll(pfds.data(), pfds.size(), 500);
-        if (rc < 0) {
-            if (errno == EINTR) continue;
-            perror("poll");
-            break;
+// --- User Collection ---
+static void db_user_create(const DbArgs& args, std::ostringstream& resp) {
+    std::string uname(args.get("username"));
+    if (uname.empty()) resp << "ERR missing_username";
+    else if (g_users.count(uname)) resp << "ERR exists";
+    else {
+        g_users[uname] = UserRec{uname, std::string(args.get("pass")), false};
+        resp << "OK user=" << uname;
+    }
+}
+
+static void db_user_read(const DbArgs& args, std::ostringstream& resp) {
+    auto it = g_users.find(args.get("username"));
+    if (it != g_users.end()) {
+        auto &u = it->second;
+        resp << "OK username=" << u.username << " pass=" << u.pass << " online=" << (u.online ? "1" : "0")
+             << " version=" << u.version;
+    } else {
+        resp << "ERR not_found";
+    }
+}
+
+static void db_user_compare_set_online(const DbArgs& args, std::ostringstream& resp) {
+    std::string_view uname = args.get("username");
+    int expect = 0;
+    int value = 0;
+    if (uname.empty()) {
+        resp << "ERR missing_username";
+    } else if (!args.get_int("expect", expect) || (expect != 0 && expect != 1)) {
+        resp << "ERR invalid_expect";
+    } else if (!args.get_int("value", value) || (value != 0 && value != 1)) {
+        resp << "ERR invalid_value";
+    } else {
+        auto uit = g_users.find(uname);
+        if (uit == g_users.end()) {
+            resp << "ERR not_found";
+        } else if (uit->second.online != (expect != 0)) {
+            resp << "ERR mismatch";
+        } else {
+            set_user_online(uit->second, value != 0);
+            if (value != 0 && args.has("lease")) lease_hold(g_names.intern(uname), args.get("lease"));
+            resp << "OK";
         }
-        if (rc == 0) continue;
+    }
+}
 
-        for (size_t i = 0; i < pfds.size(); ++i) {
-            if (!(pfds[i].revents & POLLIN)) continue;
-            if (pfds[i].fd == listen_fd) {
-                int cfd = ::accept(listen_fd, nullptr, nullptr);
-                if (cfd >= 0) {
-                    pfds.push_back({cfd, POLLIN, 0});
-                    log_checkpoint("DB", "CLIENT_CONNECTED", "fd=" + std::to_string(cfd));
-                }
-            } else {
-                int cfd = pfds[i].fd;
-                std::string req;
-                if (!db_recv_frame(cfd, req)) {
-                    ::close(cfd);
-                    pfds.erase(pfds.begin() + i);
-                    --i;
-                    log_checkpoint("DB", "CLIENT_DISCONNECTED", "fd=" + std::to_string(cfd));
-                    continue;
-                }
+static void db_user_set_online(const DbArgs& args, std::ostringstream& resp) {
+    auto it = g_users.find(args.get("username"));
+    if (it == g_users.end()) resp << "ERR not_found";
+    else {
+        const bool online = args.get("online") == "1";
+        set_user_online(it->second, online);
+        if (online && args.has("lease")) lease_hold(g_names.intern(it->first), args.get("lease"));
+        resp << "OK";
+    }
+}
 
-                std::istringstream iss(req);
-                std::string coll, action;
-                iss >> coll >> action;
-                auto kv_map = parse_kv(iss);
-                std::ostringstream resp;
-
-                // --- User Collection ---
-                if (coll == "User" && action == "create") {
-                    auto& uname = kv_map["username"];
-                    if (uname.empty()) resp << "ERR missing_username";
-                    else if (g_users.count(uname)) resp << "ERR exists";
-                    else {
-                        g_users[uname] = UserRec{uname, kv_map["pass"], false};
-                        resp << "OK user=" << uname;
-                    }
-                }
-                else if (coll == "User" && action == "read") {
-                    auto& uname = kv_map["username"];
-                    if (g_users.count(uname)) {
-                        auto &u = g_users[uname];
-                        resp << "OK username=" << u.username << " pass=" << u.pass << " online=" << (u.online ? "1" : "0");
-                    } else {
-                        resp << "ERR not_found";
-                    }
-                }
-                else if (coll == "User" && action == "compareSetOnline") {
-                    auto uname_it = kv_map.find("username");
-                    int expect = 0;
-                    int value = 0;
-                    if (uname_it == kv_map.end() || uname_it->second.empty()) {
-                        resp << "ERR missing_username";
-                    } else if (!parse_int_field(kv_map, "expect", expect) || (expect != 0 && expect != 1)) {
-                        resp << "ERR invalid_expect";
-                    } else if (!parse_int_field(kv_map, "value", value) || (value != 0 && value != 1)) {
-                        resp << "ERR invalid_value";
-                    } else {
-                        const std::string& uname = uname_it->second;
-                        auto uit = g_users.find(uname);
-                        if (uit == g_users.end()) {
-                            resp << "ERR not_found";
-                        } else if (uit->second.online != (expect != 0)) {
-                            resp << "ERR mismatch";
-                        } else {
-                            uit->second.online = (value != 0);
-                            resp << "OK";
-                        }
-                    }
-                }
-                else if (coll == "User" && action == "setOnline") {
-                    auto& uname = kv_map["username"];
-                    if (!g_users.count(uname)) resp << "ERR not_found";
-                    else {
-                        g_users[uname].online = (kv_map["online"] == "1");
+// "User lease lease=<id> ttl=<ms>": the lobby behind <id> vouches for the
+// users it logged in for ttl more; answers how many it holds online here
+static void db_user_lease(const DbArgs& args, std::ostringstream& resp) {
+    std::string_view lease = args.get("lease");
+    int ttl = 0;
+    if (lease.empty()) {
+        resp << "ERR missing_lease";
+    } else if (!args.get_int("ttl", ttl) || ttl <= 0 || ttl > kLeaseMaxTtlMs) {
+        resp << "ERR invalid_ttl";
+    } else {
+        LobbyLease& l = g_leases[std::string(lease)];
+        l.expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(ttl);
+        resp << "OK users=" << l.users.size();
+    }
+}
+
+// "User listOnline" lists everyone online. With since=<token> from an earlier
+// reply it answers "OK presence=<token> full=0 +a,-b,..." with the changes
+// since then, or "OK presence=<token> full=1 a,b,..." when it cannot (first
+// call, restarted server, token too old); the token is <epoch>.<version>.
+static void db_user_list_online(const DbArgs& args, std::ostringstream& resp) {
+    std::string body;
+    if (!args.has("since")) {
+        g_presence.list(body);
+        resp << "OK " << body;
+        return;
+    }
+    std::string_view since = args.get("since");
+    const size_t dot = since.find('.');
+    uint32_t epoch = 0;
+    uint64_t version = 0;
+    bool delta = dot != std::string_view::npos &&
+                 std::from_chars(since.data(), since.data() + dot, epoch).ec == std::errc() &&
+                 std::from_chars(since.data() + dot + 1, since.data() + since.size(), version).ec == std::errc() &&
+                 epoch == g_presence.epoch() && g_presence.changes_since(version, body);
+    if (!delta) {
+        body.clear();
+        g_presence.list(body);
+    }
+    resp << "OK presence=" << g_presence.epoch() << "." << g_presence.version() << " full=" << (delta ? 0 : 1)
+         << " " << body;
+}
+
+// --- Room Collection (Revised) ---
+// Optional p2=, status=playing and token= create a room that is already
+// seated and started, so a whole tournament round is one batch
+static void db_room_create(const DbArgs& args, std::ostringstream& resp) {
+    std::string_view p2 = args.get("p2");
+    if (!p2.empty() && p2 == args.get("host")) {
+        resp << "ERR already_in_room";
+        return;
+    }
+    RoomRec r;
+    r.id = take_room_id();
+    r.name = args.get("name");
+    r.host = g_names.intern(args.get("host"));
+    r.p1 = r.host; // Host is P1
+    if (!p2.empty()) r.p2 = g_names.intern(p2);
+    std::string vis(args.get("visibility"));
+    std::transform(vis.begin(), vis.end(), vis.begin(), [](unsigned char c){ return static_cast<char>(std::tolower(c)); });
+    r.visibility = vis == "private" ? RoomVisibility::Private : RoomVisibility::Public;
+    r.status = args.get("status") == "playing" ? RoomStatus::Playing : RoomStatus::Idle;
+    r.token = args.get("token");
+    r.version = 1;
+    index_room(g_rooms[r.id] = std::move(r));
+    resp << "OK roomId=" << r.id;
+}
+
+static void db_room_join(const DbArgs& args, std::ostringstream& resp) { // **FIX: Enforce rules**
+    int rid = 0;
+    std::string_view user_name = args.get("user");
+    if (!args.get_int("roomId", rid)) {
+        resp << "ERR invalid_roomId";
+    } else if (user_name.empty()) {
+        resp << "ERR missing_user";
+    } else {
+        RoomRec* r = find_room(rid);
+        const NameId user = g_names.find(user_name);
+        if (!r) resp << "ERR not_found";
+        else if (r->status != RoomStatus::Idle) resp << "ERR playing";
+        else if (r->p2 != kNoName) resp << "ERR full";
+        else if (r->p1 == user || r->p2 == user) resp << "ERR already_in_room";
+        else if (r->visibility == RoomVisibility::Public || name_list_has(r->inviteList, user)) {
+            r->p2 = g_names.intern(user_name);
+            name_list_erase(r->inviteList, r->p2);
+            resp << "OK";
+        } else {
+            resp << "ERR private_room_not_invited";
+        }
+    }
+}
+
+// Paging for the list commands: limit=<n> caps the page (everything when
+// absent) and after=<id> resumes past the last id of the previous page. A page
+// shorter than limit is the last one.
+struct PageArgs {
+    size_t limit = std::numeric_limits<size_t>::max();
+    int after = 0;
+};
+
+static bool parse_page_args(const DbArgs& args, PageArgs& page, std::ostringstream& resp) {
+    int value = 0;
+    if (args.has("limit")) {
+        if (!args.get_int("limit", value) || value == 0) {
+            resp << "ERR invalid_limit";
+            return false;
+        }
+        page.limit = static_cast<size_t>(value);
+    }
+    if (args.has("after")) {
+        if (!args.get_int("after", value)) {
+            resp << "ERR invalid_after";
+            return false;
+        }
+        page.after = value;
+    }
+    return true;
+}
+
+static void db_room_list(const DbArgs& args, std::ostringstream& resp) { // **FIX: Return all fields**
+    PageArgs page;
+    if (!parse_page_args(args, page, resp)) return;
+    static const std::set<int> kNoRooms;
+    const std::set<int>* ids = &g_public_rooms;
+    if (args.has("status")) {
+        RoomStatus status;
+        ids = parse_room_status(args.get("status"), status) ? &g_public_rooms_by_status[static_cast<size_t>(status)]
+                                                            : &kNoRooms;
+    }
+    resp << "OK "; // Format: ID:Name:Host:Status:Visibility:P1:P2;
+    size_t n = 0;
+    for (auto it = ids->upper_bound(page.after); it != ids->end() && n < page.limit; ++it, ++n) {
+        const RoomRec& r = g_rooms.at(*it);
+        resp << r.id << ":" << r.name << ":" << g_names.name(r.host) << ":" << room_status_name(r.status) << ":"
+             << room_visibility_name(r.visibility) << ":" << g_names.name(r.p1) << ":" << g_names.name(r.p2) << ";";
+    }
+}
+
+static void db_room_get(const DbArgs& args, std::ostringstream& resp) { // **FIX: Return all fields**
+    int rid = 0;
+    if (!args.get_int("roomId", rid)) {
+        resp << "ERR invalid_roomId";
+    } else {
+        RoomRec* r = find_room(rid);
+        if (!r) resp << "ERR not_found";
+        else resp << "OK id=" << r->id << " name=" << r->name << " host=" << g_names.name(r->host)
+                  << " status=" << room_status_name(r->status) << " p1=" << g_names.name(r->p1)
+                  << " p2=" << g_names.name(r->p2) << " token=" << r->token
+                  << " visibility=" << room_visibility_name(r->visibility) << " version=" << r->version;
+    }
+}
+
+// A guard for Atomic batches: fails unless the room matches every condition
+// given (host=, status=, players=<at least>, token=), else answers as Room get
+// does. token= pins a batch to one match, so a result sent twice applies once.
+static void db_room_check(const DbArgs& args, std::ostringstream& resp) {
+    int rid = 0;
+    int players = 0;
+    if (!args.get_int("roomId", rid)) {
+        resp << "ERR invalid_roomId";
+    } else if (args.has("players") && (!args.get_int("players", players) || players < 0 || players > 2)) {
+        resp << "ERR invalid_players";
+    } else {
+        RoomRec* r = find_room(rid);
+        RoomStatus status = RoomStatus::Idle;
+        if (!r) resp << "ERR not_found";
+        else if (args.has("host") && r->host != g_names.find(args.get("host"))) resp << "ERR not_host";
+        else if (args.has("token") && r->token != args.get("token")) resp << "ERR token_mismatch";
+        else if (players > static_cast<int>(r->p1 != kNoName) + static_cast<int>(r->p2 != kNoName)) resp << "ERR need_players";
+        else if (args.has("status") && (!parse_room_status(args.get("status"), status) || r->status != status)) {
+            resp << "ERR status_mismatch";
+        } else {
+            db_room_get(args, resp);
+        }
+    }
+}
+
+static void db_room_set_status(const DbArgs& args, std::ostringstream& resp) {
+    int rid = 0;
+    std::string_view status_text = args.get("status");
+    RoomStatus status = RoomStatus::Idle;
+    if (!args.get_int("roomId", rid)) {
+        resp << "ERR invalid_roomId";
+    } else if (status_text.empty()) {
+        resp << "ERR missing_status";
+    } else if (!parse_room_status(status_text, status)) {
+        resp << "ERR invalid_status";
+    } else {
+        RoomRec* r = find_room(rid);
+        if (!r) resp << "ERR not_found";
+        else {
+            set_room_status(*r, status);
+            if (r->status == RoomStatus::Idle) { // Reset transient game state only
+                r->token.clear();
+                r->inviteList.clear(); // Clear invites on game end
+                r->spectators.clear();
+            }
+            resp << "OK";
+        }
+    }
+}
+
+static void db_room_set_token(const DbArgs& args, std::ostringstream& resp) {
+    int rid = 0;
+    std::string_view token = args.get("token");
+    if (!args.get_int("roomId", rid)) {
+        resp << "ERR invalid_roomId";
+    } else if (token.empty()) {
+        resp << "ERR missing_token";
+    } else {
+        RoomRec* r = find_room(rid);
+        if (!r) resp << "ERR not_found";
+        else {
+            r->token = token;
+            resp << "OK";
+        }
+    }
+}
+
+static void db_room_leave(const DbArgs& args, std::ostringstream& resp) {
+    int rid = 0;
+    std::string_view user_name = args.get("user");
+    if (!args.get_int("roomId", rid)) {
+        resp << "ERR invalid_roomId";
+    } else if (user_name.empty()) {
+        resp << "ERR missing_user";
+    } else {
+        auto it = g_rooms.find(rid);
+        const NameId user = g_names.find(user_name);
+        if (it == g_rooms.end()) {
+            resp << "ERR not_found";
+        } else {
+            RoomRec& room = it->second;
+            if (name_list_erase(room.spectators, user)) {
+                resp << "OK";
+            } else {
+                bool is_member = (room.host == user) || (room.p1 == user) || (room.p2 == user);
+                if (!is_member) {
+                    resp << "ERR not_in_room";
+                } else if (room.host == user) {
+                    if (room.p2 != kNoName) {
+                        room.host = room.p2;
+                        room.p1 = room.p2;
+                        room.p2 = kNoName;
+                        set_room_status(room, RoomStatus::Idle);
+                        room.token.clear();
+                        name_list_erase(room.inviteList, user);
+                        room.spectators.clear();
                         resp << "OK";
-                    }
-                }
-                else if (coll == "User" && action == "listOnline") {
-                    resp << "OK ";
-                    bool first = true;
-                    for (auto &kv : g_users) {
-                        if (!kv.second.online) continue;
-                        if (!first) resp << ",";
-                        resp << kv.first;
-                        first = false;
-                    }
-                }
-                // --- Room Collection (Revised) ---
-                else if (coll == "Room" && action == "create") {
-                    RoomRec r;
-                    r.id = g_next_room_id++;
-                    r.name = kv_map["name"];
-                    r.host = kv_map["host"];
-                    r.p1 = kv_map["host"]; // Host is P1
-                    std::string vis = kv_map.count("visibility") ? kv_map["visibility"] : "public";
-                    std::transform(vis.begin(), vis.end(), vis.begin(), [](unsigned char c){ return static_cast<char>(std::tolower(c)); });
-                    if (vis != "public" && vis != "private") vis = "public";
-                    r.visibility = vis;
-                    r.status = "idle";
-                    g_rooms[r.id] = r;
-                    resp << "OK roomId=" << r.id;
-                }
-                else if (coll == "Room" && action == "join") { // **FIX: Enforce rules**
-                    int rid = 0;
-                    auto user_it = kv_map.find("user");
-                    if (!parse_int_field(kv_map, "roomId", rid)) {
-                        resp << "ERR invalid_roomId";
-                    } else if (user_it == kv_map.end() || user_it->second.empty()) {
-                        resp << "ERR missing_user";
-                    } else {
-                        const std::string& user = user_it->second;
-                        RoomRec* r = find_room(rid);
-                        if (!r) resp << "ERR not_found";
-                        else if (r->status != "idle") resp << "ERR playing";
-                        else if (!r->p2.empty()) resp << "ERR full";
-                        else if (r->p1 == user || r->p2 == user) resp << "ERR already_in_room";
-                        else if (r->visibility == "public" || r->inviteList.count(user)) {
-                            r->p2 = user;
-                            r->inviteList.erase(user);
-                            resp << "OK";
-                        } else {
-                            resp << "ERR private_room_not_invited";
-                        }
-                    }
-                }
-                else if (coll == "Room" && action == "list") { // **FIX: Return all fields**
-                    resp << "OK "; // Format: ID:Name:Host:Status:Visibility:P1:P2;
-                    for (auto &kv : g_rooms) {
-                        auto &r = kv.second;
-                        if (r.visibility != "public") continue;
-                        resp << r.id << ":" << r.name << ":" << r.host << ":" << r.status << ":" << r.visibility << ":" << r.p1 << ":" << r.p2 << ";";
-                    }
-                }
-                else if (coll == "Room" && action == "get") { // **FIX: Return all fields**
-                    int rid = 0;
-                    if (!parse_int_field(kv_map, "roomId", rid)) {
-                        resp << "ERR invalid_roomId";
                     } else {
-                        RoomRec* r = find_room(rid);
-                        if (!r) resp << "ERR not_found";
-                        else resp << "OK id=" << r->id << " name=" << r->name << " host=" << r->host << " status=" << r->status << " p1=" << r->p1 << " p2=" << r->p2 << " token=" << r->token;
+                        unindex_room(room);
+                        g_rooms.erase(it);
+                        resp << "OK closed";
                     }
+                } else {
+                    if (room.p2 == user) room.p2 = kNoName;
+                    if (room.p1 == user) room.p1 = kNoName;
+                    set_room_status(room, RoomStatus::Idle);
+                    room.token.clear();
+                    name_list_erase(room.inviteList, user);
+                    name_list_erase(room.spectators, user);
+                    resp << "OK";
                 }
-                else if (coll == "Room" && action == "setStatus") {
-                    int rid = 0;
-                    auto status_it = kv_map.find("status");
-                    if (!parse_int_field(kv_map, "roomId", rid)) {
-                        resp << "ERR invalid_roomId";
-                    } else if (status_it == kv_map.end() || status_it->second.empty()) {
-                        resp << "ERR missing_status";
-                    } else {
-                        RoomRec* r = find_room(rid);
-                        if (!r) resp << "ERR not_found";
-                        else {
-                            r->status = status_it->second;
-                            if (r->status == "idle") { // Reset transient game state only
-                                r->token.clear();
-                                r->inviteList.clear(); // Clear invites on game end
-                                r->spectators.clear();
-                            }
-                            resp << "OK";
-                        }
-                    }
-                }
-                else if (coll == "Room" && action == "setToken") {
-                    int rid = 0;
-                    auto tok_it = kv_map.find("token");
-                    if (!parse_int_field(kv_map, "roomId", rid)) {
-                        resp << "ERR invalid_roomId";
-                    } else if (tok_it == kv_map.end() || tok_it->second.empty()) {
-                        resp << "ERR missing_token";
-                    } else {
-                        RoomRec* r = find_room(rid);
-                        if (!r) resp << "ERR not_found";
-                        else {
-                            r->token = tok_it->second;
-                            resp << "OK";
-                        }
-                    }
+            }
+        }
+    }
+}
+
+// The idle sweep's delete (see sweep_idle), logged so replay and replicas drop the row too
+static void db_room_evict(const DbArgs& args, std::ostringstream& resp) {
+    int rid = 0;
+    if (!args.get_int("roomId", rid)) {
+        resp << "ERR invalid_roomId";
+    } else {
+        auto it = g_rooms.find(rid);
+        if (it == g_rooms.end()) resp << "ERR not_found";
+        else {
+            unindex_room(it->second);
+            g_rooms.erase(it);
+            resp << "OK";
+        }
+    }
+}
+
+static void db_room_invite(const DbArgs& args, std::ostringstream& resp) { // **FIX: Added Invite**
+    int rid = 0;
+    std::string_view user = args.get("user");
+    std::string_view host = args.get("host");
+    if (!args.get_int("roomId", rid)) {
+        resp << "ERR invalid_roomId";
+    } else if (host.empty()) {
+        resp << "ERR missing_host";
+    } else if (user.empty()) {
+        resp << "ERR missing_user";
+    } else {
+        RoomRec* r = find_room(rid);
+        if (!r) resp << "ERR not_found";
+        else if (r->host != g_names.find(host)) resp << "ERR not_host";
+        else {
+            name_list_insert(r->inviteList, g_names.intern(user));
+            resp << "OK invited=" << user;
+        }
+    }
+}
+
+static void db_room_spectate(const DbArgs& args, std::ostringstream& resp) {
+    int rid = 0;
+    std::string_view user = args.get("user");
+    if (!args.get_int("roomId", rid)) {
+        resp << "ERR invalid_roomId";
+    } else if (user.empty()) {
+        resp << "ERR missing_user";
+    } else {
+        RoomRec* r = find_room(rid);
+        if (!r) resp << "ERR not_found";
+        else if (r->status != RoomStatus::Playing) resp << "ERR not_playing";
+        else {
+            name_list_insert(r->spectators, g_names.intern(user));
+            resp << "OK";
+        }
+    }
+}
+
+static void db_room_unspectate(const DbArgs& args, std::ostringstream& resp) {
+    int rid = 0;
+    std::string_view user = args.get("user");
+    if (!args.get_int("roomId", rid)) {
+        resp << "ERR invalid_roomId";
+    } else if (user.empty()) {
+        resp << "ERR missing_user";
+    } else {
+        RoomRec* r = find_room(rid);
+        if (!r) resp << "ERR not_found";
+        else if (!name_list_erase(r->spectators, g_names.find(user))) resp << "ERR not_spectating";
+        else resp << "OK";
+    }
+}
+
+static void db_room_list_invites(const DbArgs& args, std::ostringstream& resp) { // **FIX: Added listInvites**
+    std::string_view user_name = args.get("user");
+    if (user_name.empty()) {
+        resp << "ERR missing_user";
+    } else {
+        const NameId user = g_names.find(user_name);
+        resp << "OK "; // Format: ID:Name:Host;
+        for (auto &kv : g_rooms) {
+            if (name_list_has(kv.second.inviteList, user)) {
+                resp << kv.second.id << ":" << kv.second.name << ":" << g_names.name(kv.second.host) << ";";
+            }
+        }
+    }
+}
+
+// --- GameLog Collection ---
+static void db_gamelog_create(const DbArgs& args, std::ostringstream& resp) {
+    int room_id = 0;
+    int score1 = 0;
+    int score2 = 0;
+    std::string_view user1 = args.get("user1");
+    std::string_view user2 = args.get("user2");
+    if (!args.get_int("roomId", room_id)) {
+        resp << "ERR invalid_roomId";
+    } else if (!args.get_int("score1", score1)) {
+        resp << "ERR invalid_score1";
+    } else if (!args.get_int("score2", score2)) {
+        resp << "ERR invalid_score2";
+    } else if (user1.empty() || user2.empty()) {
+        resp << "ERR missing_user";
+    } else {
+        GameLogRec g;
+        g.id = take_game_id();
+        g.roomId = room_id;
+        g.user1 = g_names.intern(user1);
+        g.user2 = g_names.intern(user2);
+        g.score1 = score1;
+        g.score2 = score2;
+        g_gamelogs.push_back(g); // **FIX: Correctly persist**
+        record_game(g);
+        index_gamelog(g_gamelogs.size() - 1);
+        resp << "OK gameId=" << g.id;
+    }
+}
+
+// Second step of a cross-shard GameLog create: the room's shard stored the game
+// (and handed out its id), each player's shard keeps a copy for their stats
+static void db_gamelog_replicate(const DbArgs& args, std::ostringstream& resp) {
+    GameLogRec g;
+    std::string_view user1 = args.get("user1");
+    std::string_view user2 = args.get("user2");
+    if (!args.get_int("gameId", g.id)) {
+        resp << "ERR invalid_gameId";
+    } else if (!args.get_int("roomId", g.roomId)) {
+        resp << "ERR invalid_roomId";
+    } else if (!args.get_int("score1", g.score1)) {
+        resp << "ERR invalid_score1";
+    } else if (!args.get_int("score2", g.score2)) {
+        resp << "ERR invalid_score2";
+    } else if (user1.empty() || user2.empty()) {
+        resp << "ERR missing_user";
+    } else {
+        if (owns_room(g.roomId) || (!owns_user(user1) && !owns_user(user2))) {
+            resp << "ERR wrong_shard";
+            return;
+        }
+        g.user1 = g_names.intern(user1);
+        g.user2 = g_names.intern(user2);
+        g_replica_logs.push_back(g);
+        record_game(g);
+        resp << "OK gameId=" << g.id;
+    }
+}
+
+// Optional user= or roomId= narrows the list. Sealed segments are skipped
+// when their dictionary lacks the user or their room range the room; in the
+// others only the id and filter columns are decoded, the rest only for blocks
+// with a match. The tail goes through the log indexes.
+static void db_gamelog_list(const DbArgs& args, std::ostringstream& resp) { // **FIX: Added list**
+    PageArgs page;
+    if (!parse_page_args(args, page, resp)) return;
+    static const std::vector<size_t> kNoLogs;
+    const std::vector<size_t>* positions = nullptr; // every log
+    const bool by_user = args.has("user");
+    const NameId user = by_user ? g_names.find(args.get("user")) : kNoName;
+    int rid = 0;
+    if (by_user) {
+        auto it = g_logs_by_user.find(user);
+        positions = (it == g_logs_by_user.end()) ? &kNoLogs : &it->second;
+    } else if (args.has("roomId")) {
+        if (!args.get_int("roomId", rid)) {
+            resp << "ERR invalid_roomId";
+            return;
+        }
+        auto it = g_logs_by_room.find(rid);
+        positions = (it == g_logs_by_room.end()) ? &kNoLogs : &it->second;
+    }
+
+    auto print = [&resp](const GameLogRec& g) {
+        resp << "id=" << g.id << " room=" << g.roomId << " p1=" << g_names.name(g.user1) << " s1=" << g.score1
+             << " p2=" << g_names.name(g.user2) << " s2=" << g.score2 << ";";
+    };
+    resp << "OK ";
+    size_t n = 0;
+    const unsigned filter = by_user ? kLogUsers : positions ? unsigned{kLogRoom} : 0u;
+    auto matches = [&](const GameLogRec& g) {
+        if (by_user) return g.user1 == user || g.user2 == user;
+        return !positions || g.roomId == rid;
+    };
+    static GameLogBlock block;
+    for (const auto& seg : g_gamelogs.segments()) {
+        if (n == page.limit) return;
+        if (seg->last_id() <= page.after) continue;
+        if (by_user && !seg->has_user(user)) continue;
+        if (filter == kLogRoom && (rid < seg->min_room() || rid > seg->max_room())) continue;
+        for (size_t b = seg->block_after(page.after); b < seg->blocks() && n < page.limit; ++b) {
+            seg->decode(b, kLogId | filter, block);
+            bool whole = false;
+            for (size_t i = 0; i < block.count && n < page.limit; ++i) {
+                if (block.row[i].id <= page.after || !matches(block.row[i])) continue;
+                if (!whole) {
+                    seg->decode(b, kLogAll & ~(kLogId | filter), block);
+                    whole = true;
                 }
-                else if (coll == "Room" && action == "leave") {
-                    int rid = 0;
-                    auto user_it = kv_map.find("user");
-                    if (!parse_int_field(kv_map, "roomId", rid)) {
-                        resp << "ERR invalid_roomId";
-                    } else if (user_it == kv_map.end() || user_it->second.empty()) {
-                        resp << "ERR missing_user";
-                    } else {
-                        const std::string& user = user_it->second;
-                        auto it = g_rooms.find(rid);
-                        if (it == g_rooms.end()) {
-                            resp << "ERR not_found";
-                        } else {
-                            RoomRec& room = it->second;
-                            if (room.spectators.erase(user) > 0) {
-                                resp << "OK";
-                            } else {
-                                bool is_member = (room.host == user) || (room.p1 == user) || (room.p2 == user);
-                                if (!is_member) {
-                                    resp << "ERR not_in_room";
-                                } else if (room.host == user) {
-                                    if (!room.p2.empty()) {
-                                        room.host = room.p2;
-                                        room.p1 = room.p2;
-                                        room.p2.clear();
-                                        room.status = "idle";
-                                        room.token.clear();
-                                        room.inviteList.erase(user);
-                                        room.spectators.clear();
-                                        resp << "OK";
-                                    } else {
-                                        g_rooms.erase(it);
-                                        resp << "OK closed";
-                                    }
-                                } else {
-                                    if (room.p2 == user) room.p2.clear();
-                                    if (room.p1 == user) room.p1.clear();
-                                    room.status = "idle";
-                                    room.token.clear();
-                                    room.inviteList.erase(user);
-                                    room.spectators.erase(user);
-                                    resp << "OK";
-                                }
-                            }
-                        }
-                    }
+                print(block.row[i]);
+                ++n;
+            }
+        }
+    }
+    if (!positions) {
+        const std::vector<GameLogRec>& tail = g_gamelogs.tail();
+        auto it = std::upper_bound(tail.begin(), tail.end(), page.after,
+                                   [](int id, const GameLogRec& g) { return id < g.id; });
+        for (; it != tail.end() && n < page.limit; ++it, ++n) print(*it);
+    } else {
+        auto it = std::upper_bound(positions->begin(), positions->end(), page.after,
+                                   [](int id, size_t pos) { return id < g_gamelogs.tail_at(pos).id; });
+        for (; it != positions->end() && n < page.limit; ++it, ++n) print(g_gamelogs.tail_at(*it));
+    }
+}
+
+// Score distribution of this shard's games: "OK <bucket start>:<scores>;..."
+// with bucket= wide buckets (100 by default), for every player or just user=.
+// Reads the score columns, and the user columns when filtered, nothing else.
+static void db_gamelog_scores(const DbArgs& args, std::ostringstream& resp) {
+    int width = 100;
+    if (args.has("bucket") && (!args.get_int("bucket", width) || width <= 0)) {
+        resp << "ERR invalid_bucket";
+        return;
+    }
+    const bool by_user = args.has("user");
+    const NameId user = by_user ? g_names.find(args.get("user")) : kNoName;
+    std::map<int, uint64_t> buckets;
+    auto count = [&](int score) {
+        const int q = score / width;
+        ++buckets[(q - (score % width < 0 ? 1 : 0)) * width];
+    };
+    auto add = [&](const GameLogRec& g) {
+        if (!by_user || g.user1 == user) count(g.score1);
+        if (!by_user || g.user2 == user) count(g.score2);
+    };
+    const unsigned columns = kLogScores | (by_user ? kLogUsers : 0);
+    static GameLogBlock block;
+    for (const auto& seg : g_gamelogs.segments()) {
+        if (by_user && !seg->has_user(user)) continue;
+        for (size_t b = 0; b < seg->blocks(); ++b) {
+            seg->decode(b, columns, block);
+            for (size_t i = 0; i < block.count; ++i) add(block.row[i]);
+        }
+    }
+    for (const GameLogRec& g : g_gamelogs.tail()) add(g);
+    resp << "OK ";
+    for (const auto& [start, scores] : buckets) resp << start << ":" << scores << ";";
+}
+
+// --- Stats (derived from GameLog, nothing of its own is persisted) ---
+static void db_stats_get(const DbArgs& args, std::ostringstream& resp) {
+    std::string_view user = args.get("username");
+    if (user.empty()) {
+        resp << "ERR missing_username";
+        return;
+    }
+    auto it = g_user_stats.find(g_names.find(user));
+    if (it == g_user_stats.end()) {
+        resp << "ERR not_found";
+        return;
+    }
+    const UserStats& st = it->second;
+    resp << "OK username=" << user << " games=" << st.games << " wins=" << st.wins << " losses=" << st.losses
+         << " draws=" << st.draws << " total=" << st.total_score << " best=" << st.best_score
+         << " rank=" << g_leaderboard.order_of_key(leader_key(it->first, st)) + 1;
+}
+
+// limit= entries (10 by default) after rank after=; Format: Rank:User:Wins:Games:Best;
+static void db_stats_top(const DbArgs& args, std::ostringstream& resp) {
+    PageArgs page;
+    page.limit = 10;
+    if (!parse_page_args(args, page, resp)) return;
+    resp << "OK ";
+    size_t rank = static_cast<size_t>(page.after);
+    for (auto it = g_leaderboard.find_by_order(rank); it != g_leaderboard.end() && rank < page.after + page.limit; ++it) {
+        const std::string& user = std::get<2>(*it);
+        const UserStats& st = g_user_stats.find(g_names.find(user))->second;
+        resp << ++rank << ":" << user << ":" << st.wins << ":" << st.games << ":" << st.best_score << ";";
+    }
+}
+
+// How many leaderboard entries here rank ahead of the given one; summed over
+// all shards this gives a user's global rank
+static void db_stats_ahead(const DbArgs& args, std::ostringstream& resp) {
+    int wins = 0;
+    int best = 0;
+    std::string_view user = args.get("username");
+    if (!args.get_int("wins", wins)) {
+        resp << "ERR invalid_wins";
+    } else if (!args.get_int("best", best)) {
+        resp << "ERR invalid_best";
+    } else if (user.empty()) {
+        resp << "ERR missing_username";
+    } else {
+        resp << "OK ahead=" << g_leaderboard.order_of_key(LeaderKey{-wins, -best, std::string(user)});
+    }
+}
+
+// --- Server metrics (see metrics.hpp), for Stats server and --metrics-port ---
+struct DbMetrics {
+    MetricGauge& users = metrics().gauge("db_users", "Rows in the User table");
+    MetricGauge& rooms = metrics().gauge("db_rooms", "Rows in the Room table");
+    MetricGauge& gamelogs = metrics().gauge("db_gamelogs", "Games logged by this shard");
+    MetricGauge& replica_logs = metrics().gauge("db_replica_gamelogs", "Games of other shards kept for local stats");
+    MetricGauge& clients = metrics().gauge("db_clients", "Open client connections");
+    MetricGauge& followers = metrics().gauge("db_followers", "Read replicas following this server's WAL");
+    MetricGauge& applied_lsn = metrics().gauge("db_applied_lsn", "Last WAL record applied, on a read replica");
+    MetricCounter& unknown = metrics().counter("db_unknown_commands_total", "Requests naming no known command");
+    LatencyHistogram& wal_commit =
+        metrics().histogram("db_wal_commit_seconds", "Write and fdatasync of one group commit");
+    MetricCounter& rooms_evicted = metrics().counter("db_rooms_evicted_total", "Idle or abandoned rooms the sweep deleted");
+    MetricCounter& rooms_reset = metrics().counter("db_rooms_reset_total", "Stale playing rooms the sweep set idle");
+    MetricCounter& lease_offline =
+        metrics().counter("db_lease_offline_total", "Users set offline because their lobby's lease ran out");
+    MetricGauge& leases = metrics().gauge("db_leases", "Lobby leases holding users online");
+};
+
+static DbMetrics& db_metrics() {
+    static DbMetrics m;
+    return m;
+}
+
+// Table sizes are sampled rather than tracked on every mutation
+static void update_table_gauges() {
+    DbMetrics& m = db_metrics();
+    m.users.set(static_cast<int64_t>(g_users.size()));
+    m.rooms.set(static_cast<int64_t>(g_rooms.size()));
+    m.gamelogs.set(static_cast<int64_t>(g_gamelogs.size()));
+    m.replica_logs.set(static_cast<int64_t>(g_replica_logs.size()));
+    m.leases.set(static_cast<int64_t>(g_leases.size()));
+}
+
+// Every metric of this process, one per line after "OK STATS"
+static void db_stats_server(const DbArgs&, std::ostringstream& resp) {
+    update_table_gauges();
+    resp << "OK STATS\n" << metrics().render_text();
+}
+
+// Writes the trace rings (see common.hpp) into the working directory
+static void db_stats_trace_dump(const DbArgs&, std::ostringstream& resp) {
+    if (!kTracingEnabled) {
+        resp << "ERR tracing_disabled";
+        return;
+    }
+    long events = 0;
+    const std::string path = trace_dump_next(&events);
+    if (path.empty()) resp << "ERR trace_write_failed";
+    else resp << "OK path=" << path << " events=" << events;
+}
+
+// --- Dispatch ---
+// (collection, action) -> handler through a perfect hash fixed at compile time:
+// FNV-1a of "<collection> <action>" mixed with a seed the compiler searches for
+// so that every command lands in its own slot. A lookup is one hash, one index
+// and one string compare to reject unknown commands.
+using DbHandler = void (*)(const DbArgs&, std::ostringstream&);
+
+// The versioned row a command names: username= for User, roomId= for Room
+enum class DbRow : uint8_t { None, User, Room };
+
+struct DbCommand {
+    std::string_view coll;
+    std::string_view action;
+    DbHandler handler;
+    bool mutates; // successful calls go to the WAL
+    DbRow row;
+};
+
+constexpr DbCommand kDbCommands[] = {
+    {"User", "create", db_user_create, true, DbRow::User},
+    {"User", "read", db_user_read, false, DbRow::User},
+    {"User", "compareSetOnline", db_user_compare_set_online, true, DbRow::User},
+    {"User", "setOnline", db_user_set_online, true, DbRow::User},
+    {"User", "listOnline", db_user_list_online, false, DbRow::None},
+    {"User", "lease", db_user_lease, false, DbRow::None},
+    {"Room", "create", db_room_create, true, DbRow::None},
+    {"Room", "join", db_room_join, true, DbRow::Room},
+    {"Room", "list", db_room_list, false, DbRow::None},
+    {"Room", "get", db_room_get, false, DbRow::Room},
+    {"Room", "check", db_room_check, false, DbRow::Room},
+    {"Room", "setStatus", db_room_set_status, true, DbRow::Room},
+    {"Room", "setToken", db_room_set_token, true, DbRow::Room},
+    {"Room", "leave", db_room_leave, true, DbRow::Room},
+    {"Room", "evict", db_room_evict, true, DbRow::Room},
+    {"Room", "invite", db_room_invite, true, DbRow::Room},
+    {"Room", "spectate", db_room_spectate, true, DbRow::Room},
+    {"Room", "unspectate", db_room_unspectate, true, DbRow::Room},
+    {"Room", "listInvites", db_room_list_invites, false, DbRow::None},
+    {"GameLog", "create", db_gamelog_create, true, DbRow::None},
+    {"GameLog", "list", db_gamelog_list, false, DbRow::None},
+    {"GameLog", "scores", db_gamelog_scores, false, DbRow::None},
+    {"GameLog", "replicate", db_gamelog_replicate, true, DbRow::None},
+    {"Stats", "get", db_stats_get, false, DbRow::None},
+    {"Stats", "top", db_stats_top, false, DbRow::None},
+    {"Stats", "ahead", db_stats_ahead, false, DbRow::None},
+    {"Stats", "server", db_stats_server, false, DbRow::None},
+    {"Stats", "traceDump", db_stats_trace_dump, false, DbRow::None},
+};
+constexpr size_t kDbCommandCount = sizeof(kDbCommands) / sizeof(kDbCommands[0]);
+
+// Service time per command, indexed like kDbCommands; filled before serving
+static LatencyHistogram* g_db_service[kDbCommandCount];
+
+static void register_command_metrics() {
+    for (size_t i = 0; i < kDbCommandCount; ++i) {
+        g_db_service[i] = &metrics().histogram(
+            "db_command_seconds", "Time to apply one request, WAL append included",
+            "command=\"" + std::string(kDbCommands[i].coll) + " " + std::string(kDbCommands[i].action) + "\"");
+    }
+}
+constexpr size_t kDbSlots = 64; // power of two, comfortably above the command count
+
+constexpr uint32_t db_command_hash(std::string_view coll, std::string_view action, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (char c : coll) h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+    h = (h ^ static_cast<unsigned char>(' ')) * 16777619u;
+    for (char c : action) h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+struct DbDispatchTable {
+    uint32_t seed = 0;
+    int8_t slots[kDbSlots] = {};
+};
+
+constexpr DbDispatchTable make_dispatch_table() {
+    for (uint32_t seed = 0; seed < 100000; ++seed) {
+        DbDispatchTable t{};
+        t.seed = seed;
+        for (auto& s : t.slots) s = -1;
+        bool clash = false;
+        for (size_t i = 0; i < kDbCommandCount && !clash; ++i) {
+            size_t slot = db_command_hash(kDbCommands[i].coll, kDbCommands[i].action, seed) & (kDbSlots - 1);
+            if (t.slots[slot] >= 0) clash = true;
+            else t.slots[slot] = static_cast<int8_t>(i);
+        }
+        if (!clash) return t;
+    }
+    return DbDispatchTable{}; // caught by the static_assert below
+}
+
+constexpr DbDispatchTable kDbDispatch = make_dispatch_table();
+
+constexpr bool dispatch_table_complete() {
+    for (size_t i = 0; i < kDbCommandCount; ++i) {
+        size_t slot = db_command_hash(kDbCommands[i].coll, kDbCommands[i].action, kDbDispatch.seed) & (kDbSlots - 1);
+        if (kDbDispatch.slots[slot] != static_cast<int8_t>(i)) return false;
+    }
+    return true;
+}
+static_assert(dispatch_table_complete(), "no collision-free seed for the DB command table");
+
+static const DbCommand* find_db_command(std::string_view coll, std::string_view action) {
+    int idx = kDbDispatch.slots[db_command_hash(coll, action, kDbDispatch.seed) & (kDbSlots - 1)];
+    if (idx < 0) return nullptr;
+    const DbCommand& cmd = kDbCommands[idx];
+    return (cmd.coll == coll && cmd.action == action) ? &cmd : nullptr;
+}
+
+// --- Versions ---
+// Any command naming a row (DbRow above) takes if_version=<v> and then runs
+// only while that row is at version v, 0 standing for "no such row": a read
+// answers as usual, a write applies and bumps the version. Otherwise it fails
+// with "ERR version_mismatch version=<current>" and changes nothing, so a
+// writer that read a row can write back its change without a lock on the
+// lobby side and re-read and retry on a mismatch. A conditional write that
+// succeeds appends " version=<new>" to its reply (unless the row is gone, as
+// after a host's Room leave closed it). Commands naming no row (Room create,
+// GameLog) answer "ERR unversioned". The condition stays in the WAL record
+// and holds again on replay, which reaches the same versions.
+static uint64_t* row_version(DbRow row, const DbArgs& args) {
+    if (row == DbRow::User) {
+        auto it = g_users.find(args.get("username"));
+        return it == g_users.end() ? nullptr : &it->second.version;
+    }
+    int rid = 0;
+    RoomRec* r = row == DbRow::Room && args.get_int("roomId", rid) ? find_room(rid) : nullptr;
+    return r ? &r->version : nullptr;
+}
+
+static bool check_version(const DbCommand& cmd, const DbArgs& args, std::ostringstream& resp) {
+    std::string_view text = args.get("if_version");
+    uint64_t expect = 0;
+    if (cmd.row == DbRow::None) {
+        resp << "ERR unversioned";
+        return false;
+    }
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), expect);
+    if (text.empty() || ec != std::errc() || end != text.data() + text.size()) {
+        resp << "ERR invalid_if_version";
+        return false;
+    }
+    const uint64_t* version = row_version(cmd.row, args);
+    const uint64_t current = version ? *version : 0;
+    if (current != expect) {
+        resp << "ERR version_mismatch version=" << current;
+        return false;
+    }
+    return true;
+}
+
+static std::string handle_atomic(const std::string& req);
+
+// Runs one "<Collection> <action> key=value..." request against the in-memory state
+static std::string handle_request(const std::string& req) {
+    if (req.rfind("Atomic\n", 0) == 0) return handle_atomic(req);
+    if (req.rfind("Batch\n", 0) == 0) {
+        std::istringstream lines(req.substr(6));
+        std::string line, replies;
+        int count = 0;
+        while (std::getline(lines, line)) {
+            if (line.empty()) continue;
+            replies += "\n" + handle_request(line);
+            ++count;
+        }
+        return "OK batch=" + std::to_string(count) + replies;
+    }
+
+    TRACE_SCOPE("db_request");
+    const auto start = std::chrono::steady_clock::now();
+    DbArgs args(req);
+    std::ostringstream resp;
+    const DbCommand* cmd = find_db_command(args.coll, args.action);
+    if (!cmd) resp << "ERR unknown_command";
+    else if (g_read_only && cmd->mutates && !g_replaying) resp << "ERR read_only";
+    else if (cmd->mutates && !g_replaying && !g_wal.healthy()) resp << "ERR wal_unavailable";
+    else if (!args.has("if_version") || check_version(*cmd, args, resp)) {
+        cmd->handler(args, resp);
+        if (cmd->mutates && cmd->row != DbRow::None && resp.view().rfind("OK", 0) == 0) {
+            if (uint64_t* version = row_version(cmd->row, args)) {
+                ++*version;
+                if (args.has("if_version")) resp << " version=" << *version;
+            }
+        }
+    }
+    int rid = 0;
+    if (cmd && args.get_int("roomId", rid)) {
+        if (RoomRec* r = find_room(rid)) r->last_active = start;
+    }
+
+    std::string out = resp.str();
+    if (!g_replaying && !g_in_atomic && cmd && cmd->mutates && out.rfind("OK", 0) == 0) g_wal.append(req);
+    if (g_replaying) return out;
+    if (cmd) g_db_service[cmd - kDbCommands]->record(std::chrono::steady_clock::now() - start);
+    else db_metrics().unknown.add();
+    return out;
+}
+
+// --- Atomic batches ---
+// "Atomic\n<cmd>\n<cmd>..." runs the commands as one unit. When all of them
+// succeed the reply is "OK batch=<n>\n<reply>..." as for Batch; otherwise the
+// first failure stops it, whatever the batch changed is put back, and the reply
+// is "ERR aborted at=<i>\n<reply>..." up to the failed one. Nothing else runs
+// in between (one poll thread) and the WAL holds the batch as one record, so
+// recovery and replicas apply all of it or none. A read such as Room check in
+// front guards the writes behind it.
+// The undo keeps the rows the commands name (roomId=, username=), the rooms
+// they create and the id counters; new game logs are dropped and the indexes
+// rebuilt, which is slow, but only a failed batch pays for it.
+constexpr const char* kWalAtomic = "Atomic";
+constexpr char kWalAtomicSeparator = '\x1f'; // WAL records are lines, so the newlines become this
+
+struct AtomicUndo {
+    std::unordered_map<int, std::optional<RoomRec>> rooms;
+    std::unordered_map<std::string, std::optional<UserRec>> users;
+    int next_room_id = g_next_room_id;
+    int next_game_id = g_next_game_id;
+    size_t gamelogs = g_gamelogs.size();
+    size_t replica_logs = g_replica_logs.size();
+
+    // Before a command runs
+    void keep(const DbArgs& args) {
+        int rid = 0;
+        if (args.get_int("roomId", rid) && !rooms.count(rid)) {
+            const RoomRec* r = find_room(rid);
+            rooms.emplace(rid, r ? std::optional<RoomRec>(*r) : std::nullopt);
+        }
+        std::string name(args.get("username"));
+        if (!name.empty() && !users.count(name)) {
+            auto it = g_users.find(name);
+            users.emplace(name, it != g_users.end() ? std::optional<UserRec>(it->second) : std::nullopt);
+        }
+    }
+    void created_room(int rid) { rooms.emplace(rid, std::nullopt); }
+
+    void restore() {
+        for (auto& [rid, saved] : rooms) {
+            auto it = g_rooms.find(rid);
+            if (it != g_rooms.end()) {
+                unindex_room(it->second);
+                g_rooms.erase(it);
+            }
+            if (saved) index_room(g_rooms[rid] = *saved);
+        }
+        for (auto& [name, saved] : users) {
+            if (saved) g_users[name] = *saved;
+            else g_users.erase(name);
+            g_presence.set(g_names.intern(name), saved && saved->online);
+        }
+        g_next_room_id = next_room_id;
+        g_next_game_id = next_game_id;
+        if (g_gamelogs.size() != gamelogs || g_replica_logs.size() != replica_logs) {
+            g_gamelogs.truncate(gamelogs); // nothing is sealed inside a batch
+            g_replica_logs.erase(g_replica_logs.begin() + static_cast<std::ptrdiff_t>(replica_logs), g_replica_logs.end());
+            rebuild_indexes();
+        }
+    }
+};
+
+static std::string handle_atomic(const std::string& req) {
+    std::vector<std::string> cmds;
+    std::istringstream lines(req.substr(7));
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.empty()) continue;
+        if (line.find(kWalAtomicSeparator) != std::string::npos) return "ERR invalid_batch";
+        cmds.push_back(std::move(line));
+    }
+
+    AtomicUndo undo;
+    std::string replies;
+    bool mutated = false;
+    g_in_atomic = true;
+    for (size_t i = 0; i < cmds.size(); ++i) {
+        DbArgs args(cmds[i]);
+        const DbCommand* cmd = find_db_command(args.coll, args.action);
+        undo.keep(args);
+        std::string reply = handle_request(cmds[i]);
+        replies += "\n" + reply;
+        if (reply.rfind("OK", 0) != 0) {
+            g_in_atomic = false;
+            undo.restore();
+            return "ERR aborted at=" + std::to_string(i) + replies;
+        }
+        if (reply.rfind("OK roomId=", 0) == 0 && args.coll == "Room" && args.action == "create") {
+            undo.created_room(std::atoi(reply.c_str() + 10));
+        }
+        mutated = mutated || (cmd && cmd->mutates);
+    }
+    g_in_atomic = false;
+    if (mutated && !g_replaying) {
+        std::string record = kWalAtomic;
+        for (const std::string& c : cmds) record += kWalAtomicSeparator + c;
+        g_wal.append(record);
+    }
+    return "OK batch=" + std::to_string(cmds.size()) + replies;
+}
+
+static void apply_wal_record(const std::string& payload) {
+    if (payload == kWalResetOnline) {
+        mark_all_users_offline();
+        return;
+    }
+    if (payload.rfind(kWalAtomic, 0) == 0 && payload.size() > 6 && payload[6] == kWalAtomicSeparator) {
+        std::string batch = payload;
+        std::replace(batch.begin(), batch.end(), kWalAtomicSeparator, '\n');
+        handle_request(batch);
+        return;
+    }
+    handle_request(payload);
+}
+
+// --- Idle sweep ---
+// Every kSweepInterval the primary fixes the rows nothing else would: users
+// held online by a lease that ran out, rooms left "playing" with no report and
+// rooms nobody uses any more, so the tables (and every pass over them, as Room
+// listInvites makes) stay the size of what is really going on. A room with
+// none of its players online is abandoned (they left without a Room leave,
+// their lobby went away) and goes after kRoomOrphanGrace; one with a player
+// online after the longer timeouts. Players of another shard count as online.
+// Each fix is an ordinary logged command (User setOnline, Room setStatus, Room
+// evict), so recovery and replicas come to the same tables.
+constexpr auto kSweepInterval = std::chrono::seconds(5);
+constexpr auto kRoomOrphanGrace = std::chrono::seconds(60);
+constexpr auto kRoomIdleTimeout = std::chrono::minutes(30);
+constexpr auto kRoomPlayingTimeout = std::chrono::minutes(60);
+
+static bool player_present(NameId user) {
+    return user != kNoName && (g_presence.online(user) || !owns_user(g_names.name(user)));
+}
+
+static void sweep_idle(std::chrono::steady_clock::time_point now) {
+    std::vector<std::string> offline;
+    for (auto it = g_leases.begin(); it != g_leases.end();) {
+        if (it->second.expires > now) {
+            ++it;
+            continue;
+        }
+        if (!it->second.users.empty()) {
+            log_checkpoint("DB", "LEASE_EXPIRED",
+                           "lease=" + it->first + " users=" + std::to_string(it->second.users.size()));
+        }
+        for (NameId user : it->second.users) {
+            offline.push_back("User setOnline username=" + std::string(g_names.name(user)) + " online=0");
+        }
+        it = g_leases.erase(it);
+    }
+    for (const std::string& c : offline) handle_request(c);
+
+    std::vector<std::string> fixes;
+    for (auto const& [id, r] : g_rooms) {
+        const bool present = player_present(r.host) || player_present(r.p1) || player_present(r.p2);
+        const auto idle = now - r.last_active;
+        if (r.status == RoomStatus::Playing) {
+            if (idle >= (present ? kRoomPlayingTimeout : kRoomOrphanGrace)) {
+                fixes.push_back("Room setStatus roomId=" + std::to_string(id) + " status=idle");
+            }
+        } else if (idle >= (present ? kRoomIdleTimeout : kRoomOrphanGrace)) {
+            fixes.push_back("Room evict roomId=" + std::to_string(id));
+        }
+    }
+    size_t evicted = 0, reset = 0;
+    for (const std::string& c : fixes) {
+        if (handle_request(c).rfind("OK", 0) != 0) continue;
+        if (c.rfind("Room evict", 0) == 0) ++evicted;
+        else ++reset;
+    }
+    db_metrics().rooms_evicted.add(evicted);
+    db_metrics().rooms_reset.add(reset);
+    db_metrics().lease_offline.add(offline.size());
+    // Give back the buckets of a table that has shrunk well below its peak
+    if (evicted > 0 && g_rooms.bucket_count() > 4 * g_rooms.size() + 64) g_rooms.rehash(0);
+    if (g_lease_of.bucket_count() > 4 * g_lease_of.size() + 64) g_lease_of.rehash(0);
+    if (offline.empty() && fixes.empty()) return;
+    log_checkpoint("DB", "IDLE_SWEEP",
+                   "offline=" + std::to_string(offline.size()) + " evicted=" + std::to_string(evicted) +
+                       " reset=" + std::to_string(reset));
+    if (!g_wal.commit()) log_checkpoint("DB", "WAL_COMMIT_FAIL", "lsn=" + std::to_string(g_wal.last_lsn()));
+}
+
+// --- Read replicas ---
+// A db_server started with --replica-of <ip>:<port> follows that primary and
+// answers the commands that only read (writes get "ERR read_only"), so list
+// and stats queries can be spread over more processes. It connects and sends
+// "Replica follow"; the primary answers
+//   "SNAPSHOT lsn=<n> bytes=<b>", then the state file image at lsn n in raw
+//   frames adding up to b bytes, sent by a fork()ed child as checkpoints are,
+//   then "W<records>" frames: the WAL from lsn n + 1 on, each group commit as
+//   it was written once it is synced, cut into frames anywhere.
+// The replica applies every record as startup replay would, so it trails the
+// primary by about one group commit and never shows what the primary could
+// still lose. It keeps no files: if the primary goes away it goes on serving
+// what it has and resyncs from a fresh snapshot once it can reconnect.
+// Replicas of a shard take the same --shard as their primary.
+constexpr size_t kReplicaChunk = LP_MAX_FRAME - 1; // WAL bytes per frame, after the W
+constexpr size_t kFollowerQueueLimit = 16 * 1024 * 1024;   // WAL queued to a follower before it is dropped
+constexpr size_t kFollowerBacklogLimit = 64 * 1024 * 1024; // WAL held while its snapshot is sent
+constexpr int kSnapshotTimeoutSecs = 30;                     // replica side, per frame
+constexpr auto kResyncInterval = std::chrono::seconds(1);
+
+// Primary side: one per replica connection
+struct Follower {
+    pid_t snapshot_child = -1; // still sending the snapshot; the WAL waits in backlog
+    uint64_t lsn = 0;          // the snapshot's
+    std::string backlog;
+};
+static std::unordered_map<int, Follower> g_followers;
+
+// Replica side
+static int g_primary_fd = -1;
+static uint64_t g_applied_lsn = 0;
+static std::string g_primary_stream; // a record cut by a frame boundary
+
+// A follower that falls too far behind is cut off; it resyncs from a snapshot
+static void queue_wal(int fd, std::string_view records) {
+    FrameWriter& w = g_writers[fd];
+    for (size_t pos = 0; pos < records.size(); pos += kReplicaChunk) {
+        std::string_view part = records.substr(pos, kReplicaChunk);
+        LpFrame frame = lp_build_frame([part](std::string& out) {
+            out.push_back('W');
+            out.append(part);
+        });
+        if (w.enqueue(frame) == FrameWriter::EnqueueResult::Overflow) {
+            log_checkpoint("DB", "FOLLOWER_BEHIND", "fd=" + std::to_string(fd));
+            ::shutdown(fd, SHUT_RDWR); // the poll loop sees the hangup and drops it
+            return;
+        }
+    }
+}
+
+// The WAL tap: every durable group commit goes to every follower
+static void feed_followers(const std::string& records) {
+    for (auto& [fd, f] : g_followers) {
+        if (f.snapshot_child < 0) {
+            queue_wal(fd, records);
+        } else if (f.backlog.size() + records.size() <= kFollowerBacklogLimit) {
+            f.backlog += records;
+        } else {
+            log_checkpoint("DB", "FOLLOWER_BEHIND", "fd=" + std::to_string(fd) + " snapshot=1");
+            ::shutdown(fd, SHUT_RDWR);
+        }
+    }
+}
+
+// "Replica follow" on fd: everything applied so far is committed, so the
+// snapshot taken now is exactly lsn last_lsn() and the tap carries the rest
+static bool start_follower(int fd) {
+    if (g_read_only || !g_wal.commit()) return false;
+    const uint64_t lsn = g_wal.last_lsn();
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        // As in a checkpoint child: nothing that takes a lock (the async log)
+        // with every log inline: the replica has no segment files of its own
+        const std::string image =
+            encode_state(g_users, g_rooms, all_gamelogs(true), {}, g_next_room_id, g_next_game_id, lsn);
+        bool ok = lp_send_frame(fd, "SNAPSHOT lsn=" + std::to_string(lsn) + " bytes=" + std::to_string(image.size()));
+        for (size_t pos = 0; ok && pos < image.size(); pos += LP_MAX_FRAME) {
+            ok = lp_send_frame(fd, image.substr(pos, LP_MAX_FRAME));
+        }
+        ::_exit(ok ? 0 : 1);
+    }
+    if (pid < 0) {
+        perror("[DB] snapshot fork");
+        return false;
+    }
+    g_writers.insert_or_assign(fd, FrameWriter(LP_WRITE_HIGH_WATER, kFollowerQueueLimit));
+    g_followers[fd] = Follower{pid, lsn, {}};
+    db_metrics().followers.set(static_cast<int64_t>(g_followers.size()));
+    log_checkpoint("DB", "FOLLOWER_ATTACHED", "fd=" + std::to_string(fd) + " lsn=" + std::to_string(lsn));
+    return true;
+}
+
+// Poll thread: once a snapshot is out, the WAL held back behind it follows
+static void reap_followers() {
+    for (auto& [fd, f] : g_followers) {
+        if (f.snapshot_child < 0) continue;
+        int status = 0;
+        pid_t r = ::waitpid(f.snapshot_child, &status, WNOHANG);
+        if (r == 0 || (r < 0 && errno == EINTR)) continue;
+        const bool ok = r == f.snapshot_child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        f.snapshot_child = -1;
+        log_checkpoint("DB", ok ? "FOLLOWER_SNAPSHOT_SENT" : "FOLLOWER_SNAPSHOT_FAIL",
+                       "fd=" + std::to_string(fd) + " lsn=" + std::to_string(f.lsn) +
+                       " backlog=" + std::to_string(f.backlog.size()));
+        if (ok) queue_wal(fd, f.backlog);
+        else ::shutdown(fd, SHUT_RDWR);
+        std::string().swap(f.backlog);
+    }
+}
+
+static void forget_follower(int fd) {
+    auto it = g_followers.find(fd);
+    if (it == g_followers.end()) return;
+    if (it->second.snapshot_child > 0) {
+        ::kill(it->second.snapshot_child, SIGKILL);
+        ::waitpid(it->second.snapshot_child, nullptr, 0);
+    }
+    g_followers.erase(it);
+    db_metrics().followers.set(static_cast<int64_t>(g_followers.size()));
+}
+
+// Connects to the primary and replaces every table with its snapshot. Blocks
+// until the snapshot is in; returns the connection the WAL will follow on.
+static int follow_primary(const std::string& ip, uint16_t port) {
+    int fd = connect_tcp(ip, port);
+    if (fd < 0) return -1;
+    timeval tv{kSnapshotTimeoutSecs, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    std::string header, image, chunk;
+    unsigned long long lsn = 0;
+    size_t bytes = 0;
+    bool ok = lp_send_frame(fd, "Replica follow") && lp_recv_frame(fd, header) &&
+              std::sscanf(header.c_str(), "SNAPSHOT lsn=%llu bytes=%zu", &lsn, &bytes) == 2 &&
+              bytes >= kStatePrefixSize + 16;
+    if (ok) image.reserve(bytes);
+    while (ok && image.size() < bytes) {
+        ok = lp_recv_frame(fd, chunk);
+        image += chunk;
+    }
+    UserTable users;
+    std::unordered_map<int, RoomRec> rooms;
+    std::vector<GameLogRec> gamelogs;
+    std::vector<uint32_t> segments;
+    int next_room_id = 1, next_game_id = 1;
+    uint64_t loaded_lsn = 0;
+    ok = ok && image.size() == bytes &&
+         load_state_binary(reinterpret_cast<const unsigned char*>(image.data()), image.size(), users, rooms, gamelogs,
+                           segments, next_room_id, next_game_id, loaded_lsn) &&
+         loaded_lsn == lsn && segments.empty();
+    if (!ok) {
+        log_checkpoint("DB", "SNAPSHOT_FAIL", ip + ":" + std::to_string(port));
+        ::close(fd);
+        return -1;
+    }
+    g_users = std::move(users);
+    g_rooms = std::move(rooms);
+    g_gamelogs.clear();
+    g_replica_logs.clear();
+    g_next_room_id = next_room_id;
+    g_next_game_id = next_game_id;
+    split_replica_logs(gamelogs);
+    rebuild_indexes();
+    g_applied_lsn = loaded_lsn;
+    g_primary_stream.clear();
+    db_metrics().applied_lsn.set(static_cast<int64_t>(g_applied_lsn));
+    log_checkpoint("DB", "SNAPSHOT_LOADED",
+                   "users=" + std::to_string(g_users.size()) + " rooms=" + std::to_string(g_rooms.size()) +
+                   " logs=" + std::to_string(g_gamelogs.size()) + " lsn=" + std::to_string(g_applied_lsn));
+    return fd;
+}
+
+// Applies the complete records of a W frame; false on a gap or a corrupt
+// record, after which only a new snapshot can bring the replica back in step
+static bool apply_primary_wal(std::string_view bytes) {
+    g_primary_stream.append(bytes);
+    std::string payload;
+    size_t start = 0, nl;
+    bool ok = true;
+    g_replaying = true;
+    while ((nl = g_primary_stream.find('\n', start)) != std::string::npos) {
+        uint64_t lsn = 0;
+        if (!WriteAheadLog::parse_record(std::string_view(g_primary_stream).substr(start, nl - start), lsn, payload) ||
+            lsn != g_applied_lsn + 1) {
+            log_checkpoint("DB", "PRIMARY_STREAM_BROKEN", "lsn=" + std::to_string(lsn) +
+                                                              " expected=" + std::to_string(g_applied_lsn + 1));
+            ok = false;
+            break;
+        }
+        apply_wal_record(payload);
+        g_applied_lsn = lsn;
+        start = nl + 1;
+    }
+    g_replaying = false;
+    g_primary_stream.erase(0, start);
+    db_metrics().applied_lsn.set(static_cast<int64_t>(g_applied_lsn));
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    install_signal_handlers();
+
+    std::string ip = "0.0.0.0";
+    uint16_t port = 12977;
+    std::string state_file = "db_state.txt";
+
+    // allow overrides but default is zero-config
+    if (argc >= 2) ip = argv[1];
+    if (argc >= 3) port = static_cast<uint16_t>(std::stoi(argv[2]));
+    if (argc >= 4) state_file = argv[3];
+    // db_server <ip> <port> <state> [--export-text <out>] [--shard <k>/<n>] [--metrics-port <p>]
+    //                               [--replica-of <ip>:<port>]
+    //   --export-text: dump the state as text and exit
+    //   --shard: run as shard k of n (every shard and client must agree on n)
+    //   --metrics-port: serve Prometheus metrics over HTTP on ip:p
+    //   --replica-of: serve reads from a copy of that primary (see Read
+    //                 replicas); <state> is not used
+    std::string export_path;
+    int metrics_port = -1;
+    std::string primary_ip;
+    uint16_t primary_port = 0;
+    for (int i = 4; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--export-text") {
+            export_path = argv[i + 1];
+        } else if (flag == "--replica-of") {
+            std::string primary = argv[i + 1];
+            size_t colon = primary.rfind(':');
+            if (colon == std::string::npos) {
+                std::cerr << "[DB] bad --replica-of " << primary << ", expected ip:port\n";
+                return 1;
+            }
+            primary_ip = primary.substr(0, colon);
+            primary_port = static_cast<uint16_t>(std::stoi(primary.substr(colon + 1)));
+            g_read_only = true;
+        } else if (flag == "--metrics-port") {
+            metrics_port = std::stoi(argv[i + 1]);
+        } else if (flag == "--shard") {
+            size_t k = 0, n = 0;
+            if (std::sscanf(argv[i + 1], "%zu/%zu", &k, &n) != 2 || n == 0 || k >= n) {
+                std::cerr << "[DB] bad --shard " << argv[i + 1] << ", expected k/n\n";
+                return 1;
+            }
+            g_ring = ShardRing(n);
+            g_shard = k;
+        }
+    }
+    if (g_ring.shards() > 1) {
+        log_checkpoint("DB", "SHARD", std::to_string(g_shard) + "/" + std::to_string(g_ring.shards()));
+    }
+
+    register_command_metrics();
+    Checkpointer checkpointer(state_file);
+    if (g_read_only) {
+        g_primary_fd = follow_primary(primary_ip, primary_port);
+        if (g_primary_fd < 0) {
+            std::cerr << "[DB] cannot follow " << primary_ip << ":" << primary_port << "\n";
+            return 1;
+        }
+    } else {
+        uint64_t lsn = 0;
+        std::vector<GameLogRec> gamelogs;
+        std::vector<uint32_t> segments;
+        bool loaded = load_state(state_file, g_users, g_rooms, gamelogs, segments, g_next_room_id, g_next_game_id, lsn);
+        std::string segment_error;
+        if (loaded && !g_gamelogs.open(gamelog_dir(state_file), segments,
+                                       [](std::string_view name) { return g_names.intern(name); }, segment_error)) {
+            std::cerr << "[DB] cannot open game log segment " << segment_error << ", refusing to start\n";
+            return 1;
+        }
+        split_replica_logs(gamelogs);
+        if (loaded) {
+            log_checkpoint("DB", "STATE_LOADED",
+                           "users=" + std::to_string(g_users.size()) +
+                           " rooms=" + std::to_string(g_rooms.size()) +
+                           " logs=" + std::to_string(g_gamelogs.size()) +
+                           " lsn=" + std::to_string(lsn));
+        } else if (::access(state_file.c_str(), F_OK) == 0) {
+            // Starting empty would checkpoint over whatever is still recoverable
+            std::cerr << "[DB] cannot load " << state_file << ", refusing to start\n";
+            return 1;
+        } else {
+            log_checkpoint("DB", "STATE_NEW", state_file);
+        }
+        rebuild_indexes();
+
+        // Checkpoint first, then the WAL tail after it: the segment left by an
+        // unfinished checkpoint (if any), then the live one
+        const std::string wal_file = state_file + ".wal";
+        size_t replayed = 0;
+        g_replaying = true;
+        for (const std::string& path : {checkpointer.old_wal(), wal_file}) {
+            lsn = WriteAheadLog::replay(path, lsn, [&](uint64_t, const std::string& payload) {
+                apply_wal_record(payload);
+                ++replayed;
+            });
+        }
+        g_replaying = false;
+        log_checkpoint("DB", "WAL_REPLAYED", "records=" + std::to_string(replayed) + " lsn=" + std::to_string(lsn));
+
+        if (!export_path.empty()) {
+            bool ok = export_state_text(export_path, g_users, g_rooms, all_gamelogs(true), g_next_room_id, g_next_game_id, lsn);
+            std::cerr << "[DB] " << (ok ? "exported " : "failed to export ") << export_path << "\n";
+            return ok ? 0 : 1;
+        }
+        if (!g_wal.open(wal_file, lsn + 1)) return 1;
+
+        mark_all_users_offline();
+        g_wal.append(kWalResetOnline);
+        g_wal.commit();
+        g_wal.set_tap(feed_followers);
+    }
+
+    int listen_fd = start_tcp_server(ip.c_str(), port);
+    if (listen_fd < 0) return 1;
+    std::cerr << "[DB] listening on " << ip << ":" << port << "\n";
+    log_checkpoint("DB", "LISTENING", ip + ":" + std::to_string(port));
+
+    MetricsHttpServer metrics_http;
+    if (metrics_port >= 0) {
+        uint16_t mport = static_cast<uint16_t>(metrics_port);
+        if (!metrics_http.start(ip.c_str(), mport)) return 1;
+        std::cerr << "[DB] metrics on " << ip << ":" << mport << "\n";
+    }
+
+    std::vector<pollfd> pfds;
+    pfds.push_back({listen_fd, POLLIN, 0});
+    if (g_primary_fd >= 0) pfds.push_back({g_primary_fd, POLLIN, 0});
+    // Clients may send requests back to back, so one read can carry several
+    std::unordered_map<int, FrameReader> readers;
+    auto last_resync = std::chrono::steady_clock::now();
+    auto last_sweep = last_resync;
+
+    auto drop_client = [&](size_t& i) {
+        int cfd = pfds[i].fd;
+        ::close(cfd);
+        readers.erase(cfd);
+        g_writers.erase(cfd);
+        forget_follower(cfd);
+        pfds.erase(pfds.begin() + i);
+        --i;
+        db_metrics().clients.add(-1);
+        log_checkpoint("DB", "CLIENT_DISCONNECTED", "fd=" + std::to_string(cfd));
+    };
+
+    // Replica: the stream from the primary broke; reads go on from what is here
+    auto lose_primary = [&](size_t& i) {
+        ::close(g_primary_fd);
+        readers.erase(g_primary_fd);
+        pfds.erase(pfds.begin() + i);
+        --i;
+        g_primary_fd = -1;
+        last_resync = std::chrono::steady_clock::now();
+        log_checkpoint("DB", "PRIMARY_LOST", "lsn=" + std::to_string(g_applied_lsn));
+    };
+
+    while (running) {
+        checkpointer.maybe_start();
+        reap_followers();
+        if (!g_read_only && g_wal.healthy() && std::chrono::steady_clock::now() - last_sweep >= kSweepInterval) {
+            last_sweep = std::chrono::steady_clock::now();
+            sweep_idle(last_sweep);
+        }
+        if (g_read_only && g_primary_fd < 0 && std::chrono::steady_clock::now() - last_resync >= kResyncInterval) {
+            last_resync = std::chrono::steady_clock::now();
+            g_primary_fd = follow_primary(primary_ip, primary_port);
+            if (g_primary_fd >= 0) pfds.push_back({g_primary_fd, POLLIN, 0});
+        }
+        // Replies wait for the WAL records they answer: none go out while a
+        // failed commit is still pending
+        const bool durable = !g_wal.pending();
+        for (auto& p : pfds) {
+            auto wit = g_writers.find(p.fd);
+            bool want_out = durable && wit != g_writers.end() && wit->second.pending();
+            p.events = static_cast<short>(POLLIN | (want_out ? POLLOUT : 0));
+        }
+        trace_poll_signal();
+        int rc;
+        {
+            TRACE_SCOPE("poll");
+            rc = ::poll(pfds.data(), pfds.size(), 500);
+        }
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        if (rc == 0 && durable) continue; // else retry the commit below
+
+        for (size_t i = 0; i < pfds.size(); ++i) {
+            if (pfds[i].fd == listen_fd) {
+                if (!(pfds[i].revents & POLLIN)) continue;
+                int cfd = ::accept(listen_fd, nullptr, nullptr);
+                if (cfd >= 0) {
+                    pfds.push_back({cfd, POLLIN, 0});
+                    db_metrics().clients.add(1);
+                    log_checkpoint("DB", "CLIENT_CONNECTED", "fd=" + std::to_string(cfd));
                 }
-                else if (coll == "Room" && action == "invite") { // **FIX: Added Invite**
-                    int rid = 0;
-                    auto user_it = kv_map.find("user");
-                    auto host_it = kv_map.find("host");
-                    if (!parse_int_field(kv_map, "roomId", rid)) {
-                        resp << "ERR invalid_roomId";
-                    } else if (host_it == kv_map.end() || host_it->second.empty()) {
-                        resp << "ERR missing_host";
-                    } else if (user_it == kv_map.end() || user_it->second.empty()) {
-                        resp << "ERR missing_user";
-                    } else {
-                        RoomRec* r = find_room(rid);
-                        if (!r) resp << "ERR not_found";
-                        else if (r->host != host_it->second) resp << "ERR not_host";
-                        else {
-                            r->inviteList.insert(user_it->second);
-                            resp << "OK invited=" << user_it->second;
-                        }
+            } else if (pfds[i].fd == g_primary_fd) {
+                if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                std::vector<std::string> frames;
+                FrameReader::ReadResult st = readers[g_primary_fd].read_from(g_primary_fd, frames);
+                bool ok = st == FrameReader::ReadResult::Ok;
+                for (const std::string& frame : frames) {
+                    if (frame[0] == 'W' && !apply_primary_wal(std::string_view(frame).substr(1))) {
+                        ok = false;
+                        break;
                     }
                 }
-                else if (coll == "Room" && action == "spectate") {
-                    int rid = 0;
-                    auto user_it = kv_map.find("user");
-                    if (!parse_int_field(kv_map, "roomId", rid)) {
-                        resp << "ERR invalid_roomId";
-                    } else if (user_it == kv_map.end() || user_it->second.empty()) {
-                        resp << "ERR missing_user";
-                    } else {
-                        RoomRec* r = find_room(rid);
-                        if (!r) resp << "ERR not_found";
-                        else if (r->status != "playing") resp << "ERR not_playing";
-                        else {
-                            r->spectators.insert(user_it->second);
-                            resp << "OK";
+                if (!ok) lose_primary(i);
+            } else {
+                int cfd = pfds[i].fd;
+                bool ok = true;
+                if ((pfds[i].revents & POLLOUT) && durable) ok = g_writers[cfd].flush(cfd);
+                if (ok && (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                    std::vector<std::string> frames;
+                    FrameReader::ReadResult st = readers[cfd].read_from(cfd, frames);
+                    for (const std::string& frame : frames) {
+                        log_communication_lazy("DB", "RX", [&] { return db_peer(cfd); }, frame);
+                        // Pipelining clients tag requests; the reply carries the same tag
+                        std::string tag, req;
+                        bool tagged = db_split_tag(frame, tag, req);
+                        if (req == "Replica follow") {
+                            // From here on the connection only carries the WAL
+                            ok = start_follower(cfd);
+                            if (!ok) break;
+                            continue;
                         }
-                    }
-                }
-                else if (coll == "Room" && action == "unspectate") {
-                    int rid = 0;
-                    auto user_it = kv_map.find("user");
-                    if (!parse_int_field(kv_map, "roomId", rid)) {
-                        resp << "ERR invalid_roomId";
-                    } else if (user_it == kv_map.end() || user_it->second.empty()) {
-                        resp << "ERR missing_user";
-                    } else {
-                        RoomRec* r = find_room(rid);
-                        if (!r) resp << "ERR not_found";
-                        else if (!r->spectators.erase(user_it->second)) resp << "ERR not_spectating";
-                        else resp << "OK";
-                    }
-                }
-                else if (coll == "Room" && action == "listInvites") { // **FIX: Added listInvites**
-                    auto user_it = kv_map.find("user");
-                    if (user_it == kv_map.end() || user_it->second.empty()) {
-                        resp << "ERR missing_user";
-                    } else {
-                        resp << "OK "; // Format: ID:Name:Host;
-                        for (auto &kv : g_rooms) {
-                            if (kv.second.inviteList.count(user_it->second)) {
-                                resp << kv.second.id << ":" << kv.second.name << ":" << kv.second.host << ";";
-                            }
+                        std::string resp = handle_request(req);
+                        if (tagged) resp = "#" + tag + " " + resp;
+                        if (!db_send_frame(cfd, resp)) {
+                            ok = false;
+                            break;
                         }
                     }
+                    if (st != FrameReader::ReadResult::Ok) ok = false;
                 }
-                // --- GameLog Collection ---
-                else if (coll == "GameLog" && action == "create") {
-                    int room_id = 0;
-                    int score1 = 0;
-                    int score2 = 0;
-                    auto user1_it = kv_map.find("user1");
-                    auto user2_it = kv_map.find("user2");
-                    if (!parse_int_field(kv_map, "roomId", room_id)) {
-                        resp << "ERR invalid_roomId";
-                    } else if (!parse_int_field(kv_map, "score1", score1)) {
-                        resp << "ERR invalid_score1";
-                    } else if (!parse_int_field(kv_map, "score2", score2)) {
-                        resp << "ERR invalid_score2";
-                    } else if (user1_it == kv_map.end() || user1_it->second.empty() ||
-                               user2_it == kv_map.end() || user2_it->second.empty()) {
-                        resp << "ERR missing_user";
-                    } else {
-                        GameLogRec g;
-                        g.id = g_next_game_id++;
-                        g.roomId = room_id;
-                        g.user1 = user1_it->second;
-                        g.user2 = user2_it->second;
-                        g.score1 = score1;
-                        g.score2 = score2;
-                        g_gamelogs.push_back(g); // **FIX: Correctly persist**
-                        resp << "OK gameId=" << g.id;
-                    }
-                }
-                else if (coll == "GameLog" && action == "list") { // **FIX: Added list**
-                    resp << "OK ";
-                    for (auto &g : g_gamelogs) {
-                         resp << "id=" << g.id << " room=" << g.roomId << " p1=" << g.user1 << " s1=" << g.score1 << " p2=" << g.user2 << " s2=" << g.score2 << ";";
-                    }
-                }
-                else {
-                    resp << "ERR unknown_command";
+                if (!ok) {
+                    // A client that hung up still gets what it asked for, if it
+                    // can and it is durable
+                    if (g_wal.commit()) g_writers[cfd].flush(cfd);
+                    drop_client(i);
                 }
+            }
+        }
 
-                std::string response = resp.str();
-                db_send_frame(cfd, response);
+        // Group commit: one sync for every mutation of this round, then the
+        // replies. A failed commit holds them (and refuses new mutations)
+        // until a later round's retry succeeds.
+        if (g_wal.pending()) {
+            MetricTimer timer(db_metrics().wal_commit);
+            TRACE_SCOPE("wal_commit");
+            const bool was_healthy = g_wal.healthy();
+            if (!g_wal.commit()) {
+                if (was_healthy) log_checkpoint("DB", "WAL_COMMIT_FAIL", "lsn=" + std::to_string(g_wal.last_lsn()));
+            } else if (!was_healthy) {
+                log_checkpoint("DB", "WAL_RECOVERED", "lsn=" + std::to_string(g_wal.last_lsn()));
+            }
+        }
+        update_table_gauges();
+        for (size_t i = 1; i < pfds.size() && !g_wal.pending(); ++i) {
+            auto wit = g_writers.find(pfds[i].fd);
+            if (wit != g_writers.end() && wit->second.pending() && !wit->second.flush(pfds[i].fd)) {
+                drop_client(i);
             }
         }
     }
 
     for (auto &p : pfds) {
         if (p.fd >= 0) ::close(p.fd);
+        forget_follower(p.fd);
     }
-    save_state(state_file, g_users, g_rooms, g_gamelogs);
+    if (g_read_only) return 0;
+    // Nothing is lost without this; it only keeps the next startup's replay short
+    g_wal.commit();
+    checkpointer.wait();
+    checkpointer.maybe_start(true);
+    checkpointer.wait();
     log_checkpoint("DB", "STATE_SAVED",
                    "users=" + std::to_string(g_users.size()) +
                    " rooms=" + std::to_string(g_rooms.size()) +
@@ -0,0 +1,57 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Consistent-hash ring shared by the sharded db_servers and the clients that
+// route to them. Users are placed by username and rooms by id; every shard
+// owns kVirtualNodes points on the ring, so each owns about 1/N of the keys,
+// and changing the shard count moves only about 1/N of them.
+// Both sides must be built with the same shard count.
+class ShardRing {
+public:
+    static constexpr int kVirtualNodes = 64;
+
+    explicit ShardRing(size_t shards = 1) : shards_(std::max<size_t>(shards, 1)) {
+        points_.reserve(shards_ * kVirtualNodes);
+        for (size_t s = 0; s < shards_; ++s) {
+            for (int v = 0; v < kVirtualNodes; ++v) {
+                points_.emplace_back(hash("shard" + std::to_string(s) + "#" + std::to_string(v)), s);
+            }
+        }
+        std::sort(points_.begin(), points_.end());
+    }
+
+    size_t shards() const { return shards_; }
+
+    size_t shard_for(std::string_view key) const {
+        if (shards_ == 1) return 0;
+        uint64_t h = hash(key);
+        auto it = std::lower_bound(points_.begin(), points_.end(), std::make_pair(h, size_t{0}));
+        return (it == points_.end() ? points_.front() : *it).second;
+    }
+
+    size_t user_shard(std::string_view username) const {
+        return shard_for("u:" + std::string(username));
+    }
+    size_t room_shard(int room_id) const { return shard_for("r:" + std::to_string(room_id)); }
+    // Game ids are not routed on, only kept unique: each shard hands out its own
+    size_t game_shard(int game_id) const { return shard_for("g:" + std::to_string(game_id)); }
+
+private:
+    // FNV-1a with a final avalanche so nearby keys ("r:1", "r:2") spread out
+    static uint64_t hash(std::string_view key) {
+        uint64_t h = 1469598103934665603ull;
+        for (char c : key) h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    size_t shards_;
+    std::vector<std::pair<uint64_t, size_t>> points_;
+};
@@ -0,0 +1,193 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+// Append-only redo log for db_server. Each record is one line,
+//   <lsn> <crc32 of payload, hex> <payload>\n
+// holding a mutating request exactly as it was applied. append() only buffers;
+// commit() writes everything buffered since the last commit and fdatasyncs once,
+// so a whole poll round of mutations shares one flush (group commit). Replay
+// stops at the first torn or corrupt record, which open() then cuts off.
+// A failed commit keeps its records: a short or failed write resumes where it
+// stopped, and a failed fdatasync (after which the kernel may have dropped
+// the unsynced pages) cuts the file back to the last synced length and writes
+// the batch again. Until a commit succeeds the log is not healthy().
+// A tap, if set, sees every committed batch once it is durable (replication).
+class WriteAheadLog {
+public:
+    ~WriteAheadLog() { close(); }
+
+    static uint32_t crc32(const void* data, size_t size) {
+        static const auto table = [] {
+            struct { uint32_t v[256]; } t{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t.v[i] = c;
+            }
+            return t;
+        }();
+        uint32_t crc = 0xFFFFFFFFu;
+        const auto* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) crc = table.v[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    static uint32_t crc32(const std::string& data) { return crc32(data.data(), data.size()); }
+
+    // Splits one record line (without its newline) and checks its crc
+    static bool parse_record(std::string_view line, uint64_t& lsn, std::string& payload) {
+        const std::string text(line);
+        char* end = nullptr;
+        lsn = std::strtoull(text.c_str(), &end, 10);
+        if (end == text.c_str() || *end != ' ') return false;
+        const char* crc_text = end + 1;
+        uint32_t crc = static_cast<uint32_t>(std::strtoul(crc_text, &end, 16));
+        if (end == crc_text || *end != ' ') return false;
+        payload.assign(end + 1);
+        return crc32(payload) == crc;
+    }
+
+    // Calls fn(lsn, payload) for every intact record with lsn > after_lsn.
+    // Returns the highest lsn seen (after_lsn if none); valid_bytes is the
+    // length of the intact prefix.
+    template <typename Fn>
+    static uint64_t replay(const std::string& path, uint64_t after_lsn, Fn&& fn, off_t* valid_bytes = nullptr) {
+        uint64_t last = after_lsn;
+        off_t good = 0;
+        std::ifstream in(path, std::ios::binary);
+        std::string line, payload;
+        while (in.is_open() && std::getline(in, line)) {
+            if (in.eof()) break; // no newline: the write was torn
+            uint64_t lsn = 0;
+            if (!parse_record(line, lsn, payload)) break;
+            good += static_cast<off_t>(line.size() + 1);
+            if (lsn > after_lsn) fn(lsn, payload);
+            if (lsn > last) last = lsn;
+        }
+        if (valid_bytes) *valid_bytes = good;
+        return last;
+    }
+
+    // Opens (creating) path for appending after next_lsn - 1, dropping a torn tail
+    bool open(const std::string& path, uint64_t next_lsn) {
+        close();
+        path_ = path;
+        next_lsn_ = next_lsn;
+        off_t valid = 0;
+        replay(path, UINT64_MAX, [](uint64_t, const std::string&) {}, &valid);
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            perror("[DB] wal open");
+            return false;
+        }
+        if (::ftruncate(fd_, valid) < 0 || ::lseek(fd_, valid, SEEK_SET) < 0) {
+            perror("[DB] wal truncate");
+            close();
+            return false;
+        }
+        synced_size_ = valid;
+        written_ = 0;
+        rewind_ = false;
+        return true;
+    }
+
+    void close() {
+        if (fd_ >= 0) {
+            commit();
+            ::close(fd_);
+        }
+        fd_ = -1;
+    }
+
+    uint64_t append(const std::string& payload) {
+        uint64_t lsn = next_lsn_++;
+        char head[40];
+        std::snprintf(head, sizeof(head), "%llu %08x ", static_cast<unsigned long long>(lsn), crc32(payload));
+        buffer_ += head;
+        buffer_ += payload;
+        buffer_ += '\n';
+        ++records_since_checkpoint_;
+        return lsn;
+    }
+
+    // Writes and syncs the pending records; false when they are not durable
+    // yet, in which case they stay pending for the next commit
+    bool commit() {
+        if (buffer_.empty()) return healthy_ = true;
+        if (fd_ < 0) return healthy_ = false;
+        if (rewind_) {
+            if (::ftruncate(fd_, synced_size_) < 0 || ::lseek(fd_, synced_size_, SEEK_SET) < 0) {
+                perror("[DB] wal truncate");
+                return healthy_ = false;
+            }
+            written_ = 0;
+            rewind_ = false;
+        }
+        while (written_ < buffer_.size()) {
+            ssize_t w = ::write(fd_, buffer_.data() + written_, buffer_.size() - written_);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                perror("[DB] wal write");
+                return healthy_ = false;
+            }
+            written_ += static_cast<size_t>(w);
+        }
+        if (::fdatasync(fd_) != 0) {
+            perror("[DB] wal fdatasync");
+            rewind_ = true;
+            return healthy_ = false;
+        }
+        synced_size_ += static_cast<off_t>(buffer_.size());
+        if (tap_) tap_(buffer_);
+        buffer_.clear();
+        written_ = 0;
+        return healthy_ = true;
+    }
+
+    // False from a failed commit until one succeeds; the server takes no
+    // mutations and holds its replies back meanwhile
+    bool healthy() const { return healthy_; }
+
+    // fn(records) gets the raw lines of each commit, after they are synced
+    void set_tap(std::function<void(const std::string&)> fn) { tap_ = std::move(fn); }
+
+    // Commits, moves the current file to old_path and starts an empty one, so a
+    // checkpoint can cover everything in old_path and then delete it
+    bool rotate(const std::string& old_path) {
+        if (!commit()) return false;
+        ::close(fd_);
+        fd_ = -1;
+        bool moved = ::rename(path_.c_str(), old_path.c_str()) == 0;
+        if (!moved) perror("[DB] wal rotate");
+        return open(path_, next_lsn_) && moved;
+    }
+
+    uint64_t last_lsn() const { return next_lsn_ - 1; }
+    // Records appended but not yet committed
+    bool pending() const { return !buffer_.empty(); }
+    // Records appended since the last checkpoint began
+    size_t records_since_checkpoint() const { return records_since_checkpoint_; }
+    void checkpoint_started() { records_since_checkpoint_ = 0; }
+
+private:
+    std::string path_;
+    int fd_ = -1;
+    uint64_t next_lsn_ = 1;
+    std::string buffer_;
+    size_t written_ = 0;     // bytes of buffer_ already in the file
+    off_t synced_size_ = 0;  // file length as of the last fdatasync that succeeded
+    bool rewind_ = false;    // the last fdatasync failed: rewrite from synced_size_
+    bool healthy_ = true;
+    size_t records_since_checkpoint_ = 0;
+    std::function<void(const std::string&)> tap_;
+};
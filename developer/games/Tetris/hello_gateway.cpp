@@ -0,0 +1,145 @@
+#include "hello_gateway.hpp"
+
+#include "../core/common.hpp"
+#include "../core/lp_framing.hpp"
+#include "../core/reactor.hpp"
+#include "tetris_snapshot.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+constexpr int kIdleWaitMs = 500; // upper bound so the thread notices stop()
+constexpr size_t kMaxHelloBytes = 512; // a HELLO frame is a few short key=value pairs
+constexpr int kHelloTimeoutMs = 5000;  // connections that never send one are dropped
+
+// Peeks the first frame of a fresh connection without consuming it.
+// 1: a whole HELLO with a token is buffered; 0: wait for more bytes;
+// -1: closed, or not a HELLO worth routing.
+int peek_hello(int fd, HelloRoute& route) {
+    char buf[4 + kMaxHelloBytes];
+    ssize_t n = ::recv(fd, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0) return -1;
+    if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    if (n < 4) return 0;
+    uint32_t netlen = 0;
+    std::memcpy(&netlen, buf, 4);
+    const uint32_t len = ntohl(netlen);
+    if (len == 0 || len > kMaxHelloBytes) return -1;
+    if (static_cast<size_t>(n) < 4 + len) return 0;
+    std::string_view hello(buf + 4, len);
+    if (hello.substr(0, 6) != "HELLO ") return -1;
+    route.token.assign(hello_field(hello, "token"));
+    route.spectator = hello_field(hello, "role") == "SPEC";
+    route.binary = hello_field(hello, "snap") == SNAP_BIN_TAG;
+    return route.token.empty() ? -1 : 1;
+}
+}
+
+std::string_view hello_field(std::string_view hello, std::string_view key) {
+    for (size_t pos = hello.find(' '); pos != std::string_view::npos; pos = hello.find(' ', pos + 1)) {
+        std::string_view rest = hello.substr(pos + 1);
+        if (rest.size() > key.size() && rest.substr(0, key.size()) == key && rest[key.size()] == '=') {
+            rest.remove_prefix(key.size() + 1);
+            return rest.substr(0, rest.find(' '));
+        }
+    }
+    return {};
+}
+
+void reject_hello(int fd) {
+    // Consume the peeked HELLO first: closing with unread input sends a reset
+    // that can overtake the ERR
+    char sink[4 + kMaxHelloBytes];
+    while (::recv(fd, sink, sizeof(sink), MSG_DONTWAIT) > 0) {}
+    lp_send_frame(fd, "ERR invalid_player_or_token");
+    ::close(fd);
+}
+
+HelloGateway::~HelloGateway() {
+    stop();
+    if (listen_fd_ >= 0) ::close(listen_fd_);
+}
+
+bool HelloGateway::listen(const char* ip, uint16_t& port) {
+    if (listen_fd_ >= 0) return false;
+    listen_fd_ = start_tcp_server(ip, port);
+    if (listen_fd_ < 0) return false;
+    port_ = port;
+    return true;
+}
+
+bool HelloGateway::adopt(int listen_fd) {
+    if (listen_fd_ >= 0 || listen_fd < 0) return false;
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    if (::getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0) return false;
+    listen_fd_ = listen_fd;
+    port_ = ntohs(addr.sin_port);
+    return true;
+}
+
+int HelloGateway::release() {
+    stop();
+    int fd = listen_fd_;
+    listen_fd_ = -1;
+    return fd;
+}
+
+bool HelloGateway::start(RouteFn route) {
+    if (listen_fd_ < 0 || thread_.joinable()) return false;
+    route_ = std::move(route);
+    stop_.store(false);
+    thread_ = std::thread([this] { run(); });
+    return true;
+}
+
+void HelloGateway::stop() {
+    if (!thread_.joinable()) return;
+    stop_.store(true);
+    thread_.join();
+}
+
+void HelloGateway::run() {
+    Reactor reactor;
+    if (!reactor.ok()) return;
+    std::unordered_map<int, uint64_t> waiting; // fd -> its HELLO timeout
+    auto forget = [&](int fd) {
+        reactor.remove(fd);
+        reactor.cancel(waiting[fd]);
+        waiting.erase(fd);
+    };
+    auto try_route = [&](int fd) {
+        HelloRoute hello;
+        int st = peek_hello(fd, hello);
+        if (st == 0) return;
+        forget(fd);
+        if (st < 0) reject_hello(fd);
+        else route_(fd, hello);
+    };
+
+    // Level-triggered listener: one accept per wakeup, the rest come next round
+    reactor.add(listen_fd_, EPOLLIN, [&](uint32_t) {
+        int cfd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (cfd < 0) return;
+        if (!reactor.add(cfd, EPOLLIN | EPOLLRDHUP | EPOLLET, [&try_route, cfd](uint32_t) { try_route(cfd); })) {
+            ::close(cfd);
+            return;
+        }
+        waiting[cfd] = reactor.after(kHelloTimeoutMs, [&forget, cfd] {
+            forget(cfd);
+            ::close(cfd);
+        });
+        try_route(cfd); // the HELLO often arrives right behind the handshake
+    });
+
+    while (running && !stop_.load()) reactor.run_once(kIdleWaitMs);
+    reactor.remove(listen_fd_);
+    for (auto const& [fd, timer] : waiting) ::close(fd);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// What a connection's HELLO frame says about where it should go
+struct HelloRoute {
+    std::string token;
+    bool spectator = false; // role=SPEC
+    bool binary = false;    // snap=bin2
+};
+
+// A listener whose connections are routed by their first frame. One thread,
+// running a core Reactor, accepts and holds each connection (edge-triggered)
+// until its HELLO is fully buffered, then hands the fd to the route callback.
+// The HELLO is only peeked, so whoever takes the fd reads it exactly as if it
+// had accepted it itself.
+// Connections that never send one are closed after a few seconds.
+class HelloGateway {
+public:
+    using RouteFn = std::function<void(int fd, const HelloRoute& hello)>;
+
+    HelloGateway() = default;
+    ~HelloGateway();
+    HelloGateway(const HelloGateway&) = delete;
+    HelloGateway& operator=(const HelloGateway&) = delete;
+
+    // Opens ip:port (0 picks a free port and writes it back)
+    bool listen(const char* ip, uint16_t& port);
+    // Serves a listening socket opened elsewhere (by a predecessor process)
+    bool adopt(int listen_fd);
+    uint16_t port() const { return port_; }
+    bool listening() const { return listen_fd_ >= 0; }
+    int listen_fd() const { return listen_fd_; }
+
+    // route runs on the gateway thread and owns the fd from then on
+    bool start(RouteFn route);
+    void stop();
+    // Stops and gives up the listening socket (-1 if none), to be served by
+    // someone else; connections still waiting for their HELLO are closed
+    int release();
+
+private:
+    void run();
+
+    int listen_fd_ = -1;
+    uint16_t port_ = 0;
+    RouteFn route_;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+// Value of " key=" in a HELLO line, empty when absent
+std::string_view hello_field(std::string_view hello, std::string_view key);
+
+// Turns away a routed connection whose HELLO is still unread: consumes it,
+// answers ERR invalid_player_or_token and closes the fd
+void reject_hello(int fd);
@@ -0,0 +1,106 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads, each draining its own FIFO. Tasks posted with the same
+// key always run on the same thread in posting order, so per-key work stays
+// serialized without a lock while different keys run in parallel. With no
+// threads started, post() runs the task inline.
+class KeyedWorkerPool {
+public:
+    using Task = std::function<void()>;
+
+    KeyedWorkerPool() = default;
+    KeyedWorkerPool(const KeyedWorkerPool&) = delete;
+    KeyedWorkerPool& operator=(const KeyedWorkerPool&) = delete;
+    ~KeyedWorkerPool() { stop(); }
+
+    void start(size_t threads) {
+        stop();
+        for (size_t i = 0; i < threads; ++i) {
+            auto lane = std::make_unique<Lane>();
+            Lane* raw = lane.get();
+            lane->thread = std::thread([this, raw] { run(*raw); });
+            lanes_.push_back(std::move(lane));
+        }
+    }
+
+    size_t threads() const { return lanes_.size(); }
+
+    // Run on a thread right before and after each batch it takes off its
+    // queue, e.g. to hold back output until the whole batch has made it.
+    // Set before start().
+    void set_batch_hooks(Task before, Task after) {
+        before_batch_ = std::move(before);
+        after_batch_ = std::move(after);
+    }
+
+    void post(size_t key, Task task) {
+        if (lanes_.empty()) {
+            task();
+            return;
+        }
+        Lane& lane = *lanes_[key % lanes_.size()];
+        {
+            std::lock_guard<std::mutex> lock(lane.mutex);
+            lane.queue.push_back(std::move(task));
+        }
+        lane.cv.notify_one();
+    }
+
+    // Tasks posted for key's thread that it has not picked up yet
+    size_t backlog(size_t key) {
+        if (lanes_.empty()) return 0;
+        Lane& lane = *lanes_[key % lanes_.size()];
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        return lane.queue.size();
+    }
+
+    // Runs whatever is still queued, then joins every thread
+    void stop() {
+        for (auto& lane : lanes_) {
+            {
+                std::lock_guard<std::mutex> lock(lane->mutex);
+                lane->stopping = true;
+            }
+            lane->cv.notify_one();
+        }
+        for (auto& lane : lanes_) {
+            if (lane->thread.joinable()) lane->thread.join();
+        }
+        lanes_.clear();
+    }
+
+private:
+    struct Lane {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Task> queue;
+        bool stopping = false;
+        std::thread thread;
+    };
+
+    void run(Lane& lane) {
+        std::unique_lock<std::mutex> lock(lane.mutex);
+        for (;;) {
+            lane.cv.wait(lock, [&] { return lane.stopping || !lane.queue.empty(); });
+            if (lane.queue.empty()) return;
+            std::deque<Task> batch;
+            batch.swap(lane.queue);
+            lock.unlock();
+            if (before_batch_) before_batch_();
+            for (Task& task : batch) task();
+            if (after_batch_) after_batch_();
+            lock.lock();
+        }
+    }
+
+    std::vector<std::unique_ptr<Lane>> lanes_;
+    Task before_batch_;
+    Task after_batch_;
+};
@@ -0,0 +1,163 @@
+#include "lobby_bus.hpp"
+
+#include "../core/common.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+constexpr int kIdleWaitMs = 500;     // upper bound so the thread notices stop()
+constexpr int kSendTimeoutMs = 100;  // a peer that does not drain its queue in time misses the message
+constexpr int kRescanMs = 1000;      // how long a peer list is trusted
+
+bool bus_address(const std::string& path, sockaddr_un& addr) {
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+}
+
+LobbyBus::~LobbyBus() {
+    stop();
+}
+
+bool LobbyBus::open(const std::string& dir) {
+    if (fd_ >= 0) return false;
+    ::mkdir(dir.c_str(), 0700); // may exist already
+    dir_ = dir;
+    path_ = dir + "/" + std::to_string(::getpid()) + ".sock";
+    sockaddr_un addr;
+    if (!bus_address(path_, addr)) {
+        std::fprintf(stderr, "[Bus] socket path too long: %s\n", path_.c_str());
+        return false;
+    }
+    fd_ = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+        perror("[Bus] socket");
+        return false;
+    }
+    ::unlink(path_.c_str()); // left by an earlier process with our pid
+    int bytes = static_cast<int>(kMaxMessage * 4);
+    ::setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+    ::setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+    timeval tv{0, kSendTimeoutMs * 1000};
+    ::setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (::bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("[Bus] bind");
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    refresh_peers(true);
+    log_checkpoint("Bus", "OPEN", path_ + " peers=" + std::to_string(peer_count()));
+    return true;
+}
+
+bool LobbyBus::start(Handler handler) {
+    if (fd_ < 0 || thread_.joinable()) return false;
+    handler_ = std::move(handler);
+    stop_.store(false);
+    thread_ = std::thread([this] { run(); });
+    return true;
+}
+
+void LobbyBus::stop() {
+    if (thread_.joinable()) {
+        stop_.store(true);
+        thread_.join();
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        ::unlink(path_.c_str());
+        fd_ = -1;
+    }
+}
+
+void LobbyBus::publish(const std::string& msg) {
+    if (fd_ < 0) return;
+    refresh_peers(false);
+    std::vector<std::string> peers;
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        peers = peers_;
+    }
+    for (auto const& peer : peers) send_one(peer, msg);
+}
+
+void LobbyBus::send_to(const std::string& peer, const std::string& msg) {
+    if (fd_ >= 0) send_one(peer, msg);
+}
+
+size_t LobbyBus::peer_count() {
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    return peers_.size();
+}
+
+bool LobbyBus::send_one(const std::string& peer, const std::string& msg) {
+    sockaddr_un addr;
+    if (msg.empty() || msg.size() > kMaxMessage || !bus_address(peer, addr)) return false;
+    ssize_t n;
+    do {
+        n = ::sendto(fd_, msg.data(), msg.size(), MSG_NOSIGNAL, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    } while (n < 0 && errno == EINTR);
+    if (n >= 0) return true;
+    if (errno == ECONNREFUSED || errno == ENOENT) {
+        // Nobody bound there any more: the process is gone
+        ::unlink(peer.c_str());
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        std::erase(peers_, peer);
+        log_checkpoint("Bus", "PEER_GONE", peer);
+    } else {
+        log_checkpoint("Bus", "SEND_FAIL", peer + " errno=" + std::to_string(errno));
+    }
+    return false;
+}
+
+// Peers come and go rarely, so the directory is listed at most every kRescanMs
+void LobbyBus::refresh_peers(bool force) {
+    const auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        if (!force && now - scanned_ < std::chrono::milliseconds(kRescanMs)) return;
+        scanned_ = now;
+    }
+    std::vector<std::string> found;
+    if (DIR* d = ::opendir(dir_.c_str())) {
+        while (dirent* e = ::readdir(d)) {
+            const std::string name = e->d_name;
+            if (name.size() < 6 || name.compare(name.size() - 5, 5, ".sock") != 0) continue;
+            const std::string path = dir_ + "/" + name;
+            if (path != path_) found.push_back(path);
+        }
+        ::closedir(d);
+    }
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    peers_.swap(found);
+}
+
+void LobbyBus::run() {
+    std::string msg(kMaxMessage, '\0');
+    while (running && !stop_.load()) {
+        pollfd pfd{fd_, POLLIN, 0};
+        if (::poll(&pfd, 1, kIdleWaitMs) <= 0) continue;
+        sockaddr_un from{};
+        socklen_t from_len = sizeof(from);
+        ssize_t n = ::recvfrom(fd_, msg.data(), msg.size(), MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&from), &from_len);
+        if (n <= 0) continue;
+        const size_t path_len = from_len > offsetof(sockaddr_un, sun_path)
+                                    ? ::strnlen(from.sun_path, from_len - offsetof(sockaddr_un, sun_path))
+                                    : 0;
+        handler_(msg.substr(0, static_cast<size_t>(n)), std::string(from.sun_path, path_len));
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pub/sub between the lobby processes of one host that share a port
+// (SO_REUSEPORT). Every process binds a datagram socket <dir>/<pid>.sock;
+// publish() sends one datagram to each other socket in the directory, so there
+// is no broker and a process that exits simply stops being a peer (its socket
+// file is removed by whoever next fails to reach it). A message is one
+// datagram of at most kMaxMessage bytes, sent in order to each peer but not
+// ordered across senders. The receiving thread hands each one, with the
+// sender's socket path to reply to, to the handler.
+class LobbyBus {
+public:
+    using Handler = std::function<void(const std::string& msg, const std::string& from)>;
+    static constexpr size_t kMaxMessage = 64 * 1024;
+
+    LobbyBus() = default;
+    ~LobbyBus();
+    LobbyBus(const LobbyBus&) = delete;
+    LobbyBus& operator=(const LobbyBus&) = delete;
+
+    // Creates dir if needed and binds this process's socket there
+    bool open(const std::string& dir);
+    bool active() const { return fd_ >= 0; }
+
+    // handler runs on the bus thread
+    bool start(Handler handler);
+    // Stops the thread and removes this process's socket
+    void stop();
+
+    // From any thread. A peer whose queue stays full for kSendTimeoutMs misses it.
+    void publish(const std::string& msg);
+    void send_to(const std::string& peer, const std::string& msg);
+    size_t peer_count();
+
+private:
+    void run();
+    bool send_one(const std::string& peer, const std::string& msg);
+    void refresh_peers(bool force);
+
+    std::string dir_;
+    std::string path_;
+    int fd_ = -1;
+    Handler handler_;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+
+    std::mutex peers_mutex_;
+    std::vector<std::string> peers_; // other processes' socket paths
+    std::chrono::steady_clock::time_point scanned_{};
+};
@@ -1,14 +1,42 @@
-#include "common.hpp"
-#include "lp_framing.hpp"
+#include "../core/common.hpp"
+#include "../core/lp_framing.hpp"
+#include "../core/reactor.hpp"
 #include "tetris_runtime.hpp"
+#include "room_scheduler.hpp"
+#include "spectator_relay.hpp"
+#include "db_client.hpp"
+#include "keyed_worker_pool.hpp"
+#include "../core/metrics.hpp"
+#include "lobby_bus.hpp"
+#include "matchmaker.hpp"
+#include "rate_limit.hpp"
+#include "result_outbox.hpp"
+#include "server_config.hpp"
+#include "session_auth.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <set>
 #include <unordered_map>
 #include <string>
 #include <sstream>
 #include <iostream>
 #include <vector>
-#include <poll.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
 #include <unistd.h>
 #include <random> // For token generation
 
@@ -18,89 +46,417 @@ struct ClientInfo {
     bool authed = false;
     int fd = -1;
     int roomId = 0; // The ID of the room they are "in"
-    int spectateRoomId = 0; // Room being spectated
+    std::vector<int> spectateRooms; // Rooms being spectated, several for a grid view
 };
 
-// --- Global, thread-safe state ---
-static std::mutex g_clients_mutex;
-static std::unordered_map<int, ClientInfo> g_clients;
+static constexpr size_t kMaxSpectatedRooms = 16;
+
+// Commands by what they cost and how much they matter. Listings and spectating
+// have their own, smaller budgets, and are the first to go when a lane is behind
+// (server_config().shed_backlog tasks queued on it).
+enum class CommandClass { Play, Listing, Spectate, Count };
+struct CommandLimit {
+    double rate;  // per second
+    double burst;
+};
+// From server_config(), by class
+static std::array<CommandLimit, static_cast<size_t>(CommandClass::Count)> command_limits(const ServerConfig& cfg) {
+    return {{
+        {cfg.play_rate, cfg.play_burst},         // Play: everything else
+        {cfg.listing_rate, cfg.listing_burst},   // Listing: LIST_ROOMS, LIST_ONLINE, LEADERBOARD, STATS, ...
+        {cfg.spectate_rate, cfg.spectate_burst}, // Spectate: a grid view opens up to kMaxSpectatedRooms at once
+    }};
+}
+
+// Per-connection I/O state. The reader belongs to the I/O thread and the
+// command limits to the client's worker lane; the writer is shared with
+// whichever worker sends to this client, under write_mutex.
+struct LobbyConn {
+    explicit LobbyConn(int fd)
+        : fd(fd), writer(server_config().write_high_water, server_config().write_hard_limit) {
+        reset_limits(server_config());
+    }
+    void reset_limits(const ServerConfig& cfg) {
+        const auto budgets = command_limits(cfg);
+        for (size_t i = 0; i < limits.size(); ++i) limits[i].reset(budgets[i].rate, budgets[i].burst);
+        limits_version = cfg.version;
+    }
+    // Starts the command limits over once the config they came from is replaced
+    void refresh_limits(const ServerConfig& cfg) {
+        if (limits_version != cfg.version) reset_limits(cfg);
+    }
+    const int fd;
+    FrameReader reader;
+    std::array<TokenBucket, static_cast<size_t>(CommandClass::Count)> limits;
+    uint64_t limits_version = 0; // of the config the limits came from
+    std::mutex write_mutex;
+    FrameWriter writer;
+    bool closed = false; // set under write_mutex right before the fd is closed
+    bool corked = false; // under write_mutex: some thread's cork will flush it (see LobbyCork)
+};
+
+// --- Global, thread-safe state, sharded so no lock covers every client ---
+static constexpr unsigned kClientShards = 32;
+struct ClientEntry {
+    ClientInfo info;
+    std::shared_ptr<LobbyConn> conn;
+};
+struct ClientShard { // by fd
+    std::mutex mutex;
+    std::unordered_map<int, ClientEntry> clients;
+};
+// username -> connection it is logged in on, by username. Written only on
+// LOGIN/LOGOUT/disconnect, read by every push (GAME_READY, invites), hence
+// the reader/writer lock.
+struct UserShard {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<LobbyConn>> conns;
+};
+static ClientShard g_client_shards[kClientShards];
+static UserShard g_user_shards[kClientShards];
 // --- No g_rooms! DB is the source of truth ---
 
-static int db_fd = -1;
-static std::mutex g_db_mutex; // Mutex for DB connection
+static ShardedDbClient g_db("Lobby"); // pipelined, shared by the main loop and the room workers
+static constexpr size_t kDbConnections = 2;
+// Rooms per LIST_ROOMS reply; "LIST_ROOMS <last id>" fetches the next page
+static constexpr int kRoomPageSize = 50;
+// Entries per LEADERBOARD reply; "LEADERBOARD <last rank>" continues
+static constexpr int kLeaderboardPageSize = 20;
 static std::string g_db_ip;
 static uint16_t g_db_port = 0;
+static std::string g_trace_dir; // per-match replay traces, empty for none
+// Match results go to the DB through here, so a room ends without waiting for
+// it; the file is "--results-outbox <path>", lobby_results_<lobby port>.outbox by default
+static ResultOutbox g_results;
+
+static GameRegistry g_game_registry;
+static RoomScheduler g_room_scheduler; // one reactor per core hosts every running match
+static Matchmaker g_matchmaker;        // players waiting in QUEUE, see the matchmaking section
+// Binary spectators of every match are served from here, off the room workers;
+// null with "--relay-workers 0" (rooms serve their own spectators)
+static std::unique_ptr<SpectatorRelay> g_spectator_relay;
+static constexpr size_t kDefaultRelayWorkers = 1;
+// "--spectator-relay <host>:<port>": SPECTATE_READY sends viewers to that relay
+// (a tetris_relay following our game port) instead of the game port itself
+static std::string g_public_relay_host;
+static uint16_t g_public_relay_port = 0;
+static bool g_offer_udp = false; // "--udp": matches offer the datagram channel (udp_channel.hpp)
+// Several lobby processes may share the lobby port ("--processes <n>", or
+// "--reuseport" on each). Each has its own reactor, DB link, room scheduler and
+// game port; what one of them does that the others must know about goes over
+// this bus (lobby_bus.hpp), one line per message:
+//   NOTIFY user=<u>\n<frame>   push for a user logged in on another process
+//   ROOM room=<id>             re-read that room into the room cache
+//   MATCH room= token= port=   a match started there, for SPECTATE
+//   ROOM_FREE room= token=     ... and ended
+//   SYNC                       a new process asks for the running matches (MATCH replies)
+// Presence needs nothing extra: who is online is decided in the DB.
+static LobbyBus g_bus;
+// Commands run here, one lane per connection so each client's frames stay in
+// order; a slow DB reply only holds up the clients sharing its lane.
+// "--workers 0" runs them on the I/O thread.
+static KeyedWorkerPool g_workers;
+static constexpr size_t kDefaultWorkers = 4;
+// Open connections by fd, I/O thread only
+static std::unordered_map<int, std::shared_ptr<LobbyConn>> g_conns;
+// Clients whose socket may still hold data; read again before the next wait
+static std::vector<int> g_read_backlog;
+static constexpr int kReadBurst = 4; // reads per client per wakeup
+
+// Public room list served from memory (see the room cache section below)
+static std::shared_mutex g_room_cache_mutex;
+static std::map<int, std::string> g_room_rows; // id -> "id:name:host:status:visibility:p1:p2"
+static uint64_t g_room_version = 0;           // bumped by every applied change
+static std::unordered_map<int, std::shared_ptr<LobbyConn>> g_room_subscribers; // under g_room_cache_mutex
+static KeyedWorkerPool g_room_refresher;      // one thread, see refresh_room()
+static constexpr int kRoomLoadPageSize = 500;
+static void invalidate_room(int rid);
+
+// Who is online, mirrored from the DB (see the presence section below)
+static std::shared_mutex g_presence_mutex;
+static std::set<std::string> g_online;
+static uint64_t g_presence_version = 0;        // bumped by every pushed change
+static std::unordered_map<int, std::shared_ptr<LobbyConn>> g_presence_subscribers; // under g_presence_mutex
+static std::string g_presence_token = "0.0";  // the DB's, for the next since=; refresher thread only
+static std::atomic<bool> g_presence_poll_queued{false};
+static constexpr int kPresencePollMs = 500;
+static void presence_poll_soon();
 
-static std::mutex g_games_mutex;
-static std::unordered_map<int, uint16_t> g_game_ports;
-static std::unordered_map<int, std::string> g_game_tokens;
-static GameRegistry g_game_registry{&g_games_mutex, &g_game_ports, &g_game_tokens};
-static uint16_t g_next_game_port = 15000;
+// The DB lease this process logs users in under: renewed every kLeaseRenewMs
+// for kLeaseTtlMs, so if the lobby dies the DB sets its users offline itself.
+// A successor (hot restart) takes it over with the clients.
+static std::string g_lease_id;
+static constexpr int kLeaseRenewMs = 2000;
+static constexpr int kLeaseTtlMs = 10000;
+static void match_ended(int rid, const std::string& token); // see the hot restart section
 
 // Helper to generate a random token
 std::string generate_token() {
-    static std::mt19937 rng(std::random_device{}());
+    thread_local std::mt19937 rng(std::random_device{}());
     std::uniform_int_distribution<uint32_t> dist;
     std::stringstream ss;
     ss << std::hex << dist(rng) << dist(rng);
     return ss.str();
 }
 
+// Drawn afresh in each process, after the --processes fork
+static std::string new_lease_id() {
+    std::random_device rd;
+    std::stringstream ss;
+    ss << std::hex << rd() << rd();
+    return ss.str();
+}
+
+// --- Metrics (see metrics.hpp): STATS SERVER and --metrics-port ---
+static MetricGauge& g_metric_clients = metrics().gauge("lobby_clients", "Open lobby connections");
+static MetricCounter& g_metric_commands = metrics().counter("lobby_commands_total", "Client commands handled");
+static MetricCounter& g_metric_rate_limited =
+    metrics().counter("lobby_commands_rate_limited_total", "Client commands refused over their class's rate limit");
+static MetricCounter& g_metric_shed =
+    metrics().counter("lobby_commands_shed_total", "Listing and spectate commands refused while a lane was behind");
+static MetricCounter& g_metric_db_errors =
+    metrics().counter("lobby_db_errors_total", "DB requests that got no reply");
+
+// Round trip of DB requests, by "<Collection> <action>"; each thread keeps
+// the histograms it has used, so only a command's first use locks the registry
+static LatencyHistogram& db_latency(const std::string& cmd) {
+    thread_local std::unordered_map<std::string, LatencyHistogram*> cache;
+    size_t end = cmd.find('\n'); // a batch counts as one request
+    if (end == std::string::npos) {
+        end = cmd.find(' ');
+        if (end != std::string::npos) end = cmd.find(' ', end + 1);
+    }
+    std::string key = cmd.substr(0, end);
+    auto it = cache.find(key);
+    if (it != cache.end()) return *it->second;
+    LatencyHistogram& h = metrics().histogram("lobby_db_request_seconds", "Round trip of one DB request",
+                                              "command=\"" + key + "\"");
+    cache.emplace(std::move(key), &h);
+    return h;
+}
+
+static void lobby_flush_corked();
+
 static bool db_req(const std::string& cmd, std::string& reply) {
-    std::lock_guard<std::mutex> lock(g_db_mutex);
-    if (db_fd < 0) return false;
-    const std::string peer = "db:" + g_db_ip + ":" + std::to_string(g_db_port);
-    log_communication("Lobby", "TX", peer, cmd);
-    if (!lp_send_frame(db_fd, cmd)) return false;
-    if (!lp_recv_frame(db_fd, reply)) return false;
-    log_communication("Lobby", "RX", peer, reply);
-    return true;
+    lobby_flush_corked();
+    TRACE_SCOPE("db_req");
+    MetricTimer timer(db_latency(cmd));
+    bool ok = g_db.call(cmd, reply);
+    if (!ok) g_metric_db_errors.add();
+    return ok;
+}
+
+// For what may be a commit or so stale (lists, the leaderboard): a read
+// replica answers it when there is one (--db-replica)
+static bool db_read(const std::string& cmd, std::string& reply) {
+    lobby_flush_corked();
+    TRACE_SCOPE("db_read");
+    MetricTimer timer(db_latency(cmd));
+    bool ok = g_db.call_read(cmd, reply);
+    if (!ok) g_metric_db_errors.add();
+    return ok;
+}
+
+// Independent requests go out back to back and are awaited together
+static void db_req_all(const std::vector<std::string>& cmds) {
+    lobby_flush_corked();
+    TRACE_SCOPE("db_req_all");
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::future<DbReply>> replies;
+    replies.reserve(cmds.size());
+    for (auto const& cmd : cmds) replies.push_back(g_db.submit(cmd));
+    for (size_t i = 0; i < replies.size(); ++i) {
+        replies[i].wait();
+        db_latency(cmds[i]).record(std::chrono::steady_clock::now() - start);
+    }
+}
+
+// The DB-side cleanup for a user leaving: offline, out of their room and spectating
+static void db_release_user(const ClientInfo& cli) {
+    g_matchmaker.remove(cli.username);
+    std::vector<std::string> cmds{"User setOnline username=" + cli.username + " online=0"};
+    if (cli.roomId != 0) {
+        cmds.push_back("Room leave roomId=" + std::to_string(cli.roomId) + " user=" + cli.username);
+    }
+    for (int rid : cli.spectateRooms) {
+        cmds.push_back("Room unspectate roomId=" + std::to_string(rid) + " user=" + cli.username);
+    }
+    db_req_all(cmds);
+    presence_poll_soon();
+    if (cli.roomId != 0) invalidate_room(cli.roomId);
+}
+
+// Admin commands are only answered on connections from this host
+static bool is_loopback_peer(int fd) {
+    sockaddr_storage addr{};
+    socklen_t len = sizeof(addr);
+    if (::getpeername(fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0) return false;
+    if (addr.ss_family == AF_INET) {
+        return (ntohl(reinterpret_cast<const sockaddr_in&>(addr).sin_addr.s_addr) >> 24) == 127;
+    }
+    if (addr.ss_family == AF_INET6) {
+        const in6_addr& a = reinterpret_cast<const sockaddr_in6&>(addr).sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(&a) || (IN6_IS_ADDR_V4MAPPED(&a) && a.s6_addr[12] == 127);
+    }
+    return false;
 }
 
 static std::string peer_for_fd(const std::string& category, int fd) {
     return category + " fd=" + std::to_string(fd);
 }
 
-static bool lobby_send_frame(int fd, const std::string& body) {
-    log_communication("Lobby", "TX", peer_for_fd("client", fd), body);
-    return lp_send_frame(fd, body);
+static ClientShard& client_shard(int fd) {
+    return g_client_shards[static_cast<unsigned>(fd) % kClientShards];
 }
 
-static bool lobby_recv_client_frame(int fd, std::string& out) {
-    bool ok = lp_recv_frame(fd, out);
-    if (ok) {
-        log_communication("Lobby", "RX", peer_for_fd("client", fd), out);
-    }
-    return ok;
+static UserShard& user_shard(const std::string& username) {
+    return g_user_shards[std::hash<std::string>{}(username) % kClientShards];
 }
 
-static int open_game_listener(uint16_t& out_port) {
-    const uint16_t kMinPort = 15000;
-    const uint16_t kMaxPort = 60000;
-    if (g_next_game_port < kMinPort || g_next_game_port > kMaxPort) g_next_game_port = kMinPort;
-    for (int attempt = 0; attempt < 2000; ++attempt) {
-        uint16_t candidate = g_next_game_port;
-        uint16_t port = candidate;
-        int fd = start_tcp_server("0.0.0.0", port);
-        g_next_game_port = (candidate >= kMaxPort) ? kMinPort : static_cast<uint16_t>(candidate + 1);
-        if (fd >= 0) {
-            out_port = port;
-            return fd;
-        }
+// Copy of the client's state; false once it has disconnected
+static bool client_info(int fd, ClientInfo& out) {
+    ClientShard& shard = client_shard(fd);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.clients.find(fd);
+    if (it == shard.clients.end()) return false;
+    out = it->second.info;
+    return true;
+}
+
+// Applies fn to the client's state under its shard lock
+template <typename Fn>
+static void update_client(int fd, Fn&& fn) {
+    ClientShard& shard = client_shard(fd);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.clients.find(fd);
+    if (it != shard.clients.end()) fn(it->second.info);
+}
+
+static std::shared_ptr<LobbyConn> client_conn(int fd) {
+    ClientShard& shard = client_shard(fd);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.clients.find(fd);
+    return it == shard.clients.end() ? nullptr : it->second.conn;
+}
+
+// The connection username is logged in on, or null. Holding the connection
+// rather than its fd means a push can never land on a reused fd.
+static std::shared_ptr<LobbyConn> find_conn_by_username(const std::string& username) {
+    UserShard& shard = user_shard(username);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.conns.find(username);
+    return it == shard.conns.end() ? nullptr : it->second;
+}
+
+// Reserves username for fd's connection; false if it is logged in elsewhere
+static bool claim_username(const std::string& username, int fd) {
+    std::shared_ptr<LobbyConn> conn = client_conn(fd);
+    if (!conn) return false;
+    UserShard& shard = user_shard(username);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.conns.emplace(username, std::move(conn)).second;
+}
+
+static void release_username(const std::string& username, int fd) {
+    UserShard& shard = user_shard(username);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.conns.find(username);
+    if (it != shard.conns.end() && it->second->fd == fd) shard.conns.erase(it);
+}
+
+// A client whose queue overflows or whose socket fails is shut down; the I/O
+// thread then gets an edge, reads EOF and runs the usual disconnect path.
+static void lobby_fail_client(int fd) {
+    log_checkpoint("Lobby", "CLIENT_WRITE_FAIL", "fd=" + std::to_string(fd));
+    ::shutdown(fd, SHUT_RDWR);
+}
+
+// --- Corked sends ---
+// While a thread is corked (a worker lane's batch, a round of the main loop,
+// a match's finish callback) its frames are only queued, and each connection
+// it queued to is flushed once when the cork comes off: a reply and the pushes
+// after it (OK SPECTATE then SPECTATE_READY, a batch of ROOM_UPDATEs) leave in
+// one sendmsg. A connection some other thread's cork will flush is not listed
+// again; that flush takes, under write_mutex, whatever is queued by then. A
+// corked thread about to wait on the DB flushes first, so nobody's reply sits
+// behind someone else's round trip.
+struct LobbyCorkState {
+    int depth = 0;
+    std::vector<std::shared_ptr<LobbyConn>> conns;
+};
+static thread_local LobbyCorkState t_cork;
+static MetricCounter& g_metric_corked_frames =
+    metrics().counter("lobby_corked_frames_total", "Frames to clients held back for their connection's next flush");
+static MetricCounter& g_metric_cork_flushes =
+    metrics().counter("lobby_cork_flushes_total", "Connections flushed as a cork came off");
+
+static void lobby_cork() {
+    ++t_cork.depth;
+}
+
+static void lobby_flush_corked() {
+    if (t_cork.conns.empty()) return;
+    std::vector<std::shared_ptr<LobbyConn>> conns;
+    conns.swap(t_cork.conns);
+    g_metric_cork_flushes.add(conns.size());
+    for (auto const& conn : conns) {
+        std::lock_guard<std::mutex> lock(conn->write_mutex);
+        conn->corked = false;
+        if (!conn->closed && !conn->writer.flush(conn->fd)) lobby_fail_client(conn->fd);
     }
-    out_port = 0;
-    return -1;
 }
 
-// Helper to find a client's FD by username
-int find_fd_by_username(const std::string& username) {
-    std::lock_guard<std::mutex> lock(g_clients_mutex);
-    for (auto const& [fd, client] : g_clients) {
-        if (client.authed && client.username == username) {
-            return fd;
+static void lobby_uncork() {
+    if (t_cork.depth == 0 || --t_cork.depth > 0) return;
+    lobby_flush_corked();
+}
+
+struct LobbyCork {
+    LobbyCork() { lobby_cork(); }
+    ~LobbyCork() { lobby_uncork(); }
+    LobbyCork(const LobbyCork&) = delete;
+    LobbyCork& operator=(const LobbyCork&) = delete;
+};
+
+// Queued and flushed without blocking (on uncorking, if the thread is corked);
+// the rest goes out on EPOLLOUT. Safe from any thread.
+static bool lobby_send_to(const std::shared_ptr<LobbyConn>& conn, const std::string& body) {
+    log_communication_lazy("Lobby", "TX", [&] { return peer_for_fd("client", conn->fd); }, body);
+    LpFrame frame = lp_prepare_frame(body);
+    if (!frame) return false;
+    std::lock_guard<std::mutex> lock(conn->write_mutex);
+    if (conn->closed) return false;
+    if (conn->writer.enqueue(frame) == FrameWriter::EnqueueResult::Overflow) {
+        lobby_fail_client(conn->fd);
+        return false;
+    }
+    if (t_cork.depth > 0) {
+        g_metric_corked_frames.add();
+        if (!conn->corked) {
+            conn->corked = true;
+            t_cork.conns.push_back(conn);
         }
+        return true;
+    }
+    if (!conn->writer.flush(conn->fd)) {
+        lobby_fail_client(conn->fd);
+        return false;
     }
-    return -1;
+    return true;
+}
+
+static bool lobby_send_frame(int fd, const std::string& body) {
+    std::shared_ptr<LobbyConn> conn = client_conn(fd);
+    return conn && lobby_send_to(conn, body);
+}
+
+// Push to whoever is logged in as username; false if nobody is here (the
+// other lobby processes, if any, are asked to deliver it)
+static bool lobby_notify_user(const std::string& username, const std::string& body) {
+    std::shared_ptr<LobbyConn> conn = find_conn_by_username(username);
+    if (conn) return lobby_send_to(conn, body);
+    if (g_bus.active()) g_bus.publish("NOTIFY user=" + username + "\n" + body);
+    return false;
 }
 
 // Helper to parse "OK ..." replies from DB
@@ -121,489 +477,1949 @@ std::unordered_map<std::string, std::string> parse_ok_reply(const std::string& r
     return map;
 }
 
-int main(int argc, char** argv) {
-    install_signal_handlers();
+// Value of key= in a "VERB key=value ..." message between lobby processes
+static std::string message_field(std::string_view msg, std::string_view key) {
+    return std::string(hello_field(msg, key));
+}
 
-    std::string ip = "0.0.0.0";
-    uint16_t lobby_port = 13472;
-    g_db_ip = "127.0.0.1";
-    g_db_port = 12977;
+static int message_int(std::string_view msg, std::string_view key) {
+    return std::atoi(message_field(msg, key).c_str());
+}
 
-    if (argc >= 2) ip = argv[1];
-    if (argc >= 3) lobby_port = static_cast<uint16_t>(std::stoi(argv[2]));
-    if (argc >= 4) g_db_ip = argv[3];
-    if (argc >= 5) g_db_port = static_cast<uint16_t>(std::stoi(argv[4]));
+// "1,2,3" in such a message; an empty list is "0" (nothing, before lists)
+static std::string join_ints(const std::vector<int>& values) {
+    std::string out;
+    for (int v : values) out += (out.empty() ? "" : ",") + std::to_string(v);
+    return out.empty() ? "0" : out;
+}
 
-    db_fd = connect_tcp(g_db_ip, g_db_port);
-    if (db_fd < 0) { std::cerr << "[Lobby] cannot connect to DB\n"; return 1; }
-    log_checkpoint("Lobby", "DB_CONNECTED", g_db_ip + ":" + std::to_string(g_db_port));
+static std::vector<int> split_ints(std::string_view text) {
+    std::vector<int> out;
+    for (size_t pos = 0; pos < text.size();) {
+        size_t end = text.find(',', pos);
+        if (end == std::string_view::npos) end = text.size();
+        int v = 0;
+        std::from_chars(text.data() + pos, text.data() + end, v);
+        if (v != 0) out.push_back(v);
+        pos = end + 1;
+    }
+    return out;
+}
 
-    int listen_fd = start_tcp_server(ip.c_str(), lobby_port);
-    if (listen_fd < 0) return 1;
-    std::cerr << "[Lobby] listening on " << ip << ":" << lobby_port << "\n";
-    log_checkpoint("Lobby", "LISTENING", ip + ":" + std::to_string(lobby_port));
+// --- Room cache ---
+// LIST_ROOMS is answered from g_room_rows, loaded once at startup. Every room
+// the lobby changes (create, join, leave, start, finish, disconnect) is re-read
+// with "Room get" on the single refresher thread: each read starts after the
+// previous one was applied, so a later read never carries older state than an
+// earlier one. Applied changes bump g_room_version and reach SUBSCRIBE_ROOMS
+// clients as
+//   ROOM_UPDATE version=<v> room=<row>     (new or changed public room)
+//   ROOM_UPDATE version=<v> removed=<id>   (closed or no longer public)
+// The lobby must be the only writer of rooms for the cache to stay exact;
+// several lobby processes also re-read every room one of them changes.
 
-    std::vector<pollfd> pfds;
+static bool room_cache_load() {
+    std::map<int, std::string> rows;
+    int after = 0;
+    while (true) {
+        std::string reply;
+        if (!db_req("Room list limit=" + std::to_string(kRoomLoadPageSize) + " after=" + std::to_string(after), reply) ||
+            reply.rfind("OK", 0) != 0) {
+            return false;
+        }
+        std::stringstream ss(reply.size() > 3 ? reply.substr(3) : std::string());
+        std::string row;
+        int count = 0;
+        while (std::getline(ss, row, ';')) {
+            if (row.empty()) continue;
+            try { after = std::stoi(row.substr(0, row.find(':'))); } catch (...) { continue; }
+            rows[after] = row;
+            ++count;
+        }
+        if (count < kRoomLoadPageSize) break;
+    }
+    std::unique_lock<std::shared_mutex> lock(g_room_cache_mutex);
+    g_room_rows.swap(rows);
+    return true;
+}
 
-    while (running) {
-        // Rebuild pfds from g_clients list (handles dynamic client FDs)
-        pfds.clear();
-        pfds.push_back({listen_fd, POLLIN, 0});
-        pfds.push_back({db_fd, POLLIN, 0});
-        {
-            std::lock_guard<std::mutex> lock(g_clients_mutex);
-            for (auto const& [fd, client] : g_clients) {
-                pfds.push_back({fd, POLLIN, 0});
+// Same reply as "Room list limit=<kRoomPageSize> after=<after>"
+static std::string room_cache_page(int after) {
+    std::string reply = "OK ";
+    std::shared_lock<std::shared_mutex> lock(g_room_cache_mutex);
+    int n = 0;
+    for (auto it = g_room_rows.upper_bound(after); it != g_room_rows.end() && n < kRoomPageSize; ++it, ++n) {
+        reply += it->second;
+        reply += ';';
+    }
+    return reply;
+}
+
+// Refresher thread only. row empty means the room left the public list.
+static void room_cache_apply(int rid, const std::string& row) {
+    std::vector<std::shared_ptr<LobbyConn>> subscribers;
+    std::string update;
+    {
+        std::unique_lock<std::shared_mutex> lock(g_room_cache_mutex);
+        auto it = g_room_rows.find(rid);
+        if (row.empty()) {
+            if (it == g_room_rows.end()) return;
+            g_room_rows.erase(it);
+            update = "ROOM_UPDATE version=" + std::to_string(++g_room_version) + " removed=" + std::to_string(rid);
+        } else {
+            if (it != g_room_rows.end() && it->second == row) return;
+            g_room_rows[rid] = row;
+            update = "ROOM_UPDATE version=" + std::to_string(++g_room_version) + " room=" + row;
+        }
+        subscribers.reserve(g_room_subscribers.size());
+        for (auto const& [fd, conn] : g_room_subscribers) subscribers.push_back(conn);
+    }
+    // Still in version order: only this thread publishes
+    for (auto const& conn : subscribers) lobby_send_to(conn, update);
+}
+
+static void refresh_room(int rid) {
+    std::string reply;
+    if (!db_req("Room get roomId=" + std::to_string(rid), reply)) {
+        log_checkpoint("Lobby", "ROOM_CACHE_STALE", "room=" + std::to_string(rid) + " reason=db_error");
+        return;
+    }
+    if (reply.rfind("OK", 0) != 0) { // not_found: closed
+        room_cache_apply(rid, "");
+        return;
+    }
+    auto f = parse_ok_reply(reply);
+    if (f["visibility"] != "public") {
+        room_cache_apply(rid, "");
+        return;
+    }
+    room_cache_apply(rid, f["id"] + ":" + f["name"] + ":" + f["host"] + ":" + f["status"] + ":" +
+                              f["visibility"] + ":" + f["p1"] + ":" + f["p2"]);
+}
+
+static void invalidate_room(int rid) {
+    g_room_refresher.post(0, [rid] { refresh_room(rid); });
+    g_bus.publish("ROOM room=" + std::to_string(rid));
+}
+
+// Returns the version the subscriber is caught up to: every later change is pushed
+static uint64_t room_cache_subscribe(int fd) {
+    std::shared_ptr<LobbyConn> conn = client_conn(fd);
+    std::unique_lock<std::shared_mutex> lock(g_room_cache_mutex);
+    if (conn) g_room_subscribers[fd] = std::move(conn);
+    return g_room_version;
+}
+
+static void room_cache_unsubscribe(int fd) {
+    std::unique_lock<std::shared_mutex> lock(g_room_cache_mutex);
+    g_room_subscribers.erase(fd);
+}
+
+// --- Presence ---
+// LIST_ONLINE is answered from g_online. The refresher thread keeps it in step
+// with the DB by asking "User listOnline since=<token>" every kPresencePollMs,
+// and right after a login or logout here, which returns only what changed
+// since the previous answer (the whole list after a DB restart). Applied
+// changes bump g_presence_version and reach SUBSCRIBE_ONLINE clients as
+//   ONLINE_UPDATE version=<v> full=0 +alice,-bob   (in order)
+//   ONLINE_UPDATE version=<v> full=1 alice,carol   (start over from this list)
+// so an open online list costs what changed, not a listing of every user.
+
+static std::string presence_list_locked() {
+    std::string names;
+    for (auto const& name : g_online) {
+        if (!names.empty()) names += ',';
+        names += name;
+    }
+    return names;
+}
+
+// Refresher thread only
+static void presence_poll() {
+    std::string reply;
+    if (!db_read("User listOnline since=" + g_presence_token, reply) || reply.rfind("OK presence=", 0) != 0) {
+        log_checkpoint("Lobby", "PRESENCE_STALE", "reason=db_error");
+        return;
+    }
+    const std::string_view header = std::string_view(reply).substr(0, reply.find(' ', reply.find(" full=") + 1));
+    g_presence_token = message_field(header, "presence");
+    const bool full = message_field(header, "full") == "1";
+    std::vector<std::string> names;
+    {
+        std::stringstream ss(header.size() < reply.size() ? reply.substr(header.size() + 1) : std::string());
+        for (std::string name; std::getline(ss, name, ',');) {
+            if (!name.empty()) names.push_back(std::move(name));
+        }
+    }
+
+    std::string changes;
+    auto note = [&changes](char sign, const std::string& name) {
+        if (!changes.empty()) changes += ',';
+        changes += sign;
+        changes += name;
+    };
+    std::vector<std::shared_ptr<LobbyConn>> subscribers;
+    std::string update;
+    {
+        std::unique_lock<std::shared_mutex> lock(g_presence_mutex);
+        if (full) {
+            std::set<std::string> now(names.begin(), names.end());
+            for (auto const& name : g_online) {
+                if (!now.count(name)) note('-', name);
+            }
+            for (auto const& name : now) {
+                if (!g_online.count(name)) note('+', name);
+            }
+            g_online.swap(now);
+        } else {
+            for (auto const& change : names) {
+                const std::string name = change.substr(1);
+                if (change[0] == '+' ? g_online.insert(name).second : g_online.erase(name) > 0) note(change[0], name);
             }
         }
+        if (changes.empty()) return;
+        update = "ONLINE_UPDATE version=" + std::to_string(++g_presence_version) + " full=0 " + changes;
+        subscribers.reserve(g_presence_subscribers.size());
+        for (auto const& [fd, conn] : g_presence_subscribers) subscribers.push_back(conn);
+    }
+    // Still in version order: only this thread publishes
+    for (auto const& conn : subscribers) lobby_send_to(conn, update);
+}
+
+// A poll already queued covers any change made before it runs
+static void presence_poll_soon() {
+    if (g_presence_poll_queued.exchange(true)) return;
+    g_room_refresher.post(0, [] {
+        g_presence_poll_queued.store(false);
+        presence_poll();
+    });
+}
 
-        int rc = ::poll(pfds.data(), pfds.size(), 500);
-        if (rc < 0) { if (errno == EINTR) continue; perror("poll"); break; }
-        if (rc == 0) continue;
+// "OK a,b,c", as "User listOnline" answers
+static std::string presence_list() {
+    std::shared_lock<std::shared_mutex> lock(g_presence_mutex);
+    return "OK " + presence_list_locked();
+}
 
-        // --- Handle New Connection ---
-        if (pfds[0].revents & POLLIN) {
-            int cfd = ::accept(listen_fd, nullptr, nullptr);
-            if (cfd >= 0) {
-                {
-                    std::lock_guard<std::mutex> lock(g_clients_mutex);
-                    g_clients[cfd] = ClientInfo{.fd=cfd};
-                }
-                log_checkpoint("Lobby", "CLIENT_CONNECTED", "fd=" + std::to_string(cfd));
-                lobby_send_frame(cfd, "WELCOME LOBBY");
+// Returns the version names (who is online) is at: every later change is pushed
+static uint64_t presence_subscribe(int fd, std::string& names) {
+    std::shared_ptr<LobbyConn> conn = client_conn(fd);
+    std::unique_lock<std::shared_mutex> lock(g_presence_mutex);
+    if (conn) g_presence_subscribers[fd] = std::move(conn);
+    names = presence_list_locked();
+    return g_presence_version;
+}
+
+static void presence_unsubscribe(int fd) {
+    std::unique_lock<std::shared_mutex> lock(g_presence_mutex);
+    g_presence_subscribers.erase(fd);
+}
+
+// Logs the client off in the DB and forgets it once its connection is gone.
+// Runs on the client's lane, after every frame it sent.
+static void drop_client(int cfd) {
+    ClientInfo cli;
+    std::shared_ptr<LobbyConn> conn;
+    {
+        ClientShard& shard = client_shard(cfd);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.clients.find(cfd);
+        if (it == shard.clients.end()) return;
+        cli = it->second.info;
+        conn = it->second.conn;
+        shard.clients.erase(it);
+    }
+    g_metric_clients.add(-1);
+    room_cache_unsubscribe(cfd);
+    presence_unsubscribe(cfd);
+    if (cli.authed) {
+        release_username(cli.username, cfd);
+        db_release_user(cli);
+    }
+    log_checkpoint("Lobby", "CLIENT_DISCONNECTED",
+                   "fd=" + std::to_string(cfd) +
+                   (cli.username.empty() ? "" : " user=" + cli.username));
+    std::lock_guard<std::mutex> lock(conn->write_mutex);
+    conn->closed = true;
+    ::close(cfd); // also drops it from the epoll set
+}
+
+// --- Sessions ---
+// "OK LOGIN ticket=<t>" hands the client a SessionTicket; "RESUME <t>" on a
+// later connection logs it in again without the user row being read. LOGIN
+// itself skips the read when g_credentials has just seen that password. Either
+// way the one DB write left, compareSetOnline, is sent in a Batch with those of
+// the logins waiting at the same time, so a reconnect storm costs a round trip
+// per batch rather than two per client.
+static SessionTickets g_tickets; // the key: --ticket-key, or random (shared with --processes children)
+static CredentialCache g_credentials(4096);
+static MetricCounter& g_metric_auth_cached =
+    metrics().counter("lobby_logins_without_read_total", "Logins let in by a ticket or cached credentials");
+
+static std::mutex g_acquire_mutex;
+static std::vector<std::pair<std::string, std::promise<std::string>>> g_acquire_queue; // user, reply
+static bool g_acquire_flushing = false;
+
+static int64_t unix_now() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// "User compareSetOnline ... expect=0 value=1 lease=<g_lease_id>"; false if the DB did not answer.
+// The first caller sends what has queued up, and keeps sending until nothing
+// is left, while the others wait for their reply.
+static bool db_acquire_online(const std::string& user, std::string& reply) {
+    std::promise<std::string> promise;
+    std::future<std::string> future = promise.get_future();
+    std::unique_lock<std::mutex> lock(g_acquire_mutex);
+    g_acquire_queue.emplace_back(user, std::move(promise));
+    if (!g_acquire_flushing) {
+        g_acquire_flushing = true;
+        while (!g_acquire_queue.empty()) {
+            auto batch = std::move(g_acquire_queue);
+            g_acquire_queue.clear();
+            lock.unlock();
+            std::vector<std::string> cmds;
+            for (auto const& [name, waiter] : batch) {
+                cmds.push_back("User compareSetOnline username=" + name + " expect=0 value=1 lease=" + g_lease_id);
+            }
+            std::string batch_reply;
+            std::vector<std::string> replies;
+            if (cmds.size() == 1) {
+                if (db_req(cmds[0], batch_reply)) replies.push_back(batch_reply);
+            } else if (db_req(db_batch_request(cmds), batch_reply)) {
+                replies = db_split_batch_reply(batch_reply);
             }
+            for (size_t i = 0; i < batch.size(); ++i) batch[i].second.set_value(i < replies.size() ? replies[i] : "");
+            lock.lock();
+        }
+        g_acquire_flushing = false;
+    }
+    lock.unlock();
+    reply = future.get();
+    return !reply.empty();
+}
+
+// The shared end of LOGIN and RESUME once the user is known and claimed here
+static void finish_login(int cfd, const std::string& u, const char* how) {
+    std::string acquire_reply;
+    if (!db_acquire_online(u, acquire_reply)) {
+        release_username(u, cfd);
+        lobby_send_frame(cfd, "ERR db");
+        log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=db_error");
+        return;
+    }
+    if (acquire_reply.rfind("OK", 0) != 0) {
+        release_username(u, cfd);
+        if (acquire_reply.rfind("ERR mismatch", 0) == 0) {
+            lobby_send_frame(cfd, "ERR already_online");
+            log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=already_online_race");
+        } else {
+            lobby_send_frame(cfd, acquire_reply);
+            log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=" + acquire_reply);
         }
+        return;
+    }
+
+    update_client(cfd, [&](ClientInfo& c) {
+        c.username = u;
+        c.authed = true;
+    });
+    lobby_send_frame(cfd, "OK LOGIN ticket=" + g_tickets.issue(u, unix_now()));
+    log_checkpoint("Lobby", "LOGIN_OK", "user=" + u + " via=" + how);
+    presence_poll_soon();
+}
+
+// --- Match start ---
+// What every match start shares once its room row says playing. The registry
+// and the other lobby processes learn the token, and the room posts its result
+// to g_results when it ends; then, if set, runs right after on the room's
+// worker thread. Once the DB has it, the room is free for a rematch or, with
+// close_room, closed, and the room cache re-reads it. Once the room is with the
+// scheduler, match_ready() sends the players there.
+static TetrisRoomConfig match_config(int rid, const std::string& token, const std::string& p1_name,
+                                     const std::string& p2_name, int gravity_ms, bool close_room,
+                                     GameFinishedCallback then = nullptr) {
+    const uint16_t gport = g_room_scheduler.shared_port();
+    g_game_registry.put(rid, GameRoomEntry{gport, token, -1});
+    g_bus.publish("MATCH room=" + std::to_string(rid) + " token=" + token + " port=" + std::to_string(gport));
+
+    auto finish_cb = [rid, token, close_room, then](int room_id,
+                                                    const std::string& user1,
+                                                    int score1,
+                                                    const std::string& user2,
+                                                    int score2) {
+        // The result and the free room become visible together, and only while
+        // the room still holds this match: the outbox may deliver it twice
+        LobbyCork cork; // what the result sets off (a next round, its notes) leaves in one flush per player
+        const std::string room_key = "roomId=" + std::to_string(rid);
+        std::vector<std::string> cmds{"Room check " + room_key + " token=" + token,
+                                      "GameLog create " + room_key + " user1=" + user1 + " user2=" + user2 +
+                                      " score1=" + std::to_string(score1) + " score2=" + std::to_string(score2)};
+        if (close_room) {
+            cmds.push_back("Room leave " + room_key + " user=" + user2);
+            cmds.push_back("Room leave " + room_key + " user=" + user1);
+        } else {
+            cmds.push_back("Room setStatus " + room_key + " status=idle");
+        }
+        const std::string request = db_atomic_request(cmds);
+        if (!g_results.post(request, [rid](const std::string&) { invalidate_room(rid); })) {
+            std::string reply;
+            db_req(request, reply);
+            invalidate_room(rid);
+        }
+        match_ended(rid, token);
+        g_bus.publish("ROOM_FREE room=" + std::to_string(rid) + " token=" + token);
+        if (then) then(room_id, user1, score1, user2, score2);
+    };
+
+    TetrisRoomConfig room{-1, p1_name, p2_name, g_db_ip, g_db_port, rid, token, &g_game_registry,
+                          finish_cb, gravity_ms, g_trace_dir};
+    room.relay = g_spectator_relay.get();
+    room.udp = g_offer_udp;
+    return room;
+}
+
+static void match_ready(int rid, const std::string& token, const std::string& p1_name, const std::string& p2_name,
+                        int gravity_ms) {
+    const uint16_t gport = g_room_scheduler.shared_port();
+    std::string msg = "GAME_READY port=" + std::to_string(gport) + " token=" + token;
+    lobby_notify_user(p1_name, msg);
+    lobby_notify_user(p2_name, msg);
+    log_checkpoint("Lobby", "GAME_START",
+                   "room=" + std::to_string(rid) + " port=" + std::to_string(gport) +
+                   " p1=" + p1_name + " p2=" + p2_name + " gravity=" + std::to_string(gravity_ms));
+}
+
+// Matches the lobby makes up itself (tournaments, the queue) rather than a
+// host's START_GAME: their rooms come from one DB batch, created already
+// seated and playing, go to the room scheduler together, and are closed again
+// once the result is in. Both players get note (with roomId=) before
+// GAME_READY. Sets each match's room, 0 where the DB would not make one.
+struct LobbyMatch {
+    std::string name; // of the room
+    std::string p1, p2;
+    int gravity_ms = server_config().gravity_ms;
+    std::string note;
+    GameFinishedCallback then;
+    int room = 0;
+};
+
+static void start_lobby_matches(std::vector<LobbyMatch>& matches) {
+    std::vector<std::string> tokens, cmds;
+    for (auto const& m : matches) {
+        tokens.push_back(generate_token());
+        cmds.push_back("Room create name=" + m.name + " host=" + m.p1 + " p2=" + m.p2 +
+                       " visibility=public status=playing token=" + tokens.back());
+    }
+    std::string reply;
+    std::vector<std::string> replies;
+    if (cmds.size() == 1) {
+        if (db_req(cmds[0], reply)) replies.push_back(reply);
+    } else if (db_req(db_batch_request(cmds), reply)) {
+        replies = db_split_batch_reply(reply);
+    }
+
+    std::vector<TetrisRoomConfig> rooms;
+    for (size_t i = 0; i < matches.size(); ++i) {
+        LobbyMatch& m = matches[i];
+        if (i >= replies.size() || replies[i].rfind("OK roomId=", 0) != 0) continue;
+        m.room = std::atoi(replies[i].c_str() + 10);
+        invalidate_room(m.room);
+        rooms.push_back(match_config(m.room, tokens[i], m.p1, m.p2, m.gravity_ms, true, m.then));
+    }
+    const std::vector<int> workers = g_room_scheduler.add_rooms(std::move(rooms));
+    size_t placed = 0;
+    for (size_t i = 0; i < matches.size(); ++i) {
+        const LobbyMatch& m = matches[i];
+        if (m.room == 0) continue;
+        const int worker = workers[placed++];
+        if (worker >= 0) g_game_registry.set_worker(m.room, worker);
+        const std::string note = m.note + " roomId=" + std::to_string(m.room);
+        lobby_notify_user(m.p1, note);
+        lobby_notify_user(m.p2, note);
+        match_ready(m.room, tokens[i], m.p1, m.p2, m.gravity_ms);
+    }
+}
+
+// --- Tournaments ---
+// "TOURNAMENT_CREATE <name> <user,user,...> [gravity=<ms>]" runs a single
+// elimination bracket. The first round pairs the i-th listed player with the
+// (i + half)-th, half being half the next power of two, so missing players are
+// byes for the first ones listed; the higher listed player goes through on a
+// tie. A round's rooms come from one DB batch, already seated and playing, and
+// go to the room scheduler together with their ticks staggered. Each result
+// (GameFinishedCallback) moves its winner on, and a match starts as soon as
+// both its players are known. Players hear "TOURNAMENT_MATCH" before each
+// GAME_READY and everyone in it "TOURNAMENT_OVER" at the end;
+// "TOURNAMENT_STATUS <id>" shows the bracket. A tournament lives in the lobby
+// process that created it.
+struct TournamentMatch {
+    int round = 1;
+    std::string players[2]; // "" for a bye, or while a winner is still to come
+    int feeders = 0;        // earlier matches whose winners are still to come
+    int next = -1;          // where the winner goes, -1 for the final
+    int next_slot = 0;
+    int room = 0;
+    int scores[2] = {};
+    bool started = false;
+    bool done = false;
+    std::string winner;
+};
 
-        // --- Handle DB Response (unexpected) ---
-        if (pfds[1].revents & POLLIN) {
-            std::string tmp;
-            if (!lp_recv_frame(db_fd, tmp)) {
-                std::cerr << "[Lobby] DB connection lost." << std::endl;
-                running = 0; break;
+struct Tournament {
+    std::string name;
+    std::string organizer;
+    int gravity_ms = server_config().gravity_ms;
+    int rounds = 0;
+    std::vector<std::string> entrants;
+    std::vector<TournamentMatch> matches; // round by round, the final last
+    std::string champion;                 // once it is over
+};
+
+static std::mutex g_tournament_mutex;
+static std::map<int, Tournament> g_tournaments;
+static int g_next_tournament_id = 1;
+static constexpr size_t kMaxTournamentPlayers = 64;
+static MetricCounter& g_metric_tournament_matches =
+    metrics().counter("lobby_tournament_matches_total", "Tournament matches started");
+
+static void tournament_advance(Tournament& t, int m, std::vector<int>& ready);
+
+// Under g_tournament_mutex: a match whose players are known either goes on
+// ready to be started or, with a bye, is decided on the spot
+static void tournament_settle(Tournament& t, int m, std::vector<int>& ready) {
+    TournamentMatch& match = t.matches[static_cast<size_t>(m)];
+    if (match.feeders > 0 || match.started) return;
+    match.started = true;
+    if (!match.players[0].empty() && !match.players[1].empty()) {
+        ready.push_back(m);
+        return;
+    }
+    match.done = true;
+    match.winner = match.players[0].empty() ? match.players[1] : match.players[0];
+    tournament_advance(t, m, ready);
+}
+
+// Under g_tournament_mutex: the winner of a decided match moves on
+static void tournament_advance(Tournament& t, int m, std::vector<int>& ready) {
+    const TournamentMatch& match = t.matches[static_cast<size_t>(m)];
+    if (match.next < 0) {
+        t.champion = match.winner.empty() ? "-" : match.winner;
+        return;
+    }
+    TournamentMatch& next = t.matches[static_cast<size_t>(match.next)];
+    next.players[match.next_slot] = match.winner;
+    --next.feeders;
+    tournament_settle(t, match.next, ready);
+}
+
+static void tournament_start(int tid, std::vector<int> matches);
+
+// Room worker thread: a tournament match has its result
+static void tournament_result(int tid, int m, int score1, int score2) {
+    std::vector<int> ready;
+    std::string over;
+    std::vector<std::string> entrants;
+    {
+        std::lock_guard<std::mutex> lock(g_tournament_mutex);
+        auto it = g_tournaments.find(tid);
+        if (it == g_tournaments.end()) return;
+        Tournament& t = it->second;
+        TournamentMatch& match = t.matches[static_cast<size_t>(m)];
+        match.scores[0] = score1;
+        match.scores[1] = score2;
+        match.done = true;
+        match.winner = score2 > score1 ? match.players[1] : match.players[0];
+        tournament_advance(t, m, ready);
+        if (!t.champion.empty()) {
+            over = "TOURNAMENT_OVER id=" + std::to_string(tid) + " name=" + t.name + " champion=" + t.champion;
+            entrants = t.entrants;
+        }
+    }
+    if (!over.empty()) {
+        for (auto const& user : entrants) lobby_notify_user(user, over);
+        log_checkpoint("Lobby", "TOURNAMENT_OVER", over.substr(16));
+    }
+    if (!ready.empty()) tournament_start(tid, std::move(ready));
+}
+
+// Gives the matches rooms in one DB batch and hands them to the scheduler in
+// one go. A match whose room could not be made goes to the first player.
+static void tournament_start(int tid, std::vector<int> matches) {
+    std::vector<LobbyMatch> starts;
+    {
+        std::lock_guard<std::mutex> lock(g_tournament_mutex);
+        auto it = g_tournaments.find(tid);
+        if (it == g_tournaments.end()) return;
+        const Tournament& t = it->second;
+        for (int m : matches) {
+            const TournamentMatch& match = t.matches[static_cast<size_t>(m)];
+            LobbyMatch start;
+            start.name = t.name + "-r" + std::to_string(match.round) + "m" + std::to_string(m);
+            start.p1 = match.players[0];
+            start.p2 = match.players[1];
+            start.gravity_ms = t.gravity_ms;
+            start.note = "TOURNAMENT_MATCH id=" + std::to_string(tid) + " round=" + std::to_string(match.round) +
+                         " p1=" + start.p1 + " p2=" + start.p2;
+            start.then = [tid, m](int, const std::string&, int score1, const std::string&, int score2) {
+                tournament_result(tid, m, score1, score2);
+            };
+            starts.push_back(std::move(start));
+        }
+    }
+    start_lobby_matches(starts);
+    g_metric_tournament_matches.add(static_cast<uint64_t>(
+        std::count_if(starts.begin(), starts.end(), [](const LobbyMatch& start) { return start.room != 0; })));
+    {
+        std::lock_guard<std::mutex> lock(g_tournament_mutex);
+        Tournament& t = g_tournaments[tid];
+        for (size_t i = 0; i < matches.size(); ++i) t.matches[static_cast<size_t>(matches[i])].room = starts[i].room;
+    }
+    for (size_t i = 0; i < matches.size(); ++i) {
+        if (starts[i].room == 0) {
+            log_checkpoint("Lobby", "TOURNAMENT_ROOM_FAIL", "id=" + std::to_string(tid) + " match=" + std::to_string(matches[i]));
+            tournament_result(tid, matches[i], 0, 0);
+        }
+    }
+}
+
+// "OK TOURNAMENT id= name= rounds= champion=<user or ->" then one line per
+// match: "<round> <p1> <p2> roomId=<id, 0 before it starts> state=<waiting|playing|done> score=<s1>:<s2>"
+static std::string tournament_status(int tid) {
+    std::lock_guard<std::mutex> lock(g_tournament_mutex);
+    auto it = g_tournaments.find(tid);
+    if (it == g_tournaments.end()) return "ERR no_such_tournament";
+    const Tournament& t = it->second;
+    std::string out = "OK TOURNAMENT id=" + std::to_string(tid) + " name=" + t.name + " rounds=" +
+                      std::to_string(t.rounds) + " champion=" + (t.champion.empty() ? "-" : t.champion);
+    for (auto const& match : t.matches) {
+        const char* state = match.done ? "done" : match.started ? "playing" : "waiting";
+        out += "\n" + std::to_string(match.round) + " " + (match.players[0].empty() ? "-" : match.players[0]) + " " +
+               (match.players[1].empty() ? "-" : match.players[1]) + " roomId=" + std::to_string(match.room) +
+               " state=" + state + " score=" + std::to_string(match.scores[0]) + ":" + std::to_string(match.scores[1]);
+    }
+    return out;
+}
+
+// Checks the entrants, lays out the bracket and starts its first round;
+// returns the reply for the organizer
+static std::string tournament_create(const std::string& organizer, const std::string& name,
+                                     const std::vector<std::string>& players, int gravity_ms) {
+    if (name.empty() || players.size() < 2) return "ERR usage";
+    if (players.size() > kMaxTournamentPlayers) return "ERR too_many_players";
+    for (size_t i = 0; i < players.size(); ++i) {
+        if (std::find(players.begin(), players.begin() + static_cast<long>(i), players[i]) !=
+            players.begin() + static_cast<long>(i)) {
+            return "ERR duplicate_player user=" + players[i];
+        }
+    }
+    {
+        std::shared_lock<std::shared_mutex> lock(g_presence_mutex);
+        for (auto const& p : players) {
+            if (!g_online.count(p)) return "ERR offline user=" + p;
+        }
+    }
+
+    Tournament t;
+    t.name = name;
+    t.organizer = organizer;
+    t.gravity_ms = gravity_ms;
+    t.entrants = players;
+    size_t seats = 2;
+    t.rounds = 1;
+    while (seats < players.size()) {
+        seats *= 2;
+        ++t.rounds;
+    }
+    // Round r's matches follow round r-1's; match j of a round feeds match j/2 of the next
+    size_t first = 0;
+    for (int round = 1, count = static_cast<int>(seats / 2); count >= 1; ++round, count /= 2) {
+        for (int j = 0; j < count; ++j) {
+            TournamentMatch match;
+            match.round = round;
+            if (round == 1) {
+                match.players[0] = players[static_cast<size_t>(j)];
+                const size_t other = static_cast<size_t>(j) + seats / 2;
+                if (other < players.size()) match.players[1] = players[other];
             } else {
-                log_communication("Lobby", "RX", "db:" + g_db_ip + ":" + std::to_string(g_db_port), tmp);
+                match.feeders = 2;
+            }
+            if (count > 1) {
+                match.next = static_cast<int>(first) + count + j / 2;
+                match.next_slot = j % 2;
             }
+            t.matches.push_back(std::move(match));
         }
+        first += static_cast<size_t>(count);
+    }
 
-        // --- Handle Client IO ---
-        for (size_t i = 2; i < pfds.size(); ++i) {
-            if (!(pfds[i].revents & POLLIN)) continue;
+    const int rounds = t.rounds;
+    int tid = 0;
+    std::vector<int> ready;
+    {
+        std::lock_guard<std::mutex> lock(g_tournament_mutex);
+        tid = g_next_tournament_id++;
+        Tournament& placed = g_tournaments[tid] = std::move(t);
+        for (int j = 0; j < static_cast<int>(seats / 2); ++j) tournament_settle(placed, j, ready);
+    }
+    log_checkpoint("Lobby", "TOURNAMENT_CREATE",
+                   "id=" + std::to_string(tid) + " name=" + name + " by=" + organizer +
+                   " players=" + std::to_string(players.size()) + " first_round=" + std::to_string(ready.size()));
+    const std::string reply = "OK TOURNAMENT id=" + std::to_string(tid) + " rounds=" + std::to_string(rounds) +
+                              " matches=" + std::to_string(seats - 1);
+    tournament_start(tid, std::move(ready));
+    return reply;
+}
 
-            int cfd = pfds[i].fd;
-            std::string req;
-            ClientInfo cli; // Local copy
+// --- Matchmaking queue ---
+// "QUEUE [gravity=<ms>]" waits for an opponent of about the same rating and
+// "UNQUEUE" stops waiting. The rating is read once, on QUEUE: kBaseRating plus
+// kRatingPerWin for every win more than losses. The main loop pairs whoever is
+// waiting every kMatchmakeMs (matchmaker.hpp) without touching the DB; only a
+// pair that was found costs DB work, when the round's rooms are made together
+// (start_lobby_matches) on a worker thread. Both players hear
+// "MATCH_FOUND p1= p2= rating1= rating2= roomId=" before GAME_READY. The queue
+// is per lobby process.
+static constexpr int kMatchmakeMs = 250;
+static constexpr int kBaseRating = 1000;
+static constexpr int kRatingPerWin = 25;
+static MetricGauge& g_metric_queue_waiting =
+    metrics().gauge("lobby_queue_waiting", "Players waiting in the matchmaking queue");
+static MetricCounter& g_metric_queue_matches =
+    metrics().counter("lobby_queue_matches_total", "Matches made by the matchmaking queue");
 
-            {
-                std::lock_guard<std::mutex> lock(g_clients_mutex);
-                if (!g_clients.count(cfd)) continue; // Disconnected already
-                cli = g_clients[cfd];
-            }
+static int queue_rating(const std::string& user) {
+    std::string reply;
+    if (!db_read("Stats get username=" + user, reply) || reply.rfind("OK", 0) != 0) return kBaseRating; // no games yet
+    return kBaseRating + kRatingPerWin * (message_int(reply, "wins") - message_int(reply, "losses"));
+}
 
-            if (!lobby_recv_client_frame(cfd, req)) {
-                // client gone
-                if (cli.authed) {
-                    std::string r2;
-                    db_req("User setOnline username=" + cli.username + " online=0", r2);
-                    if (cli.roomId != 0) {
-                        db_req("Room leave roomId=" + std::to_string(cli.roomId) + " user=" + cli.username, r2);
-                    }
-                    if (cli.spectateRoomId != 0) {
-                        db_req("Room unspectate roomId=" + std::to_string(cli.spectateRoomId) + " user=" + cli.username, r2);
-                    }
-                }
-                log_checkpoint("Lobby", "CLIENT_DISCONNECTED",
-                               "fd=" + std::to_string(cfd) +
-                               (cli.username.empty() ? "" : " user=" + cli.username));
-                ::close(cfd);
-                {
-                    std::lock_guard<std::mutex> lock(g_clients_mutex);
-                    g_clients.erase(cfd);
-                }
+// Main thread, every kMatchmakeMs
+static void matchmake() {
+    std::vector<Matchmaker::Pair> pairs = g_matchmaker.match(Matchmaker::Clock::now());
+    g_metric_queue_waiting.set(static_cast<int64_t>(g_matchmaker.size()));
+    if (pairs.empty()) return;
+    g_workers.post(0, [pairs = std::move(pairs)] {
+        std::vector<LobbyMatch> starts;
+        for (auto const& pair : pairs) {
+            LobbyMatch start;
+            start.name = "queue-" + pair.p1;
+            start.p1 = pair.p1;
+            start.p2 = pair.p2;
+            start.gravity_ms = pair.gravity_ms;
+            start.note = "MATCH_FOUND p1=" + pair.p1 + " p2=" + pair.p2 + " rating1=" + std::to_string(pair.rating1) +
+                         " rating2=" + std::to_string(pair.rating2);
+            starts.push_back(std::move(start));
+        }
+        start_lobby_matches(starts);
+        for (auto const& start : starts) {
+            if (start.room != 0) {
+                g_metric_queue_matches.add();
                 continue;
             }
+            lobby_notify_user(start.p1, "ERR queue_match_failed");
+            lobby_notify_user(start.p2, "ERR queue_match_failed");
+        }
+    });
+}
 
-            std::istringstream iss(req);
-            std::string cmd;
-            iss >> cmd;
-            std::string u, p; // For register/login
-            std::string reply; // For DB replies
-
-            if (cmd == "REGISTER") {
-                iss >> u >> p;
-                if (db_req("User create username=" + u + " pass=" + p, reply)) {
-                    lobby_send_frame(cfd, reply);
-                    if (reply.rfind("OK", 0) == 0) {
-                        log_checkpoint("Lobby", "REGISTER_OK", "user=" + u);
-                    } else {
-                        log_checkpoint("Lobby", "REGISTER_FAIL", "user=" + u + " reason=" + reply);
-                    }
-                } else {
-                    lobby_send_frame(cfd, "ERR db");
-                    log_checkpoint("Lobby", "REGISTER_FAIL", "user=" + u + " reason=db_unreachable");
-                }
+// Runs one lobby command from a client; cli is its state when the frame arrived
+static void handle_client_command(int cfd, const ClientInfo& cli, const std::string& req) {
+    std::istringstream iss(req);
+    std::string cmd;
+    iss >> cmd;
+    std::string u, p; // For register/login
+    std::string reply; // For DB replies
+    g_metric_commands.add();
+    TRACE_SCOPE("lobby_command");
+
+    if (cmd == "REGISTER") {
+        iss >> u >> p;
+        if (db_req("User create username=" + u + " pass=" + p, reply)) {
+            lobby_send_frame(cfd, reply);
+            if (reply.rfind("OK", 0) == 0) {
+                log_checkpoint("Lobby", "REGISTER_OK", "user=" + u);
+            } else {
+                log_checkpoint("Lobby", "REGISTER_FAIL", "user=" + u + " reason=" + reply);
             }
-            else if (cmd == "LOGIN") {
-                iss >> u >> p;
-                if (db_req("User read username=" + u, reply)) {
-                    auto reply_map = parse_ok_reply(reply);
-                    bool already_online = reply_map.count("online") && reply_map["online"] == "1";
-                    if (!already_online) {
-                        std::lock_guard<std::mutex> lock(g_clients_mutex);
-                        for (auto const& kv : g_clients) {
-                            if (kv.second.authed && kv.second.username == u) {
-                                already_online = true;
-                                break;
-                            }
-                        }
-                    }
+        } else {
+            lobby_send_frame(cfd, "ERR db");
+            log_checkpoint("Lobby", "REGISTER_FAIL", "user=" + u + " reason=db_unreachable");
+        }
+    }
+    else if (cmd == "LOGIN") {
+        iss >> u >> p;
+        // Reserved here first, so two connections racing on one name cannot both win
+        if (find_conn_by_username(u) || !claim_username(u, cfd)) {
+            lobby_send_frame(cfd, "ERR already_online");
+            log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=already_online");
+            return;
+        }
+        if (g_credentials.matches(u, p)) {
+            g_metric_auth_cached.add();
+            finish_login(cfd, u, "cache");
+            return;
+        }
+        if (!db_req("User read username=" + u, reply)) {
+            release_username(u, cfd);
+            lobby_send_frame(cfd, reply.empty() ? "ERR db" : reply);
+            log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=db_error");
+            return;
+        }
+        auto reply_map = parse_ok_reply(reply);
+        if (reply_map.count("online") && reply_map["online"] == "1") {
+            release_username(u, cfd);
+            lobby_send_frame(cfd, "ERR already_online");
+            log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=already_online");
+        } else if (reply_map.count("pass") && reply_map["pass"] == p) {
+            g_credentials.remember(u, p);
+            finish_login(cfd, u, "password");
+        } else {
+            release_username(u, cfd);
+            lobby_send_frame(cfd, "ERR bad_credentials");
+            log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=bad_credentials");
+        }
+    }
+    else if (cmd == "RESUME") {
+        std::string ticket;
+        iss >> ticket;
+        if (!g_tickets.verify(ticket, unix_now(), u)) {
+            lobby_send_frame(cfd, "ERR bad_ticket");
+            log_checkpoint("Lobby", "LOGIN_REJECT", "reason=bad_ticket");
+            return;
+        }
+        if (find_conn_by_username(u) || !claim_username(u, cfd)) {
+            lobby_send_frame(cfd, "ERR already_online");
+            log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=already_online");
+            return;
+        }
+        g_metric_auth_cached.add();
+        finish_login(cfd, u, "ticket");
+    }
+    else if (cmd == "LOGOUT") { // **FIX: Added LOGOUT**
+        if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        release_username(cli.username, cfd);
+        db_release_user(cli);
+        update_client(cfd, [](ClientInfo& c) {
+            c.authed = false;
+            c.username = "";
+            c.roomId = 0;
+            c.spectateRooms.clear();
+        });
+        lobby_send_frame(cfd, "OK LOGOUT");
+        log_checkpoint("Lobby", "LOGOUT", "user=" + cli.username);
+    }
+    else if (cmd == "LIST_ONLINE") {
+        lobby_send_frame(cfd, presence_list());
+    }
+    else if (cmd == "SUBSCRIBE_ONLINE") {
+        std::string names;
+        const uint64_t version = presence_subscribe(cfd, names);
+        lobby_send_frame(cfd, "OK SUBSCRIBED_ONLINE version=" + std::to_string(version) + " " + names);
+    }
+    else if (cmd == "UNSUBSCRIBE_ONLINE") {
+        presence_unsubscribe(cfd);
+        lobby_send_frame(cfd, "OK UNSUBSCRIBED_ONLINE");
+    }
+    else if (cmd == "LEADERBOARD") {
+        int after = 0;
+        if (!(iss >> after) || after < 0) after = 0;
+        if (db_read("Stats top limit=" + std::to_string(kLeaderboardPageSize) + " after=" + std::to_string(after), reply))
+            lobby_send_frame(cfd, reply);
+        else
+            lobby_send_frame(cfd, "ERR db");
+    }
+    else if (cmd == "STATS") {
+        iss >> u;
+        // "STATS SERVER": this process's metrics, one per line after "OK STATS"
+        if (u == "SERVER") {
+            lobby_send_frame(cfd, is_loopback_peer(cfd) ? "OK STATS\n" + metrics().render_text() : "ERR forbidden");
+            return;
+        }
+        if (u.empty()) u = cli.username;
+        if (u.empty()) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        if (db_read("Stats get username=" + u, reply))
+            lobby_send_frame(cfd, reply);
+        else
+            lobby_send_frame(cfd, "ERR db");
+    }
+    else if (cmd == "CREATE_ROOM") {
+        if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        std::string name, visibility;
+        iss >> name >> visibility;
+        if (visibility.empty()) visibility = "public";
 
-                    if (already_online) {
-                        lobby_send_frame(cfd, "ERR already_online");
-                        log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=already_online");
-                    }
-                    else if (reply_map.count("pass") && reply_map["pass"] == p) {
-                        std::string acquire_reply;
-                        if (!db_req("User compareSetOnline username=" + u + " expect=0 value=1", acquire_reply)) {
-                            lobby_send_frame(cfd, "ERR db");
-                            log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=db_error");
-                            continue;
-                        }
-                        if (acquire_reply.rfind("OK", 0) != 0) {
-                            std::string reason = acquire_reply;
-                            if (acquire_reply.rfind("ERR mismatch", 0) == 0) {
-                                lobby_send_frame(cfd, "ERR already_online");
-                                log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=already_online_race");
-                            } else {
-                                lobby_send_frame(cfd, acquire_reply);
-                                log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=" + acquire_reply);
-                            }
-                            continue;
-                        }
-
-                        {
-                            std::lock_guard<std::mutex> lock(g_clients_mutex);
-                            g_clients[cfd].username = u;
-                            g_clients[cfd].authed = true;
-                        }
-                        lobby_send_frame(cfd, "OK LOGIN");
-                        log_checkpoint("Lobby", "LOGIN_OK", "user=" + u);
-                    } else {
-                        lobby_send_frame(cfd, "ERR bad_credentials");
-                        log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=bad_credentials");
-                    }
-                } else {
-                    lobby_send_frame(cfd, reply.empty() ? "ERR db" : reply);
-                    log_checkpoint("Lobby", "LOGIN_REJECT", "user=" + u + " reason=db_error");
-                }
+        if(db_req("Room create name=" + name + " host=" + cli.username + " visibility=" + visibility, reply)) {
+            auto reply_map = parse_ok_reply(reply);
+            if (reply_map.count("roomId")) {
+                int rid = std::stoi(reply_map["roomId"]);
+                update_client(cfd, [&](ClientInfo& c) {
+                    c.roomId = rid;
+                    c.spectateRooms.clear();
+                });
+                if (visibility == "public") invalidate_room(rid);
+                lobby_send_frame(cfd, reply); // Forward "OK roomId=..."
+                log_checkpoint("Lobby", "ROOM_CREATED",
+                               "room=" + std::to_string(rid) + " host=" + cli.username + " vis=" + visibility);
+            } else {
+                lobby_send_frame(cfd, "ERR create_failed");
+                log_checkpoint("Lobby", "ROOM_CREATE_FAIL", "host=" + cli.username + " reason=bad_reply");
             }
-            else if (cmd == "LOGOUT") { // **FIX: Added LOGOUT**
-                if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); continue; }
-                db_req("User setOnline username=" + cli.username + " online=0", reply);
-                if (cli.roomId != 0) {
-                    std::string tmp;
-                    db_req("Room leave roomId=" + std::to_string(cli.roomId) + " user=" + cli.username, tmp);
-                }
-                if (cli.spectateRoomId != 0) {
-                    std::string tmp;
-                    db_req("Room unspectate roomId=" + std::to_string(cli.spectateRoomId) + " user=" + cli.username, tmp);
-                }
-                {
-                    std::lock_guard<std::mutex> lock(g_clients_mutex);
-                    g_clients[cfd].authed = false;
-                    g_clients[cfd].username = "";
-                    g_clients[cfd].roomId = 0;
-                    g_clients[cfd].spectateRoomId = 0;
-                }
-                lobby_send_frame(cfd, "OK LOGOUT");
-                log_checkpoint("Lobby", "LOGOUT", "user=" + cli.username);
+        } else {
+            lobby_send_frame(cfd, "ERR db");
+            log_checkpoint("Lobby", "ROOM_CREATE_FAIL", "host=" + cli.username + " reason=db_error");
+        }
+    }
+    else if (cmd == "LIST_ROOMS") {
+        int after = 0;
+        if (!(iss >> after) || after < 0) after = 0;
+        lobby_send_frame(cfd, room_cache_page(after));
+    }
+    else if (cmd == "SUBSCRIBE_ROOMS") {
+        lobby_send_frame(cfd, "OK SUBSCRIBED version=" + std::to_string(room_cache_subscribe(cfd)));
+    }
+    else if (cmd == "UNSUBSCRIBE_ROOMS") {
+        room_cache_unsubscribe(cfd);
+        lobby_send_frame(cfd, "OK UNSUBSCRIBED");
+    }
+    else if (cmd == "JOIN_ROOM") {
+        if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        int rid; iss >> rid;
+        if(db_req("Room join roomId=" + std::to_string(rid) + " user=" + cli.username, reply)) {
+            if (reply.rfind("OK", 0) == 0) {
+                update_client(cfd, [&](ClientInfo& c) {
+                    c.roomId = rid;
+                    c.spectateRooms.clear();
+                });
+                invalidate_room(rid);
+                lobby_send_frame(cfd, "OK joined");
+                log_checkpoint("Lobby", "ROOM_JOINED",
+                               "room=" + std::to_string(rid) + " user=" + cli.username);
+            } else {
+                if (reply.rfind("ERR not_found", 0) == 0) invalidate_room(rid); // evicted by the DB's idle sweep
+                lobby_send_frame(cfd, reply); // Forward error
+                log_checkpoint("Lobby", "ROOM_JOIN_FAIL",
+                               "room=" + std::to_string(rid) + " user=" + cli.username + " reason=" + reply);
             }
-            else if (cmd == "LIST_ONLINE") {
-                if (db_req("User listOnline", reply))
-                    lobby_send_frame(cfd, reply);
-                else
-                    lobby_send_frame(cfd, "ERR db");
+        } else {
+            lobby_send_frame(cfd, "ERR db");
+            log_checkpoint("Lobby", "ROOM_JOIN_FAIL",
+                           "room=" + std::to_string(rid) + " user=" + cli.username + " reason=db_error");
+        }
+    }
+    else if (cmd == "LEAVE_ROOM") {
+        if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        if (cli.roomId == 0) { lobby_send_frame(cfd, "ERR not_in_room"); return; }
+
+        if (db_req("Room leave roomId=" + std::to_string(cli.roomId) + " user=" + cli.username, reply)) {
+            if (reply.rfind("OK", 0) == 0) {
+                update_client(cfd, [](ClientInfo& c) {
+                    c.roomId = 0;
+                    c.spectateRooms.clear();
+                });
+                invalidate_room(cli.roomId);
+                lobby_send_frame(cfd, reply);
+                log_checkpoint("Lobby", "ROOM_LEFT",
+                               "user=" + cli.username + " room=" + std::to_string(cli.roomId));
+            } else {
+                lobby_send_frame(cfd, reply);
+                log_checkpoint("Lobby", "ROOM_LEAVE_FAIL",
+                               "user=" + cli.username + " room=" + std::to_string(cli.roomId) + " reason=" + reply);
             }
-            else if (cmd == "CREATE_ROOM") {
-                if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); continue; }
-                std::string name, visibility;
-                iss >> name >> visibility;
-                if (visibility.empty()) visibility = "public";
-
-                if(db_req("Room create name=" + name + " host=" + cli.username + " visibility=" + visibility, reply)) {
-                    auto reply_map = parse_ok_reply(reply);
-                    if (reply_map.count("roomId")) {
-                        int rid = std::stoi(reply_map["roomId"]);
-                        {
-                            std::lock_guard<std::mutex> lock(g_clients_mutex);
-                            g_clients[cfd].roomId = rid;
-                            g_clients[cfd].spectateRoomId = 0;
-                        }
-                        lobby_send_frame(cfd, reply); // Forward "OK roomId=..."
-                        log_checkpoint("Lobby", "ROOM_CREATED",
-                                       "room=" + std::to_string(rid) + " host=" + cli.username + " vis=" + visibility);
-                    } else {
-                        lobby_send_frame(cfd, "ERR create_failed");
-                        log_checkpoint("Lobby", "ROOM_CREATE_FAIL", "host=" + cli.username + " reason=bad_reply");
-                    }
+        } else {
+            lobby_send_frame(cfd, "ERR db");
+            log_checkpoint("Lobby", "ROOM_LEAVE_FAIL",
+                           "user=" + cli.username + " room=" + std::to_string(cli.roomId) + " reason=db_error");
+        }
+    }
+    else if (cmd == "SPECTATE") {
+        if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        int rid; iss >> rid;
+        if (rid == 0) { lobby_send_frame(cfd, "ERR invalid_room"); return; }
+        if (cli.roomId != 0) { lobby_send_frame(cfd, "ERR must_leave_room"); return; }
+
+        if (std::find(cli.spectateRooms.begin(), cli.spectateRooms.end(), rid) != cli.spectateRooms.end()) {
+            lobby_send_frame(cfd, "ERR already_spectating");
+            return;
+        }
+        if (cli.spectateRooms.size() >= kMaxSpectatedRooms) { lobby_send_frame(cfd, "ERR too_many_rooms"); return; }
+
+        if (db_req("Room spectate roomId=" + std::to_string(rid) + " user=" + cli.username, reply)) {
+            if (reply.rfind("OK", 0) == 0) {
+                GameRoomEntry game;
+                g_game_registry.get(rid, game);
+                uint16_t port = game.port;
+                const std::string& tok = game.token;
+                if (port == 0 || tok.empty()) {
+                    lobby_send_frame(cfd, "ERR no_active_game");
+                    std::string rollback;
+                    db_req("Room unspectate roomId=" + std::to_string(rid) + " user=" + cli.username, rollback);
+                    log_checkpoint("Lobby", "SPECTATE_FAIL",
+                                   "user=" + cli.username + " room=" + std::to_string(rid) + " reason=no_active_game");
                 } else {
-                    lobby_send_frame(cfd, "ERR db");
-                    log_checkpoint("Lobby", "ROOM_CREATE_FAIL", "host=" + cli.username + " reason=db_error");
-                }
-            }
-            else if (cmd == "LIST_ROOMS") {
-                if (db_req("Room list", reply))
-                    lobby_send_frame(cfd, reply);
-                else
-                    lobby_send_frame(cfd, "ERR db");
-            }
-            else if (cmd == "JOIN_ROOM") {
-                if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); continue; }
-                int rid; iss >> rid;
-                if(db_req("Room join roomId=" + std::to_string(rid) + " user=" + cli.username, reply)) {
-                    if (reply.rfind("OK", 0) == 0) {
-                        {
-                            std::lock_guard<std::mutex> lock(g_clients_mutex);
-                            g_clients[cfd].roomId = rid;
-                            g_clients[cfd].spectateRoomId = 0;
-                        }
-                        lobby_send_frame(cfd, "OK joined");
-                        log_checkpoint("Lobby", "ROOM_JOINED",
-                                       "room=" + std::to_string(rid) + " user=" + cli.username);
-                    } else {
-                        lobby_send_frame(cfd, reply); // Forward error
-                        log_checkpoint("Lobby", "ROOM_JOIN_FAIL",
-                                       "room=" + std::to_string(rid) + " user=" + cli.username + " reason=" + reply);
+                    update_client(cfd, [&](ClientInfo& c) { c.spectateRooms.push_back(rid); });
+                    lobby_send_frame(cfd, "OK SPECTATE roomId=" + std::to_string(rid));
+                    std::string ready = "SPECTATE_READY port=";
+                    if (g_public_relay_port != 0) {
+                        port = g_public_relay_port;
+                        ready = "SPECTATE_READY host=" + g_public_relay_host + " port=";
                     }
-                } else {
-                    lobby_send_frame(cfd, "ERR db");
-                    log_checkpoint("Lobby", "ROOM_JOIN_FAIL",
-                                   "room=" + std::to_string(rid) + " user=" + cli.username + " reason=db_error");
+                    lobby_send_frame(cfd, ready + std::to_string(port) + " token=" + tok + " role=SPEC roomId=" +
+                                              std::to_string(rid));
+                    log_checkpoint("Lobby", "SPECTATE_READY",
+                                   "user=" + cli.username + " room=" + std::to_string(rid) + " port=" + std::to_string(port));
                 }
+            } else {
+                lobby_send_frame(cfd, reply);
+                log_checkpoint("Lobby", "SPECTATE_FAIL",
+                               "user=" + cli.username + " room=" + std::to_string(rid) + " reason=" + reply);
             }
-            else if (cmd == "LEAVE_ROOM") {
-                if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); continue; }
-                if (cli.roomId == 0) { lobby_send_frame(cfd, "ERR not_in_room"); continue; }
-
-                if (db_req("Room leave roomId=" + std::to_string(cli.roomId) + " user=" + cli.username, reply)) {
-                    if (reply.rfind("OK", 0) == 0) {
-                        {
-                            std::lock_guard<std::mutex> lock(g_clients_mutex);
-                            g_clients[cfd].roomId = 0;
-                            g_clients[cfd].spectateRoomId = 0;
-                        }
-                        lobby_send_frame(cfd, reply);
-                        log_checkpoint("Lobby", "ROOM_LEFT",
-                                       "user=" + cli.username + " room=" + std::to_string(cli.roomId));
-                    } else {
-                        lobby_send_frame(cfd, reply);
-                        log_checkpoint("Lobby", "ROOM_LEAVE_FAIL",
-                                       "user=" + cli.username + " room=" + std::to_string(cli.roomId) + " reason=" + reply);
-                    }
-                } else {
-                    lobby_send_frame(cfd, "ERR db");
-                    log_checkpoint("Lobby", "ROOM_LEAVE_FAIL",
-                                   "user=" + cli.username + " room=" + std::to_string(cli.roomId) + " reason=db_error");
+        } else {
+            lobby_send_frame(cfd, "ERR db");
+            log_checkpoint("Lobby", "SPECTATE_FAIL",
+                           "user=" + cli.username + " room=" + std::to_string(rid) + " reason=db_error");
+        }
+    }
+    else if (cmd == "UNSPECTATE") {
+        if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        // "UNSPECTATE <roomId>" stops watching one room, a bare one all of them
+        int only = 0; iss >> only;
+        std::vector<int> rooms = cli.spectateRooms;
+        if (only != 0) {
+            if (std::find(rooms.begin(), rooms.end(), only) == rooms.end()) rooms.clear();
+            else rooms.assign(1, only);
+        }
+        if (rooms.empty()) { lobby_send_frame(cfd, "ERR not_spectating"); return; }
+
+        // A room whose match is over has already dropped its spectators, so
+        // the DB's answer does not matter; the lobby forgets the room either way
+        std::vector<std::string> cmds;
+        std::string room_list;
+        for (int rid : rooms) {
+            cmds.push_back("Room unspectate roomId=" + std::to_string(rid) + " user=" + cli.username);
+            room_list += (room_list.empty() ? "" : ",") + std::to_string(rid);
+        }
+        db_req_all(cmds);
+        update_client(cfd, [&](ClientInfo& c) {
+            std::erase_if(c.spectateRooms, [&](int rid) { return std::find(rooms.begin(), rooms.end(), rid) != rooms.end(); });
+        });
+        lobby_send_frame(cfd, only != 0 ? "OK UNSPECTATE roomId=" + std::to_string(only) : "OK UNSPECTATE");
+        log_checkpoint("Lobby", "UNSPECTATE", "user=" + cli.username + " room=" + room_list);
+    }
+    else if (cmd == "INVITE") { // **FIX: Added INVITE**
+        if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        std::string target_user;
+        int rid = cli.roomId;
+        iss >> target_user;
+        if (rid == 0) { lobby_send_frame(cfd, "ERR not_in_room"); return; }
+
+        // Only host can invite
+        if (db_req("Room invite roomId=" + std::to_string(rid) + " user=" + target_user + " host=" + cli.username, reply)) {
+            lobby_send_frame(cfd, reply); // Forward DB reply (OK or ERR not_host)
+            if (reply.rfind("OK", 0) == 0) {
+                log_checkpoint("Lobby", "ROOM_INVITE",
+                               "room=" + std::to_string(rid) + " from=" + cli.username + " to=" + target_user);
+                std::string room_info;
+                if (db_req("Room get roomId=" + std::to_string(rid), room_info) && room_info.rfind("OK", 0) == 0) {
+                    auto info = parse_ok_reply(room_info);
+                    std::string room_name = info.count("name") ? info["name"] : "";
+                    lobby_notify_user(target_user, "ROOM_INVITE roomId=" + std::to_string(rid)
+                                                       + " name=" + room_name
+                                                       + " host=" + cli.username);
                 }
+            } else {
+                log_checkpoint("Lobby", "ROOM_INVITE_FAIL",
+                               "room=" + std::to_string(rid) + " from=" + cli.username + " to=" + target_user + " reason=" + reply);
             }
-            else if (cmd == "SPECTATE") {
-                if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); continue; }
-                int rid; iss >> rid;
-                if (rid == 0) { lobby_send_frame(cfd, "ERR invalid_room"); continue; }
-                if (cli.roomId != 0) { lobby_send_frame(cfd, "ERR must_leave_room"); continue; }
-
-                if (cli.spectateRoomId == rid) {
-                    lobby_send_frame(cfd, "ERR already_spectating");
-                    continue;
-                }
+        } else {
+            lobby_send_frame(cfd, "ERR db");
+            log_checkpoint("Lobby", "ROOM_INVITE_FAIL",
+                           "room=" + std::to_string(rid) + " from=" + cli.username + " to=" + target_user + " reason=db_error");
+        }
+    }
+    else if (cmd == "LIST_INVITES") { // **FIX: Added LIST_INVITES**
+         if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+         if (db_read("Room listInvites user=" + cli.username, reply)) {
+            lobby_send_frame(cfd, reply);
+         } else {
+            lobby_send_frame(cfd, "ERR db");
+         }
+    }
+    else if (cmd == "TRACE_DUMP") {
+        // Writes the trace rings (see common.hpp) into the working directory
+        if (!is_loopback_peer(cfd)) { lobby_send_frame(cfd, "ERR forbidden"); return; }
+        if (!kTracingEnabled) { lobby_send_frame(cfd, "ERR tracing_disabled"); return; }
+        long events = 0;
+        const std::string path = trace_dump_next(&events);
+        lobby_send_frame(cfd, path.empty() ? "ERR trace_write_failed"
+                                           : "OK TRACE path=" + path + " events=" + std::to_string(events));
+    }
+    else if (cmd == "START_GAME") {
+        TRACE_SCOPE("start_game");
+        if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        int rid = cli.roomId;
+        if (rid == 0) { lobby_send_frame(cfd, "ERR not_in_room"); return; }
 
-                if (db_req("Room spectate roomId=" + std::to_string(rid) + " user=" + cli.username, reply)) {
-                    if (reply.rfind("OK", 0) == 0) {
-                        uint16_t port = 0;
-                        std::string tok;
-                        {
-                            std::lock_guard<std::mutex> lock(g_games_mutex);
-                            auto pit = g_game_ports.find(rid);
-                            if (pit != g_game_ports.end()) port = pit->second;
-                            auto tit = g_game_tokens.find(rid);
-                            if (tit != g_game_tokens.end()) tok = tit->second;
-                        }
-                        if (port == 0 || tok.empty()) {
-                            lobby_send_frame(cfd, "ERR no_active_game");
-                            std::string rollback;
-                            db_req("Room unspectate roomId=" + std::to_string(rid) + " user=" + cli.username, rollback);
-                            log_checkpoint("Lobby", "SPECTATE_FAIL",
-                                           "user=" + cli.username + " room=" + std::to_string(rid) + " reason=no_active_game");
-                        } else {
-                            {
-                                std::lock_guard<std::mutex> lock(g_clients_mutex);
-                                g_clients[cfd].spectateRoomId = rid;
-                            }
-                            lobby_send_frame(cfd, "OK SPECTATE");
-                            lobby_send_frame(cfd, "SPECTATE_READY port=" + std::to_string(port) + " token=" + tok + " role=SPEC");
-                            log_checkpoint("Lobby", "SPECTATE_READY",
-                                           "user=" + cli.username + " room=" + std::to_string(rid) + " port=" + std::to_string(port));
-                        }
-                    } else {
-                        lobby_send_frame(cfd, reply);
-                        log_checkpoint("Lobby", "SPECTATE_FAIL",
-                                       "user=" + cli.username + " room=" + std::to_string(rid) + " reason=" + reply);
-                    }
-                } else {
-                    lobby_send_frame(cfd, "ERR db");
-                    log_checkpoint("Lobby", "SPECTATE_FAIL",
-                                   "user=" + cli.username + " room=" + std::to_string(rid) + " reason=db_error");
-                }
+        // Optional "gravity=<ms>": level 0 drop interval for this room (default: the config's)
+        int gravity_ms = server_config().gravity_ms;
+        std::string opt;
+        while (iss >> opt) {
+            if (opt.rfind("gravity=", 0) == 0) {
+                try { gravity_ms = std::stoi(opt.substr(8)); } catch (...) {}
             }
-            else if (cmd == "UNSPECTATE") {
-                if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); continue; }
-                if (cli.spectateRoomId == 0) { lobby_send_frame(cfd, "ERR not_spectating"); continue; }
-
-                if (db_req("Room unspectate roomId=" + std::to_string(cli.spectateRoomId) + " user=" + cli.username, reply)) {
-                    if (reply.rfind("OK", 0) == 0) {
-                        {
-                            std::lock_guard<std::mutex> lock(g_clients_mutex);
-                            g_clients[cfd].spectateRoomId = 0;
-                        }
-                        lobby_send_frame(cfd, "OK UNSPECTATE");
-                        log_checkpoint("Lobby", "UNSPECTATE", "user=" + cli.username + " room=" + std::to_string(cli.spectateRoomId));
-                    } else {
-                        lobby_send_frame(cfd, reply);
-                        log_checkpoint("Lobby", "UNSPECTATE_FAIL",
-                                       "user=" + cli.username + " room=" + std::to_string(cli.spectateRoomId) + " reason=" + reply);
-                    }
-                } else {
-                    lobby_send_frame(cfd, "ERR db");
-                    log_checkpoint("Lobby", "UNSPECTATE_FAIL",
-                                   "user=" + cli.username + " room=" + std::to_string(cli.spectateRoomId) + " reason=db_error");
-                }
+        }
+        gravity_ms = std::clamp(gravity_ms, MIN_GRAVITY_MS, 2000);
+
+        // 1. Check the room and mark it playing in one atomic DB batch, so a
+        //    failed check changes nothing. Every match shares the scheduler's
+        //    game port; its connections are routed by the token.
+        std::string token = generate_token();
+        const std::string room_key = "roomId=" + std::to_string(rid);
+        std::string reply;
+        if (!db_req(db_atomic_request({"Room check " + room_key + " host=" + cli.username + " status=idle players=2",
+                                       "Room setStatus " + room_key + " status=playing",
+                                       "Room setToken " + room_key + " token=" + token}),
+                    reply)) {
+            lobby_send_frame(cfd, "ERR no_such_room"); return;
+        }
+        std::vector<std::string> replies = db_split_batch_reply(reply);
+        if (reply.rfind("OK", 0) != 0) {
+            const std::string why = replies.empty() ? "" : replies.back();
+            if (why == "ERR not_host") lobby_send_frame(cfd, "ERR not_host");
+            else if (why == "ERR need_players") lobby_send_frame(cfd, "ERR need_2_players");
+            else if (why == "ERR status_mismatch") lobby_send_frame(cfd, "ERR already_playing");
+            else lobby_send_frame(cfd, "ERR no_such_room");
+            return;
+        }
+
+        // 2. Room is ours; the check answered with its players
+        auto room_map = parse_ok_reply(replies[0]);
+        std::string p1_name = room_map["p1"];
+        std::string p2_name = room_map["p2"];
+        invalidate_room(rid);
+
+        // 3. Hand the match to the room scheduler, then send both players there
+        int worker = g_room_scheduler.add_room(match_config(rid, token, p1_name, p2_name, gravity_ms, false));
+        if (worker >= 0) g_game_registry.set_worker(rid, worker);
+        match_ready(rid, token, p1_name, p2_name, gravity_ms);
+    }
+    else if (cmd == "QUEUE") {
+        if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        if (cli.roomId != 0) { lobby_send_frame(cfd, "ERR in_room"); return; }
+        int gravity_ms = server_config().gravity_ms;
+        std::string opt;
+        while (iss >> opt) {
+            if (opt.rfind("gravity=", 0) == 0) {
+                try { gravity_ms = std::stoi(opt.substr(8)); } catch (...) {}
             }
-            else if (cmd == "INVITE") { // **FIX: Added INVITE**
-                if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); continue; }
-                std::string target_user;
-                int rid = cli.roomId;
-                iss >> target_user;
-                if (rid == 0) { lobby_send_frame(cfd, "ERR not_in_room"); continue; }
-
-                // Only host can invite
-                if (db_req("Room invite roomId=" + std::to_string(rid) + " user=" + target_user + " host=" + cli.username, reply)) {
-                    lobby_send_frame(cfd, reply); // Forward DB reply (OK or ERR not_host)
-                    if (reply.rfind("OK", 0) == 0) {
-                        log_checkpoint("Lobby", "ROOM_INVITE",
-                                       "room=" + std::to_string(rid) + " from=" + cli.username + " to=" + target_user);
-                        std::string room_info;
-                        if (db_req("Room get roomId=" + std::to_string(rid), room_info) && room_info.rfind("OK", 0) == 0) {
-                            auto info = parse_ok_reply(room_info);
-                            std::string room_name = info.count("name") ? info["name"] : "";
-                            int target_fd = find_fd_by_username(target_user);
-                            if (target_fd != -1) {
-                                std::string notice = "ROOM_INVITE roomId=" + std::to_string(rid)
-                                                     + " name=" + room_name
-                                                     + " host=" + cli.username;
-                                lobby_send_frame(target_fd, notice);
-                            }
-                        }
-                    } else {
-                        log_checkpoint("Lobby", "ROOM_INVITE_FAIL",
-                                       "room=" + std::to_string(rid) + " from=" + cli.username + " to=" + target_user + " reason=" + reply);
-                    }
-                } else {
-                    lobby_send_frame(cfd, "ERR db");
-                    log_checkpoint("Lobby", "ROOM_INVITE_FAIL",
-                                   "room=" + std::to_string(rid) + " from=" + cli.username + " to=" + target_user + " reason=db_error");
-                }
+        }
+        const int rating = queue_rating(cli.username);
+        if (!g_matchmaker.add(cli.username, rating, std::clamp(gravity_ms, MIN_GRAVITY_MS, 2000),
+                              Matchmaker::Clock::now())) {
+            lobby_send_frame(cfd, "ERR already_queued");
+            return;
+        }
+        lobby_send_frame(cfd, "OK QUEUE rating=" + std::to_string(rating));
+        log_checkpoint("Lobby", "QUEUE", "user=" + cli.username + " rating=" + std::to_string(rating));
+    }
+    else if (cmd == "UNQUEUE") {
+        lobby_send_frame(cfd, g_matchmaker.remove(cli.username) ? "OK UNQUEUE" : "ERR not_queued");
+    }
+    else if (cmd == "TOURNAMENT_CREATE") {
+        if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); return; }
+        std::string name, list, opt;
+        iss >> name >> list;
+        int gravity_ms = server_config().gravity_ms;
+        while (iss >> opt) {
+            if (opt.rfind("gravity=", 0) == 0) {
+                try { gravity_ms = std::stoi(opt.substr(8)); } catch (...) {}
             }
-            else if (cmd == "LIST_INVITES") { // **FIX: Added LIST_INVITES**
-                 if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); continue; }
-                 if (db_req("Room listInvites user=" + cli.username, reply)) {
-                    lobby_send_frame(cfd, reply);
-                 } else {
-                    lobby_send_frame(cfd, "ERR db");
-                 }
+        }
+        std::vector<std::string> players;
+        std::stringstream ss(list);
+        for (std::string p; std::getline(ss, p, ',');) {
+            if (!p.empty()) players.push_back(p);
+        }
+        lobby_send_frame(cfd, tournament_create(cli.username, name, players, std::clamp(gravity_ms, MIN_GRAVITY_MS, 2000)));
+    }
+    else if (cmd == "TOURNAMENT_STATUS") {
+        int tid = 0;
+        iss >> tid;
+        lobby_send_frame(cfd, tournament_status(tid));
+    }
+    else {
+        lobby_send_frame(cfd, "ERR unknown_command");
+    }
+}
+
+static void on_client_event(Reactor& reactor, int cfd, uint32_t events);
+
+// Registers a connection once for input and output, edge-triggered, for as
+// long as it stays open; null (and the fd closed) if epoll refuses it
+static std::shared_ptr<LobbyConn> register_client(Reactor& reactor, int cfd, ClientInfo info) {
+    const uint32_t interest = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    if (!reactor.add(cfd, interest, [&reactor, cfd](uint32_t events) { on_client_event(reactor, cfd, events); })) {
+        perror("[Lobby] epoll_ctl");
+        ::close(cfd);
+        return nullptr;
+    }
+    auto conn = std::make_shared<LobbyConn>(cfd);
+    g_conns[cfd] = conn;
+    info.fd = cfd;
+    {
+        ClientShard& shard = client_shard(cfd);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.clients[cfd] = ClientEntry{std::move(info), conn};
+    }
+    g_metric_clients.add(1);
+    return conn;
+}
+
+// Edge-triggered: takes every pending connection
+static void accept_clients(int listen_fd, Reactor& reactor) {
+    while (true) {
+        int cfd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (cfd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("[Lobby] accept");
+            return;
+        }
+        if (!register_client(reactor, cfd, ClientInfo{})) continue;
+        log_checkpoint("Lobby", "CLIENT_CONNECTED", "fd=" + std::to_string(cfd));
+        lobby_send_frame(cfd, "WELCOME LOBBY");
+    }
+}
+
+static CommandClass command_class(std::string_view req) {
+    const std::string_view cmd = req.substr(0, req.find(' '));
+    if (cmd == "LIST_ROOMS" || cmd == "LIST_ONLINE" || cmd == "LEADERBOARD" || cmd == "STATS" ||
+        cmd == "LIST_INVITES" || cmd == "TOURNAMENT_STATUS") {
+        return CommandClass::Listing;
+    }
+    return cmd == "SPECTATE" ? CommandClass::Spectate : CommandClass::Play;
+}
+
+// Runs one read's worth of frames, on the client's lane
+static void run_client_frames(LobbyConn& conn, const std::vector<std::string>& frames) {
+    const int cfd = conn.fd;
+    ClientInfo cli; // Local copy
+    const auto now = std::chrono::steady_clock::now();
+    const ServerConfig& tun = server_config();
+    conn.refresh_limits(tun);
+    const bool behind = g_workers.backlog(static_cast<size_t>(cfd)) > tun.shed_backlog;
+    for (const std::string& req : frames) {
+        // Earlier frames of the batch may have logged in or joined a room
+        if (!client_info(cfd, cli)) return; // Disconnected already
+        const CommandClass cls = command_class(req);
+        if (behind && cls != CommandClass::Play) {
+            g_metric_shed.add();
+            lobby_send_frame(cfd, "ERR busy");
+            continue;
+        }
+        if (!conn.limits[static_cast<size_t>(cls)].take(now)) {
+            g_metric_rate_limited.add();
+            lobby_send_frame(cfd, "ERR rate_limited");
+            continue;
+        }
+        log_communication_lazy("Lobby", "RX", [&] { return peer_for_fd("client", cfd); }, req);
+        handle_client_command(cfd, cli, req);
+    }
+}
+
+// Reads what the client has sent and hands complete frames to its lane.
+// Edge-triggered, so the socket is read until empty; one that is still not
+// after kReadBurst reads goes back on the backlog, so a flooding client cannot
+// starve the others.
+static void serve_client_reads(Reactor& reactor, int cfd) {
+    auto cit = g_conns.find(cfd);
+    if (cit == g_conns.end()) return; // Disconnected already
+    LobbyConn& conn = *cit->second;
+    for (int burst = 0; burst < kReadBurst; ++burst) {
+        // A partial frame stays in the reader until the rest arrives
+        std::vector<std::string> frames;
+        FrameReader::ReadResult st = conn.reader.read_from(cfd, frames);
+        if (!frames.empty()) {
+            g_workers.post(static_cast<size_t>(cfd), [conn = cit->second, frames = std::move(frames)] {
+                run_client_frames(*conn, frames);
+            });
+        }
+        if (st != FrameReader::ReadResult::Ok) {
+            // Queued behind its frames; the lane closes the fd
+            reactor.remove(cfd);
+            g_conns.erase(cit);
+            g_workers.post(static_cast<size_t>(cfd), [cfd] { drop_client(cfd); });
+            return;
+        }
+        if (conn.reader.drained()) return;
+    }
+    g_read_backlog.push_back(cfd);
+}
+
+static void on_client_event(Reactor& reactor, int cfd, uint32_t events) {
+    if (events & EPOLLOUT) {
+        auto cit = g_conns.find(cfd);
+        if (cit != g_conns.end()) {
+            LobbyConn& conn = *cit->second;
+            std::lock_guard<std::mutex> lock(conn.write_mutex);
+            if (!conn.closed && !conn.writer.flush(cfd)) {
+                lobby_fail_client(cfd);
+                events |= EPOLLIN; // to read the EOF without waiting for its edge
             }
-            else if (cmd == "START_GAME") {
-                if (!cli.authed) { lobby_send_frame(cfd, "ERR not_logged_in"); continue; }
-                int rid = cli.roomId;
-                if (rid == 0) { lobby_send_frame(cfd, "ERR not_in_room"); continue; }
-
-                // 1. Get room details from DB
-                std::string room_details;
-                if (!db_req("Room get roomId=" + std::to_string(rid), room_details) || room_details.rfind("OK", 0) != 0) {
-                    lobby_send_frame(cfd, "ERR no_such_room"); continue;
-                }
+        }
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) serve_client_reads(reactor, cfd);
+}
 
-                auto room_map = parse_ok_reply(room_details);
-                if (room_map["host"] != cli.username) { lobby_send_frame(cfd, "ERR not_host"); continue; }
-                if (room_map["p1"].empty() || room_map["p2"].empty()) { lobby_send_frame(cfd, "ERR need_2_players"); continue; }
-                if (room_map["status"] != "idle") { lobby_send_frame(cfd, "ERR already_playing"); continue; }
-
-                // 2. Room is valid, create game server
-                uint16_t gport = 0;
-                int gfd = open_game_listener(gport);
-                if (gfd < 0 || gport < 10000) {
-                    lobby_send_frame(cfd, "ERR cannot_start_game_port");
-                    log_checkpoint("Lobby", "GAME_START_FAIL",
-                                   "room=" + std::to_string(rid) + " reason=listen_error");
-                    continue;
-                }
+// Bus thread: what the other lobby processes tell us (see g_bus)
+static void on_bus_message(const std::string& msg, const std::string& from) {
+    if (msg.rfind("NOTIFY ", 0) == 0) {
+        const size_t nl = msg.find('\n');
+        if (nl == std::string::npos) return;
+        std::shared_ptr<LobbyConn> conn = find_conn_by_username(message_field(std::string_view(msg).substr(0, nl), "user"));
+        if (conn) lobby_send_to(conn, msg.substr(nl + 1));
+    } else if (msg.rfind("ROOM ", 0) == 0) {
+        const int rid = message_int(msg, "room");
+        g_room_refresher.post(0, [rid] { refresh_room(rid); });
+    } else if (msg.rfind("MATCH ", 0) == 0) {
+        g_game_registry.put(message_int(msg, "room"),
+                            GameRoomEntry{static_cast<uint16_t>(message_int(msg, "port")), message_field(msg, "token"), -1});
+    } else if (msg.rfind("ROOM_FREE ", 0) == 0) {
+        g_game_registry.erase(message_int(msg, "room"), message_field(msg, "token"));
+    } else if (msg == "SYNC") {
+        // Only the matches this process hosts: they alone have a worker
+        std::vector<std::string> matches;
+        g_game_registry.for_each([&](int rid, const GameRoomEntry& entry) {
+            if (entry.worker >= 0) {
+                matches.push_back("MATCH room=" + std::to_string(rid) + " token=" + entry.token +
+                                  " port=" + std::to_string(entry.port));
+            }
+        });
+        for (auto const& m : matches) g_bus.send_to(from, m);
+    }
+}
 
-                // 3. Generate token and update DB
-                std::string token = generate_token();
-                std::string p1_name = room_map["p1"];
-                std::string p2_name = room_map["p2"];
-                db_req("Room setStatus roomId=" + std::to_string(rid) + " status=playing", reply);
-                db_req("Room setToken roomId=" + std::to_string(rid) + " token=" + token, reply);
-
-                {
-                    std::lock_guard<std::mutex> lock(g_games_mutex);
-                    g_game_ports[rid] = gport;
-                    g_game_tokens[rid] = token;
-                }
+// --- Hot restart ---
+// "--handoff <path>" listens on a UNIX socket for a successor; a new binary
+// started with "--takeover <path>" connects there and the running one hands it
+// everything but its matches, over SOCK_SEQPACKET with descriptors passed as
+// SCM_RIGHTS:
+//   LISTENERS version=<room cache version> tickets=<session ticket key> lease=<DB lease>
+//                                               + lobby and game listeners
+//   CLIENT user= authed= room= spec= sub= online_sub=\n<bytes of a partial frame>
+//                                               + the client's socket, per client
+//   MATCH room= token= port=                    per match it is still running
+//   DONE
+// then "ROOM_FREE room= token=" as each of those matches ends. Clients keep
+// their connection and login; output still queued for one is flushed first
+// (kHandoffDrainMs for all of them), and one that cannot be is logged off as if
+// it had disconnected. The successor serves everything new, and a game HELLO
+// whose token it has no room for goes back as "ROUTE token= spec= bin=" + the
+// socket, so reconnects and spectators of the old matches still find them. The
+// predecessor exits once its last match has reported. Online subscribers get
+// a full=1 ONLINE_UPDATE from the successor's own list. Connections its game
+// listener had accepted but whose HELLO had not arrived yet are closed.
+struct InheritedClient {
+    int fd = -1;
+    ClientInfo info;
+    bool subscribed = false;
+    bool online_subscribed = false;
+    std::string partial; // read, but not a whole frame yet
+};
+static std::string g_handoff_path;
+static std::mutex g_link_mutex; // senders on room and gateway threads; the main thread owns the fds
+static int g_successor_link = -1;   // after a handoff: the process that took over
+static int g_predecessor_link = -1; // after a takeover: the one still finishing its matches
+static constexpr int kHandoffDrainMs = 1000;
+
+// A match that was handed over (or that our predecessor ran) has ended
+static void match_ended(int rid, const std::string& token) {
+    std::lock_guard<std::mutex> lock(g_link_mutex);
+    if (g_successor_link < 0) return;
+    send_with_fds(g_successor_link, "ROOM_FREE room=" + std::to_string(rid) + " token=" + token, nullptr, 0);
+}
+
+// Scheduler fallback: game connections for tokens we have no room for
+static void forward_to_predecessor(int fd, const HelloRoute& hello) {
+    bool sent = false;
+    {
+        std::lock_guard<std::mutex> lock(g_link_mutex);
+        if (g_predecessor_link >= 0) {
+            sent = send_with_fds(g_predecessor_link,
+                                 "ROUTE token=" + hello.token + " spec=" + (hello.spectator ? "1" : "0") +
+                                     " bin=" + (hello.binary ? "1" : "0"),
+                                 &fd, 1);
+        }
+    }
+    if (!sent) {
+        log_checkpoint("Lobby", "ROUTE_REJECTED", "reason=unknown_token");
+        reject_hello(fd);
+        return;
+    }
+    ::close(fd); // the predecessor has its own copy now
+}
+
+// Old process, main thread: link is a successor that just connected. False
+// (and nothing changed) if it is gone before it got the listeners.
+static bool hand_off(int link, int& listen_fd, Reactor& reactor, MetricsHttpServer& metrics_http) {
+    uint64_t version;
+    {
+        std::shared_lock<std::shared_mutex> lock(g_room_cache_mutex);
+        version = g_room_version;
+    }
+    const int listeners[2] = {listen_fd, g_room_scheduler.shared_fd()};
+    const std::string header = "LISTENERS version=" + std::to_string(version) + " tickets=" + g_tickets.key_hex() +
+                               " lease=" + g_lease_id;
+    if (listeners[1] < 0 || !send_with_fds(link, header, listeners, 2)) {
+        log_checkpoint("Lobby", "HANDOFF_FAIL", "reason=successor_gone");
+        ::close(link);
+        return false;
+    }
+    log_checkpoint("Lobby", "HANDOFF_START",
+                   "clients=" + std::to_string(g_conns.size()) + " matches=" + std::to_string(g_room_scheduler.room_count()));
+    // From here on the successor serves new connections
+    metrics_http.stop();
+    reactor.remove(listen_fd);
+    ::close(listen_fd);
+    listen_fd = -1;
+    ::close(g_room_scheduler.release_shared());
+    // Commands in flight finish first, so the state handed over is final
+    g_workers.stop();
 
-                // 4. Tell both players
-                std::string msg = "GAME_READY port=" + std::to_string(gport) + " token=" + token;
-                int p1_fd = find_fd_by_username(p1_name);
-                int p2_fd = find_fd_by_username(p2_name);
-                if (p1_fd != -1) lobby_send_frame(p1_fd, msg);
-                if (p2_fd != -1) lobby_send_frame(p2_fd, msg);
-                log_checkpoint("Lobby", "GAME_START",
-                               "room=" + std::to_string(rid) + " port=" + std::to_string(gport) +
-                               " p1=" + p1_name + " p2=" + p2_name);
-
-                // 5. Spawn game thread
-                auto finish_cb = [rid](int room_id,
-                                      const std::string& user1,
-                                      int score1,
-                                      const std::string& user2,
-                                      int score2) {
-                    (void)room_id; // room_id == rid
-                    std::string reply;
-                    db_req("GameLog create roomId=" + std::to_string(rid)
-                           + " user1=" + user1
-                           + " user2=" + user2
-                           + " score1=" + std::to_string(score1)
-                           + " score2=" + std::to_string(score2), reply);
-                    db_req("Room setStatus roomId=" + std::to_string(rid) + " status=idle", reply);
-                };
-
-                std::thread([gfd, p1_name, p2_name, rid, token, finish_cb](){
-                    run_tetris_server_on_fd(gfd, p1_name, p2_name, g_db_ip, g_db_port, rid, token, &g_game_registry, finish_cb);
-                }).detach();
+    const auto drain_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kHandoffDrainMs);
+    size_t moved = 0;
+    for (auto const& [cfd, conn] : g_conns) {
+        reactor.remove(cfd);
+        ClientInfo cli;
+        if (!client_info(cfd, cli)) continue;
+        bool subscribed;
+        {
+            std::shared_lock<std::shared_mutex> lock(g_room_cache_mutex);
+            subscribed = g_room_subscribers.count(cfd) > 0;
+        }
+        bool online_subscribed;
+        {
+            std::shared_lock<std::shared_mutex> lock(g_presence_mutex);
+            online_subscribed = g_presence_subscribers.count(cfd) > 0;
+        }
+        bool flushed;
+        {
+            std::lock_guard<std::mutex> lock(conn->write_mutex);
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(drain_deadline - std::chrono::steady_clock::now());
+            flushed = conn->writer.drain(cfd, std::max<int>(0, static_cast<int>(left.count())));
+        }
+        const std::string msg = "CLIENT user=" + cli.username + " authed=" + (cli.authed ? "1" : "0") +
+                                " room=" + std::to_string(cli.roomId) + " spec=" + join_ints(cli.spectateRooms) +
+                                " sub=" + (subscribed ? "1" : "0") + " online_sub=" + (online_subscribed ? "1" : "0") +
+                                "\n" + conn->reader.take_buffered();
+        if (!flushed || !send_with_fds(link, msg, &cfd, 1)) {
+            drop_client(cfd);
+            continue;
+        }
+        // Forgotten here without logging off: the successor has it now
+        {
+            ClientShard& shard = client_shard(cfd);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.clients.erase(cfd);
+        }
+        room_cache_unsubscribe(cfd);
+        presence_unsubscribe(cfd);
+        if (cli.authed) release_username(cli.username, cfd);
+        g_metric_clients.add(-1);
+        std::lock_guard<std::mutex> lock(conn->write_mutex);
+        conn->closed = true;
+        ::close(cfd);
+        ++moved;
+    }
+    g_conns.clear();
+    g_read_backlog.clear();
+
+    // Under the link lock, so a match ending meanwhile is announced after DONE
+    // (its finish callback runs before the registry forgets it, so it is listed)
+    size_t matches = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_link_mutex);
+        g_game_registry.for_each([&](int rid, const GameRoomEntry& entry) {
+            send_with_fds(link, "MATCH room=" + std::to_string(rid) + " token=" + entry.token +
+                                    " port=" + std::to_string(entry.port), nullptr, 0);
+            ++matches;
+        });
+        send_with_fds(link, "DONE", nullptr, 0);
+        g_successor_link = link;
+    }
+    log_checkpoint("Lobby", "HANDOFF_DONE", "clients=" + std::to_string(moved) + " matches=" + std::to_string(matches));
+    return true;
+}
+
+// New process, before it opens anything: takes the listeners, clients and
+// match list of the process at path
+static bool take_over(const std::string& path, int& listen_fd, int& game_fd, std::vector<InheritedClient>& clients) {
+    int link = connect_unix(path);
+    if (link < 0) return false;
+    std::string msg;
+    std::vector<int> fds;
+    if (!recv_with_fds(link, msg, fds) || msg.rfind("LISTENERS ", 0) != 0 || fds.size() != 2) {
+        for (int fd : fds) ::close(fd);
+        ::close(link);
+        return false;
+    }
+    listen_fd = fds[0];
+    game_fd = fds[1];
+    {
+        std::unique_lock<std::shared_mutex> lock(g_room_cache_mutex);
+        g_room_version = std::strtoull(message_field(msg, "version").c_str(), nullptr, 10);
+    }
+    g_tickets.set_key(message_field(msg, "tickets")); // so the tickets it issued still work
+    if (!message_field(msg, "lease").empty()) g_lease_id = message_field(msg, "lease"); // its logins stay held
+    size_t matches = 0;
+    while (true) {
+        if (!recv_with_fds(link, msg, fds)) {
+            // Keep what arrived; its matches can no longer be reached from here
+            log_checkpoint("Lobby", "TAKEOVER_CUT_SHORT", "clients=" + std::to_string(clients.size()));
+            ::close(link);
+            link = -1;
+            break;
+        }
+        if (msg == "DONE") break;
+        if (msg.rfind("CLIENT ", 0) == 0 && fds.size() == 1) {
+            const size_t nl = msg.find('\n');
+            const std::string_view header = std::string_view(msg).substr(0, nl);
+            InheritedClient c;
+            c.fd = fds[0];
+            c.info.username = message_field(header, "user");
+            c.info.authed = message_field(header, "authed") == "1";
+            c.info.roomId = message_int(header, "room");
+            c.info.spectateRooms = split_ints(message_field(header, "spec"));
+            c.subscribed = message_field(header, "sub") == "1";
+            c.online_subscribed = message_field(header, "online_sub") == "1";
+            if (nl != std::string::npos) c.partial = msg.substr(nl + 1);
+            clients.push_back(std::move(c));
+            continue;
+        }
+        if (msg.rfind("MATCH ", 0) == 0) {
+            g_game_registry.put(message_int(msg, "room"),
+                                GameRoomEntry{static_cast<uint16_t>(message_int(msg, "port")), message_field(msg, "token"), -1});
+            ++matches;
+            continue;
+        }
+        for (int fd : fds) ::close(fd);
+    }
+    g_predecessor_link = link;
+    log_checkpoint("Lobby", "TAKEOVER",
+                   "clients=" + std::to_string(clients.size()) + " matches=" + std::to_string(matches));
+    return true;
+}
+
+// New process: the handed over clients join the reactor where they left off
+static void import_clients(Reactor& reactor, std::vector<InheritedClient>& clients) {
+    for (InheritedClient& c : clients) {
+        auto conn = register_client(reactor, c.fd, c.info);
+        if (!conn) {
+            if (c.info.authed) db_release_user(c.info);
+            continue;
+        }
+        conn->reader.preload(c.partial);
+        if (c.info.authed) claim_username(c.info.username, c.fd);
+        if (c.subscribed) room_cache_subscribe(c.fd);
+        if (c.online_subscribed) {
+            std::string names;
+            const uint64_t version = presence_subscribe(c.fd, names);
+            lobby_send_frame(c.fd, "ONLINE_UPDATE version=" + std::to_string(version) + " full=1 " + names);
+        }
+        g_read_backlog.push_back(c.fd); // whatever arrived during the handoff
+        log_checkpoint("Lobby", "CLIENT_INHERITED",
+                       "fd=" + std::to_string(c.fd) + (c.info.username.empty() ? "" : " user=" + c.info.username));
+    }
+    clients.clear();
+}
+
+// One message from the other process: ROUTE (we handed off) or ROOM_FREE (we
+// took over). EOF closes the link.
+static void serve_link(Reactor& reactor, int& link) {
+    std::string msg;
+    std::vector<int> fds;
+    if (!recv_with_fds(link, msg, fds)) {
+        reactor.remove(link);
+        std::lock_guard<std::mutex> lock(g_link_mutex);
+        ::close(link);
+        link = -1;
+        log_checkpoint("Lobby", "HANDOFF_LINK_CLOSED", "");
+        return;
+    }
+    if (msg.rfind("ROUTE ", 0) == 0 && fds.size() == 1) {
+        HelloRoute hello{message_field(msg, "token"), message_field(msg, "spec") == "1", message_field(msg, "bin") == "1"};
+        g_room_scheduler.route(fds[0], hello);
+        return;
+    }
+    if (msg.rfind("ROOM_FREE ", 0) == 0) {
+        const int rid = message_int(msg, "room");
+        const std::string token = message_field(msg, "token");
+        g_game_registry.erase(rid, token);
+        invalidate_room(rid);
+        match_ended(rid, token); // a successor of ours listed it too
+    }
+    for (int fd : fds) ::close(fd);
+}
+
+int main(int argc, char** argv) {
+    install_signal_handlers();
+    server_config_watch_sighup();
+
+    std::string ip = "0.0.0.0";
+    uint16_t lobby_port = 13472;
+    g_db_ip = "127.0.0.1";
+    g_db_port = 12977;
+
+    size_t workers = kDefaultWorkers;
+    size_t relay_workers = kDefaultRelayWorkers;
+    uint16_t game_port = 0;
+    int metrics_port = -1;
+    std::string takeover_path;
+    std::string bus_dir;
+    std::string results_path;
+    bool reuse_port = false;
+    bool pin_cpus = false;
+    int processes = 1;
+    if (argc >= 2) ip = argv[1];
+    if (argc >= 3) lobby_port = static_cast<uint16_t>(std::stoi(argv[2]));
+    if (argc >= 4) g_db_ip = argv[3];
+    if (argc >= 5) g_db_port = static_cast<uint16_t>(std::stoi(argv[4]));
+    // Any further "<ip>:<port>" arguments are more DB shards: shard 0 is the
+    // one above, shard k the k-th extra (db_server --shard k/n).
+    // "--trace-dir <dir>" writes a replay trace per match there, "--workers <n>"
+    // sets the command thread count (0: run commands on the I/O thread),
+    // "--game-port <port>" fixes the port every match is played on (default: any free one),
+    // "--metrics-port <port>" serves Prometheus metrics over HTTP there,
+    // "--relay-workers <n>" sets the spectator relay's thread count (0: no relay),
+    // "--spectator-relay <host>:<port>" points spectators at a remote relay,
+    // "--udp" lets players take snapshots and send inputs over UDP,
+    // "--pin-cpus" pins each room worker to a CPU of its own (see RoomScheduler),
+    // "--handoff <path>" lets a successor take over through that UNIX socket,
+    // "--takeover <path>" starts as the successor of the lobby listening there
+    // (see the hot restart section),
+    // "--reuseport" shares the lobby port with other lobby processes on the bus
+    // "--bus <dir>" (see g_bus), "--processes <n>" starts n of them at once
+    // (the bus defaults to /tmp/tetris_lobby_<port>.bus; fixed game and metrics
+    // ports and the handoff paths are per process: port + index, path.<index>),
+    // "--db-replica <host>:<port>", once per DB shard in shard order, sends
+    // the reads that may lag a little to read replicas (see db_read),
+    // "--ticket-key <32 hex digits>" signs session tickets with that key, so
+    // separately started lobbies accept each other's (see the sessions section),
+    // "--results-outbox <path>" keeps results not yet in the DB there (see g_results;
+    // each process takes a file of its own, <path>.1 and on when <path> is held),
+    // "--config <path>" reads tunables from that file, again on SIGHUP (see
+    // server_config.hpp; children of "--processes" are passed the signal).
+    std::vector<std::pair<std::string, uint16_t>> db_shards{{g_db_ip, g_db_port}};
+    std::vector<std::pair<std::string, uint16_t>> db_replicas;
+    for (int i = 5; i < argc; ++i) {
+        std::string endpoint = argv[i];
+        if (endpoint == "--trace-dir" && i + 1 < argc) {
+            g_trace_dir = argv[++i];
+            continue;
+        }
+        if (endpoint == "--workers" && i + 1 < argc) {
+            workers = static_cast<size_t>(std::max(0, std::stoi(argv[++i])));
+            continue;
+        }
+        if (endpoint == "--game-port" && i + 1 < argc) {
+            game_port = static_cast<uint16_t>(std::stoi(argv[++i]));
+            continue;
+        }
+        if (endpoint == "--metrics-port" && i + 1 < argc) {
+            metrics_port = std::stoi(argv[++i]);
+            continue;
+        }
+        if (endpoint == "--handoff" && i + 1 < argc) {
+            g_handoff_path = argv[++i];
+            continue;
+        }
+        if (endpoint == "--takeover" && i + 1 < argc) {
+            takeover_path = argv[++i];
+            continue;
+        }
+        if (endpoint == "--bus" && i + 1 < argc) {
+            bus_dir = argv[++i];
+            continue;
+        }
+        if (endpoint == "--reuseport") {
+            reuse_port = true;
+            continue;
+        }
+        if (endpoint == "--processes" && i + 1 < argc) {
+            processes = std::max(1, std::stoi(argv[++i]));
+            continue;
+        }
+        if (endpoint == "--udp") {
+            g_offer_udp = true;
+            continue;
+        }
+        if (endpoint == "--pin-cpus") {
+            pin_cpus = true;
+            continue;
+        }
+        if (endpoint == "--db-replica" && i + 1 < argc) {
+            std::string replica = argv[++i];
+            size_t colon = replica.rfind(':');
+            if (colon == std::string::npos) { std::cerr << "[Lobby] bad DB replica " << replica << "\n"; return 1; }
+            db_replicas.emplace_back(replica.substr(0, colon), static_cast<uint16_t>(std::stoi(replica.substr(colon + 1))));
+            continue;
+        }
+        if (endpoint == "--config" && i + 1 < argc) {
+            std::string error;
+            if (!server_config_load(argv[++i], error)) { std::cerr << "[Lobby] " << error << "\n"; return 1; }
+            continue;
+        }
+        if (endpoint == "--results-outbox" && i + 1 < argc) {
+            results_path = argv[++i];
+            continue;
+        }
+        if (endpoint == "--ticket-key" && i + 1 < argc) {
+            if (!g_tickets.set_key(argv[++i])) { std::cerr << "[Lobby] --ticket-key needs 32 hex digits\n"; return 1; }
+            continue;
+        }
+        if (endpoint == "--relay-workers" && i + 1 < argc) {
+            relay_workers = static_cast<size_t>(std::max(0, std::stoi(argv[++i])));
+            continue;
+        }
+        if (endpoint == "--spectator-relay" && i + 1 < argc) {
+            std::string relay = argv[++i];
+            size_t colon = relay.rfind(':');
+            if (colon == std::string::npos) { std::cerr << "[Lobby] bad spectator relay " << relay << "\n"; return 1; }
+            g_public_relay_host = relay.substr(0, colon);
+            g_public_relay_port = static_cast<uint16_t>(std::stoi(relay.substr(colon + 1)));
+            continue;
+        }
+        size_t colon = endpoint.rfind(':');
+        if (colon == std::string::npos) { std::cerr << "[Lobby] bad DB shard " << endpoint << "\n"; return 1; }
+        db_shards.emplace_back(endpoint.substr(0, colon), static_cast<uint16_t>(std::stoi(endpoint.substr(colon + 1))));
+    }
+
+    // One process per "--processes", forked before any thread exists; the
+    // children go down with the first one
+    std::vector<pid_t> children;
+    int process_index = 0;
+    if (processes > 1) {
+        reuse_port = true;
+        if (bus_dir.empty()) bus_dir = "/tmp/tetris_lobby_" + std::to_string(lobby_port) + ".bus";
+        for (int k = 1; k < processes; ++k) {
+            pid_t pid = ::fork();
+            if (pid < 0) { perror("[Lobby] fork"); return 1; }
+            if (pid == 0) {
+                ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+                children.clear();
+                process_index = k;
+                break;
             }
-            else {
-                lobby_send_frame(cfd, "ERR unknown_command");
+            children.push_back(pid);
+        }
+        if (game_port != 0) game_port = static_cast<uint16_t>(game_port + process_index);
+        if (metrics_port > 0) metrics_port += process_index;
+        const std::string suffix = "." + std::to_string(process_index);
+        if (!g_handoff_path.empty()) g_handoff_path += suffix;
+        if (!takeover_path.empty()) takeover_path += suffix;
+    }
+    if (reuse_port && bus_dir.empty()) { std::cerr << "[Lobby] --reuseport needs --bus <dir>\n"; return 1; }
+    g_lease_id = new_lease_id();
+
+    if (!g_db.connect(db_shards, kDbConnections)) { std::cerr << "[Lobby] cannot connect to DB\n"; return 1; }
+    log_checkpoint("Lobby", "DB_CONNECTED",
+                   g_db_ip + ":" + std::to_string(g_db_port) + " shards=" + std::to_string(g_db.shards()));
+    if (!db_replicas.empty()) {
+        // Without them every read simply stays on the primaries
+        bool ok = g_db.connect_replicas(db_replicas, kDbConnections);
+        if (!ok) std::cerr << "[Lobby] cannot use the DB replicas (one per shard, all reachable)\n";
+        log_checkpoint("Lobby", ok ? "DB_REPLICAS_CONNECTED" : "DB_REPLICAS_FAILED",
+                       "replicas=" + std::to_string(db_replicas.size()));
+    }
+    if (results_path.empty()) results_path = "lobby_results_" + std::to_string(lobby_port) + ".outbox";
+    if (!g_results.start(results_path, [](const std::string& request) { return g_db.submit(request); })) {
+        std::cerr << "[Lobby] cannot open a results outbox at " << results_path << "\n";
+        return 1;
+    }
+
+    // A successor inherits both listeners, so clients never see them closed
+    int listen_fd = -1;
+    int game_fd = -1;
+    std::vector<InheritedClient> inherited;
+    if (!takeover_path.empty()) {
+        if (!take_over(takeover_path, listen_fd, game_fd, inherited)) {
+            std::cerr << "[Lobby] cannot take over from " << takeover_path << "\n";
+            return 1;
+        }
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+        if (::getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &len) == 0) lobby_port = ntohs(addr.sin_port);
+        std::cerr << "[Lobby] took over from " << takeover_path << ": " << inherited.size() << " clients\n";
+    } else {
+        listen_fd = start_tcp_server(ip.c_str(), lobby_port, reuse_port);
+        if (listen_fd < 0) return 1;
+    }
+    std::cerr << "[Lobby] listening on " << ip << ":" << lobby_port << "\n";
+    log_checkpoint("Lobby", "LISTENING", ip + ":" + std::to_string(lobby_port) +
+                                             (reuse_port ? " process=" + std::to_string(process_index) : ""));
+
+    if (game_fd >= 0 ? !g_room_scheduler.adopt_shared(game_fd) : !g_room_scheduler.listen_shared("0.0.0.0", game_port)) {
+        std::cerr << "[Lobby] cannot open game port\n";
+        return 1;
+    }
+    game_port = g_room_scheduler.shared_port();
+    if (g_predecessor_link >= 0) g_room_scheduler.set_fallback(forward_to_predecessor);
+    std::cerr << "[Lobby] matches on port " << game_port << "\n";
+    if (relay_workers > 0) {
+        g_spectator_relay = std::make_unique<SpectatorRelay>(relay_workers);
+        if (!g_spectator_relay->start()) {
+            std::cerr << "[Lobby] cannot start spectator relay\n";
+            return 1;
+        }
+        g_room_scheduler.set_relay(g_spectator_relay.get());
+    }
+    // Each process of "--processes" starts where the previous one's workers end
+    g_room_scheduler.set_cpu_pinning(pin_cpus, static_cast<size_t>(process_index) * g_room_scheduler.worker_count());
+    if (!g_room_scheduler.start()) {
+        std::cerr << "[Lobby] cannot start room scheduler\n";
+        return 1;
+    }
+    // A batch's ROOM_UPDATEs and ONLINE_UPDATEs reach each subscriber in one flush
+    g_room_refresher.set_batch_hooks(lobby_cork, lobby_uncork);
+    g_room_refresher.start(1);
+    if (!room_cache_load()) { std::cerr << "[Lobby] cannot load room list\n"; return 1; }
+    presence_poll();
+    if (!bus_dir.empty()) {
+        if (!g_bus.open(bus_dir) || !g_bus.start(on_bus_message)) { std::cerr << "[Lobby] cannot join bus " << bus_dir << "\n"; return 1; }
+        g_bus.publish("SYNC");
+    }
+    g_workers.set_batch_hooks(lobby_cork, lobby_uncork);
+    g_workers.start(workers);
+
+    metrics().gauge_fn("lobby_matches", "Matches running on the room scheduler",
+                       [] { return static_cast<double>(g_room_scheduler.room_count()); });
+    metrics().gauge_fn("lobby_online_users", "Users online in the presence mirror", [] {
+        std::shared_lock<std::shared_mutex> lock(g_presence_mutex);
+        return static_cast<double>(g_online.size());
+    });
+    metrics().gauge_fn("lobby_public_rooms", "Public rooms in the room cache", [] {
+        std::shared_lock<std::shared_mutex> lock(g_room_cache_mutex);
+        return static_cast<double>(g_room_rows.size());
+    });
+    MetricsHttpServer metrics_http;
+    if (metrics_port >= 0) {
+        uint16_t mport = static_cast<uint16_t>(metrics_port);
+        if (!metrics_http.start(ip.c_str(), mport)) { std::cerr << "[Lobby] cannot open metrics port\n"; return 1; }
+        std::cerr << "[Lobby] metrics on " << ip << ":" << mport << "\n";
+    }
+
+    // A core Reactor with a persistent interest set: the listener and every
+    // client are added once, edge-triggered (clients for both directions), and
+    // leave when closed, so idle connections cost nothing per wakeup.
+    Reactor reactor;
+    if (!reactor.ok() || ::fcntl(listen_fd, F_SETFL, ::fcntl(listen_fd, F_GETFL) | O_NONBLOCK) < 0) {
+        perror("[Lobby] epoll");
+        return 1;
+    }
+    reactor.add(listen_fd, EPOLLIN | EPOLLET, [&](uint32_t) { accept_clients(listen_fd, reactor); });
+    import_clients(reactor, inherited);
+
+    // The handoff socket and the links to the other process are level-triggered
+    auto watch_link = [&reactor](int* link) {
+        reactor.add(*link, EPOLLIN, [&reactor, link](uint32_t) { serve_link(reactor, *link); });
+    };
+    if (g_predecessor_link >= 0) watch_link(&g_predecessor_link);
+    int handoff_fd = -1;
+    bool handed_off = false;
+    std::function<void()> watch_handoff = [&] {
+        reactor.add(handoff_fd, EPOLLIN, [&](uint32_t) {
+            int link = ::accept4(handoff_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (link < 0) return;
+            reactor.remove(handoff_fd);
+            ::close(handoff_fd);
+            ::unlink(g_handoff_path.c_str());
+            handoff_fd = -1;
+            if (!hand_off(link, listen_fd, reactor, metrics_http)) {
+                handoff_fd = start_unix_server(g_handoff_path); // for the next attempt
+                if (handoff_fd >= 0) watch_handoff();
+                return;
             }
+            // the clients' events still due this round were dropped with them
+            handed_off = true;
+            watch_link(&g_successor_link);
+            std::cerr << "[Lobby] handed off; finishing " << g_room_scheduler.room_count() << " matches\n";
+        });
+    };
+    if (!g_handoff_path.empty()) {
+        handoff_fd = start_unix_server(g_handoff_path);
+        if (handoff_fd < 0) { std::cerr << "[Lobby] cannot listen on " << g_handoff_path << "\n"; return 1; }
+        watch_handoff();
+        log_checkpoint("Lobby", "HANDOFF_LISTENING", g_handoff_path);
+    }
+
+    // Periodic work runs on reactor timers that re-arm themselves
+    std::function<void(int, std::function<void()>)> every = [&](int ms, std::function<void()> fn) {
+        reactor.after(ms, [&every, ms, fn] {
+            fn();
+            every(ms, fn);
+        });
+    };
+    every(kPresencePollMs, presence_poll_soon);
+    auto renew_lease = [] {
+        g_db.submit("User lease lease=" + g_lease_id + " ttl=" + std::to_string(kLeaseTtlMs)); // reply not needed
+    };
+    renew_lease();
+    every(kLeaseRenewMs, renew_lease);
+    every(kMatchmakeMs, matchmake);
+
+    while (running) {
+        if (!g_db.connected()) {
+            std::cerr << "[Lobby] DB connection lost." << std::endl;
+            running = 0; break;
+        }
+        // Handed off: done once our matches (and those we relay for) are
+        if (handed_off && g_room_scheduler.room_count() == 0 && g_predecessor_link < 0) {
+            log_checkpoint("Lobby", "HANDOFF_EXIT", "");
+            break;
         }
+
+        trace_poll_signal();
+        if (server_config_poll_signal()) {
+            for (pid_t pid : children) ::kill(pid, SIGHUP);
+        }
+        LobbyCork cork; // whatever this round sends goes out at its end
+        // Left-over input is served first, without sleeping
+        std::vector<int> backlog;
+        backlog.swap(g_read_backlog);
+        for (int fd : backlog) serve_client_reads(reactor, fd);
+        reactor.run_once(g_read_backlog.empty() ? 500 : 0);
     }
 
+    // Commands in flight finish, then running matches report their results and
+    // the outbox has a last go at them, all before the DB link goes away
+    metrics_http.stop();
+    g_workers.stop();
+    g_room_scheduler.stop();
+    g_results.stop();
+    if (g_spectator_relay) g_spectator_relay->stop();
+    g_room_refresher.stop();
+    g_bus.stop();
+
     // Close all client sockets
-    {
-        std::lock_guard<std::mutex> lock(g_clients_mutex);
-        for (auto const& [fd, client] : g_clients) {
+    for (ClientShard& shard : g_client_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto const& [fd, client] : shard.clients) {
             ::close(fd);
         }
-        g_clients.clear();
+        shard.clients.clear();
     }
-    ::close(listen_fd);
-    ::close(db_fd);
+    g_conns.clear();
+    if (listen_fd >= 0) ::close(listen_fd);
+    if (handoff_fd >= 0) {
+        ::close(handoff_fd);
+        ::unlink(g_handoff_path.c_str());
+    }
+    for (int* link : {&g_successor_link, &g_predecessor_link}) {
+        std::lock_guard<std::mutex> lock(g_link_mutex);
+        if (*link >= 0) ::close(*link);
+        *link = -1;
+    }
+    g_db.close();
+    for (pid_t pid : children) ::kill(pid, SIGTERM);
+    for (pid_t pid : children) ::waitpid(pid, nullptr, 0);
     return 0;
 }
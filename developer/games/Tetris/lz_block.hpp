@@ -0,0 +1,104 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Byte-oriented LZ77 block codec in the LZ4 mould, for data that is written
+// once and read back in pieces (match archives). No dictionary, no entropy
+// stage: a block decodes on its own, and decoding is a copy loop. A block is
+// a run of sequences:
+//   u8 token: literal count << 4 | (match length - LZ_MIN_MATCH)
+//   [255 ... n] more literal count when the nibble is 15
+//   literals
+//   u16 match offset back from the end of the output (little-endian)
+//   [255 ... n] more match length when the nibble is 15
+// The last sequence is literals only; its end is the end of the block.
+constexpr size_t LZ_MIN_MATCH = 4;
+constexpr size_t LZ_MAX_OFFSET = 65535;
+
+namespace lz_detail {
+inline uint32_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+inline void put_length(std::string& out, size_t n) {
+    for (; n >= 255; n -= 255) out.push_back(static_cast<char>(255));
+    out.push_back(static_cast<char>(n));
+}
+
+inline void put_sequence(std::string& out, const char* literals, size_t literal_count, size_t offset,
+                         size_t match_len) {
+    const size_t extra = match_len ? match_len - LZ_MIN_MATCH : 0;
+    out.push_back(static_cast<char>((std::min<size_t>(literal_count, 15) << 4) | std::min<size_t>(extra, 15)));
+    if (literal_count >= 15) put_length(out, literal_count - 15);
+    out.append(literals, literal_count);
+    if (match_len == 0) return;
+    out.push_back(static_cast<char>(offset));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (extra >= 15) put_length(out, extra - 15);
+}
+} // namespace lz_detail
+
+// Appends the compressed form of src[0, n) to out
+inline void lz_compress(const char* src, size_t n, std::string& out) {
+    constexpr int kHashBits = 12;
+    std::vector<uint32_t> table(size_t{1} << kHashBits, 0); // position + 1 of the last 4 bytes with that hash
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= n) {
+        const uint32_t word = lz_detail::read32(src + i);
+        const uint32_t h = (word * 2654435761u) >> (32 - kHashBits);
+        const size_t candidate = table[h];
+        table[h] = static_cast<uint32_t>(i + 1);
+        if (candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET || lz_detail::read32(src + candidate - 1) != word) {
+            ++i;
+            continue;
+        }
+        const size_t from = candidate - 1;
+        size_t len = LZ_MIN_MATCH;
+        while (i + len < n && src[from + len] == src[i + len]) ++len;
+        lz_detail::put_sequence(out, src + anchor, i - anchor, i - from, len);
+        i += len;
+        anchor = i;
+    }
+    lz_detail::put_sequence(out, src + anchor, n - anchor, 0, 0);
+}
+
+// Replaces out with the decompressed block src[0, n), which must come to
+// exactly raw_size bytes; false if it is damaged
+inline bool lz_decompress(const char* src, size_t n, size_t raw_size, std::string& out) {
+    out.clear();
+    out.reserve(raw_size);
+    size_t pos = 0;
+    auto length = [&](size_t& v) {
+        for (;;) {
+            if (pos >= n) return false;
+            const uint8_t b = static_cast<uint8_t>(src[pos++]);
+            v += b;
+            if (b != 255) return true;
+        }
+    };
+    while (pos < n) {
+        const uint8_t token = static_cast<uint8_t>(src[pos++]);
+        size_t literals = token >> 4;
+        if (literals == 15 && !length(literals)) return false;
+        if (literals > n - pos || out.size() + literals > raw_size) return false;
+        out.append(src + pos, literals);
+        pos += literals;
+        if (pos == n) break;
+        if (n - pos < 2) return false;
+        const size_t offset = static_cast<uint8_t>(src[pos]) | size_t(static_cast<uint8_t>(src[pos + 1])) << 8;
+        pos += 2;
+        size_t len = token & 0x0F;
+        if (len == 15 && !length(len)) return false;
+        len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out.size() || out.size() + len > raw_size) return false;
+        // Byte by byte: a match may overlap what it copies (a run)
+        for (size_t k = 0; k < len; ++k) out.push_back(out[out.size() - offset]);
+    }
+    return out.size() == raw_size;
+}
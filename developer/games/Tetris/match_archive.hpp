@@ -0,0 +1,356 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "lz_block.hpp"
+#include "tetris_lockstep.hpp"
+#include "tetris_trace.hpp"
+
+// Finished matches packed into one file, so they can be watched again long
+// after their rooms are gone. Each match is its replay trace (tetris_trace.hpp)
+// cut into blocks that start with both boards as they stood, so a viewer can
+// start anywhere: the seek index names the block, its keyframes restore the
+// boards and only that block's events are replayed. Blocks are compressed on
+// their own (lz_block.hpp), which about pays for the keyframes: an archive
+// comes out a little smaller than the traces it was packed from. Integers are
+// little-endian:
+//   file:   "TARC" | u8 version | blocks | index | footer
+//   block:  compressed: both boards' state (encode_lockstep_state, board 0
+//           first) | events as in a trace, the first delta counted from base_ms
+//   index:  u32 match count, then per match: u32 room | i64 seed | u16 gravity_ms
+//           | i64 start (unix ms) | two names as u8 length + bytes | u8 complete
+//           | u64 duration_ms | u32 block count, then per block: u64 file offset
+//           | u32 stored bytes | u32 raw bytes | u64 base_ms (when the event
+//           before its first happened)
+//   footer: u64 index offset | "TARX"
+// A block is cut every ARCHIVE_KEYFRAME_MS of match time or ARCHIVE_BLOCK_BYTES
+// of events, whichever comes first, so no seek replays more than that.
+constexpr char ARCHIVE_MAGIC[4] = {'T', 'A', 'R', 'C'};
+constexpr char ARCHIVE_FOOTER_MAGIC[4] = {'T', 'A', 'R', 'X'};
+constexpr uint8_t ARCHIVE_VERSION = 1;
+constexpr uint64_t ARCHIVE_KEYFRAME_MS = 30000;
+constexpr size_t ARCHIVE_BLOCK_BYTES = 16 * 1024;
+constexpr size_t ARCHIVE_FOOTER_SIZE = 12;
+
+struct ArchivedBlock {
+    uint64_t offset = 0;
+    uint32_t stored = 0;
+    uint32_t raw = 0;
+    uint64_t base_ms = 0;
+};
+
+struct ArchivedMatch {
+    TraceHeader header;
+    bool complete = false; // the trace reached its End event
+    uint64_t duration_ms = 0;
+    std::vector<ArchivedBlock> blocks;
+
+    // "room<id>-<seed>", as the trace file was named
+    std::string key() const { return "room" + std::to_string(header.room_id) + "-" + std::to_string(header.seed); }
+};
+
+// Packs traces into a new archive. Matches are kept in the order added.
+class MatchArchiveWriter {
+public:
+    bool open(const std::string& path) {
+        out_.open(path, std::ios::binary | std::ios::trunc);
+        if (!out_) return false;
+        out_.write(ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+        out_.put(static_cast<char>(ARCHIVE_VERSION));
+        offset_ = sizeof(ARCHIVE_MAGIC) + 1;
+        index_.clear();
+        count_ = 0;
+        return true;
+    }
+
+    // Adds one match from its trace; false (and nothing written) if it is not one
+    bool add(std::string_view trace) {
+        TraceHeader header;
+        std::vector<TraceEvent> events;
+        bool complete = false;
+        if (!parse_match_trace(trace, header, [&](const TraceEvent& ev) { events.push_back(ev); }, &complete)) {
+            return false;
+        }
+        auto sequence = std::make_shared<PieceSequence>(header.seed);
+        TetrisGame games[2] = {TetrisGame(sequence), TetrisGame(sequence)};
+
+        std::vector<ArchivedBlock> blocks;
+        std::string raw;
+        uint64_t at = 0, base = 0;
+        auto start_block = [&] {
+            raw.clear();
+            for (const TetrisGame& g : games) encode_lockstep_state(raw, g, 0, 0);
+            base = at;
+        };
+        auto end_block = [&] {
+            std::string stored;
+            lz_compress(raw.data(), raw.size(), stored);
+            blocks.push_back(ArchivedBlock{offset_, static_cast<uint32_t>(stored.size()),
+                                           static_cast<uint32_t>(raw.size()), base});
+            out_.write(stored.data(), static_cast<std::streamsize>(stored.size()));
+            offset_ += stored.size();
+        };
+        start_block();
+        for (const TraceEvent& ev : events) {
+            if (raw.size() > 2 * LOCK_STATE_SIZE &&
+                (raw.size() >= ARCHIVE_BLOCK_BYTES + 2 * LOCK_STATE_SIZE || ev.at_ms - base >= ARCHIVE_KEYFRAME_MS)) {
+                end_block();
+                start_block();
+            }
+            const int action = ev.kind == TraceKind::Input ? static_cast<int>(ev.action) : -1;
+            trace_put_event(raw, ev.kind, ev.board, ev.at_ms - at, action);
+            trace_apply(games[ev.board], ev);
+            at = ev.at_ms;
+        }
+        end_block();
+
+        trace_put_le(index_, header.room_id, 4);
+        trace_put_le(index_, static_cast<uint64_t>(header.seed), 8);
+        trace_put_le(index_, header.gravity_ms, 2);
+        trace_put_le(index_, static_cast<uint64_t>(header.start_unix_ms), 8);
+        for (const std::string& name : header.names) {
+            index_.push_back(static_cast<char>(name.size()));
+            index_.append(name);
+        }
+        index_.push_back(complete ? 1 : 0);
+        trace_put_le(index_, at, 8);
+        trace_put_le(index_, blocks.size(), 4);
+        for (const ArchivedBlock& b : blocks) {
+            trace_put_le(index_, b.offset, 8);
+            trace_put_le(index_, b.stored, 4);
+            trace_put_le(index_, b.raw, 4);
+            trace_put_le(index_, b.base_ms, 8);
+        }
+        ++count_;
+        return static_cast<bool>(out_);
+    }
+
+    // Writes the index; the archive is only readable once this returns true
+    bool finish() {
+        std::string tail;
+        trace_put_le(tail, count_, 4);
+        tail += index_;
+        trace_put_le(tail, offset_, 8);
+        tail.append(ARCHIVE_FOOTER_MAGIC, sizeof(ARCHIVE_FOOTER_MAGIC));
+        out_.write(tail.data(), static_cast<std::streamsize>(tail.size()));
+        out_.close();
+        return !out_.fail();
+    }
+
+    uint32_t matches() const { return count_; }
+    // Bytes of blocks written so far
+    uint64_t bytes() const { return offset_; }
+
+private:
+    std::ofstream out_;
+    uint64_t offset_ = 0;
+    std::string index_;
+    uint32_t count_ = 0;
+};
+
+// An archive mapped read-only; blocks are decompressed as they are asked for,
+// so however many matches it holds, only those being watched are touched
+class MatchArchive {
+public:
+    MatchArchive() = default;
+    MatchArchive(const MatchArchive&) = delete;
+    MatchArchive& operator=(const MatchArchive&) = delete;
+    ~MatchArchive() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            size_ = static_cast<size_t>(st.st_size);
+            void* map = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) data_ = static_cast<const char*>(map);
+        }
+        ::close(fd);
+        if (!data_ || !parse_index()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (data_) ::munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+        matches_.clear();
+        by_key_.clear();
+    }
+
+    const std::vector<ArchivedMatch>& matches() const { return matches_; }
+
+    // The match of that key(), null if the archive has none
+    const ArchivedMatch* find(const std::string& key) const {
+        auto it = by_key_.find(key);
+        return it == by_key_.end() ? nullptr : &matches_[it->second];
+    }
+
+    // Decompresses one of m's blocks into out; false if it is damaged
+    bool read_block(const ArchivedBlock& b, std::string& out) const {
+        return lz_decompress(data_ + b.offset, b.stored, b.raw, out) && b.raw >= 2 * LOCK_STATE_SIZE;
+    }
+
+private:
+    bool parse_index() {
+        if (size_ < sizeof(ARCHIVE_MAGIC) + 1 + ARCHIVE_FOOTER_SIZE) return false;
+        if (std::memcmp(data_, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 || data_[4] != ARCHIVE_VERSION) return false;
+        if (std::memcmp(data_ + size_ - 4, ARCHIVE_FOOTER_MAGIC, sizeof(ARCHIVE_FOOTER_MAGIC)) != 0) return false;
+        const size_t end = size_ - ARCHIVE_FOOTER_SIZE;
+        size_t pos = end;
+        uint64_t index_at = 0;
+        if (!take(pos, size_ - 4, 8, index_at) || index_at > end) return false;
+        pos = static_cast<size_t>(index_at);
+        uint64_t count = 0;
+        if (!take(pos, end, 4, count)) return false;
+        for (uint64_t i = 0; i < count; ++i) {
+            ArchivedMatch m;
+            uint64_t room, seed, gravity, start, complete, blocks;
+            if (!take(pos, end, 4, room) || !take(pos, end, 8, seed) || !take(pos, end, 2, gravity) ||
+                !take(pos, end, 8, start)) {
+                return false;
+            }
+            m.header.room_id = static_cast<uint32_t>(room);
+            m.header.seed = static_cast<int64_t>(seed);
+            m.header.gravity_ms = static_cast<uint16_t>(gravity);
+            m.header.start_unix_ms = static_cast<int64_t>(start);
+            for (std::string& name : m.header.names) {
+                uint64_t n;
+                if (!take(pos, end, 1, n) || pos + n > end) return false;
+                name.assign(data_ + pos, n);
+                pos += n;
+            }
+            if (!take(pos, end, 1, complete) || !take(pos, end, 8, m.duration_ms) || !take(pos, end, 4, blocks)) {
+                return false;
+            }
+            m.complete = complete != 0;
+            for (uint64_t k = 0; k < blocks; ++k) {
+                ArchivedBlock b;
+                uint64_t stored, raw;
+                if (!take(pos, end, 8, b.offset) || !take(pos, end, 4, stored) || !take(pos, end, 4, raw) ||
+                    !take(pos, end, 8, b.base_ms)) {
+                    return false;
+                }
+                b.stored = static_cast<uint32_t>(stored);
+                b.raw = static_cast<uint32_t>(raw);
+                if (b.offset + b.stored > index_at) return false;
+                m.blocks.push_back(b);
+            }
+            if (m.blocks.empty()) return false;
+            by_key_.emplace(m.key(), matches_.size());
+            matches_.push_back(std::move(m));
+        }
+        return true;
+    }
+
+    bool take(size_t& pos, size_t end, int bytes, uint64_t& v) const {
+        if (pos + bytes > end) return false;
+        v = 0;
+        for (int i = 0; i < bytes; ++i) v |= uint64_t(static_cast<uint8_t>(data_[pos + i])) << (8 * i);
+        pos += bytes;
+        return true;
+    }
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<ArchivedMatch> matches_;
+    std::unordered_map<std::string, size_t> by_key_;
+};
+
+// Plays one archived match forward from any point in it: seek() puts both
+// boards where they stood, then next() applies the events that follow, one by
+// one, across blocks. The archive must outlive the cursor.
+class ArchiveCursor {
+public:
+    ArchiveCursor(const MatchArchive& archive, const ArchivedMatch& match)
+        : archive_(archive), match_(match), sequence_(std::make_shared<PieceSequence>(match.header.seed)),
+          games_{TetrisGame(sequence_), TetrisGame(sequence_)} {}
+
+    // Boards as they were at at_ms (events at that very time applied); false
+    // if the archive is damaged there
+    bool seek(uint64_t at_ms) {
+        size_t b = 0;
+        while (b + 1 < match_.blocks.size() && match_.blocks[b + 1].base_ms <= at_ms) ++b;
+        if (!load(b, true)) return false;
+        uint64_t next_at;
+        TraceEvent ev;
+        while (peek(next_at) && next_at <= at_ms) next(ev);
+        return ok_;
+    }
+
+    // When the next event happens; false at the end of the match
+    bool peek(uint64_t& at_ms) {
+        if (!advance_block()) return false;
+        size_t pos = pos_;
+        uint64_t at = at_ms_;
+        TraceEvent ev;
+        if (!trace_next_event(block_, pos, at, ev)) return false;
+        at_ms = ev.at_ms;
+        return true;
+    }
+
+    // Applies the next event to its board; false at the end of the match
+    bool next(TraceEvent& ev) {
+        if (!advance_block() || !trace_next_event(block_, pos_, at_ms_, ev)) return false;
+        trace_apply(games_[ev.board], ev);
+        return true;
+    }
+
+    const TetrisGame& game(int board) const { return games_[board]; }
+    // When the last event applied happened
+    uint64_t at_ms() const { return at_ms_; }
+    const ArchivedMatch& match() const { return match_; }
+
+private:
+    // Reads block b; its keyframes replace the boards only on a seek, a block
+    // reached by playing on starts where the one before left off
+    bool load(size_t b, bool restore) {
+        ok_ = archive_.read_block(match_.blocks[b], block_);
+        block_index_ = b;
+        pos_ = 2 * LOCK_STATE_SIZE;
+        at_ms_ = match_.blocks[b].base_ms;
+        if (ok_ && restore) {
+            for (int i = 0; i < 2; ++i) {
+                TetrisGame game(sequence_);
+                uint32_t events = 0, seq = 0;
+                if (!decode_lockstep_state(block_.data() + i * LOCK_STATE_SIZE, game, events, seq)) ok_ = false;
+                else games_[i] = std::move(game);
+            }
+        }
+        if (!ok_) block_.resize(pos_ = 0);
+        return ok_;
+    }
+
+    bool advance_block() {
+        if (!ok_) return false;
+        if (pos_ < block_.size()) return true;
+        if (block_index_ + 1 >= match_.blocks.size()) return false;
+        return load(block_index_ + 1, false) && pos_ < block_.size();
+    }
+
+    const MatchArchive& archive_;
+    const ArchivedMatch& match_;
+    std::shared_ptr<PieceSequence> sequence_;
+    TetrisGame games_[2];
+    std::string block_;
+    size_t block_index_ = 0;
+    size_t pos_ = 0;
+    uint64_t at_ms_ = 0;
+    bool ok_ = false;
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Players waiting for a match, ordered by rating so a batch pairs neighbours
+// in one pass. Adding and removing a player are O(log n); match() is O(n) and
+// meant to run every so often over everyone who queued meanwhile, not per
+// request. Two neighbours are paired once their ratings are within the window
+// of the one who has waited longer; a window starts at kBaseWindow and widens
+// by kWidenPerSec for every second waited, up to kMaxWindow, so nobody waits
+// forever for an exact match. Thread-safe.
+class Matchmaker {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int kBaseWindow = 50;
+    static constexpr int kWidenPerSec = 25;
+    static constexpr int kMaxWindow = 1000;
+
+    struct Pair {
+        std::string p1, p2; // p1 waited longer
+        int rating1 = 0, rating2 = 0;
+        int gravity_ms = 0; // p1's
+    };
+
+    // False if the user is already waiting
+    bool add(const std::string& user, int rating, int gravity_ms, Clock::time_point now) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (by_user_.count(user)) return false;
+        auto pos = waiting_.insert(Waiting{rating, next_seq_++, user, gravity_ms, now}).first;
+        by_user_.emplace(user, pos);
+        return true;
+    }
+
+    // False if the user was not waiting
+    bool remove(const std::string& user) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = by_user_.find(user);
+        if (it == by_user_.end()) return false;
+        waiting_.erase(it->second);
+        by_user_.erase(it);
+        return true;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return waiting_.size();
+    }
+
+    // Takes every pair that fits out of the queue
+    std::vector<Pair> match(Clock::time_point now) {
+        std::vector<Pair> pairs;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto prev = waiting_.end();
+        for (auto it = waiting_.begin(); it != waiting_.end();) {
+            if (prev == waiting_.end()) {
+                prev = it++;
+                continue;
+            }
+            const Waiting& a = *prev;
+            const Waiting& b = *it;
+            const Waiting& older = a.since <= b.since ? a : b;
+            if (b.rating - a.rating > window(older, now)) {
+                prev = it++;
+                continue;
+            }
+            const Waiting& newer = &older == &a ? b : a;
+            pairs.push_back(Pair{older.user, newer.user, older.rating, newer.rating, older.gravity_ms});
+            by_user_.erase(a.user);
+            by_user_.erase(b.user);
+            waiting_.erase(prev);
+            it = waiting_.erase(it);
+            prev = waiting_.end();
+        }
+        return pairs;
+    }
+
+private:
+    struct Waiting {
+        int rating = 0;
+        uint64_t seq = 0; // tie-break, and keeps equal ratings in arrival order
+        std::string user;
+        int gravity_ms = 0;
+        Clock::time_point since;
+
+        bool operator<(const Waiting& o) const { return std::tie(rating, seq) < std::tie(o.rating, o.seq); }
+    };
+
+    static int window(const Waiting& w, Clock::time_point now) {
+        const auto waited = std::chrono::duration_cast<std::chrono::seconds>(now - w.since).count();
+        return static_cast<int>(std::min<int64_t>(kMaxWindow, kBaseWindow + kWidenPerSec * waited));
+    }
+
+    mutable std::mutex mutex_;
+    std::set<Waiting> waiting_;
+    std::unordered_map<std::string, std::set<Waiting>::iterator> by_user_;
+    uint64_t next_seq_ = 0;
+};
@@ -0,0 +1,488 @@
+#include "platform_server.hpp"
+
+#include "../core/common.hpp"
+#include "../core/json_lines.hpp"
+#include "tetris_game.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <netdb.h>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr int kHeartbeatMs = 10000;
+constexpr int kHelloTimeoutMs = 5000;   // a connection that has not said hello by then is closed
+constexpr int kFlushMs = 1000;          // how long game_over may take to drain at the end
+constexpr int kReportTimeoutMs = 3000;
+constexpr size_t kMaxLine = 4096;
+constexpr size_t kMaxOutbox = 1 << 20;  // a reader this far behind is dropped
+constexpr int kPreview = 3;
+
+std::string upper(std::string s) {
+    for (char& c : s) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    return s;
+}
+
+// One short connection per report, so the platform needs no session with us
+bool send_report(const std::string& host, uint16_t port, const std::string& line) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) return false;
+    bool sent = false;
+    for (addrinfo* ai = found; ai && !sent; ai = ai->ai_next) {
+        const int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        timeval tv{kReportTimeoutMs / 1000, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)); // bounds connect() too
+        sent = ::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 && send_all(fd, line.data(), line.size());
+        ::close(fd);
+    }
+    ::freeaddrinfo(found);
+    return sent;
+}
+
+class PlatformRoom {
+public:
+    explicit PlatformRoom(const PlatformServerConfig& config) : cfg_(config) {
+        names_[0] = cfg_.p1;
+        names_[1] = cfg_.p2;
+    }
+
+    int run() {
+        uint16_t port = cfg_.port;
+        listen_fd_ = start_tcp_server(cfg_.bind_host.c_str(), port);
+        port_ = port;
+        if (listen_fd_ < 0) {
+            std::cerr << "[Platform] cannot listen on " << cfg_.bind_host << ":" << cfg_.port << "\n";
+            report("ERROR", {}, {}, {}, "cannot listen", false);
+            return 1;
+        }
+        ::fcntl(listen_fd_, F_SETFL, ::fcntl(listen_fd_, F_GETFL) | O_NONBLOCK); // accept_all() drains it
+        std::cerr << "[Platform] Tetris listening on " << cfg_.bind_host << ":" << port << " room=" << cfg_.room_id << "\n";
+        log_checkpoint("Platform", "LISTENING", cfg_.bind_host + ":" + std::to_string(port) + " room=" + std::to_string(cfg_.room_id));
+        report("STARTED", {}, {}, {}, {}, true);
+        next_heartbeat_ = Clock::now() + std::chrono::milliseconds(kHeartbeatMs);
+
+        while (running && !over_) {
+            poll_once(wait_ms());
+            const auto now = Clock::now();
+            if (started_ && !over_ && now >= next_tick_) {
+                next_tick_ += std::chrono::milliseconds(cfg_.tick_ms);
+                if (next_tick_ < now) next_tick_ = now + std::chrono::milliseconds(cfg_.tick_ms); // fell behind
+                tick();
+            }
+            if (!over_ && now >= next_heartbeat_) {
+                next_heartbeat_ = now + std::chrono::milliseconds(kHeartbeatMs);
+                report("HEARTBEAT", {}, {}, "heartbeat", {}, true);
+            }
+        }
+        if (!over_) report("ERROR", {}, {}, {}, "interrupted", false);
+
+        // Let game_over reach everyone before the process goes away
+        const auto flush_until = Clock::now() + std::chrono::milliseconds(kFlushMs);
+        while (Clock::now() < flush_until &&
+               std::any_of(conns_.begin(), conns_.end(), [](const auto& c) { return !c->out.empty(); })) {
+            poll_once(50);
+        }
+        for (auto& c : conns_) ::close(c->fd);
+        ::close(listen_fd_);
+        return 0;
+    }
+
+private:
+    enum class Role { Pending, Player, Spectator };
+    struct Conn {
+        int fd = -1;
+        Role role = Role::Pending;
+        int player = -1;
+        std::string name;
+        jsonl::LineBuffer in;
+        std::string out;
+        Clock::time_point accepted;
+        bool close_when_flushed = false;
+        bool dead = false;
+    };
+
+    int wait_ms() const {
+        auto until = next_heartbeat_;
+        if (started_) until = std::min(until, next_tick_);
+        if (std::any_of(conns_.begin(), conns_.end(), [](const auto& c) { return c->role == Role::Pending; })) {
+            until = std::min(until, Clock::now() + std::chrono::milliseconds(500));
+        }
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(until - Clock::now()).count();
+        return static_cast<int>(std::clamp<int64_t>(ms, 0, kHeartbeatMs));
+    }
+
+    void poll_once(int timeout_ms) {
+        std::vector<pollfd> pfds;
+        pfds.push_back(pollfd{listen_fd_, static_cast<short>(over_ ? 0 : POLLIN), 0});
+        for (auto& c : conns_) pfds.push_back(pollfd{c->fd, static_cast<short>(POLLIN | (c->out.empty() ? 0 : POLLOUT)), 0});
+        if (::poll(pfds.data(), pfds.size(), timeout_ms) < 0) return; // EINTR: running says whether to go on
+        if (pfds[0].revents & POLLIN) accept_all();
+        const auto now = Clock::now();
+        for (size_t i = 1; i < pfds.size(); ++i) {
+            Conn& c = *conns_[i - 1];
+            if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) read_from(c);
+            if (!c.dead && (pfds[i].revents & POLLOUT)) flush(c);
+            if (c.role == Role::Pending && !c.dead && now - c.accepted > std::chrono::milliseconds(kHelloTimeoutMs)) {
+                c.dead = true;
+            }
+        }
+        reap();
+    }
+
+    void accept_all() {
+        for (;;) {
+            const int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            auto c = std::make_unique<Conn>();
+            c->fd = fd;
+            c->accepted = Clock::now();
+            conns_.push_back(std::move(c));
+        }
+    }
+
+    void read_from(Conn& c) {
+        char buf[4096];
+        for (;;) {
+            const ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                c.in.append(buf, static_cast<size_t>(n));
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n < 0 && errno == EINTR) continue;
+            c.dead = true; // EOF or error; whatever was read still counts
+            break;
+        }
+        for (std::string_view line; !c.close_when_flushed && c.in.next(line);) on_line(c, line);
+        c.in.compact();
+        if (c.in.pending() > kMaxLine) c.dead = true;
+    }
+
+    void on_line(Conn& c, std::string_view line) {
+        jsonl::Value type;
+        if (!jsonl::ObjectReader::find(line, "type", type)) {
+            if (c.role == Role::Pending) c.dead = true;
+            return;
+        }
+        if (c.role == Role::Pending) {
+            hello(c, line);
+            return;
+        }
+        if (c.role != Role::Player || !started_ || over_ || type.kind != jsonl::Kind::String) return;
+        const std::string_view t = type.str(scratch_);
+        if (t == "quit") {
+            quit(c.player);
+        } else if (t == "cmd") {
+            const std::string cmd = upper(std::string(jsonl::ObjectReader::text(line, "cmd", scratch_)));
+            if (cmd == "QUIT") {
+                quit(c.player);
+            } else {
+                games_[c.player]->handle_input(cmd);
+            }
+        }
+    }
+
+    void refuse(Conn& c, const char* reason) {
+        line_.clear();
+        jsonl::JsonWriter(line_).begin_object().key("ok").boolean(false).key("reason").str(reason).end().end_line();
+        send(c, line_);
+        c.close_when_flushed = true;
+    }
+
+    // Each field is read straight out of the line; a view of scratch_ only lives until the next read
+    void hello(Conn& c, std::string_view msg) {
+        using jsonl::ObjectReader;
+        if (ObjectReader::text(msg, "client_token", scratch_) != cfg_.client_token) return refuse(c, "invalid client token");
+        if (ObjectReader::text(msg, "match_id", scratch_) != cfg_.match_id) return refuse(c, "invalid match_id");
+        jsonl::Value room;
+        int64_t room_id = 0;
+        ObjectReader::find(msg, "room_id", room);
+        if (!room.to_int(room_id) || room_id != cfg_.room_id) return refuse(c, "invalid room_id");
+        std::string role(ObjectReader::text(msg, "role", scratch_));
+        role = role.empty() ? "player" : role;
+        for (char& ch : role) ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+        const std::string name(ObjectReader::text(msg, "player_name", scratch_));
+        if (name.empty()) return refuse(c, "player_name required");
+        if (role == "spectator") {
+            for (auto& o : conns_) {
+                if (o->role == Role::Spectator && !o->dead && o->name == name) return refuse(c, "spectator already connected");
+            }
+            c.role = Role::Spectator;
+            c.name = name;
+            send(c, "{\"ok\": true, \"game_protocol_version\": 1}\n");
+            log_checkpoint("Platform", "SPECTATOR", name);
+            return;
+        }
+        if (started_) return refuse(c, "spectators only");
+        int index = -1;
+        for (int i = 0; i < 2; ++i) {
+            if (name == names_[i] && !player_conn(i)) {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0) return refuse(c, "bad player");
+        c.role = Role::Player;
+        c.player = index;
+        c.name = name;
+        send(c, "{\"ok\": true, \"assigned_player_index\": " + std::to_string(index) + ", \"game_protocol_version\": 1}\n");
+        log_checkpoint("Platform", "PLAYER", name + " index=" + std::to_string(index));
+        if (player_conn(0) && player_conn(1)) start();
+    }
+
+    Conn* player_conn(int index) {
+        for (auto& c : conns_) {
+            if (c->role == Role::Player && c->player == index && !c->dead) return c.get();
+        }
+        return nullptr;
+    }
+
+    void start() {
+        std::random_device rd;
+        auto pieces = std::make_shared<PieceSequence>(static_cast<int>(rd() & 0x7fffffff));
+        for (auto& g : games_) g = std::make_unique<TetrisGame>(pieces);
+        started_ = true;
+        next_tick_ = Clock::now() + std::chrono::milliseconds(cfg_.tick_ms);
+        log_checkpoint("Platform", "GAME_START", names_[0] + " vs " + names_[1]);
+    }
+
+    void tick() {
+        for (auto& g : games_) g->tick();
+        broadcast();
+        if (games_[0]->game_over && games_[1]->game_over) {
+            const int w = winner_by_result();
+            finish(names_[w], names_[1 - w], "normal");
+        }
+    }
+
+    // The one still standing, else the higher score, else more lines; ties go to p1
+    int winner_by_result() const {
+        const TetrisGame& a = *games_[0];
+        const TetrisGame& b = *games_[1];
+        if (a.game_over != b.game_over) return a.game_over ? 1 : 0;
+        if (a.score != b.score) return a.score > b.score ? 0 : 1;
+        return a.lines_cleared >= b.lines_cleared ? 0 : 1;
+    }
+
+    // A player who quits or drops loses at once, to whoever is still alive
+    void quit(int index) {
+        if (!started_ || over_) return;
+        games_[index]->forfeit();
+        std::string winner, loser;
+        for (int i = 0; i < 2; ++i) {
+            if (!games_[i]->game_over) {
+                winner = names_[i];
+                loser = names_[1 - i];
+                break;
+            }
+        }
+        log_checkpoint("Platform", "QUIT", names_[index]);
+        finish(winner, loser, "quit");
+    }
+
+    void finish(const std::string& winner, const std::string& loser, const std::string& reason) {
+        line_.clear();
+        jsonl::JsonWriter(line_).begin_object().key("type").str("game_over").key("winner").str(winner).end().end_line();
+        for (auto& c : conns_) {
+            if (c->role != Role::Pending && !c->dead) send(*c, line_);
+        }
+        over_ = true;
+        log_checkpoint("Platform", "GAME_OVER", "winner=" + winner + " reason=" + reason);
+        report("END", winner, loser, reason, {}, false);
+    }
+
+    // A dead board is shown without the piece that no longer fits
+    static void write_board(jsonl::JsonWriter& w, const TetrisGame& g) {
+        char cells[BOARD_ROWS * BOARD_COLS];
+        write_board_letters(cells, g.colors, g.game_over ? nullptr : &g.current_piece);
+        w.begin_array();
+        for (int r = 0; r < BOARD_ROWS; ++r) w.str(std::string_view(cells + r * BOARD_COLS, BOARD_COLS));
+        w.end();
+    }
+
+    static void write_hold(jsonl::JsonWriter& w, const TetrisGame& g) {
+        if (g.hold_shape_id < 0) {
+            w.null();
+        } else {
+            w.str(std::string_view(&SHAPE_LETTERS[g.hold_shape_id], 1));
+        }
+    }
+
+    // "board", "next", "hold", "score", "lines", "alive" of one player
+    static void write_player_fields(jsonl::JsonWriter& w, const TetrisGame& g) {
+        w.key("board");
+        write_board(w, g);
+        w.key("next").begin_array();
+        for (int i = 0; i < kPreview; ++i) w.str(std::string_view(&SHAPE_LETTERS[g.preview(i)], 1));
+        w.end().key("hold");
+        write_hold(w, g);
+        w.key("score").num(int64_t{g.score}).key("lines").num(int64_t{g.lines_cleared}).key("alive").boolean(!g.game_over);
+    }
+
+    // Lines are built in line_ and spectator_line_, which keep their capacity from tick to tick
+    void broadcast() {
+        spectator_line_.clear();
+        for (auto& c : conns_) {
+            if (c->dead) continue;
+            if (c->role == Role::Player) {
+                const TetrisGame& opp = *games_[1 - c->player];
+                line_.clear();
+                jsonl::JsonWriter w(line_);
+                w.begin_object().key("type").str("tick").key("you").str(names_[c->player]);
+                write_player_fields(w, *games_[c->player]);
+                w.key("opponent").begin_object().key("name").str(names_[1 - c->player]).key("alive").boolean(!opp.game_over);
+                w.key("lines").num(int64_t{opp.lines_cleared}).key("score").num(int64_t{opp.score}).key("hold");
+                write_hold(w, opp);
+                w.end().end().end_line();
+                send(*c, line_);
+            } else if (c->role == Role::Spectator) {
+                if (spectator_line_.empty()) {
+                    char room[16];
+                    std::snprintf(room, sizeof(room), "%d", cfg_.room_id);
+                    jsonl::JsonWriter w(spectator_line_);
+                    w.begin_object().key("type").str("tick").key("room").str(room).key("players").begin_object();
+                    for (int i = 0; i < 2; ++i) {
+                        w.key(names_[i]).begin_object();
+                        write_player_fields(w, *games_[i]);
+                        w.end();
+                    }
+                    w.end().end().end_line();
+                }
+                send(*c, spectator_line_);
+            }
+        }
+    }
+
+    void send(Conn& c, std::string_view line) {
+        c.out += line;
+        if (c.out.size() > kMaxOutbox) {
+            c.dead = true;
+            return;
+        }
+        flush(c);
+    }
+
+    void flush(Conn& c) {
+        while (!c.out.empty()) {
+            const ssize_t n = ::send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) {
+                c.out.erase(0, static_cast<size_t>(n));
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            c.dead = true;
+            return;
+        }
+        if (c.close_when_flushed) c.dead = true;
+    }
+
+    // Closes dead connections; a player gone mid-match has quit
+    void reap() {
+        for (size_t i = 0; i < conns_.size();) {
+            Conn& c = *conns_[i];
+            if (!c.dead) {
+                ++i;
+                continue;
+            }
+            const int player = c.role == Role::Player ? c.player : -1;
+            ::close(c.fd);
+            conns_.erase(conns_.begin() + static_cast<std::ptrdiff_t>(i));
+            if (player >= 0) quit(player);
+        }
+    }
+
+    // GAME.REPORT to the platform. STARTED and HEARTBEAT go from a thread of
+    // their own so a slow report host never holds up a tick; END and ERROR are
+    // sent before returning, since the process exits right after.
+    void report(const std::string& status, const std::string& winner, const std::string& loser,
+                const std::string& reason, const std::string& err_msg, bool async) {
+        if (cfg_.report_host.empty() || cfg_.report_port == 0) return;
+        std::string line;
+        jsonl::JsonWriter w(line);
+        w.begin_object().key("type").str("GAME.REPORT").key("status").str(status).key("game").str("Tetris");
+        w.key("room_id").num(int64_t{cfg_.room_id}).key("match_id").str(cfg_.match_id);
+        w.key("report_token").str(cfg_.report_token).key("timestamp").num(
+            std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count(), 3);
+        if (status == "STARTED") w.key("port").num(int64_t{port_});
+        if (!winner.empty()) w.key("winner").str(winner);
+        if (!loser.empty()) w.key("loser").str(loser);
+        if (!err_msg.empty()) w.key("err_msg").str(err_msg);
+        if (!reason.empty()) w.key("reason").str(reason);
+        if (status == "END") {
+            auto result = [&w](const std::string& player, const char* outcome, int rank) {
+                w.begin_object().key("player").str(player).key("outcome").str(outcome).key("rank");
+                if (rank) {
+                    w.num(int64_t{rank});
+                } else {
+                    w.null();
+                }
+                w.key("score").null().end();
+            };
+            w.key("results").begin_array();
+            if (winner.empty()) {
+                result(names_[0], "DRAW", 0);
+                result(names_[1], "DRAW", 0);
+            } else {
+                result(winner, "WIN", 1);
+                if (!loser.empty()) result(loser, "LOSE", 2);
+            }
+            w.end();
+        }
+        w.key("scores").begin_object();
+        for (int i = 0; i < 2; ++i) w.key(names_[i]).num(int64_t{games_[i] ? games_[i]->score : 0});
+        w.end().key("lines").begin_object();
+        for (int i = 0; i < 2; ++i) w.key(names_[i]).num(int64_t{games_[i] ? games_[i]->lines_cleared : 0});
+        w.end().end().end_line();
+
+        auto deliver = [host = cfg_.report_host, port = cfg_.report_port, status, line] {
+            if (!send_report(host, port, line)) {
+                log_message(LogLevel::Warn, "Platform", "report " + status + " to " + host + ":" + std::to_string(port) + " failed");
+            }
+        };
+        if (async) {
+            std::thread(deliver).detach();
+        } else {
+            deliver();
+        }
+    }
+
+    const PlatformServerConfig cfg_;
+    std::string names_[2];
+    int listen_fd_ = -1;
+    uint16_t port_ = 0;
+    std::vector<std::unique_ptr<Conn>> conns_;
+    std::unique_ptr<TetrisGame> games_[2];
+    bool started_ = false;
+    bool over_ = false;
+    Clock::time_point next_tick_{};
+    Clock::time_point next_heartbeat_{};
+    std::string line_, spectator_line_; // outgoing messages, reused
+    std::string scratch_;               // unescaped strings of the line being read
+};
+}
+
+int run_platform_server(const PlatformServerConfig& config) {
+    return PlatformRoom(config).run();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// One room as the game platform's launcher runs it (manifest.json, the same
+// contract as server.py): two named players and any number of spectators
+// connect to port and speak newline-delimited JSON.
+//   hello  {"client_token","match_id","room_id","role":"player"|"spectator","player_name"}
+//          -> {"ok":true,"assigned_player_index":i,"game_protocol_version":1}, or
+//             {"ok":false,"reason":..} and the connection is closed
+//   player {"type":"cmd","cmd":"LEFT|RIGHT|DOWN|ROTATE|DROP|HOLD"}, {"type":"quit"}
+//   server {"type":"tick",..} every tick_ms once both players are in, then
+//          {"type":"game_over","winner":..}
+// The boards are TetrisGame's, sharing one piece sequence. Progress goes to
+// report_host:report_port as GAME.REPORT lines (STARTED, HEARTBEAT every 10s,
+// END or ERROR), one short connection each; no report host means no reports.
+struct PlatformServerConfig {
+    std::string bind_host = "0.0.0.0";
+    uint16_t port = 0;
+    int room_id = 0;
+    std::string p1, p2;
+    int tick_ms = 500;
+    std::string match_id;
+    std::string client_token;
+    std::string report_token;
+    std::string report_host;
+    uint16_t report_port = 0;
+};
+
+// Serves the match to its end on the calling thread; the process exit code
+int run_platform_server(const PlatformServerConfig& config);
@@ -0,0 +1,41 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+
+// Admits rate() events per second on average and up to burst() at once. Not
+// thread-safe: each bucket belongs to whichever thread serves its connection.
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TokenBucket() = default; // admits nothing until reset()
+    TokenBucket(double rate, double burst) { reset(rate, burst); }
+
+    // New limits, starting full
+    void reset(double rate, double burst) {
+        rate_ = rate;
+        burst_ = burst;
+        tokens_ = burst;
+        last_ = {};
+    }
+
+    // Spends cost tokens if there are that many; false (nothing spent) if not
+    bool take(Clock::time_point now, double cost = 1.0) {
+        if (last_ != Clock::time_point{}) {
+            tokens_ = std::min(burst_, tokens_ + rate_ * std::chrono::duration<double>(now - last_).count());
+        }
+        last_ = now;
+        if (tokens_ < cost) return false;
+        tokens_ -= cost;
+        return true;
+    }
+
+    double rate() const { return rate_; }
+    double burst() const { return burst_; }
+
+private:
+    double rate_ = 0;
+    double burst_ = 0;
+    double tokens_ = 0;
+    Clock::time_point last_{};
+};
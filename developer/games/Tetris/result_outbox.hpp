@@ -0,0 +1,235 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fcntl.h>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/file.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "../core/common.hpp"
+#include "db_client.hpp"
+#include "db_wal.hpp"
+#include "../core/metrics.hpp"
+
+// Match results on their way to the DB, so ending a match never waits for it.
+// post() hands over a request (a match's GameLog create and room writes, one
+// Atomic batch) and returns at once. A sender thread appends it to the outbox
+// file, syncs, and submits everything pending back to back, kBatch per round
+// trip; what gets no answer is sent again after a backoff growing from
+// kRetryMin to kRetryMax. A request the DB answered, OK or ERR, is done: the
+// file marks it so and its callback runs, on the sender thread. The file is
+// emptied whenever nothing is pending.
+// stop() makes one last attempt; what is left stays in the file and goes first
+// once an outbox is started on it again. A request can therefore reach the DB
+// twice (a reply lost with its connection, a crash before the mark), so it
+// must guard itself, as "Room check ... token=<match token>" in front of a
+// match's writes does. One process holds a file at a time (flock): start()
+// takes <path>, or else the first of <path>.1, <path>.2, ... that is free.
+// File records are WriteAheadLog lines: "P <request>", newlines as \x1f, and
+// "D <lsn of that P>" once it is answered.
+class ResultOutbox {
+public:
+    using Submit = std::function<std::future<DbReply>(const std::string& request)>;
+    using Done = std::function<void(const std::string& reply)>;
+
+    static constexpr size_t kBatch = 64;
+    static constexpr auto kReplyTimeout = std::chrono::seconds(5);
+    static constexpr auto kRetryMin = std::chrono::milliseconds(200);
+    static constexpr auto kRetryMax = std::chrono::seconds(10);
+    static constexpr int kMaxFiles = 64;
+
+    ResultOutbox() = default;
+    ResultOutbox(const ResultOutbox&) = delete;
+    ResultOutbox& operator=(const ResultOutbox&) = delete;
+    ~ResultOutbox() { stop(); }
+
+    // Takes a file, picks up what an earlier run left in it and starts the sender
+    bool start(const std::string& path, Submit submit) {
+        if (sender_.joinable()) return false;
+        for (int n = 0; n < kMaxFiles && lock_fd_ < 0; ++n) {
+            const std::string candidate = n == 0 ? path : path + "." + std::to_string(n);
+            int fd = ::open(candidate.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) break;
+            if (::flock(fd, LOCK_EX | LOCK_NB) == 0) {
+                lock_fd_ = fd;
+                path_ = candidate;
+            } else {
+                ::close(fd);
+            }
+        }
+        if (lock_fd_ < 0) {
+            log_checkpoint("Outbox", "OPEN_FAIL", path);
+            return false;
+        }
+        std::map<uint64_t, std::string> left;
+        const uint64_t last = WriteAheadLog::replay(path_, 0, [&](uint64_t lsn, const std::string& payload) {
+            if (payload.rfind("P ", 0) == 0) left.emplace(lsn, unescape(payload.substr(2)));
+            else if (payload.rfind("D ", 0) == 0) left.erase(std::strtoull(payload.c_str() + 2, nullptr, 10));
+        });
+        if (left.empty() && last > 0) ::truncate(path_.c_str(), 0);
+        if (!wal_.open(path_, left.empty() ? 1 : last + 1)) {
+            ::close(lock_fd_);
+            lock_fd_ = -1;
+            return false;
+        }
+        for (auto& [lsn, request] : left) pending_.push_back(Entry{lsn, std::move(request), nullptr});
+        if (!left.empty()) log_checkpoint("Outbox", "RECOVERED", path_ + " pending=" + std::to_string(left.size()));
+        submit_ = std::move(submit);
+        stopping_ = false;
+        pending_gauge_.set(static_cast<int64_t>(pending_.size()));
+        sender_ = std::thread([this] { run(); });
+        return true;
+    }
+
+    // Never waits on the disk or the DB; false (and done is never called)
+    // when the outbox is not running
+    bool post(std::string request, Done done = nullptr) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!sender_.joinable() || stopping_) return false;
+            incoming_.push_back(Entry{0, std::move(request), std::move(done)});
+        }
+        pending_gauge_.add(1);
+        cv_.notify_one();
+        return true;
+    }
+
+    // One last attempt at whatever is pending, then joins the sender
+    void stop() {
+        if (!sender_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        sender_.join();
+        if (!pending_.empty()) log_checkpoint("Outbox", "LEFT_PENDING", path_ + " pending=" + std::to_string(pending_.size()));
+        pending_.clear();
+        wal_.close();
+        ::close(lock_fd_);
+        lock_fd_ = -1;
+    }
+
+    // The file start() took
+    const std::string& path() const { return path_; }
+
+private:
+    struct Entry {
+        uint64_t lsn = 0; // of its P record
+        std::string request;
+        Done done;
+    };
+
+    static std::string escape(std::string text) {
+        std::replace(text.begin(), text.end(), '\n', '\x1f');
+        return text;
+    }
+    static std::string unescape(std::string text) {
+        std::replace(text.begin(), text.end(), '\x1f', '\n');
+        return text;
+    }
+
+    void run() {
+        using Clock = std::chrono::steady_clock;
+        auto retry_at = Clock::now();
+        auto backoff = std::chrono::duration_cast<Clock::duration>(kRetryMin);
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            auto woken = [this] { return stopping_ || !incoming_.empty(); };
+            if (pending_.empty()) cv_.wait(lock, woken);
+            else cv_.wait_until(lock, retry_at, woken);
+            std::vector<Entry> fresh;
+            fresh.swap(incoming_);
+            const bool last = stopping_;
+            lock.unlock();
+
+            for (Entry& e : fresh) {
+                e.lsn = wal_.append("P " + escape(e.request));
+                pending_.push_back(std::move(e));
+            }
+            if (!wal_.commit()) log_checkpoint("Outbox", "COMMIT_FAIL", path_);
+            const auto now = Clock::now();
+            if (!pending_.empty() && (last || now >= retry_at)) {
+                if (deliver()) {
+                    backoff = kRetryMin;
+                    retry_at = now;
+                } else {
+                    retries_.add();
+                    retry_at = now + backoff;
+                    backoff = std::min<Clock::duration>(backoff * 2, kRetryMax);
+                }
+            }
+
+            lock.lock();
+            if (last) return;
+        }
+    }
+
+    // Sends the first kBatch pending requests and waits for their replies;
+    // false if any got none
+    bool deliver() {
+        const size_t n = std::min(pending_.size(), kBatch);
+        std::vector<std::future<DbReply>> replies;
+        replies.reserve(n);
+        for (size_t i = 0; i < n; ++i) replies.push_back(submit_(pending_[i].request));
+        const auto deadline = std::chrono::steady_clock::now() + kReplyTimeout;
+
+        std::vector<std::pair<Entry, std::string>> answered;
+        size_t kept = 0;
+        for (size_t i = 0; i < pending_.size(); ++i) {
+            DbReply r;
+            // A deferred future (a sharded Atomic batch) waits inside get()
+            if (i < n && replies[i].valid() && replies[i].wait_until(deadline) != std::future_status::timeout) {
+                r = replies[i].get();
+            }
+            if (!r.ok) {
+                if (kept != i) pending_[kept] = std::move(pending_[i]);
+                ++kept;
+                continue;
+            }
+            wal_.append("D " + std::to_string(pending_[i].lsn));
+            if (r.body.rfind("OK", 0) != 0) {
+                log_checkpoint("Outbox", "RESULT_REJECTED", r.body.substr(0, r.body.find('\n')));
+            }
+            answered.emplace_back(std::move(pending_[i]), std::move(r.body));
+        }
+        pending_.resize(kept);
+        if (!wal_.commit()) log_checkpoint("Outbox", "COMMIT_FAIL", path_);
+        if (pending_.empty()) {
+            // Everything in the file is answered: start it over
+            wal_.close();
+            ::truncate(path_.c_str(), 0);
+            wal_.open(path_, 1);
+        }
+        delivered_.add(answered.size());
+        pending_gauge_.add(-static_cast<int64_t>(answered.size()));
+        for (auto& [entry, reply] : answered) {
+            if (entry.done) entry.done(reply);
+        }
+        return answered.size() == n;
+    }
+
+    std::string path_;
+    int lock_fd_ = -1;
+    WriteAheadLog wal_;         // sender thread only, once started
+    std::vector<Entry> pending_; // in the file, not yet answered; sender thread only
+    Submit submit_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Entry> incoming_; // posted, not yet in the file
+    bool stopping_ = false;
+    std::thread sender_;
+    MetricGauge& pending_gauge_ = metrics().gauge("outbox_pending", "Match results not yet answered by the DB");
+    MetricCounter& delivered_ = metrics().counter("outbox_delivered_total", "Match results the DB answered");
+    MetricCounter& retries_ =
+        metrics().counter("outbox_retries_total", "Delivery rounds with a result left unanswered");
+};
@@ -0,0 +1,503 @@
+#include "room_scheduler.hpp"
+
+#include "../core/common.hpp"
+#include "../core/lp_framing.hpp"
+#include "../core/reactor.hpp"
+#include "spectator_relay.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <sys/epoll.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+constexpr int kIdleWaitMs = 500; // upper bound so workers notice shutdown
+constexpr int kPhaseSlots = 20;  // of a gravity interval: 25 ms apart at the default 500
+
+// "0-3,8-11" as in sysfs cpulist files
+std::vector<int> parse_cpu_list(const std::string& text) {
+    std::vector<int> cpus;
+    size_t i = 0;
+    while (i < text.size()) {
+        char* end = nullptr;
+        const long lo = std::strtol(text.c_str() + i, &end, 10);
+        if (end == text.c_str() + i) break;
+        long hi = lo;
+        i = static_cast<size_t>(end - text.c_str());
+        if (i < text.size() && text[i] == '-') {
+            hi = std::strtol(text.c_str() + i + 1, &end, 10);
+            i = static_cast<size_t>(end - text.c_str());
+        }
+        for (long c = lo; c <= hi; ++c) cpus.push_back(static_cast<int>(c));
+        if (i < text.size() && text[i] == ',') ++i;
+        else break;
+    }
+    return cpus;
+}
+
+// The CPUs this process may run on, one NUMA node after the other in turn
+// (node0's first, node1's first, node0's second, ...); without sysfs node
+// information simply in order
+std::vector<int> worker_cpus() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return {};
+    std::vector<std::vector<int>> nodes;
+    if (DIR* dir = ::opendir("/sys/devices/system/node")) {
+        while (dirent* e = ::readdir(dir)) {
+            const std::string name = e->d_name;
+            if (name.rfind("node", 0) != 0 || name.size() == 4 || name.find_first_not_of("0123456789", 4) != std::string::npos) {
+                continue;
+            }
+            std::ifstream in("/sys/devices/system/node/" + name + "/cpulist");
+            std::string list;
+            std::getline(in, list);
+            std::vector<int> cpus;
+            for (int c : parse_cpu_list(list)) {
+                if (c < CPU_SETSIZE && CPU_ISSET(c, &allowed)) cpus.push_back(c);
+            }
+            if (!cpus.empty()) nodes.push_back(std::move(cpus));
+        }
+        ::closedir(dir);
+    }
+    if (nodes.empty()) {
+        nodes.emplace_back();
+        for (int c = 0; c < CPU_SETSIZE; ++c) {
+            if (CPU_ISSET(c, &allowed)) nodes.back().push_back(c);
+        }
+    }
+    std::sort(nodes.begin(), nodes.end());
+    std::vector<int> order;
+    for (size_t k = 0;; ++k) {
+        bool any = false;
+        for (const auto& node : nodes) {
+            if (k < node.size()) {
+                order.push_back(node[k]);
+                any = true;
+            }
+        }
+        if (!any) break;
+    }
+    return order;
+}
+}
+
+struct RoomScheduler::Worker {
+    using Clock = Reactor::Clock;
+
+    RoomScheduler* owner = nullptr;
+    int index = 0;
+    Reactor reactor;
+    std::thread thread;
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> load{0};
+
+    std::mutex pending_mutex;
+    std::vector<std::unique_ptr<TetrisRoom>> pending;
+    std::vector<std::pair<std::string, int>> pending_clients; // from the gateway: token, fd
+
+    struct Hosted {
+        std::unique_ptr<TetrisRoom> room;
+        Clock::time_point due[TetrisRoom::kBoards];
+        uint64_t timer[TetrisRoom::kBoards] = {};
+        int phase_slot = 0;
+        std::vector<int> fds; // watched for it; may hold numbers since closed, fd_owner decides
+    };
+
+    // Reactor thread only. Rooms are keyed by a worker-local serial so a stale
+    // callback can never hit a newer room that reused the same room id.
+    std::unordered_map<uint64_t, Hosted> rooms;
+    std::unordered_map<int, uint64_t> fd_owner;
+    std::unordered_map<std::string, uint64_t> by_token; // rooms fed by the gateway
+    std::vector<uint64_t> finished_rooms; // queued by the rooms as they end, retired after the round
+    std::unordered_map<int, TetrisRoom::Linger> lingering; // let go by their rooms, flushing on EPOLLOUT
+    uint64_t next_serial = 1;
+    int slot_rooms[kPhaseSlots] = {}; // rooms whose first tick fell in each slot of their interval
+
+    // Any thread: the reactor takes whatever is pending in its next round
+    void wake() {
+        reactor.post([this] { adopt(); });
+    }
+
+    void watch(int fd, uint64_t serial, Hosted& hosted) {
+        if (!reactor.add(fd, EPOLLIN, [this, fd](uint32_t events) { on_event(fd, events); })) {
+            perror("[Scheduler] epoll_ctl");
+            return;
+        }
+        fd_owner[fd] = serial;
+        hosted.fds.push_back(fd);
+    }
+
+    // The room closed fd
+    void forget(int fd, Hosted& hosted) {
+        reactor.remove(fd);
+        fd_owner.erase(fd);
+        auto it = std::find(hosted.fds.begin(), hosted.fds.end(), fd);
+        if (it == hosted.fds.end()) return;
+        *it = hosted.fds.back();
+        hosted.fds.pop_back();
+    }
+
+    // Follows the room's output queues: EPOLLOUT only while an fd has frames pending
+    void sync_write_interest(TetrisRoom& room) {
+        for (auto const& [fd, want] : room.take_write_interest_changes()) {
+            if (!fd_owner.count(fd)) continue;
+            reactor.modify(fd, EPOLLIN | (want ? static_cast<uint32_t>(EPOLLOUT) : 0u));
+        }
+        take_lingering(room);
+    }
+
+    // Connections the room let go with frames still queued: watched for
+    // EPOLLOUT only, and closed once flushed or at their deadline
+    void take_lingering(TetrisRoom& room) {
+        for (TetrisRoom::Linger& l : room.take_lingering()) {
+            const int fd = l.fd;
+            reactor.remove(fd); // still registered for the room unless retire() dropped it first
+            fd_owner.erase(fd);
+            if (!reactor.add(fd, EPOLLOUT, [this, fd](uint32_t events) { on_lingering(fd, events); })) {
+                ::close(fd);
+                continue;
+            }
+            const auto deadline = l.deadline;
+            lingering.insert_or_assign(fd, std::move(l));
+            // The number may have lingered again by then, with a later deadline
+            reactor.at(deadline, [this, fd] {
+                auto it = lingering.find(fd);
+                if (it != lingering.end() && it->second.deadline <= Clock::now()) let_go(fd);
+            });
+        }
+    }
+
+    void on_lingering(int fd, uint32_t events) {
+        auto it = lingering.find(fd);
+        if (it == lingering.end()) return;
+        FrameWriter& writer = it->second.writer;
+        if (events & (EPOLLHUP | EPOLLERR) || !writer.flush(fd) || !writer.pending()) let_go(fd);
+    }
+
+    void let_go(int fd) {
+        reactor.remove(fd);
+        ::close(fd);
+        lingering.erase(fd);
+    }
+
+    void adopt() {
+        std::vector<std::unique_ptr<TetrisRoom>> incoming;
+        std::vector<std::pair<std::string, int>> clients;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            incoming.swap(pending);
+            clients.swap(pending_clients);
+        }
+        for (auto& room : incoming) {
+            uint64_t serial = next_serial++;
+            Hosted& hosted = rooms[serial];
+            if (room->listen_fd() >= 0) watch(room->listen_fd(), serial, hosted);
+            else by_token[room->token()] = serial;
+            if (room->udp_fd() >= 0) watch(room->udp_fd(), serial, hosted);
+            room->set_on_finished([this, serial] { finished_rooms.push_back(serial); });
+            auto now = Clock::now();
+            const int phase = pick_phase(*room, now, hosted.phase_slot);
+            for (int b = 0; b < TetrisRoom::kBoards; ++b) {
+                hosted.due[b] = now + std::chrono::milliseconds(room->gravity_ms(b) + phase);
+                hosted.timer[b] = reactor.at(hosted.due[b], [this, serial, b] { tick(serial, b); });
+            }
+            log_checkpoint("Scheduler", "ROOM_ADOPTED",
+                           "room=" + std::to_string(room->room_id()) + " worker=" + std::to_string(index));
+            hosted.room = std::move(room);
+        }
+        // A room is always queued before any client routed to it, so it is known here
+        for (auto& [token, fd] : clients) {
+            auto tit = by_token.find(token);
+            auto rit = tit == by_token.end() ? rooms.end() : rooms.find(tit->second);
+            if (rit == rooms.end() || !rit->second.room->adopt_client(fd)) {
+                reject_hello(fd);
+                continue;
+            }
+            watch(fd, tit->second, rit->second);
+        }
+    }
+
+    // Delay of a new room's first tick: the room's own tick_phase_ms if it has
+    // one, else whatever puts the tick in the least used slot of the interval
+    // (the soonest such slot on a tie). slot gets the slot taken.
+    int pick_phase(const TetrisRoom& room, Clock::time_point now, int& slot) {
+        const int interval = std::max(1, room.gravity_ms(0));
+        const auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+        const int offset = static_cast<int>(now_ms % interval); // where "now" sits in the interval
+        int phase = room.tick_phase_ms();
+        if (phase > 0) {
+            slot = (offset + phase) % interval * kPhaseSlots / interval;
+        } else {
+            const int here = (offset * kPhaseSlots + interval - 1) / interval % kPhaseSlots; // next slot to start
+            slot = here;
+            for (int k = 1; k < kPhaseSlots; ++k) {
+                const int s = (here + k) % kPhaseSlots;
+                if (slot_rooms[s] < slot_rooms[slot]) slot = s;
+            }
+            phase = ((slot * interval / kPhaseSlots - offset) % interval + interval) % interval;
+        }
+        ++slot_rooms[slot];
+        return phase;
+    }
+
+    void retire(uint64_t serial) {
+        auto it = rooms.find(serial);
+        if (it == rooms.end()) return;
+        --slot_rooms[it->second.phase_slot];
+        for (uint64_t timer : it->second.timer) reactor.cancel(timer);
+        for (int fd : it->second.fds) {
+            auto fit = fd_owner.find(fd);
+            if (fit == fd_owner.end() || fit->second != serial) continue; // closed, maybe reused since
+            reactor.remove(fd);
+            fd_owner.erase(fit);
+        }
+        it->second.room->finish();
+        take_lingering(*it->second.room);
+        if (it->second.room->listen_fd() < 0 && by_token.erase(it->second.room->token())) {
+            owner->drop_route(it->second.room->token());
+        }
+        rooms.erase(it);
+        load.fetch_sub(1);
+    }
+
+    void on_event(int fd, uint32_t events) {
+        auto oit = fd_owner.find(fd);
+        if (oit == fd_owner.end()) return;
+        uint64_t serial = oit->second;
+        auto rit = rooms.find(serial);
+        if (rit == rooms.end()) return;
+        TetrisRoom& room = *rit->second.room;
+        if (fd == room.listen_fd()) {
+            int cfd = room.on_accept();
+            if (cfd >= 0) watch(cfd, serial, rit->second);
+        } else if (fd == room.udp_fd()) {
+            room.on_datagrams();
+        } else {
+            bool open = true;
+            if (events & EPOLLOUT) open = room.on_writable(fd);
+            if (open && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) open = room.on_readable(fd);
+            if (!open) forget(fd, rit->second);
+        }
+        sync_write_interest(room);
+    }
+
+    // A board's gravity timer
+    void tick(uint64_t serial, int board) {
+        auto it = rooms.find(serial);
+        if (it == rooms.end()) return;
+        Hosted& hosted = it->second;
+        hosted.room->on_gravity(board, hosted.due[board]);
+        sync_write_interest(*hosted.room);
+        if (hosted.room->finished()) return;
+        // Next deadline follows the previous one so ticks do not drift
+        const auto now = Clock::now();
+        const auto interval = std::chrono::milliseconds(hosted.room->gravity_ms(board));
+        hosted.due[board] += interval;
+        if (hosted.due[board] < now) hosted.due[board] = now + interval;
+        hosted.timer[board] = reactor.at(hosted.due[board], [this, serial, board] { tick(serial, board); });
+    }
+
+    void run() {
+        while (running && !stop.load()) {
+            reactor.run_once(kIdleWaitMs);
+            std::vector<uint64_t> done;
+            done.swap(finished_rooms);
+            for (uint64_t serial : done) retire(serial);
+        }
+
+        // Shutting down: rooms that never ended still report their result
+        adopt();
+        std::vector<uint64_t> all;
+        for (auto const& [serial, room] : rooms) all.push_back(serial);
+        for (uint64_t serial : all) retire(serial);
+        // Nothing else to serve now, so the last frames are flushed in place
+        for (auto& [fd, l] : lingering) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(l.deadline - Clock::now()).count();
+            if (left > 0) l.writer.drain(fd, static_cast<int>(left));
+            reactor.remove(fd);
+            ::close(fd);
+        }
+        lingering.clear();
+    }
+};
+
+RoomScheduler::RoomScheduler(size_t workers) {
+    if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < workers; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+        workers_.back()->owner = this;
+        workers_.back()->index = static_cast<int>(i);
+    }
+}
+
+RoomScheduler::~RoomScheduler() {
+    stop();
+}
+
+bool RoomScheduler::start() {
+    if (started_) return true;
+    for (auto& w : workers_) {
+        if (!w->reactor.ok()) return false;
+        w->stop.store(false);
+    }
+    const std::vector<int> cpus = pin_cpus_ ? worker_cpus() : std::vector<int>{};
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        Worker* raw = workers_[i].get();
+        const int cpu = cpus.empty() ? -1 : cpus[(first_cpu_ + i) % cpus.size()];
+        raw->thread = std::thread([raw, cpu]() {
+            if (cpu >= 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                const int rc = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+                log_checkpoint("Scheduler", rc == 0 ? "WORKER_PINNED" : "WORKER_PIN_FAILED",
+                               "worker=" + std::to_string(raw->index) + " cpu=" + std::to_string(cpu));
+            }
+            raw->run();
+        });
+    }
+    if (gateway_.listening()) {
+        gateway_.start([this](int fd, const HelloRoute& hello) { route_client(fd, hello); });
+    }
+    started_ = true;
+    log_checkpoint("Scheduler", "STARTED", "workers=" + std::to_string(workers_.size()));
+    return true;
+}
+
+void RoomScheduler::stop() {
+    if (!started_) return;
+    // The gateway goes first so nothing is routed to a worker that has exited
+    gateway_.stop();
+    for (auto& w : workers_) {
+        w->stop.store(true);
+        w->reactor.post([] {}); // wakes it to see the flag
+    }
+    for (auto& w : workers_) {
+        if (w->thread.joinable()) w->thread.join();
+    }
+    started_ = false;
+}
+
+int RoomScheduler::add_room(TetrisRoomConfig cfg) {
+    if (!started_ || workers_.empty()) return -1;
+    Worker* target = workers_.front().get();
+    for (auto& w : workers_) {
+        if (w->load.load() < target->load.load()) target = w.get();
+    }
+    target->load.fetch_add(1);
+    if (cfg.listen_fd < 0) {
+        std::lock_guard<std::mutex> lock(routes_mutex_);
+        routes_[cfg.expected_token] = target;
+    }
+    {
+        std::lock_guard<std::mutex> lock(target->pending_mutex);
+        target->pending.push_back(std::make_unique<TetrisRoom>(std::move(cfg)));
+    }
+    target->wake();
+    return target->index;
+}
+
+std::vector<int> RoomScheduler::add_rooms(std::vector<TetrisRoomConfig> cfgs) {
+    std::vector<int> placed(cfgs.size(), -1);
+    if (!started_ || workers_.empty()) return placed;
+    // Least loaded first, counting the rooms of this call as they are placed
+    std::vector<size_t> load(workers_.size());
+    for (size_t w = 0; w < workers_.size(); ++w) load[w] = workers_[w]->load.load();
+    std::vector<std::vector<size_t>> by_worker(workers_.size());
+    for (size_t i = 0; i < cfgs.size(); ++i) {
+        const size_t w = static_cast<size_t>(std::min_element(load.begin(), load.end()) - load.begin());
+        ++load[w];
+        by_worker[w].push_back(i);
+        placed[i] = static_cast<int>(w);
+    }
+    for (size_t w = 0; w < workers_.size(); ++w) {
+        if (by_worker[w].empty()) continue;
+        Worker* target = workers_[w].get();
+        std::vector<std::unique_ptr<TetrisRoom>> rooms;
+        for (size_t i : by_worker[w]) {
+            TetrisRoomConfig& cfg = cfgs[i];
+            if (cfg.listen_fd < 0) {
+                std::lock_guard<std::mutex> lock(routes_mutex_);
+                routes_[cfg.expected_token] = target;
+            }
+            rooms.push_back(std::make_unique<TetrisRoom>(std::move(cfg)));
+        }
+        target->load.fetch_add(rooms.size());
+        {
+            std::lock_guard<std::mutex> lock(target->pending_mutex);
+            for (auto& room : rooms) target->pending.push_back(std::move(room));
+        }
+        target->wake();
+    }
+    return placed;
+}
+
+size_t RoomScheduler::room_count() const {
+    size_t total = 0;
+    for (auto const& w : workers_) total += w->load.load();
+    return total;
+}
+
+bool RoomScheduler::listen_shared(const char* ip, uint16_t& port) {
+    if (started_ || !gateway_.listen(ip, port)) return false;
+    log_checkpoint("Scheduler", "SHARED_LISTENER", "port=" + std::to_string(port));
+    return true;
+}
+
+bool RoomScheduler::adopt_shared(int listen_fd) {
+    if (started_ || !gateway_.adopt(listen_fd)) return false;
+    log_checkpoint("Scheduler", "SHARED_LISTENER", "port=" + std::to_string(gateway_.port()) + " adopted=1");
+    return true;
+}
+
+int RoomScheduler::release_shared() {
+    int fd = gateway_.release();
+    if (fd >= 0) log_checkpoint("Scheduler", "SHARED_LISTENER_RELEASED", "rooms=" + std::to_string(room_count()));
+    return fd;
+}
+
+void RoomScheduler::drop_route(const std::string& token) {
+    std::lock_guard<std::mutex> lock(routes_mutex_);
+    routes_.erase(token);
+}
+
+void RoomScheduler::route_client(int fd, const HelloRoute& hello) {
+    Worker* target = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(routes_mutex_);
+        auto it = routes_.find(hello.token);
+        if (it != routes_.end()) target = it->second;
+    }
+    if (!target && fallback_) {
+        fallback_(fd, hello);
+        return;
+    }
+    // Binary spectators watch through the relay, off the room's thread
+    if (relay_ && hello.spectator && hello.binary) {
+        relay_->adopt(fd, hello.token);
+        return;
+    }
+    if (!target) {
+        log_checkpoint("Scheduler", "ROUTE_REJECTED", "reason=unknown_token");
+        reject_hello(fd);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(target->pending_mutex);
+        target->pending_clients.emplace_back(hello.token, fd);
+    }
+    target->wake();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "hello_gateway.hpp"
+#include "tetris_runtime.hpp"
+
+class SpectatorRelay;
+
+// Hosts many TetrisRooms on a fixed pool of worker threads. Each worker runs one
+// Reactor (core/reactor.hpp) for the listen and client fds of its rooms and
+// their gravity ticks; new rooms go to the worker with the fewest rooms.
+// A worker spreads its rooms' first ticks over the gravity interval, each in
+// the least used of its phase slots, so rooms on one interval do not all wake
+// and broadcast in the same instant.
+//
+// Optionally one shared game listener serves every match: a HelloGateway
+// hands each connection to the worker hosting the room its HELLO token names.
+// Rooms added with listen_fd < 0 rely on it, so a match start costs no
+// socket/bind/listen and no port. With a SpectatorRelay set, binary spectators
+// go to the relay instead and never touch the room's worker.
+class RoomScheduler {
+public:
+    // workers == 0 means one per hardware thread
+    explicit RoomScheduler(size_t workers = 0);
+    ~RoomScheduler();
+    RoomScheduler(const RoomScheduler&) = delete;
+    RoomScheduler& operator=(const RoomScheduler&) = delete;
+
+    // Opens the shared game listener on ip:port (0 picks a free port and writes
+    // it back). Call before start().
+    bool listen_shared(const char* ip, uint16_t& port);
+    // The same with a listener handed over by a predecessor process
+    bool adopt_shared(int listen_fd);
+    uint16_t shared_port() const { return gateway_.port(); }
+    int shared_fd() const { return gateway_.listen_fd(); }
+    // Stops serving the shared listener and returns it (-1 if none), for a
+    // successor process; rooms keep running and route() still reaches them
+    int release_shared();
+    // Where HELLOs for tokens no room here has go instead of being rejected
+    // (a predecessor still finishing its matches). Call before start().
+    void set_fallback(HelloGateway::RouteFn fallback) { fallback_ = std::move(fallback); }
+    // Pins worker i to the (first + i)-th CPU this process may use, taking the
+    // NUMA nodes in turn so workers spread over their memory. A match's boards
+    // are allocated on its worker's thread, so they stay on that node. Call
+    // before start(); processes sharing a host pass different firsts.
+    void set_cpu_pinning(bool on, size_t first = 0) {
+        pin_cpus_ = on;
+        first_cpu_ = first;
+    }
+    // Where binary spectators of the shared listener go. Call before start();
+    // the rooms must be opened on the same relay (TetrisRoomConfig::relay).
+    void set_relay(SpectatorRelay* relay) { relay_ = relay; }
+
+    bool start();
+    // Stops the workers; rooms still running are finished (results reported) first
+    void stop();
+
+    // Hands the room to the least loaded worker; returns its index or -1
+    int add_room(TetrisRoomConfig cfg);
+    // The same for many rooms at once (a tournament round), waking each worker
+    // once. Returns each room's worker, -1 for none.
+    std::vector<int> add_rooms(std::vector<TetrisRoomConfig> cfgs);
+
+    size_t worker_count() const { return workers_.size(); }
+    size_t room_count() const;
+
+    // Takes a connection whose HELLO is still unread, as the shared listener would
+    void route(int fd, const HelloRoute& hello) { route_client(fd, hello); }
+
+private:
+    struct Worker;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    bool started_ = false;
+    bool pin_cpus_ = false;
+    size_t first_cpu_ = 0;
+
+    void route_client(int fd, const HelloRoute& hello);
+    void drop_route(const std::string& token);
+
+    HelloGateway gateway_;
+    SpectatorRelay* relay_ = nullptr;
+    HelloGateway::RouteFn fallback_;
+    std::mutex routes_mutex_;
+    std::unordered_map<std::string, Worker*> routes_; // HELLO token -> hosting worker
+};
@@ -0,0 +1,163 @@
+#include "server_config.hpp"
+
+#include "../core/common.hpp"
+#include "../core/metrics.hpp"
+#include "tetris_game.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+namespace {
+
+struct ConfigKey {
+    const char* name;
+    std::variant<int ServerConfig::*, double ServerConfig::*, size_t ServerConfig::*> member;
+    double min, max;
+};
+
+const ConfigKey kKeys[] = {
+    {"gravity_ms", &ServerConfig::gravity_ms, MIN_GRAVITY_MS, 2000},
+    {"player_frame_rate", &ServerConfig::player_frame_rate, 1, 10000},
+    {"player_frame_burst", &ServerConfig::player_frame_burst, 1, 100000},
+    {"spectator_frame_rate", &ServerConfig::spectator_frame_rate, 1, 10000},
+    {"spectator_frame_burst", &ServerConfig::spectator_frame_burst, 1, 100000},
+    {"inputs_per_tick", &ServerConfig::inputs_per_tick, 1, 65535},
+    {"overload_late_ms", &ServerConfig::overload_late_ms, 1, 60000},
+    {"snapshot_heartbeat_ms", &ServerConfig::snapshot_heartbeat_ms, 100, 60000},
+    {"write_high_water", &ServerConfig::write_high_water, 4096, 64.0 * 1024 * 1024},
+    {"write_hard_limit", &ServerConfig::write_hard_limit, 4096, 1024.0 * 1024 * 1024},
+    {"play_rate", &ServerConfig::play_rate, 0.1, 100000},
+    {"play_burst", &ServerConfig::play_burst, 1, 1000000},
+    {"listing_rate", &ServerConfig::listing_rate, 0.1, 100000},
+    {"listing_burst", &ServerConfig::listing_burst, 1, 1000000},
+    {"spectate_rate", &ServerConfig::spectate_rate, 0.1, 100000},
+    {"spectate_burst", &ServerConfig::spectate_burst, 1, 1000000},
+    {"shed_backlog", &ServerConfig::shed_backlog, 1, 1000000},
+};
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+bool parse_file(const std::string& path, ServerConfig& out, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string line;
+    for (int lineno = 1; std::getline(in, line); ++lineno) {
+        std::string_view text = line;
+        text = trim(text.substr(0, text.find('#')));
+        if (text.empty()) continue;
+        const size_t eq = text.find('=');
+        const std::string where = path + ":" + std::to_string(lineno);
+        if (eq == std::string_view::npos) {
+            error = where + ": expected key = value";
+            return false;
+        }
+        const std::string_view key = trim(text.substr(0, eq));
+        const std::string value(trim(text.substr(eq + 1)));
+        const ConfigKey* found = nullptr;
+        for (const ConfigKey& k : kKeys) {
+            if (key == k.name) found = &k;
+        }
+        if (!found) {
+            error = where + ": unknown key " + std::string(key);
+            return false;
+        }
+        char* end = nullptr;
+        errno = 0;
+        const double v = std::strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || errno != 0 || v < found->min || v > found->max) {
+            error = where + ": bad value for " + std::string(key);
+            return false;
+        }
+        std::visit(
+            [&](auto member) {
+                using T = std::remove_reference_t<decltype(out.*member)>;
+                out.*member = static_cast<T>(v);
+            },
+            found->member);
+    }
+    if (out.write_high_water > out.write_hard_limit) {
+        error = path + ": write_high_water is above write_hard_limit";
+        return false;
+    }
+    return true;
+}
+
+const ServerConfig kDefaults{};
+std::atomic<const ServerConfig*> g_current{&kDefaults};
+std::mutex g_load_mutex; // loads, and what they keep
+std::vector<std::unique_ptr<ServerConfig>> g_snapshots;
+std::string g_path;
+volatile std::sig_atomic_t g_reload_requested = 0;
+
+void handle_sighup(int) {
+    g_reload_requested = 1;
+}
+
+MetricGauge& config_version_gauge() {
+    static MetricGauge& g = metrics().gauge("server_config_version", "Loads of the config file that took");
+    return g;
+}
+
+} // namespace
+
+const ServerConfig& server_config() {
+    return *g_current.load(std::memory_order_acquire);
+}
+
+bool server_config_load(const std::string& path, std::string& error) {
+    std::lock_guard<std::mutex> lock(g_load_mutex);
+    auto next = std::make_unique<ServerConfig>();
+    if (!parse_file(path, *next, error)) {
+        log_checkpoint("Config", "LOAD_FAIL", error);
+        return false;
+    }
+    next->version = server_config().version + 1;
+    g_path = path;
+    g_current.store(next.get(), std::memory_order_release);
+    config_version_gauge().set(static_cast<int64_t>(next->version));
+    log_checkpoint("Config", "LOADED", "path=" + path + " version=" + std::to_string(next->version));
+    g_snapshots.push_back(std::move(next));
+    return true;
+}
+
+void server_config_watch_sighup() {
+    struct sigaction sa{};
+    sa.sa_handler = handle_sighup;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGHUP, &sa, nullptr) == -1) perror("sigaction(SIGHUP)");
+}
+
+bool server_config_poll_signal() {
+    if (!g_reload_requested) return false;
+    g_reload_requested = 0;
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(g_load_mutex);
+        path = g_path;
+    }
+    if (path.empty()) {
+        log_checkpoint("Config", "RELOAD_SKIPPED", "no --config file");
+        return true;
+    }
+    std::string error;
+    server_config_load(path, error);
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "../core/lp_framing.hpp"
+
+// Tunables that can change under a running server. "--config <path>" names a
+// file of "key = value" lines ('#' starts a comment) that is read at startup
+// and again on SIGHUP; a key the file leaves out keeps its default, an unknown
+// key or a value out of range fails the whole load, and a failed reload keeps
+// what was in force. What a change reaches: matches and connections started
+// after it, and the lobby's command limits of every client (their buckets
+// start over, full). A running match keeps its gravity.
+//
+// Reads are one atomic load: server_config() returns the current snapshot,
+// which never changes under its reader. A reload builds a new one and
+// publishes it; the old ones are kept until exit (reloads are rare and a
+// snapshot is small), so no reader ever takes a lock or a reference count.
+struct ServerConfig {
+    uint64_t version = 0; // bumps on every load that took
+
+    // Rooms
+    int gravity_ms = 500;               // level 0 drop interval of matches that do not name one
+    double player_frame_rate = 120;     // frames per second a player may send...
+    double player_frame_burst = 240;    // ...and at once
+    double spectator_frame_rate = 10;
+    double spectator_frame_burst = 20;
+    int inputs_per_tick = 32;           // applied per board between two gravity steps
+    double overload_late_ms = 50;       // average gravity lateness past which spectators are shed
+    int snapshot_heartbeat_ms = 2000;   // an unchanged board is re-sent this often
+    size_t write_high_water = LP_WRITE_HIGH_WATER; // queued bytes past which snapshots coalesce
+    size_t write_hard_limit = LP_WRITE_HARD_LIMIT; // queued bytes that drop a client
+
+    // Lobby, by command class (see CommandClass)
+    double play_rate = 50;
+    double play_burst = 100;
+    double listing_rate = 5;
+    double listing_burst = 20;
+    double spectate_rate = 5;
+    double spectate_burst = 20;
+    size_t shed_backlog = 256; // lane backlog past which listing and spectate commands are refused
+};
+
+// The snapshot in force; stays valid for the life of the process
+const ServerConfig& server_config();
+
+// Reads path into a new snapshot and publishes it; false (with why in error)
+// leaves the current one in force. Remembers path for reloads.
+bool server_config_load(const std::string& path, std::string& error);
+
+// Reloads on SIGHUP: installs the handler, which only sets a flag
+void server_config_watch_sighup();
+// Main loops call this to carry out a SIGHUP outside the handler; true if one
+// was pending (whether or not the reload took)
+bool server_config_poll_signal();
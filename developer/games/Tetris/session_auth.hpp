@@ -0,0 +1,168 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// SipHash-2-4: a keyed 64-bit hash that is safe to use as a MAC for short
+// messages, which is all a session ticket is
+inline uint64_t siphash24(const uint8_t key[16], std::string_view msg) {
+    auto load64 = [](const uint8_t* p) {
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+        return v;
+    };
+    auto rotl = [](uint64_t x, int b) { return (x << b) | (x >> (64 - b)); };
+    const uint64_t k0 = load64(key), k1 = load64(key + 8);
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ull, v1 = k1 ^ 0x646f72616e646f6dull;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ull, v3 = k1 ^ 0x7465646279746573ull;
+    auto round = [&] {
+        v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+        v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+    };
+    const auto* in = reinterpret_cast<const uint8_t*>(msg.data());
+    const size_t len = msg.size();
+    const size_t whole = len - len % 8;
+    for (size_t i = 0; i < whole; i += 8) {
+        const uint64_t m = load64(in + i);
+        v3 ^= m;
+        round();
+        round();
+        v0 ^= m;
+    }
+    uint64_t last = static_cast<uint64_t>(len & 0xff) << 56;
+    for (size_t i = 0; i < len % 8; ++i) last |= static_cast<uint64_t>(in[whole + i]) << (8 * i);
+    v3 ^= last;
+    round();
+    round();
+    v0 ^= last;
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i) round();
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// Session tickets let a client that logged in once come back (RESUME) without
+// the lobby reading its user row again. A ticket is
+//   <username>:<expiry, unix seconds>:<16 hex digits of SipHash over the rest>
+// under a 128-bit key only the lobby knows, so it is checked without the DB.
+// Processes that should accept each other's tickets need the same key.
+class SessionTickets {
+public:
+    static constexpr int64_t kLifetimeSecs = 3600;
+
+    SessionTickets() {
+        std::random_device rd;
+        for (auto& b : key_) b = static_cast<uint8_t>(rd());
+    }
+
+    // 32 hex digits; false (and the key unchanged) if hex is not that
+    bool set_key(std::string_view hex) {
+        uint8_t key[16];
+        if (hex.size() != 32) return false;
+        for (size_t i = 0; i < 16; ++i) {
+            char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+            char* end = nullptr;
+            key[i] = static_cast<uint8_t>(std::strtoul(byte, &end, 16));
+            if (end != byte + 2) return false;
+        }
+        std::memcpy(key_, key, sizeof(key_));
+        return true;
+    }
+    std::string key_hex() const {
+        std::string out;
+        char byte[3];
+        for (uint8_t b : key_) {
+            std::snprintf(byte, sizeof(byte), "%02x", b);
+            out += byte;
+        }
+        return out;
+    }
+
+    std::string issue(const std::string& username, int64_t now) const {
+        const std::string body = username + ":" + std::to_string(now + kLifetimeSecs);
+        return body + ":" + sign(body);
+    }
+
+    // The username of a ticket that is ours and not expired, else false
+    bool verify(std::string_view ticket, int64_t now, std::string& username) const {
+        const size_t sig = ticket.rfind(':');
+        if (sig == std::string_view::npos || sig == 0) return false;
+        const size_t exp = ticket.rfind(':', sig - 1);
+        if (exp == std::string_view::npos || exp == 0) return false;
+        const std::string_view body = ticket.substr(0, sig);
+        const std::string_view got = ticket.substr(sig + 1);
+        const std::string want = sign(body);
+        if (got.size() != want.size()) return false;
+        unsigned char diff = 0; // every digit compared, so timing says nothing about a forgery
+        for (size_t i = 0; i < want.size(); ++i) diff |= static_cast<unsigned char>(got[i] ^ want[i]);
+        if (diff != 0) return false;
+        const int64_t expiry = std::atoll(std::string(ticket.substr(exp + 1, sig - exp - 1)).c_str());
+        if (expiry < now) return false;
+        username = ticket.substr(0, exp);
+        return true;
+    }
+
+private:
+    std::string sign(std::string_view body) const {
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(siphash24(key_, body)));
+        return hex;
+    }
+
+    uint8_t key_[16];
+};
+
+// Recently verified username/password pairs, so a LOGIN repeated after a
+// disconnect need not read the user row again. Passwords are kept only as a
+// keyed hash. Users never change their password or go away, so an entry stays
+// right until it is evicted (least recently used first).
+class CredentialCache {
+public:
+    explicit CredentialCache(size_t capacity) : capacity_(capacity) {
+        std::random_device rd;
+        for (auto& b : key_) b = static_cast<uint8_t>(rd());
+    }
+
+    bool matches(const std::string& username, std::string_view pass) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(username);
+        if (it == entries_.end()) return false;
+        order_.splice(order_.begin(), order_, it->second.pos);
+        return it->second.digest == siphash24(key_, pass);
+    }
+
+    void remember(const std::string& username, std::string_view pass) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(username);
+        if (it != entries_.end()) {
+            it->second.digest = siphash24(key_, pass);
+            order_.splice(order_.begin(), order_, it->second.pos);
+            return;
+        }
+        if (entries_.size() >= capacity_ && !order_.empty()) {
+            entries_.erase(order_.back());
+            order_.pop_back();
+        }
+        order_.push_front(username);
+        entries_.emplace(username, Entry{siphash24(key_, pass), order_.begin()});
+    }
+
+private:
+    struct Entry {
+        uint64_t digest;
+        std::list<std::string>::iterator pos;
+    };
+    const size_t capacity_;
+    uint8_t key_[16];
+    std::mutex mutex_;
+    std::list<std::string> order_; // most recent first
+    std::unordered_map<std::string, Entry> entries_;
+};
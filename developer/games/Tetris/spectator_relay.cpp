@@ -0,0 +1,686 @@
+#include "spectator_relay.hpp"
+
+#include "../core/common.hpp"
+#include "hello_gateway.hpp"
+#include "../core/metrics.hpp"
+#include "../core/reactor.hpp"
+#include "tetris_snapshot.hpp"
+#include "uring_sender.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+constexpr int kIdleWaitMs = 500;  // upper bound so workers notice shutdown
+constexpr int kCloseDrainMs = 250; // how long a closed channel's viewers get to take what is queued
+constexpr int kDrainPollMs = 20;
+constexpr int kMaxRateMs = 60000; // slowest "rate=" a spectator may ask for
+constexpr int kBatchIov = 16;     // frames per viewer in one batched send; the rest wait for EPOLLOUT
+
+struct RelayMetrics {
+    MetricGauge& viewers = metrics().gauge("relay_viewers", "Spectators connected to the relay");
+    MetricGauge& channels = metrics().gauge("relay_channels", "Matches open on the relay");
+    MetricCounter& frames_in = metrics().counter("relay_frames_in_total", "Frames published to the relay or received from upstream");
+    MetricCounter& bytes_out = metrics().counter("relay_bytes_out_total", "Bytes queued to relayed spectators");
+    MetricCounter& resyncs =
+        metrics().counter("relay_resyncs_total", "Keyframes rebuilt for late joiners and spectators that missed a delta");
+    MetricCounter& slow_viewers =
+        metrics().counter("relay_slow_viewers_total", "Spectators dropped for an overflowing send queue");
+};
+
+RelayMetrics& relay_metrics() {
+    static RelayMetrics m;
+    return m;
+}
+}
+
+struct SpectatorRelay::Worker {
+    using Clock = std::chrono::steady_clock;
+
+    SpectatorRelay* owner = nullptr;
+    size_t index = 0;
+    Reactor reactor;
+    std::thread thread;
+    std::atomic<bool> stop{false};
+
+    struct Command {
+        enum class Kind { Open, Publish, Close, Adopt };
+        Kind kind = Kind::Publish;
+        uint64_t channel = 0;
+        std::string token;
+        std::string welcome;
+        LpFrame frame;
+        int fd = -1;
+    };
+    std::mutex inbox_mutex;
+    std::vector<Command> inbox;
+
+    struct Viewer {
+        int fd = -1;
+        uint64_t channel = 0; // 0 until its HELLO is read
+        std::string token;
+        FrameReader reader;
+        FrameWriter writer;
+        bool armed = false; // watching EPOLLOUT
+        bool dirty = false; // has frames queued this round, in Worker::dirty
+        // HELLO (or a later VIEW) "detail=summary|paused" and "rate=<ms>". A
+        // paced viewer gets, per board, the latest state (a keyframe, or a
+        // summary) at most once per interval instead of every frame; a paused
+        // one gets no boards at all until it asks again.
+        bool summary = false;
+        bool paused = false;
+        Clock::duration interval{};
+        uint32_t sent[2] = {};  // channel version last queued, per board
+        Clock::time_point next_due[2];
+        bool scheduled[2] = {}; // has a pacing timer pending
+        bool paced() const { return summary || interval.count() > 0; }
+    };
+    struct Summary {
+        int score = 0;
+        int lines = 0;
+        int height = 0;
+        bool gameover = false;
+        bool operator==(const Summary&) const = default;
+    };
+    struct Channel {
+        std::string token;
+        LpFrame welcome; // null until a followed channel hears upstream's WELCOME
+        SnapshotView views[2];
+        std::vector<Viewer*> viewers;
+        int upstream_fd = -1;
+        FrameReader upstream_reader;
+        bool closing = false;
+        Clock::time_point close_by;
+        // Per board: bumped by every snapshot, and by those that change what a
+        // summary shows. Each level is encoded once per version and shared.
+        uint32_t version[2] = {};
+        uint32_t summary_version[2] = {};
+        Summary summarized[2];
+        LpFrame keyframe[2];
+        uint32_t keyframe_at[2] = {};
+        LpFrame summary[2];
+        uint32_t summary_at[2] = {};
+    };
+    // Reactor thread only
+    std::unordered_map<uint64_t, Channel> channels;
+    std::unordered_map<std::string, uint64_t> by_token;
+    std::unordered_map<int, std::unique_ptr<Viewer>> viewers;
+    std::unordered_map<int, uint64_t> upstreams; // upstream fd -> channel
+    int closing = 0;
+    // Viewers given frames since the last flush_dirty(), by fd, and what a
+    // batched send of them needs; kept between rounds so sending allocates nothing
+    std::vector<int> dirty, flushing;
+    std::unique_ptr<UringSender> uring;
+    std::vector<msghdr> batch_msgs;
+    std::vector<iovec> batch_iov;
+    std::vector<UringSender::Result> batch_results;
+
+    // Any thread. Only a command finding the inbox empty posts a drain: the
+    // reactor swaps the whole inbox out, so one task covers a burst
+    void post(Command cmd) {
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(inbox_mutex);
+            wake = inbox.empty();
+            inbox.push_back(std::move(cmd));
+        }
+        if (wake) reactor.post([this] { drain_inbox(); });
+    }
+
+    void drain_inbox() {
+        std::vector<Command> batch;
+        {
+            std::lock_guard<std::mutex> lock(inbox_mutex);
+            batch.swap(inbox);
+        }
+        for (Command& cmd : batch) {
+            switch (cmd.kind) {
+            case Command::Kind::Open: {
+                Channel& ch = channels[cmd.channel];
+                ch.token = cmd.token;
+                ch.welcome = lp_prepare_frame(cmd.welcome);
+                by_token[cmd.token] = cmd.channel;
+                relay_metrics().channels.add(1);
+                break;
+            }
+            case Command::Kind::Publish: {
+                auto it = channels.find(cmd.channel);
+                if (it == channels.end() || it->second.closing || !cmd.frame) break;
+                fan_out(it->second, cmd.frame, cmd.frame->substr(4));
+                break;
+            }
+            case Command::Kind::Close: close_channel(cmd.channel); break;
+            case Command::Kind::Adopt: {
+                auto v = std::make_unique<Viewer>();
+                v->fd = cmd.fd;
+                v->token = std::move(cmd.token);
+                const int fd = cmd.fd;
+                if (!reactor.add(fd, EPOLLIN, [this, fd](uint32_t events) { on_viewer(fd, events); })) {
+                    reject_hello(fd);
+                    break;
+                }
+                viewers[cmd.fd] = std::move(v);
+                relay_metrics().viewers.add(1);
+                break;
+            }
+            }
+        }
+    }
+
+    // Queues one frame for every viewer of ch. Binary snapshots also update
+    // the channel's copy of the board, which is what late joiners and viewers
+    // that miss a delta are rebuilt from.
+    void fan_out(Channel& ch, const LpFrame& frame, const std::string& body) {
+        relay_metrics().frames_in.add();
+        int board = -1;
+        if (is_binary_snapshot(body)) {
+            if (!apply_binary_snapshot(body, ch.views, board)) return;
+            note_board(ch, board);
+        }
+        const bool delta = board >= 0 && is_binary_delta(body);
+        const auto now = Clock::now();
+        std::vector<int> failed;
+        for (Viewer* v : ch.viewers) {
+            if (board >= 0 && v->paused) continue;
+            if (board >= 0 && v->paced()) {
+                if (!offer(ch, *v, board, now)) failed.push_back(v->fd);
+                continue;
+            }
+            FrameWriter::EnqueueResult r = v->writer.enqueue(frame, board, !delta);
+            size_t queued = frame->size();
+            if (r == FrameWriter::EnqueueResult::Skipped) {
+                const LpFrame& resync = keyframe_of(ch, board);
+                r = v->writer.enqueue(resync, board, true);
+                queued = resync->size();
+            }
+            if (r == FrameWriter::EnqueueResult::Overflow) {
+                relay_metrics().slow_viewers.add();
+                log_checkpoint("Relay", "VIEWER_TOO_SLOW",
+                               "fd=" + std::to_string(v->fd) + " queued=" + std::to_string(v->writer.queued_bytes()));
+                failed.push_back(v->fd);
+                continue;
+            }
+            relay_metrics().bytes_out.add(queued);
+            mark_dirty(*v);
+        }
+        for (int fd : failed) drop_viewer(fd);
+    }
+
+    // After a snapshot of board was applied to ch.views. Gravity steps only
+    // move the piece, so a summary changes on locks and at the end.
+    void note_board(Channel& ch, int board) {
+        const SnapshotView& view = ch.views[board];
+        ++ch.version[board];
+        const Summary shown{view.score, view.lines, view_stack_height(view), view.gameover};
+        if (ch.summary_version[board] == 0 || shown != ch.summarized[board]) {
+            ch.summarized[board] = shown;
+            ++ch.summary_version[board];
+        }
+    }
+
+    // Latest state of a board at each detail level, encoded on first need
+    const LpFrame& keyframe_of(Channel& ch, int board) {
+        if (!ch.keyframe[board] || ch.keyframe_at[board] != ch.version[board]) {
+            ch.keyframe[board] = lp_prepare_frame(encode_view_keyframe(ch.views[board], static_cast<uint8_t>(board)));
+            ch.keyframe_at[board] = ch.version[board];
+            relay_metrics().resyncs.add();
+        }
+        return ch.keyframe[board];
+    }
+    const LpFrame& summary_of(Channel& ch, int board) {
+        if (!ch.summary[board] || ch.summary_at[board] != ch.summary_version[board]) {
+            ch.summary[board] =
+                lp_prepare_frame(encode_view_summary(ch.views[board], static_cast<uint8_t>(board),
+                                                    ch.summarized[board].height));
+            ch.summary_at[board] = ch.summary_version[board];
+        }
+        return ch.summary[board];
+    }
+
+    // Queues a paced viewer's board if it is behind and its interval is up,
+    // otherwise schedules it for when it is. False if the viewer must go.
+    bool offer(Channel& ch, Viewer& v, int board, Clock::time_point now) {
+        if (v.paused) return true;
+        const uint32_t want = v.summary ? ch.summary_version[board] : ch.version[board];
+        if (v.sent[board] == want || !ch.views[board].have_keyframe) return true;
+        if (now < v.next_due[board]) {
+            if (!v.scheduled[board]) {
+                v.scheduled[board] = true;
+                const int fd = v.fd;
+                reactor.at(v.next_due[board], [this, fd, board] { pace(fd, board); });
+            }
+            return true;
+        }
+        const LpFrame& frame = v.summary ? summary_of(ch, board) : keyframe_of(ch, board);
+        if (v.writer.enqueue(frame, board, true) == FrameWriter::EnqueueResult::Overflow) {
+            relay_metrics().slow_viewers.add();
+            return false;
+        }
+        relay_metrics().bytes_out.add(frame->size());
+        v.sent[board] = want;
+        v.next_due[board] = now + v.interval;
+        mark_dirty(v);
+        return true;
+    }
+
+    // A paced viewer's interval for board is up. The viewer may be gone
+    // meanwhile, its fd even reused: offer() holds back a board that is not due.
+    void pace(int fd, int board) {
+        auto vit = viewers.find(fd);
+        if (vit == viewers.end()) return;
+        Viewer& v = *vit->second;
+        v.scheduled[board] = false;
+        auto cit = channels.find(v.channel);
+        if (cit == channels.end() || cit->second.closing) return;
+        if (!offer(cit->second, v, board, Clock::now())) drop_viewer(fd);
+    }
+
+    // WELCOME and the latest state of every board seen so far
+    void greet(Channel& ch, Viewer& v) {
+        v.writer.enqueue(ch.welcome);
+        catch_up(ch, v);
+    }
+
+    // The latest state of every board at the viewer's level of detail
+    void catch_up(Channel& ch, Viewer& v) {
+        const auto now = Clock::now();
+        for (int b = 0; b < 2 && !v.paused; ++b) {
+            if (!ch.views[b].have_keyframe) continue;
+            if (v.paced()) {
+                if (!offer(ch, v, b, now)) {
+                    drop_viewer(v.fd);
+                    return;
+                }
+                continue;
+            }
+            v.writer.enqueue(keyframe_of(ch, b), b, true);
+        }
+        if (!flush(v)) drop_viewer(v.fd);
+    }
+
+    static void read_detail(Viewer& v, std::string_view msg) {
+        const std::string_view detail = hello_field(msg, "detail");
+        v.summary = detail == "summary";
+        v.paused = detail == "paused";
+        const std::string_view rate = hello_field(msg, "rate");
+        int rate_ms = 0;
+        std::from_chars(rate.data(), rate.data() + rate.size(), rate_ms);
+        v.interval = std::chrono::milliseconds(std::clamp(rate_ms, 0, kMaxRateMs));
+    }
+
+    // VIEW: the viewer changes its level of detail (a grid of matches pauses
+    // the ones out of sight, say). What it has may be older than the new level
+    // allows, or deltas may no longer fit it, so it is brought up to date at
+    // once.
+    void change_view(Viewer& v, std::string_view msg) {
+        read_detail(v, msg);
+        for (int b = 0; b < 2; ++b) {
+            v.sent[b] = 0;
+            v.next_due[b] = Clock::time_point{};
+        }
+        auto cit = channels.find(v.channel);
+        if (cit == channels.end() || cit->second.closing || !cit->second.welcome) return;
+        catch_up(cit->second, v);
+    }
+
+    bool flush(Viewer& v) {
+        if (!v.writer.flush(v.fd)) return false;
+        watch_writable(v);
+        return true;
+    }
+
+    // EPOLLOUT only while the viewer has frames its socket would not take yet
+    void watch_writable(Viewer& v) {
+        const bool want = v.writer.pending();
+        if (want != v.armed) {
+            v.armed = want;
+            reactor.modify(v.fd, EPOLLIN | (want ? static_cast<uint32_t>(EPOLLOUT) : 0u));
+        }
+    }
+
+    // Frames go out at the end of the reactor round, so a viewer given both
+    // boards' snapshots (or a burst of publishes) is written to once
+    void mark_dirty(Viewer& v) {
+        if (v.dirty) return;
+        v.dirty = true;
+        dirty.push_back(v.fd);
+    }
+
+    // With a ring, every viewer's send of the round leaves in one
+    // io_uring_enter per batch; otherwise each gets its own sendmsg
+    void flush_dirty() {
+        if (dirty.empty()) return;
+        flushing.swap(dirty);
+        std::vector<int> failed;
+        if (uring && uring->available()) {
+            send_batched(failed);
+        } else {
+            for (int fd : flushing) {
+                auto it = viewers.find(fd);
+                if (it == viewers.end()) continue;
+                it->second->dirty = false;
+                if (!flush(*it->second)) failed.push_back(fd);
+            }
+        }
+        flushing.clear();
+        for (int fd : failed) drop_viewer(fd);
+    }
+
+    void send_batched(std::vector<int>& failed) {
+        batch_msgs.resize(flushing.size());
+        batch_iov.resize(flushing.size() * kBatchIov);
+        for (size_t i = 0; i < flushing.size();) {
+            const size_t first = i;
+            for (; i < flushing.size() && uring->space() > 0; ++i) {
+                auto it = viewers.find(flushing[i]);
+                if (it == viewers.end()) continue;
+                Viewer& v = *it->second;
+                v.dirty = false;
+                if (!v.writer.pending()) continue;
+                msghdr& msg = batch_msgs[i];
+                msg = msghdr{};
+                msg.msg_iov = &batch_iov[i * kBatchIov];
+                msg.msg_iovlen = static_cast<size_t>(v.writer.gather(msg.msg_iov, kBatchIov));
+                uring->queue(v.fd, &msg, i);
+            }
+            if (!uring->submit(batch_results)) {
+                // Nothing says what reached whom: those viewers cannot be resumed
+                for (size_t k = first; k < i; ++k) failed.push_back(flushing[k]);
+                continue;
+            }
+            for (const UringSender::Result& r : batch_results) {
+                const int fd = flushing[static_cast<size_t>(r.tag)];
+                Viewer& v = *viewers.at(fd);
+                if (!v.writer.sent(r.bytes)) {
+                    failed.push_back(fd);
+                    continue;
+                }
+                watch_writable(v);
+            }
+        }
+    }
+
+    void join(Viewer& v) {
+        auto tit = by_token.find(v.token);
+        uint64_t id = tit != by_token.end() ? tit->second : follow(v.token);
+        auto cit = channels.find(id);
+        if (cit == channels.end() || cit->second.closing) {
+            lp_send_frame(v.fd, "ERR invalid_player_or_token");
+            drop_viewer(v.fd);
+            return;
+        }
+        v.channel = id;
+        cit->second.viewers.push_back(&v);
+        if (cit->second.welcome) greet(cit->second, v);
+    }
+
+    // Opens a channel fed by upstream for a token nobody published here; 0 if
+    // there is no upstream or it cannot be reached
+    uint64_t follow(const std::string& token) {
+        if (owner->upstream_host_.empty()) return 0;
+        const int fd = connect_tcp(owner->upstream_host_, owner->upstream_port_);
+        if (fd < 0) return 0;
+        if (!lp_send_frame(fd, "HELLO username=relay token=" + token + " role=SPEC snap=" + SNAP_BIN_TAG)) {
+            ::close(fd);
+            return 0;
+        }
+        const bool added = reactor.add(fd, EPOLLIN, [this, fd](uint32_t) {
+            auto it = upstreams.find(fd);
+            if (it != upstreams.end()) on_upstream(fd, it->second);
+        });
+        if (!added) {
+            ::close(fd);
+            return 0;
+        }
+        const uint64_t id = owner->next_serial_.fetch_add(1) * owner->workers_.size() + index;
+        Channel& ch = channels[id];
+        ch.token = token;
+        ch.upstream_fd = fd;
+        by_token[token] = id;
+        upstreams[fd] = id;
+        relay_metrics().channels.add(1);
+        log_checkpoint("Relay", "FOLLOWING", "upstream=" + owner->upstream_host_ + ":" +
+                                                 std::to_string(owner->upstream_port_) + " channel=" + std::to_string(id));
+        return id;
+    }
+
+    void on_upstream(int fd, uint64_t id) {
+        Channel& ch = channels[id];
+        std::vector<std::string> frames;
+        FrameReader::ReadResult st = ch.upstream_reader.read_from(fd, frames);
+        for (const std::string& f : frames) {
+            if (ch.closing) break;
+            LpFrame frame = lp_prepare_frame(f);
+            if (!frame) continue;
+            if (ch.welcome) {
+                fan_out(ch, frame, f);
+            } else if (f.rfind("WELCOME", 0) == 0) {
+                ch.welcome = frame;
+                std::vector<Viewer*> waiting = ch.viewers;
+                for (Viewer* v : waiting) greet(ch, *v);
+            } else {
+                // Upstream turned the token down: so does this relay
+                fan_out(ch, frame, f);
+                close_channel(id);
+            }
+        }
+        if (st != FrameReader::ReadResult::Ok) close_channel(id);
+    }
+
+    void on_viewer(int fd, uint32_t events) {
+        auto it = viewers.find(fd);
+        if (it == viewers.end()) return;
+        Viewer& v = *it->second;
+        if ((events & EPOLLOUT) && !flush(v)) {
+            drop_viewer(fd);
+            return;
+        }
+        if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+        std::vector<std::string> frames;
+        FrameReader::ReadResult st = v.reader.read_from(fd, frames);
+        // After HELLO a spectator only ever says VIEW
+        for (size_t i = 0; i < frames.size(); ++i) {
+            const std::string& msg = frames[i];
+            if (v.channel == 0 && i == 0) {
+                if (msg.rfind("HELLO ", 0) != 0) {
+                    drop_viewer(fd);
+                    return;
+                }
+                read_detail(v, msg);
+                join(v);
+            } else if (msg.rfind("VIEW ", 0) == 0) {
+                change_view(v, msg);
+            }
+            if (!viewers.count(fd)) return;
+        }
+        if (st != FrameReader::ReadResult::Ok) drop_viewer(fd);
+    }
+
+    void drop_viewer(int fd) {
+        auto it = viewers.find(fd);
+        if (it == viewers.end()) return;
+        Viewer* v = it->second.get();
+        auto cit = channels.find(v->channel);
+        if (cit != channels.end()) {
+            auto& list = cit->second.viewers;
+            list.erase(std::remove(list.begin(), list.end(), v), list.end());
+            // A followed match nobody here watches any more is let go
+            if (list.empty() && cit->second.upstream_fd >= 0 && !cit->second.closing) close_channel(v->channel);
+        }
+        reactor.remove(fd);
+        ::close(fd);
+        viewers.erase(it);
+        relay_metrics().viewers.add(-1);
+    }
+
+    void close_channel(uint64_t id) {
+        auto it = channels.find(id);
+        if (it == channels.end() || it->second.closing) return;
+        Channel& ch = it->second;
+        ch.closing = true;
+        ch.close_by = Clock::now() + std::chrono::milliseconds(kCloseDrainMs);
+        ++closing;
+        auto tit = by_token.find(ch.token);
+        if (tit != by_token.end() && tit->second == id) by_token.erase(tit);
+        if (ch.upstream_fd >= 0) {
+            upstreams.erase(ch.upstream_fd);
+            reactor.remove(ch.upstream_fd);
+            ::close(ch.upstream_fd);
+            ch.upstream_fd = -1;
+        }
+    }
+
+    // Closes the viewers of closed channels once their queue is out (or the
+    // drain time is up), then the channels themselves
+    void reap() {
+        if (closing == 0) return;
+        const auto now = Clock::now();
+        for (auto it = channels.begin(); it != channels.end();) {
+            Channel& ch = it->second;
+            if (!ch.closing) {
+                ++it;
+                continue;
+            }
+            std::vector<int> done;
+            for (Viewer* v : ch.viewers) {
+                if (!v->writer.pending() || now >= ch.close_by) done.push_back(v->fd);
+            }
+            for (int fd : done) drop_viewer(fd);
+            if (!ch.viewers.empty()) {
+                ++it;
+                continue;
+            }
+            it = channels.erase(it);
+            --closing;
+            relay_metrics().channels.add(-1);
+        }
+    }
+
+    void run() {
+        while (running && !stop.load()) {
+            reactor.run_once(closing > 0 ? kDrainPollMs : kIdleWaitMs);
+            flush_dirty();
+            reap();
+        }
+
+        for (auto& [fd, v] : viewers) {
+            reactor.remove(fd);
+            ::close(fd);
+        }
+        relay_metrics().viewers.add(-static_cast<int64_t>(viewers.size()));
+        viewers.clear();
+        for (auto& [fd, id] : upstreams) {
+            reactor.remove(fd);
+            ::close(fd);
+        }
+        upstreams.clear();
+        relay_metrics().channels.add(-static_cast<int64_t>(channels.size()));
+        channels.clear();
+        by_token.clear();
+        closing = 0;
+        dirty.clear();
+        // Connections handed over after the last drain are still owned here
+        std::lock_guard<std::mutex> lock(inbox_mutex);
+        for (Command& cmd : inbox) {
+            if (cmd.kind == Command::Kind::Adopt) ::close(cmd.fd);
+        }
+        inbox.clear();
+    }
+};
+
+SpectatorRelay::SpectatorRelay(size_t workers) {
+    if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < workers; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+        workers_.back()->owner = this;
+        workers_.back()->index = i;
+    }
+}
+
+SpectatorRelay::~SpectatorRelay() {
+    stop();
+}
+
+void SpectatorRelay::set_upstream(const std::string& host, uint16_t port) {
+    upstream_host_ = host;
+    upstream_port_ = port;
+}
+
+bool SpectatorRelay::start() {
+    if (started_) return true;
+    for (auto& w : workers_) {
+        if (!w->reactor.ok()) return false;
+        if (!w->uring) w->uring = std::make_unique<UringSender>();
+    }
+    for (auto& w : workers_) {
+        w->stop.store(false);
+        Worker* raw = w.get();
+        w->thread = std::thread([raw]() { raw->run(); });
+    }
+    started_ = true;
+    log_checkpoint("Relay", "STARTED", "workers=" + std::to_string(workers_.size()));
+    return true;
+}
+
+void SpectatorRelay::stop() {
+    if (!started_) return;
+    for (auto& w : workers_) {
+        w->stop.store(true);
+        w->reactor.post([] {}); // wakes it to see the flag
+    }
+    for (auto& w : workers_) {
+        if (w->thread.joinable()) w->thread.join();
+    }
+    started_ = false;
+}
+
+SpectatorRelay::Worker& SpectatorRelay::worker_for(const std::string& token) {
+    return *workers_[std::hash<std::string>{}(token) % workers_.size()];
+}
+
+uint64_t SpectatorRelay::open(const std::string& token, const std::string& welcome) {
+    Worker& w = worker_for(token);
+    const uint64_t id = next_serial_.fetch_add(1) * workers_.size() + w.index;
+    Worker::Command cmd;
+    cmd.kind = Worker::Command::Kind::Open;
+    cmd.channel = id;
+    cmd.token = token;
+    cmd.welcome = welcome;
+    w.post(std::move(cmd));
+    return id;
+}
+
+void SpectatorRelay::publish(uint64_t channel, LpFrame frame) {
+    Worker::Command cmd;
+    cmd.kind = Worker::Command::Kind::Publish;
+    cmd.channel = channel;
+    cmd.frame = std::move(frame);
+    workers_[channel % workers_.size()]->post(std::move(cmd));
+}
+
+void SpectatorRelay::close(uint64_t channel) {
+    Worker::Command cmd;
+    cmd.kind = Worker::Command::Kind::Close;
+    cmd.channel = channel;
+    workers_[channel % workers_.size()]->post(std::move(cmd));
+}
+
+void SpectatorRelay::adopt(int fd, const std::string& token) {
+    if (!started_) {
+        reject_hello(fd);
+        return;
+    }
+    Worker::Command cmd;
+    cmd.kind = Worker::Command::Kind::Adopt;
+    cmd.token = token;
+    cmd.fd = fd;
+    worker_for(token).post(std::move(cmd));
+}
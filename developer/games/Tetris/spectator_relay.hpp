@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../core/lp_framing.hpp"
+
+// Serves a match's spectators off the room's thread. The room opens a channel
+// when it is created, publishes each frame spectators should see (the binary
+// snapshots of both boards, and the PLAYER_AWAY / PLAYER_BACK / GAME_OVER
+// events) and closes the channel when it finishes: one queue push per frame,
+// however many people watch. The relay's own Reactor workers (channels spread
+// over them by token) do the fan-out:
+//   - a late joiner gets WELCOME and a keyframe of each board rebuilt from the
+//     relay's copy of the boards, so the room never re-encodes for anyone
+//   - each viewer has its own coalescing FrameWriter; one that misses a delta is
+//     sent a rebuilt keyframe of that board at once, nobody else is affected;
+//     past the hard limit it is dropped
+//   - a spectator may ask for less in its HELLO: "rate=<ms>" gets it each
+//     board's latest keyframe at most that often, "detail=summary" only score,
+//     lines and stack height (snapshot kind 'S'), sent when they change,
+//     "detail=paused" no boards at all. Each level is encoded once per board
+//     state and shared by whoever needs it. "VIEW detail=.. rate=.." changes
+//     the level mid-match and brings the viewer up to date at the new one.
+// Only binary (snap=bin2) spectators are relayed; text ones stay on the room.
+//
+// Relays chain. With an upstream set, a HELLO whose token no channel has
+// opens one that follows upstream: the relay joins there as a spectator itself
+// and republishes what it receives. A relay process near the viewers can so
+// mirror a match from the lobby's game port, or from another relay, with a
+// single connection per match.
+class SpectatorRelay {
+public:
+    // workers == 0 means one per hardware thread
+    explicit SpectatorRelay(size_t workers = 1);
+    ~SpectatorRelay();
+    SpectatorRelay(const SpectatorRelay&) = delete;
+    SpectatorRelay& operator=(const SpectatorRelay&) = delete;
+
+    // Tokens no channel was opened for are followed from host:port (a game
+    // port or another relay) instead of being rejected. Call before start().
+    void set_upstream(const std::string& host, uint16_t port);
+
+    bool start();
+    // Stops the workers and closes every viewer
+    void stop();
+
+    // Room side, from any thread. welcome is the WELCOME line each viewer gets
+    // first; the returned id names the channel in the calls below.
+    uint64_t open(const std::string& token, const std::string& welcome);
+    void publish(uint64_t channel, LpFrame frame);
+    // After the last publish: viewers get what is queued for them (for a short
+    // while), then are closed
+    void close(uint64_t channel);
+
+    // Viewer side: takes a spectator connection whose HELLO is still unread
+    void adopt(int fd, const std::string& token);
+
+    size_t worker_count() const { return workers_.size(); }
+
+private:
+    struct Worker;
+    Worker& worker_for(const std::string& token);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::string upstream_host_;
+    uint16_t upstream_port_ = 0;
+    std::atomic<uint64_t> next_serial_{1};
+    bool started_ = false;
+};
@@ -0,0 +1,343 @@
+// Microbenchmarks for the TetrisGame hot paths, on fixed seeded boards.
+//
+//   tetris_bench [--filter TEXT] [--min-ms N] [--label NAME] [--out FILE]
+//   tetris_bench --compare BEFORE AFTER
+//
+// Every result is one JSON object per line:
+//   {"label":"...","bench":"drop","board":"mid","ns_per_op":41.2,"allocs_per_op":0,"iters":1048576}
+// so runs before and after an engine change can be kept side by side and
+// diffed with --compare. ns_per_op is the median of several timed batches;
+// benches that must restore the board between ops report it with the cost
+// of the restore (a TetrisGame copy-assign, which allocates nothing)
+// already taken off. allocs_per_op counts operator new calls; the send path
+// benches (snapshot_frame, frame_roundtrip) should stay at 0 once warm.
+#include "../core/lp_framing.hpp"
+#include "tetris_bot.hpp"
+#include "tetris_game.hpp"
+#include "tetris_snapshot.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+uint64_t g_allocs = 0; // the benches are single threaded
+}
+
+void* operator new(std::size_t size) {
+    ++g_allocs;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+// GCC pairs these free() calls with the operator new above once they are
+// inlined into library code, and warns that they do not match
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+#pragma GCC diagnostic pop
+
+namespace {
+using Clock = std::chrono::steady_clock;
+constexpr int BATCHES = 7;
+
+template <typename T>
+inline void keep(T const& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Sets a cell in both the bitboard and the color plane, as lock_piece would
+void fill_cell(TetrisGame& g, int r, int c, uint8_t color) {
+    g.rows[r] = static_cast<uint16_t>(g.rows[r] | (1u << (c + BOARD_WALL)));
+    g.colors[r][c] = color;
+}
+
+// The boards every bench runs on. Garbage rows have one or two gaps, placed
+// by a fixed seed, so runs are comparable across builds and machines.
+struct Board {
+    const char* name;
+    TetrisGame game;
+};
+
+std::vector<Board> make_boards() {
+    std::vector<Board> boards;
+    boards.push_back({"empty", TetrisGame(1)});
+
+    auto garbage = [](int seed, int height) {
+        TetrisGame g(seed);
+        std::mt19937 rng(static_cast<unsigned>(seed));
+        for (int r = BOARD_ROWS - height; r < BOARD_ROWS; ++r) {
+            const int gap = static_cast<int>(rng() % BOARD_COLS);
+            const int gap2 = (rng() & 1) ? static_cast<int>(rng() % BOARD_COLS) : gap;
+            for (int c = 0; c < BOARD_COLS; ++c) {
+                if (c != gap && c != gap2) fill_cell(g, r, c, static_cast<uint8_t>(1 + (r + c) % 7));
+            }
+        }
+        g.recompute_col_top();
+        return g;
+    };
+    boards.push_back({"mid", garbage(2, 8)});
+    boards.push_back({"high", garbage(3, 14)});
+
+    // Four full rows right where the spawned piece sits, for clear_lines
+    TetrisGame full(4);
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < BOARD_COLS; ++c) fill_cell(full, BOARD_ROWS - 1 - r, c, 1);
+    }
+    for (int c = 1; c < BOARD_COLS; ++c) fill_cell(full, BOARD_ROWS - 5, c, 2);
+    full.recompute_col_top();
+    boards.push_back({"full4", std::move(full)});
+    return boards;
+}
+
+struct Result {
+    double ns_per_op;
+    double allocs_per_op;
+    uint64_t iters;
+};
+
+// Times body(i) over growing iteration counts until a batch takes min_ns,
+// then reports the median of BATCHES batches of that size
+template <typename Body>
+Result measure(double min_ns, Body&& body) {
+    uint64_t iters = 1;
+    for (;;) {
+        const auto t0 = Clock::now();
+        for (uint64_t i = 0; i < iters; ++i) body(i);
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+        if (ns >= min_ns || iters >= (uint64_t{1} << 30)) break;
+        iters *= 2;
+    }
+    double samples[BATCHES];
+    uint64_t allocs = 0;
+    for (double& s : samples) {
+        const uint64_t a0 = g_allocs;
+        const auto t0 = Clock::now();
+        for (uint64_t i = 0; i < iters; ++i) body(i);
+        s = std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / static_cast<double>(iters);
+        allocs += g_allocs - a0;
+    }
+    std::nth_element(samples, samples + BATCHES / 2, samples + BATCHES);
+    return {samples[BATCHES / 2], static_cast<double>(allocs) / static_cast<double>(iters * BATCHES), iters};
+}
+
+struct Options {
+    std::string filter;
+    std::string label = "run";
+    std::string out;
+    double min_ns = 20e6;
+};
+
+class Runner {
+public:
+    Runner(const Options& opt, std::ostream& out) : opt_(opt), out_(out) {}
+
+    template <typename Body>
+    void run(const char* bench, const Board& board, Body&& body, double overhead_ns = 0) {
+        const std::string id = std::string(bench) + "/" + board.name;
+        if (!opt_.filter.empty() && id.find(opt_.filter) == std::string::npos) return;
+        Result r = measure(opt_.min_ns, body);
+        r.ns_per_op = std::max(0.0, r.ns_per_op - overhead_ns);
+        char line[256];
+        std::snprintf(line, sizeof line,
+                      "{\"label\":\"%s\",\"bench\":\"%s\",\"board\":\"%s\",\"ns_per_op\":%.2f,"
+                      "\"allocs_per_op\":%.3g,\"iters\":%llu}",
+                      opt_.label.c_str(), bench, board.name, r.ns_per_op, r.allocs_per_op,
+                      static_cast<unsigned long long>(r.iters));
+        out_ << line << '\n' << std::flush;
+    }
+
+    // Cost of putting a board back, taken off the benches that need it
+    double restore_ns(const Board& board) {
+        TetrisGame game = board.game;
+        return measure(opt_.min_ns, [&](uint64_t) {
+                   game = board.game;
+                   keep(game.rows);
+               }).ns_per_op;
+    }
+
+private:
+    const Options& opt_;
+    std::ostream& out_;
+};
+
+void run_all(const Options& opt, std::ostream& out) {
+    Runner runner(opt, out);
+    for (const Board& board : make_boards()) {
+        TetrisGame game = board.game;
+        const double restore = runner.restore_ns(board);
+
+        runner.run("check_collision", board, [&](uint64_t i) {
+            // Sweep the columns and the rows above and inside the stack
+            const int x = static_cast<int>(i % (BOARD_COLS + 2)) - 2;
+            const int y = static_cast<int>((i / (BOARD_COLS + 2)) % BOARD_ROWS);
+            bool hit = game.check_collision(x, y);
+            keep(hit);
+        });
+
+        game = board.game;
+        runner.run("rotate_piece", board, [&](uint64_t i) {
+            game.rotate_piece(static_cast<int>(i >> 2) & 1); // four turns each way, then back
+            keep(game.current_piece);
+        });
+
+        runner.run("drop", board, [&](uint64_t) {
+            game = board.game;
+            game.handle_input("DROP");
+            keep(game.rows);
+        }, restore);
+
+        runner.run("clear_lines", board, [&](uint64_t) {
+            game = board.game;
+            game.current_piece.y = BOARD_ROWS - 4; // rows the last lock touched
+            game.clear_lines();
+            keep(game.rows);
+        }, restore);
+
+        runner.run("tick", board, [&](uint64_t i) {
+            // A piece falls about a board's height per lock; restore before the stack grows
+            if (i % 64 == 0) game = board.game;
+            game.tick();
+            keep(game.current_piece);
+        });
+
+        // The bot's scoring of one candidate board, alone and as one lane of a batch
+        const BotBoard bot_board = BotBoard::from_game(board.game);
+        const BotWeights weights;
+        runner.run("bot_evaluate", board, [&](uint64_t i) {
+            float v = evaluate_board(bot_board, static_cast<int>(i & 3), weights);
+            keep(v);
+        });
+        BotBoardBatch batch;
+        while (!batch.full()) batch.add(bot_board);
+        uint8_t lines[BotBoardBatch::kLanes] = {};
+        float values[BotBoardBatch::kLanes];
+        runner.run("bot_evaluate_batch16", board, [&](uint64_t i) {
+            lines[0] = static_cast<uint8_t>(i & 3);
+            evaluate_batch(batch, lines, weights, values);
+            keep(values);
+        });
+
+        game = board.game;
+        runner.run("get_board_snapshot", board, [&](uint64_t) {
+            std::string snap = game.get_board_snapshot();
+            keep(snap.data());
+        });
+
+        // One tick of a room's send path: encode the board into a pooled frame
+        SnapshotEncoder encoder;
+        const std::string name = "bench";
+        runner.run("snapshot_frame", board, [&](uint64_t i) {
+            if (i % 64 == 0) game = board.game;
+            game.tick();
+            LpFrame frame = lp_build_frame([&](std::string& out) { encoder.encode_into(out, game, 0, name, 0); });
+            keep(frame->data());
+        });
+
+        // ...and on through a FrameWriter and a socket into a FrameReader
+        int sv[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0) {
+            FrameWriter writer;
+            FrameReader reader;
+            std::vector<std::string> frames;
+            runner.run("frame_roundtrip", board, [&](uint64_t i) {
+                if (i % 64 == 0) game = board.game;
+                game.tick();
+                writer.enqueue(lp_build_frame([&](std::string& out) { encoder.encode_into(out, game, 0, name, 0); }));
+                writer.flush(sv[0]);
+                size_t count = 0;
+                reader.read_from(sv[1], frames, count);
+                keep(count);
+            });
+            ::close(sv[0]);
+            ::close(sv[1]);
+        }
+    }
+}
+
+// --compare: one line per bench present in both files
+int compare(const char* before_path, const char* after_path) {
+    auto load = [](const char* path, std::map<std::string, double>& ns, std::map<std::string, double>& allocs) {
+        std::ifstream in(path);
+        if (!in) return false;
+        std::string line;
+        auto field = [&](const std::string& key) {
+            const std::string tag = "\"" + key + "\":";
+            const size_t at = line.find(tag);
+            if (at == std::string::npos) return std::string();
+            size_t start = at + tag.size();
+            if (line[start] == '"') return line.substr(start + 1, line.find('"', start + 1) - start - 1);
+            return line.substr(start, line.find_first_of(",}", start) - start);
+        };
+        while (std::getline(in, line)) {
+            const std::string id = field("bench") + "/" + field("board");
+            if (id == "/") continue;
+            ns[id] = std::atof(field("ns_per_op").c_str());
+            allocs[id] = std::atof(field("allocs_per_op").c_str());
+        }
+        return true;
+    };
+    std::map<std::string, double> ns_a, ns_b, al_a, al_b;
+    if (!load(before_path, ns_a, al_a) || !load(after_path, ns_b, al_b)) {
+        std::cerr << "cannot read " << before_path << " or " << after_path << "\n";
+        return 1;
+    }
+    std::printf("%-30s %12s %12s %8s %14s\n", "bench", "before ns", "after ns", "speedup", "allocs b->a");
+    for (const auto& [id, before] : ns_a) {
+        auto it = ns_b.find(id);
+        if (it == ns_b.end()) continue;
+        const double after = it->second;
+        std::printf("%-30s %12.2f %12.2f %7.2fx %6.3g -> %-6.3g\n", id.c_str(), before, after,
+                    after > 0 ? before / after : 0.0, al_a[id], al_b[id]);
+    }
+    return 0;
+}
+
+void usage() {
+    std::cerr << "usage: tetris_bench [--filter TEXT] [--min-ms N] [--label NAME] [--out FILE]\n"
+              << "       tetris_bench --compare BEFORE AFTER\n";
+}
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (a == "--compare" && i + 2 < argc) return compare(argv[i + 1], argv[i + 2]);
+        if (a == "--filter" && has_value) opt.filter = argv[++i];
+        else if (a == "--min-ms" && has_value) opt.min_ns = std::atof(argv[++i]) * 1e6;
+        else if (a == "--label" && has_value) opt.label = argv[++i];
+        else if (a == "--out" && has_value) opt.out = argv[++i];
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (opt.out.empty()) {
+        run_all(opt, std::cout);
+        return 0;
+    }
+    std::ofstream out(opt.out, std::ios::app);
+    if (!out) {
+        std::cerr << "cannot open " << opt.out << "\n";
+        return 1;
+    }
+    run_all(opt, out);
+    return 0;
+}
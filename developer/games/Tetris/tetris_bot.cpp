@@ -0,0 +1,513 @@
+#include "tetris_bot.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+constexpr uint16_t FIELD_BITS = static_cast<uint16_t>(~ROW_EMPTY);
+// Bit c of a row is set with bit c + 1 in here when both columns are on the board
+constexpr uint16_t PAIR_BITS = static_cast<uint16_t>(FIELD_BITS & (FIELD_BITS >> 1));
+constexpr int SPAWN_X = BOARD_COLS / 2 - 2;
+// Turns tried before sliding: none, one and two clockwise, one counter-clockwise
+constexpr int8_t ROTATION_INPUTS[4] = {0, 1, 2, -1};
+
+// The cells a resting piece fills, for spotting placements that only differ by
+// rotation state (I, S and Z have two states per footprint, O four)
+struct Footprint {
+    int8_t top;
+    uint64_t cells;
+    bool operator==(const Footprint&) const = default;
+};
+
+Footprint footprint(const Piece& p) {
+    const PieceMask& mask = PIECE_MASKS.masks[p.shape_id][p.rotation];
+    uint64_t cells = 0;
+    for (int r = mask.min_row; r <= mask.max_row; ++r) {
+        cells |= static_cast<uint64_t>(static_cast<uint16_t>(mask.rows[r] << (p.x + BOARD_WALL))) << (16 * (r - mask.min_row));
+    }
+    return {static_cast<int8_t>(p.y + mask.min_row), cells};
+}
+}
+
+BotBoard BotBoard::empty() {
+    BotBoard b;
+    std::fill(std::begin(b.rows), std::end(b.rows), ROW_EMPTY);
+    return b;
+}
+
+BotBoard BotBoard::from_game(const TetrisGame& game) {
+    BotBoard b;
+    std::memcpy(b.rows, game.rows, sizeof(b.rows));
+    return b;
+}
+
+BotBoard BotBoard::from_colors(const uint8_t (&colors)[BOARD_ROWS][BOARD_COLS]) {
+    BotBoard b = empty();
+    for (int r = 0; r < BOARD_ROWS; ++r) {
+        for (int c = 0; c < BOARD_COLS; ++c) {
+            if (colors[r][c]) b.rows[r] = static_cast<uint16_t>(b.rows[r] | (1u << (c + BOARD_WALL)));
+        }
+    }
+    return b;
+}
+
+int BotBoard::lock(const Piece& piece) {
+    const PieceMask& mask = PIECE_MASKS.masks[piece.shape_id][piece.rotation];
+    int full = 0;
+    for (int r = mask.min_row; r <= mask.max_row; ++r) {
+        uint16_t& row = rows[piece.y + r];
+        row = static_cast<uint16_t>(row | (mask.rows[r] << (piece.x + BOARD_WALL)));
+        full += row == ROW_FULL;
+    }
+    if (!full) return 0;
+    // Same bottom-up sweep as TetrisGame::clear_lines, without the color plane
+    int dst = BOARD_ROWS - 1;
+    for (int src = BOARD_ROWS - 1; src >= 0; --src) {
+        if (rows[src] != ROW_FULL) rows[dst--] = rows[src];
+    }
+    for (; dst >= 0; --dst) rows[dst] = ROW_EMPTY;
+    return full;
+}
+
+bool BotBoard::topped_out(int shape_id) const {
+    return collides(PIECE_MASKS.masks[shape_id][0], SPAWN_X, 0);
+}
+
+int enumerate_placements(const BotBoard& board, int shape_id, std::array<BotPlacement, BOT_MAX_PLACEMENTS>& out) {
+    Piece spawn;
+    spawn.shape_id = static_cast<int8_t>(shape_id);
+    spawn.x = SPAWN_X;
+    return enumerate_placements(board, spawn, out);
+}
+
+int enumerate_placements(const BotBoard& board, const Piece& from, std::array<BotPlacement, BOT_MAX_PLACEMENTS>& out) {
+    const int shape_id = from.shape_id;
+    if (board.collides(PIECE_MASKS.masks[shape_id][from.rotation], from.x, from.y)) return 0;
+
+    std::array<Footprint, BOT_MAX_PLACEMENTS> seen;
+    int count = 0;
+    const int turns = shape_id == SHAPE_ID_O ? 1 : 4;
+    for (int t = 0; t < turns; ++t) {
+        const int8_t rotations = ROTATION_INPUTS[t];
+        Piece p = from;
+        bool turned = true;
+        for (int i = 0; i < std::abs(rotations) && turned; ++i) turned = rotate_with_kicks(board.rows, p, rotations < 0);
+        if (!turned) continue; // the inputs would leave it in a state already covered
+        const PieceMask& mask = PIECE_MASKS.masks[shape_id][p.rotation];
+
+        // Slide left from where the turn left it, then right, dropping at every stop
+        for (int dir = -1; dir <= 1; dir += 2) {
+            for (int shift = dir < 0 ? 0 : 1;; ++shift) {
+                const int x = p.x + dir * shift;
+                if (board.collides(mask, x, p.y)) break;
+                int y = p.y;
+                while (!board.collides(mask, x, y + 1)) ++y;
+                Piece rest = p;
+                rest.x = static_cast<int8_t>(x);
+                rest.y = static_cast<int8_t>(y);
+                const Footprint f = footprint(rest);
+                if (std::find(seen.begin(), seen.begin() + count, f) != seen.begin() + count) continue;
+                seen[count] = f;
+                out[count] = {rest, rotations, static_cast<int8_t>(dir * shift), false};
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
+void placement_actions(const BotPlacement& p, std::vector<const char*>& out) {
+    if (p.hold) out.push_back("HOLD");
+    for (int i = 0; i < std::abs(p.rotations); ++i) out.push_back(p.rotations < 0 ? "ROTATE_CCW" : "ROTATE");
+    for (int i = 0; i < std::abs(p.shift); ++i) out.push_back(p.shift < 0 ? "LEFT" : "RIGHT");
+    out.push_back("DROP");
+}
+
+BoardFeatures board_features(const BotBoard& board) {
+    BoardFeatures f;
+    int height[BOARD_COLS] = {};
+    uint16_t seen = 0; // columns with a filled cell at or above the current row
+    for (int r = 0; r < BOARD_ROWS; ++r) {
+        const uint16_t filled = static_cast<uint16_t>(board.rows[r] & FIELD_BITS);
+        f.holes += std::popcount(static_cast<uint16_t>(seen & ~filled));
+        for (uint16_t fresh = static_cast<uint16_t>(filled & ~seen); fresh; fresh &= static_cast<uint16_t>(fresh - 1)) {
+            height[std::countr_zero(fresh) - BOARD_WALL] = BOARD_ROWS - r;
+        }
+        seen |= filled;
+    }
+    for (int c = 0; c < BOARD_COLS; ++c) {
+        f.height += height[c];
+        f.max_height = std::max(f.max_height, height[c]);
+        if (c > 0) f.bumpiness += std::abs(height[c] - height[c - 1]);
+    }
+    return f;
+}
+
+namespace {
+float weigh(const BoardFeatures& f, int lines, const BotWeights& w) {
+    return w.height * static_cast<float>(f.height) + w.lines * static_cast<float>(lines) +
+           w.holes * static_cast<float>(f.holes) + w.bumpiness * static_cast<float>(f.bumpiness);
+}
+
+// With seen the filled columns at or above row r, walking down the board:
+//   sum of heights   = sum over rows of popcount(seen)
+//   holes            = sum over rows of popcount(seen & ~row)
+//   bumpiness        = sum over rows of popcount((seen ^ seen >> 1) & PAIR_BITS)
+// (two neighbouring columns' seen bits differ on exactly the rows between their
+// tops), and the max height is the rows where seen is not empty. No step
+// depends on the column, so a vector of lanes runs them all together.
+void features_out(const uint16_t* height, const uint16_t* holes, const uint16_t* bump, const uint16_t* empty_rows,
+                  BoardFeatures* out) {
+    for (int i = 0; i < BotBoardBatch::kLanes; ++i) {
+        out[i] = {height[i], holes[i], bump[i], BOARD_ROWS - empty_rows[i]};
+    }
+}
+
+#if !defined(__AVX2__) && !defined(__ARM_NEON)
+// Without a popcount instruction to count on; plain 16-bit arithmetic, which
+// the compiler vectorizes over the lanes of the loops below
+inline uint16_t popcount16(uint16_t x) {
+    x = static_cast<uint16_t>(x - ((x >> 1) & 0x5555));
+    x = static_cast<uint16_t>((x & 0x3333) + ((x >> 2) & 0x3333));
+    x = static_cast<uint16_t>((x + (x >> 4)) & 0x0F0F);
+    return static_cast<uint16_t>((x + (x >> 8)) & 0x1F);
+}
+#endif
+
+#if defined(__AVX2__)
+// Bits set in each byte, by nibble lookup
+__m256i popcount_bytes(__m256i v) {
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+                           _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+}
+
+// Byte counts (at most 8 a row, so 160 over a board: no overflow) into 16-bit lanes
+__m256i widen_counts(__m256i bytes) {
+    return _mm256_add_epi16(_mm256_and_si256(bytes, _mm256_set1_epi16(0x00FF)), _mm256_srli_epi16(bytes, 8));
+}
+#endif
+}
+
+float evaluate_board(const BotBoard& board, int lines, const BotWeights& w) {
+    return weigh(board_features(board), lines, w);
+}
+
+void board_features(const BotBoardBatch& batch, BoardFeatures* out) {
+    static_assert(BotBoardBatch::kLanes == 16, "the vector paths take 16 lanes of 16 bits");
+#if defined(__AVX2__)
+    const __m256i field = _mm256_set1_epi16(static_cast<short>(FIELD_BITS));
+    const __m256i pairs = _mm256_set1_epi16(static_cast<short>(PAIR_BITS));
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i seen = zero, height = zero, holes = zero, bump = zero, empty_rows = zero;
+    for (int r = 0; r < BOARD_ROWS; ++r) {
+        const __m256i row =
+            _mm256_and_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(batch.rows[r])), field);
+        seen = _mm256_or_si256(seen, row);
+        height = _mm256_add_epi8(height, popcount_bytes(seen));
+        holes = _mm256_add_epi8(holes, popcount_bytes(_mm256_andnot_si256(row, seen)));
+        const __m256i steps = _mm256_and_si256(_mm256_xor_si256(seen, _mm256_srli_epi16(seen, 1)), pairs);
+        bump = _mm256_add_epi8(bump, popcount_bytes(steps));
+        empty_rows = _mm256_sub_epi16(empty_rows, _mm256_cmpeq_epi16(seen, zero)); // all ones is -1
+    }
+    alignas(32) uint16_t h[16], o[16], b[16], e[16];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(h), widen_counts(height));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(o), widen_counts(holes));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(b), widen_counts(bump));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(e), empty_rows);
+    features_out(h, o, b, e, out);
+#elif defined(__ARM_NEON)
+    const uint16x8_t field = vdupq_n_u16(FIELD_BITS);
+    const uint16x8_t pairs = vdupq_n_u16(PAIR_BITS);
+    const uint16x8_t zero = vdupq_n_u16(0);
+    uint16_t h[16], o[16], b[16], e[16];
+    for (int half = 0; half < 2; ++half) {
+        uint16x8_t seen = zero, empty_rows = zero;
+        uint8x16_t height = vdupq_n_u8(0), holes = height, bump = height;
+        for (int r = 0; r < BOARD_ROWS; ++r) {
+            const uint16x8_t row = vandq_u16(vld1q_u16(batch.rows[r] + 8 * half), field);
+            seen = vorrq_u16(seen, row);
+            height = vaddq_u8(height, vcntq_u8(vreinterpretq_u8_u16(seen)));
+            holes = vaddq_u8(holes, vcntq_u8(vreinterpretq_u8_u16(vbicq_u16(seen, row))));
+            const uint16x8_t steps = vandq_u16(veorq_u16(seen, vshrq_n_u16(seen, 1)), pairs);
+            bump = vaddq_u8(bump, vcntq_u8(vreinterpretq_u8_u16(steps)));
+            empty_rows = vsubq_u16(empty_rows, vceqq_u16(seen, zero));
+        }
+        // Byte pairs summed into their 16-bit lane
+        vst1q_u16(h + 8 * half, vpaddlq_u8(height));
+        vst1q_u16(o + 8 * half, vpaddlq_u8(holes));
+        vst1q_u16(b + 8 * half, vpaddlq_u8(bump));
+        vst1q_u16(e + 8 * half, empty_rows);
+    }
+    features_out(h, o, b, e, out);
+#else
+    constexpr int kLanes = BotBoardBatch::kLanes;
+    uint16_t seen[kLanes] = {}, h[kLanes] = {}, o[kLanes] = {}, b[kLanes] = {}, e[kLanes] = {};
+    for (int r = 0; r < BOARD_ROWS; ++r) {
+        for (int i = 0; i < kLanes; ++i) {
+            const uint16_t row = static_cast<uint16_t>(batch.rows[r][i] & FIELD_BITS);
+            seen[i] = static_cast<uint16_t>(seen[i] | row);
+            h[i] = static_cast<uint16_t>(h[i] + popcount16(seen[i]));
+            o[i] = static_cast<uint16_t>(o[i] + popcount16(static_cast<uint16_t>(seen[i] & ~row)));
+            b[i] = static_cast<uint16_t>(b[i] + popcount16(static_cast<uint16_t>((seen[i] ^ (seen[i] >> 1)) & PAIR_BITS)));
+            e[i] = static_cast<uint16_t>(e[i] + (seen[i] == 0));
+        }
+    }
+    features_out(h, o, b, e, out);
+#endif
+}
+
+void evaluate_batch(const BotBoardBatch& batch, const uint8_t* lines, const BotWeights& w, float* values) {
+    BoardFeatures f[BotBoardBatch::kLanes];
+    board_features(batch, f);
+    for (int i = 0; i < batch.count; ++i) values[i] = weigh(f[i], lines[i], w);
+}
+
+BotPieces BotPieces::from_game(const TetrisGame& game, int preview) {
+    BotPieces pieces;
+    pieces.current = game.current_piece.shape_id;
+    pieces.pose = game.current_piece;
+    pieces.hold = game.hold_shape_id;
+    pieces.hold_used = game.hold_used;
+    const int known = std::min(preview, static_cast<int>(pieces.next.size()));
+    for (int i = 0; i < known; ++i) pieces.next[i] = static_cast<int8_t>(game.preview(i));
+    pieces.next_count = known;
+    return pieces;
+}
+
+void BotThreadPool::start(size_t threads) {
+    stop();
+    stopping_ = false;
+    for (size_t i = 0; i < threads; ++i) threads_.emplace_back([this] { work(); });
+}
+
+void BotThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : threads_) t.join();
+    threads_.clear();
+}
+
+void BotThreadPool::run_raw(size_t n, Job job, void* ctx) {
+    if (threads_.empty() || n <= 1) {
+        for (size_t i = 0; i < n; ++i) job(ctx, i);
+        return;
+    }
+    std::lock_guard<std::mutex> serial(run_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = job;
+        ctx_ = ctx;
+        job_size_ = n;
+        next_.store(0, std::memory_order_relaxed);
+        busy_ = threads_.size();
+        ++generation_;
+    }
+    wake_.notify_all();
+    drain(job, ctx, n);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&] { return busy_ == 0; });
+}
+
+void BotThreadPool::work() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+        if (stopping_) return;
+        seen = generation_;
+        Job job = job_;
+        void* ctx = ctx_;
+        size_t n = job_size_;
+        lock.unlock();
+        drain(job, ctx, n);
+        lock.lock();
+        if (--busy_ == 0) done_.notify_one();
+    }
+}
+
+void BotThreadPool::drain(Job job, void* ctx, size_t n) {
+    for (size_t i; (i = next_.fetch_add(1, std::memory_order_relaxed)) < n;) job(ctx, i);
+}
+
+TetrisBot::TetrisBot(BotConfig cfg, BotThreadPool* pool) : cfg_(cfg), pool_(pool) {}
+
+int TetrisBot::expand(const Node& node, const BotPieces& pieces, bool root, std::vector<Node>& out) const {
+    out.clear();
+    std::array<BotPlacement, BOT_MAX_PLACEMENTS> spots;
+    int evaluated = 0;
+    auto preview = [&](int i) { return i < pieces.next_count ? pieces.next[i] : int8_t{-1}; };
+
+    // Option 0 plays the current piece, option 1 holds it and plays what hold gives back
+    for (int option = 0; option < 2; ++option) {
+        int8_t play, hold = node.hold, current;
+        uint8_t used = node.used;
+        if (option == 0) {
+            play = node.current;
+            current = preview(used++);
+        } else {
+            if (root && pieces.hold_used) break;
+            hold = node.current;
+            if (node.hold >= 0) {
+                if (node.hold == node.current) break; // same piece, same children
+                play = node.hold;
+            } else {
+                play = preview(used++);
+                if (play < 0) break;
+            }
+            current = preview(used++);
+        }
+
+        // Only the falling piece can have moved; anything coming out of hold or
+        // the preview starts at the spawn pose
+        Piece from = pieces.pose;
+        from.shape_id = play;
+        const int n = root && option == 0 ? enumerate_placements(node.board, from, spots)
+                                          : enumerate_placements(node.board, play, spots);
+        for (int i = 0; i < n; ++i) {
+            Node child;
+            child.board = node.board;
+            child.lines = static_cast<uint8_t>(node.lines + child.board.lock(spots[i].rest));
+            ++evaluated;
+            if (current >= 0 && child.board.topped_out(current)) continue;
+            child.current = current;
+            child.hold = hold;
+            child.used = used;
+            if (root) {
+                child.first = spots[i];
+                child.first.hold = option == 1;
+            } else {
+                child.first = node.first;
+            }
+            out.push_back(child);
+        }
+    }
+
+    BotBoardBatch batch;
+    uint8_t lines[BotBoardBatch::kLanes];
+    float values[BotBoardBatch::kLanes];
+    for (size_t from = 0; from < out.size(); from += BotBoardBatch::kLanes) {
+        const size_t n = std::min(out.size() - from, static_cast<size_t>(BotBoardBatch::kLanes));
+        batch.clear();
+        for (size_t i = 0; i < n; ++i) {
+            batch.add(out[from + i].board);
+            lines[i] = out[from + i].lines;
+        }
+        evaluate_batch(batch, lines, cfg_.weights, values);
+        for (size_t i = 0; i < n; ++i) out[from + i].value = values[i];
+    }
+    return evaluated;
+}
+
+BotDecision TetrisBot::choose(const BotBoard& board, const BotPieces& pieces) {
+    using Clock = std::chrono::steady_clock;
+    const auto deadline = Clock::now() + cfg_.budget;
+    BotDecision decision;
+    const size_t width = static_cast<size_t>(std::max(1, cfg_.beam_width));
+
+    beam_.clear();
+    beam_.push_back(Node{board, static_cast<int8_t>(pieces.current), static_cast<int8_t>(pieces.hold), 0, 0, 0.0f, {}});
+    std::atomic<bool> late{false};
+
+    for (int depth = 0; depth < cfg_.max_depth; ++depth) {
+        const bool root = depth == 0;
+        size_t open = 0;
+        while (open < beam_.size() && beam_[open].current >= 0) ++open;
+        if (open == 0) break;
+        if (children_.size() < open) children_.resize(open);
+        evaluated_.assign(open, 0);
+
+        auto job = [&](size_t i) {
+            // Past the first ply a late search stops where it is; that ply is thrown away
+            if (!root && late.load(std::memory_order_relaxed)) {
+                children_[i].clear();
+                return;
+            }
+            evaluated_[i] = expand(beam_[i], pieces, root, children_[i]);
+            if (Clock::now() > deadline) late.store(true, std::memory_order_relaxed);
+        };
+        if (pool_) pool_->run(open, job);
+        else for (size_t i = 0; i < open; ++i) job(i);
+        if (!root && late.load(std::memory_order_relaxed)) break;
+
+        for (size_t i = 0; i < open; ++i) decision.nodes += evaluated_[i];
+        size_t total = 0;
+        for (size_t i = 0; i < open; ++i) total += children_[i].size();
+        if (total == 0) break;
+
+        // Lines that ran out of known pieces end here: their values cover fewer
+        // pieces, so they only compete within their own ply
+        beam_.clear();
+        for (size_t i = 0; i < open; ++i) beam_.insert(beam_.end(), children_[i].begin(), children_[i].end());
+        auto better = [](const Node& a, const Node& b) { return a.value > b.value; };
+        if (beam_.size() > width) {
+            std::nth_element(beam_.begin(), beam_.begin() + static_cast<long>(width) - 1, beam_.end(), better);
+            beam_.resize(width);
+        }
+        // Expandable nodes first, best first within each group
+        std::sort(beam_.begin(), beam_.end(), [&](const Node& a, const Node& b) {
+            if ((a.current >= 0) != (b.current >= 0)) return a.current >= 0;
+            return better(a, b);
+        });
+        const Node& best = *std::min_element(beam_.begin(), beam_.end(), better);
+        decision.ok = true;
+        decision.placement = best.first;
+        decision.value = best.value;
+        decision.depth = depth + 1;
+        if (Clock::now() > deadline) break;
+    }
+    return decision;
+}
+
+int TetrisBot::play(TetrisGame& game, int pieces, int preview) {
+    std::vector<const char*> actions;
+    const uint32_t start = game.pieces_locked;
+    while (!game.game_over && static_cast<int>(game.pieces_locked - start) < pieces) {
+        const BotDecision d = choose(BotBoard::from_game(game), BotPieces::from_game(game, preview));
+        if (!d.ok) break;
+        actions.clear();
+        placement_actions(d.placement, actions);
+        for (const char* a : actions) game.handle_input(a);
+    }
+    return static_cast<int>(game.pieces_locked - start);
+}
+
+void BotSeat::start(int seed) {
+    order_ = std::make_unique<PieceSequence>(seed);
+    current_ = 0;
+    hold_ = -1;
+}
+
+bool BotSeat::next_move(const SnapshotView& view, std::vector<const char*>& actions) {
+    BotPieces pieces;
+    pieces.current = view.piece.shape_id;
+    pieces.pose = view.piece;
+    pieces.hold = hold_;
+    if (order_ && order_->at(current_) == view.piece.shape_id) {
+        pieces.next[0] = static_cast<int8_t>(order_->at(current_ + 1));
+        pieces.next_count = 1;
+    }
+    const BotDecision d = bot_.choose(BotBoard::from_colors(view.colors), pieces);
+    if (!d.ok) return false;
+
+    placement_actions(d.placement, actions);
+    if (d.placement.hold) {
+        if (hold_ < 0) ++current_; // holding into an empty slot takes the next piece
+        hold_ = pieces.current;
+    }
+    ++current_;
+    return true;
+}
@@ -0,0 +1,228 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "tetris_game.hpp"
+#include "tetris_snapshot.hpp"
+
+// Placement-search bot. The search never touches a TetrisGame (which carries a
+// color plane and a shared piece sequence): it works on BotBoard, the bare 40-byte occupancy
+// bitboard, so a candidate board is a plain struct copy and a whole search runs
+// without a heap allocation once the beam buffers have grown.
+
+struct BotBoard {
+    uint16_t rows[BOARD_ROWS];
+
+    static BotBoard empty();
+    static BotBoard from_game(const TetrisGame& game);
+    // From a color plane without the falling piece, e.g. a decoded binary snapshot
+    static BotBoard from_colors(const uint8_t (&colors)[BOARD_ROWS][BOARD_COLS]);
+
+    bool collides(const PieceMask& mask, int px, int py) const { return piece_collides(rows, mask, px, py); }
+    // Locks the piece in and clears full rows; returns the rows cleared
+    int lock(const Piece& piece);
+    // A fresh piece of this shape would not fit at the spawn pose
+    bool topped_out(int shape_id) const;
+};
+static_assert(sizeof(BotBoard) == BOARD_ROWS * sizeof(uint16_t), "BotBoard must stay a bare bitboard");
+
+// One landing spot and the inputs that get there from the piece's pose: HOLD if
+// hold, `rotations` turns (negative = counter-clockwise), |shift| LEFT or RIGHT
+// steps, then DROP. rest is where it lands, for checking the server agreed.
+struct BotPlacement {
+    Piece rest;
+    int8_t rotations = 0;
+    int8_t shift = 0;
+    bool hold = false;
+};
+
+// Every distinct landing spot that the inputs above reach from `from`, rotating
+// in place (with SRS kicks) and then sliding; spots that fill the same cells
+// are listed once. Returns how many were written to out, 0 if from collides.
+constexpr int BOT_MAX_PLACEMENTS = 4 * BOARD_COLS;
+int enumerate_placements(const BotBoard& board, const Piece& from, std::array<BotPlacement, BOT_MAX_PLACEMENTS>& out);
+// The same from the spawn pose of shape_id
+int enumerate_placements(const BotBoard& board, int shape_id, std::array<BotPlacement, BOT_MAX_PLACEMENTS>& out);
+
+// Appends the input actions for p, as handle_input spells them
+void placement_actions(const BotPlacement& p, std::vector<const char*>& out);
+
+// Linear board heuristic, higher is better. The defaults are the usual
+// hand-tuned weights for height / lines / holes / bumpiness.
+struct BotWeights {
+    float height = -0.510066f;    // sum of column heights
+    float lines = 0.760666f;      // rows cleared along the way
+    float holes = -0.35663f;      // empty cells with a filled cell above
+    float bumpiness = -0.184483f; // sum of height steps between neighbouring columns
+};
+
+struct BoardFeatures {
+    int height = 0;
+    int holes = 0;
+    int bumpiness = 0;
+    int max_height = 0;
+};
+BoardFeatures board_features(const BotBoard& board);
+float evaluate_board(const BotBoard& board, int lines, const BotWeights& w);
+
+// Candidate boards in structure-of-arrays form, row r of the i-th at
+// rows[r][i], so one vector load takes the same row of every board. Lanes past
+// count keep whatever was there (empty boards at first): they are scored along
+// with the rest and ignored.
+struct BotBoardBatch {
+    static constexpr int kLanes = 16;
+    alignas(32) uint16_t rows[BOARD_ROWS][kLanes] = {};
+    int count = 0;
+
+    void clear() { count = 0; }
+    void add(const BotBoard& board) {
+        for (int r = 0; r < BOARD_ROWS; ++r) rows[r][count] = board.rows[r];
+        ++count;
+    }
+    bool full() const { return count == kLanes; }
+};
+
+// board_features of every lane at once, each feature a popcount per row over
+// all lanes: AVX2 or NEON when the build targets them (-mavx2, -march=native),
+// otherwise 16-bit arithmetic the compiler vectorizes. Fills out[0..kLanes).
+void board_features(const BotBoardBatch& batch, BoardFeatures* out);
+// evaluate_board of the first count lanes, lines[i] cleared on the way to the
+// i-th, into values[i]
+void evaluate_batch(const BotBoardBatch& batch, const uint8_t* lines, const BotWeights& w, float* values);
+
+// Pieces the bot knows about: the falling one (and where it is now, which
+// gravity may have moved from the spawn pose), the held one (-1 for none) and
+// the preview, soonest first. Clients see one preview piece; more only lengthen
+// the search.
+struct BotPieces {
+    int current = 0;
+    Piece pose; // shape_id is taken from current
+    int hold = -1;
+    bool hold_used = false;
+    std::array<int8_t, 8> next{};
+    int next_count = 0;
+
+    // current, hold and the next `preview` shapes (at most next.size()) of game
+    static BotPieces from_game(const TetrisGame& game, int preview = 1);
+};
+
+// Fork-join helper for the search: run(n, fn) calls fn(i) for every i < n on
+// the pool's threads and the caller's, returning once all are done. With no
+// threads started it is a plain loop. fn is called through a pointer, so a
+// capturing lambda costs no allocation.
+class BotThreadPool {
+public:
+    BotThreadPool() = default;
+    BotThreadPool(const BotThreadPool&) = delete;
+    BotThreadPool& operator=(const BotThreadPool&) = delete;
+    ~BotThreadPool() { stop(); }
+
+    void start(size_t threads);
+    void stop();
+    size_t threads() const { return threads_.size(); }
+    template <typename Fn>
+    void run(size_t n, Fn& fn) {
+        run_raw(n, [](void* ctx, size_t i) { (*static_cast<Fn*>(ctx))(i); }, &fn);
+    }
+
+private:
+    using Job = void (*)(void*, size_t);
+    void run_raw(size_t n, Job job, void* ctx);
+    void work();
+    void drain(Job job, void* ctx, size_t n);
+
+    std::vector<std::thread> threads_;
+    std::mutex run_mutex_; // one job at a time
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    Job job_ = nullptr;
+    void* ctx_ = nullptr;
+    size_t job_size_ = 0;
+    uint64_t generation_ = 0;
+    size_t busy_ = 0;
+    std::atomic<size_t> next_{0};
+    bool stopping_ = false;
+};
+
+struct BotConfig {
+    BotWeights weights;
+    int beam_width = 32;
+    int max_depth = 3;                          // pieces placed along one line of play
+    std::chrono::microseconds budget{5000};     // per move; the first ply always completes
+};
+
+struct BotDecision {
+    bool ok = false; // false: nothing fits, the bot has lost
+    BotPlacement placement;
+    float value = 0;
+    int depth = 0;   // plies fully searched
+    int nodes = 0;   // boards evaluated
+};
+
+// Beam search over current/hold/preview. Each ply expands every beam node by
+// every placement of the piece it would play next and of the one hold would
+// give it, scores the children (a BotBoardBatch at a time) and keeps the best
+// beam_width. Expansion is
+// split across the pool; plies stop early when the budget runs out. One
+// TetrisBot per game, which may share a pool with others (calls to one pool
+// are serialized).
+class TetrisBot {
+public:
+    explicit TetrisBot(BotConfig cfg = {}, BotThreadPool* pool = nullptr);
+
+    BotDecision choose(const BotBoard& board, const BotPieces& pieces);
+    // Plays game until it tops out or `pieces` pieces are locked, seeing
+    // `preview` pieces ahead; returns the pieces locked
+    int play(TetrisGame& game, int pieces, int preview = 1);
+
+    const BotConfig& config() const { return cfg_; }
+
+private:
+    struct Node {
+        BotBoard board;
+        int8_t current;   // piece to play at this node
+        int8_t hold;
+        uint8_t used;     // preview pieces consumed
+        uint8_t lines;
+        float value;
+        BotPlacement first; // the root move this line started with
+    };
+
+    // Children of node into out; returns the boards evaluated
+    int expand(const Node& node, const BotPieces& pieces, bool root, std::vector<Node>& out) const;
+
+    BotConfig cfg_;
+    BotThreadPool* pool_;
+    std::vector<Node> beam_;
+    std::vector<std::vector<Node>> children_; // one per expanded beam node, reused
+    std::vector<int> evaluated_;
+};
+
+// Plays one seat of a networked match from its binary snapshots (which never
+// include the falling piece). The preview comes from a private PieceSequence(seed):
+// both boards of a match draw that order, so counting spawns says what comes
+// next for as long as it agrees with the server.
+class BotSeat {
+public:
+    explicit BotSeat(const BotConfig& cfg = {}, BotThreadPool* pool = nullptr) : bot_(cfg, pool) {}
+
+    // From the seed= in WELCOME
+    void start(int seed);
+    // Inputs for the next placement from view, the seat's board with every
+    // input sent so far applied; false when nothing fits
+    bool next_move(const SnapshotView& view, std::vector<const char*>& actions);
+
+private:
+    TetrisBot bot_;
+    std::unique_ptr<PieceSequence> order_;
+    uint64_t current_ = 0; // index in order_ of the falling piece
+    int hold_ = -1;
+};
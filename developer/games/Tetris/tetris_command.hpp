@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "tetris_game.hpp"
+
+// Compact binary INPUT, the message clients send most. A room that reads it
+// says "cmd=bin1" in WELCOME; the client may then send, instead of the text
+// "INPUT <action> seq=<n> t=<ms>", a frame of (integers in network byte order)
+//   u8 opcode | u32 seq if CMD_HAS_SEQ | u32 t if CMD_HAS_T
+// where opcode = CMD_INPUT | flags | action code (INPUT_ACTIONS): 1 to 9 bytes
+// where the text took 30 or so. Text frames start with an ASCII letter, so the
+// top bit tells the two apart and the text form keeps working for debugging.
+constexpr const char* CMD_BIN_TAG = "bin1";
+constexpr uint8_t CMD_INPUT = 0x80;
+constexpr uint8_t CMD_HAS_SEQ = 0x40;
+constexpr uint8_t CMD_HAS_T = 0x20;
+constexpr uint8_t CMD_ACTION_MASK = 0x0F; // 0x10 is reserved for other commands
+
+// seq 0: not sequenced (numbering starts at 1); t 0: no client timestamp
+struct InputCommand {
+    InputAction action = INPUT_LEFT;
+    uint32_t seq = 0;
+    uint32_t t = 0;
+};
+
+inline bool is_binary_command(std::string_view frame) {
+    return !frame.empty() && (static_cast<uint8_t>(frame[0]) & CMD_INPUT) != 0;
+}
+
+inline std::string encode_input_command(InputAction action, uint32_t seq, uint32_t t = 0) {
+    char buf[9];
+    size_t n = 1;
+    uint8_t op = CMD_INPUT | action;
+    for (uint32_t v : {seq, t}) {
+        if (v == 0) continue;
+        buf[n++] = static_cast<char>(v >> 24);
+        buf[n++] = static_cast<char>(v >> 16);
+        buf[n++] = static_cast<char>(v >> 8);
+        buf[n++] = static_cast<char>(v);
+    }
+    if (seq) op |= CMD_HAS_SEQ;
+    if (t) op |= CMD_HAS_T;
+    buf[0] = static_cast<char>(op);
+    return std::string(buf, n);
+}
+
+inline bool decode_input_command(std::string_view frame, InputCommand& out) {
+    if (frame.empty()) return false;
+    const uint8_t op = static_cast<uint8_t>(frame[0]);
+    const size_t want = 1 + ((op & CMD_HAS_SEQ) ? 4 : 0) + ((op & CMD_HAS_T) ? 4 : 0);
+    if ((op & 0x90) != CMD_INPUT || (op & CMD_ACTION_MASK) >= INPUT_ACTION_COUNT || frame.size() != want) return false;
+    auto u32 = [&frame](size_t at) {
+        const auto* u = reinterpret_cast<const unsigned char*>(frame.data() + at);
+        return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | uint32_t(u[3]);
+    };
+    out.action = static_cast<InputAction>(op & CMD_ACTION_MASK);
+    size_t at = 1;
+    out.seq = (op & CMD_HAS_SEQ) ? u32(at) : 0;
+    if (op & CMD_HAS_SEQ) at += 4;
+    out.t = (op & CMD_HAS_T) ? u32(at) : 0;
+    return true;
+}
+
+inline uint32_t command_digits(std::string_view s) {
+    uint32_t v = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9') break;
+        v = v * 10 + static_cast<uint32_t>(c - '0'); // wraps like the u32 it becomes
+    }
+    return v;
+}
+
+// The text form, "INPUT <action> [seq=<n>] [t=<ms>]", read in place
+inline bool parse_text_input(std::string_view frame, InputCommand& out) {
+    if (frame.substr(0, 6) != "INPUT ") return false;
+    frame.remove_prefix(6);
+    const int code = input_action_code(frame.substr(0, frame.find(' ')));
+    if (code < 0) return false;
+    out.action = static_cast<InputAction>(code);
+    out.seq = out.t = 0;
+    for (size_t pos = frame.find(' '); pos != std::string_view::npos; pos = frame.find(' ', pos + 1)) {
+        const std::string_view kv = frame.substr(pos + 1);
+        if (kv.substr(0, 4) == "seq=") out.seq = command_digits(kv.substr(4));
+        else if (kv.substr(0, 2) == "t=") out.t = command_digits(kv.substr(2));
+    }
+    return true;
+}
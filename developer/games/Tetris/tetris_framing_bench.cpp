@@ -0,0 +1,310 @@
+// Loopback benchmark for the lp_framing.hpp stacks: messages and bytes per
+// second one way, and round-trip latency percentiles, over TCP on 127.0.0.1
+// (TCP_NODELAY, as the servers set it) and a UNIX stream socketpair.
+//
+//   tetris_framing_bench [--sizes 16,256,4096,65536] [--conns 1,4,16] [--ms N]
+//                        [--filter TEXT] [--label NAME] [--out FILE]
+//
+// Stacks:
+//   lp      lp_send_frame out (one sendmsg), lp_recv_frame in (two blocking
+//           recv_all per frame), as the blocking clients use them
+//   reader  lp_send_prepared of a pooled frame out, FrameReader in (poll,
+//           then take whatever the socket has), as the event loops do
+// Modes, for every stack x transport x payload size x connection count:
+//   stream    each connection sends for --ms (default 500) while its peer
+//             reads; the rates are totals over all connections
+//   pingpong  each connection sends a frame and waits for its echo; the rates
+//             count round trips and the bytes of both directions
+// Every case runs on its own sockets, one thread per end of a connection.
+// Every result is one JSON object per line, like tetris_bench's:
+//   {"label":"...","stack":"lp","transport":"tcp","mode":"pingpong","payload":256,"conns":4,
+//    "msgs_per_s":41234,"bytes_per_s":21111808,"p50_us":21.3,"p90_us":30.1,"p99_us":55.0,"max_us":410.2}
+// (the percentiles only for pingpong), so runs before and after a change to
+// the framing can be kept side by side.
+// Build: g++ -std=c++20 -O2 -pthread -o tetris_framing_bench tetris_framing_bench.cpp ../core/common.cpp
+#include "../core/common.hpp"
+#include "../core/lp_framing.hpp"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::vector<size_t> sizes{16, 256, 4096, 65536};
+    std::vector<int> conns{1, 4, 16};
+    int ms = 500;
+    std::string filter;
+    std::string label = "run";
+    std::string out;
+};
+
+// One end of a connection speaking one stack; blocking calls, false once the
+// peer is gone
+class Endpoint {
+public:
+    explicit Endpoint(int fd) : fd_(fd) {}
+    virtual ~Endpoint() { ::close(fd_); }
+    virtual bool send(const std::string& body) = 0;
+    virtual bool recv(std::string& out) = 0;
+    // No more frames from this end; the peer's recv then fails
+    void finish() { ::shutdown(fd_, SHUT_WR); }
+
+protected:
+    int fd_;
+};
+
+class LpEndpoint : public Endpoint {
+public:
+    using Endpoint::Endpoint;
+    bool send(const std::string& body) override { return lp_send_frame(fd_, body); }
+    bool recv(std::string& out) override { return lp_recv_frame(fd_, out); }
+};
+
+class ReaderEndpoint : public Endpoint {
+public:
+    using Endpoint::Endpoint;
+    bool send(const std::string& body) override { return lp_send_prepared(fd_, lp_prepare_frame(body)); }
+    bool recv(std::string& out) override {
+        while (next_ == count_) {
+            pollfd p{fd_, POLLIN, 0};
+            if (::poll(&p, 1, -1) < 0 && errno != EINTR) return false;
+            next_ = 0;
+            if (reader_.read_from(fd_, frames_, count_) != FrameReader::ReadResult::Ok && count_ == 0) return false;
+        }
+        out.swap(frames_[next_++]);
+        return true;
+    }
+
+private:
+    FrameReader reader_;
+    std::vector<std::string> frames_;
+    size_t count_ = 0;
+    size_t next_ = 0;
+};
+
+struct Stack {
+    const char* name;
+    std::unique_ptr<Endpoint> (*make)(int fd);
+};
+
+const Stack kStacks[] = {
+    {"lp", [](int fd) -> std::unique_ptr<Endpoint> { return std::make_unique<LpEndpoint>(fd); }},
+    {"reader", [](int fd) -> std::unique_ptr<Endpoint> { return std::make_unique<ReaderEndpoint>(fd); }},
+};
+const char* const kTransports[] = {"tcp", "unix"};
+const char* const kModes[] = {"stream", "pingpong"};
+
+// A connected pair of sockets; false if the transport is unavailable
+bool connect_pair(const std::string& transport, int& a, int& b) {
+    if (transport == "unix") {
+        int sv[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) return false;
+        a = sv[0];
+        b = sv[1];
+        return true;
+    }
+    static int listen_fd = -1;
+    static uint16_t port = 0;
+    if (listen_fd < 0 && (listen_fd = start_tcp_server("127.0.0.1", port)) < 0) return false;
+    a = connect_tcp("127.0.0.1", port);
+    if (a < 0) return false;
+    b = ::accept(listen_fd, nullptr, nullptr);
+    if (b < 0) {
+        ::close(a);
+        return false;
+    }
+    const int one = 1;
+    ::setsockopt(a, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ::setsockopt(b, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+}
+
+struct CaseResult {
+    double msgs_per_s = 0;
+    double bytes_per_s = 0;
+    std::vector<double> rtt_us; // pingpong only
+};
+
+// Runs one case on conns fresh connections; false if they could not be made
+bool run_case(const Stack& stack, const std::string& transport, const std::string& mode, size_t payload,
+              int conns, int ms, CaseResult& result) {
+    std::vector<std::unique_ptr<Endpoint>> senders, receivers;
+    for (int i = 0; i < conns; ++i) {
+        int a = -1, b = -1;
+        if (!connect_pair(transport, a, b)) return false;
+        senders.push_back(stack.make(a));
+        receivers.push_back(stack.make(b));
+    }
+    const std::string body(payload, 'x');
+    const bool pingpong = mode == "pingpong";
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<uint64_t> counts(conns, 0);
+    std::vector<std::vector<double>> rtts(conns);
+    Clock::time_point start, deadline;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < conns; ++i) {
+        // The far end: counts a stream, or echoes each ping
+        threads.emplace_back([&, i] {
+            std::string in;
+            Endpoint& e = *receivers[i];
+            while (e.recv(in)) {
+                if (pingpong) {
+                    if (!e.send(in)) break;
+                } else {
+                    ++counts[i];
+                }
+            }
+            if (pingpong) e.finish();
+        });
+        threads.emplace_back([&, i] {
+            Endpoint& e = *senders[i];
+            std::string in;
+            ready.fetch_add(1);
+            while (!go.load()) std::this_thread::yield();
+            while (Clock::now() < deadline) {
+                if (pingpong) {
+                    const auto t0 = Clock::now();
+                    if (!e.send(body) || !e.recv(in)) break;
+                    rtts[i].push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+                    ++counts[i];
+                } else if (!e.send(body)) {
+                    break;
+                }
+            }
+            e.finish();
+            if (pingpong) {
+                while (e.recv(in)) {} // until the echo side closes too
+            }
+        });
+    }
+    while (ready.load() < conns) std::this_thread::yield();
+    start = Clock::now();
+    deadline = start + std::chrono::milliseconds(ms);
+    go.store(true);
+    for (auto& t : threads) t.join();
+    const double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint64_t msgs = 0;
+    for (uint64_t c : counts) msgs += c;
+    result.msgs_per_s = static_cast<double>(msgs) / secs;
+    result.bytes_per_s = result.msgs_per_s * static_cast<double>(payload) * (pingpong ? 2 : 1);
+    result.rtt_us.clear();
+    for (auto& r : rtts) result.rtt_us.insert(result.rtt_us.end(), r.begin(), r.end());
+    std::sort(result.rtt_us.begin(), result.rtt_us.end());
+    return true;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    const size_t i = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+void run_all(const Options& opt, std::ostream& out) {
+    for (const Stack& stack : kStacks) {
+        for (const char* transport : kTransports) {
+            for (const char* mode : kModes) {
+                const std::string id = std::string(stack.name) + "/" + transport + "/" + mode;
+                if (!opt.filter.empty() && id.find(opt.filter) == std::string::npos) continue;
+                for (size_t size : opt.sizes) {
+                    for (int conns : opt.conns) {
+                        CaseResult r;
+                        if (!run_case(stack, transport, mode, size, conns, opt.ms, r)) {
+                            std::cerr << "cannot connect over " << transport << ", skipping " << id << "\n";
+                            continue;
+                        }
+                        char line[512];
+                        int n = std::snprintf(line, sizeof(line),
+                                              "{\"label\":\"%s\",\"stack\":\"%s\",\"transport\":\"%s\",\"mode\":\"%s\","
+                                              "\"payload\":%zu,\"conns\":%d,\"msgs_per_s\":%.0f,\"bytes_per_s\":%.0f",
+                                              opt.label.c_str(), stack.name, transport, mode, size, conns,
+                                              r.msgs_per_s, r.bytes_per_s);
+                        if (!r.rtt_us.empty()) {
+                            std::snprintf(line + n, sizeof(line) - static_cast<size_t>(n),
+                                          ",\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f",
+                                          percentile(r.rtt_us, 0.5), percentile(r.rtt_us, 0.9),
+                                          percentile(r.rtt_us, 0.99), r.rtt_us.back());
+                        }
+                        out << line << "}" << std::endl;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename T>
+bool parse_list(const std::string& text, std::vector<T>& out) {
+    out.clear();
+    std::stringstream ss(text);
+    for (std::string item; std::getline(ss, item, ',');) {
+        const long long v = std::atoll(item.c_str());
+        if (v <= 0) return false;
+        out.push_back(static_cast<T>(v));
+    }
+    return !out.empty();
+}
+
+void usage() {
+    std::cerr << "usage: tetris_framing_bench [--sizes 16,256,4096,65536] [--conns 1,4,16] [--ms N]\n"
+              << "                            [--filter TEXT] [--label NAME] [--out FILE]\n";
+}
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        const bool has_value = i + 1 < argc;
+        bool ok = has_value;
+        if (a == "--sizes" && has_value) ok = parse_list(argv[++i], opt.sizes);
+        else if (a == "--conns" && has_value) ok = parse_list(argv[++i], opt.conns);
+        else if (a == "--ms" && has_value) ok = (opt.ms = std::atoi(argv[++i])) > 0;
+        else if (a == "--filter" && has_value) opt.filter = argv[++i];
+        else if (a == "--label" && has_value) opt.label = argv[++i];
+        else if (a == "--out" && has_value) opt.out = argv[++i];
+        else ok = false;
+        if (!ok) {
+            usage();
+            return 2;
+        }
+    }
+    for (size_t size : opt.sizes) {
+        if (size > LP_MAX_FRAME) {
+            std::cerr << "payload " << size << " is over the frame limit of " << LP_MAX_FRAME << "\n";
+            return 2;
+        }
+    }
+    set_log_level(LogLevel::Warn);
+    if (opt.out.empty()) {
+        run_all(opt, std::cout);
+        return 0;
+    }
+    std::ofstream out(opt.out, std::ios::app);
+    if (!out) {
+        std::cerr << "cannot open " << opt.out << "\n";
+        return 1;
+    }
+    run_all(opt, out);
+    return 0;
+}
@@ -1,107 +1,440 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <string_view>
 #include <random>
 #include <algorithm>
-#include <sstream>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
 
-#define BOARD_COLS 10
-#define BOARD_ROWS 20
+// Every input a board takes. The index is the action's code on the wire
+// (binary INPUT commands, tetris_command.hpp) and in replay traces, so the
+// order is fixed: new actions go at the end.
+constexpr const char* INPUT_ACTIONS[] = {"LEFT", "RIGHT", "DOWN", "ROTATE", "ROTATE_CCW", "DROP", "HOLD"};
+constexpr int INPUT_ACTION_COUNT = 7;
+enum InputAction : uint8_t {
+    INPUT_LEFT, INPUT_RIGHT, INPUT_DOWN, INPUT_ROTATE, INPUT_ROTATE_CCW, INPUT_DROP, INPUT_HOLD
+};
+
+// -1 for anything TetrisGame does not know
+inline int input_action_code(std::string_view action) {
+    for (int i = 0; i < INPUT_ACTION_COUNT; ++i) {
+        if (action == INPUT_ACTIONS[i]) return i;
+    }
+    return -1;
+}
+
+// Shape definitions (using 4x4 matrix), in their SRS spawn orientation
+constexpr int SHAPE_I[4][4] = {{0,0,0,0},{1,1,1,1},{0,0,0,0},{0,0,0,0}};
+constexpr int SHAPE_T[4][4] = {{0,1,0,0},{1,1,1,0},{0,0,0,0},{0,0,0,0}};
+constexpr int SHAPE_L[4][4] = {{0,0,1,0},{1,1,1,0},{0,0,0,0},{0,0,0,0}};
+constexpr int SHAPE_L2[4][4] = {{1,0,0,0},{1,1,1,0},{0,0,0,0},{0,0,0,0}};
+constexpr int SHAPE_O[4][4] = {{1,1,0,0},{1,1,0,0},{0,0,0,0},{0,0,0,0}};
+constexpr int SHAPE_S[4][4] = {{0,1,1,0},{1,1,0,0},{0,0,0,0},{0,0,0,0}};
+constexpr int SHAPE_S2[4][4] = {{1,1,0,0},{0,1,1,0},{0,0,0,0},{0,0,0,0}};
+constexpr const int (*SHAPES[7])[4] = {SHAPE_I, SHAPE_T, SHAPE_L, SHAPE_L2, SHAPE_O, SHAPE_S, SHAPE_S2};
+constexpr int SHAPE_COUNT = 7;
+constexpr int SHAPE_ID_I = 0;
+constexpr int SHAPE_ID_O = 4;
+// Side of the square each shape rotates in: 4 for I, 2 for O, 3 for the rest
+constexpr int SHAPE_BOX[7] = {4, 3, 3, 3, 2, 3, 3};
+
+// Bitboard layout: every board row is one mask where bit (kWall + c) is column
+// c. The bits left and right of the playfield are always set, so the walls
+// collide exactly like locked cells and no per-cell bounds checks are needed.
+// A board is Cols x VisibleRows on screen with HiddenRows more above, where
+// pieces spawn (the guideline's 10x40 matrix is <10, 20, 20>); its rows are
+// 16-bit masks when the columns and walls fit, 32-bit ones otherwise.
+template <int Cols, int VisibleRows, int HiddenRows = 0>
+struct BoardGeometry {
+    static constexpr int kCols = Cols;
+    static constexpr int kVisibleRows = VisibleRows;
+    static constexpr int kHiddenRows = HiddenRows;
+    static constexpr int kRows = VisibleRows + HiddenRows; // bitboard rows, the hidden ones first
+    static constexpr int kWall = 3;
+    static_assert(kWall + Cols + kWall <= 32, "board row must fit a 32-bit mask");
+    using Row = std::conditional_t<kWall + Cols + kWall <= 16, uint16_t, uint32_t>;
+    static constexpr Row kRowFull = static_cast<Row>(~Row{0});
+    static constexpr Row kRowEmpty = static_cast<Row>(~(((uint32_t{1} << Cols) - 1u) << kWall));
+    // A fresh piece's box: centred, and in the last two hidden rows if there are any
+    static constexpr int kSpawnX = Cols / 2 - 2;
+    static constexpr int kSpawnY = HiddenRows >= 2 ? HiddenRows - 2 : 0;
+};
+using ClassicGeometry = BoardGeometry<10, 20>;
+
+// The classic board: what the wire formats, the bot and the rooms work on
+constexpr int BOARD_COLS = ClassicGeometry::kCols;
+constexpr int BOARD_ROWS = ClassicGeometry::kRows;
+constexpr int BOARD_WALL = ClassicGeometry::kWall;
+constexpr uint16_t ROW_FULL = ClassicGeometry::kRowFull;
+constexpr uint16_t ROW_EMPTY = ClassicGeometry::kRowEmpty;
+static_assert(std::is_same_v<ClassicGeometry::Row, uint16_t>, "the classic board row must stay a 16-bit mask");
+
+// One rotation of a piece: rows[r] has bit c set when cell (r, c) of the 4x4 box is filled,
+// bottom[c] is the lowest filled row of box column c (-1 when the column is empty) and
+// min/max_row/col is the bounding box of the filled cells.
+struct PieceMask {
+    uint8_t rows[4] = {0, 0, 0, 0};
+    int8_t bottom[4] = {-1, -1, -1, -1};
+    int8_t min_row = 4, max_row = -1;
+    int8_t min_col = 4, max_col = -1;
+};
+
+constexpr PieceMask make_piece_mask(const int (*shape)[4], int box, int rotation) {
+    int cells[4][4] = {};
+    for (int r = 0; r < 4; ++r)
+        for (int c = 0; c < 4; ++c) cells[r][c] = shape[r][c];
+    // Rotate 90 degrees clockwise inside the shape's box (SRS rotation centre)
+    for (int turn = 0; turn < rotation; ++turn) {
+        int next[4][4] = {};
+        for (int r = 0; r < box; ++r)
+            for (int c = 0; c < box; ++c) next[c][box - 1 - r] = cells[r][c];
+        for (int r = 0; r < 4; ++r)
+            for (int c = 0; c < 4; ++c) cells[r][c] = next[r][c];
+    }
+    PieceMask mask;
+    for (int r = 0; r < 4; ++r) {
+        uint8_t bits = 0;
+        for (int c = 0; c < 4; ++c) {
+            if (!cells[r][c]) continue;
+            bits = static_cast<uint8_t>(bits | (1u << c));
+            mask.bottom[c] = static_cast<int8_t>(r);
+            if (r < mask.min_row) mask.min_row = static_cast<int8_t>(r);
+            if (r > mask.max_row) mask.max_row = static_cast<int8_t>(r);
+            if (c < mask.min_col) mask.min_col = static_cast<int8_t>(c);
+            if (c > mask.max_col) mask.max_col = static_cast<int8_t>(c);
+        }
+        mask.rows[r] = bits;
+    }
+    return mask;
+}
+
+// SRS wall kicks as (dx, dy) with y pointing down the board, tried in order.
+// Indexed by [from rotation][direction], direction 0 = clockwise, 1 = counter-clockwise.
+struct KickOffset {
+    int8_t dx, dy;
+};
+constexpr int KICK_TESTS = 5;
+constexpr KickOffset KICKS_JLSTZ[4][2][KICK_TESTS] = {
+    {{{0,0},{-1,0},{-1,-1},{0,2},{-1,2}},  {{0,0},{1,0},{1,-1},{0,2},{1,2}}},     // 0->R, 0->L
+    {{{0,0},{1,0},{1,1},{0,-2},{1,-2}},    {{0,0},{1,0},{1,1},{0,-2},{1,-2}}},    // R->2, R->0
+    {{{0,0},{1,0},{1,-1},{0,2},{1,2}},     {{0,0},{-1,0},{-1,-1},{0,2},{-1,2}}},  // 2->L, 2->R
+    {{{0,0},{-1,0},{-1,1},{0,-2},{-1,-2}}, {{0,0},{-1,0},{-1,1},{0,-2},{-1,-2}}}, // L->0, L->2
+};
+constexpr KickOffset KICKS_I[4][2][KICK_TESTS] = {
+    {{{0,0},{-2,0},{1,0},{-2,1},{1,-2}},   {{0,0},{-1,0},{2,0},{-1,-2},{2,1}}},   // 0->R, 0->L
+    {{{0,0},{-1,0},{2,0},{-1,-2},{2,1}},   {{0,0},{2,0},{-1,0},{2,-1},{-1,2}}},   // R->2, R->0
+    {{{0,0},{2,0},{-1,0},{2,-1},{-1,2}},   {{0,0},{1,0},{-2,0},{1,2},{-2,-1}}},   // 2->L, 2->R
+    {{{0,0},{1,0},{-2,0},{1,2},{-2,-1}},   {{0,0},{-2,0},{1,0},{-2,1},{1,-2}}},   // L->0, L->2
+};
 
-// Shape definitions (using 4x4 matrix)
-const int SHAPE_I[4][4] = {{0,1,0,0},{0,1,0,0},{0,1,0,0},{0,1,0,0}};
-const int SHAPE_T[4][4] = {{0,1,0,0},{1,1,1,0},{0,0,0,0},{0,0,0,0}};
-const int SHAPE_L[4][4] = {{0,1,0,0},{0,1,0,0},{0,1,1,0},{0,0,0,0}};
-const int SHAPE_L2[4][4] = {{0,1,0,0},{0,1,0,0},{1,1,0,0},{0,0,0,0}};
-const int SHAPE_O[4][4] = {{1,1,0,0},{1,1,0,0},{0,0,0,0},{0,0,0,0}};
-const int SHAPE_S[4][4] = {{0,1,1,0},{1,1,0,0},{0,0,0,0},{0,0,0,0}};
-const int SHAPE_S2[4][4] = {{1,1,0,0},{0,1,1,0},{0,0,0,0},{0,0,0,0}};
-const std::vector<const int(*)[4]> SHAPES = {SHAPE_I, SHAPE_T, SHAPE_L, SHAPE_L2, SHAPE_O, SHAPE_S, SHAPE_S2};
+struct PieceMaskTable {
+    PieceMask masks[SHAPE_COUNT][4];
+    constexpr PieceMaskTable() : masks() {
+        for (int s = 0; s < SHAPE_COUNT; ++s)
+            for (int rot = 0; rot < 4; ++rot) masks[s][rot] = make_piece_mask(SHAPES[s], SHAPE_BOX[s], rot);
+    }
+};
+inline constexpr PieceMaskTable PIECE_MASKS{};
+static_assert(PIECE_MASKS.masks[SHAPE_ID_I][1].min_col == 2 && PIECE_MASKS.masks[SHAPE_ID_I][1].max_col == 2,
+              "I piece state R must occupy box column 2");
 
+// Active piece: everything else is looked up in PIECE_MASKS
 struct Piece {
-    int shape[4][4] = {0};
-    int x = BOARD_COLS / 2 - 2;
-    int y = 0;
-    int shape_id = 0;
+    int8_t shape_id = 0;
+    int8_t rotation = 0;
+    int8_t x = BOARD_COLS / 2 - 2;
+    int8_t y = 0;
+    bool operator==(const Piece&) const = default;
 };
 
-class TetrisGame {
+// True when mask at (px, py) overlaps a wall, the floor, the top edge or a set cell of rows.
+// Works on any bitboard, so search code can test placements without a TetrisGame.
+template <typename Geometry = ClassicGeometry>
+inline bool piece_collides(const typename Geometry::Row (&rows)[Geometry::kRows], const PieceMask& mask, int px,
+                           int py) {
+    // Bounding box outside the field: walls, floor or above the top
+    if (px + mask.min_col < 0 || px + mask.max_col >= Geometry::kCols) return true;
+    if (py + mask.min_row < 0 || py + mask.max_row >= Geometry::kRows) return true;
+    const int shift = px + Geometry::kWall;
+    for (int r = mask.min_row; r <= mask.max_row; ++r) {
+        if ((uint32_t{mask.rows[r]} << shift) & rows[py + r]) return true;
+    }
+    return false;
+}
+
+// SRS rotation of piece on rows, direction 0 = clockwise, 1 = counter-clockwise:
+// the first kick offset that fits wins, otherwise the piece stays put (false)
+template <typename Geometry = ClassicGeometry>
+inline bool rotate_with_kicks(const typename Geometry::Row (&rows)[Geometry::kRows], Piece& piece, int direction) {
+    if (piece.shape_id == SHAPE_ID_O) return false; // O has no rotation states worth kicking
+    const int from = piece.rotation;
+    const int to = (from + (direction == 0 ? 1 : 3)) & 3;
+    const PieceMask& next = PIECE_MASKS.masks[piece.shape_id][to];
+    const KickOffset (&kicks)[KICK_TESTS] = (piece.shape_id == SHAPE_ID_I ? KICKS_I : KICKS_JLSTZ)[from][direction];
+    for (const KickOffset& k : kicks) {
+        if (!piece_collides<Geometry>(rows, next, piece.x + k.dx, piece.y + k.dy)) {
+            piece.rotation = static_cast<int8_t>(to);
+            piece.x = static_cast<int8_t>(piece.x + k.dx);
+            piece.y = static_cast<int8_t>(piece.y + k.dy);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Levels go up every 10 cleared lines; each level drops 15% faster than the last
+constexpr int LINES_PER_LEVEL = 10;
+constexpr int MIN_GRAVITY_MS = 50;
+
+inline int gravity_interval_ms(int base_ms, int level) {
+    double ms = base_ms;
+    for (int i = 0; i < level && ms > MIN_GRAVITY_MS; ++i) ms *= 0.85;
+    return std::max(MIN_GRAVITY_MS, static_cast<int>(ms));
+}
+
+// Color plane as ASCII digits, row-major, with the given piece overlaid, written
+// to out[0, BOARD_ROWS * BOARD_COLS).
+inline void write_board_chars(char* out, const uint8_t (&colors)[BOARD_ROWS][BOARD_COLS], const Piece& piece) {
+    for (int r = 0; r < BOARD_ROWS; ++r) {
+        for (int c = 0; c < BOARD_COLS; ++c) {
+            out[r * BOARD_COLS + c] = static_cast<char>('0' + colors[r][c]);
+        }
+    }
+    if (piece.shape_id < 0 || piece.shape_id >= SHAPE_COUNT || piece.rotation < 0 || piece.rotation > 3) return;
+    const PieceMask& mask = PIECE_MASKS.masks[piece.shape_id][piece.rotation];
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            if (mask.rows[r] & (1u << c)) {
+                int board_r = piece.y + r;
+                int board_c = piece.x + c;
+                if(board_r >= 0 && board_r < BOARD_ROWS && board_c >= 0 && board_c < BOARD_COLS) {
+                    out[board_r * BOARD_COLS + board_c] = static_cast<char>('0' + piece.shape_id + 1);
+                }
+            }
+        }
+    }
+}
+
+// Letter of each shape id, as the JSON boards of server.py name the pieces
+constexpr char SHAPE_LETTERS[SHAPE_COUNT + 1] = "ITLJOSZ";
+
+// The JSON protocol's view of a board, row-major to out[0, BOARD_ROWS * BOARD_COLS):
+// '.' for empty, the shape letter of a locked cell, the piece (unless null) in lowercase
+inline void write_board_letters(char* out, const uint8_t (&colors)[BOARD_ROWS][BOARD_COLS], const Piece* piece) {
+    for (int r = 0; r < BOARD_ROWS; ++r) {
+        for (int c = 0; c < BOARD_COLS; ++c) {
+            out[r * BOARD_COLS + c] = colors[r][c] ? SHAPE_LETTERS[colors[r][c] - 1] : '.';
+        }
+    }
+    if (!piece || piece->shape_id < 0 || piece->shape_id >= SHAPE_COUNT) return;
+    const PieceMask& mask = PIECE_MASKS.masks[piece->shape_id][piece->rotation];
+    const char letter = static_cast<char>(SHAPE_LETTERS[piece->shape_id] - 'A' + 'a');
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            const int board_r = piece->y + r, board_c = piece->x + c;
+            if ((mask.rows[r] & (1u << c)) && board_r >= 0 && board_r < BOARD_ROWS && board_c >= 0 && board_c < BOARD_COLS) {
+                out[board_r * BOARD_COLS + board_c] = letter;
+            }
+        }
+    }
+}
+
+// The same as a 200-char string (20x10). Shared by the server's replay output
+// and the client's binary snapshot decoder.
+inline std::string render_board_string(const uint8_t (&colors)[BOARD_ROWS][BOARD_COLS], const Piece& piece) {
+    std::string out(BOARD_ROWS * BOARD_COLS, '0');
+    write_board_chars(out.data(), colors, piece);
+    return out;
+}
+
+// The piece order of a seed: 7-bags, each a std::shuffle of the shapes by one
+// std::mt19937(seed) and dealt from the back. Both boards of a match use the same
+// order, so a room generates it once, a block of bags at a time, into a ring that
+// every game reads by index. The ring keeps the last kRing pieces; a game that
+// falls further behind than that replays the sequence from the seed (slow, but
+// it takes one board being 4000 pieces ahead of the other). Not thread-safe: the
+// games sharing a sequence must run on one thread.
+class PieceSequence {
 public:
-    int board[BOARD_ROWS][BOARD_COLS] = {0};
+    static constexpr int kBagsPerBlock = 16;
+    static constexpr uint64_t kRing = 4096; // power of two, more than a block
+
+    explicit PieceSequence(int seed) : seed_(seed), rng_(seed) {}
+
+    // Shape of the index-th piece (0-based) of the sequence
+    int at(uint64_t index) {
+        while (index >= generated_) generate_block();
+        if (generated_ - index > kRing) return replay(index);
+        return ring_[index & (kRing - 1)];
+    }
+
+private:
+    template <typename Emit>
+    static void deal_bag(std::mt19937& rng, Emit&& emit) {
+        std::array<int8_t, SHAPE_COUNT> bag = {0, 1, 2, 3, 4, 5, 6};
+        std::shuffle(bag.begin(), bag.end(), rng);
+        for (int i = SHAPE_COUNT - 1; i >= 0; --i) emit(bag[i]);
+    }
+
+    void generate_block() {
+        for (int b = 0; b < kBagsPerBlock; ++b) {
+            deal_bag(rng_, [this](int8_t shape) { ring_[generated_++ & (kRing - 1)] = shape; });
+        }
+    }
+
+    int replay(uint64_t index) const {
+        std::mt19937 rng(seed_);
+        uint64_t n = 0;
+        int8_t found = 0;
+        while (n <= index) {
+            deal_bag(rng, [&](int8_t shape) {
+                if (n++ == index) found = shape;
+            });
+        }
+        return found;
+    }
+
+    int seed_;
+    std::mt19937 rng_;
+    uint64_t generated_ = 0; // pieces generated so far
+    std::array<int8_t, kRing> ring_{};
+};
+
+// What a mode scores and how it paces and ends, as the policy BasicTetrisGame
+// is built on. Everything is constexpr, so a rule a mode leaves off costs the
+// others nothing: there is no flag to test at run time.
+struct ClassicRules {
+    using Geometry = ClassicGeometry;
+    static constexpr int kLinePoints[5] = {0, 100, 300, 500, 800}; // by rows cleared at once
+    static constexpr int kSoftDropPoints = 1;                        // per row
+    static constexpr int kHardDropPoints = 2;                        // per row
+    static constexpr bool kHold = true;
+    static constexpr int kLinesPerLevel = LINES_PER_LEVEL; // 0: level, and so gravity, never change
+    static constexpr int kLineGoal = 0;                    // lines that end the game, won; 0 for none
+    static constexpr uint32_t kTickLimit = 0;              // gravity steps that end it, won; 0 for none
+};
+// The guideline's 10x40 matrix: twenty rows out of sight above the visible
+// twenty, pieces spawn there, and one that locks wholly up there ends the game
+struct TallRules : ClassicRules {
+    using Geometry = BoardGeometry<10, 20, 20>;
+};
+// Forty lines as fast as possible, at a constant speed
+struct SprintRules : TallRules {
+    static constexpr int kLinesPerLevel = 0;
+    static constexpr int kLineGoal = 40;
+};
+// As many points as possible in 240 gravity steps (two minutes at the rooms'
+// default 500 ms), at a constant speed
+struct UltraRules : TallRules {
+    static constexpr int kLinesPerLevel = 0;
+    static constexpr uint32_t kTickLimit = 240;
+};
+
+template <typename Rules>
+class BasicTetrisGame {
+public:
+    using Geometry = typename Rules::Geometry;
+    using Row = typename Geometry::Row;
+    static constexpr int kRows = Geometry::kRows;
+    static constexpr int kCols = Geometry::kCols;
+
+    Row rows[kRows];               // occupancy bitboard (with wall bits)
+    uint8_t colors[kRows][kCols];  // color plane for rendering, 0 = empty, 1-7 = shape id + 1
+    int col_top[kCols];            // highest filled row per column, kRows when empty
     int score = 0;
     int lines_cleared = 0;
+    uint32_t pieces_locked = 0; // bumps whenever the board itself changes
+    uint32_t generation = 1;    // bumps on every change a viewer can see; never 0
+    uint32_t ticks = 0;         // gravity steps applied so far
     bool game_over = false;
+    bool goal_reached = false;  // over because the mode's line goal or time ran out, not a top-out
     Piece current_piece;
     int hold_shape_id = -1;
     bool hold_used = false;
 
-    std::mt19937 rng;
-    std::vector<int> bag;
+    std::shared_ptr<PieceSequence> pieces; // shared with the other board of the match
+    uint64_t next_piece = 0;               // index in pieces of the next spawn
 
-    TetrisGame(int seed) : rng(seed) {
-        fill_bag();
+    BasicTetrisGame(int seed) : BasicTetrisGame(std::make_shared<PieceSequence>(seed)) {}
+    explicit BasicTetrisGame(std::shared_ptr<PieceSequence> sequence) : pieces(std::move(sequence)) {
+        std::fill(std::begin(rows), std::end(rows), Geometry::kRowEmpty);
+        std::memset(colors, 0, sizeof(colors));
+        std::fill(std::begin(col_top), std::end(col_top), kRows);
         spawn_piece();
     }
 
-    void fill_bag() {
-        bag = {0, 1, 2, 3, 4, 5, 6};
-        std::shuffle(bag.begin(), bag.end(), rng);
+    int cell(int r, int c) const { return colors[r][c]; }
+    int level() const {
+        if constexpr (Rules::kLinesPerLevel == 0) {
+            return 0;
+        } else {
+            return lines_cleared / Rules::kLinesPerLevel;
+        }
+    }
+
+    const PieceMask& piece_mask(const Piece& p) const {
+        return PIECE_MASKS.masks[p.shape_id][p.rotation];
     }
 
+    // Shape of the i-th piece to spawn after the current one (0 = next)
+    int preview(int i) const { return pieces->at(next_piece + static_cast<uint64_t>(i)); }
+
     void set_active_shape(int shape_id) {
-        current_piece.shape_id = shape_id;
-        const int(*shape_ptr)[4] = SHAPES[shape_id];
-        current_piece.x = BOARD_COLS / 2 - 2;
-        current_piece.y = 0;
-        for (int r = 0; r < 4; ++r) {
-            for (int c = 0; c < 4; ++c) {
-                current_piece.shape[r][c] = shape_ptr[r][c];
-            }
-        }
+        current_piece.shape_id = static_cast<int8_t>(shape_id);
+        current_piece.rotation = 0;
+        current_piece.x = Geometry::kSpawnX;
+        current_piece.y = Geometry::kSpawnY;
         if (check_collision(current_piece.x, current_piece.y)) {
             game_over = true;
         }
     }
 
     void spawn_piece() {
-        if (bag.empty()) fill_bag();
-        int next_id = bag.back();
-        bag.pop_back();
-        set_active_shape(next_id);
+        set_active_shape(pieces->at(next_piece++));
         hold_used = false;
     }
 
-    bool check_collision(int px, int py) {
+    bool collides(const PieceMask& mask, int px, int py) const {
+        return piece_collides<Geometry>(rows, mask, px, py);
+    }
+
+    bool check_collision(int px, int py) const {
+        return collides(piece_mask(current_piece), px, py);
+    }
+
+    void lock_piece() {
+        const PieceMask& mask = piece_mask(current_piece);
+        const uint8_t color = static_cast<uint8_t>(current_piece.shape_id + 1); // Use 1-7 as color id
         for (int r = 0; r < 4; ++r) {
+            if (!mask.rows[r]) continue;
+            int board_r = current_piece.y + r;
+            rows[board_r] = static_cast<Row>(rows[board_r] | (uint32_t{mask.rows[r]} << (current_piece.x + Geometry::kWall)));
             for (int c = 0; c < 4; ++c) {
-                if (current_piece.shape[r][c]) {
-                    int board_r = py + r;
-                    int board_c = px + c;
-                    if (board_r < 0 || board_r >= BOARD_ROWS || // Out of bounds (bottom/top)
-                        board_c < 0 || board_c >= BOARD_COLS || // Out of bounds (left/right)
-                        board[board_r][board_c])                // Colliding with another piece
-                    {
-                        return true;
-                    }
+                if (mask.rows[r] & (1u << c)) {
+                    colors[board_r][current_piece.x + c] = color;
+                    col_top[current_piece.x + c] = std::min(col_top[current_piece.x + c], board_r);
                 }
             }
         }
-        return false;
-    }
-
-    void lock_piece() {
-        for (int r = 0; r < 4; ++r) {
-            for (int c = 0; c < 4; ++c) {
-                if (current_piece.shape[r][c]) {
-                    board[current_piece.y + r][current_piece.x + c] = current_piece.shape_id + 1; // Use 1-7 as color id
-                }
-            }
+        if constexpr (Geometry::kHiddenRows > 0) {
+            // Lock out: nothing of the piece came to rest where it can be seen
+            const bool locked_out = current_piece.y + mask.max_row < Geometry::kHiddenRows;
+            clear_lines();
+            spawn_piece();
+            if (locked_out) game_over = true;
+        } else {
+            clear_lines();
+            spawn_piece();
         }
-        clear_lines();
-        spawn_piece();
+        ++pieces_locked;
     }
 
     void hold_piece() {
+        if constexpr (!Rules::kHold) return;
         if (game_over || hold_used) return;
         int current_id = current_piece.shape_id;
         if (hold_shape_id == -1) {
@@ -116,38 +449,81 @@ public:
     }
 
     void clear_lines() {
+        // Only the rows touched by the piece that just locked can have become full
         int lines_to_clear = 0;
-        for (int r = BOARD_ROWS - 1; r >= 0; --r) {
-            bool line_full = true;
-            for (int c = 0; c < BOARD_COLS; ++c) {
-                if (board[r][c] == 0) {
-                    line_full = false;
-                    break;
-                }
+        for (int r = std::max<int>(current_piece.y, 0); r < std::min(current_piece.y + 4, kRows); ++r) {
+            if (rows[r] == Geometry::kRowFull) lines_to_clear++;
+        }
+        if (lines_to_clear == 0) return;
+
+        // Single bottom-up sweep: keep every non-full row, packed towards the floor
+        int dst = kRows - 1;
+        for (int src = kRows - 1; src >= 0; --src) {
+            if (rows[src] == Geometry::kRowFull) continue;
+            if (dst != src) {
+                rows[dst] = rows[src];
+                std::memcpy(colors[dst], colors[src], sizeof(colors[0]));
             }
-            if (line_full) {
-                lines_to_clear++;
-                for (int r_above = r; r_above > 0; --r_above) {
-                    for (int c = 0; c < BOARD_COLS; ++c) {
-                        board[r_above][c] = board[r_above - 1][c];
-                    }
-                }
-                for (int c = 0; c < BOARD_COLS; ++c) {
-                    board[0][c] = 0;
-                }
-                r++; // Re-check this row
+            dst--;
+        }
+        for (; dst >= 0; --dst) {
+            rows[dst] = Geometry::kRowEmpty;
+            std::memset(colors[dst], 0, sizeof(colors[0]));
+        }
+        recompute_col_top();
+
+        lines_cleared += lines_to_clear;
+        score += Rules::kLinePoints[lines_to_clear];
+        if constexpr (Rules::kLineGoal > 0) {
+            if (lines_cleared >= Rules::kLineGoal) reach_goal();
+        }
+    }
+
+    void recompute_col_top() {
+        Row seen = 0;
+        std::fill(std::begin(col_top), std::end(col_top), kRows);
+        for (int r = 0; r < kRows; ++r) {
+            Row fresh = static_cast<Row>(rows[r] & ~Geometry::kRowEmpty & ~seen);
+            if (!fresh) continue;
+            for (int c = 0; c < kCols; ++c) {
+                if (fresh & (uint32_t{1} << (c + Geometry::kWall))) col_top[c] = r;
             }
+            seen = static_cast<Row>(seen | fresh);
         }
-        if (lines_to_clear > 0) {
-            lines_cleared += lines_to_clear;
-            int points[] = {0, 100, 300, 500, 800};
-            score += points[lines_to_clear];
+    }
+
+    // Rows the current piece can fall before it rests on the stack or the floor
+    int drop_distance() const {
+        const PieceMask& mask = piece_mask(current_piece);
+        int dist = kRows;
+        for (int c = 0; c < 4; ++c) {
+            if (mask.bottom[c] < 0) continue;
+            int board_c = current_piece.x + c;
+            int lowest = current_piece.y + mask.bottom[c];
+            // Piece is tucked under an overhang: heights say nothing, walk it down instead
+            if (lowest >= col_top[board_c]) return step_drop_distance();
+            dist = std::min(dist, col_top[board_c] - lowest - 1);
         }
+        return dist;
+    }
+
+    int step_drop_distance() const {
+        int dist = 0;
+        while (!check_collision(current_piece.x, current_piece.y + dist + 1)) dist++;
+        return dist;
     }
 
     // Server-side gravity tick
     void tick() {
+        ++ticks;
         if (game_over) return;
+        if constexpr (Rules::kTickLimit > 0) {
+            if (ticks > Rules::kTickLimit) {
+                reach_goal();
+                return;
+            }
+        }
+        ++generation; // the piece either falls or locks
         if (!check_collision(current_piece.x, current_piece.y + 1)) {
             current_piece.y++;
         } else {
@@ -155,97 +531,83 @@ public:
         }
     }
 
-    // Handle player input
-    void handle_input(const std::string& action) {
+    // Ends the game from outside, e.g. a player who left
+    void forfeit() {
+        if (game_over) return;
+        game_over = true;
+        ++generation;
+    }
+
+    // Handle player input, by name; unknown actions are ignored
+    void handle_input(std::string_view action) {
+        const int code = input_action_code(action);
+        if (code >= 0) handle_input(static_cast<InputAction>(code));
+    }
+
+    void handle_input(InputAction action) {
         if (game_over) return;
-        if (action == "LEFT") {
+        const Piece before = current_piece;
+        const uint32_t locked = pieces_locked;
+        const int held = hold_shape_id;
+        switch (action) {
+        case INPUT_LEFT:
             if (!check_collision(current_piece.x - 1, current_piece.y)) {
                 current_piece.x--;
             }
-        } else if (action == "RIGHT") {
+            break;
+        case INPUT_RIGHT:
             if (!check_collision(current_piece.x + 1, current_piece.y)) {
                 current_piece.x++;
             }
-        } else if (action == "DOWN") {
+            break;
+        case INPUT_DOWN:
             if (!check_collision(current_piece.x, current_piece.y + 1)) {
                 current_piece.y++;
-                score += 1; // Score for soft drop
+                score += Rules::kSoftDropPoints; // Score for soft drop
             } else {
                 lock_piece();
             }
-        } else if (action == "ROTATE") {
-            rotate_piece();
-        } else if (action == "DROP") {
-            int drop_dist = 0;
-            while (!check_collision(current_piece.x, current_piece.y + 1)) {
-                current_piece.y++;
-                drop_dist++;
-            }
-            score += drop_dist * 2; // Score for hard drop
+            break;
+        case INPUT_ROTATE:
+            rotate_piece(0);
+            break;
+        case INPUT_ROTATE_CCW:
+            rotate_piece(1);
+            break;
+        case INPUT_DROP: {
+            int drop_dist = drop_distance();
+            current_piece.y += drop_dist;
+            score += drop_dist * Rules::kHardDropPoints; // Score for hard drop
             lock_piece();
-        } else if (action == "HOLD") {
+            break;
+        }
+        case INPUT_HOLD:
             hold_piece();
+            break;
         }
+        if (current_piece != before || pieces_locked != locked || hold_shape_id != held) ++generation;
     }
 
-    void rotate_piece() {
-        int new_shape[4][4];
-        // Rotate 90 degrees clockwise
-        for(int r = 0; r < 4; ++r) {
-            for (int c = 0; c < 4; ++c) {
-                new_shape[c][3-r] = current_piece.shape[r][c];
-            }
-        }
-
-        int old_shape[4][4];
-        for(int r = 0; r < 4; ++r) for (int c = 0; c < 4; ++c) old_shape[r][c] = current_piece.shape[r][c];
-
-        for(int r = 0; r < 4; ++r) for (int c = 0; c < 4; ++c) current_piece.shape[r][c] = new_shape[r][c];
-
-        // Wall kick logic (simplified)
-        if (check_collision(current_piece.x, current_piece.y)) {
-            // Try moving 1 left
-            if (!check_collision(current_piece.x - 1, current_piece.y)) {
-                current_piece.x--;
-            } // Try moving 1 right
-            else if (!check_collision(current_piece.x + 1, current_piece.y)) {
-                current_piece.x++;
-            } // Failed, revert
-            else {
-                for(int r = 0; r < 4; ++r) for (int c = 0; c < 4; ++c) current_piece.shape[r][c] = old_shape[r][c];
-            }
-        }
+    // direction 0 = clockwise, 1 = counter-clockwise
+    void rotate_piece(int direction) {
+        rotate_with_kicks<Geometry>(rows, current_piece, direction);
     }
 
-    // Serialize the board for sending over network
-    std::string get_board_snapshot() {
-        std::ostringstream os;
-
-        // Create a temp board with the active piece
-        int temp_board[BOARD_ROWS][BOARD_COLS];
-        for (int r = 0; r < BOARD_ROWS; ++r) {
-            for (int c = 0; c < BOARD_COLS; ++c) {
-                temp_board[r][c] = board[r][c];
-            }
-        }
-        for (int r = 0; r < 4; ++r) {
-            for (int c = 0; c < 4; ++c) {
-                if (current_piece.shape[r][c]) {
-                    int board_r = current_piece.y + r;
-                    int board_c = current_piece.x + c;
-                    if(board_r >= 0 && board_r < BOARD_ROWS && board_c >= 0 && board_c < BOARD_COLS) {
-                        temp_board[board_r][board_c] = current_piece.shape_id + 1;
-                    }
-                }
-            }
-        }
+    // Serialize the board for sending over network (the classic board only)
+    std::string get_board_snapshot() const {
+        return render_board_string(colors, current_piece);
+    }
 
-        // Serialize the temp board
-        for (int r = 0; r < BOARD_ROWS; ++r) {
-            for (int c = 0; c < BOARD_COLS; ++c) {
-                os << temp_board[r][c];
-            }
-        }
-        return os.str(); // 200-char string (20x10)
+private:
+    void reach_goal() {
+        game_over = true;
+        goal_reached = true;
+        ++generation;
     }
 };
+
+// The game every room plays, and the wire formats describe
+using TetrisGame = BasicTetrisGame<ClassicRules>;
+using TallTetrisGame = BasicTetrisGame<TallRules>;
+using SprintTetrisGame = BasicTetrisGame<SprintRules>;
+using UltraTetrisGame = BasicTetrisGame<UltraRules>;
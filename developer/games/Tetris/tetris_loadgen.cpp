@@ -0,0 +1,1055 @@
+// Synthetic load against lobby_server and the matches it hosts.
+//
+//   tetris_loadgen HOST PORT [--rooms N] [--spectators K] [--matches M] [--ramp R]
+//                  [--gravity MS] [--input-hz H] [--bot] [--match-secs S]
+//                  [--threads T] [--prefix NAME] [--timeout S] [--server-pid PID]...
+//                  [--spectator-rate MS] [--spectator-summary] [--udp] [--udp-loss PCT]
+//                  [--text-inputs] [--lockstep]
+//   tetris_loadgen HOST PORT --footprint N [--spectators K] [--metrics HOST:PORT]...
+//                  [--server-pid PID]... [--label NAME] [--out FILE] [...]
+//
+// Every room is a host, a guest and K spectators, all simulated users:
+// REGISTER (an existing account is fine) and LOGIN, the host CREATE_ROOMs, the
+// guest JOIN_ROOMs, the host START_GAMEs and both players HELLO the match
+// from GAME_READY; spectators SPECTATE once it is running. Players send
+// random INPUTs at H per second, or play with the placement bot (--bot, at
+// most H placements per second, 0 for no limit). After S seconds they only
+// hard drop, so every match ends; each room plays M matches. Rooms start at R
+// per second (0: all at once). Spectators may ask for at most one frame per
+// board every MS, or for summaries only (see spectator_relay.hpp). With --udp
+// game clients take the datagram channel when the room offers it (lobby_server
+// --udp), dropping PCT% of datagrams each way to mimic a lossy link. Inputs go
+// as binary commands where the room reads them (tetris_command.hpp), as text
+// with --text-inputs. With --lockstep players ask for lockstep mode
+// (tetris_lockstep.hpp): they run both boards from the room's events and send
+// it their board hashes. Clients are non-blocking connections spread over T
+// threads, one epoll loop each, so a few threads carry thousands.
+//
+// The report has per-command lobby latency percentiles (START_GAME runs until
+// GAME_READY arrives), the time between consecutive snapshots of a board as
+// seen by players and spectators, matches started per second and, with
+// --server-pid (lobby_server, db_server, ...), the servers' CPU time per
+// second of match played.
+//
+// --footprint measures what the servers hold per entity instead. N hosts log
+// in and stay idle, then each creates a room and waits, then a guest and K
+// spectators join every room and its match starts; once a stage is reached
+// everywhere and has settled, every --metrics endpoint (a server's
+// --metrics-port) is scraped for its process_* memory gauges (metrics.hpp) and
+// every --server-pid's resident set is read. The report is each stage's
+// growth over the one before divided by N: per idle connection, per waiting
+// room and per running match with its guest and spectators. Allocations count
+// every operator new in the stage, blocks only those still held. With --out
+// each figure is also appended to FILE as a JSON line under --label, so runs
+// of two builds can be diffed. Accounts are registered on the first run of a
+// --prefix; later runs with the same prefix leave them out of the numbers.
+// Matches play on at --input-hz while the last stage settles; --input-hz 0
+// and a slow --gravity keep them from ending.
+#include "../core/common.hpp"
+#include "../core/lp_framing.hpp"
+#include "tetris_bot.hpp"
+#include "tetris_command.hpp"
+#include "tetris_lockstep.hpp"
+#include "tetris_snapshot.hpp"
+#include "udp_channel.hpp"
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host;
+    uint16_t port = 0;
+    int rooms = 10;
+    int spectators = 0;
+    int matches = 1;
+    double ramp = 0;        // rooms started per second, 0 = all at once
+    int gravity_ms = 500;
+    double input_hz = 5;
+    bool bot = false;
+    double match_secs = 60; // then players only hard drop
+    int threads = 1;
+    std::string prefix = "load";
+    double timeout_secs = 600;
+    std::vector<int> server_pids;
+    int spectator_rate_ms = 0;
+    bool spectator_summary = false;
+    bool udp = false;
+    bool text_inputs = false;
+    bool lockstep = false;
+    double udp_loss = 0; // percent of datagrams dropped each way
+    int footprint = 0;   // rooms per stage, 0: a normal load run
+    std::vector<std::string> metrics_endpoints;
+    std::string label = "run";
+    std::string out;
+};
+
+std::atomic<bool> g_stop{false};
+
+// --footprint: how far rooms may go, and how many have got there
+enum Stage { kIdle, kWaiting, kPlaying, kStages };
+const char* const kStageNames[kStages] = {"connection", "waiting_room", "match"};
+std::atomic<int> g_stage{kIdle};
+std::atomic<int> g_reached[kStages] = {};
+std::atomic<int> g_rooms_failed{0};
+
+uint32_t micros(Clock::duration d) {
+    return static_cast<uint32_t>(std::min<int64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(d).count(), UINT32_MAX));
+}
+
+struct Stats {
+    std::map<std::string, std::vector<uint32_t>> lobby_us; // per command
+    std::vector<uint32_t> snapshot_gap_us;
+    std::map<std::string, uint64_t> errors;
+    uint64_t snapshots = 0;
+    uint64_t spectator_bytes = 0; // framed, as received
+    uint64_t player_bytes = 0;    // the same for players, over TCP
+    uint64_t lockstep_events = 0; // applied by players' mirrors
+    uint64_t udp_in = 0;          // datagrams received (after the simulated loss)
+    uint64_t udp_sessions = 0;    // game connections switched over to UDP
+    uint64_t inputs = 0;
+    uint64_t input_bytes = 0; // framed, over TCP
+    uint64_t matches_started = 0;
+    uint64_t matches_finished = 0;
+    uint64_t rooms_failed = 0;
+    double match_secs = 0;
+
+    void merge(const Stats& o) {
+        for (const auto& [cmd, v] : o.lobby_us) lobby_us[cmd].insert(lobby_us[cmd].end(), v.begin(), v.end());
+        snapshot_gap_us.insert(snapshot_gap_us.end(), o.snapshot_gap_us.begin(), o.snapshot_gap_us.end());
+        for (const auto& [what, n] : o.errors) errors[what] += n;
+        snapshots += o.snapshots;
+        spectator_bytes += o.spectator_bytes;
+        player_bytes += o.player_bytes;
+        lockstep_events += o.lockstep_events;
+        input_bytes += o.input_bytes;
+        udp_in += o.udp_in;
+        udp_sessions += o.udp_sessions;
+        inputs += o.inputs;
+        matches_started += o.matches_started;
+        matches_finished += o.matches_finished;
+        rooms_failed += o.rooms_failed;
+        match_secs += o.match_secs;
+    }
+};
+
+// One socket of a simulated client, non-blocking, framed both ways
+struct Link {
+    int fd = -1;
+    FrameReader reader;
+    FrameWriter writer;
+    bool want_out = false; // EPOLLOUT registered
+};
+
+enum class Role { Host, Guest, Spectator };
+
+struct Room;
+
+struct Client {
+    Room* room = nullptr;
+    Role role = Role::Host;
+    std::string name;
+    Link lobby;
+    Link game;
+
+    // Lobby side: at most one command in flight
+    std::string pending;
+    Clock::time_point sent_at;
+    bool welcomed = false;
+    bool registered = false;
+    bool logged_in = false;
+    bool joined = false;         // guest: in the room
+    bool spectating = false;     // spectator: the lobby has it watching
+    int spectated_match = 0;     // spectator: last match it asked to watch
+
+    // Game side
+    int seat = -1;
+    SnapshotView views[2];
+    Clock::time_point last_snapshot[2];
+    bool seen[2] = {false, false};
+    uint32_t seq = 0;
+    Clock::time_point next_input;
+    std::unique_ptr<BotSeat> bot;
+    std::vector<const char*> actions;
+    LockstepMirror mirror; // --lockstep, once WELCOME grants it
+
+    // Datagram session (--udp), see udp_channel.hpp
+    std::string game_host;
+    bool binary_inputs = false; // WELCOME said cmd=bin1
+    int udp_fd = -1;
+    uint64_t udp_key = 0;
+    uint32_t udp_seq = 0;
+    bool udp_ready = false;
+    uint32_t udp_lane_seq[2] = {};
+    std::deque<UdpInput> udp_unacked;
+    Clock::time_point udp_started, udp_hello_at, udp_inputs_at;
+};
+
+struct Room {
+    int index = 0;
+    int rid = 0;
+    std::vector<std::unique_ptr<Client>> clients; // host, guest, then spectators
+    Clock::time_point begin_at;
+    bool begun = false;
+    bool finished = false;
+    bool playing = false;
+    int match = 0;             // matches started so far
+    Clock::time_point match_start;
+    Clock::time_point start_due; // when the host may (re)try START_GAME
+
+    Client& host() { return *clients[0]; }
+    Client& guest() { return *clients[1]; }
+};
+
+// One thread's share of the rooms and the epoll loop driving them
+class Driver {
+public:
+    Driver(const Options& opt, std::vector<int> room_indices, Clock::time_point t0)
+        : opt_(opt), rng_(std::random_device{}()) {
+        for (int idx : room_indices) {
+            auto room = std::make_unique<Room>();
+            room->index = idx;
+            room->begin_at = t0 + std::chrono::microseconds(
+                opt.ramp > 0 ? static_cast<int64_t>(idx * 1e6 / opt.ramp) : 0);
+            const std::string base = opt.prefix + std::to_string(idx);
+            for (int i = 0; i < 2 + opt.spectators; ++i) {
+                auto c = std::make_unique<Client>();
+                c->room = room.get();
+                c->role = i == 0 ? Role::Host : i == 1 ? Role::Guest : Role::Spectator;
+                c->name = base + (i == 0 ? "h" : i == 1 ? "g" : "s" + std::to_string(i - 2));
+                room->clients.push_back(std::move(c));
+            }
+            rooms_.push_back(std::move(room));
+        }
+    }
+
+    void run(Clock::time_point deadline) {
+        epfd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epfd_ < 0) return;
+        epoll_event events[256];
+        std::vector<std::string> frames;
+        while (!g_stop && Clock::now() < deadline) {
+            if (opt_.footprint && g_stage.load() != stage_) {
+                stage_ = g_stage.load();
+                for (auto& room : rooms_) {
+                    if (room->begun && !room->finished) enter_stage(*room);
+                }
+            }
+            const auto now = Clock::now();
+            bool open = false;
+            for (auto& room : rooms_) {
+                if (room->finished) continue;
+                open = true;
+                if (!room->begun && now >= room->begin_at) begin(*room);
+                if (room->begun) on_timer(*room, now);
+            }
+            if (!open) break;
+
+            int n = ::epoll_wait(epfd_, events, 256, 5);
+            if (n < 0 && errno != EINTR) break;
+            for (int i = 0; i < n; ++i) {
+                auto uit = udp_endpoints_.find(events[i].data.fd);
+                if (uit != udp_endpoints_.end()) {
+                    udp_receive(*uit->second);
+                    continue;
+                }
+                auto it = endpoints_.find(events[i].data.fd);
+                if (it == endpoints_.end()) continue;
+                Client& c = *it->second.first;
+                const bool is_game = it->second.second;
+                Link& link = is_game ? c.game : c.lobby;
+                if (events[i].events & EPOLLOUT) flush(link);
+                if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP))) continue;
+                frames.clear();
+                const auto st = link.reader.read_from(link.fd, frames);
+                for (const std::string& f : frames) {
+                    if (is_game) on_game_frame(c, f);
+                    else on_lobby_frame(c, f);
+                    if (c.room->finished) break;
+                }
+                if (st != FrameReader::ReadResult::Ok && !c.room->finished && link.fd >= 0) {
+                    if (is_game) on_game_closed(c);
+                    else fail(*c.room, "lobby connection lost");
+                }
+            }
+        }
+        for (auto& room : rooms_) {
+            if (room->finished) continue;
+            if (opt_.footprint && g_stop) finish(*room); // measured, not failed
+            else fail(*room, "timed out");
+        }
+        ::close(epfd_);
+    }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    // --- connections ---
+
+    bool connect(Client& c, Link& link, const std::string& host, uint16_t port, bool is_game) {
+        link.fd = connect_tcp(host, port);
+        if (link.fd < 0) return false;
+        ::fcntl(link.fd, F_SETFL, ::fcntl(link.fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        ::setsockopt(link.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        link.reader = FrameReader();
+        link.writer = FrameWriter();
+        link.want_out = false;
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = link.fd;
+        ::epoll_ctl(epfd_, EPOLL_CTL_ADD, link.fd, &ev);
+        endpoints_[link.fd] = {&c, is_game};
+        return true;
+    }
+
+    // --- datagram channel ---
+
+    void udp_open(Client& c, uint16_t port, const std::string& key) {
+        udp_close(c);
+        c.udp_fd = connect_udp(c.game_host, port);
+        if (c.udp_fd < 0) {
+            stats_.errors["udp connect failed"]++;
+            return;
+        }
+        c.udp_key = std::strtoull(key.c_str(), nullptr, 16);
+        c.udp_started = Clock::now();
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = c.udp_fd;
+        ::epoll_ctl(epfd_, EPOLL_CTL_ADD, c.udp_fd, &ev);
+        udp_endpoints_[c.udp_fd] = &c;
+        udp_hello(c);
+    }
+
+    void udp_close(Client& c) {
+        if (c.udp_fd < 0) return;
+        udp_endpoints_.erase(c.udp_fd);
+        ::close(c.udp_fd); // also leaves epoll
+        c.udp_fd = -1;
+        c.udp_ready = false;
+        c.udp_lane_seq[0] = c.udp_lane_seq[1] = 0;
+        c.udp_unacked.clear();
+    }
+
+    bool udp_lost() { return opt_.udp_loss > 0 && std::uniform_real_distribution<double>(0, 100)(rng_) < opt_.udp_loss; }
+
+    void udp_send(Client& c, const std::string& datagram) {
+        if (udp_lost()) return;
+        ssize_t n = ::send(c.udp_fd, datagram.data(), datagram.size(), MSG_DONTWAIT);
+        (void)n;
+    }
+
+    void udp_hello(Client& c) {
+        std::string datagram;
+        udp_put_header(datagram, UDP_HELLO, c.udp_key, ++c.udp_seq);
+        datagram.push_back(c.udp_ready ? 1 : 0);
+        udp_send(c, datagram);
+        c.udp_hello_at = Clock::now();
+    }
+
+    void udp_inputs(Client& c) {
+        udp_send(c, udp_encode_inputs(c.udp_key, ++c.udp_seq, c.udp_unacked));
+        c.udp_inputs_at = Clock::now();
+    }
+
+    // Hello retries, keepalives and repeats of unacked inputs
+    void udp_timers(Client& c, Clock::time_point now) {
+        if (c.udp_fd < 0) return;
+        using std::chrono::milliseconds;
+        if (!c.udp_ready && now - c.udp_started >= milliseconds(UDP_GIVE_UP_MS)) {
+            stats_.errors["udp never answered"]++;
+            udp_close(c);
+            return;
+        }
+        if (now - c.udp_hello_at >= milliseconds(c.udp_ready ? UDP_KEEPALIVE_MS : UDP_HELLO_RETRY_MS)) udp_hello(c);
+        if (!c.udp_unacked.empty() && now - c.udp_inputs_at >= milliseconds(UDP_RESEND_MS)) udp_inputs(c);
+    }
+
+    void udp_receive(Client& c) {
+        char buf[UDP_MAX_DATAGRAM];
+        ssize_t n;
+        while (c.udp_fd >= 0 && (n = ::recv(c.udp_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+            if (udp_lost()) continue;
+            UdpHeader h;
+            std::string_view payload;
+            if (!udp_parse(buf, static_cast<size_t>(n), h, payload) || h.key != c.udp_key) continue;
+            stats_.udp_in++;
+            if (h.type == UDP_HELLO) {
+                if (c.udp_ready) continue;
+                c.udp_ready = true;
+                stats_.udp_sessions++;
+                udp_hello(c);
+            } else if (h.type == UDP_FRAME && payload.size() > 1) {
+                const uint8_t lane = static_cast<uint8_t>(payload[0]);
+                if (lane >= 2 || h.seq <= c.udp_lane_seq[lane]) continue;
+                c.udp_lane_seq[lane] = h.seq;
+                on_game_frame(c, std::string(payload.substr(1)));
+                if (c.room->finished) return;
+            }
+        }
+    }
+
+    void disconnect(Link& link) {
+        if (link.fd < 0) return;
+        ::epoll_ctl(epfd_, EPOLL_CTL_DEL, link.fd, nullptr);
+        endpoints_.erase(link.fd);
+        ::close(link.fd);
+        link.fd = -1;
+    }
+
+    void send(Link& link, const std::string& body) {
+        if (link.fd < 0) return;
+        link.writer.enqueue(lp_prepare_frame(body));
+        flush(link);
+    }
+
+    void flush(Link& link) {
+        if (link.fd < 0) return;
+        link.writer.flush(link.fd);
+        const bool want = link.writer.pending();
+        if (want == link.want_out) return;
+        link.want_out = want;
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0u);
+        ev.data.fd = link.fd;
+        ::epoll_ctl(epfd_, EPOLL_CTL_MOD, link.fd, &ev);
+    }
+
+    // --- lobby side ---
+
+    void begin(Room& room) {
+        room.begun = true;
+        enter_stage(room);
+    }
+
+    // Connects the clients the stage has room for (with --footprint only the
+    // host until kPlaying) and lets the host take its next step
+    void enter_stage(Room& room) {
+        for (size_t i = 0; i < room.clients.size(); ++i) {
+            Client& c = *room.clients[i];
+            if (c.lobby.fd >= 0 || (opt_.footprint && i > 0 && stage_ < kPlaying)) continue;
+            if (!connect(c, c.lobby, opt_.host, opt_.port, false)) {
+                fail(room, "lobby connect failed");
+                return;
+            }
+        }
+        pump(room.host());
+    }
+
+    void command(Client& c, const std::string& body) {
+        c.pending = body.substr(0, body.find(' '));
+        c.sent_at = Clock::now();
+        send(c.lobby, body);
+    }
+
+    void complete(Client& c) {
+        stats_.lobby_us[c.pending].push_back(micros(Clock::now() - c.sent_at));
+        c.pending.clear();
+    }
+
+    // Sends the client's next lobby command, if it has one and none in flight
+    void pump(Client& c) {
+        Room& room = *c.room;
+        if (room.finished || !c.pending.empty() || !c.welcomed) return;
+        if (!c.registered) return command(c, "REGISTER " + c.name + " pw" + c.name);
+        if (!c.logged_in) return command(c, "LOGIN " + c.name + " pw" + c.name);
+        switch (c.role) {
+        case Role::Host:
+            if (room.rid == 0) {
+                if (opt_.footprint && stage_ < kWaiting) return;
+                return command(c, "CREATE_ROOM " + c.name + " public");
+            }
+            if (room.guest().joined && !room.playing && room.match < opt_.matches && Clock::now() >= room.start_due) {
+                return command(c, "START_GAME gravity=" + std::to_string(opt_.gravity_ms));
+            }
+            return;
+        case Role::Guest:
+            if (room.rid != 0 && !c.joined) return command(c, "JOIN_ROOM " + std::to_string(room.rid));
+            return;
+        case Role::Spectator:
+            if (c.spectating && c.game.fd < 0 && (!room.playing || c.spectated_match == room.match)) {
+                return command(c, "UNSPECTATE");
+            }
+            if (!c.spectating && room.playing && c.spectated_match < room.match) {
+                c.spectated_match = room.match;
+                return command(c, "SPECTATE " + std::to_string(room.rid));
+            }
+            return;
+        }
+    }
+
+    void on_lobby_frame(Client& c, const std::string& f) {
+        Room& room = *c.room;
+        if (f.rfind("GAME_READY", 0) == 0) {
+            if (c.pending == "START_GAME") complete(c);
+            join_match(c, f, "");
+            if (c.role == Role::Host) {
+                if (opt_.footprint) g_reached[kPlaying]++;
+                room.playing = true;
+                room.match++;
+                room.match_start = Clock::now();
+                stats_.matches_started++;
+                for (size_t i = 2; i < room.clients.size(); ++i) pump(*room.clients[i]);
+            }
+            return;
+        }
+        if (f.rfind("SPECTATE_READY", 0) == 0) {
+            join_match(c, f, " role=SPEC");
+            return;
+        }
+        if (f.rfind("WELCOME", 0) == 0 && !c.welcomed) {
+            c.welcomed = true;
+            return pump(c);
+        }
+        if (c.pending.empty()) return; // some other push (invites, room updates)
+
+        const std::string cmd = c.pending;
+        const bool ok = f.rfind("OK", 0) == 0;
+        if (cmd == "START_GAME") {
+            // Success is only GAME_READY; an error is the previous match not wound down yet
+            complete(c);
+            stats_.errors["START_GAME " + f]++;
+            room.start_due = Clock::now() + std::chrono::milliseconds(100);
+            return;
+        }
+        complete(c);
+        if (cmd == "REGISTER") {
+            c.registered = true; // an existing account from an earlier run is fine
+        } else if (cmd == "LOGIN") {
+            if (!ok) return fail(room, "LOGIN " + f);
+            c.logged_in = true;
+            if (opt_.footprint && c.role == Role::Host) g_reached[kIdle]++;
+        } else if (cmd == "CREATE_ROOM") {
+            const size_t at = f.find("roomId=");
+            if (!ok || at == std::string::npos) return fail(room, "CREATE_ROOM " + f);
+            room.rid = std::atoi(f.c_str() + at + 7);
+            if (opt_.footprint) g_reached[kWaiting]++;
+            pump(room.guest());
+        } else if (cmd == "JOIN_ROOM") {
+            if (!ok) return fail(room, "JOIN_ROOM " + f);
+            c.joined = true;
+            pump(room.host());
+        } else if (cmd == "SPECTATE") {
+            // The match may have ended already; this spectator sits it out
+            if (ok) c.spectating = true;
+            else stats_.errors["SPECTATE " + f]++;
+        } else if (cmd == "UNSPECTATE") {
+            c.spectating = false;
+        }
+        pump(c);
+    }
+
+    // --- game side ---
+
+    void join_match(Client& c, const std::string& ready, const std::string& role) {
+        std::istringstream iss(ready);
+        std::string kv, token, host = opt_.host; // spectators may be sent to a relay elsewhere
+        udp_close(c);
+        uint16_t port = 0;
+        while (iss >> kv) {
+            if (kv.rfind("host=", 0) == 0) host = kv.substr(5);
+            else if (kv.rfind("port=", 0) == 0) port = static_cast<uint16_t>(std::atoi(kv.c_str() + 5));
+            else if (kv.rfind("token=", 0) == 0) token = kv.substr(6);
+        }
+        disconnect(c.game);
+        c.game_host = host;
+        c.seat = -1;
+        c.seq = 0;
+        c.seen[0] = c.seen[1] = false;
+        for (SnapshotView& v : c.views) v = SnapshotView();
+        c.mirror.stop();
+        if (!connect(c, c.game, host, port, true)) {
+            stats_.errors["game connect failed"]++;
+            return;
+        }
+        std::string hello = "HELLO username=" + c.name + " token=" + token + role + " snap=" + SNAP_BIN_TAG;
+        if (c.role == Role::Spectator) {
+            if (opt_.spectator_rate_ms > 0) hello += " rate=" + std::to_string(opt_.spectator_rate_ms);
+            if (opt_.spectator_summary) hello += " detail=summary";
+        }
+        if (opt_.udp) hello += " udp=1";
+        if (opt_.lockstep && c.role != Role::Spectator) hello += std::string(" lockstep=") + LOCK_TAG;
+        send(c.game, hello);
+    }
+
+    void on_game_frame(Client& c, const std::string& f) {
+        if (c.role == Role::Spectator) stats_.spectator_bytes += 4 + f.size();
+        else stats_.player_bytes += 4 + f.size();
+        if (is_lockstep_event(f)) {
+            int board = -1;
+            if (!c.mirror.apply(f, board)) return;
+            stats_.lockstep_events++;
+            const std::string sum = c.mirror.sum(board);
+            if (!sum.empty()) send(c.game, sum);
+            if (board == c.seat && c.bot) {
+                c.mirror.view(board, c.name, c.views[board]);
+                bot_move(c, Clock::now());
+            }
+            return;
+        }
+        if (is_binary_snapshot(f)) {
+            int board = -1;
+            if (!apply_binary_snapshot(f, c.views, board)) return;
+            const auto now = Clock::now();
+            stats_.snapshots++;
+            if (c.seen[board]) stats_.snapshot_gap_us.push_back(micros(now - c.last_snapshot[board]));
+            c.seen[board] = true;
+            c.last_snapshot[board] = now;
+            if (board == c.seat) {
+                while (!c.udp_unacked.empty() && c.udp_unacked.front().seq <= c.views[board].ack) c.udp_unacked.pop_front();
+            }
+            if (board == c.seat && c.bot) bot_move(c, now);
+            return;
+        }
+        if (f.rfind("WELCOME", 0) == 0) {
+            if (opt_.footprint && c.role == Role::Spectator) g_reached[kPlaying]++;
+            c.binary_inputs = !opt_.text_inputs && f.find(std::string(" cmd=") + CMD_BIN_TAG) != std::string::npos;
+            const size_t udp_at = f.find(" udp=");
+            const size_t key_at = f.find(" udp_key=");
+            if (udp_at != std::string::npos && key_at != std::string::npos) {
+                udp_open(c, static_cast<uint16_t>(std::atoi(f.c_str() + udp_at + 5)), f.substr(key_at + 9, 16));
+            }
+            const size_t s = f.find("seed=");
+            const int seed = s == std::string::npos ? 0 : static_cast<int>(std::atoll(f.c_str() + s + 5));
+            if (f.find(std::string(" lockstep=") + LOCK_TAG) != std::string::npos) c.mirror.start(seed);
+            const size_t at = f.find("role=P");
+            if (at != std::string::npos) {
+                c.seat = std::atoi(f.c_str() + at + 6) - 1;
+                c.next_input = Clock::now();
+                if (opt_.bot) {
+                    if (!c.bot) c.bot = std::make_unique<BotSeat>();
+                    c.bot->start(seed);
+                }
+            }
+            return;
+        }
+        if (f.rfind("LOCKSTEP_OFF", 0) == 0) {
+            // Snapshots from here on
+            c.mirror.stop();
+            stats_.errors["game " + f]++;
+            return;
+        }
+        if (f.rfind("GAME_OVER", 0) == 0) {
+            on_game_closed(c);
+            return;
+        }
+        if (f.rfind("ERR", 0) == 0) stats_.errors["game " + f]++;
+    }
+
+    void on_game_closed(Client& c) {
+        disconnect(c.game);
+        udp_close(c);
+        c.seat = -1;
+        Room& room = *c.room;
+        if (c.role == Role::Host && room.playing) {
+            room.playing = false;
+            stats_.matches_finished++;
+            stats_.match_secs += std::chrono::duration<double>(Clock::now() - room.match_start).count();
+            if (room.match >= opt_.matches) return finish(room);
+            room.start_due = Clock::now() + std::chrono::milliseconds(100);
+        }
+        pump(c);
+    }
+
+    bool dropping(const Room& room, Clock::time_point now) const {
+        return now - room.match_start > std::chrono::duration<double>(opt_.match_secs);
+    }
+
+    void input(Client& c, const char* action) {
+        ++c.seq;
+        if (c.udp_ready) {
+            c.udp_unacked.push_back(UdpInput{c.seq, 0, action});
+            udp_inputs(c);
+        } else {
+            const std::string frame =
+                c.binary_inputs ? encode_input_command(static_cast<InputAction>(input_action_code(action)), c.seq)
+                                : std::string("INPUT ") + action + " seq=" + std::to_string(c.seq);
+            stats_.input_bytes += 4 + frame.size();
+            send(c.game, frame);
+        }
+        stats_.inputs++;
+    }
+
+    void bot_move(Client& c, Clock::time_point now) {
+        const SnapshotView& view = c.views[c.seat];
+        if (view.gameover || view.ack != c.seq || now < c.next_input) return;
+        if (dropping(*c.room, now)) return; // on_timer takes over
+        c.actions.clear();
+        if (!c.bot->next_move(view, c.actions)) return;
+        for (const char* a : c.actions) input(c, a);
+        if (opt_.input_hz > 0) c.next_input = now + std::chrono::duration_cast<Clock::duration>(
+                                                       std::chrono::duration<double>(1.0 / opt_.input_hz));
+    }
+
+    void on_timer(Room& room, Clock::time_point now) {
+        for (auto& c : room.clients) udp_timers(*c, now);
+        if (!room.playing) {
+            if (room.rid != 0 && room.match < opt_.matches && now >= room.start_due) pump(room.host());
+            return;
+        }
+        static constexpr const char* kRandomActions[] = {"LEFT", "RIGHT", "ROTATE", "ROTATE_CCW", "DOWN", "DROP"};
+        const bool drop_only = dropping(room, now);
+        const double hz = drop_only ? std::max(opt_.input_hz, 20.0) : opt_.input_hz;
+        if (hz <= 0) return;
+        const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / hz));
+        for (int p = 0; p < 2; ++p) {
+            Client& c = *room.clients[p];
+            if (c.seat < 0 || c.game.fd < 0 || (c.bot && !drop_only)) continue;
+            // Catch up at most a few periods after a stall instead of bursting
+            if (now - c.next_input > 4 * period) c.next_input = now;
+            while (c.next_input <= now) {
+                input(c, drop_only ? "DROP" : kRandomActions[rng_() % std::size(kRandomActions)]);
+                c.next_input += period;
+            }
+        }
+    }
+
+    // --- room lifetime ---
+
+    void finish(Room& room) {
+        room.finished = true;
+        for (auto& c : room.clients) {
+            disconnect(c->game);
+            disconnect(c->lobby);
+            udp_close(*c);
+        }
+    }
+
+    void fail(Room& room, const std::string& why) {
+        if (room.finished) return;
+        stats_.errors[why]++;
+        stats_.rooms_failed++;
+        g_rooms_failed++;
+        if (room.playing) {
+            stats_.match_secs += std::chrono::duration<double>(Clock::now() - room.match_start).count();
+        }
+        finish(room);
+    }
+
+    const Options& opt_;
+    std::mt19937 rng_;
+    int epfd_ = -1;
+    int stage_ = kIdle; // --footprint: the last g_stage seen
+    std::vector<std::unique_ptr<Room>> rooms_;
+    std::unordered_map<int, std::pair<Client*, bool>> endpoints_; // fd -> client, is the game link
+    std::unordered_map<int, Client*> udp_endpoints_;
+    Stats stats_;
+};
+
+// utime + stime of a process in seconds, -1 if it cannot be read
+double process_cpu_secs(int pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    if (!std::getline(in, stat)) return -1;
+    // The command name is in parentheses and may hold spaces; fields resume after it
+    const size_t close = stat.rfind(')');
+    if (close == std::string::npos) return -1;
+    std::istringstream iss(stat.substr(close + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && iss >> field; ++i) {
+        if (i == 14) utime = std::strtoull(field.c_str(), nullptr, 10);
+        if (i == 15) stime = std::strtoull(field.c_str(), nullptr, 10);
+    }
+    return static_cast<double>(utime + stime) / static_cast<double>(::sysconf(_SC_CLK_TCK));
+}
+
+// --- --footprint ---
+
+// One reading of a server's memory; NaN where the source does not say
+struct MemorySample {
+    double rss = NAN;
+    double heap = NAN;
+    double blocks = NAN;
+    double allocs = NAN;
+};
+
+// The process_* gauges from a /metrics endpoint, all NaN if it cannot be scraped
+MemorySample scrape_memory(const std::string& endpoint) {
+    MemorySample m;
+    const size_t colon = endpoint.rfind(':');
+    if (colon == std::string::npos) return m;
+    const int fd = connect_tcp(endpoint.substr(0, colon), static_cast<uint16_t>(std::atoi(endpoint.c_str() + colon + 1)));
+    if (fd < 0) return m;
+    timeval tv{2, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    static const char kRequest[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    std::string page;
+    if (send_all(fd, kRequest, sizeof kRequest - 1)) {
+        char buf[4096];
+        ssize_t n;
+        while ((n = ::recv(fd, buf, sizeof buf, 0)) > 0) page.append(buf, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    std::istringstream lines(page);
+    for (std::string line; std::getline(lines, line);) {
+        std::istringstream kv(line);
+        std::string name;
+        double value = 0;
+        if (!(kv >> name >> value)) continue;
+        if (name == "process_resident_bytes") m.rss = value;
+        else if (name == "process_heap_bytes") m.heap = value;
+        else if (name == "process_heap_blocks") m.blocks = value;
+        else if (name == "process_heap_allocs_total") m.allocs = value;
+    }
+    return m;
+}
+
+// Resident set of a process, NaN if it cannot be read
+double process_rss_bytes(int pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/statm");
+    unsigned long long size = 0, resident = 0;
+    if (!(in >> size >> resident)) return NAN;
+    return static_cast<double>(resident) * static_cast<double>(::sysconf(_SC_PAGESIZE));
+}
+
+// Every --metrics endpoint, then every --server-pid
+std::vector<MemorySample> sample_memory(const Options& opt) {
+    std::vector<MemorySample> out;
+    for (const std::string& e : opt.metrics_endpoints) out.push_back(scrape_memory(e));
+    for (int pid : opt.server_pids) {
+        MemorySample m;
+        m.rss = process_rss_bytes(pid);
+        out.push_back(m);
+    }
+    return out;
+}
+
+// Steps g_stage through the stages while the drivers run, sampling after each;
+// false if a room failed or the deadline passed first
+bool measure_footprint(const Options& opt, Clock::time_point deadline, std::vector<std::vector<MemorySample>>& samples) {
+    constexpr auto kSettle = std::chrono::seconds(1); // for the servers' deferred work (WAL, relays) to land
+    const int spectators_welcomed = opt.footprint * opt.spectators;
+    for (int stage = kIdle; stage < kStages; ++stage) {
+        g_stage = stage;
+        const int goal = opt.footprint + (stage == kPlaying ? spectators_welcomed : 0);
+        while (g_reached[stage].load() < goal) {
+            if (g_stop || g_rooms_failed.load() > 0 || Clock::now() >= deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        std::this_thread::sleep_for(kSettle);
+        samples.push_back(sample_memory(opt));
+    }
+    return true;
+}
+
+void report_footprint(const Options& opt, const std::vector<std::vector<MemorySample>>& samples) {
+    std::vector<std::string> sources = opt.metrics_endpoints;
+    for (int pid : opt.server_pids) sources.push_back("pid " + std::to_string(pid));
+    std::ofstream out;
+    if (!opt.out.empty()) out.open(opt.out, std::ios::app);
+    const double n = opt.footprint;
+    auto delta = [n](double now, double before) { return (now - before) / n; }; // NaN stays NaN
+    auto cell = [](double v) {
+        char buf[32];
+        std::snprintf(buf, sizeof buf, "%.1f", v);
+        return std::isnan(v) ? std::string("-") : std::string(buf);
+    };
+    std::printf("memory per entity, %d of each, %d spectators per match:\n", opt.footprint, opt.spectators);
+    for (size_t i = 0; i < sources.size(); ++i) {
+        const MemorySample& base = samples[0][i];
+        std::printf("  %s: baseline rss %.0f, heap %.0f bytes, %.0f blocks\n", sources[i].c_str(), base.rss, base.heap,
+                    base.blocks);
+        std::printf("    %-14s %12s %12s %10s %10s\n", "per", "rss bytes", "heap bytes", "blocks", "allocs");
+        for (int stage = 0; stage < kStages; ++stage) {
+            const MemorySample& before = samples[static_cast<size_t>(stage)][i];
+            const MemorySample& after = samples[static_cast<size_t>(stage) + 1][i];
+            const MemorySample per{delta(after.rss, before.rss), delta(after.heap, before.heap),
+                                   delta(after.blocks, before.blocks), delta(after.allocs, before.allocs)};
+            std::printf("    %-14s %12s %12s %10s %10s\n", kStageNames[stage], cell(per.rss).c_str(),
+                        cell(per.heap).c_str(), cell(per.blocks).c_str(), cell(per.allocs).c_str());
+            if (!out) continue;
+            out << "{\"label\":\"" << opt.label << "\",\"source\":\"" << sources[i] << "\",\"entity\":\""
+                << kStageNames[stage] << "\",\"n\":" << opt.footprint << ",\"spectators\":" << opt.spectators;
+            const std::pair<const char*, double> fields[] = {
+                {"rss_bytes", per.rss}, {"heap_bytes", per.heap}, {"heap_blocks", per.blocks}, {"allocs", per.allocs}};
+            for (const auto& [key, v] : fields) {
+                if (!std::isnan(v)) out << ",\"" << key << "\":" << cell(v);
+            }
+            out << "}\n";
+        }
+    }
+}
+
+void print_percentiles(const char* label, std::vector<uint32_t>& us) {
+    if (us.empty()) return;
+    std::sort(us.begin(), us.end());
+    auto at = [&](double q) { return us[std::min(us.size() - 1, static_cast<size_t>(q * static_cast<double>(us.size())))] / 1000.0; };
+    std::printf("  %-14s n=%-8zu p50 %8.2f  p90 %8.2f  p99 %8.2f  p99.9 %8.2f  max %8.2f ms\n", label, us.size(),
+                at(0.5), at(0.9), at(0.99), at(0.999), us.back() / 1000.0);
+}
+
+void report(Stats& s, double secs, const Options& opt, const std::vector<double>& cpu) {
+    const size_t clients = static_cast<size_t>(opt.rooms) * static_cast<size_t>(2 + opt.spectators);
+    std::printf("%d rooms, %zu clients, %.1fs: %llu matches started (%.2f/s), %llu finished, %llu rooms failed\n",
+                opt.rooms, clients, secs, static_cast<unsigned long long>(s.matches_started),
+                secs > 0 ? static_cast<double>(s.matches_started) / secs : 0.0,
+                static_cast<unsigned long long>(s.matches_finished), static_cast<unsigned long long>(s.rooms_failed));
+    std::printf("%llu inputs sent (%llu bytes over TCP), %llu snapshots received, %llu bytes to players, "
+                "%llu bytes to spectators\n",
+                static_cast<unsigned long long>(s.inputs), static_cast<unsigned long long>(s.input_bytes),
+                static_cast<unsigned long long>(s.snapshots), static_cast<unsigned long long>(s.player_bytes),
+                static_cast<unsigned long long>(s.spectator_bytes));
+    if (opt.lockstep) {
+        std::printf("%llu lockstep events applied by players\n", static_cast<unsigned long long>(s.lockstep_events));
+    }
+    if (opt.udp) {
+        std::printf("%llu game connections on UDP, %llu datagrams received (%.1f%% dropped each way)\n",
+                    static_cast<unsigned long long>(s.udp_sessions), static_cast<unsigned long long>(s.udp_in),
+                    opt.udp_loss);
+    }
+    std::printf("lobby command latency:\n");
+    for (auto& [cmd, us] : s.lobby_us) print_percentiles(cmd.c_str(), us);
+    if (!s.snapshot_gap_us.empty()) {
+        double mean = 0, var = 0;
+        for (uint32_t v : s.snapshot_gap_us) mean += v;
+        mean /= static_cast<double>(s.snapshot_gap_us.size());
+        for (uint32_t v : s.snapshot_gap_us) var += (v - mean) * (v - mean);
+        var /= static_cast<double>(s.snapshot_gap_us.size());
+        std::printf("snapshot inter-arrival per board (gravity %d ms; locks add extra frames), stddev %.2f ms:\n",
+                    opt.gravity_ms, std::sqrt(var) / 1000.0);
+        print_percentiles("gap", s.snapshot_gap_us);
+    }
+    if (!cpu.empty()) {
+        std::printf("server CPU over %.1f match-seconds:\n", s.match_secs);
+        for (size_t i = 0; i < cpu.size(); ++i) {
+            if (cpu[i] < 0) {
+                std::printf("  pid %d: unreadable\n", opt.server_pids[i]);
+                continue;
+            }
+            std::printf("  pid %d: %.2fs CPU, %.3f%% of a core per running match\n", opt.server_pids[i], cpu[i],
+                        s.match_secs > 0 ? 100.0 * cpu[i] / s.match_secs : 0.0);
+        }
+    }
+    for (const auto& [what, n] : s.errors) {
+        std::printf("error x%llu: %s\n", static_cast<unsigned long long>(n), what.c_str());
+    }
+}
+
+void usage() {
+    std::cerr << "usage: tetris_loadgen HOST PORT [--rooms N] [--spectators K] [--matches M] [--ramp R]\n"
+              << "                      [--gravity MS] [--input-hz H] [--bot] [--match-secs S]\n"
+              << "                      [--threads T] [--prefix NAME] [--timeout S] [--server-pid PID]...\n"
+              << "                      [--spectator-rate MS] [--spectator-summary] [--udp] [--udp-loss PCT]\n"
+              << "                      [--text-inputs] [--lockstep]\n"
+              << "       tetris_loadgen HOST PORT --footprint N [--spectators K] [--metrics HOST:PORT]...\n"
+              << "                      [--server-pid PID]... [--label NAME] [--out FILE] [...]\n";
+}
+
+void on_signal(int) { g_stop = true; }
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (a == "--bot") opt.bot = true;
+        else if (a == "--spectator-summary") opt.spectator_summary = true;
+        else if (a == "--udp") opt.udp = true;
+        else if (a == "--text-inputs") opt.text_inputs = true;
+        else if (a == "--lockstep") opt.lockstep = true;
+        else if (a == "--udp-loss" && has_value) opt.udp_loss = std::atof(argv[++i]);
+        else if (a == "--spectator-rate" && has_value) opt.spectator_rate_ms = std::atoi(argv[++i]);
+        else if (a == "--rooms" && has_value) opt.rooms = std::atoi(argv[++i]);
+        else if (a == "--spectators" && has_value) opt.spectators = std::atoi(argv[++i]);
+        else if (a == "--matches" && has_value) opt.matches = std::atoi(argv[++i]);
+        else if (a == "--ramp" && has_value) opt.ramp = std::atof(argv[++i]);
+        else if (a == "--gravity" && has_value) opt.gravity_ms = std::atoi(argv[++i]);
+        else if (a == "--input-hz" && has_value) opt.input_hz = std::atof(argv[++i]);
+        else if (a == "--match-secs" && has_value) opt.match_secs = std::atof(argv[++i]);
+        else if (a == "--threads" && has_value) opt.threads = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--prefix" && has_value) opt.prefix = argv[++i];
+        else if (a == "--timeout" && has_value) opt.timeout_secs = std::atof(argv[++i]);
+        else if (a == "--server-pid" && has_value) opt.server_pids.push_back(std::atoi(argv[++i]));
+        else if (a == "--footprint" && has_value) opt.footprint = std::atoi(argv[++i]);
+        else if (a == "--metrics" && has_value) opt.metrics_endpoints.push_back(argv[++i]);
+        else if (a == "--label" && has_value) opt.label = argv[++i];
+        else if (a == "--out" && has_value) opt.out = argv[++i];
+        else if (a.rfind("--", 0) == 0) {
+            usage();
+            return 2;
+        } else args.push_back(a);
+    }
+    if (opt.footprint > 0) {
+        opt.rooms = opt.footprint;
+        opt.matches = 1;
+    }
+    if (args.size() != 2 || opt.rooms <= 0 || opt.footprint < 0) {
+        usage();
+        return 2;
+    }
+    opt.host = args[0];
+    opt.port = static_cast<uint16_t>(std::atoi(args[1].c_str()));
+    ::signal(SIGPIPE, SIG_IGN);
+    ::signal(SIGINT, on_signal);
+    ::signal(SIGTERM, on_signal);
+    set_log_level(LogLevel::Warn);
+
+    std::vector<double> cpu0;
+    for (int pid : opt.server_pids) cpu0.push_back(process_cpu_secs(pid));
+    std::vector<std::vector<MemorySample>> footprint;
+    if (opt.footprint) footprint.push_back(sample_memory(opt));
+
+    const auto t0 = Clock::now();
+    const auto deadline = t0 + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.timeout_secs));
+    std::vector<std::unique_ptr<Driver>> drivers;
+    for (int t = 0; t < opt.threads; ++t) {
+        std::vector<int> mine;
+        for (int r = t; r < opt.rooms; r += opt.threads) mine.push_back(r);
+        drivers.push_back(std::make_unique<Driver>(opt, std::move(mine), t0));
+    }
+    std::vector<std::thread> threads;
+    for (auto& d : drivers) threads.emplace_back([&d, deadline] { d->run(deadline); });
+    bool measured = false;
+    if (opt.footprint) {
+        measured = measure_footprint(opt, deadline, footprint);
+        g_stop = true;
+    }
+    for (auto& t : threads) t.join();
+    const double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    std::vector<double> cpu;
+    for (size_t i = 0; i < opt.server_pids.size(); ++i) {
+        const double now = process_cpu_secs(opt.server_pids[i]);
+        cpu.push_back(now < 0 || cpu0[i] < 0 ? -1 : now - cpu0[i]);
+    }
+    Stats total;
+    for (auto& d : drivers) total.merge(d->stats());
+    report(total, secs, opt, cpu);
+    if (opt.footprint) {
+        if (!measured) {
+            std::printf("footprint: stage %s not reached by every room\n", kStageNames[g_stage.load()]);
+            return 1;
+        }
+        report_footprint(opt, footprint);
+    }
+    return total.rooms_failed ? 1 : 0;
+}
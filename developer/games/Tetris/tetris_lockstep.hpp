@@ -0,0 +1,340 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "tetris_game.hpp"
+#include "tetris_snapshot.hpp"
+
+// Lockstep mode. Both boards are TetrisGame(seed) and only change by gravity
+// steps, inputs and forfeits, so a client that is told those, in the order the
+// room applied them, can run the match itself instead of being sent boards.
+//
+// A binary client asks with "lockstep=lock1" in HELLO. A room grants it to
+// any connection but a resumed player's and says so in WELCOME:
+// "lockstep=lock1 p1=<name> p2=<name>". Such a connection gets no snapshots
+// and no POSE; instead, one frame per event (integers in network byte order):
+//   u8 op | u32 seq if LOCK_HAS_SEQ
+// where op = LOCK_EVENT | flags | board << 4 | code, and code is an
+// INPUT_ACTIONS index, LOCK_TICK or LOCK_FORFEIT. seq is the mover's INPUT
+// seq, so the mover knows which of its inputs are in. 5 or 9 bytes framed, for
+// what used to be a snapshot to every viewer on every change.
+//
+// A connection let in after the match started has missed events, so right
+// after WELCOME it gets one LOCK_CATCHUP frame per board: the board as it was
+// after its last LOCK_KEYFRAME_EVERY-th event, and every event since, which
+// the client runs through at once before the live ones:
+//   u8 op (code LOCK_CATCHUP) | state | tail
+//   state: u32 events | u32 seq | u32 ticks | u32 score | u32 lines
+//          | u32 pieces_locked | u32 generation | u32 next_piece
+//          | i8 shape | i8 rotation | i8 x | i8 y | i8 hold | u8 LOCK_STATE_* flags
+//          | every row packed as in snapshots
+//   tail:  per event u8 flags | code, then a LEB128 varint of seq minus the one
+//          before if LOCK_HAS_SEQ, or a u8 count of repeats if LOCK_RUN
+// A joiner costs those two frames, a few hundred bytes at most, whatever the
+// length of the match.
+//
+// Every LOCK_SUM_EVERY events of a board the client sends
+//   "SUM board=<b> n=<events so far> h=<lockstep_hash, 16 hex digits>"
+// and the room checks it against its own copy at that point. On a mismatch (a
+// modified client, or a bug) the room logs it and puts the connection back on
+// snapshots: "LOCKSTEP_OFF reason=desync", then a keyframe of each board.
+// Text events (PLAYER_AWAY, GAME_OVER, ...) are sent as usual.
+constexpr const char* LOCK_TAG = "lock1";
+constexpr uint8_t LOCK_EVENT = 0x80;
+constexpr uint8_t LOCK_HAS_SEQ = 0x40;
+constexpr uint8_t LOCK_BOARD = 0x10;
+constexpr uint8_t LOCK_RUN = 0x10; // in a catch-up tail, where the board bit is not needed
+constexpr uint8_t LOCK_CODE_MASK = 0x0F;
+constexpr uint8_t LOCK_TICK = INPUT_ACTION_COUNT;
+constexpr uint8_t LOCK_FORFEIT = INPUT_ACTION_COUNT + 1;
+constexpr uint8_t LOCK_CATCHUP = LOCK_CODE_MASK;
+constexpr uint32_t LOCK_SUM_EVERY = 32;
+constexpr uint32_t LOCK_KEYFRAME_EVERY = 8 * LOCK_SUM_EVERY;
+constexpr uint8_t LOCK_STATE_GAMEOVER = 0x01;
+constexpr uint8_t LOCK_STATE_GOAL = 0x02;
+constexpr uint8_t LOCK_STATE_HOLD_USED = 0x04;
+constexpr size_t LOCK_STATE_SIZE = 8 * 4 + 6 + BOARD_ROWS * SNAP_ROW_BYTES;
+
+// Text and binary snapshots never have the top bit set in their first byte
+inline bool is_lockstep_event(std::string_view frame) {
+    return !frame.empty() && (static_cast<uint8_t>(frame[0]) & LOCK_EVENT) != 0;
+}
+
+// Appends the event's frame body to out
+inline void encode_lockstep_event(std::string& out, int board, uint8_t code, uint32_t seq) {
+    const uint8_t op = static_cast<uint8_t>(LOCK_EVENT | (seq ? LOCK_HAS_SEQ : 0) | (board ? LOCK_BOARD : 0) | code);
+    out.push_back(static_cast<char>(op));
+    if (seq) snap_put_u32(out, seq);
+}
+
+// FNV-1a over everything that decides how a board plays on: the cells, the
+// piece, hold, the position in the piece sequence, score and lines
+inline uint64_t lockstep_hash(const TetrisGame& g) {
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&h](const void* data, size_t len) {
+        const auto* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < len; ++i) {
+            h ^= p[i];
+            h *= 1099511628211ull;
+        }
+    };
+    mix(g.colors, sizeof(g.colors));
+    const int32_t fields[] = {g.current_piece.shape_id, g.current_piece.rotation, g.current_piece.x,
+                              g.current_piece.y,        g.score,                  g.lines_cleared,
+                              g.hold_shape_id,          g.hold_used,              g.game_over};
+    mix(fields, sizeof(fields));
+    mix(&g.next_piece, sizeof(g.next_piece));
+    return h;
+}
+
+inline std::string lockstep_sum(int board, uint32_t events, uint64_t hash) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "SUM board=%d n=%u h=%016llx", board, events,
+                  static_cast<unsigned long long>(hash));
+    return buf;
+}
+
+inline void lock_put_varint(std::string& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+inline bool lock_get_varint(std::string_view data, size_t& pos, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; pos < data.size() && shift < 35; shift += 7) {
+        const uint8_t b = static_cast<uint8_t>(data[pos++]);
+        v |= uint32_t(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// Appends the state block of a catch-up frame: the board after events events,
+// the last of them an input with that seq
+inline void encode_lockstep_state(std::string& out, const TetrisGame& g, uint32_t events, uint32_t seq) {
+    const uint32_t words[] = {events, seq, g.ticks, static_cast<uint32_t>(g.score),
+                              static_cast<uint32_t>(g.lines_cleared), g.pieces_locked, g.generation,
+                              static_cast<uint32_t>(g.next_piece)};
+    for (uint32_t w : words) snap_put_u32(out, w);
+    out.push_back(static_cast<char>(g.current_piece.shape_id));
+    out.push_back(static_cast<char>(g.current_piece.rotation));
+    out.push_back(static_cast<char>(g.current_piece.x));
+    out.push_back(static_cast<char>(g.current_piece.y));
+    out.push_back(static_cast<char>(g.hold_shape_id));
+    out.push_back(static_cast<char>((g.game_over ? LOCK_STATE_GAMEOVER : 0) | (g.goal_reached ? LOCK_STATE_GOAL : 0) |
+                                    (g.hold_used ? LOCK_STATE_HOLD_USED : 0)));
+    for (int r = 0; r < BOARD_ROWS; ++r) snap_put_row(out, g.colors[r]);
+}
+
+// Puts a state block (LOCK_STATE_SIZE bytes at p) back into g, a game on the
+// match's piece sequence; false if it cannot be a board
+inline bool decode_lockstep_state(const char* p, TetrisGame& g, uint32_t& events, uint32_t& seq) {
+    uint32_t words[8];
+    for (int i = 0; i < 8; ++i) words[i] = snap_get_u32(p + 4 * i);
+    p += 32;
+    const Piece piece{static_cast<int8_t>(p[0]), static_cast<int8_t>(p[1]), static_cast<int8_t>(p[2]),
+                      static_cast<int8_t>(p[3])};
+    const int hold = static_cast<int8_t>(p[4]);
+    const uint8_t flags = static_cast<uint8_t>(p[5]);
+    if (piece.shape_id < 0 || piece.shape_id >= SHAPE_COUNT || piece.rotation < 0 || piece.rotation > 3 ||
+        hold < -1 || hold >= SHAPE_COUNT) {
+        return false;
+    }
+    p += 6;
+    events = words[0];
+    seq = words[1];
+    g.ticks = words[2];
+    g.score = static_cast<int>(words[3]);
+    g.lines_cleared = static_cast<int>(words[4]);
+    g.pieces_locked = words[5];
+    g.generation = words[6];
+    g.next_piece = words[7];
+    g.current_piece = piece;
+    g.hold_shape_id = hold;
+    g.game_over = flags & LOCK_STATE_GAMEOVER;
+    g.goal_reached = flags & LOCK_STATE_GOAL;
+    g.hold_used = flags & LOCK_STATE_HOLD_USED;
+    for (int r = 0; r < BOARD_ROWS; ++r, p += SNAP_ROW_BYTES) {
+        snap_get_row(p, g.colors[r]);
+        g.rows[r] = ROW_EMPTY;
+        for (int c = 0; c < BOARD_COLS; ++c) {
+            if (g.colors[r][c] > SHAPE_COUNT) return false;
+            if (g.colors[r][c]) g.rows[r] = static_cast<uint16_t>(g.rows[r] | (1u << (c + BOARD_WALL)));
+        }
+    }
+    g.recompute_col_top();
+    return true;
+}
+
+// Server side, one per board: where a late joiner starts. The board as of its
+// last LOCK_KEYFRAME_EVERY-th event and the events since, kept packed as the
+// catch-up frame carries them, so a join is two copies and memory stays bounded.
+class LockstepLog {
+public:
+    // After every event applied to the board, with the board as it now is
+    void record(const TetrisGame& game, uint8_t code, uint32_t seq) {
+        ++events_;
+        if (events_ % LOCK_KEYFRAME_EVERY == 0) {
+            if (seq) seq_ = seq;
+            keyframe(game);
+            return;
+        }
+        if (seq) {
+            tail_.push_back(static_cast<char>(LOCK_HAS_SEQ | code));
+            lock_put_varint(tail_, seq - seq_);
+            seq_ = seq;
+            run_at_ = kNoRun;
+        } else if (run_at_ != kNoRun && (tail_[run_at_] & LOCK_CODE_MASK) == code &&
+                   (!(tail_[run_at_] & LOCK_RUN) || static_cast<uint8_t>(tail_.back()) < 255)) {
+            // Gravity steps mostly come in a row: one entry and a count for the lot
+            if (tail_[run_at_] & LOCK_RUN) {
+                tail_.back() = static_cast<char>(static_cast<uint8_t>(tail_.back()) + 1);
+            } else {
+                tail_[run_at_] = static_cast<char>(tail_[run_at_] | LOCK_RUN);
+                tail_.push_back(1);
+            }
+        } else {
+            run_at_ = tail_.size();
+            tail_.push_back(static_cast<char>(code));
+        }
+    }
+
+    // Starts the log over from the board as it is, e.g. when the match starts
+    void keyframe(const TetrisGame& game) {
+        state_.clear();
+        encode_lockstep_state(state_, game, events_, seq_);
+        tail_.clear();
+        run_at_ = kNoRun;
+    }
+
+    // Events applied to the board so far
+    uint32_t events() const { return events_; }
+
+    // The LOCK_CATCHUP frame body for the board
+    std::string catch_up(int board) const {
+        std::string out;
+        out.reserve(1 + state_.size() + tail_.size());
+        out.push_back(static_cast<char>(LOCK_EVENT | (board ? LOCK_BOARD : 0) | LOCK_CATCHUP));
+        out.append(state_);
+        out.append(tail_);
+        return out;
+    }
+
+private:
+    static constexpr size_t kNoRun = static_cast<size_t>(-1);
+
+    std::string state_;
+    std::string tail_;
+    size_t run_at_ = kNoRun; // of the last entry without a seq, while it is the last
+    uint32_t events_ = 0;
+    uint32_t seq_ = 0; // of the last input recorded
+};
+
+// Client side: both boards, run from the event stream
+class LockstepMirror {
+public:
+    void start(int seed) {
+        sequence_ = std::make_shared<PieceSequence>(seed);
+        for (int b = 0; b < 2; ++b) {
+            games_[b].emplace(sequence_);
+            events_[b] = acked_[b] = 0;
+        }
+    }
+    void stop() {
+        games_[0].reset();
+        games_[1].reset();
+        sequence_.reset();
+    }
+    bool active() const { return games_[0].has_value(); }
+
+    // Applies one event frame, or a catch-up frame and every event in it;
+    // false if it is malformed or the mirror is off
+    bool apply(std::string_view frame, int& board) {
+        if (!active() || !is_lockstep_event(frame)) return false;
+        const uint8_t op = static_cast<uint8_t>(frame[0]);
+        const uint8_t code = op & LOCK_CODE_MASK;
+        board = (op & LOCK_BOARD) ? 1 : 0;
+        if (code == LOCK_CATCHUP) return catch_up(frame, board);
+        if (frame.size() != ((op & LOCK_HAS_SEQ) ? 5u : 1u) || code > LOCK_FORFEIT) return false;
+        step(*games_[board], code);
+        if (op & LOCK_HAS_SEQ) acked_[board] = snap_get_u32(frame.data() + 1);
+        ++events_[board];
+        return true;
+    }
+
+    const TetrisGame& game(int board) const { return *games_[board]; }
+    // seq of the last input applied to the board
+    uint32_t acked(int board) const { return acked_[board]; }
+    // The SUM the room expects after the last event of the board, empty if none is due
+    std::string sum(int board) const {
+        if (events_[board] % LOCK_SUM_EVERY != 0) return {};
+        return lockstep_sum(board, events_[board], lockstep_hash(*games_[board]));
+    }
+
+    // The board as a snapshot would have shown it, for code written against those
+    void view(int board, const std::string& name, SnapshotView& out) const {
+        const TetrisGame& g = *games_[board];
+        out.have_keyframe = true;
+        out.name = name;
+        std::memcpy(out.colors, g.colors, sizeof(out.colors));
+        out.piece = g.current_piece;
+        out.score = g.score;
+        out.lines = g.lines_cleared;
+        out.gameover = g.game_over;
+        out.tick = g.ticks;
+        out.ack = acked_[board];
+    }
+
+private:
+    static void step(TetrisGame& game, uint8_t code) {
+        if (code == LOCK_TICK) {
+            game.tick();
+        } else if (code == LOCK_FORFEIT) {
+            game.forfeit();
+        } else {
+            game.handle_input(static_cast<InputAction>(code));
+        }
+    }
+
+    // Fast-forwards a board from the frame's keyframe through its tail, as
+    // fast as it runs; the board is only replaced once all of it checks out
+    bool catch_up(std::string_view frame, int board) {
+        if (frame.size() < 1 + LOCK_STATE_SIZE) return false;
+        TetrisGame game(sequence_);
+        uint32_t events = 0, seq = 0;
+        if (!decode_lockstep_state(frame.data() + 1, game, events, seq)) return false;
+        for (size_t pos = 1 + LOCK_STATE_SIZE; pos < frame.size();) {
+            const uint8_t op = static_cast<uint8_t>(frame[pos++]);
+            const uint8_t code = op & LOCK_CODE_MASK;
+            if (code > LOCK_FORFEIT) return false;
+            uint32_t times = 1;
+            if (op & LOCK_HAS_SEQ) {
+                uint32_t delta = 0;
+                if (!lock_get_varint(frame, pos, delta)) return false;
+                seq += delta;
+            } else if (op & LOCK_RUN) {
+                if (pos >= frame.size()) return false;
+                times += static_cast<uint8_t>(frame[pos++]);
+            }
+            for (uint32_t i = 0; i < times; ++i) step(game, code);
+            events += times;
+        }
+        games_[board] = std::move(game);
+        events_[board] = events;
+        acked_[board] = seq;
+        return true;
+    }
+
+    std::shared_ptr<PieceSequence> sequence_; // both boards draw from it
+    std::optional<TetrisGame> games_[2];
+    uint32_t events_[2] = {};
+    uint32_t acked_[2] = {};
+};
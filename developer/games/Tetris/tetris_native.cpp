@@ -0,0 +1,196 @@
+// CPython extension "tetris_native": TetrisGame (tetris_game.hpp) for server.py.
+//
+//   g = tetris_native.TetrisGame(seed)   two games with one seed get the same pieces
+//   g.tick()                             one gravity step
+//   g.handle_input("LEFT")               LEFT RIGHT DOWN ROTATE ROTATE_CCW DROP HOLD;
+//                                        True if the board changed, unknown actions do nothing
+//   g.snapshot()                         the 200 colour digits of get_board_snapshot()
+//   g.rows()                             20 strings of 10 as server.py sends them
+//   g.next(n=3), g.forfeit()
+//   g.score, g.lines, g.level, g.game_over, g.hold (letter or None), g.generation
+//
+// Scoring is TetrisGame's. Build next to server.py:
+//   g++ -std=c++20 -O2 -shared -fPIC $(python3-config --includes)
+//       -o tetris_native$(python3-config --extension-suffix) tetris_native.cpp
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "tetris_game.hpp"
+
+#include <new>
+
+namespace {
+struct PyTetrisGame {
+    PyObject_HEAD
+    TetrisGame* game;
+};
+
+int game_init(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static const char* kwlist[] = {"seed", nullptr};
+    int seed = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", const_cast<char**>(kwlist), &seed)) return -1;
+    auto* g = reinterpret_cast<PyTetrisGame*>(self);
+    delete g->game;
+    g->game = new (std::nothrow) TetrisGame(seed);
+    if (!g->game) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    return 0;
+}
+
+void game_dealloc(PyObject* self) {
+    delete reinterpret_cast<PyTetrisGame*>(self)->game;
+    Py_TYPE(self)->tp_free(self);
+}
+
+// nullptr (with RuntimeError) for an object whose __init__ never ran
+TetrisGame* game_of(PyObject* self) {
+    TetrisGame* g = reinterpret_cast<PyTetrisGame*>(self)->game;
+    if (!g) PyErr_SetString(PyExc_RuntimeError, "TetrisGame not initialised");
+    return g;
+}
+
+PyObject* game_tick(PyObject* self, PyObject*) {
+    TetrisGame* g = game_of(self);
+    if (!g) return nullptr;
+    g->tick();
+    Py_RETURN_NONE;
+}
+
+PyObject* game_handle_input(PyObject* self, PyObject* arg) {
+    TetrisGame* g = game_of(self);
+    if (!g) return nullptr;
+    Py_ssize_t len = 0;
+    const char* action = PyUnicode_AsUTF8AndSize(arg, &len);
+    if (!action) return nullptr;
+    const uint32_t before = g->generation;
+    g->handle_input(std::string_view(action, static_cast<size_t>(len)));
+    return PyBool_FromLong(g->generation != before);
+}
+
+PyObject* game_forfeit(PyObject* self, PyObject*) {
+    TetrisGame* g = game_of(self);
+    if (!g) return nullptr;
+    g->forfeit();
+    Py_RETURN_NONE;
+}
+
+PyObject* game_snapshot(PyObject* self, PyObject*) {
+    TetrisGame* g = game_of(self);
+    if (!g) return nullptr;
+    char cells[BOARD_ROWS * BOARD_COLS];
+    write_board_chars(cells, g->colors, g->current_piece);
+    return PyUnicode_FromStringAndSize(cells, sizeof(cells));
+}
+
+// A dead board is shown without the piece that no longer fits, as tetris_server does
+PyObject* game_rows(PyObject* self, PyObject*) {
+    TetrisGame* g = game_of(self);
+    if (!g) return nullptr;
+    char cells[BOARD_ROWS * BOARD_COLS];
+    write_board_letters(cells, g->colors, g->game_over ? nullptr : &g->current_piece);
+    PyObject* rows = PyList_New(BOARD_ROWS);
+    if (!rows) return nullptr;
+    for (int r = 0; r < BOARD_ROWS; ++r) {
+        PyObject* row = PyUnicode_FromStringAndSize(cells + r * BOARD_COLS, BOARD_COLS);
+        if (!row) {
+            Py_DECREF(rows);
+            return nullptr;
+        }
+        PyList_SET_ITEM(rows, r, row);
+    }
+    return rows;
+}
+
+PyObject* game_next(PyObject* self, PyObject* args) {
+    TetrisGame* g = game_of(self);
+    int n = 3;
+    if (!g || !PyArg_ParseTuple(args, "|i", &n)) return nullptr;
+    if (n < 0) n = 0;
+    PyObject* out = PyList_New(n);
+    if (!out) return nullptr;
+    for (int i = 0; i < n; ++i) {
+        PyList_SET_ITEM(out, i, PyUnicode_FromStringAndSize(&SHAPE_LETTERS[g->preview(i)], 1));
+    }
+    return out;
+}
+
+PyObject* get_score(PyObject* self, void*) {
+    TetrisGame* g = game_of(self);
+    return g ? PyLong_FromLong(g->score) : nullptr;
+}
+PyObject* get_lines(PyObject* self, void*) {
+    TetrisGame* g = game_of(self);
+    return g ? PyLong_FromLong(g->lines_cleared) : nullptr;
+}
+PyObject* get_level(PyObject* self, void*) {
+    TetrisGame* g = game_of(self);
+    return g ? PyLong_FromLong(g->level()) : nullptr;
+}
+PyObject* get_game_over(PyObject* self, void*) {
+    TetrisGame* g = game_of(self);
+    return g ? PyBool_FromLong(g->game_over) : nullptr;
+}
+PyObject* get_generation(PyObject* self, void*) {
+    TetrisGame* g = game_of(self);
+    return g ? PyLong_FromUnsignedLong(g->generation) : nullptr;
+}
+PyObject* get_hold(PyObject* self, void*) {
+    TetrisGame* g = game_of(self);
+    if (!g) return nullptr;
+    if (g->hold_shape_id < 0) Py_RETURN_NONE;
+    return PyUnicode_FromStringAndSize(&SHAPE_LETTERS[g->hold_shape_id], 1);
+}
+
+PyMethodDef kGameMethods[] = {
+    {"tick", game_tick, METH_NOARGS, "one gravity step"},
+    {"handle_input", game_handle_input, METH_O, "apply an action by name; True if the board changed"},
+    {"forfeit", game_forfeit, METH_NOARGS, "end the game from outside"},
+    {"snapshot", game_snapshot, METH_NOARGS, "200 colour digits, row-major, piece included"},
+    {"rows", game_rows, METH_NOARGS, "20 strings of 10: '.', locked letters, the piece in lowercase"},
+    {"next", game_next, METH_VARARGS, "letters of the next n pieces (default 3)"},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+PyGetSetDef kGameGetters[] = {
+    {"score", get_score, nullptr, nullptr, nullptr},
+    {"lines", get_lines, nullptr, nullptr, nullptr},
+    {"level", get_level, nullptr, nullptr, nullptr},
+    {"game_over", get_game_over, nullptr, nullptr, nullptr},
+    {"generation", get_generation, nullptr, "bumps on every visible change", nullptr},
+    {"hold", get_hold, nullptr, "letter of the held piece, or None", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+PyTypeObject kGameType = [] {
+    PyTypeObject t{};
+    Py_SET_REFCNT(&t, 1);
+    t.tp_name = "tetris_native.TetrisGame";
+    t.tp_basicsize = sizeof(PyTetrisGame);
+    t.tp_flags = Py_TPFLAGS_DEFAULT;
+    t.tp_doc = "TetrisGame(seed): one board of tetris_game.hpp";
+    t.tp_new = PyType_GenericNew;
+    t.tp_init = game_init;
+    t.tp_dealloc = game_dealloc;
+    t.tp_methods = kGameMethods;
+    t.tp_getset = kGameGetters;
+    return t;
+}();
+
+PyModuleDef kModule = {PyModuleDef_HEAD_INIT, "tetris_native", "TetrisGame from tetris_game.hpp", -1, nullptr,
+                       nullptr, nullptr, nullptr, nullptr};
+}
+
+PyMODINIT_FUNC PyInit_tetris_native() {
+    if (PyType_Ready(&kGameType) < 0) return nullptr;
+    PyObject* m = PyModule_Create(&kModule);
+    if (!m) return nullptr;
+    Py_INCREF(&kGameType);
+    if (PyModule_AddObject(m, "TetrisGame", reinterpret_cast<PyObject*>(&kGameType)) < 0) {
+        Py_DECREF(&kGameType);
+        Py_DECREF(m);
+        return nullptr;
+    }
+    return m;
+}
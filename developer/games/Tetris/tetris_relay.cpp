@@ -0,0 +1,80 @@
+// Standalone spectator relay (spectator_relay.hpp), e.g. in a region far from
+// the game servers.
+//
+//   tetris_relay LISTEN_IP PORT UPSTREAM_IP UPSTREAM_PORT [--workers N] [--metrics-port P]
+//       serves binary spectators on LISTEN_IP:PORT. Each match is followed
+//       from UPSTREAM (a lobby's game port, or another relay) over a single
+//       connection, however many viewers it has here. Point the lobby's
+//       "--spectator-relay" at this one to send its spectators here.
+#include "../core/common.hpp"
+#include "hello_gateway.hpp"
+#include "../core/metrics.hpp"
+#include "spectator_relay.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+int main(int argc, char** argv) {
+    if (argc < 5) {
+        std::cerr << "usage: tetris_relay LISTEN_IP PORT UPSTREAM_IP UPSTREAM_PORT [--workers N] [--metrics-port P]\n";
+        return 1;
+    }
+    install_signal_handlers();
+
+    const std::string ip = argv[1];
+    uint16_t port = static_cast<uint16_t>(std::stoi(argv[2]));
+    const std::string upstream_ip = argv[3];
+    const uint16_t upstream_port = static_cast<uint16_t>(std::stoi(argv[4]));
+    size_t workers = 1;
+    int metrics_port = -1;
+    for (int i = 5; i + 1 < argc; i += 2) {
+        const std::string flag = argv[i];
+        if (flag == "--workers") workers = static_cast<size_t>(std::max(0, std::stoi(argv[i + 1])));
+        else if (flag == "--metrics-port") metrics_port = std::stoi(argv[i + 1]);
+        else {
+            std::cerr << "[Relay] unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+
+    SpectatorRelay relay(workers);
+    relay.set_upstream(upstream_ip, upstream_port);
+    HelloGateway gateway;
+    if (!gateway.listen(ip.c_str(), port)) {
+        std::cerr << "[Relay] cannot listen on " << ip << ":" << argv[2] << "\n";
+        return 1;
+    }
+    if (!relay.start()) {
+        std::cerr << "[Relay] cannot start workers\n";
+        return 1;
+    }
+    // Players play upstream; only binary spectators are served here
+    gateway.start([&relay](int fd, const HelloRoute& hello) {
+        if (hello.spectator && hello.binary) relay.adopt(fd, hello.token);
+        else reject_hello(fd);
+    });
+    std::cerr << "[Relay] listening on " << ip << ":" << port << ", following " << upstream_ip << ":"
+              << upstream_port << " with " << relay.worker_count() << " workers\n";
+    log_checkpoint("Relay", "LISTENING", ip + ":" + std::to_string(port));
+
+    MetricsHttpServer metrics_http;
+    if (metrics_port >= 0) {
+        uint16_t mport = static_cast<uint16_t>(metrics_port);
+        if (!metrics_http.start(ip.c_str(), mport)) {
+            std::cerr << "[Relay] cannot open metrics port\n";
+            return 1;
+        }
+    }
+
+    while (running) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    metrics_http.stop();
+    gateway.stop();
+    relay.stop();
+    return 0;
+}
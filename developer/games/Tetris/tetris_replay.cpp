@@ -0,0 +1,333 @@
+// Replays of finished matches from match archives (match_archive.hpp), served
+// to spectators as if the matches were live, with no room kept for them.
+//
+//   tetris_replay --pack OUT TRACE...
+//       packs match traces (the lobby's "--trace-dir") into a new archive OUT
+//   tetris_replay --list ARCHIVE
+//       prints the matches an archive holds, one per line, key first
+//   tetris_replay LISTEN_IP PORT ARCHIVE... [--metrics-port P]
+//       serves binary spectators (HELLO role=SPEC snap=bin2). The HELLO's
+//       token is the match's key, "room<id>-<seed>" as in its trace's name,
+//       and "from=<ms>" starts it that far in. Archives are mapped, not read:
+//       a viewer only costs the block its cursor is in, so thousands of
+//       matches can sit on disk behind one server. Boards go out through the
+//       same SnapshotEncoder and coalescing FrameWriter as a room's, so a
+//       client cannot tell a replay from a match it joined late: WELCOME,
+//       keyframes of both boards, deltas at the pace they were played, and
+//       GAME_OVER at the end.
+#include "../core/common.hpp"
+#include "../core/framed_connection.hpp"
+#include "../core/lp_framing.hpp"
+#include "../core/metrics.hpp"
+#include "../core/reactor.hpp"
+#include "hello_gateway.hpp"
+#include "match_archive.hpp"
+#include "tetris_snapshot.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+constexpr int kCloseDrainMs = 250; // how long a finished viewer gets to take what is queued
+
+struct ReplayMetrics {
+    MetricGauge& viewers = metrics().gauge("replay_viewers", "Spectators watching an archived match");
+    MetricCounter& started = metrics().counter("replay_started_total", "Replays started, by HELLO");
+    MetricCounter& bytes_out = metrics().counter("replay_bytes_out_total", "Bytes queued to replay viewers");
+    MetricCounter& slow_viewers =
+        metrics().counter("replay_slow_viewers_total", "Replay viewers dropped for an overflowing send queue");
+};
+
+ReplayMetrics& replay_metrics() {
+    static ReplayMetrics m;
+    return m;
+}
+
+// One thread plays every viewer's match: each viewer has its own cursor into
+// the archive, and a timer for its next event.
+class ReplayServer {
+public:
+    using Clock = Reactor::Clock;
+
+    explicit ReplayServer(std::vector<std::unique_ptr<MatchArchive>> archives) : archives_(std::move(archives)) {}
+    ~ReplayServer() { stop(); }
+
+    bool start() {
+        if (!reactor_.ok()) return false;
+        thread_ = std::thread([this] { reactor_.run(); });
+        return true;
+    }
+
+    void stop() {
+        if (!thread_.joinable()) return;
+        reactor_.stop();
+        thread_.join();
+        for (auto& [serial, viewer] : viewers_) viewer->conn->close();
+        replay_metrics().viewers.add(-static_cast<int64_t>(viewers_.size()));
+        viewers_.clear();
+    }
+
+    // The archive and match a HELLO's token names, or false
+    bool find(const std::string& token, const MatchArchive*& archive, const ArchivedMatch*& match) const {
+        for (const auto& a : archives_) {
+            if ((match = a->find(token))) {
+                archive = a.get();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Gateway thread: takes a spectator whose HELLO is still unread
+    void adopt(int fd, const MatchArchive* archive, const ArchivedMatch* match) {
+        reactor_.post([this, fd, archive, match] { begin(fd, *archive, *match); });
+    }
+
+private:
+    struct Viewer {
+        uint64_t serial = 0;
+        std::shared_ptr<FramedConnection> conn;
+        std::unique_ptr<ArchiveCursor> cursor; // set once the HELLO is in
+        SnapshotEncoder encoders[2];
+        Clock::time_point origin; // when match time 0 would have been, for this viewer
+        uint64_t timer = 0;       // the next play()
+    };
+
+    // The HELLO arrives as the connection's first frame
+    void begin(int fd, const MatchArchive& archive, const ArchivedMatch& match) {
+        const uint64_t serial = ++serial_;
+        auto on_frame = [this, serial, &archive, &match](FramedConnection&, const std::string& frame) {
+            auto it = viewers_.find(serial);
+            // Viewers have nothing to say to a replay past their HELLO; the rest is dropped
+            if (it != viewers_.end() && !it->second->cursor) hello(*it->second, archive, match, frame);
+        };
+        auto conn = FramedConnection::open(reactor_, fd, on_frame, [this, serial](FramedConnection&) { drop(serial); });
+        if (!conn) return;
+        auto viewer = std::make_unique<Viewer>();
+        viewer->serial = serial;
+        viewer->conn = std::move(conn);
+        viewers_.emplace(serial, std::move(viewer));
+        replay_metrics().viewers.add(1);
+    }
+
+    // Puts the boards where "from=" asks and sends them whole
+    void hello(Viewer& v, const MatchArchive& archive, const ArchivedMatch& match, const std::string& frame) {
+        uint64_t from = 0;
+        const std::string_view field = hello_field(frame, "from");
+        std::from_chars(field.data(), field.data() + field.size(), from);
+        from = std::min(from, match.duration_ms);
+        v.cursor = std::make_unique<ArchiveCursor>(archive, match);
+        if (!v.cursor->seek(from)) {
+            log_message(LogLevel::Warn, "Replay", "damaged archive block in " + match.key());
+            // The HELLO is consumed already, so reject_hello() cannot be used
+            v.conn->send("ERR invalid_player_or_token");
+            finish(v);
+            return;
+        }
+        v.origin = Clock::now() - std::chrono::milliseconds(from);
+        replay_metrics().started.add();
+        const TraceHeader& h = match.header;
+        send(v, "WELCOME role=SPEC seed=" + std::to_string(h.seed) + " gravity=" + std::to_string(h.gravity_ms) +
+                    " bag=7 snap=" + SNAP_BIN_TAG + " replay=" + match.key() + " from=" + std::to_string(from) +
+                    " duration_ms=" + std::to_string(match.duration_ms));
+        for (int b = 0; b < 2; ++b) send_board(v, b);
+        log_checkpoint("Replay", "STARTED", match.key() + " from=" + std::to_string(from));
+        play(v.serial);
+    }
+
+    // Applies the events that are due, sends the boards they touched and
+    // schedules the next; GAME_OVER once there is none
+    void play(uint64_t serial) {
+        auto it = viewers_.find(serial);
+        if (it == viewers_.end()) return;
+        Viewer& v = *it->second;
+        v.timer = 0;
+        const auto now = Clock::now();
+        bool touched[2] = {false, false};
+        uint64_t at = 0;
+        TraceEvent ev;
+        while (v.cursor->peek(at) && v.origin + std::chrono::milliseconds(at) <= now) {
+            v.cursor->next(ev);
+            touched[ev.board] = true;
+        }
+        for (int b = 0; b < 2; ++b) {
+            if (touched[b]) send_board(v, b);
+        }
+        if (!v.conn->is_open()) return; // dropped as a slow viewer; on_close reaps it
+        if (v.cursor->peek(at)) {
+            v.timer = reactor_.at(v.origin + std::chrono::milliseconds(at), [this, serial] { play(serial); });
+            return;
+        }
+        send(v, "GAME_OVER p1_score=" + std::to_string(v.cursor->game(0).score) +
+                    " p2_score=" + std::to_string(v.cursor->game(1).score));
+        finish(v);
+    }
+
+    void send_board(Viewer& v, int board) {
+        const ArchivedMatch& m = v.cursor->match();
+        std::string body;
+        const bool key = v.encoders[board].encode_into(body, v.cursor->game(board), static_cast<uint8_t>(board),
+                                                       m.header.names[board], 0);
+        enqueue(v, lp_prepare_frame(body), board, key);
+    }
+
+    void send(Viewer& v, const std::string& line) { enqueue(v, lp_prepare_frame(line), -1, true); }
+
+    void enqueue(Viewer& v, LpFrame frame, int board, bool self_contained) {
+        if (!v.conn->is_open()) return;
+        const size_t bytes = frame->size();
+        switch (v.conn->send_frame(std::move(frame), board, self_contained)) {
+        case FrameWriter::EnqueueResult::Overflow:
+            replay_metrics().slow_viewers.add();
+            return;
+        case FrameWriter::EnqueueResult::Skipped:
+            // Behind: the next frame of that board is a keyframe, which coalesces
+            v.encoders[board].force_keyframe();
+            return;
+        default:
+            replay_metrics().bytes_out.add(bytes);
+        }
+    }
+
+    // The viewer is done: what is queued still goes out, for a while
+    void finish(Viewer& v) {
+        v.conn->close_after_flush(kCloseDrainMs);
+        drop(v.serial);
+    }
+
+    void drop(uint64_t serial) {
+        auto it = viewers_.find(serial);
+        if (it == viewers_.end()) return;
+        if (it->second->timer) reactor_.cancel(it->second->timer);
+        viewers_.erase(it);
+        replay_metrics().viewers.add(-1);
+    }
+
+    std::vector<std::unique_ptr<MatchArchive>> archives_;
+    Reactor reactor_;
+    std::thread thread_;
+    // Reactor thread only
+    std::unordered_map<uint64_t, std::unique_ptr<Viewer>> viewers_;
+    uint64_t serial_ = 0;
+};
+
+int pack(const std::string& out, const std::vector<std::string>& traces) {
+    MatchArchiveWriter writer;
+    if (!writer.open(out)) {
+        std::cerr << "[Replay] cannot write " << out << "\n";
+        return 1;
+    }
+    size_t raw = 0;
+    for (const std::string& path : traces) {
+        std::ifstream in(path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (!writer.add(data)) {
+            std::cerr << "[Replay] not a match trace, skipped: " << path << "\n";
+            continue;
+        }
+        raw += data.size();
+    }
+    if (!writer.finish()) {
+        std::cerr << "[Replay] cannot write " << out << "\n";
+        return 1;
+    }
+    std::cout << "packed " << writer.matches() << " matches, " << raw << " trace bytes into " << writer.bytes()
+              << " (plus the index)\n";
+    return 0;
+}
+
+int list(const std::string& path) {
+    MatchArchive archive;
+    if (!archive.open(path)) {
+        std::cerr << "[Replay] not a match archive: " << path << "\n";
+        return 1;
+    }
+    for (const ArchivedMatch& m : archive.matches()) {
+        std::cout << m.key() << " " << m.header.names[0] << " vs " << m.header.names[1]
+                  << " start=" << m.header.start_unix_ms << " duration_ms=" << m.duration_ms
+                  << " blocks=" << m.blocks.size() << (m.complete ? "" : " (cut short)") << "\n";
+    }
+    return 0;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc >= 3 && std::string(argv[1]) == "--pack") {
+        return pack(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+    }
+    if (argc == 3 && std::string(argv[1]) == "--list") return list(argv[2]);
+    if (argc < 4) {
+        std::cerr << "usage: tetris_replay LISTEN_IP PORT ARCHIVE... [--metrics-port P]\n"
+                     "       tetris_replay --pack OUT TRACE...\n"
+                     "       tetris_replay --list ARCHIVE\n";
+        return 1;
+    }
+    install_signal_handlers();
+
+    const std::string ip = argv[1];
+    uint16_t port = static_cast<uint16_t>(std::stoi(argv[2]));
+    int metrics_port = -1;
+    std::vector<std::unique_ptr<MatchArchive>> archives;
+    size_t matches = 0;
+    for (int i = 3; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--metrics-port" && i + 1 < argc) {
+            metrics_port = std::stoi(argv[++i]);
+            continue;
+        }
+        auto archive = std::make_unique<MatchArchive>();
+        if (!archive->open(arg)) {
+            std::cerr << "[Replay] not a match archive: " << arg << "\n";
+            return 1;
+        }
+        matches += archive->matches().size();
+        archives.push_back(std::move(archive));
+    }
+
+    ReplayServer server(std::move(archives));
+    HelloGateway gateway;
+    if (!gateway.listen(ip.c_str(), port)) {
+        std::cerr << "[Replay] cannot listen on " << ip << ":" << argv[2] << "\n";
+        return 1;
+    }
+    if (!server.start()) {
+        std::cerr << "[Replay] cannot start\n";
+        return 1;
+    }
+    gateway.start([&server](int fd, const HelloRoute& hello) {
+        const MatchArchive* archive = nullptr;
+        const ArchivedMatch* match = nullptr;
+        if (hello.spectator && hello.binary && server.find(hello.token, archive, match)) {
+            server.adopt(fd, archive, match);
+        } else {
+            reject_hello(fd);
+        }
+    });
+    std::cerr << "[Replay] listening on " << ip << ":" << port << " with " << matches << " archived matches\n";
+    log_checkpoint("Replay", "LISTENING", ip + ":" + std::to_string(port) + " matches=" + std::to_string(matches));
+
+    MetricsHttpServer metrics_http;
+    if (metrics_port >= 0) {
+        uint16_t mport = static_cast<uint16_t>(metrics_port);
+        if (!metrics_http.start(ip.c_str(), mport)) {
+            std::cerr << "[Replay] cannot open metrics port\n";
+            return 1;
+        }
+    }
+
+    while (running) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    metrics_http.stop();
+    gateway.stop();
+    server.stop();
+    return 0;
+}
@@ -1,15 +1,33 @@
 #include "tetris_runtime.hpp"
 
-#include "common.hpp"
-#include "lp_framing.hpp"
+#include "../core/common.hpp"
+#include "db_client.hpp"
+#include "hello_gateway.hpp"
+#include "../core/lp_framing.hpp"
+#include "../core/metrics.hpp"
+#include "result_outbox.hpp"
+#include "server_config.hpp"
+#include "spectator_relay.hpp"
 #include "tetris_game.hpp"
+#include "tetris_lockstep.hpp"
+#include "tetris_snapshot.hpp"
+#include "udp_channel.hpp"
 
+#include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
-#include <set>
+#include <random>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -17,278 +35,1142 @@
 
 namespace {
 
-bool tetris_db_req(const std::string& db_ip, uint16_t db_port, const std::string& cmd, std::string& reply) {
-    int fd = connect_tcp(db_ip, db_port);
-    if (fd < 0) {
+// One pipelined client per DB address, shared by every room (and thread) of the
+// process, so ending a match costs no TCP handshake. One whose connection is
+// gone is replaced by a fresh client rather than reconnected in place: other
+// threads may still be inside its submit(), and it lives until they let go.
+constexpr size_t kDbPoolConnections = 2;
+
+std::shared_ptr<DbClient> tetris_db_client(const std::string& db_ip, uint16_t db_port) {
+    static std::mutex pool_mutex;
+    static std::map<std::string, std::shared_ptr<DbClient>> pool;
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    auto& client = pool[db_ip + ":" + std::to_string(db_port)];
+    if (client && client->connected()) return client;
+    auto fresh = std::make_shared<DbClient>("Tetris");
+    if (!fresh->connect(db_ip, db_port, kDbPoolConnections)) {
         log_checkpoint("Tetris", "DB_CONNECT_FAIL", db_ip + ":" + std::to_string(db_port));
-        return false;
-    }
-    const std::string peer = "db:" + db_ip + ":" + std::to_string(db_port);
-    log_communication("Tetris", "TX", peer, cmd);
-    bool ok = lp_send_frame(fd, cmd);
-    if (ok) {
-        ok = lp_recv_frame(fd, reply);
-        if (ok) {
-            log_communication("Tetris", "RX", peer, reply);
-        }
+        return nullptr;
     }
-    ::close(fd);
+    client = std::move(fresh);
+    return client;
+}
+
+bool tetris_db_req(const std::string& db_ip, uint16_t db_port, const std::string& cmd, std::string& reply) {
+    std::shared_ptr<DbClient> db = tetris_db_client(db_ip, db_port);
+    bool ok = db && db->call(cmd, reply);
     if (!ok) {
         log_checkpoint("Tetris", "DB_REQ_FAIL", cmd);
     }
     return ok;
 }
 
+// Results of rooms with no finished_cb (the standalone server) leave through an
+// outbox per DB address, tetris_results_<port>.outbox in the working directory;
+// nullptr if it cannot be opened
+ResultOutbox* tetris_result_outbox(const std::string& db_ip, uint16_t db_port) {
+    // The client pool's statics first: destroyed after the outboxes, whose
+    // stop() still sends through them
+    tetris_db_client(db_ip, db_port);
+    static std::mutex outbox_mutex;
+    static std::map<std::string, std::unique_ptr<ResultOutbox>> outboxes;
+    std::lock_guard<std::mutex> lock(outbox_mutex);
+    auto& outbox = outboxes[db_ip + ":" + std::to_string(db_port)];
+    if (outbox) return outbox.get();
+    outbox = std::make_unique<ResultOutbox>();
+    auto submit = [db_ip, db_port](const std::string& request) {
+        if (std::shared_ptr<DbClient> db = tetris_db_client(db_ip, db_port)) return db->submit(request);
+        std::promise<DbReply> unreachable;
+        unreachable.set_value(DbReply{});
+        return unreachable.get_future();
+    };
+    if (!outbox->start("tetris_results_" + std::to_string(db_port) + ".outbox", submit)) outbox.reset();
+    return outbox.get();
+}
+
 std::string peer_desc(int fd) {
     return "socket fd=" + std::to_string(fd);
 }
 
-bool tetris_send_frame(int fd, const std::string& msg) {
-    log_communication("Tetris", "TX", peer_desc(fd), msg);
-    return lp_send_frame(fd, msg);
+uint64_t new_session_key() {
+    thread_local std::mt19937_64 rng{std::random_device{}()};
+    return rng();
 }
 
-bool tetris_recv_frame(int fd, std::string& out) {
-    bool ok = lp_recv_frame(fd, out);
-    if (ok) {
-        log_communication("Tetris", "RX", peer_desc(fd), out);
-    }
-    return ok;
+std::string new_resume_token() {
+    char buf[17];
+    std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(new_session_key()));
+    return buf;
 }
 
-void broadcast(const std::vector<int>& fds, const std::string& msg) {
-    for (int fd : fds) {
-        if (fd >= 0) {
-            tetris_send_frame(fd, msg);
-        }
-    }
+std::string describe_frame(const std::string& msg) {
+    if (is_lockstep_event(msg)) return "LOCKSTEP op=" + std::to_string(static_cast<uint8_t>(msg[0])) +
+                                       " bytes=" + std::to_string(msg.size());
+    return is_binary_snapshot(msg) ? describe_binary_snapshot(msg) : msg;
 }
 
-struct Player {
-    std::string name;
-    int fd = -1;
-    bool authed = false;
-    std::unique_ptr<TetrisGame> game;
+// Sends are queued and never block the reactor; when a room ends or turns a
+// client away, whatever is still queued gets this long to reach the peer while
+// the driver flushes it (TetrisRoom::take_lingering()).
+constexpr int kFinishDrainMs = 250;
+
+// The tunables below are read from server_config() (server_config.hpp), so
+// they can change under a running server:
+// - snapshot_heartbeat_ms: a board that has not changed is not re-sent on its
+//   gravity tick, except this often, so viewers of a frozen board still hear
+//   that the room is alive
+// - player_/spectator_frame_rate and _burst: frames per second a connection
+//   may send, and how many at once. A player's come in bursts of one
+//   placement's moves; a spectator only says HELLO and, in lockstep, the odd
+//   SUM. Frames over budget are dropped before they are parsed or logged, and
+//   a connection that drops kFloodFrames more than its budget allows is cut off.
+// - inputs_per_tick: inputs a board takes one by one between two of its
+//   gravity steps; later moves are folded together (net sideways shift, last
+//   rotation, one DOWN) and applied once at the end of the read batch, before
+//   the POSE that acks them, so an ack never covers a move that was dropped
+// - overload_late_ms: when gravity steps run this late on average, the room
+//   (or the worker thread it shares) is behind, and spectator HELLOs are
+//   refused until it catches up
+// - write_high_water, write_hard_limit: a connection's send queue, see FrameWriter
+constexpr double kFloodFrames = 1000;
+
+// Shared by every room in the process; see metrics.hpp
+struct RoomMetrics {
+    LatencyHistogram& tick = metrics().histogram("tetris_tick_seconds", "Gravity step of one board, broadcast included");
+    LatencyHistogram& tick_lateness =
+        metrics().histogram("tetris_tick_lateness_seconds", "How long after its deadline a gravity step ran");
+    LatencyHistogram& broadcast =
+        metrics().histogram("tetris_broadcast_seconds", "Encoding one board and queueing it to every viewer");
+    MetricCounter& bytes_out = metrics().counter("tetris_bytes_out_total", "Bytes queued to game clients");
+    LatencyHistogram& room_bytes_out = metrics().histogram(
+        "tetris_room_bytes_out", "Bytes queued to the clients of one match, over its lifetime", {}, MetricUnit::Bytes);
+    MetricCounter& slow_clients =
+        metrics().counter("tetris_slow_clients_total", "Game clients dropped for an overflowing send queue");
+    MetricCounter& matches = metrics().counter("tetris_matches_finished_total", "Matches finished or cut short");
+    MetricCounter& udp_in = metrics().counter("tetris_udp_datagrams_in_total", "Datagrams taken from game clients");
+    MetricCounter& udp_out = metrics().counter("tetris_udp_datagrams_out_total", "Datagrams sent to game clients");
+    MetricCounter& udp_inputs_repeated =
+        metrics().counter("tetris_udp_inputs_repeated_total", "Inputs that came again in a later datagram");
+    MetricCounter& lockstep_sums =
+        metrics().counter("tetris_lockstep_sums_total", "Board hashes from lockstep clients checked");
+    MetricCounter& lockstep_desyncs =
+        metrics().counter("tetris_lockstep_desyncs_total", "Lockstep clients whose board hash disagreed");
+    MetricCounter& lockstep_catchups =
+        metrics().counter("tetris_lockstep_catchups_total", "Lockstep viewers let in mid-match from the event log");
+    MetricCounter& frames_shed =
+        metrics().counter("tetris_frames_shed_total", "Frames from game clients dropped over their rate limit");
+    MetricCounter& inputs_capped =
+        metrics().counter("tetris_inputs_capped_total", "Inputs over a board's per-tick cap, folded into one net move");
+    MetricCounter& flooders = metrics().counter("tetris_flooders_total", "Game clients cut off for flooding");
+    MetricCounter& spectators_shed =
+        metrics().counter("tetris_spectators_shed_total", "Spectator HELLOs refused while the room ran late");
 };
 
+RoomMetrics& room_metrics() {
+    static RoomMetrics m;
+    return m;
+}
+
 } // namespace
 
-void run_tetris_server_on_fd(int listen_fd,
-                             const std::string& p1_name,
-                             const std::string& p2_name,
-                             const std::string& db_ip,
-                             uint16_t db_port,
-                             int room_id,
-                             const std::string& expected_token,
-                             GameRegistry* registry,
-                             GameFinishedCallback finished_cb)
-{
-    Player players[2];
-    players[0].name = p1_name;
-    players[1].name = p2_name;
+TetrisRoom::TetrisRoom(TetrisRoomConfig cfg) : cfg_(std::move(cfg)) {
+    players_[0].name = cfg_.p1_name;
+    players_[1].name = cfg_.p2_name;
+    game_seed_ = std::chrono::system_clock::now().time_since_epoch().count();
+    if (cfg_.relay) {
+        relay_channel_ = cfg_.relay->open(cfg_.expected_token, "WELCOME role=SPEC seed=" + std::to_string(game_seed_) +
+                                                                   " gravity=" + std::to_string(cfg_.gravity_ms) +
+                                                                   " bag=7 snap=" + SNAP_BIN_TAG);
+    }
+    if (cfg_.udp) {
+        udp_fd_ = start_udp_socket("0.0.0.0", udp_port_);
+        if (udp_fd_ < 0) log_checkpoint("Tetris", "UDP_UNAVAILABLE", "room=" + std::to_string(cfg_.room_id));
+    }
+}
 
-    std::map<int, int> fd_to_player_idx;
-    std::set<int> spectator_fds;
-    std::map<int, std::string> spectator_names;
-    std::vector<pollfd> pfds;
-    pfds.push_back({listen_fd, POLLIN, 0});
+TetrisRoom::~TetrisRoom() {
+    for (Linger& l : lingering_) ::close(l.fd); // no driver took them
+    std::pmr::polymorphic_allocator<TetrisGame> alloc(&arena_);
+    for (Player& pl : players_) {
+        if (pl.game) alloc.delete_object(pl.game);
+    }
+}
 
-    int authed_players = 0;
-    long game_seed = std::chrono::system_clock::now().time_since_epoch().count();
+int TetrisRoom::on_accept() {
+    if (finished_ || cfg_.listen_fd < 0) return -1;
+    int cfd = ::accept(cfg_.listen_fd, nullptr, nullptr);
+    if (cfd >= 0) adopt_client(cfd);
+    return cfd;
+}
 
-    auto last_tick = std::chrono::steady_clock::now();
-    bool game_started = false;
+bool TetrisRoom::adopt_client(int cfd) {
+    if (finished_) return false;
+    // POSE acks are tiny and must not sit behind Nagle waiting for an ACK
+    int one = 1;
+    ::setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (static_cast<size_t>(cfd) >= conns_.size()) conns_.resize(cfd + 1);
+    conns_[cfd] = Conn();
+    conns_[cfd].open = true;
+    const ServerConfig& tun = server_config();
+    conns_[cfd].writer = FrameWriter(tun.write_high_water, tun.write_hard_limit);
+    conns_[cfd].frames.reset(tun.player_frame_rate, tun.player_frame_burst);
+    conns_[cfd].flood.reset(tun.player_frame_rate, kFloodFrames);
+    log_checkpoint("Tetris", "CLIENT_CONNECTED", peer_desc(cfd));
+    return true;
+}
 
-    while (running) {
-        int rc = ::poll(pfds.data(), pfds.size(), 100);
-        if (rc < 0) {
-            if (errno == EINTR) continue;
-            perror("[Tetris] poll");
+void TetrisRoom::drop_connection(int cfd) {
+    Conn* c = conn(cfd);
+    if (!c) return;
+    std::string who = peer_desc(cfd);
+    const int p_idx = c->player;
+    if (c->spectator) who += " spec=" + c->name;
+    close_conn(cfd);
+    int away_idx = -1;
+    if (p_idx >= 0) {
+        if (!game_started_) {
+            players_[p_idx].authed = false;
+            if (authed_players_ > 0) --authed_players_;
+        } else if (players_[p_idx].game && !match_over_ && cfg_.resume_grace_ms > 0) {
+            // Keep the seat: the board freezes until they resume or the grace runs out
+            players_[p_idx].away = true;
+            players_[p_idx].away_since = std::chrono::steady_clock::now();
+            away_idx = p_idx;
+        } else if (players_[p_idx].game) {
+            players_[p_idx].game->forfeit();
+            trace_.forfeit(p_idx);
+            lockstep_event(p_idx, LOCK_FORFEIT);
+        }
+        players_[p_idx].fd = -1;
+        who += " player=" + players_[p_idx].name;
+    }
+    log_checkpoint("Tetris", "CLIENT_DISCONNECTED", who);
+    if (away_idx >= 0) {
+        log_checkpoint("Tetris", "PLAYER_AWAY", "user=" + players_[away_idx].name +
+                                                   " grace_ms=" + std::to_string(cfg_.resume_grace_ms));
+        announce("PLAYER_AWAY user=" + players_[away_idx].name + " grace_ms=" + std::to_string(cfg_.resume_grace_ms));
+    }
+}
+
+void TetrisRoom::expire_away_players() {
+    if (match_over_) return;
+    const auto now = std::chrono::steady_clock::now();
+    bool expired = false;
+    for (int i = 0; i < kBoards; ++i) {
+        Player& pl = players_[i];
+        if (!pl.away || now - pl.away_since < std::chrono::milliseconds(cfg_.resume_grace_ms)) continue;
+        pl.away = false;
+        pl.game->forfeit();
+        trace_.forfeit(i);
+        lockstep_event(i, LOCK_FORFEIT);
+        log_checkpoint("Tetris", "RESUME_EXPIRED", "user=" + pl.name);
+        expired = true;
+    }
+    if (expired) update_match_state();
+}
+
+bool TetrisRoom::on_readable(int cfd) {
+    Conn* c = conn(cfd);
+    if (!c) return false; // already dropped by a failed send
+    if (finished_) return true;
+    size_t count = 0;
+    FrameReader::ReadResult st = c->reader.read_from(cfd, rx_frames_, count);
+    const auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        if (!c->frames.take(now)) {
+            room_metrics().frames_shed.add();
+            if (c->flood.take(now)) continue;
+            room_metrics().flooders.add();
+            log_checkpoint("Tetris", "CLIENT_FLOODING", peer_desc(cfd));
+            drop_connection(cfd);
             break;
         }
+        const std::string& req = rx_frames_[i];
+        log_communication_lazy("Tetris", "RX", [&] { return peer_desc(cfd); }, req);
+        handle_frame(cfd, req);
+        if (finished_ || !conn(cfd)) break;
+    }
+    if (!finished_) ack_inputs();
+    if (st != FrameReader::ReadResult::Ok) drop_connection(cfd);
+    update_match_state();
+    return conn(cfd) != nullptr;
+}
 
-        if (listen_fd >= 0 && (pfds[0].revents & POLLIN)) {
-            int cfd = ::accept(listen_fd, nullptr, nullptr);
-            if (cfd >= 0) {
-                pfds.push_back({cfd, POLLIN, 0});
-                log_checkpoint("Tetris", "CLIENT_CONNECTED", peer_desc(cfd));
-            }
+// Inputs come as binary commands or as text (tetris_command.hpp); both are
+// read in place, without copying the frame apart
+void TetrisRoom::handle_frame(int cfd, const std::string& req) {
+    InputCommand in;
+    if (is_binary_command(req)) {
+        if (decode_input_command(req, in)) apply_input(cfd, in);
+    } else if (parse_text_input(req, in)) {
+        apply_input(cfd, in);
+    } else if (req.rfind("HELLO", 0) == 0) {
+        handle_hello(cfd, req);
+    } else if (req.rfind("SUM ", 0) == 0) {
+        check_sum(cfd, req);
+    }
+}
+
+void TetrisRoom::apply_input(int cfd, const InputCommand& in) {
+    const Conn* c = conn(cfd);
+    if (!game_started_ || !c || c->player < 0) return;
+    const int p_idx = c->player;
+    Player& pl = players_[p_idx];
+    if (in.seq) {
+        pl.input_seq = in.seq;
+        pl.sequenced = true;
+    }
+    if (in.t) pl.input_t = in.t;
+    pl.pose_due = pl.sequenced;
+    if (pl.tick_inputs >= server_config().inputs_per_tick) {
+        room_metrics().inputs_capped.add();
+        Player::Excess& ex = pl.excess;
+        switch (in.action) {
+        case INPUT_LEFT:
+            ex.shift = static_cast<int8_t>(std::max(ex.shift - 1, -BOARD_COLS));
+            return;
+        case INPUT_RIGHT:
+            ex.shift = static_cast<int8_t>(std::min(ex.shift + 1, BOARD_COLS));
+            return;
+        case INPUT_DOWN:
+            ex.down = true;
+            return;
+        case INPUT_ROTATE:
+        case INPUT_ROTATE_CCW:
+            ex.rotate = static_cast<int8_t>(in.action);
+            return;
+        default:
+            // DROP and HOLD change the piece, so they cannot be folded: what
+            // was folded so far goes first, in order
+            apply_excess(p_idx);
         }
+    } else {
+        ++pl.tick_inputs;
+    }
+    play_input(p_idx, in.action, in.seq);
+}
 
-        for (size_t i = 1; i < pfds.size(); ++i) {
-            if (!(pfds[i].revents & POLLIN)) continue;
-
-            int cfd = pfds[i].fd;
-            std::string req;
-            if (!tetris_recv_frame(cfd, req)) {
-                std::string who = peer_desc(cfd);
-                ::close(cfd);
-                pfds.erase(pfds.begin() + i);
-                if (fd_to_player_idx.count(cfd)) {
-                    int p_idx = fd_to_player_idx[cfd];
-                    if (!game_started) {
-                        players[p_idx].authed = false;
-                        if (authed_players > 0) --authed_players;
-                    } else if (players[p_idx].game) {
-                        players[p_idx].game->game_over = true;
-                    }
-                    players[p_idx].fd = -1;
-                    fd_to_player_idx.erase(cfd);
-                    who += " player=" + players[p_idx].name;
-                } else {
-                    auto sit = spectator_names.find(cfd);
-                    if (sit != spectator_names.end()) {
-                        who += " spec=" + sit->second;
-                    }
-                    spectator_fds.erase(cfd);
-                    spectator_names.erase(cfd);
-                }
-                --i;
-                log_checkpoint("Tetris", "CLIENT_DISCONNECTED", who);
-                continue;
-            }
+void TetrisRoom::play_input(int p_idx, InputAction action, uint32_t seq) {
+    trace_.input(p_idx, action);
+    {
+        TRACE_SCOPE("handle_input");
+        players_[p_idx].game->handle_input(action);
+    }
+    lockstep_event(p_idx, action, seq);
+}
 
-            std::istringstream iss(req);
-            std::string cmd;
-            iss >> cmd;
-
-            if (cmd == "HELLO") {
-                std::string kv, uname, token, role_param;
-                while (iss >> kv) {
-                    auto pos = kv.find('=');
-                    if (pos == std::string::npos) continue;
-                    std::string key = kv.substr(0, pos);
-                    std::string val = kv.substr(pos + 1);
-                    if (key == "username") uname = val;
-                    else if (key == "token") token = val;
-                    else if (key == "role") role_param = val;
-                }
+// The folded moves as at most one rotation, BOARD_COLS shifts and one DOWN
+void TetrisRoom::apply_excess(int p_idx) {
+    Player& pl = players_[p_idx];
+    const Player::Excess ex = pl.excess;
+    pl.excess = {};
+    if (ex.rotate >= 0) play_input(p_idx, static_cast<InputAction>(ex.rotate), pl.input_seq);
+    for (int i = 0; i < std::abs(ex.shift); ++i) {
+        play_input(p_idx, ex.shift < 0 ? INPUT_LEFT : INPUT_RIGHT, pl.input_seq);
+    }
+    if (ex.down) play_input(p_idx, INPUT_DOWN, pl.input_seq);
+}
 
-                bool handled = false;
-                bool wants_spec = (role_param == "SPEC");
-
-                if (token == expected_token) {
-                    if (!wants_spec && uname == players[0].name && !players[0].authed) {
-                        players[0].fd = cfd;
-                        players[0].authed = true;
-                        fd_to_player_idx[cfd] = 0;
-                        authed_players++;
-                        tetris_send_frame(cfd, "WELCOME role=P1 seed=" + std::to_string(game_seed) + " gravity=500 bag=7");
-                        log_checkpoint("Tetris", "HELLO_ACCEPTED", "user=" + uname + " role=P1");
-                        handled = true;
-                    } else if (!wants_spec && uname == players[1].name && !players[1].authed) {
-                        players[1].fd = cfd;
-                        players[1].authed = true;
-                        fd_to_player_idx[cfd] = 1;
-                        authed_players++;
-                        tetris_send_frame(cfd, "WELCOME role=P2 seed=" + std::to_string(game_seed) + " gravity=500 bag=7");
-                        log_checkpoint("Tetris", "HELLO_ACCEPTED", "user=" + uname + " role=P2");
-                        handled = true;
-                    } else {
-                        spectator_fds.insert(cfd);
-                        spectator_names[cfd] = uname;
-                        tetris_send_frame(cfd, "WELCOME role=SPEC seed=" + std::to_string(game_seed) + " gravity=500 bag=7");
-                        log_checkpoint("Tetris", "HELLO_ACCEPTED", "user=" + uname + " role=SPEC");
-                        handled = true;
-                    }
-                }
+bool TetrisRoom::overloaded() const {
+    return lateness_ms_ > server_config().overload_late_ms;
+}
 
-                if (!handled) {
-                    tetris_send_frame(cfd, "ERR invalid_player_or_token");
-                    log_checkpoint("Tetris", "HELLO_REJECTED",
-                                   "user=" + (!uname.empty() ? uname : "unknown") + " reason=bad_token");
-                    ::close(cfd);
-                    pfds.erase(pfds.begin() + i);
-                    --i;
-                }
-            } else if (cmd == "INPUT") {
-                if (game_started && fd_to_player_idx.count(cfd)) {
-                    int p_idx = fd_to_player_idx[cfd];
-                    std::string action;
-                    iss >> action;
-                    players[p_idx].game->handle_input(action);
-                }
+void TetrisRoom::lockstep_event(int board, uint8_t code, uint32_t seq) {
+    lock_logs_[board].record(*players_[board].game, code, seq);
+    const uint32_t n = lock_logs_[board].events();
+    const std::vector<int>& fds = viewers_[2];
+    if (fds.empty()) return;
+    if (n % LOCK_SUM_EVERY == 0) {
+        lock_checks_[board][(n / LOCK_SUM_EVERY) % kLockChecks] = LockCheck{n, lockstep_hash(*players_[board].game)};
+    }
+    send_prepared_to_all(fds, lp_build_frame([&](std::string& out) { encode_lockstep_event(out, board, code, seq); }),
+                         -1, true);
+}
+
+void TetrisRoom::check_sum(int cfd, std::string_view sum) {
+    const Conn* c = conn(cfd);
+    if (!c || !c->lockstep) return;
+    const uint32_t board = command_digits(hello_field(sum, "board"));
+    const uint32_t n = command_digits(hello_field(sum, "n"));
+    if (board >= kBoards) return;
+    const LockCheck& check = lock_checks_[board][(n / LOCK_SUM_EVERY) % kLockChecks];
+    if (n == 0 || check.n != n) return; // not a checkpoint, or one too old to check
+    const std::string_view h = hello_field(sum, "h");
+    uint64_t theirs = 0;
+    std::from_chars(h.data(), h.data() + h.size(), theirs, 16);
+    room_metrics().lockstep_sums.add();
+    if (theirs == check.hash) return;
+    room_metrics().lockstep_desyncs.add();
+    log_checkpoint("Tetris", "LOCKSTEP_DESYNC",
+                   peer_desc(cfd) + " board=" + std::to_string(board) + " n=" + std::to_string(n));
+    end_lockstep(cfd, "desync");
+}
+
+void TetrisRoom::end_lockstep(int cfd, const char* reason) {
+    Conn* c = conn(cfd);
+    if (!c || !c->lockstep) return;
+    remove_viewer(cfd);
+    c->lockstep = false;
+    add_viewer(cfd);
+    send_frame(cfd, std::string("LOCKSTEP_OFF reason=") + reason);
+    // The shared binary stream starts over from keyframes, for everyone on it
+    for (int b = 0; b < kBoards; ++b) {
+        encoders_[b].force_keyframe();
+        if (players_[b].game) broadcast_board(b);
+    }
+}
+
+void TetrisRoom::handle_hello(int cfd, std::string_view hello) {
+    const std::string uname(hello_field(hello, "username"));
+    const std::string_view token = hello_field(hello, "token");
+    const std::string_view resume_param = hello_field(hello, "resume");
+
+    bool handled = false;
+    bool wants_spec = hello_field(hello, "role") == "SPEC";
+    bool wants_bin = hello_field(hello, "snap") == SNAP_BIN_TAG;
+    // Datagrams only carry binary keyframes
+    // Lockstep replaces the snapshots a datagram session would carry; a
+    // connection let in mid-match is caught up from lock_logs_ first
+    const bool lockstep = wants_bin && hello_field(hello, "lockstep") == LOCK_TAG &&
+                          token == cfg_.expected_token && resume_param.empty();
+    const bool wants_udp =
+        wants_bin && !lockstep && hello_field(hello, "udp") == "1" && token == cfg_.expected_token;
+    const std::string welcome_params =
+        " seed=" + std::to_string(game_seed_) + " gravity=" + std::to_string(cfg_.gravity_ms) +
+        " bag=7 cmd=" + CMD_BIN_TAG + (wants_bin ? std::string(" snap=") + SNAP_BIN_TAG : std::string()) +
+        (lockstep ? std::string(" lockstep=") + LOCK_TAG + " p1=" + players_[0].name + " p2=" + players_[1].name
+                  : std::string()) +
+        (wants_udp ? open_udp(cfd) : std::string());
+
+    if (token == cfg_.expected_token && !wants_spec && !resume_param.empty()) {
+        for (int i = 0; i < kBoards; ++i) {
+            if (players_[i].away && uname == players_[i].name && resume_param == players_[i].resume_token) {
+                resume_player(cfd, i, wants_bin, welcome_params);
+                return;
             }
         }
+    }
 
-        if (!game_started && authed_players == 2) {
-            players[0].game = std::make_unique<TetrisGame>(game_seed);
-            players[1].game = std::make_unique<TetrisGame>(game_seed);
-            game_started = true;
-            last_tick = std::chrono::steady_clock::now();
-            log_checkpoint("Tetris", "MATCH_STARTED",
-                           "room=" + std::to_string(room_id) + " seed=" + std::to_string(game_seed));
+    // Players get a token to resume with should their connection drop mid-match
+    auto player_welcome = [&](int p_idx) {
+        std::string msg = "WELCOME role=P" + std::to_string(p_idx + 1) + welcome_params;
+        if (cfg_.resume_grace_ms > 0) {
+            players_[p_idx].resume_token = new_resume_token();
+            msg += " resume=" + players_[p_idx].resume_token + " resume_ms=" + std::to_string(cfg_.resume_grace_ms);
         }
+        return msg;
+    };
 
-        if (game_started) {
-            auto now = std::chrono::steady_clock::now();
-            std::vector<int> conns;
-            if (players[0].fd >= 0) conns.push_back(players[0].fd);
-            if (players[1].fd >= 0) conns.push_back(players[1].fd);
-            for (int fd : spectator_fds) {
-                if (fd >= 0) conns.push_back(fd);
-            }
+    if (token == cfg_.expected_token) {
+        Conn& c = conns_[cfd];
+        remove_viewer(cfd); // a second HELLO on the same connection starts over
+        c.binary = wants_bin;
+        c.lockstep = lockstep;
+        if (!wants_spec && uname == players_[0].name && !players_[0].authed) {
+            players_[0].fd = cfd;
+            players_[0].authed = true;
+            c.player = 0;
+            authed_players_++;
+            send_frame(cfd, player_welcome(0));
+            log_checkpoint("Tetris", "HELLO_ACCEPTED", "user=" + uname + " role=P1");
+        } else if (!wants_spec && uname == players_[1].name && !players_[1].authed) {
+            players_[1].fd = cfd;
+            players_[1].authed = true;
+            c.player = 1;
+            authed_players_++;
+            send_frame(cfd, player_welcome(1));
+            log_checkpoint("Tetris", "HELLO_ACCEPTED", "user=" + uname + " role=P2");
+        } else if (overloaded()) {
+            // Spectators are shed first, so the players' boards keep their pace
+            room_metrics().spectators_shed.add();
+            send_frame(cfd, "ERR busy");
+            log_checkpoint("Tetris", "HELLO_REJECTED", "user=" + uname + " reason=busy");
+            c.writer.drain(cfd, 0);
+            close_conn(cfd);
+            return;
+        } else {
+            c.spectator = true;
+            c.name = uname;
+            const ServerConfig& tun = server_config();
+            c.frames.reset(tun.spectator_frame_rate, tun.spectator_frame_burst);
+            c.flood.reset(tun.spectator_frame_rate, kFloodFrames);
+            send_frame(cfd, "WELCOME role=SPEC" + welcome_params);
+            log_checkpoint("Tetris", "HELLO_ACCEPTED", "user=" + uname + " role=SPEC");
+        }
+        add_viewer(cfd);
+        handled = true;
+        if (lockstep && game_started_) {
+            // A keyframe and the events since for each board, ahead of the live ones
+            for (int b = 0; b < kBoards; ++b) send_frame(cfd, lock_logs_[b].catch_up(b));
+            room_metrics().lockstep_catchups.add();
+        }
+    }
 
-            if (std::chrono::duration_cast<std::chrono::milliseconds>(now - last_tick).count() >= 500) {
-                if (players[0].game) players[0].game->tick();
-                if (players[1].game) players[1].game->tick();
-
-                for (int p_idx = 0; p_idx < 2; ++p_idx) {
-                    if (players[p_idx].game) {
-                        std::ostringstream os;
-                        os << "SNAPSHOT user=" << players[p_idx].name
-                           << " score=" << players[p_idx].game->score
-                           << " lines=" << players[p_idx].game->lines_cleared
-                           << " gameover=" << (players[p_idx].game->game_over ? "1" : "0")
-                           << " board=" << players[p_idx].game->get_board_snapshot();
-                        broadcast(conns, os.str());
-                    }
-                }
-                last_tick = now;
-            }
+    if (handled && wants_bin && !lockstep) {
+        // The newcomer has no board yet, so the next binary round starts with keyframes
+        encoders_[0].force_keyframe();
+        encoders_[1].force_keyframe();
+    }
+
+    if (!handled) {
+        send_frame(cfd, "ERR invalid_player_or_token");
+        log_checkpoint("Tetris", "HELLO_REJECTED",
+                       "user=" + (!uname.empty() ? uname : "unknown") + " reason=bad_token");
+        close_conn(cfd, std::chrono::steady_clock::now() + std::chrono::milliseconds(kFinishDrainMs));
+    }
+}
+
+bool TetrisRoom::resume_player(int cfd, int p_idx, bool wants_bin, const std::string& welcome_params) {
+    Player& pl = players_[p_idx];
+    Conn& c = conns_[cfd];
+    if (c.player >= 0 && c.player != p_idx) {
+        // Already seated on the other board: one connection never plays both
+        send_frame(cfd, "ERR invalid_player_or_token");
+        log_checkpoint("Tetris", "HELLO_REJECTED", "user=" + pl.name + " reason=seated");
+        return false;
+    }
+    // A second HELLO on the same connection starts over, as in handle_hello:
+    // off whichever viewer list its earlier HELLO put it on
+    remove_viewer(cfd);
+    c.lockstep = false;
+    c.spectator = false;
+    const auto away_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - pl.away_since).count();
+    pl.away = false;
+    pl.fd = cfd;
+    c.player = static_cast<int8_t>(p_idx);
+    c.binary = wants_bin;
+    add_viewer(cfd);
+    send_frame(cfd, "WELCOME role=P" + std::to_string(p_idx + 1) + welcome_params + " resume=" + pl.resume_token +
+                        " resume_ms=" + std::to_string(cfg_.resume_grace_ms) + " resumed=1");
+    // Catch up from where the live stream is, so it simply carries on: binary
+    // viewers get a keyframe of the last broadcast state for each board and the
+    // next shared delta applies on top; nobody else is sent a keyframe.
+    for (int b = 0; b < kBoards; ++b) {
+        if (!players_[b].game) continue;
+        const Player& shown = players_[b];
+        if (wants_bin) {
+            send_frame(cfd, encoders_[b].resync(*shown.game, static_cast<uint8_t>(b), shown.name, shown.input_seq));
+        } else {
+            send_frame(cfd, text_encoders_[b].encode(*shown.game, shown.name, shown.input_seq));
+        }
+    }
+    log_checkpoint("Tetris", "SESSION_RESUMED",
+                   "user=" + pl.name + " role=P" + std::to_string(p_idx + 1) + " away_ms=" + std::to_string(away_ms));
+    announce("PLAYER_BACK user=" + pl.name);
+    return true;
+}
+
+std::string TetrisRoom::open_udp(int fd) {
+    if (udp_fd_ < 0) return {};
+    close_udp(fd); // a second HELLO on the same connection starts over
+    UdpPeer& peer = conns_[fd].udp;
+    do {
+        peer.key = new_session_key();
+    } while (peer.key == 0 || udp_keys_.count(peer.key));
+    udp_keys_[peer.key] = fd;
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(peer.key));
+    return " udp=" + std::to_string(udp_port_) + " udp_key=" + key;
+}
+
+void TetrisRoom::close_udp(int fd) {
+    Conn* c = conn(fd);
+    if (!c || c->udp.key == 0) return;
+    udp_keys_.erase(c->udp.key);
+    if (c->udp.ready) --udp_ready_;
+    c->udp = UdpPeer{};
+}
+
+void TetrisRoom::on_datagrams() {
+    if (udp_fd_ < 0 || finished_) return;
+    char buf[UDP_MAX_DATAGRAM];
+    while (true) {
+        sockaddr_in from{};
+        socklen_t from_len = sizeof(from);
+        ssize_t n = ::recvfrom(udp_fd_, buf, sizeof(buf), 0, reinterpret_cast<sockaddr*>(&from), &from_len);
+        if (n < 0) break; // EAGAIN: all taken
+        on_datagram(buf, static_cast<size_t>(n), from);
+        if (finished_) return;
+    }
+    ack_inputs();
+    update_match_state();
+}
 
-            bool p1_over = !players[0].game || players[0].game->game_over;
-            bool p2_over = !players[1].game || players[1].game->game_over;
-            if (p1_over || p2_over) {
-                log_checkpoint("Tetris", "MATCH_ENDING",
-                               "room=" + std::to_string(room_id) +
-                               " p1=" + players[0].name + " score=" + std::to_string(players[0].game ? players[0].game->score : 0) +
-                               " p2=" + players[1].name + " score=" + std::to_string(players[1].game ? players[1].game->score : 0));
-                broadcast(conns,
-                          "GAME_OVER p1_score=" + std::to_string(players[0].game ? players[0].game->score : 0) +
-                          " p2_score=" + std::to_string(players[1].game ? players[1].game->score : 0));
-                break;
+void TetrisRoom::on_datagram(const char* data, size_t len, const sockaddr_in& from) {
+    UdpHeader h;
+    std::string_view payload;
+    if (!udp_parse(data, len, h, payload)) return;
+    auto kit = udp_keys_.find(h.key);
+    if (kit == udp_keys_.end()) return;
+    const int fd = kit->second;
+    room_metrics().udp_in.add();
+    // Datagrams share the connection's frame budget; inputs in a dropped one
+    // come again in the next
+    const auto now = std::chrono::steady_clock::now();
+    if (!conns_[fd].frames.take(now)) {
+        room_metrics().frames_shed.add();
+        return;
+    }
+    UdpPeer& peer = conns_[fd].udp;
+    // Replies go wherever the client last sent from, so a NAT rebinding is followed
+    peer.addr = from;
+    peer.known = true;
+    peer.heard_at = now;
+
+    if (h.type == UDP_HELLO) {
+        send_udp(peer, UDP_HELLO, -1, {});
+        if (payload.empty() || payload[0] == 0 || peer.ready) return;
+        peer.ready = true;
+        ++udp_ready_;
+        log_checkpoint("Tetris", "UDP_READY", peer_desc(fd));
+        // From here on its snapshots come this way; start it off with both boards
+        for (int b = 0; b < kBoards; ++b) {
+            const Player& shown = players_[b];
+            if (!shown.game) continue;
+            send_datagram(fd, b, encoders_[b].keyframe(*shown.game, static_cast<uint8_t>(b), shown.name,
+                                                       shown.input_seq));
+        }
+    } else if (h.type == UDP_INPUTS) {
+        const int p_idx = conns_[fd].player;
+        if (!game_started_ || p_idx < 0) return;
+        std::vector<UdpInput> inputs;
+        if (!udp_decode_inputs(payload, inputs)) return;
+        for (const UdpInput& in : inputs) {
+            // Every datagram repeats what is not acked yet; only the new ones count
+            if (in.seq <= players_[p_idx].input_seq) {
+                room_metrics().udp_inputs_repeated.add();
+                continue;
             }
+            const int code = input_action_code(in.action);
+            if (code >= 0) apply_input(fd, InputCommand{static_cast<InputAction>(code), in.seq, in.t});
         }
     }
+}
 
-    std::cerr << "[Tetris] Game " << room_id << " finished." << std::endl;
-    log_checkpoint("Tetris", "MATCH_FINISHED", "room=" + std::to_string(room_id));
+bool TetrisRoom::udp_live(int fd) {
+    Conn* c = conn(fd);
+    if (!c || !c->udp.ready) return false;
+    if (std::chrono::steady_clock::now() - c->udp.heard_at < std::chrono::milliseconds(UDP_SILENCE_MS)) return true;
+    // The client has stopped its keepalives; it takes TCP snapshots again, and
+    // the shared binary stream has to restart from keyframes for it
+    c->udp.ready = false;
+    --udp_ready_;
+    encoders_[0].force_keyframe();
+    encoders_[1].force_keyframe();
+    log_checkpoint("Tetris", "UDP_SILENT", peer_desc(fd));
+    return false;
+}
 
-    int p1_score = players[0].game ? players[0].game->score : 0;
-    int p2_score = players[1].game ? players[1].game->score : 0;
+bool TetrisRoom::send_datagram(int fd, int lane, const std::string& body) {
+    if (!udp_live(fd)) return false;
+    log_communication_lazy("Tetris", "TX_UDP", [&] { return peer_desc(fd); }, [&] { return describe_frame(body); });
+    send_udp(conns_[fd].udp, UDP_FRAME, lane, body);
+    return true;
+}
 
-    if (finished_cb) {
-        finished_cb(room_id, players[0].name, p1_score, players[1].name, p2_score);
+// Header and lane are per client, the body is shared: one sendmsg, no copy.
+// A full socket buffer just loses the datagram, as the network might have.
+void TetrisRoom::send_udp(UdpPeer& peer, uint8_t type, int lane, const std::string& body) {
+    if (!peer.known || udp_fd_ < 0) return;
+    std::string head;
+    head.reserve(UDP_HEADER_SIZE + 1);
+    udp_put_header(head, type, peer.key, ++peer.seq);
+    if (type == UDP_FRAME) head.push_back(static_cast<char>(lane));
+    iovec iov[2];
+    iov[0].iov_base = head.data();
+    iov[0].iov_len = head.size();
+    iov[1].iov_base = const_cast<char*>(body.data());
+    iov[1].iov_len = body.size();
+    msghdr msg{};
+    msg.msg_name = &peer.addr;
+    msg.msg_namelen = sizeof(peer.addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = body.empty() ? 1 : 2;
+    if (::sendmsg(udp_fd_, &msg, MSG_DONTWAIT) < 0) return;
+    const size_t sent = head.size() + body.size();
+    bytes_out_ += sent;
+    room_metrics().bytes_out.add(sent);
+    room_metrics().udp_out.add();
+}
+
+bool TetrisRoom::queue_frame(int fd, const LpFrame& frame, int coalesce_key, bool self_contained) {
+    Conn* c = conn(fd);
+    if (!c) return false;
+    FrameWriter& writer = c->writer;
+    switch (writer.enqueue(frame, coalesce_key, self_contained)) {
+    case FrameWriter::EnqueueResult::Overflow:
+        room_metrics().slow_clients.add();
+        log_checkpoint("Tetris", "CLIENT_TOO_SLOW",
+                       peer_desc(fd) + " queued=" + std::to_string(writer.queued_bytes()));
+        return false;
+    case FrameWriter::EnqueueResult::Skipped:
+        // This viewer missed a delta, so the board's next frame must stand alone
+        if (coalesce_key >= 0 && coalesce_key < kBoards) encoders_[coalesce_key].force_keyframe();
+        break;
+    default:
+        bytes_out_ += frame->size();
+        room_metrics().bytes_out.add(frame->size());
+        break;
+    }
+    if (!writer.flush(fd)) return false;
+    note_write_interest(fd);
+    return true;
+}
+
+bool TetrisRoom::send_frame(int fd, const std::string& msg) {
+    log_communication_lazy("Tetris", "TX", [&] { return peer_desc(fd); }, [&] { return describe_frame(msg); });
+    LpFrame frame = lp_prepare_frame(msg);
+    return frame && queue_frame(fd, frame, -1, true);
+}
+
+bool TetrisRoom::send_frame(int fd, const LpFrame& frame) {
+    if (!frame) return false;
+    log_communication_lazy("Tetris", "TX", [&] { return peer_desc(fd); },
+                           [&] { return describe_frame(frame->substr(4)); });
+    return queue_frame(fd, frame, -1, true);
+}
+
+void TetrisRoom::send_to_all(const std::vector<int>& fds, const std::string& msg, int coalesce_key) {
+    if (fds.empty()) return;
+    // Framed once; every queue shares the same buffer
+    send_prepared_to_all(fds, lp_prepare_frame(msg), coalesce_key, !is_binary_delta(msg));
+}
+
+void TetrisRoom::send_prepared_to_all(const std::vector<int>& fds, const LpFrame& frame, int coalesce_key,
+                                      bool self_contained) {
+    if (fds.empty() || !frame) return;
+    log_communication_lazy("Tetris", "TX", [&] { return "broadcast fds=" + std::to_string(fds.size()); },
+                           [&] { return describe_frame(frame->substr(4)); });
+    std::vector<int> failed;
+    for (int fd : fds) {
+        if (fd >= 0 && !queue_frame(fd, frame, coalesce_key, self_contained)) failed.push_back(fd);
+    }
+    for (int fd : failed) drop_connection(fd);
+}
+
+void TetrisRoom::note_write_interest(int fd) {
+    Conn* c = conn(fd);
+    if (!c || c->writer.pending() == c->write_armed) return;
+    c->write_armed = !c->write_armed;
+    write_interest_changes_[fd] = c->write_armed;
+}
+
+TetrisRoom::Conn* TetrisRoom::conn(int fd) {
+    return fd >= 0 && static_cast<size_t>(fd) < conns_.size() && conns_[fd].open ? &conns_[fd] : nullptr;
+}
+
+const TetrisRoom::Conn* TetrisRoom::conn(int fd) const {
+    return fd >= 0 && static_cast<size_t>(fd) < conns_.size() && conns_[fd].open ? &conns_[fd] : nullptr;
+}
+
+void TetrisRoom::close_conn(int fd, std::chrono::steady_clock::time_point linger_until) {
+    if (!conn(fd)) return;
+    remove_viewer(fd);
+    close_udp(fd);
+    FrameWriter& writer = conns_[fd].writer;
+    if (linger_until != std::chrono::steady_clock::time_point{} && writer.flush(fd) && writer.pending()) {
+        lingering_.push_back(Linger{fd, std::move(writer), linger_until});
+    } else {
+        ::close(fd);
+    }
+    conns_[fd] = Conn(); // also lets go of its buffers
+    write_interest_changes_.erase(fd);
+}
+
+void TetrisRoom::add_viewer(int fd) {
+    Conn& c = conns_[fd];
+    if (c.viewer_pos >= 0) return;
+    std::vector<int>& list = viewers_[c.feed()];
+    c.viewer_pos = static_cast<int32_t>(list.size());
+    list.push_back(fd);
+}
+
+void TetrisRoom::remove_viewer(int fd) {
+    Conn& c = conns_[fd];
+    if (c.viewer_pos < 0) return;
+    std::vector<int>& list = viewers_[c.feed()];
+    const int last = list.back();
+    list[c.viewer_pos] = last;
+    conns_[last].viewer_pos = c.viewer_pos;
+    list.pop_back();
+    c.viewer_pos = -1;
+}
+
+bool TetrisRoom::wants_write(int fd) const {
+    const Conn* c = conn(fd);
+    return c && c->write_armed;
+}
+
+std::vector<TetrisRoom::Linger> TetrisRoom::take_lingering() {
+    std::vector<Linger> out;
+    out.swap(lingering_);
+    return out;
+}
+
+std::map<int, bool> TetrisRoom::take_write_interest_changes() {
+    std::map<int, bool> changes;
+    changes.swap(write_interest_changes_);
+    return changes;
+}
+
+bool TetrisRoom::on_writable(int cfd) {
+    Conn* c = conn(cfd);
+    if (!c) return false;
+    if (!c->writer.flush(cfd)) {
+        drop_connection(cfd);
+        update_match_state();
+        return false;
+    }
+    note_write_interest(cfd);
+    return true;
+}
+
+int TetrisRoom::gravity_ms(int board) const {
+    const auto& game = players_[board].game;
+    return gravity_interval_ms(cfg_.gravity_ms, game ? game->level() : 0);
+}
+
+void TetrisRoom::on_gravity(int p_idx, std::chrono::steady_clock::time_point due) {
+    if (due != std::chrono::steady_clock::time_point{}) {
+        const auto late = std::chrono::steady_clock::now() - due;
+        room_metrics().tick_lateness.record(late);
+        lateness_ms_ += (std::chrono::duration<double, std::milli>(late).count() - lateness_ms_) / 16;
+    }
+    MetricTimer timer(room_metrics().tick);
+    TRACE_SCOPE("gravity_tick");
+    expire_away_players();
+    if (!game_started_ || match_over_ || !players_[p_idx].game) return;
+
+    Player& pl = players_[p_idx];
+    pl.tick_inputs = 0;
+    if (!pl.away) { // frozen until they resume or forfeit
+        trace_.tick(p_idx);
+        pl.game->tick();
+        lockstep_event(p_idx, LOCK_TICK);
+    }
+    if (pl.game->generation != pl.generation_sent || encoders_[p_idx].keyframe_pending() ||
+        std::chrono::steady_clock::now() - pl.sent_at >= std::chrono::milliseconds(server_config().snapshot_heartbeat_ms)) {
+        broadcast_board(p_idx);
+    }
+    update_match_state();
+}
+
+// Sends one board to every viewer: text snapshots, or the next frame of the
+// shared binary stream
+void TetrisRoom::broadcast_board(int p_idx) {
+    MetricTimer timer(room_metrics().broadcast);
+    players_[p_idx].locks_sent = players_[p_idx].game->pieces_locked;
+    players_[p_idx].generation_sent = players_[p_idx].game->generation;
+    players_[p_idx].sent_at = std::chrono::steady_clock::now();
+    const std::vector<int>& text_conns = viewers_[0];
+    // Binary viewers on a ready datagram session are left out of the TCP stream;
+    // with none (the usual case) the list goes as it is
+    const bool split = udp_ready_ > 0;
+    std::vector<int> bin_split, udp_conns;
+    if (split) {
+        for (int fd : viewers_[1]) (udp_live(fd) ? udp_conns : bin_split).push_back(fd);
+    }
+    const std::vector<int>& bin_conns = split ? bin_split : viewers_[1];
+
+    if (!text_conns.empty()) {
+        LpFrame snap;
+        {
+            TRACE_SCOPE("snapshot_text");
+            snap = text_encoders_[p_idx].encode(*players_[p_idx].game, players_[p_idx].name, players_[p_idx].input_seq);
+        }
+        send_prepared_to_all(text_conns, snap, p_idx, true);
+    }
+    if (!bin_conns.empty() || relay_channel_) {
+        // Encoded straight into a recycled frame, once for the room's own viewers and the relay alike
+        bool key = false;
+        LpFrame framed;
+        {
+            TRACE_SCOPE("snapshot_encode");
+            framed = lp_build_frame([&](std::string& out) {
+                key = encoders_[p_idx].encode_into(out, *players_[p_idx].game, static_cast<uint8_t>(p_idx),
+                                                   players_[p_idx].name, players_[p_idx].input_seq);
+            });
+        }
+        send_prepared_to_all(bin_conns, framed, p_idx, key);
+        if (relay_channel_ && framed) cfg_.relay->publish(relay_channel_, framed);
+    }
+    if (!udp_conns.empty()) {
+        // Datagrams may be lost or reordered, so each carries a whole board
+        {
+            TRACE_SCOPE("snapshot_keyframe");
+            udp_scratch_.clear();
+            encoders_[p_idx].keyframe_into(udp_scratch_, *players_[p_idx].game, static_cast<uint8_t>(p_idx),
+                                           players_[p_idx].name, players_[p_idx].input_seq);
+        }
+        for (int fd : udp_conns) send_datagram(fd, p_idx, udp_scratch_);
+    }
+}
+
+void TetrisRoom::announce(const std::string& msg) {
+    // Framed once for both kinds of viewer and the relay
+    LpFrame frame = lp_prepare_frame(msg);
+    send_prepared_to_all(viewers_[0], frame, -1, true);
+    send_prepared_to_all(viewers_[1], frame, -1, true);
+    send_prepared_to_all(viewers_[2], frame, -1, true);
+    if (relay_channel_) cfg_.relay->publish(relay_channel_, frame);
+}
+
+// After each read batch: a small POSE to the mover with the piece where the
+// server now has it, the last seq applied and the gravity step count (all a
+// predicting client needs to replay the same history), so moves show without
+// waiting for gravity. A batch that locked a piece changed the board as well,
+// and that goes to every viewer at once instead of on the next tick. Lockstep
+// clients need no POSE: the input events already told them.
+void TetrisRoom::ack_inputs() {
+    for (int i = 0; i < kBoards; ++i) {
+        Player& pl = players_[i];
+        if (pl.excess.any() && pl.game && !match_over_) apply_excess(i);
+        if (!pl.pose_due) continue;
+        pl.pose_due = false;
+        if (pl.fd < 0 || !pl.game) continue;
+        if (!conns_[pl.fd].lockstep) {
+            const Piece& piece = pl.game->current_piece;
+            std::string pose = "POSE seq=" + std::to_string(pl.input_seq);
+            if (pl.input_t) pose += " t=" + std::to_string(pl.input_t);
+            pose += " shape=" + std::to_string(piece.shape_id) + " rot=" + std::to_string(piece.rotation) +
+                    " x=" + std::to_string(piece.x) + " y=" + std::to_string(piece.y) +
+                    " score=" + std::to_string(pl.game->score) + " g=" + std::to_string(pl.game->ticks);
+            if (!send_datagram(pl.fd, i, pose)) send_frame(pl.fd, pose);
+        }
+        if (pl.game->pieces_locked != pl.locks_sent) broadcast_board(i);
+    }
+}
+
+void TetrisRoom::update_match_state() {
+    if (match_over_) return;
+
+    if (!game_started_ && authed_players_ == 2) {
+        // One piece sequence for both boards: they draw the same order
+        // Boards and their sequence live in the room's arena for the whole match
+        std::pmr::polymorphic_allocator<PieceSequence> alloc(&arena_);
+        auto sequence = std::allocate_shared<PieceSequence>(alloc, game_seed_);
+        players_[0].game = alloc.new_object<TetrisGame>(sequence);
+        players_[1].game = alloc.new_object<TetrisGame>(sequence);
+        lock_logs_[0].keyframe(*players_[0].game);
+        lock_logs_[1].keyframe(*players_[1].game);
+        game_started_ = true;
+        log_checkpoint("Tetris", "MATCH_STARTED",
+                       "room=" + std::to_string(cfg_.room_id) + " seed=" + std::to_string(game_seed_));
+        if (!cfg_.trace_dir.empty()) {
+            trace_.open(cfg_.trace_dir, cfg_.room_id, game_seed_, cfg_.gravity_ms, players_[0].name, players_[1].name);
+            log_checkpoint("Tetris", "TRACE_STARTED", trace_.path());
+        }
+        // Both boards right away, so viewers (and predicting clients) start in step
+        broadcast_board(0);
+        broadcast_board(1);
+    }
+    if (!game_started_) return;
+
+    bool p1_over = !players_[0].game || players_[0].game->game_over;
+    bool p2_over = !players_[1].game || players_[1].game->game_over;
+    if (p1_over || p2_over) {
+        int s1 = players_[0].game ? players_[0].game->score : 0;
+        int s2 = players_[1].game ? players_[1].game->score : 0;
+        log_checkpoint("Tetris", "MATCH_ENDING",
+                       "room=" + std::to_string(cfg_.room_id) +
+                       " p1=" + players_[0].name + " score=" + std::to_string(s1) +
+                       " p2=" + players_[1].name + " score=" + std::to_string(s2));
+        announce("GAME_OVER p1_score=" + std::to_string(s1) + " p2_score=" + std::to_string(s2));
+        match_over_ = true;
+        mark_finished();
+        trace_.end();
+    }
+}
+
+void TetrisRoom::mark_finished() {
+    if (finished_) return;
+    finished_ = true;
+    if (on_finished_) on_finished_();
+}
+
+void TetrisRoom::finish() {
+    if (reported_) return;
+    reported_ = true;
+    mark_finished();
+
+    std::cerr << "[Tetris] Game " << cfg_.room_id << " finished." << std::endl;
+    trace_.close(); // no-op unless the match was cut short
+    log_checkpoint("Tetris", "MATCH_FINISHED",
+                   "room=" + std::to_string(cfg_.room_id) + " bytes_out=" + std::to_string(bytes_out_));
+    room_metrics().matches.add();
+    room_metrics().room_bytes_out.record(bytes_out_);
+
+    int p1_score = players_[0].game ? players_[0].game->score : 0;
+    int p2_score = players_[1].game ? players_[1].game->score : 0;
+
+    if (cfg_.finished_cb) {
+        cfg_.finished_cb(cfg_.room_id, players_[0].name, p1_score, players_[1].name, p2_score);
     } else {
         std::string reply;
-        std::string log_req = "GameLog create roomId=" + std::to_string(room_id)
-           + " user1=" + players[0].name
-           + " user2=" + players[1].name
+        std::string log_req = "GameLog create roomId=" + std::to_string(cfg_.room_id)
+           + " user1=" + players_[0].name
+           + " user2=" + players_[1].name
            + " score1=" + std::to_string(p1_score)
            + " score2=" + std::to_string(p2_score);
-        tetris_db_req(db_ip, db_port, log_req, reply);
+        std::string status_req = "Room setStatus roomId=" + std::to_string(cfg_.room_id) + " status=idle";
+        // Both writes applied together, and only while the room still holds
+        // this match: the outbox may deliver the batch twice
+        std::vector<std::string> cmds{log_req, status_req};
+        if (!cfg_.expected_token.empty()) {
+            cmds.insert(cmds.begin(),
+                        "Room check roomId=" + std::to_string(cfg_.room_id) + " token=" + cfg_.expected_token);
+        }
+        std::string request = db_atomic_request(cmds);
+        ResultOutbox* outbox = tetris_result_outbox(cfg_.db_ip, cfg_.db_port);
+        if (!outbox || !outbox->post(request)) tetris_db_req(cfg_.db_ip, cfg_.db_port, request, reply);
+    }
 
-        std::string status_req = "Room setStatus roomId=" + std::to_string(room_id) + " status=idle";
-        tetris_db_req(db_ip, db_port, status_req, reply);
+    // A rematch may already hold the room id under a new token
+    if (cfg_.registry) cfg_.registry->erase(cfg_.room_id, cfg_.expected_token);
+    if (relay_channel_) {
+        cfg_.relay->close(relay_channel_); // relayed spectators get GAME_OVER from there
+        relay_channel_ = 0;
     }
 
-    if (registry && registry->mutex) {
-        std::lock_guard<std::mutex> lock(*registry->mutex);
-        if (registry->ports) registry->ports->erase(room_id);
-        if (registry->tokens) registry->tokens->erase(room_id);
+    // GAME_OVER and the last snapshots may still be queued: those go to the driver
+    const auto linger_until = std::chrono::steady_clock::now() + std::chrono::milliseconds(kFinishDrainMs);
+    for (size_t fd = 0; fd < conns_.size(); ++fd) close_conn(static_cast<int>(fd), linger_until);
+    conns_.clear();
+    for (std::vector<int>& list : viewers_) list.clear();
+    write_interest_changes_.clear();
+    if (cfg_.listen_fd >= 0) ::close(cfg_.listen_fd);
+    cfg_.listen_fd = -1;
+    if (udp_fd_ >= 0) ::close(udp_fd_);
+    udp_fd_ = -1;
+    udp_ready_ = 0;
+    udp_keys_.clear();
+}
+
+void run_tetris_server_on_fd(int listen_fd,
+                             const std::string& p1_name,
+                             const std::string& p2_name,
+                             const std::string& db_ip,
+                             uint16_t db_port,
+                             int room_id,
+                             const std::string& expected_token,
+                             GameRegistry* registry,
+                             GameFinishedCallback finished_cb,
+                             int gravity_ms,
+                             const std::string& trace_dir,
+                             bool udp)
+{
+    TetrisRoomConfig cfg{listen_fd, p1_name, p2_name, db_ip, db_port,
+                         room_id, expected_token, registry, finished_cb, gravity_ms, trace_dir};
+    cfg.udp = udp;
+    TetrisRoom room(std::move(cfg));
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point due[TetrisRoom::kBoards];
+    for (int b = 0; b < TetrisRoom::kBoards; ++b) due[b] = Clock::now() + std::chrono::milliseconds(room.gravity_ms(b));
+
+    // Kept across iterations: a client is added once and swap-removed when it
+    // closes, and only write interest changes touch the rest
+    std::vector<pollfd> pfds{{listen_fd, POLLIN, 0}, {room.udp_fd(), POLLIN, 0}}; // poll skips a negative fd
+    std::vector<size_t> slot;                      // fd -> index in pfds, 0 when not watched
+    auto unwatch = [&](size_t i) {
+        slot[pfds[i].fd] = 0;
+        if (i + 1 < pfds.size()) {
+            pfds[i] = pfds.back();
+            slot[pfds[i].fd] = i;
+        }
+        pfds.pop_back();
+    };
+    std::unordered_map<int, TetrisRoom::Linger> lingering; // turned-away clients, flushing on POLLOUT
+    auto let_go = [&](int fd) {
+        if (static_cast<size_t>(fd) < slot.size() && slot[fd]) unwatch(slot[fd]);
+        lingering.erase(fd);
+        ::close(fd);
+    };
+
+    while (running && !room.finished()) {
+        for (auto const& [fd, want] : room.take_write_interest_changes()) {
+            if (static_cast<size_t>(fd) < slot.size() && slot[fd]) {
+                pfds[slot[fd]].events = static_cast<short>(POLLIN | (want ? POLLOUT : 0));
+            }
+        }
+
+        // Sleep exactly until the next board is due instead of polling on a fixed period
+        auto next = std::min(due[0], due[1]);
+        for (auto const& [fd, l] : lingering) next = std::min(next, l.deadline);
+        int timeout = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(next - Clock::now()).count());
+        trace_poll_signal();
+        int rc;
+        {
+            TRACE_SCOPE("poll");
+            rc = ::poll(pfds.data(), pfds.size(), std::max(timeout, 0));
+        }
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            perror("[Tetris] poll");
+            break;
+        }
+
+        if (pfds[1].revents & POLLIN) room.on_datagrams();
+        // Swap-removal pulls the last entry into i, whose revents are from this poll too
+        for (size_t i = 2; i < pfds.size() && !room.finished();) {
+            const short revents = pfds[i].revents;
+            pfds[i].revents = 0;
+            auto lit = lingering.find(pfds[i].fd);
+            if (lit != lingering.end()) {
+                FrameWriter& writer = lit->second.writer;
+                if (revents & (POLLHUP | POLLERR | POLLNVAL) || !writer.flush(lit->first) || !writer.pending()) {
+                    let_go(lit->first); // pulls the last entry into i
+                } else {
+                    ++i;
+                }
+                continue;
+            }
+            bool open = true;
+            if (revents & POLLOUT) open = room.on_writable(pfds[i].fd);
+            if (open && (revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))) open = room.on_readable(pfds[i].fd);
+            if (open) ++i;
+            else unwatch(i);
+        }
+        if (pfds[0].revents & POLLIN) {
+            int cfd = room.on_accept();
+            if (cfd >= 0) {
+                if (static_cast<size_t>(cfd) >= slot.size()) slot.resize(cfd + 1, 0);
+                if (slot[cfd]) unwatch(slot[cfd]); // the room closed the old holder of this number unseen
+                slot[cfd] = pfds.size();
+                pfds.push_back({cfd, static_cast<short>(POLLIN | (room.wants_write(cfd) ? POLLOUT : 0)), 0});
+            }
+        }
+
+        auto now = Clock::now();
+        for (int b = 0; b < TetrisRoom::kBoards; ++b) {
+            if (now < due[b]) continue;
+            room.on_gravity(b, due[b]);
+            // Stay on the original cadence unless we fell a whole interval behind
+            due[b] += std::chrono::milliseconds(room.gravity_ms(b));
+            if (due[b] < now) due[b] = now + std::chrono::milliseconds(room.gravity_ms(b));
+        }
+
+        for (TetrisRoom::Linger& l : room.take_lingering()) {
+            if (static_cast<size_t>(l.fd) >= slot.size()) slot.resize(l.fd + 1, 0);
+            if (slot[l.fd]) unwatch(slot[l.fd]);
+            slot[l.fd] = pfds.size();
+            pfds.push_back({l.fd, POLLOUT, 0});
+            const int fd = l.fd;
+            lingering.insert_or_assign(fd, std::move(l));
+        }
+        std::vector<int> expired;
+        for (auto const& [fd, l] : lingering) {
+            if (l.deadline <= now) expired.push_back(fd);
+        }
+        for (int fd : expired) let_go(fd);
     }
 
-    for (size_t i = 0; i < pfds.size(); ++i) ::close(pfds[i].fd);
-    if (listen_fd >= 0) ::close(listen_fd);
+    room.finish();
+    // Nothing left to serve here, so the last frames are flushed in place
+    for (TetrisRoom::Linger& l : room.take_lingering()) lingering.insert_or_assign(l.fd, std::move(l));
+    for (auto& [fd, l] : lingering) {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(l.deadline - Clock::now()).count();
+        if (left > 0) l.writer.drain(fd, static_cast<int>(left));
+        ::close(fd);
+    }
 }
@@ -1,15 +1,88 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <map>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <netinet/in.h>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
-struct GameRegistry {
-    std::mutex* mutex = nullptr;
-    std::unordered_map<int, uint16_t>* ports = nullptr;
-    std::unordered_map<int, std::string>* tokens = nullptr;
+#include "../core/lp_framing.hpp"
+#include "rate_limit.hpp"
+#include "tetris_command.hpp"
+#include "tetris_game.hpp"
+#include "tetris_lockstep.hpp"
+#include "tetris_snapshot.hpp"
+#include "tetris_trace.hpp"
+
+class SpectatorRelay;
+
+// One entry per running match: where clients connect and which scheduler
+// worker hosts it (-1 for rooms driven by their own thread).
+struct GameRoomEntry {
+    uint16_t port = 0;
+    std::string token;
+    int worker = -1;
+};
+
+// Shared room directory, owned by whoever starts the games (the lobby).
+// Sharded by room id, so lookups for different rooms do not contend.
+class GameRegistry {
+public:
+    void put(int room_id, const GameRoomEntry& entry) {
+        Shard& s = shard(room_id);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.rooms[room_id] = entry;
+    }
+
+    bool get(int room_id, GameRoomEntry& out) {
+        Shard& s = shard(room_id);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.rooms.find(room_id);
+        if (it == s.rooms.end()) return false;
+        out = it->second;
+        return true;
+    }
+
+    // No-op if the room already ended
+    void set_worker(int room_id, int worker) {
+        Shard& s = shard(room_id);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.rooms.find(room_id);
+        if (it != s.rooms.end()) it->second.worker = worker;
+    }
+
+    // Only while the entry is still the match with that token
+    void erase(int room_id, const std::string& token) {
+        Shard& s = shard(room_id);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.rooms.find(room_id);
+        if (it != s.rooms.end() && it->second.token == token) s.rooms.erase(it);
+    }
+
+    // fn(room_id, entry) for every running match, one shard locked at a time
+    template <typename Fn>
+    void for_each(Fn&& fn) {
+        for (Shard& s : shards_) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            for (auto const& [room_id, entry] : s.rooms) fn(room_id, entry);
+        }
+    }
+
+private:
+    static constexpr unsigned kShards = 16;
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<int, GameRoomEntry> rooms;
+    };
+    Shard& shard(int room_id) { return shards_[static_cast<unsigned>(room_id) % kShards]; }
+    Shard shards_[kShards];
 };
 
 using GameFinishedCallback = std::function<void(int room_id,
@@ -18,8 +91,237 @@ using GameFinishedCallback = std::function<void(int room_id,
                                                const std::string& user2,
                                                int score2)>;
 
-// Shared Tetris game server runner used by both the lobby and
-// the standalone tetris_server executable.
+struct TetrisRoomConfig {
+    int listen_fd = -1; // -1 when connections are handed over through adopt_client()
+    std::string p1_name;
+    std::string p2_name;
+    std::string db_ip;
+    uint16_t db_port = 0;
+    int room_id = 0;
+    std::string expected_token;
+    GameRegistry* registry = nullptr;
+    GameFinishedCallback finished_cb = nullptr;
+    int gravity_ms = 500; // level 0 drop interval, faster levels scale from it
+    std::string trace_dir; // where to write <room>-<seed>.trace replay files, empty for none
+    // How long a player who drops mid-match may come back with HELLO resume=<token>
+    // before forfeiting; their board is frozen meanwhile. 0 forfeits at once.
+    int resume_grace_ms = 10000;
+    // Serves the binary spectators (the shared listener's gateway sends them
+    // there); the room publishes its frames to it instead of fanning them out
+    SpectatorRelay* relay = nullptr;
+    // Offer binary clients that ask the datagram channel of udp_channel.hpp, on
+    // a UDP port of the room's own
+    bool udp = false;
+    // Delays the first gravity tick, so rooms on one worker do not all tick in
+    // the same instant; 0 lets RoomScheduler pick the least crowded phase
+    int tick_phase_ms = 0;
+};
+
+// A single match as an event-driven state machine. It owns the listen fd and
+// every client fd it accepts; the driver (a poll loop or a RoomScheduler worker)
+// only tells it which fd is readable and when a board's gravity timer fires.
+class TetrisRoom {
+public:
+    explicit TetrisRoom(TetrisRoomConfig cfg);
+    ~TetrisRoom();
+    TetrisRoom(const TetrisRoom&) = delete;
+    TetrisRoom& operator=(const TetrisRoom&) = delete;
+
+    int room_id() const { return cfg_.room_id; }
+    int listen_fd() const { return cfg_.listen_fd; }
+    // The room's datagram socket, -1 unless cfg.udp
+    int udp_fd() const { return udp_fd_; }
+    const std::string& token() const { return cfg_.expected_token; }
+    static constexpr int kBoards = 2;
+    // Current drop interval of one board: the room's base rate at that player's level
+    int gravity_ms(int board) const;
+    int tick_phase_ms() const { return cfg_.tick_phase_ms; }
+    bool finished() const { return finished_; }
+    // Runs once, on the driver's thread, when finished() turns true, so a
+    // driver hosting many rooms need not poll them
+    void set_on_finished(std::function<void()> fn) { on_finished_ = std::move(fn); }
+
+    // Accepts one pending connection, returns the new fd or -1
+    int on_accept();
+    // Takes ownership of a connection accepted elsewhere (a shared game
+    // listener) whose HELLO is still unread; false if the room is over
+    bool adopt_client(int cfd);
+    // Handles one frame from fd; false means the room closed the fd
+    bool on_readable(int fd);
+    // Takes every datagram waiting on udp_fd()
+    void on_datagrams();
+    // Flushes fd's queued frames; false when the room closed the fd
+    bool on_writable(int fd);
+    // True while fd has frames queued, i.e. the reactor should watch POLLOUT
+    bool wants_write(int fd) const;
+    // fds whose wants_write() changed since the last call, with the new value
+    std::map<int, bool> take_write_interest_changes();
+    // Gravity step for one board plus its snapshot broadcast, which is skipped
+    // while the board has not changed (bar a heartbeat every few seconds); due is
+    // when the driver meant to run it, for the tick lateness metric (unset: not recorded)
+    void on_gravity(int board, std::chrono::steady_clock::time_point due = {});
+    // Reports the result, leaves the registry and closes every fd. Idempotent.
+    void finish();
+
+    // A connection the room is done with whose last frames are still queued.
+    // The driver owns fd from here: it flushes writer as the socket allows and
+    // closes fd once it is empty, fails or the deadline passes.
+    struct Linger {
+        int fd = -1;
+        FrameWriter writer;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    // Connections let go (by finish() or a turned-away HELLO) since the last call
+    std::vector<Linger> take_lingering();
+
+private:
+    struct Player {
+        std::string name;
+        int fd = -1;
+        bool authed = false;
+        TetrisGame* game = nullptr; // in the room's arena, once the match starts
+        std::string resume_token; // handed out in WELCOME
+        bool away = false;        // dropped mid-match, inside the resume grace window
+        std::chrono::steady_clock::time_point away_since;
+        uint32_t input_seq = 0;   // seq= of the last INPUT applied, acked in POSE and snapshots
+        uint32_t input_t = 0;     // its client timestamp (0: none), echoed back in POSE
+        bool sequenced = false;   // client numbers its inputs, so it wants POSE acks
+        bool pose_due = false;
+        uint32_t locks_sent = 0;  // pieces_locked as of the last board broadcast
+        uint32_t generation_sent = 0; // game->generation as of the last board broadcast
+        uint16_t tick_inputs = 0; // applied since the board's last gravity step
+        // Moves past the per-tick cap, folded until the end of the read batch
+        struct Excess {
+            int8_t shift = 0;   // net columns, RIGHT positive
+            int8_t rotate = -1; // the last rotation asked for, -1 for none
+            bool down = false;
+            bool any() const { return shift != 0 || rotate >= 0 || down; }
+        } excess;
+        std::chrono::steady_clock::time_point sent_at; // when that was
+    };
+    // A client's datagram session, next to its TCP connection
+    struct UdpPeer {
+        uint64_t key = 0;   // 0: none
+        sockaddr_in addr{}; // where its last datagram came from
+        bool known = false; // addr is set
+        bool ready = false; // it hears us: snapshots and POSE go here, not over TCP
+        uint32_t seq = 0;   // of the last datagram sent to it
+        std::chrono::steady_clock::time_point heard_at;
+    };
+    // One client connection, in a table indexed by fd: fds are small and
+    // dense, so every lookup on the hot path is array indexing
+    struct Conn {
+        bool open = false;
+        int8_t player = -1;       // board, once HELLO seated it as a player
+        bool spectator = false;
+        bool binary = false;      // snap=bin2
+        bool lockstep = false;    // runs the boards itself from events (tetris_lockstep.hpp)
+        bool write_armed = false; // output pending
+        int32_t viewer_pos = -1;  // index in viewers_[feed()] while seated or watching
+        std::string name;         // spectators' (players' are in players_)
+        FrameReader reader;       // partial frames
+        FrameWriter writer;       // queued output
+        TokenBucket frames;       // frames it may send; the rest are dropped unread
+        TokenBucket flood;        // frames it may have dropped before it is cut off
+        UdpPeer udp;
+
+        // Which viewer list it is in: text snapshots, binary ones, or lockstep events
+        int feed() const { return lockstep ? 2 : binary; }
+    };
+    // A board's lockstep hash after its n-th event, kept for checking SUMs
+    struct LockCheck {
+        uint32_t n = 0;
+        uint64_t hash = 0;
+    };
+
+    void drop_connection(int fd);
+    void handle_frame(int fd, const std::string& req);
+    void handle_hello(int fd, std::string_view hello);
+    bool resume_player(int fd, int p_idx, bool wants_bin, const std::string& welcome_params);
+    void apply_input(int fd, const InputCommand& in);
+    void play_input(int p_idx, InputAction action, uint32_t seq);
+    void apply_excess(int p_idx);
+    // Tells lockstep viewers about a board event (code: an InputAction,
+    // LOCK_TICK or LOCK_FORFEIT) just applied; called wherever the trace records one
+    void lockstep_event(int board, uint8_t code, uint32_t seq = 0);
+    // Gravity steps have been running late: new spectators are turned away
+    bool overloaded() const;
+    void check_sum(int fd, std::string_view sum);
+    // Puts a lockstep connection back on binary snapshots
+    void end_lockstep(int fd, const char* reason);
+    // WELCOME fields opening a datagram session for fd, empty if the room has none
+    std::string open_udp(int fd);
+    void close_udp(int fd);
+    void on_datagram(const char* data, size_t len, const sockaddr_in& from);
+    // fd's datagram session is ready and not silent for too long (then it is
+    // given up and fd gets TCP snapshots again)
+    bool udp_live(int fd);
+    // Sends one frame body over fd's datagram session; false if it has no ready one
+    bool send_datagram(int fd, int lane, const std::string& body);
+    void send_udp(UdpPeer& peer, uint8_t type, int lane, const std::string& body);
+    void expire_away_players();
+    void broadcast_board(int p_idx);
+    void ack_inputs();
+    // A text event for every viewer, relayed spectators included
+    void announce(const std::string& msg);
+    void update_match_state();
+    bool send_frame(int fd, const std::string& msg);
+    bool send_frame(int fd, const LpFrame& frame);
+    // coalesce_key: the board a snapshot belongs to, so slow viewers only keep the latest
+    void send_to_all(const std::vector<int>& fds, const std::string& msg, int coalesce_key = -1);
+    // The same for a frame that is already length-prefixed (a cached snapshot)
+    void send_prepared_to_all(const std::vector<int>& fds, const LpFrame& frame, int coalesce_key, bool self_contained);
+    bool queue_frame(int fd, const LpFrame& frame, int coalesce_key, bool self_contained);
+    void note_write_interest(int fd);
+    // Open fd's entry, or nullptr
+    Conn* conn(int fd);
+    const Conn* conn(int fd) const;
+    // Closes fd, or with a deadline hands it to the driver (take_lingering())
+    // while frames it could not take yet are still queued
+    void close_conn(int fd, std::chrono::steady_clock::time_point linger_until = {});
+    void mark_finished();
+    // Seated players and spectators get every broadcast; O(1) both ways
+    void add_viewer(int fd);
+    void remove_viewer(int fd);
+
+    // Two boards and their shared sequence, plus room for the control block
+    static constexpr size_t kLockChecks = 8; // per board: SUMs may lag the room this many checkpoints
+    static constexpr size_t kArenaBytes = sizeof(PieceSequence) + 2 * sizeof(TetrisGame) + 256;
+
+    TetrisRoomConfig cfg_;
+    // Long-lived match state (both boards, their piece sequence) comes from
+    // here; freed all at once with the room, after players_
+    std::pmr::monotonic_buffer_resource arena_{kArenaBytes};
+    Player players_[2];
+    std::vector<Conn> conns_;             // by fd; grows to the highest fd accepted
+    std::vector<int> viewers_[3];         // by Conn::feed(), unordered (swap-removed)
+    std::map<int, bool> write_interest_changes_;
+    std::vector<Linger> lingering_;
+    SnapshotEncoder encoders_[2];
+    TextSnapshotEncoder text_encoders_[2];
+    uint64_t relay_channel_ = 0; // 0 without a relay
+    int udp_fd_ = -1;
+    uint16_t udp_port_ = 0;
+    size_t udp_ready_ = 0;                // sessions with Conn::udp.ready
+    std::unordered_map<uint64_t, int> udp_keys_; // session key -> TCP fd
+    LockstepLog lock_logs_[2];            // each board's events, for lockstep viewers let in late
+    LockCheck lock_checks_[2][kLockChecks]; // by (n / LOCK_SUM_EVERY) % kLockChecks
+    std::vector<std::string> rx_frames_; // read scratch, reused by every on_readable()
+    std::string udp_scratch_;            // a datagram keyframe being sent
+    MatchTrace trace_;
+    int authed_players_ = 0;
+    long game_seed_ = 0;
+    bool game_started_ = false;
+    bool match_over_ = false;
+    bool finished_ = false;
+    bool reported_ = false;
+    std::function<void()> on_finished_;
+    double lateness_ms_ = 0; // moving average of how late gravity steps run
+    uint64_t bytes_out_ = 0; // queued to every client over the match
+};
+
+// Shared Tetris game server runner used by the standalone tetris_server
+// executable: drives one TetrisRoom with its own poll loop until it ends.
 void run_tetris_server_on_fd(int listen_fd,
                              const std::string& p1_name,
                              const std::string& p2_name,
@@ -28,4 +330,7 @@ void run_tetris_server_on_fd(int listen_fd,
                              int room_id,
                              const std::string& expected_token,
                              GameRegistry* registry = nullptr,
-                             GameFinishedCallback finished_cb = nullptr);
+                             GameFinishedCallback finished_cb = nullptr,
+                             int gravity_ms = 500,
+                             const std::string& trace_dir = "",
+                             bool udp = false);
@@ -1,16 +1,128 @@
-#include "common.hpp"
+#include "../core/common.hpp"
+#include "platform_server.hpp"
 #include "tetris_runtime.hpp"
+#include "tetris_trace.hpp"
 
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <string>
 
+// tetris_server --replay <file>: rebuilds a match from its trace and prints the result
+static int replay_trace(const std::string& path) {
+    TraceHeader header;
+    std::unique_ptr<TetrisGame> games[2];
+    bool complete = false;
+    if (!replay_match_trace(path, header, games, &complete)) {
+        std::cerr << "not a match trace: " << path << "\n";
+        return 1;
+    }
+    std::cout << "room=" << header.room_id << " seed=" << header.seed << " gravity=" << header.gravity_ms
+              << " start=" << header.start_unix_ms << (complete ? "" : " (cut short)") << "\n";
+    for (int b = 0; b < 2; ++b) {
+        std::cout << "P" << b + 1 << " " << header.names[b] << " score=" << games[b]->score
+                  << " lines=" << games[b]->lines_cleared << " gameover=" << games[b]->game_over
+                  << " board=" << games[b]->get_board_snapshot() << "\n";
+    }
+    return 0;
+}
+
+// First line of a secret file, without surrounding whitespace; empty if unreadable
+static std::string read_secret_file(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    const size_t b = line.find_first_not_of(" \t\r\n");
+    const size_t e = line.find_last_not_of(" \t\r\n");
+    return b == std::string::npos ? std::string() : line.substr(b, e - b + 1);
+}
+
+// A secret as server.py resolves it: the flag, the file the path flag names,
+// the environment variable, then the file the *_PATH variable names
+static std::string resolve_secret(const std::string& flag, const std::string& flag_path, const char* env, const char* path_env) {
+    if (!flag.empty()) return flag;
+    if (!flag_path.empty()) return read_secret_file(flag_path);
+    if (const char* v = std::getenv(env); v && *v) return v;
+    if (const char* p = std::getenv(path_env); p && *p) return read_secret_file(p);
+    return {};
+}
+
+// tetris_server --port N --room ID --p1 A --p2 B [--report_host H --report_port N] ...:
+// the platform launcher's command line (manifest.json), see platform_server.hpp
+static int run_platform_mode(int argc, char** argv) {
+    std::map<std::string, std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string key = argv[i];
+        if (key.rfind("--", 0) != 0) {
+            std::cerr << "unexpected argument: " << key << "\n";
+            return 2;
+        }
+        key = key.substr(2);
+        if (const size_t eq = key.find('='); eq != std::string::npos) {
+            args[key.substr(0, eq)] = key.substr(eq + 1);
+        } else if (i + 1 < argc) {
+            args[key] = argv[++i];
+        } else {
+            std::cerr << "--" << key << " needs a value\n";
+            return 2;
+        }
+    }
+    auto arg = [&](const char* key, const char* fallback = "") {
+        auto it = args.find(key);
+        return it != args.end() ? it->second : std::string(fallback);
+    };
+    for (const char* required : {"port", "room", "p1", "p2"}) {
+        if (!args.count(required)) {
+            std::cerr << "--" << required << " is required\n";
+            return 2;
+        }
+    }
+    const char* bind_env = std::getenv("BIND_HOST");
+    const char* match_env = std::getenv("MATCH_ID");
+
+    PlatformServerConfig config;
+    config.port = static_cast<uint16_t>(std::atoi(arg("port").c_str()));
+    config.room_id = std::atoi(arg("room").c_str());
+    config.p1 = arg("p1");
+    config.p2 = arg("p2");
+    config.tick_ms = std::max(MIN_GRAVITY_MS, std::atoi(arg("tick_ms", "500").c_str()));
+    config.bind_host = arg("bind_host", bind_env && *bind_env ? bind_env : "0.0.0.0");
+    config.match_id = arg("match_id", match_env ? match_env : "");
+    config.client_token = resolve_secret(arg("client_token"), arg("client_token_path"), "CLIENT_TOKEN", "CLIENT_TOKEN_PATH");
+    config.report_token = resolve_secret(arg("report_token"), arg("report_token_path"), "REPORT_TOKEN", "REPORT_TOKEN_PATH");
+    config.report_host = arg("report_host");
+    config.report_port = static_cast<uint16_t>(std::atoi(arg("report_port", "0").c_str()));
+    if (config.client_token.empty() || config.report_token.empty() || config.match_id.empty()) {
+        std::cerr << "missing required client_token/report_token/match_id; aborting\n";
+        return 2;
+    }
+    return run_platform_server(config);
+}
+
 int main(int argc, char** argv) {
+    if (argc >= 3 && std::string(argv[1]) == "--replay") return replay_trace(argv[2]);
     install_signal_handlers();
+    if (argc >= 2 && std::string(argv[1]).rfind("--", 0) == 0 && std::string(argv[1]) != "--udp") {
+        return run_platform_mode(argc, argv);
+    }
 
     uint16_t port = 15234;
+    int gravity_ms = 500;
+    std::string trace_dir;
+    // "--udp" (last) offers clients the datagram channel of udp_channel.hpp
+    const bool udp = argc >= 2 && std::string(argv[argc - 1]) == "--udp";
+    if (udp) --argc;
     if (argc >= 2) {
         port = static_cast<uint16_t>(std::stoi(argv[1]));
     }
+    if (argc >= 3) {
+        gravity_ms = std::max(MIN_GRAVITY_MS, std::stoi(argv[2]));
+    }
+    if (argc >= 4) {
+        trace_dir = argv[3];
+    }
 
     int listen_fd = start_tcp_server("0.0.0.0", port);
     if (listen_fd < 0) {
@@ -21,6 +133,6 @@ int main(int argc, char** argv) {
     log_checkpoint("Tetris", "LISTENING", "0.0.0.0:" + std::to_string(port));
 
     // Standalone mode won't have lobby state, so we pass dummies.
-    run_tetris_server_on_fd(listen_fd, "p1", "p2", "127.0.0.1", 12000, 0, "demo");
+    run_tetris_server_on_fd(listen_fd, "p1", "p2", "127.0.0.1", 12000, 0, "demo", nullptr, nullptr, gravity_ms, trace_dir, udp);
     return 0;
 }
@@ -0,0 +1,332 @@
+#pragma once
+#include <string>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include "../core/lp_framing.hpp"
+#include "tetris_game.hpp"
+
+// Binary SNAPSHOT frames, negotiated with "snap=bin2" in HELLO and echoed in WELCOME.
+// They travel over the same length-prefixed channel as the text protocol; the first
+// byte is the format version, which can never start a text frame.
+//
+// Header (24 bytes, integers in network byte order):
+//   u8 version | u8 kind | u8 player | u8 flags | u32 tick (gravity steps so far) | u32 score | u32 lines
+//   u32 ack (last INPUT seq applied to this board) | u8 shape | u8 rotation | i8 x | i8 y
+// Keyframe ('K'): u8 name_len | name | every row packed two cells per byte
+// Delta    ('D'): u32 changed row bitmask | only the changed rows, packed the same way
+// Summary  ('S'): u8 stack height, no board. Sent instead of the others to
+//                 spectators that asked for "detail=summary" (a thumbnail in a room list).
+// The board never includes the falling piece; receivers overlay it from the pose.
+constexpr uint8_t SNAP_BIN_VERSION = 2;
+constexpr uint8_t SNAP_KIND_KEYFRAME = 'K';
+constexpr uint8_t SNAP_KIND_DELTA = 'D';
+constexpr uint8_t SNAP_KIND_SUMMARY = 'S';
+constexpr uint8_t SNAP_FLAG_GAMEOVER = 0x01;
+constexpr int SNAP_HEADER_SIZE = 24;
+constexpr int SNAP_ROW_BYTES = (BOARD_COLS + 1) / 2;
+constexpr int SNAP_KEYFRAME_INTERVAL = 20; // frames between keyframes
+constexpr const char* SNAP_BIN_TAG = "bin2";
+static_assert(BOARD_ROWS <= 32, "changed row bitmask is 32 bits");
+
+inline bool is_binary_snapshot(std::string_view frame) {
+    return !frame.empty() && static_cast<uint8_t>(frame[0]) == SNAP_BIN_VERSION;
+}
+
+// Deltas only make sense on top of the frame before them; keyframes stand alone
+inline bool is_binary_delta(std::string_view frame) {
+    return is_binary_snapshot(frame) && frame.size() > 1 &&
+           static_cast<uint8_t>(frame[1]) == SNAP_KIND_DELTA;
+}
+
+inline void snap_put_u32(std::string& out, uint32_t v) {
+    char b[4] = {static_cast<char>(v >> 24), static_cast<char>(v >> 16), static_cast<char>(v >> 8), static_cast<char>(v)};
+    out.append(b, 4);
+}
+
+inline uint32_t snap_get_u32(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | uint32_t(u[3]);
+}
+
+inline void snap_put_row(std::string& out, const uint8_t (&row)[BOARD_COLS]) {
+    for (int c = 0; c < BOARD_COLS; c += 2) {
+        uint8_t hi = row[c] & 0x0F;
+        uint8_t lo = (c + 1 < BOARD_COLS) ? (row[c + 1] & 0x0F) : 0;
+        out.push_back(static_cast<char>((hi << 4) | lo));
+    }
+}
+
+inline void snap_get_row(const char* p, uint8_t (&row)[BOARD_COLS]) {
+    for (int c = 0; c < BOARD_COLS; c += 2) {
+        uint8_t b = static_cast<uint8_t>(p[c / 2]);
+        row[c] = b >> 4;
+        if (c + 1 < BOARD_COLS) row[c + 1] = b & 0x0F;
+    }
+}
+
+inline void snap_put_header(std::string& out, uint8_t kind, uint8_t player, bool gameover, uint32_t tick, int score,
+                            int lines, uint32_t ack, const Piece& piece) {
+    out.push_back(static_cast<char>(SNAP_BIN_VERSION));
+    out.push_back(static_cast<char>(kind));
+    out.push_back(static_cast<char>(player));
+    out.push_back(static_cast<char>(gameover ? SNAP_FLAG_GAMEOVER : 0));
+    snap_put_u32(out, tick);
+    snap_put_u32(out, static_cast<uint32_t>(score));
+    snap_put_u32(out, static_cast<uint32_t>(lines));
+    snap_put_u32(out, ack);
+    out.push_back(static_cast<char>(piece.shape_id));
+    out.push_back(static_cast<char>(piece.rotation));
+    out.push_back(static_cast<char>(piece.x));
+    out.push_back(static_cast<char>(piece.y));
+}
+
+inline void snap_put_name(std::string& out, const std::string& name) {
+    size_t name_len = std::min<size_t>(name.size(), 255);
+    out.push_back(static_cast<char>(name_len));
+    out.append(name, 0, name_len);
+}
+
+// Server side: one encoder per player, remembers what the viewers already have.
+class SnapshotEncoder {
+public:
+    // Next encode() emits a keyframe, e.g. because a new binary viewer joined
+    void force_keyframe() { need_keyframe_ = true; }
+    // Some viewer is waiting for that keyframe, so the board is worth sending
+    // even if it has not changed
+    bool keyframe_pending() const { return need_keyframe_; }
+
+    std::string encode(const TetrisGame& game, uint8_t player_idx, const std::string& name, uint32_t ack) {
+        std::string out;
+        out.reserve(max_size(name));
+        encode_into(out, game, player_idx, name, ack);
+        return out;
+    }
+
+    // The same appended to out (a recycled frame buffer, say); true for a keyframe
+    bool encode_into(std::string& out, const TetrisGame& game, uint8_t player_idx, const std::string& name,
+                     uint32_t ack) {
+        const bool key = need_keyframe_ || frames_ % SNAP_KEYFRAME_INTERVAL == 0;
+        put_header(out, game, key, player_idx, name, ack);
+        if (key) {
+            for (int r = 0; r < BOARD_ROWS; ++r) snap_put_row(out, game.colors[r]);
+        } else {
+            uint32_t changed = 0;
+            for (int r = 0; r < BOARD_ROWS; ++r) {
+                if (std::memcmp(game.colors[r], sent_[r], BOARD_COLS) != 0) changed |= (1u << r);
+            }
+            snap_put_u32(out, changed);
+            for (int r = 0; r < BOARD_ROWS; ++r) {
+                if (changed & (1u << r)) snap_put_row(out, game.colors[r]);
+            }
+        }
+        std::memcpy(sent_, game.colors, sizeof(sent_));
+        need_keyframe_ = false;
+        ++frames_;
+        return key;
+    }
+
+    // Keyframe of the board as last broadcast, for one viewer catching up (a
+    // resumed session): the shared stream's next delta applies on top of it, so
+    // nobody else has to be sent a keyframe. Leaves the encoder untouched.
+    std::string resync(const TetrisGame& game, uint8_t player_idx, const std::string& name, uint32_t ack) const {
+        std::string out;
+        out.reserve(max_size(name));
+        put_header(out, game, true, player_idx, name, ack);
+        for (int r = 0; r < BOARD_ROWS; ++r) snap_put_row(out, sent_[r]);
+        return out;
+    }
+
+    // Keyframe of the board as it is now, for a channel that cannot rely on
+    // earlier frames (datagrams). Leaves the encoder untouched.
+    std::string keyframe(const TetrisGame& game, uint8_t player_idx, const std::string& name, uint32_t ack) const {
+        std::string out;
+        out.reserve(max_size(name));
+        keyframe_into(out, game, player_idx, name, ack);
+        return out;
+    }
+
+    void keyframe_into(std::string& out, const TetrisGame& game, uint8_t player_idx, const std::string& name,
+                       uint32_t ack) const {
+        put_header(out, game, true, player_idx, name, ack);
+        for (int r = 0; r < BOARD_ROWS; ++r) snap_put_row(out, game.colors[r]);
+    }
+
+private:
+    static size_t max_size(const std::string& name) {
+        return SNAP_HEADER_SIZE + 1 + name.size() + BOARD_ROWS * SNAP_ROW_BYTES;
+    }
+
+    static void put_header(std::string& out, const TetrisGame& game, bool key, uint8_t player_idx,
+                           const std::string& name, uint32_t ack) {
+        snap_put_header(out, key ? SNAP_KIND_KEYFRAME : SNAP_KIND_DELTA, player_idx, game.game_over, game.ticks,
+                        game.score, game.lines_cleared, ack, game.current_piece);
+        if (key) snap_put_name(out, name);
+    }
+
+    uint8_t sent_[BOARD_ROWS][BOARD_COLS] = {};
+    uint32_t frames_ = 0;
+    bool need_keyframe_ = true;
+};
+
+// Text snapshots, for viewers that did not negotiate binary ones:
+//   SNAPSHOT user=<name> score=<n> lines=<n> gameover=<0|1> ack=<seq> board=<200 digits>
+// Server side, one encoder per player. Everything after the name is formatted
+// with to_chars into a fixed buffer, and the framed line is kept until the game's
+// generation or the ack changes, so however many text viewers a board has (and
+// however often it is asked for) the line is built at most once per change.
+class TextSnapshotEncoder {
+public:
+    const LpFrame& encode(const TetrisGame& game, const std::string& name, uint32_t ack) {
+        if (frame_ && &game == game_ && game.generation == generation_ && ack == ack_ && name == name_) return frame_;
+        if (name != name_ || prefix_.empty()) {
+            name_ = name;
+            prefix_ = "SNAPSHOT user=" + name;
+        }
+        char* p = tail_;
+        char* const end = tail_ + sizeof(tail_);
+        p = put(p, " score=");
+        p = std::to_chars(p, end, game.score).ptr;
+        p = put(p, " lines=");
+        p = std::to_chars(p, end, game.lines_cleared).ptr;
+        p = put(p, game.game_over ? " gameover=1" : " gameover=0");
+        p = put(p, " ack=");
+        p = std::to_chars(p, end, ack).ptr;
+        p = put(p, " board=");
+        write_board_chars(p, game.colors, game.current_piece);
+        p += BOARD_ROWS * BOARD_COLS;
+
+        const size_t tail_len = static_cast<size_t>(p - tail_);
+        frame_ = lp_build_frame([&](std::string& out) {
+            out.append(prefix_);
+            out.append(tail_, tail_len);
+        });
+        game_ = &game;
+        generation_ = game.generation;
+        ack_ = ack;
+        return frame_;
+    }
+
+private:
+    static char* put(char* p, const char* s) {
+        const size_t n = std::strlen(s);
+        std::memcpy(p, s, n);
+        return p + n;
+    }
+
+    // Longest tail: three 10-digit counters and a sign, the labels and the board
+    char tail_[96 + BOARD_ROWS * BOARD_COLS];
+    std::string name_;
+    std::string prefix_;
+    const TetrisGame* game_ = nullptr;
+    uint32_t generation_ = 0;
+    uint32_t ack_ = 0;
+    LpFrame frame_;
+};
+
+// Client side: board state for one player slot, rebuilt from keyframes and deltas.
+struct SnapshotView {
+    bool have_keyframe = false;
+    std::string name;
+    uint8_t colors[BOARD_ROWS][BOARD_COLS] = {};
+    Piece piece;
+    int score = 0;
+    int lines = 0;
+    bool gameover = false;
+    uint32_t tick = 0;
+    uint32_t ack = 0; // last of the owner's inputs reflected in this state
+    int height = 0;   // rows up to the highest locked cell, kept by summary frames only
+};
+
+// Rows from the floor up to the highest locked cell of a view's board
+inline int view_stack_height(const SnapshotView& view) {
+    for (int r = 0; r < BOARD_ROWS; ++r) {
+        for (int c = 0; c < BOARD_COLS; ++c) {
+            if (view.colors[r][c] != 0) return BOARD_ROWS - r;
+        }
+    }
+    return 0;
+}
+
+// Applies one binary frame to views[player]. Returns false on malformed frames and on
+// deltas that arrive before that player's first keyframe.
+inline bool apply_binary_snapshot(std::string_view frame, SnapshotView (&views)[2], int& out_player) {
+    if (frame.size() < SNAP_HEADER_SIZE || !is_binary_snapshot(frame)) return false;
+    const char* p = frame.data();
+    const uint8_t kind = static_cast<uint8_t>(p[1]);
+    const uint8_t player = static_cast<uint8_t>(p[2]);
+    if (player > 1) return false;
+    SnapshotView& view = views[player];
+    size_t off = SNAP_HEADER_SIZE;
+
+    if (kind == SNAP_KIND_KEYFRAME) {
+        if (frame.size() < off + 1) return false;
+        size_t name_len = static_cast<uint8_t>(p[off++]);
+        if (frame.size() != off + name_len + BOARD_ROWS * SNAP_ROW_BYTES) return false;
+        view.name.assign(p + off, name_len);
+        off += name_len;
+        for (int r = 0; r < BOARD_ROWS; ++r, off += SNAP_ROW_BYTES) snap_get_row(p + off, view.colors[r]);
+        view.have_keyframe = true;
+    } else if (kind == SNAP_KIND_DELTA) {
+        if (!view.have_keyframe || frame.size() < off + 4) return false;
+        uint32_t changed = snap_get_u32(p + off);
+        off += 4;
+        size_t rows = static_cast<size_t>(__builtin_popcount(changed));
+        if ((changed >> BOARD_ROWS) != 0 || frame.size() != off + rows * SNAP_ROW_BYTES) return false;
+        for (int r = 0; r < BOARD_ROWS; ++r) {
+            if (!(changed & (1u << r))) continue;
+            snap_get_row(p + off, view.colors[r]);
+            off += SNAP_ROW_BYTES;
+        }
+    } else if (kind == SNAP_KIND_SUMMARY) {
+        if (frame.size() != off + 1) return false;
+        view.height = static_cast<uint8_t>(p[off]);
+    } else {
+        return false;
+    }
+
+    view.gameover = (static_cast<uint8_t>(p[3]) & SNAP_FLAG_GAMEOVER) != 0;
+    view.tick = snap_get_u32(p + 4);
+    view.score = static_cast<int>(snap_get_u32(p + 8));
+    view.lines = static_cast<int>(snap_get_u32(p + 12));
+    view.ack = snap_get_u32(p + 16);
+    view.piece.shape_id = static_cast<int8_t>(p[20]);
+    view.piece.rotation = static_cast<int8_t>(p[21]);
+    view.piece.x = static_cast<int8_t>(p[22]);
+    view.piece.y = static_cast<int8_t>(p[23]);
+    out_player = player;
+    return true;
+}
+
+// Keyframe of a view rebuilt from the stream, so a relay can start a late
+// joiner (or catch up a viewer that missed a delta) without asking the room
+inline std::string encode_view_keyframe(const SnapshotView& view, uint8_t player) {
+    std::string out;
+    out.reserve(SNAP_HEADER_SIZE + 1 + view.name.size() + BOARD_ROWS * SNAP_ROW_BYTES);
+    snap_put_header(out, SNAP_KIND_KEYFRAME, player, view.gameover, view.tick, view.score, view.lines, view.ack,
+                    view.piece);
+    snap_put_name(out, view.name);
+    for (int r = 0; r < BOARD_ROWS; ++r) snap_put_row(out, view.colors[r]);
+    return out;
+}
+
+// Summary of a view for spectators that only want the numbers; height is
+// passed in since full views do not keep it
+inline std::string encode_view_summary(const SnapshotView& view, uint8_t player, int height) {
+    std::string out;
+    out.reserve(SNAP_HEADER_SIZE + 1);
+    snap_put_header(out, SNAP_KIND_SUMMARY, player, view.gameover, view.tick, view.score, view.lines, view.ack,
+                    view.piece);
+    out.push_back(static_cast<char>(height));
+    return out;
+}
+
+// Short printable summary for log_communication, binary frames are not logged raw
+inline std::string describe_binary_snapshot(const std::string& frame) {
+    if (frame.size() < SNAP_HEADER_SIZE) return "SNAPSHOT_BIN malformed bytes=" + std::to_string(frame.size());
+    return std::string("SNAPSHOT_BIN kind=") + frame[1] +
+           " player=" + std::to_string(static_cast<uint8_t>(frame[2])) +
+           " tick=" + std::to_string(snap_get_u32(frame.data() + 4)) +
+           " bytes=" + std::to_string(frame.size());
+}
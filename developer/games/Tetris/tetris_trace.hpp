@@ -0,0 +1,344 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+#include "../core/common.hpp"
+#include "tetris_game.hpp"
+
+// Per-match replay trace. Both boards of a match are TetrisGame(seed), so the
+// seed plus every event that changes a board, in order, rebuilds the match
+// exactly. Integers are little-endian, "varint" is LEB128:
+//   header: "TTRC" | u8 version | u32 room | i64 seed | u16 gravity_ms
+//           | i64 start (unix ms) | two names as u8 length + bytes
+//   event:  u8 kind << 1 | board | varint ms since the previous event
+//           | Input only: u8 action (index into INPUT_ACTIONS)
+// A trace without a trailing End event was cut short (server stopped or crashed).
+constexpr char TRACE_MAGIC[4] = {'T', 'T', 'R', 'C'};
+constexpr uint8_t TRACE_VERSION = 1;
+
+enum class TraceKind : uint8_t {
+    Tick = 1,    // gravity step of one board
+    Input = 2,   // handle_input on one board
+    Forfeit = 3, // the player disconnected, board forced to game over
+    End = 4,     // match over, nothing follows
+};
+
+// Appends trace chunks on one background thread for the whole process, so a
+// room never waits on the disk. Files are opened per chunk; rooms flush rarely.
+class TraceFlusher {
+public:
+    void submit(const std::string& path, std::string bytes, bool truncate) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopped_) {
+                write_chunk({path, std::move(bytes), truncate});
+                return;
+            }
+            if (!thread_.joinable()) thread_ = std::thread([this] { run(); });
+            queue_.push_back({path, std::move(bytes), truncate});
+        }
+        cv_.notify_one();
+    }
+
+    // Writes everything queued and stops the thread; later chunks are written inline
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        cv_.notify_one();
+        if (thread_.joinable()) thread_.join();
+    }
+
+private:
+    struct Chunk {
+        std::string path;
+        std::string bytes;
+        bool truncate = false;
+    };
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            cv_.wait(lock, [this] { return stopped_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            std::deque<Chunk> batch;
+            batch.swap(queue_);
+            lock.unlock();
+            for (const Chunk& chunk : batch) write_chunk(chunk);
+            lock.lock();
+        }
+    }
+
+    static void write_chunk(const Chunk& chunk) {
+        int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (chunk.truncate ? O_TRUNC : 0);
+        int fd = ::open(chunk.path.c_str(), flags, 0644);
+        if (fd < 0) {
+            log_message(LogLevel::Warn, "Trace", "cannot open " + chunk.path);
+            return;
+        }
+        const char* p = chunk.bytes.data();
+        size_t left = chunk.bytes.size();
+        while (left > 0) {
+            ssize_t w = ::write(fd, p, left);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                log_message(LogLevel::Warn, "Trace", "write failed " + chunk.path);
+                break;
+            }
+            p += w;
+            left -= static_cast<size_t>(w);
+        }
+        ::close(fd);
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Chunk> queue_;
+    std::thread thread_;
+    bool stopped_ = false;
+};
+
+inline TraceFlusher& trace_flusher() {
+    // Never destroyed; drained at exit so finished matches are always on disk
+    static TraceFlusher* flusher = [] {
+        auto* created = new TraceFlusher();
+        std::atexit([] { trace_flusher().shutdown(); });
+        return created;
+    }();
+    return *flusher;
+}
+
+inline void trace_put_le(std::string& out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back(static_cast<char>(v >> (8 * i)));
+}
+
+inline void trace_put_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+// One event as the trace stores it; action is only written for Input
+inline void trace_put_event(std::string& out, TraceKind kind, int board, uint64_t delta_ms, int action = -1) {
+    out.push_back(static_cast<char>((static_cast<uint8_t>(kind) << 1) | (board & 1)));
+    trace_put_varint(out, delta_ms);
+    if (kind == TraceKind::Input) out.push_back(static_cast<char>(action));
+}
+
+// Writer side, owned by one TetrisRoom. Events are buffered and handed to the
+// flusher every kFlushBytes and when the trace closes.
+class MatchTrace {
+public:
+    static constexpr size_t kFlushBytes = 4096;
+
+    ~MatchTrace() { close(); }
+
+    // Starts <dir>/room<id>-<seed>.trace; the file itself is written by the flusher
+    void open(const std::string& dir, int room_id, int64_t seed, int gravity_ms,
+              const std::string& p1, const std::string& p2) {
+        close();
+        path_ = dir + "/room" + std::to_string(room_id) + "-" + std::to_string(seed) + ".trace";
+        buffer_.assign(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        buffer_.push_back(static_cast<char>(TRACE_VERSION));
+        trace_put_le(buffer_, static_cast<uint32_t>(room_id), 4);
+        trace_put_le(buffer_, static_cast<uint64_t>(seed), 8);
+        trace_put_le(buffer_, static_cast<uint16_t>(gravity_ms), 2);
+        auto start = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        trace_put_le(buffer_, static_cast<uint64_t>(start), 8);
+        for (const std::string* name : {&p1, &p2}) {
+            size_t n = std::min<size_t>(name->size(), 255);
+            buffer_.push_back(static_cast<char>(n));
+            buffer_.append(*name, 0, n);
+        }
+        start_ = std::chrono::steady_clock::now();
+        last_ms_ = 0;
+        first_chunk_ = true;
+        active_ = true;
+    }
+
+    bool active() const { return active_; }
+    const std::string& path() const { return path_; }
+
+    void tick(int board) { event(TraceKind::Tick, board); }
+    void forfeit(int board) { event(TraceKind::Forfeit, board); }
+    void input(int board, InputAction action) { event(TraceKind::Input, board, action); }
+
+    // Marks the match complete and hands over the rest
+    void end() {
+        if (!active_) return;
+        event(TraceKind::End, 0);
+        close();
+    }
+
+    // Hands over what is buffered without an End marker
+    void close() {
+        if (!active_) return;
+        flush();
+        active_ = false;
+    }
+
+private:
+    void event(TraceKind kind, int board, int action = -1) {
+        if (!active_) return;
+        // Deltas are taken between whole milliseconds since the start so they never drift
+        auto at = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_).count();
+        trace_put_event(buffer_, kind, board, static_cast<uint64_t>(std::max<int64_t>(at - last_ms_, 0)), action);
+        last_ms_ = std::max<int64_t>(at, last_ms_);
+        if (buffer_.size() >= kFlushBytes) flush();
+    }
+
+    void flush() {
+        if (buffer_.empty()) return;
+        trace_flusher().submit(path_, std::move(buffer_), first_chunk_);
+        buffer_.clear();
+        first_chunk_ = false;
+    }
+
+    std::string path_;
+    std::string buffer_;
+    std::chrono::steady_clock::time_point start_;
+    int64_t last_ms_ = 0;
+    bool first_chunk_ = true;
+    bool active_ = false;
+};
+
+// Reader side
+struct TraceHeader {
+    uint32_t room_id = 0;
+    int64_t seed = 0;
+    uint16_t gravity_ms = 0;
+    int64_t start_unix_ms = 0;
+    std::string names[2];
+};
+
+struct TraceEvent {
+    TraceKind kind;
+    int board = 0;
+    uint64_t at_ms = 0;          // since the start of the match
+    InputAction action = INPUT_LEFT; // Input only
+};
+
+// Reads the event at data[pos] (at is the time of the one before it) and moves
+// pos past it; false at the end of the data or on a malformed event
+inline bool trace_next_event(std::string_view data, size_t& pos, uint64_t& at, TraceEvent& ev) {
+    if (pos >= data.size()) return false;
+    const uint8_t tag = static_cast<uint8_t>(data[pos++]);
+    uint64_t delta = 0;
+    for (int shift = 0;; shift += 7) {
+        if (pos >= data.size() || shift >= 64) return false;
+        const uint8_t b = static_cast<uint8_t>(data[pos++]);
+        delta |= uint64_t(b & 0x7F) << shift;
+        if (!(b & 0x80)) break;
+    }
+    ev = TraceEvent{static_cast<TraceKind>(tag >> 1), tag & 1, at + delta, INPUT_LEFT};
+    if (ev.kind == TraceKind::Input) {
+        if (pos >= data.size() || static_cast<uint8_t>(data[pos]) >= INPUT_ACTION_COUNT) return false;
+        ev.action = static_cast<InputAction>(static_cast<uint8_t>(data[pos++]));
+    } else if (ev.kind != TraceKind::Tick && ev.kind != TraceKind::Forfeit && ev.kind != TraceKind::End) {
+        return false;
+    }
+    at = ev.at_ms;
+    return true;
+}
+
+// Parses a trace held in memory: the header, then fn(const TraceEvent&) for
+// each event. False when the header is bad; complete tells whether the End
+// event was reached.
+template <typename Fn>
+bool parse_match_trace(std::string_view data, TraceHeader& header, Fn&& fn, bool* complete = nullptr) {
+    if (complete) *complete = false;
+    size_t pos = 0;
+    auto take = [&](int bytes, uint64_t& v) {
+        if (pos + bytes > data.size()) return false;
+        v = 0;
+        for (int i = 0; i < bytes; ++i) v |= uint64_t(static_cast<uint8_t>(data[pos + i])) << (8 * i);
+        pos += bytes;
+        return true;
+    };
+
+    if (data.compare(0, sizeof(TRACE_MAGIC), std::string_view(TRACE_MAGIC, sizeof(TRACE_MAGIC))) != 0) return false;
+    pos = sizeof(TRACE_MAGIC);
+    uint64_t version, room, seed, gravity, start;
+    if (!take(1, version) || version != TRACE_VERSION) return false;
+    if (!take(4, room) || !take(8, seed) || !take(2, gravity) || !take(8, start)) return false;
+    header.room_id = static_cast<uint32_t>(room);
+    header.seed = static_cast<int64_t>(seed);
+    header.gravity_ms = static_cast<uint16_t>(gravity);
+    header.start_unix_ms = static_cast<int64_t>(start);
+    for (std::string& name : header.names) {
+        uint64_t n;
+        if (!take(1, n) || pos + n > data.size()) return false;
+        name = std::string(data.substr(pos, n));
+        pos += n;
+    }
+
+    uint64_t at = 0;
+    TraceEvent ev;
+    while (trace_next_event(data, pos, at, ev)) {
+        if (ev.kind == TraceKind::End) {
+            if (complete) *complete = true;
+            break;
+        }
+        fn(ev);
+    }
+    return true;
+}
+
+// The same for a trace file
+template <typename Fn>
+bool read_match_trace(const std::string& path, TraceHeader& header, Fn&& fn, bool* complete = nullptr) {
+    std::ifstream in(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return parse_match_trace(data, header, std::forward<Fn>(fn), complete);
+}
+
+// Does to a board what the event did to it
+inline void trace_apply(TetrisGame& game, const TraceEvent& ev) {
+    switch (ev.kind) {
+    case TraceKind::Tick: game.tick(); break;
+    case TraceKind::Input: game.handle_input(ev.action); break;
+    case TraceKind::Forfeit: game.forfeit(); break;
+    default: break;
+    }
+}
+
+// Rebuilds both boards as they stood when the trace ends
+inline bool replay_match_trace(const std::string& path, TraceHeader& header,
+                               std::unique_ptr<TetrisGame> (&games)[2], bool* complete = nullptr) {
+    TraceHeader parsed;
+    bool ok = read_match_trace(path, parsed, [&](const TraceEvent& ev) {
+        if (!games[0]) {
+            auto sequence = std::make_shared<PieceSequence>(parsed.seed);
+            games[0] = std::make_unique<TetrisGame>(sequence);
+            games[1] = std::make_unique<TetrisGame>(sequence);
+        }
+        trace_apply(*games[ev.board], ev);
+    }, complete);
+    if (!ok) return false;
+    header = parsed;
+    if (!games[0]) {
+        auto sequence = std::make_shared<PieceSequence>(header.seed);
+        games[0] = std::make_unique<TetrisGame>(sequence);
+        games[1] = std::make_unique<TetrisGame>(sequence);
+    }
+    return true;
+}
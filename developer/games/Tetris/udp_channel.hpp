@@ -0,0 +1,125 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Optional datagram channel next to a match connection, for lossy links (Wi-Fi)
+// where one lost TCP segment holds back every snapshot behind it.
+//
+// A client asks with "udp=1" in HELLO; a room that offers it answers in WELCOME
+// with "udp=<port> udp_key=<16 hex digits>" (the port is on the same host).
+// Every datagram, both ways (integers in network byte order):
+//   u8 version | u8 type | u64 key | u32 seq | payload
+// Client -> room:
+//   'H' hello / keepalive, payload u8 ready. Sent until the room answers, then
+//       every UDP_KEEPALIVE_MS with ready=1: from the first of those on, the room
+//       sends this client its snapshots and POSE here instead of over TCP.
+//   'I' inputs, payload u8 count, then per input u32 seq | u32 t | u8 len | action.
+//       Every input the client has not seen acked (by a snapshot or POSE of its
+//       own board) rides in every datagram, so a lost one costs nothing; the
+//       room applies those past the last seq it applied.
+// Room -> client:
+//   'H' answer to a hello, no payload
+//   'F' frame, payload u8 lane | the body of a frame that would otherwise have
+//       gone over TCP (a binary keyframe, or POSE). seq counts per client; in
+//       each lane (the board the frame is about) a datagram is only used if its
+//       seq is above the last one used, so a late one never undoes a newer
+//       state. Snapshots sent this way are always keyframes: each stands alone.
+// TCP stays the control path (HELLO, WELCOME, events, GAME_OVER) and the
+// fallback: a client that never hears the room over UDP just keeps using it.
+constexpr uint8_t UDP_VERSION = 1;
+constexpr uint8_t UDP_HELLO = 'H';
+constexpr uint8_t UDP_INPUTS = 'I';
+constexpr uint8_t UDP_FRAME = 'F';
+constexpr size_t UDP_HEADER_SIZE = 14;
+constexpr size_t UDP_MAX_DATAGRAM = 1200; // stays under any path MTU
+constexpr size_t UDP_MAX_INPUTS = 32;     // oldest unacked inputs per datagram
+constexpr int UDP_HELLO_RETRY_MS = 200;
+constexpr int UDP_GIVE_UP_MS = 3000;      // no answer by then: stay on TCP
+constexpr int UDP_KEEPALIVE_MS = 1000;    // also keeps NAT mappings open
+constexpr int UDP_RESEND_MS = 50;         // unacked inputs are repeated this often
+// Either side that hears nothing for this long (keepalives and their answers
+// included) gives the session up: the client closes it, the room goes back to
+// sending that client everything over TCP
+constexpr int UDP_SILENCE_MS = 5000;
+
+struct UdpHeader {
+    uint8_t type = 0;
+    uint64_t key = 0;
+    uint32_t seq = 0;
+};
+
+struct UdpInput {
+    uint32_t seq = 0;
+    uint32_t t = 0; // client clock in ms, echoed in POSE
+    std::string action;
+};
+
+inline void udp_put_u32(std::string& out, uint32_t v) {
+    char b[4] = {static_cast<char>(v >> 24), static_cast<char>(v >> 16), static_cast<char>(v >> 8), static_cast<char>(v)};
+    out.append(b, 4);
+}
+
+inline uint32_t udp_get_u32(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | uint32_t(u[3]);
+}
+
+inline void udp_put_header(std::string& out, uint8_t type, uint64_t key, uint32_t seq) {
+    out.push_back(static_cast<char>(UDP_VERSION));
+    out.push_back(static_cast<char>(type));
+    udp_put_u32(out, static_cast<uint32_t>(key >> 32));
+    udp_put_u32(out, static_cast<uint32_t>(key));
+    udp_put_u32(out, seq);
+}
+
+// False for anything that is not one of our datagrams
+inline bool udp_parse(const char* data, size_t len, UdpHeader& h, std::string_view& payload) {
+    if (len < UDP_HEADER_SIZE || static_cast<uint8_t>(data[0]) != UDP_VERSION) return false;
+    h.type = static_cast<uint8_t>(data[1]);
+    h.key = (uint64_t(udp_get_u32(data + 2)) << 32) | udp_get_u32(data + 6);
+    h.seq = udp_get_u32(data + 10);
+    payload = std::string_view(data + UDP_HEADER_SIZE, len - UDP_HEADER_SIZE);
+    return true;
+}
+
+// Up to UDP_MAX_INPUTS of inputs, oldest first, as long as they fit a datagram
+template <typename Inputs>
+std::string udp_encode_inputs(uint64_t key, uint32_t seq, const Inputs& inputs) {
+    std::string out;
+    udp_put_header(out, UDP_INPUTS, key, seq);
+    out.push_back(0);
+    uint8_t count = 0;
+    for (const UdpInput& in : inputs) {
+        if (count == UDP_MAX_INPUTS || out.size() + 9 + in.action.size() > UDP_MAX_DATAGRAM) break;
+        udp_put_u32(out, in.seq);
+        udp_put_u32(out, in.t);
+        const size_t len = std::min<size_t>(in.action.size(), 255);
+        out.push_back(static_cast<char>(len));
+        out.append(in.action, 0, len);
+        ++count;
+    }
+    out[UDP_HEADER_SIZE] = static_cast<char>(count);
+    return out;
+}
+
+inline bool udp_decode_inputs(std::string_view payload, std::vector<UdpInput>& out) {
+    if (payload.empty()) return false;
+    const size_t count = static_cast<uint8_t>(payload[0]);
+    size_t off = 1;
+    for (size_t i = 0; i < count; ++i) {
+        if (payload.size() < off + 9) return false;
+        UdpInput in;
+        in.seq = udp_get_u32(payload.data() + off);
+        in.t = udp_get_u32(payload.data() + off + 4);
+        const size_t len = static_cast<uint8_t>(payload[off + 8]);
+        off += 9;
+        if (payload.size() < off + len) return false;
+        in.action.assign(payload.substr(off, len));
+        off += len;
+        out.push_back(std::move(in));
+    }
+    return off == payload.size();
+}
@@ -0,0 +1,150 @@
+#include "uring_sender.hpp"
+
+#if defined(TETRIS_IO_URING)
+
+#include "../core/common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+int ring_setup(unsigned entries, io_uring_params* p) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+int ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+// The kernel moves the sq head and the cq tail; we move the other two
+unsigned load_acquire(unsigned* p) {
+    return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+}
+
+void store_release(unsigned* p, unsigned v) {
+    std::atomic_ref<unsigned>(*p).store(v, std::memory_order_release);
+}
+
+template <typename T>
+T* at(void* base, size_t offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+}
+
+UringSender::UringSender(unsigned entries) {
+    io_uring_params p{};
+    const int fd = ring_setup(entries, &p);
+    if (fd < 0) {
+        log_message(LogLevel::Info, "Uring", std::string("io_uring unavailable (") + std::strerror(errno) + "), using sendmsg");
+        return;
+    }
+    sq_ring_bytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_ring_bytes_ = cq_ring_bytes_ = std::max(sq_ring_bytes_, cq_ring_bytes_);
+    sq_ring_ = ::mmap(nullptr, sq_ring_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq_ring_ = single ? sq_ring_
+                      : ::mmap(nullptr, cq_ring_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                               IORING_OFF_CQ_RING);
+    sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = ::mmap(nullptr, sqes_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+        perror("[Uring] mmap");
+        if (sq_ring_ != MAP_FAILED) ::munmap(sq_ring_, sq_ring_bytes_);
+        if (!single && cq_ring_ != MAP_FAILED) ::munmap(cq_ring_, cq_ring_bytes_);
+        if (sqes_ != MAP_FAILED) ::munmap(sqes_, sqes_bytes_);
+        sq_ring_ = cq_ring_ = sqes_ = nullptr;
+        ::close(fd);
+        return;
+    }
+    sq_head_ = at<unsigned>(sq_ring_, p.sq_off.head);
+    sq_tail_ = at<unsigned>(sq_ring_, p.sq_off.tail);
+    sq_mask_ = at<unsigned>(sq_ring_, p.sq_off.ring_mask);
+    sq_array_ = at<unsigned>(sq_ring_, p.sq_off.array);
+    cq_head_ = at<unsigned>(cq_ring_, p.cq_off.head);
+    cq_tail_ = at<unsigned>(cq_ring_, p.cq_off.tail);
+    cq_mask_ = at<unsigned>(cq_ring_, p.cq_off.ring_mask);
+    cqes_ = at<void>(cq_ring_, p.cq_off.cqes);
+    entries_ = p.sq_entries;
+    ring_fd_ = fd;
+}
+
+UringSender::~UringSender() {
+    if (ring_fd_ < 0) return;
+    ::munmap(sqes_, sqes_bytes_);
+    if (cq_ring_ != sq_ring_) ::munmap(cq_ring_, cq_ring_bytes_);
+    ::munmap(sq_ring_, sq_ring_bytes_);
+    ::close(ring_fd_);
+}
+
+size_t UringSender::space() const {
+    return available() ? entries_ - queued_ : 0;
+}
+
+bool UringSender::queue(int fd, const msghdr* msg, uint64_t tag) {
+    if (!available() || queued_ == entries_) return false;
+    const unsigned tail = *sq_tail_;
+    const unsigned index = tail & *sq_mask_;
+    io_uring_sqe& sqe = static_cast<io_uring_sqe*>(sqes_)[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_SENDMSG;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(msg);
+    sqe.len = 1;
+    // MSG_DONTWAIT: a full socket completes at once with -EAGAIN instead of
+    // being parked in the kernel, the same as the sendmsg path
+    sqe.msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    sqe.user_data = tag;
+    sq_array_[index] = index;
+    store_release(sq_tail_, tail + 1);
+    ++queued_;
+    return true;
+}
+
+bool UringSender::submit(std::vector<Result>& results) {
+    results.clear();
+    unsigned to_submit = queued_;
+    const unsigned expected = queued_;
+    queued_ = 0;
+    while (results.size() < expected) {
+        const int n = ring_enter(ring_fd_, to_submit, static_cast<unsigned>(expected - results.size()),
+                                 IORING_ENTER_GETEVENTS);
+        if (n < 0 && errno != EINTR) {
+            perror("[Uring] io_uring_enter");
+            return false;
+        }
+        if (n > 0) to_submit -= std::min(to_submit, static_cast<unsigned>(n));
+        unsigned head = *cq_head_;
+        const unsigned tail = load_acquire(cq_tail_);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = static_cast<io_uring_cqe*>(cqes_)[head & *cq_mask_];
+            results.push_back(Result{cqe.user_data, static_cast<long>(cqe.res)});
+        }
+        store_release(cq_head_, head);
+    }
+    return true;
+}
+
+#else
+
+UringSender::UringSender(unsigned) {}
+UringSender::~UringSender() = default;
+size_t UringSender::space() const {
+    return 0;
+}
+bool UringSender::queue(int, const msghdr*, uint64_t) {
+    return false;
+}
+bool UringSender::submit(std::vector<Result>& results) {
+    results.clear();
+    return true;
+}
+
+#endif
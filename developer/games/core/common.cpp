@@ -0,0 +1,1080 @@
+#include "common.hpp"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+std::atomic<LogLevel> g_log_level(LogLevel::Info);
+
+// Appends "YYYY-mm-dd HH:MM:SS.mmm". The part up to the seconds is formatted
+// once per second and reused; only the milliseconds are written per record.
+void append_timestamp(std::string& out, std::chrono::system_clock::time_point now) {
+    using namespace std::chrono;
+    struct SecondCache {
+        std::time_t second = -1;
+        char text[32] = {};
+        size_t len = 0;
+    };
+    thread_local SecondCache cache;
+    auto tt = system_clock::to_time_t(now);
+    if (tt != cache.second) {
+        std::tm tm_buf{};
+#if defined(_WIN32)
+        localtime_s(&tm_buf, &tt);
+#else
+        localtime_r(&tt, &tm_buf);
+#endif
+        cache.len = std::strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S", &tm_buf);
+        cache.second = tt;
+    }
+    auto ms = static_cast<int>((duration_cast<milliseconds>(now.time_since_epoch()) % 1000).count());
+    char frac[4] = {'.', static_cast<char>('0' + ms / 100), static_cast<char>('0' + ms / 10 % 10),
+                    static_cast<char>('0' + ms % 10)};
+    out.append(cache.text, cache.len);
+    out.append(frac, 4);
+}
+
+const char* level_to_string(LogLevel level) {
+    switch (level) {
+        case LogLevel::Error: return "ERROR";
+        case LogLevel::Warn:  return "WARN";
+        case LogLevel::Info:  return "INFO";
+        case LogLevel::Debug: return "DEBUG";
+        case LogLevel::Trace: return "TRACE";
+        default: return "INFO";
+    }
+}
+
+bool is_delim(char c) {
+    switch (c) {
+        case ' ': case '\t': case '\n': case '\r':
+            return true;
+        default:
+            return false;
+    }
+}
+
+// original_size: the payload's length before the log ring cut it short
+std::string sanitize_payload(std::string_view payload, size_t original_size) {
+    std::string sanitized(payload);
+    auto mask_key = [&](const std::string& key) {
+        size_t pos = 0;
+        while ((pos = sanitized.find(key, pos)) != std::string::npos) {
+            size_t value_start = pos + key.size();
+            size_t value_end = value_start;
+            while (value_end < sanitized.size() && !is_delim(sanitized[value_end])) {
+                ++value_end;
+            }
+            sanitized.replace(value_start, value_end - value_start, "***");
+            pos = value_end;
+        }
+    };
+    mask_key("pass=");
+    mask_key("password=");
+    mask_key("token=");
+    mask_key("auth=");
+    mask_key("secret=");
+
+    // "<CMD> <user> <password...>" becomes "<CMD> <user> ***"
+    auto mask_positional = [&](const std::string& prefix) {
+        if (sanitized.rfind(prefix, 0) != 0) return;
+        size_t cmd_end = prefix.size();
+        while (cmd_end < sanitized.size() && !is_delim(sanitized[cmd_end])) ++cmd_end;
+        size_t user_start = cmd_end;
+        while (user_start < sanitized.size() && is_delim(sanitized[user_start])) ++user_start;
+        size_t user_end = user_start;
+        while (user_end < sanitized.size() && !is_delim(sanitized[user_end])) ++user_end;
+        if (user_end > user_start) {
+            sanitized = sanitized.substr(0, cmd_end) + " " + sanitized.substr(user_start, user_end - user_start) + " ***";
+        }
+    };
+    mask_positional("REGISTER");
+    mask_positional("LOGIN");
+
+    constexpr size_t limit = 240;
+    if (sanitized.size() > limit || original_size > payload.size()) {
+        std::ostringstream os;
+        size_t head = limit - 20;
+        size_t total = original_size > payload.size() ? original_size : sanitized.size();
+        os << sanitized.substr(0, head) << "...<" << total << " bytes>";
+        sanitized = os.str();
+    }
+    return sanitized;
+}
+
+void write_fd(int fd, const std::string& text) {
+    const char* p = text.data();
+    size_t left = text.size();
+    while (left > 0) {
+        ssize_t w = ::write(fd, p, left);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return;
+        p += w;
+        left -= static_cast<size_t>(w);
+    }
+}
+
+size_t env_size(const char* name, size_t fallback) {
+    const char* v = std::getenv(name);
+    if (!v || !*v) return fallback;
+    char* end = nullptr;
+    unsigned long long n = std::strtoull(v, &end, 10);
+    return end && *end == '\0' ? static_cast<size_t>(n) : fallback;
+}
+
+// --- Log files ---
+// With TETRIS_LOG_FILE set the log goes to that file instead of stderr and is
+// rotated once it passes TETRIS_LOG_ROTATE_MB (default 64) or has been open
+// TETRIS_LOG_ROTATE_SECONDS (default a day): it is renamed to
+// <path>.<yyyymmdd-HHMMSS> and a new file opened, all on the log writer
+// thread. A compressor thread at idle CPU and I/O priority gzips the rotated
+// files (the gzip child inherits its priority) and keeps the newest
+// TETRIS_LOG_KEEP (default 8), so the log takes bounded disk and the slow part
+// runs on neither the writer nor the threads that log.
+class LogCompressor {
+public:
+    LogCompressor(std::string path, size_t keep) : path_(std::move(path)), keep_(keep) {
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    void add(std::string rotated) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(rotated));
+        }
+        cv_.notify_one();
+    }
+
+    // The file being compressed is finished; the rest wait for the next run
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        if (thread_.joinable()) thread_.join();
+    }
+
+private:
+    void run() {
+        ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), 19);
+        constexpr int kIoprioWhoProcess = 1, kIoprioClassIdle = 3, kIoprioClassShift = 13;
+        ::syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, kIoprioClassIdle << kIoprioClassShift);
+        // Rotated files an earlier run left uncompressed
+        for (const std::string& f : rotated_files()) {
+            if (f.size() < 3 || f.compare(f.size() - 3, 3, ".gz") != 0) add(f);
+        }
+        prune();
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (stop_) return;
+            std::string file = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            compress(file);
+            prune();
+            lock.lock();
+        }
+    }
+
+    void compress(const std::string& file) {
+        char arg0[] = "gzip", arg1[] = "-f", arg2[] = "-q";
+        std::string target = file;
+        char* argv[] = {arg0, arg1, arg2, target.data(), nullptr};
+        pid_t pid = -1;
+        int status = 0;
+        if (::posix_spawnp(&pid, "gzip", nullptr, nullptr, argv, environ) != 0 ||
+            ::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            if (!warned_) log_message(LogLevel::Warn, "Log", "cannot gzip " + file + ", rotated logs stay uncompressed");
+            warned_ = true;
+        }
+    }
+
+    // Rotated files of path_, oldest first: by timestamp, then the counter
+    // rotate() adds when one second saw several
+    std::vector<std::string> rotated_files() const {
+        const size_t slash = path_.rfind('/');
+        const std::string dir = slash == std::string::npos ? "." : path_.substr(0, slash);
+        const std::string prefix = (slash == std::string::npos ? path_ : path_.substr(slash + 1)) + ".";
+        std::vector<std::string> files;
+        DIR* d = ::opendir(dir.c_str());
+        if (!d) return files;
+        while (dirent* e = ::readdir(d)) {
+            std::string_view name(e->d_name);
+            if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+                std::isdigit(static_cast<unsigned char>(name[prefix.size()]))) {
+                files.push_back(dir + "/" + std::string(name));
+            }
+        }
+        ::closedir(d);
+        auto key = [skip = dir.size() + 1 + prefix.size()](const std::string& f) {
+            std::string_view rest = std::string_view(f).substr(skip);
+            if (rest.size() >= 3 && rest.substr(rest.size() - 3) == ".gz") rest.remove_suffix(3);
+            const size_t dot = rest.find('.');
+            return std::make_pair(rest.substr(0, dot), dot == std::string_view::npos ? 0 : std::atoi(rest.data() + dot + 1));
+        };
+        std::sort(files.begin(), files.end(), [&key](const std::string& a, const std::string& b) { return key(a) < key(b); });
+        return files;
+    }
+
+    void prune() {
+        std::vector<std::string> files = rotated_files();
+        for (size_t i = 0; i + keep_ < files.size(); ++i) ::unlink(files[i].c_str());
+    }
+
+    std::string path_;
+    size_t keep_;
+    bool warned_ = false;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::string> queue_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+// The writer's end: stderr, or the rotated file described above
+class LogSink {
+public:
+    LogSink() {
+        const char* path = std::getenv("TETRIS_LOG_FILE");
+        if (!path || !*path) return;
+        path_ = path;
+        max_bytes_ = env_size("TETRIS_LOG_ROTATE_MB", 64) * 1024 * 1024;
+        max_age_ = std::chrono::seconds(env_size("TETRIS_LOG_ROTATE_SECONDS", 24 * 3600));
+        if (!open()) {
+            write_fd(STDERR_FILENO, "[Log] cannot open " + path_ + ": " + std::strerror(errno) + ", logging to stderr\n");
+            return;
+        }
+        compressor_ = std::make_unique<LogCompressor>(path_, env_size("TETRIS_LOG_KEEP", 8));
+    }
+
+    // Writer thread: rotates first when this text would pass a limit
+    void write(const std::string& text) {
+        if (fd_ >= 0 && bytes_ > 0 &&
+            (bytes_ + text.size() > max_bytes_ || std::chrono::steady_clock::now() - opened_ >= max_age_)) {
+            rotate();
+        }
+        write_direct(text);
+        bytes_ += text.size();
+    }
+
+    // Any thread, once the writer is gone; never rotates
+    void write_direct(const std::string& text) const { write_fd(fd_ >= 0 ? fd_ : STDERR_FILENO, text); }
+
+    void stop() {
+        if (compressor_) compressor_->stop();
+    }
+
+private:
+    bool open() {
+        fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0) return false;
+        struct stat st{};
+        bytes_ = ::fstat(fd_, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+        opened_ = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    void rotate() {
+        char stamp[32];
+        std::time_t now = std::time(nullptr);
+        std::tm tm_buf{};
+        localtime_r(&now, &tm_buf);
+        std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_buf);
+        // Counted up within a second, never reused: pruning frees the oldest names
+        rotated_in_second_ = stamp == last_stamp_ ? rotated_in_second_ + 1 : 0;
+        last_stamp_ = stamp;
+        std::string rotated;
+        while (true) {
+            rotated = path_ + "." + stamp;
+            if (rotated_in_second_ > 0) rotated += "." + std::to_string(rotated_in_second_);
+            if (::access(rotated.c_str(), F_OK) != 0 && ::access((rotated + ".gz").c_str(), F_OK) != 0) break;
+            ++rotated_in_second_;
+        }
+        if (::rename(path_.c_str(), rotated.c_str()) != 0) {
+            opened_ = std::chrono::steady_clock::now(); // keep appending; try again at the next limit
+            bytes_ = 0;
+            return;
+        }
+        const int old_fd = fd_;
+        if (!open()) {
+            fd_ = old_fd; // the renamed file takes the log until a later rotation works
+            bytes_ = 0;
+            opened_ = std::chrono::steady_clock::now();
+            return;
+        }
+        ::close(old_fd);
+        compressor_->add(std::move(rotated));
+    }
+
+    std::string path_;
+    int fd_ = -1;
+    size_t bytes_ = 0;
+    size_t max_bytes_ = 0;
+    std::chrono::seconds max_age_{0};
+    std::chrono::steady_clock::time_point opened_;
+    std::string last_stamp_;
+    int rotated_in_second_ = 0;
+    std::unique_ptr<LogCompressor> compressor_;
+};
+
+// Logging is asynchronous: callers copy the raw pieces of a record into a slot
+// of a bounded lock-free MPSC ring (per-slot sequence numbers, no allocation,
+// no lock) and one background thread formats, sanitizes and writes them to
+// stderr (or the log file, see LogSink) in batches. A full ring drops the record and counts it; the writer
+// reports the count. At exit the ring is drained and anything logged later
+// (static destructors, threads still winding down) is written directly.
+enum class LogKind : uint8_t { Message, Checkpoint, Communication };
+
+class AsyncLog {
+public:
+    static constexpr size_t kSlots = 4096; // power of two
+    static constexpr size_t kSlotBytes = 480;
+    static constexpr int kMaxFields = 4;
+    static constexpr size_t kBatch = 256;
+
+    AsyncLog() : slots_(new Slot[kSlots]) {
+        for (size_t i = 0; i < kSlots; ++i) slots_[i].seq.store(i, std::memory_order_relaxed);
+        writer_ = std::thread([this]() { run(); });
+    }
+
+    void shutdown() {
+        stop_.store(true);
+        wake();
+        if (writer_.joinable()) writer_.join();
+        sink_.stop();
+    }
+
+    // The last field may be cut to fit the slot; its full length is kept
+    void push(LogLevel level, LogKind kind, std::initializer_list<std::string_view> fields) {
+        if (stop_.load(std::memory_order_relaxed)) {
+            Slot slot;
+            fill(slot, level, kind, fields);
+            std::string out;
+            format(slot, out);
+            sink_.write_direct(out);
+            return;
+        }
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots_[pos & (kSlots - 1)];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+
+        fill(*slot, level, kind, fields);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        wake();
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq{0};
+        std::chrono::system_clock::time_point time;
+        LogLevel level = LogLevel::Info;
+        LogKind kind = LogKind::Message;
+        uint8_t count = 0;
+        uint16_t lens[kMaxFields] = {};
+        uint32_t last_size = 0;
+        char data[kSlotBytes];
+    };
+
+    static void fill(Slot& slot, LogLevel level, LogKind kind, std::initializer_list<std::string_view> fields) {
+        slot.time = std::chrono::system_clock::now();
+        slot.level = level;
+        slot.kind = kind;
+        slot.count = 0;
+        size_t used = 0;
+        for (std::string_view f : fields) {
+            size_t n = std::min(f.size(), kSlotBytes - used);
+            std::memcpy(slot.data + used, f.data(), n);
+            slot.lens[slot.count++] = static_cast<uint16_t>(n);
+            slot.last_size = static_cast<uint32_t>(f.size());
+            used += n;
+        }
+    }
+
+    void wake() {
+        wake_seq_.fetch_add(1);
+        if (writer_waiting_.load()) wake_seq_.notify_one();
+    }
+
+    static void format(const Slot& slot, std::string& out) {
+        std::string_view fields[kMaxFields];
+        size_t off = 0;
+        for (int i = 0; i < slot.count; ++i) {
+            fields[i] = std::string_view(slot.data + off, slot.lens[i]);
+            off += slot.lens[i];
+        }
+        out += '[';
+        append_timestamp(out, slot.time);
+        out += "] [";
+        out += fields[0];
+        out += "] [";
+        out += level_to_string(slot.level);
+        out += "] ";
+        switch (slot.kind) {
+            case LogKind::Message:
+                out += fields[1];
+                break;
+            case LogKind::Checkpoint:
+                out += "CHECKPOINT ";
+                out += fields[1];
+                if (!fields[2].empty()) {
+                    out += ' ';
+                    out += fields[2];
+                }
+                break;
+            case LogKind::Communication:
+                out += "COMM ";
+                out += fields[1];
+                out += " peer=";
+                out += fields[2];
+                out += " body=";
+                out += sanitize_payload(fields[3], slot.last_size);
+                break;
+        }
+        out += '\n';
+    }
+
+    // Formats and writes up to kBatch records; false when the ring was empty
+    bool drain_batch(std::string& out) {
+        out.clear();
+        size_t n = 0;
+        for (; n < kBatch; ++n) {
+            Slot& slot = slots_[tail_ & (kSlots - 1)];
+            if (slot.seq.load(std::memory_order_acquire) != tail_ + 1) break;
+            format(slot, out);
+            slot.seq.store(tail_ + kSlots, std::memory_order_release);
+            ++tail_;
+        }
+        size_t dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped_) {
+            out += '[';
+            append_timestamp(out, std::chrono::system_clock::now());
+            out += "] [Log] [WARN] dropped " + std::to_string(dropped - reported_dropped_) + " records, ring full\n";
+            reported_dropped_ = dropped;
+        }
+        if (!out.empty()) sink_.write(out);
+        return n > 0;
+    }
+
+    void run() {
+        std::string out;
+        while (true) {
+            if (drain_batch(out)) continue;
+            if (stop_.load()) break;
+            // Sleep until a producer bumps wake_seq_; re-check after announcing
+            // ourselves so a push that missed the flag is still seen
+            uint32_t seen = wake_seq_.load();
+            writer_waiting_.store(true);
+            if (!stop_.load() && slots_[tail_ & (kSlots - 1)].seq.load(std::memory_order_acquire) != tail_ + 1) {
+                wake_seq_.wait(seen);
+            }
+            writer_waiting_.store(false);
+        }
+        while (drain_batch(out)) {}
+    }
+
+    LogSink sink_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<size_t> head_{0}; // producers claim slots here
+    alignas(64) size_t tail_ = 0;             // writer thread only
+    std::atomic<size_t> dropped_{0};
+    size_t reported_dropped_ = 0;
+    std::atomic<uint32_t> wake_seq_{0};
+    std::atomic<bool> writer_waiting_{false};
+    std::atomic<bool> stop_{false};
+    std::thread writer_;
+};
+
+AsyncLog& async_log() {
+    // Never destroyed, so logging from other static destructors stays safe
+    static AsyncLog* log = [] {
+        auto* created = new AsyncLog();
+        std::atexit([] { async_log().shutdown(); });
+        return created;
+    }();
+    return *log;
+}
+
+} // namespace
+
+// --- Tracing ---
+// Each thread appends to its own ring with relaxed stores and publishes the
+// new head with a release store; no lock, no allocation after the first
+// event. A dump copies a ring and then keeps only the events the writer
+// cannot have overwritten meanwhile. Rings outlive their threads.
+namespace {
+struct TraceRing {
+    struct Event {
+        std::atomic<const char*> name{nullptr};
+        std::atomic<uint64_t> start{0};
+        std::atomic<uint64_t> dur{0};
+    };
+    std::unique_ptr<Event[]> events{new Event[kTraceEvents]};
+    std::atomic<uint64_t> head{0};
+    long tid = 0;
+};
+
+std::mutex g_trace_rings_mutex;
+std::vector<std::unique_ptr<TraceRing>> g_trace_rings;
+std::atomic<int> g_trace_dumps{0};
+volatile std::sig_atomic_t g_trace_dump_requested = 0;
+
+TraceRing* this_thread_ring() {
+    thread_local TraceRing* ring = [] {
+        auto created = std::make_unique<TraceRing>();
+        created->tid = ::syscall(SYS_gettid);
+        std::lock_guard<std::mutex> lock(g_trace_rings_mutex);
+        g_trace_rings.push_back(std::move(created));
+        return g_trace_rings.back().get();
+    }();
+    return ring;
+}
+}
+
+void trace_record(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    TraceRing* ring = this_thread_ring();
+    const uint64_t at = ring->head.load(std::memory_order_relaxed);
+    TraceRing::Event& e = ring->events[at & (kTraceEvents - 1)];
+    e.name.store(name, std::memory_order_relaxed);
+    e.start.store(start_ns, std::memory_order_relaxed);
+    e.dur.store(end_ns - start_ns, std::memory_order_relaxed);
+    ring->head.store(at + 1, std::memory_order_release);
+}
+
+long trace_dump(const std::string& path) {
+    if (!kTracingEnabled) return -1;
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) return -1;
+    const long pid = ::getpid();
+    long written = 0;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    std::lock_guard<std::mutex> lock(g_trace_rings_mutex);
+    struct Copy {
+        const char* name;
+        uint64_t start;
+        uint64_t dur;
+    };
+    std::vector<Copy> copy;
+    for (const auto& ring : g_trace_rings) {
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        const uint64_t first = head > kTraceEvents ? head - kTraceEvents : 0;
+        copy.clear();
+        for (uint64_t i = first; i < head; ++i) {
+            const TraceRing::Event& e = ring->events[i & (kTraceEvents - 1)];
+            copy.push_back({e.name.load(std::memory_order_relaxed), e.start.load(std::memory_order_relaxed),
+                            e.dur.load(std::memory_order_relaxed)});
+        }
+        // The writer may have lapped the copy; its slot at the new head may be half written too
+        const uint64_t after = ring->head.load(std::memory_order_acquire);
+        const uint64_t safe = after >= kTraceEvents ? after - kTraceEvents + 1 : 0;
+        for (uint64_t i = std::max(first, safe); i < head; ++i) {
+            const Copy& c = copy[i - first];
+            if (!c.name) continue;
+            char line[256];
+            std::snprintf(line, sizeof line,
+                          "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld}",
+                          written ? "," : "", c.name, static_cast<double>(c.start) / 1000.0,
+                          static_cast<double>(c.dur) / 1000.0, pid, ring->tid);
+            out << line;
+            ++written;
+        }
+    }
+    out << "\n]}\n";
+    out.flush();
+    return out ? written : -1;
+}
+
+std::string trace_dump_next(long* events) {
+    const std::string path = "trace-" + std::to_string(::getpid()) + "-" + std::to_string(g_trace_dumps.fetch_add(1)) +
+                             ".json";
+    const long n = trace_dump(path);
+    if (events) *events = n;
+    return n < 0 ? std::string() : path;
+}
+
+void trace_poll_signal() {
+    if (!g_trace_dump_requested) return;
+    g_trace_dump_requested = 0;
+    if (!kTracingEnabled) {
+        log_message(LogLevel::Warn, "Trace", "dump requested, but tracing is not built in (-DTETRIS_TRACING)");
+        return;
+    }
+    long events = 0;
+    const std::string path = trace_dump_next(&events);
+    if (path.empty()) log_message(LogLevel::Error, "Trace", "cannot write the trace dump");
+    else log_checkpoint("Trace", "DUMPED", "path=" + path + " events=" + std::to_string(events));
+}
+
+volatile std::sig_atomic_t running = 1;
+
+static void handle_trace_signal(int) {
+    g_trace_dump_requested = 1;
+}
+
+static void handle_signal_internal(int signo) {
+    (void)signo;
+    running = 0;
+    const char msg[] = "signal received, shutting down...\n";
+    ::write(STDERR_FILENO, msg, sizeof(msg)-1);
+}
+
+void install_signal_handlers() {
+    struct sigaction sa{};
+    sa.sa_handler = handle_signal_internal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    if (sigaction(SIGINT, &sa, nullptr) == -1) {
+        perror("sigaction(SIGINT)");
+    }
+    if (sigaction(SIGTERM, &sa, nullptr) == -1) {
+        perror("sigaction(SIGTERM)");
+    }
+    // SIGUSR1 asks for a trace dump, picked up by trace_poll_signal()
+    struct sigaction usr{};
+    usr.sa_handler = handle_trace_signal;
+    sigemptyset(&usr.sa_mask);
+    usr.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &usr, nullptr) == -1) {
+        perror("sigaction(SIGUSR1)");
+    }
+    // ignore SIGPIPE, so send() gives EPIPE instead of killing us
+    struct sigaction ign{};
+    ign.sa_handler = SIG_IGN;
+    sigemptyset(&ign.sa_mask);
+    ign.sa_flags = 0;
+    if (sigaction(SIGPIPE, &ign, nullptr) == -1) {
+        perror("sigaction(SIGPIPE)");
+    }
+}
+
+bool send_all(int fd, const void* buf, size_t len) {
+    const char* p = static_cast<const char*>(buf);
+    while (len > 0) {
+        ssize_t w = ::send(fd, p, len,
+#ifdef MSG_NOSIGNAL
+                           MSG_NOSIGNAL
+#else
+                           0
+#endif
+        );
+        if (w > 0) {
+            p += w;
+            len -= (size_t)w;
+        } else if (w < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool send_all_iov(int fd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = static_cast<size_t>(iovcnt);
+        ssize_t w = ::sendmsg(fd, &msg,
+#ifdef MSG_NOSIGNAL
+                              MSG_NOSIGNAL
+#else
+                              0
+#endif
+        );
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        size_t sent = static_cast<size_t>(w);
+        // Drop fully written buffers, then advance into the partially written one
+        while (iovcnt > 0 && sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+bool recv_all(int fd, void* buf, size_t len) {
+    char* p = static_cast<char*>(buf);
+    while (len > 0) {
+        ssize_t r = ::recv(fd, p, len, 0);
+        if (r > 0) {
+            p += r;
+            len -= (size_t)r;
+        } else if (r == 0) {
+            return false;
+        } else if (r < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int start_tcp_server(const char* ip, uint16_t& out_port, bool reuse_port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        ::close(fd);
+        return -1;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(out_port);
+    addr.sin_addr.s_addr = inet_addr(ip);
+
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        ::close(fd);
+        return -1;
+    }
+    if (out_port == 0) {
+        socklen_t sl = sizeof(addr);
+        if (getsockname(fd, (sockaddr*)&addr, &sl) == 0) {
+            out_port = ntohs(addr.sin_port);
+        }
+    }
+    // Deep accept queue: a burst of connects must not overflow it before the next accept round
+    if (listen(fd, SOMAXCONN) < 0) {
+        perror("listen");
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+namespace {
+// One address per family in turn, the resolver's first family leading
+std::vector<const addrinfo*> interleave_families(const addrinfo* list) {
+    std::vector<const addrinfo*> first, other;
+    for (const addrinfo* p = list; p; p = p->ai_next) {
+        (p->ai_family == list->ai_family ? first : other).push_back(p);
+    }
+    std::vector<const addrinfo*> order;
+    for (size_t i = 0; i < std::max(first.size(), other.size()); ++i) {
+        if (i < first.size()) order.push_back(first[i]);
+        if (i < other.size()) order.push_back(other[i]);
+    }
+    return order;
+}
+}
+
+int connect_tcp(const std::string& host, uint16_t port, int timeout_ms) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    addrinfo* res = nullptr;
+    const std::string service = std::to_string(port);
+    if (int rc = ::getaddrinfo(host.c_str(), service.c_str(), &hints, &res); rc != 0) {
+        std::fprintf(stderr, "connect %s: %s\n", host.c_str(), gai_strerror(rc));
+        return -1;
+    }
+    const std::vector<const addrinfo*> order = interleave_families(res);
+
+    // Happy eyeballs (RFC 8305): a new attempt starts every kConnectStaggerMs,
+    // or at once when the last one fails, and the first to complete wins
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    const auto deadline = start + std::chrono::milliseconds(timeout_ms);
+    auto next_attempt = start;
+    std::vector<pollfd> pending;
+    size_t next = 0;
+    int winner = -1, error = ETIMEDOUT;
+    while (winner < 0) {
+        auto now = Clock::now();
+        if (now >= deadline) break;
+        if (next < order.size() && (pending.empty() || now >= next_attempt)) {
+            const addrinfo* p = order[next++];
+            int fd = ::socket(p->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                error = errno;
+                continue;
+            }
+            if (::connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+                winner = fd;
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                error = errno;
+                ::close(fd);
+                continue;
+            }
+            pending.push_back(pollfd{fd, POLLOUT, 0});
+            next_attempt = now + std::chrono::milliseconds(kConnectStaggerMs);
+        }
+        if (pending.empty()) {
+            if (next == order.size()) break;
+            continue;
+        }
+        const auto until = next < order.size() ? std::min(next_attempt, deadline) : deadline;
+        const int wait = static_cast<int>(
+            std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count() + 1));
+        if (::poll(pending.data(), pending.size(), wait) < 0 && errno != EINTR) {
+            error = errno;
+            break;
+        }
+        for (size_t i = 0; i < pending.size() && winner < 0;) {
+            if (pending[i].revents == 0) {
+                ++i;
+                continue;
+            }
+            int so_error = 0;
+            socklen_t len = sizeof(so_error);
+            ::getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+            if (so_error == 0) {
+                winner = pending[i].fd;
+                pending.erase(pending.begin() + static_cast<long>(i));
+                break;
+            }
+            error = so_error;
+            ::close(pending[i].fd);
+            pending.erase(pending.begin() + static_cast<long>(i));
+            next_attempt = Clock::now(); // a refusal moves the next attempt up
+        }
+    }
+    for (const pollfd& p : pending) ::close(p.fd);
+    ::freeaddrinfo(res);
+    if (winner < 0) {
+        std::fprintf(stderr, "connect %s:%u: %s\n", host.c_str(), port, std::strerror(error));
+        return -1;
+    }
+    // callers expect a blocking socket, as a plain connect() would give them
+    ::fcntl(winner, F_SETFL, ::fcntl(winner, F_GETFL) & ~O_NONBLOCK);
+    return winner;
+}
+
+int start_udp_socket(const char* ip, uint16_t& out_port) {
+    int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(out_port);
+    addr.sin_addr.s_addr = inet_addr(ip);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        ::close(fd);
+        return -1;
+    }
+    if (out_port == 0) {
+        socklen_t sl = sizeof(addr);
+        if (getsockname(fd, (sockaddr*)&addr, &sl) == 0) {
+            out_port = ntohs(addr.sin_port);
+        }
+    }
+    return fd;
+}
+
+int connect_udp(const std::string& ip, uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(ip.c_str());
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+namespace {
+bool unix_address(const std::string& path, sockaddr_un& addr) {
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// Room for a whole client's state in one message
+void widen_unix_buffers(int fd) {
+    int bytes = static_cast<int>(UNIX_MAX_MESSAGE);
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+}
+}
+
+int start_unix_server(const std::string& path) {
+    sockaddr_un addr;
+    if (!unix_address(path, addr)) {
+        std::fprintf(stderr, "unix socket path too long: %s\n", path.c_str());
+        return -1;
+    }
+    int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    ::unlink(path.c_str());
+    widen_unix_buffers(fd);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        perror("bind unix");
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int connect_unix(const std::string& path) {
+    sockaddr_un addr;
+    if (!unix_address(path, addr)) return -1;
+    int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    widen_unix_buffers(fd);
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect unix");
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool send_with_fds(int sock, const std::string& msg, const int* fds, size_t nfds) {
+    if (msg.empty() || msg.size() > UNIX_MAX_MESSAGE || nfds > UNIX_MAX_FDS) return false;
+    iovec iov{const_cast<char*>(msg.data()), msg.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * UNIX_MAX_FDS)] = {};
+    msghdr mh{};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (nfds > 0) {
+        mh.msg_control = control;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        std::memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+    }
+    ssize_t n;
+    do {
+        n = ::sendmsg(sock, &mh, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == static_cast<ssize_t>(msg.size());
+}
+
+bool recv_with_fds(int sock, std::string& msg, std::vector<int>& fds) {
+    fds.clear();
+    msg.resize(UNIX_MAX_MESSAGE);
+    iovec iov{msg.data(), msg.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * UNIX_MAX_FDS)];
+    msghdr mh{};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+        n = ::recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    for (cmsghdr* cm = n < 0 ? nullptr : CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        const size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+        }
+    }
+    if (n <= 0 || (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        for (int fd : fds) ::close(fd);
+        fds.clear();
+        msg.clear();
+        return false;
+    }
+    msg.resize(static_cast<size_t>(n));
+    return true;
+}
+
+void set_log_level(LogLevel level) {
+    g_log_level.store(level);
+}
+
+bool log_enabled(LogLevel level) {
+    return static_cast<int>(level) <= static_cast<int>(g_log_level.load(std::memory_order_relaxed));
+}
+
+void log_message(LogLevel level, std::string_view module, std::string_view message) {
+    if (!log_enabled(level)) return;
+    async_log().push(level, LogKind::Message, {module, message});
+}
+
+void log_checkpoint(std::string_view module, std::string_view checkpoint, std::string_view details) {
+    if (!log_enabled(LogLevel::Info)) return;
+    async_log().push(LogLevel::Info, LogKind::Checkpoint, {module, checkpoint, details});
+}
+
+void log_communication(std::string_view module,
+                       std::string_view direction,
+                       std::string_view peer,
+                       std::string_view payload)
+{
+    if (!log_enabled(LogLevel::Info)) return;
+    async_log().push(LogLevel::Info, LogKind::Communication, {module, direction, peer, payload});
+}
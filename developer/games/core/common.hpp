@@ -0,0 +1,138 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <csignal>
+#include <thread>
+#include <mutex>
+#include <unordered_map> // Added for lobby server state
+#include <vector>
+
+enum class LogLevel {
+    Error = 0,
+    Warn,
+    Info,
+    Debug,
+    Trace
+};
+
+// global running flag for all servers
+extern volatile std::sig_atomic_t running;
+
+// install SIGINT, SIGTERM, ignore SIGPIPE
+void install_signal_handlers();
+
+// TCP helpers
+// start a TCP server on ip:port; if out_port==0, system picks a free port and writes it back
+// reuse_port: several processes may bind the same port (SO_REUSEPORT) and the
+// kernel spreads new connections over them
+// return listening fd or -1 on error
+int start_tcp_server(const char* ip, uint16_t& out_port, bool reuse_port = false);
+
+// connect to TCP server, return a blocking fd or -1. host may be a name or
+// either family's address; when it resolves to several the attempts are
+// raced, a new one every kConnectStaggerMs with IPv6 and IPv4 alternating,
+// and the first to connect wins. Gives up after timeout_ms in all.
+constexpr int kConnectStaggerMs = 250;
+constexpr int kConnectTimeoutMs = 3000;
+int connect_tcp(const std::string& host, uint16_t port, int timeout_ms = kConnectTimeoutMs);
+
+// UDP helpers, both return a non-blocking fd or -1
+// bind a datagram socket on ip:port; out_port==0 picks a free port and writes it back
+int start_udp_socket(const char* ip, uint16_t& out_port);
+// datagram socket connected to ip:port, so plain send/recv talk to that peer only
+int connect_udp(const std::string& ip, uint16_t port);
+
+// UNIX seqpacket helpers, for handing sockets to another process on this host
+// listening socket at path (an old file there is removed first), -1 on error
+int start_unix_server(const std::string& path);
+// connect to a unix server, return fd or -1
+int connect_unix(const std::string& path);
+// one message plus up to UNIX_MAX_FDS descriptors (SCM_RIGHTS); the sender keeps its copies
+constexpr size_t UNIX_MAX_FDS = 4;
+constexpr size_t UNIX_MAX_MESSAGE = 256 * 1024;
+bool send_with_fds(int sock, const std::string& msg, const int* fds, size_t nfds);
+// blocking; false on EOF or error. Received descriptors are close-on-exec.
+bool recv_with_fds(int sock, std::string& msg, std::vector<int>& fds);
+
+// reliable send/recv
+bool send_all(int fd, const void* buf, size_t len);
+bool recv_all(int fd, void* buf, size_t len);
+// gathered send of several buffers in as few syscalls as possible; iov is modified
+bool send_all_iov(int fd, struct iovec* iov, int iovcnt);
+
+// Logging helpers shared across modules; the text is copied, so views of
+// temporaries are fine. Records go to stderr, or with TETRIS_LOG_FILE=<path>
+// to that file, rotated by size and age and gzipped in the background
+// (TETRIS_LOG_ROTATE_MB, TETRIS_LOG_ROTATE_SECONDS, TETRIS_LOG_KEEP).
+void set_log_level(LogLevel level);
+bool log_enabled(LogLevel level);
+void log_message(LogLevel level, std::string_view module, std::string_view message);
+void log_checkpoint(std::string_view module, std::string_view checkpoint, std::string_view details = {});
+void log_communication(std::string_view module,
+                       std::string_view direction,
+                       std::string_view peer,
+                       std::string_view payload);
+
+// log_communication for hot paths: peer (and payload, if it is a closure) are
+// only built when Info is enabled; a plain payload is passed through as a view
+template <typename PeerFn, typename Payload>
+void log_communication_lazy(std::string_view module, std::string_view direction, PeerFn&& peer, Payload&& payload) {
+    if (!log_enabled(LogLevel::Info)) return;
+    if constexpr (std::is_invocable_v<Payload>) {
+        log_communication(module, direction, std::forward<PeerFn>(peer)(), std::forward<Payload>(payload)());
+    } else {
+        log_communication(module, direction, std::forward<PeerFn>(peer)(), std::string_view(payload));
+    }
+}
+
+// Scoped tracing, built in with -DTETRIS_TRACING: TRACE_SCOPE("name") records
+// when the enclosing scope started and how long it took into a ring of the
+// last kTraceEvents events per thread; trace_dump() writes every ring as
+// Chrome trace JSON (chrome://tracing, ui.perfetto.dev). name must be a string
+// literal, only the pointer is kept. Without the flag TRACE_SCOPE expands to
+// nothing and the dump functions report that tracing is off.
+#if defined(TETRIS_TRACING)
+constexpr bool kTracingEnabled = true;
+#else
+constexpr bool kTracingEnabled = false;
+#endif
+constexpr size_t kTraceEvents = 8192; // per thread, power of two
+
+inline uint64_t trace_now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+void trace_record(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+#if defined(TETRIS_TRACING)
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name_(name), start_(trace_now_ns()) {}
+    ~TraceScope() { trace_record(name_, start_, trace_now_ns()); }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_;
+    uint64_t start_;
+};
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) static_cast<void>(0)
+#endif
+
+// Writes the rings to path; returns the events written, -1 on failure or
+// when tracing is compiled out
+long trace_dump(const std::string& path);
+// Dumps to trace-<pid>-<n>.json in the working directory; returns the path,
+// empty on failure. events (if given) gets the count.
+std::string trace_dump_next(long* events = nullptr);
+// SIGUSR1 asks for a dump (see install_signal_handlers); main loops call this
+// to carry it out outside the signal handler
+void trace_poll_signal();
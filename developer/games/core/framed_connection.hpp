@@ -0,0 +1,172 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "lp_framing.hpp"
+#include "reactor.hpp"
+
+// One length-prefixed stream connection on a Reactor. Frames are read as they
+// complete (FrameReader) and handed to on_frame; sends go through a
+// FrameWriter, so a peer with a full window costs its own queue and never the
+// loop: the queue is flushed when a send finds it empty and otherwise when the
+// socket turns writable, with EPOLLOUT watched only while something waits.
+//
+// The connection closes itself when the peer leaves, the socket fails, a
+// frame is malformed or the queue passes its hard limit. on_close then runs
+// once, from the loop and never from inside a send(), so an owner may send
+// from anywhere; the fd stays open until on_close has returned, so an owner
+// keying connections by fd never meets a reused number first. close() by the
+// owner closes at once and runs no callback.
+//
+// The reactor holds the connection until it is closed: an owner may drop its
+// pointer after close_after_flush() and the queued frames still go out.
+class FramedConnection : public std::enable_shared_from_this<FramedConnection> {
+public:
+    using FrameHandler = std::function<void(FramedConnection&, const std::string& frame)>;
+    using CloseHandler = std::function<void(FramedConnection&)>;
+    using EnqueueResult = FrameWriter::EnqueueResult;
+
+    // Takes over fd; nullptr (and fd closed) if the reactor refuses it
+    static std::shared_ptr<FramedConnection> open(Reactor& reactor, int fd, FrameHandler on_frame,
+                                                  CloseHandler on_close, size_t high_water = LP_WRITE_HIGH_WATER,
+                                                  size_t hard_limit = LP_WRITE_HARD_LIMIT) {
+        std::shared_ptr<FramedConnection> c(new FramedConnection(reactor, fd, std::move(on_frame),
+                                                                 std::move(on_close), high_water, hard_limit));
+        if (!reactor.add(fd, EPOLLIN, [c](uint32_t events) { c->handle(events); })) {
+            c->state_ = State::Closed;
+            ::close(fd);
+            c->fd_ = -1;
+            return nullptr;
+        }
+        return c;
+    }
+
+    ~FramedConnection() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+    FramedConnection(const FramedConnection&) = delete;
+    FramedConnection& operator=(const FramedConnection&) = delete;
+
+    // Queues a frame (see FrameWriter::enqueue for the key); Overflow once the
+    // connection is closing. An empty or oversized body is refused as Skipped.
+    EnqueueResult send_frame(LpFrame frame, int coalesce_key = -1, bool self_contained = true) {
+        if (state_ != State::Open) return EnqueueResult::Overflow;
+        if (!frame) return EnqueueResult::Skipped;
+        const bool idle = !writer_.pending();
+        EnqueueResult r = writer_.enqueue(std::move(frame), coalesce_key, self_contained);
+        if (r == EnqueueResult::Overflow) {
+            fail();
+        } else if (idle) {
+            flush();
+        }
+        return r;
+    }
+    // false if the frame was not queued
+    bool send(const std::string& body) {
+        EnqueueResult r = send_frame(lp_prepare_frame(body));
+        return r == EnqueueResult::Queued || r == EnqueueResult::Coalesced;
+    }
+
+    // Stops reading and closes once the queue is out, or after timeout_ms
+    // regardless; no callback either way
+    void close_after_flush(int timeout_ms) {
+        if (state_ != State::Open) return;
+        state_ = State::Draining;
+        if (!writer_.pending()) {
+            close();
+            return;
+        }
+        auto self = shared_from_this();
+        drain_timer_ = reactor_.after(timeout_ms, [self] { self->close(); });
+        update_interest();
+    }
+
+    void close() {
+        if (state_ == State::Closed) return;
+        state_ = State::Closed;
+        if (drain_timer_) reactor_.cancel(drain_timer_);
+        reactor_.remove(fd_); // drops the reactor's reference, this lives on in the caller's
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    bool is_open() const { return state_ == State::Open; }
+    int fd() const { return fd_; }
+    size_t queued_bytes() const { return writer_.queued_bytes(); }
+
+private:
+    enum class State { Open, Draining, Failed, Closed };
+
+    FramedConnection(Reactor& reactor, int fd, FrameHandler on_frame, CloseHandler on_close, size_t high_water,
+                     size_t hard_limit)
+        : reactor_(reactor), fd_(fd), on_frame_(std::move(on_frame)), on_close_(std::move(on_close)),
+          writer_(high_water, hard_limit) {}
+
+    void handle(uint32_t events) {
+        auto self = shared_from_this(); // on_frame may drop the owner's reference
+        if (state_ == State::Open && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            size_t count = 0;
+            FrameReader::ReadResult r = reader_.read_from(fd_, frames_, count);
+            for (size_t i = 0; i < count && state_ == State::Open; ++i) on_frame_(*this, frames_[i]);
+            if (r != FrameReader::ReadResult::Ok) {
+                fail();
+                return;
+            }
+        }
+        if (state_ == State::Draining && (events & (EPOLLHUP | EPOLLERR))) {
+            close(); // nobody left to take the rest
+            return;
+        }
+        if ((events & EPOLLOUT) && (state_ == State::Open || state_ == State::Draining)) flush();
+    }
+
+    void flush() {
+        if (!writer_.flush(fd_)) {
+            if (state_ == State::Draining) close();
+            else fail();
+            return;
+        }
+        if (state_ == State::Draining && !writer_.pending()) {
+            close();
+            return;
+        }
+        update_interest();
+    }
+
+    void update_interest() {
+        uint32_t want = (state_ == State::Open ? EPOLLIN : 0u) | (writer_.pending() ? EPOLLOUT : 0u);
+        if (want == interest_) return;
+        interest_ = want;
+        reactor_.modify(fd_, want);
+    }
+
+    // Closes from the loop, after whatever called this has unwound
+    void fail() {
+        if (state_ != State::Open) return;
+        state_ = State::Failed;
+        interest_ = 0;
+        reactor_.modify(fd_, 0);
+        auto self = shared_from_this();
+        reactor_.post([self] {
+            if (self->state_ != State::Failed) return; // the owner closed it meanwhile
+            if (self->on_close_) self->on_close_(*self);
+            self->close();
+        });
+    }
+
+    Reactor& reactor_;
+    int fd_;
+    State state_ = State::Open;
+    uint32_t interest_ = EPOLLIN;
+    uint64_t drain_timer_ = 0;
+    FrameHandler on_frame_;
+    CloseHandler on_close_;
+    FrameReader reader_;
+    FrameWriter writer_;
+    std::vector<std::string> frames_; // reused between reads
+};
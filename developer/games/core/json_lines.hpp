@@ -0,0 +1,402 @@
+#pragma once
+
+// Newline-delimited JSON as the platform protocol speaks it, without building
+// a tree. LineBuffer cuts what a socket delivers into lines, ObjectReader walks
+// the members of one line's object handing out views into it, and JsonWriter
+// appends to a string the caller keeps, so clear() between messages leaves the
+// capacity and a steady stream of ticks does not allocate.
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace jsonl {
+
+// Bytes from a stream, handed back a line at a time. Lines are views into the
+// buffer: use them before the next append() or compact().
+class LineBuffer {
+public:
+    void append(const char* data, size_t n) { buf_.append(data, n); }
+
+    // The next complete line without its '\n'; false when only a partial one is left
+    bool next(std::string_view& line) {
+        const void* nl = std::memchr(buf_.data() + pos_, '\n', buf_.size() - pos_);
+        if (!nl) return false;
+        const size_t end = static_cast<size_t>(static_cast<const char*>(nl) - buf_.data());
+        line = std::string_view(buf_).substr(pos_, end - pos_);
+        pos_ = end + 1;
+        return true;
+    }
+
+    // Drops the lines already returned; once per read, not once per line
+    void compact() {
+        buf_.erase(0, pos_);
+        pos_ = 0;
+    }
+
+    // Bytes of the line still being received
+    size_t pending() const { return buf_.size() - pos_; }
+
+private:
+    std::string buf_;
+    size_t pos_ = 0;
+};
+
+enum class Kind { String, Number, True, False, Null, Array, Object };
+
+struct Value {
+    Kind kind = Kind::Null;
+    std::string_view raw;  // as written; a String without its quotes and still escaped
+    bool escaped = false;  // a String with a backslash in it
+
+    // A String unescaped: raw itself when it has no escapes, else decoded into scratch
+    std::string_view str(std::string& scratch) const {
+        if (!escaped) return raw;
+        scratch.clear();
+        for (size_t i = 0; i < raw.size(); ++i) {
+            const char c = raw[i];
+            if (c != '\\' || i + 1 >= raw.size()) {
+                scratch += c;
+                continue;
+            }
+            const char e = raw[++i];
+            switch (e) {
+            case 'b': scratch += '\b'; break;
+            case 'f': scratch += '\f'; break;
+            case 'n': scratch += '\n'; break;
+            case 'r': scratch += '\r'; break;
+            case 't': scratch += '\t'; break;
+            case 'u': {
+                unsigned cp = 0;
+                if (i + 4 >= raw.size() || std::from_chars(raw.data() + i + 1, raw.data() + i + 5, cp, 16).ptr !=
+                                               raw.data() + i + 5) {
+                    return scratch;
+                }
+                i += 4;
+                // UTF-8 for the basic plane; surrogate halves are kept as they come
+                if (cp < 0x80) {
+                    scratch += static_cast<char>(cp);
+                } else if (cp < 0x800) {
+                    scratch += static_cast<char>(0xC0 | (cp >> 6));
+                    scratch += static_cast<char>(0x80 | (cp & 0x3F));
+                } else {
+                    scratch += static_cast<char>(0xE0 | (cp >> 12));
+                    scratch += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                    scratch += static_cast<char>(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default: scratch += e; break; // \" \\ \/
+            }
+        }
+        return scratch;
+    }
+
+    // A whole Number, or a String holding one (room ids come either way)
+    bool to_int(int64_t& out) const {
+        if (kind != Kind::Number && (kind != Kind::String || escaped)) return false;
+        const auto [end, ec] = std::from_chars(raw.data(), raw.data() + raw.size(), out);
+        return ec == std::errc() && end == raw.data() + raw.size();
+    }
+};
+
+// Shared by ObjectReader and ArrayReader: one value at a time from text
+class ValueScanner {
+public:
+    explicit ValueScanner(std::string_view text) : s_(text) {}
+
+protected:
+    char peek() const { return i_ < s_.size() ? s_[i_] : '\0'; }
+    bool eat(char c) {
+        skip_ws();
+        if (peek() != c) return false;
+        ++i_;
+        return true;
+    }
+    void skip_ws() {
+        while (i_ < s_.size() && (s_[i_] == ' ' || s_[i_] == '\t' || s_[i_] == '\r' || s_[i_] == '\n')) ++i_;
+    }
+
+    // The body of the string at i_; escapes are left for Value::str
+    bool string(std::string_view& body, bool& escaped) {
+        if (peek() != '"') return false;
+        const size_t from = ++i_;
+        escaped = false;
+        while (i_ < s_.size()) {
+            const char c = s_[i_++];
+            if (c == '"') {
+                body = s_.substr(from, i_ - 1 - from);
+                return true;
+            }
+            if (c == '\\') {
+                escaped = true;
+                ++i_;
+            }
+        }
+        return false;
+    }
+
+    bool value(Value& v) {
+        skip_ws();
+        const char c = peek();
+        v.escaped = false;
+        if (c == '"') {
+            v.kind = Kind::String;
+            return string(v.raw, v.escaped);
+        }
+        const size_t from = i_;
+        if (c == '{' || c == '[') {
+            v.kind = c == '{' ? Kind::Object : Kind::Array;
+            int depth = 0;
+            while (i_ < s_.size()) {
+                const char d = s_[i_];
+                if (d == '"') {
+                    std::string_view ignored;
+                    bool esc;
+                    if (!string(ignored, esc)) return false;
+                    continue;
+                }
+                ++i_;
+                if (d == '{' || d == '[') {
+                    ++depth;
+                } else if ((d == '}' || d == ']') && --depth == 0) {
+                    v.raw = s_.substr(from, i_ - from);
+                    return true;
+                }
+            }
+            return false;
+        }
+        while (i_ < s_.size() && s_[i_] != ',' && s_[i_] != '}' && s_[i_] != ']' && s_[i_] != ' ' && s_[i_] != '\t' &&
+               s_[i_] != '\r' && s_[i_] != '\n') {
+            ++i_;
+        }
+        v.raw = s_.substr(from, i_ - from);
+        if (v.raw == "true") {
+            v.kind = Kind::True;
+        } else if (v.raw == "false") {
+            v.kind = Kind::False;
+        } else if (v.raw == "null") {
+            v.kind = Kind::Null;
+        } else {
+            v.kind = Kind::Number;
+            if (v.raw.empty() || !(v.raw[0] == '-' || (v.raw[0] >= '0' && v.raw[0] <= '9'))) return false;
+        }
+        return true;
+    }
+
+    std::string_view s_;
+    size_t i_ = 0;
+};
+
+// The members of one JSON object, in order. next() is false at the end of the
+// object and on malformed text, ok() tells the two apart. Keys are compared as
+// written; protocol keys carry no escapes.
+class ObjectReader : ValueScanner {
+public:
+    explicit ObjectReader(std::string_view text) : ValueScanner(text) {
+        if (!eat('{')) {
+            failed_ = true;
+        } else if (eat('}')) {
+            done_ = true;
+        }
+    }
+
+    bool next(std::string_view& key, Value& v) {
+        if (failed_ || done_) return false;
+        bool key_escaped;
+        skip_ws();
+        if (!string(key, key_escaped) || !eat(':') || !value(v)) return fail();
+        if (eat('}')) {
+            done_ = true;
+        } else if (!eat(',')) {
+            return fail();
+        }
+        return true;
+    }
+
+    bool ok() const { return !failed_; }
+
+    // Reads the whole object: true if it is well formed, with v the member named
+    // key (Null if there is none). A protocol message has a handful of members,
+    // so a scan per lookup is cheaper than building an index.
+    static bool find(std::string_view text, std::string_view key, Value& v) {
+        ObjectReader r(text);
+        std::string_view k;
+        Value each;
+        bool found = false;
+        v = Value{};
+        while (r.next(k, each)) {
+            if (!found && k == key) {
+                v = each;
+                found = true;
+            }
+        }
+        return r.ok();
+    }
+
+    // The member as text: a string unescaped, a number or literal as written,
+    // empty when missing or null
+    static std::string_view text(std::string_view object, std::string_view key, std::string& scratch) {
+        Value v;
+        if (!find(object, key, v) || v.kind == Kind::Null) return {};
+        return v.kind == Kind::String ? v.str(scratch) : v.raw;
+    }
+
+private:
+    bool fail() {
+        failed_ = true;
+        return false;
+    }
+
+    bool failed_ = false;
+    bool done_ = false;
+};
+
+// The elements of an Array value (its raw text, brackets included)
+class ArrayReader : ValueScanner {
+public:
+    explicit ArrayReader(std::string_view text) : ValueScanner(text) {
+        if (!eat('[')) {
+            failed_ = true;
+        } else if (eat(']')) {
+            done_ = true;
+        }
+    }
+
+    bool next(Value& v) {
+        if (failed_ || done_) return false;
+        if (!value(v)) return fail();
+        if (eat(']')) {
+            done_ = true;
+        } else if (!eat(',')) {
+            return fail();
+        }
+        return true;
+    }
+
+    bool ok() const { return !failed_; }
+
+private:
+    bool fail() {
+        failed_ = true;
+        return false;
+    }
+
+    bool failed_ = false;
+    bool done_ = false;
+};
+
+// s as a JSON string literal, appended to out
+inline void append_quoted(std::string& out, std::string_view s) {
+    out += '"';
+    size_t run = 0; // start of the bytes not yet copied
+    for (size_t i = 0; i < s.size(); ++i) {
+        const auto c = static_cast<unsigned char>(s[i]);
+        if (c != '"' && c != '\\' && c >= 0x20) continue;
+        out.append(s.data() + run, i - run);
+        run = i + 1;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else {
+            char esc[8];
+            std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        }
+    }
+    out.append(s.data() + run, s.size() - run);
+    out += '"';
+}
+
+// Appends JSON to out with the separators of Python's json.dumps (", " and
+// ": "), so a native server's lines read the same as server.py's. Nesting is
+// tracked in two bit masks, so up to 64 levels deep.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out) : out_(out) {}
+
+    JsonWriter& begin_object() { return open('{', false); }
+    JsonWriter& begin_array() { return open('[', true); }
+    JsonWriter& end() {
+        out_ += (arrays_ >> depth_) & 1 ? ']' : '}';
+        arrays_ &= ~(uint64_t{1} << depth_);
+        nonempty_ &= ~(uint64_t{1} << depth_);
+        --depth_;
+        return *this;
+    }
+
+    JsonWriter& key(std::string_view k) {
+        separate();
+        append_quoted(out_, k);
+        out_ += ": ";
+        after_key_ = true;
+        return *this;
+    }
+
+    JsonWriter& str(std::string_view s) {
+        separate();
+        append_quoted(out_, s);
+        return *this;
+    }
+    JsonWriter& num(int64_t n) {
+        separate();
+        char buf[24];
+        out_.append(buf, static_cast<size_t>(std::to_chars(buf, buf + sizeof(buf), n).ptr - buf));
+        return *this;
+    }
+    // fixed notation, as the reports write their timestamps
+    JsonWriter& num(double d, int decimals) {
+        separate();
+        char buf[48];
+        const int n = std::snprintf(buf, sizeof(buf), "%.*f", decimals, d);
+        out_.append(buf, n > 0 ? static_cast<size_t>(n) : 0);
+        return *this;
+    }
+    JsonWriter& boolean(bool b) { return raw(b ? "true" : "false"); }
+    JsonWriter& null() { return raw("null"); }
+    // Text that is already JSON
+    JsonWriter& raw(std::string_view json) {
+        separate();
+        out_ += json;
+        return *this;
+    }
+
+    // Ends the message; the writer is ready for the next one on the same string
+    void end_line() {
+        out_ += '\n';
+        depth_ = 0;
+        nonempty_ = arrays_ = 0;
+        after_key_ = false;
+    }
+
+private:
+    JsonWriter& open(char bracket, bool array) {
+        separate();
+        out_ += bracket;
+        ++depth_;
+        if (array) arrays_ |= uint64_t{1} << depth_;
+        return *this;
+    }
+
+    // ", " before every value but the first at its level, none after a key
+    void separate() {
+        if (after_key_) {
+            after_key_ = false;
+            return;
+        }
+        const uint64_t bit = uint64_t{1} << depth_;
+        if (nonempty_ & bit) out_ += ", ";
+        nonempty_ |= bit;
+    }
+
+    std::string& out_;
+    int depth_ = 0;
+    uint64_t nonempty_ = 0;
+    uint64_t arrays_ = 0;
+    bool after_key_ = false;
+};
+
+}
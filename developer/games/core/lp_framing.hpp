@@ -0,0 +1,465 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "common.hpp"
+
+inline bool lp_send_frame(int fd, const std::string& body) {
+    if (body.empty() || body.size() > 65536) {
+        errno = EMSGSIZE;
+        return false;
+    }
+    uint32_t len = htonl(static_cast<uint32_t>(body.size()));
+    // header and body leave in one sendmsg instead of two small writes
+    struct iovec iov[2];
+    iov[0].iov_base = &len;
+    iov[0].iov_len = 4;
+    iov[1].iov_base = const_cast<char*>(body.data());
+    iov[1].iov_len = body.size();
+    return send_all_iov(fd, iov, 2);
+}
+
+// A frame with its length header already in front, built once and shared by
+// every connection it is sent to (broadcasts, queued writes).
+using LpFrame = std::shared_ptr<const std::string>;
+
+// Frame buffers are recycled. Every thread keeps spare strings (capacity
+// included) and spare shared_ptr control blocks, and a frame goes back to the
+// spares of whichever thread drops its last reference, so once traffic has
+// warmed them up building and sending frames allocates nothing.
+namespace lp_pool {
+constexpr size_t kMaxSpares = 256;               // per thread, of each kind
+constexpr size_t kMaxSpareCapacity = 16 * 1024;  // larger buffers are freed
+
+struct Spares {
+    std::vector<std::string*> buffers;
+    std::vector<void*> blocks; // all one size: LpFrame's control block
+    size_t block_size = 0;
+    Spares() {
+        buffers.reserve(kMaxSpares);
+        blocks.reserve(kMaxSpares);
+    }
+    ~Spares();
+};
+
+// Set once the thread's spares are gone (thread exit), so late frames are freed
+inline thread_local bool t_spares_gone = false;
+
+inline Spares* spares() {
+    if (t_spares_gone) return nullptr;
+    thread_local Spares s;
+    return &s;
+}
+
+inline Spares::~Spares() {
+    t_spares_gone = true;
+    for (std::string* b : buffers) delete b;
+    for (void* p : blocks) ::operator delete(p);
+}
+
+inline std::string* take_buffer() {
+    Spares* s = spares();
+    if (!s || s->buffers.empty()) return new std::string();
+    std::string* b = s->buffers.back();
+    s->buffers.pop_back();
+    b->clear();
+    return b;
+}
+
+inline void give_buffer(std::string* b) {
+    Spares* s = spares();
+    if (s && s->buffers.size() < kMaxSpares && b->capacity() <= kMaxSpareCapacity) s->buffers.push_back(b);
+    else delete b;
+}
+
+struct Recycle {
+    void operator()(const std::string* b) const { give_buffer(const_cast<std::string*>(b)); }
+};
+
+template <typename T>
+struct BlockAllocator {
+    using value_type = T;
+    BlockAllocator() = default;
+    template <typename U>
+    BlockAllocator(const BlockAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        const size_t bytes = n * sizeof(T);
+        Spares* s = spares();
+        if (s && s->block_size == bytes && !s->blocks.empty()) {
+            void* p = s->blocks.back();
+            s->blocks.pop_back();
+            return static_cast<T*>(p);
+        }
+        return static_cast<T*>(::operator new(bytes));
+    }
+    void deallocate(T* p, size_t n) {
+        const size_t bytes = n * sizeof(T);
+        Spares* s = spares();
+        if (s && (s->blocks.empty() || s->block_size == bytes) && s->blocks.size() < kMaxSpares) {
+            s->block_size = bytes;
+            s->blocks.push_back(p);
+        } else {
+            ::operator delete(p);
+        }
+    }
+    template <typename U>
+    bool operator==(const BlockAllocator<U>&) const { return true; }
+};
+} // namespace lp_pool
+
+// Builds a frame in a recycled buffer: write(out) appends the body to out
+template <typename Write>
+LpFrame lp_build_frame(Write&& write) {
+    std::string* buf = lp_pool::take_buffer();
+    buf->assign(4, '\0');
+    write(*buf);
+    const size_t body = buf->size() - 4;
+    if (body == 0 || body > 65536) {
+        lp_pool::give_buffer(buf);
+        errno = EMSGSIZE;
+        return nullptr;
+    }
+    uint32_t len = htonl(static_cast<uint32_t>(body));
+    std::memcpy(buf->data(), &len, 4);
+    return LpFrame(buf, lp_pool::Recycle{}, lp_pool::BlockAllocator<char>{});
+}
+
+inline LpFrame lp_prepare_frame(const std::string& body) {
+    return lp_build_frame([&body](std::string& out) { out.append(body); });
+}
+
+inline bool lp_send_prepared(int fd, const LpFrame& frame) {
+    if (!frame) return false;
+    return send_all(fd, frame->data(), frame->size());
+}
+
+inline bool lp_recv_frame(int fd, std::string& out) {
+    TRACE_SCOPE("lp_recv_frame");
+    uint32_t netlen = 0;
+    if (!recv_all(fd, &netlen, 4)) return false;
+    uint32_t len = ntohl(netlen);
+    if (len == 0 || len > 65536) {
+        errno = EINVAL;
+        return false;
+    }
+    out.resize(len);
+    if (!recv_all(fd, out.data(), len)) return false;
+    return true;
+}
+
+// Incremental reader for one connection: each read_from() takes whatever the
+// socket has (at most LP_READ_CHUNK bytes, never blocking, whatever the fd mode)
+// into a ring buffer and hands back every frame that is now complete. Partial
+// frames simply wait in the buffer for the next readiness event.
+constexpr size_t LP_MAX_FRAME = 65536;
+constexpr size_t LP_READ_CHUNK = 64 * 1024;
+
+class FrameReader {
+public:
+    enum class ReadResult { Ok, Closed, Error };
+
+    ReadResult read_from(int fd, std::vector<std::string>& frames) {
+        return read_into(fd, [&frames](size_t len) -> std::string& { return frames.emplace_back(len, '\0'); });
+    }
+
+    // The same into frames[0, count), reusing the strings already there (and
+    // their capacity) before adding any: a caller that keeps frames around
+    // reads without allocating
+    ReadResult read_from(int fd, std::vector<std::string>& frames, size_t& count) {
+        count = 0;
+        return read_into(fd, [&frames, &count](size_t len) -> std::string& {
+            if (count == frames.size()) frames.emplace_back();
+            std::string& frame = frames[count++];
+            frame.resize(len);
+            return frame;
+        });
+    }
+
+    // Bytes waiting for the rest of their frame
+    size_t buffered() const { return size_; }
+    // True when the last read_from() left nothing in the socket, which an
+    // edge-triggered reactor needs before it may wait for the next edge
+    bool drained() const { return drained_; }
+
+    // The partial frame held back, removed from the reader; for a connection
+    // that moves to another reader (or process), which preload()s it
+    std::string take_buffered() {
+        std::string out(size_, '\0');
+        if (size_ > 0) copy_out(0, out.data(), size_);
+        head_ = size_ = 0;
+        return out;
+    }
+    // Puts bytes read elsewhere in front of what the socket delivers next;
+    // only into an empty reader
+    void preload(std::string_view bytes) {
+        if (size_ > 0 || bytes.empty()) return;
+        if (buf_.size() < bytes.size()) buf_.resize(std::min(std::max(kInitialCapacity, bytes.size()), kMaxCapacity));
+        size_t n = std::min(bytes.size(), buf_.size());
+        std::memcpy(buf_.data(), bytes.data(), n);
+        head_ = 0;
+        size_ = n;
+    }
+
+private:
+    // next(len) returns a string of len bytes for the next complete frame
+    template <typename Next>
+    ReadResult read_into(int fd, Next&& next) {
+        TRACE_SCOPE("frame_read");
+        reserve_for_pending();
+        size_t want = std::min(LP_READ_CHUNK, buf_.size() - size_);
+        drained_ = false;
+        if (want > 0) {
+            size_t tail = (head_ + size_) % buf_.size();
+            struct iovec iov[2];
+            int iovcnt = 1;
+            size_t first = std::min(want, buf_.size() - tail);
+            iov[0].iov_base = buf_.data() + tail;
+            iov[0].iov_len = first;
+            if (first < want) {
+                iov[1].iov_base = buf_.data();
+                iov[1].iov_len = want - first;
+                iovcnt = 2;
+            }
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = static_cast<size_t>(iovcnt);
+            ssize_t r;
+            do {
+                r = ::recvmsg(fd, &msg, MSG_DONTWAIT);
+            } while (r < 0 && errno == EINTR);
+            if (r == 0) {
+                drain(next);
+                return ReadResult::Closed;
+            }
+            if (r < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) return ReadResult::Error;
+                drained_ = true;
+            } else {
+                size_ += static_cast<size_t>(r);
+                drained_ = static_cast<size_t>(r) < want; // a short read empties the socket
+            }
+        }
+        return drain(next) ? ReadResult::Ok : ReadResult::Error;
+    }
+
+    // Small to start with (most peers only send short commands), grown up to
+    // two read chunks when a large frame or a burst needs the room.
+    static constexpr size_t kInitialCapacity = 4096;
+    static constexpr size_t kMaxCapacity = 2 * LP_READ_CHUNK + 4;
+
+    void copy_out(size_t offset, char* dst, size_t n) const {
+        size_t start = (head_ + offset) % buf_.size();
+        size_t first = std::min(n, buf_.size() - start);
+        std::memcpy(dst, buf_.data() + start, first);
+        if (first < n) std::memcpy(dst + first, buf_.data(), n - first);
+    }
+
+    void grow(size_t capacity) {
+        std::vector<char> bigger(capacity);
+        if (size_ > 0) copy_out(0, bigger.data(), size_);
+        buf_.swap(bigger);
+        head_ = 0;
+    }
+
+    void reserve_for_pending() {
+        if (buf_.empty()) {
+            buf_.resize(kInitialCapacity);
+            return;
+        }
+        size_t need = size_ + 1; // room for at least one more byte
+        if (size_ >= 4) {
+            uint32_t netlen = 0;
+            copy_out(0, reinterpret_cast<char*>(&netlen), 4);
+            need = std::max(need, static_cast<size_t>(4 + std::min<uint32_t>(ntohl(netlen), LP_MAX_FRAME)));
+        }
+        if (need <= buf_.size() || buf_.size() >= kMaxCapacity) return;
+        size_t capacity = buf_.size();
+        while (capacity < need) capacity *= 2;
+        grow(std::min(capacity, kMaxCapacity));
+    }
+
+    // Moves every complete frame out of the buffer; false on a bad length header
+    template <typename Next>
+    bool drain(Next& next) {
+        while (size_ >= 4) {
+            uint32_t netlen = 0;
+            copy_out(0, reinterpret_cast<char*>(&netlen), 4);
+            uint32_t len = ntohl(netlen);
+            if (len == 0 || len > LP_MAX_FRAME) {
+                errno = EINVAL;
+                return false;
+            }
+            if (size_ < 4 + len) break;
+            copy_out(4, next(len).data(), len);
+            head_ = (head_ + 4 + len) % buf_.size();
+            size_ -= 4 + len;
+        }
+        if (size_ == 0) head_ = 0;
+        return true;
+    }
+
+    std::vector<char> buf_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+    bool drained_ = false;
+};
+
+// Outgoing queue for one connection. Frames are appended without touching the
+// socket's blocking mode and flushed with one gathered sendmsg(MSG_DONTWAIT) per
+// call, so a peer with a full receive window costs a queued frame instead of a
+// stalled thread; callers watch POLLOUT while pending() and flush again.
+//
+// Frames may carry a coalescing key (a board, say). Once the queue is past the
+// high-water mark a self-contained frame replaces the unsent ones with the same
+// key and a frame that depends on its predecessors is refused (Skipped), so a
+// slow viewer only ever gets the latest state. Past the hard limit the caller
+// should drop the connection (Overflow).
+constexpr size_t LP_WRITE_HIGH_WATER = 64 * 1024;
+constexpr size_t LP_WRITE_HARD_LIMIT = 1024 * 1024;
+
+class FrameWriter {
+public:
+    enum class EnqueueResult { Queued, Coalesced, Skipped, Overflow };
+
+    explicit FrameWriter(size_t high_water = LP_WRITE_HIGH_WATER, size_t hard_limit = LP_WRITE_HARD_LIMIT)
+        : high_water_(high_water), hard_limit_(hard_limit) {}
+
+    EnqueueResult enqueue(LpFrame frame, int coalesce_key = -1, bool self_contained = true) {
+        if (!frame) return EnqueueResult::Overflow;
+        EnqueueResult result = EnqueueResult::Queued;
+        if (coalesce_key >= 0 && bytes_ > high_water_) {
+            if (!self_contained) return EnqueueResult::Skipped;
+            // The head may be half written; everything behind it is still whole
+            size_t kept = head_offset_ > 0 ? 1 : 0;
+            for (size_t i = kept; i < count_; ++i) {
+                Item& item = at(i);
+                if (item.key == coalesce_key) {
+                    bytes_ -= item.frame->size();
+                    item.frame.reset();
+                    result = EnqueueResult::Coalesced;
+                } else {
+                    if (i != kept) at(kept) = std::move(item);
+                    ++kept;
+                }
+            }
+            count_ = kept;
+        }
+        if (bytes_ + frame->size() > hard_limit_) return EnqueueResult::Overflow;
+        bytes_ += frame->size();
+        if (count_ == ring_.size()) grow();
+        at(count_++) = Item{std::move(frame), coalesce_key};
+        return result;
+    }
+
+    // Writes as much as the socket takes right now; false on a socket error
+    bool flush(int fd) {
+        while (count_ > 0) {
+            struct iovec iov[kMaxIov];
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = static_cast<size_t>(gather(iov, kMaxIov));
+            ssize_t w = ::sendmsg(fd, &msg, MSG_DONTWAIT
+#ifdef MSG_NOSIGNAL
+                                  | MSG_NOSIGNAL
+#endif
+            );
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            consume(static_cast<size_t>(w));
+        }
+        return true;
+    }
+
+    // For a caller that sends itself (many sockets in one batch, say): the
+    // unsent bytes as at most max iovecs, valid until the writer next changes,
+    // and then sent() with what came of it
+    int gather(struct iovec* iov, int max) {
+        int iovcnt = 0;
+        for (; static_cast<size_t>(iovcnt) < count_ && iovcnt < max; ++iovcnt) {
+            const std::string& frame = *at(static_cast<size_t>(iovcnt)).frame;
+            size_t skip = (iovcnt == 0) ? head_offset_ : 0;
+            iov[iovcnt].iov_base = const_cast<char*>(frame.data()) + skip;
+            iov[iovcnt].iov_len = frame.size() - skip;
+        }
+        return iovcnt;
+    }
+    // result is the bytes written or -errno; false on a socket error
+    bool sent(long result) {
+        if (result >= 0) {
+            consume(static_cast<size_t>(result));
+            return true;
+        }
+        return result == -EAGAIN || result == -EWOULDBLOCK || result == -EINTR;
+    }
+
+    // Flushes until empty, waiting for POLLOUT at most timeout_ms overall
+    bool drain(int fd, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (true) {
+            if (!flush(fd)) return false;
+            if (count_ == 0) return true;
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0) return false;
+            pollfd pfd{fd, POLLOUT, 0};
+            if (::poll(&pfd, 1, static_cast<int>(left)) < 0 && errno != EINTR) return false;
+        }
+    }
+
+    bool pending() const { return count_ > 0; }
+    size_t queued_bytes() const { return bytes_; }
+
+private:
+    static constexpr int kMaxIov = 64;
+
+    struct Item {
+        LpFrame frame;
+        int key;
+    };
+
+    Item& at(size_t i) { return ring_[(head_ + i) % ring_.size()]; }
+
+    // The ring only grows, so a steady stream of frames allocates nothing
+    void grow() {
+        std::vector<Item> bigger(std::max<size_t>(8, ring_.size() * 2));
+        for (size_t i = 0; i < count_; ++i) bigger[i] = std::move(at(i));
+        ring_.swap(bigger);
+        head_ = 0;
+    }
+
+    void consume(size_t n) {
+        bytes_ -= n;
+        while (n > 0) {
+            size_t left = at(0).frame->size() - head_offset_;
+            if (n < left) {
+                head_offset_ += n;
+                return;
+            }
+            n -= left;
+            head_offset_ = 0;
+            at(0).frame.reset();
+            head_ = (head_ + 1) % ring_.size();
+            --count_;
+        }
+    }
+
+    std::vector<Item> ring_; // queued frames: count_ of them from head_ on
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t head_offset_ = 0;
+    size_t bytes_ = 0;
+    size_t high_water_;
+    size_t hard_limit_;
+};
@@ -0,0 +1,293 @@
+#include "metrics.hpp"
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <malloc.h>
+#include <map>
+#include <new>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace {
+constexpr int kHttpIdleWaitMs = 500;    // upper bound so the thread notices stop()
+constexpr int kHttpRequestTimeoutMs = 1000;
+constexpr size_t kHttpMaxRequest = 8192;
+
+std::string format_number(double v) {
+    char buf[32];
+    // Whole numbers (byte and block counts) in full, the rest to 6 digits
+    const bool whole = v == std::floor(v) && std::fabs(v) < 1e15;
+    std::snprintf(buf, sizeof buf, whole ? "%.0f" : "%.6g", v);
+    return buf;
+}
+
+// Histogram samples in the unit they are exported in: seconds or bytes
+double export_scale(MetricUnit unit) { return unit == MetricUnit::Micros ? 1e-6 : 1.0; }
+
+// operator new/delete counts. Threads take slots round-robin, each on its own
+// cache line, so allocating threads do not contend on one counter; all of it
+// is constant-initialized and safe to use before main.
+struct alignas(64) AllocSlot {
+    std::atomic<uint64_t> allocs{0};
+    std::atomic<uint64_t> frees{0};
+};
+constexpr unsigned kAllocSlots = 16;
+AllocSlot g_alloc_slots[kAllocSlots];
+std::atomic<unsigned> g_alloc_next_slot{0};
+
+AllocSlot& alloc_slot() {
+    static thread_local int slot = -1;
+    if (slot < 0) slot = static_cast<int>(g_alloc_next_slot.fetch_add(1, std::memory_order_relaxed) % kAllocSlots);
+    return g_alloc_slots[slot];
+}
+
+void* counted_new(std::size_t n) {
+    void* p;
+    while (!(p = std::malloc(n ? n : 1))) {
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+    alloc_slot().allocs.fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+void counted_delete(void* p) noexcept {
+    if (!p) return;
+    alloc_slot().frees.fetch_add(1, std::memory_order_relaxed);
+    std::free(p);
+}
+
+void add_memory_gauges(MetricsRegistry& registry) {
+    registry.gauge_fn("process_resident_bytes", "Resident set size", [] {
+        std::ifstream in("/proc/self/statm");
+        unsigned long long size = 0, resident = 0;
+        if (!(in >> size >> resident)) return -1.0;
+        return static_cast<double>(resident) * static_cast<double>(::sysconf(_SC_PAGESIZE));
+    });
+    registry.gauge_fn("process_heap_bytes", "Bytes malloc has handed out and not had back", [] {
+        const struct mallinfo2 mi = ::mallinfo2();
+        return static_cast<double>(mi.uordblks + mi.hblkhd);
+    });
+    registry.gauge_fn("process_heap_blocks", "operator new blocks not yet deleted", [] {
+        uint64_t allocs = 0, frees = 0;
+        for (const AllocSlot& s : g_alloc_slots) {
+            allocs += s.allocs.load(std::memory_order_relaxed);
+            frees += s.frees.load(std::memory_order_relaxed);
+        }
+        return static_cast<double>(allocs) - static_cast<double>(frees);
+    });
+    registry.gauge_fn("process_heap_allocs_total", "operator new calls", [] {
+        uint64_t allocs = 0;
+        for (const AllocSlot& s : g_alloc_slots) allocs += s.allocs.load(std::memory_order_relaxed);
+        return static_cast<double>(allocs);
+    });
+}
+
+std::string with_labels(const std::string& name, const std::string& labels, const std::string& extra = {}) {
+    if (labels.empty() && extra.empty()) return name;
+    std::string out = name + "{" + labels;
+    if (!labels.empty() && !extra.empty()) out += ",";
+    return out + extra + "}";
+}
+}
+
+void* operator new(std::size_t n) { return counted_new(n); }
+void* operator new[](std::size_t n) { return counted_new(n); }
+void operator delete(void* p) noexcept { counted_delete(p); }
+void operator delete[](void* p) noexcept { counted_delete(p); }
+void operator delete(void* p, std::size_t) noexcept { counted_delete(p); }
+void operator delete[](void* p, std::size_t) noexcept { counted_delete(p); }
+
+double LatencyHistogram::Snapshot::quantile(double q) const {
+    if (count == 0) return 0;
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            const int b = static_cast<int>(i);
+            const double mid = static_cast<double>(bucket_low(b)) + static_cast<double>(bucket_width(b) - 1) / 2.0;
+            return std::min(mid, static_cast<double>(max));
+        }
+    }
+    return static_cast<double>(max);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot s;
+    s.buckets.resize(kBuckets);
+    for (int i = 0; i < kBuckets; ++i) {
+        s.buckets[static_cast<size_t>(i)] = buckets_[i].load(std::memory_order_relaxed);
+        s.count += s.buckets[static_cast<size_t>(i)];
+    }
+    s.sum = sum_.load(std::memory_order_relaxed);
+    s.max = max_.load(std::memory_order_relaxed);
+    return s;
+}
+
+MetricsRegistry::Entry& MetricsRegistry::entry(Kind kind, const std::string& name, const std::string& help,
+                                               const std::string& labels) {
+    for (auto& e : entries_) {
+        if (e->kind == kind && e->name == name && e->labels == labels) return *e;
+    }
+    auto e = std::make_unique<Entry>();
+    e->kind = kind;
+    e->name = name;
+    e->help = help;
+    e->labels = labels;
+    entries_.push_back(std::move(e));
+    return *entries_.back();
+}
+
+MetricCounter& MetricsRegistry::counter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& e = entry(Kind::Counter, name, help, labels);
+    if (!e.counter) e.counter = std::make_unique<MetricCounter>();
+    return *e.counter;
+}
+
+MetricGauge& MetricsRegistry::gauge(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& e = entry(Kind::Gauge, name, help, labels);
+    if (!e.gauge) e.gauge = std::make_unique<MetricGauge>();
+    return *e.gauge;
+}
+
+LatencyHistogram& MetricsRegistry::histogram(const std::string& name, const std::string& help,
+                                             const std::string& labels, MetricUnit unit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& e = entry(Kind::Histogram, name, help, labels);
+    if (!e.histogram) {
+        e.histogram = std::make_unique<LatencyHistogram>();
+        e.unit = unit;
+    }
+    return *e.histogram;
+}
+
+void MetricsRegistry::gauge_fn(const std::string& name, const std::string& help, std::function<double()> fn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entry(Kind::GaugeFn, name, help, {}).fn = std::move(fn);
+}
+
+std::string MetricsRegistry::render_text() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string out;
+    for (const auto& e : entries_) {
+        out += with_labels(e->name, e->labels);
+        switch (e->kind) {
+        case Kind::Counter: out += " " + std::to_string(e->counter->value()); break;
+        case Kind::Gauge: out += " " + std::to_string(e->gauge->value()); break;
+        case Kind::GaugeFn: out += " " + format_number(e->fn()); break;
+        case Kind::Histogram: {
+            const LatencyHistogram::Snapshot s = e->histogram->snapshot();
+            // Durations read best in ms, sizes as they are
+            const double scale = e->unit == MetricUnit::Micros ? 1e-3 : 1.0;
+            auto q = [&](double p) { return format_number(s.quantile(p) * scale); };
+            out += " count=" + std::to_string(s.count) +
+                   " mean=" + format_number(s.count ? static_cast<double>(s.sum) / static_cast<double>(s.count) * scale : 0) +
+                   " p50=" + q(0.5) + " p90=" + q(0.9) + " p99=" + q(0.99) + " p999=" + q(0.999) +
+                   " max=" + format_number(static_cast<double>(s.max) * scale);
+            break;
+        }
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+std::string MetricsRegistry::render_prometheus() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // One HELP/TYPE header per name, then every label set of it
+    std::map<std::string, std::vector<const Entry*>> by_name;
+    for (const auto& e : entries_) by_name[e->name].push_back(e.get());
+    std::string out;
+    for (const auto& [name, group] : by_name) {
+        const Entry& first = *group.front();
+        const char* type = first.kind == Kind::Counter ? "counter" : first.kind == Kind::Histogram ? "summary" : "gauge";
+        out += "# HELP " + name + " " + first.help + "\n# TYPE " + name + " " + type + "\n";
+        for (const Entry* e : group) {
+            switch (e->kind) {
+            case Kind::Counter: out += with_labels(name, e->labels) + " " + std::to_string(e->counter->value()) + "\n"; break;
+            case Kind::Gauge: out += with_labels(name, e->labels) + " " + std::to_string(e->gauge->value()) + "\n"; break;
+            case Kind::GaugeFn: out += with_labels(name, e->labels) + " " + format_number(e->fn()) + "\n"; break;
+            case Kind::Histogram: {
+                const LatencyHistogram::Snapshot s = e->histogram->snapshot();
+                const double scale = export_scale(e->unit);
+                for (const char* q : {"0.5", "0.9", "0.99", "0.999"}) {
+                    out += with_labels(name, e->labels, std::string("quantile=\"") + q + "\"") + " " +
+                           format_number(s.quantile(std::atof(q)) * scale) + "\n";
+                }
+                out += with_labels(name + "_sum", e->labels) + " " + format_number(static_cast<double>(s.sum) * scale) + "\n";
+                out += with_labels(name + "_count", e->labels) + " " + std::to_string(s.count) + "\n";
+                break;
+            }
+            }
+        }
+    }
+    return out;
+}
+
+MetricsRegistry& metrics() {
+    static MetricsRegistry registry;
+    static const bool memory_gauges = (add_memory_gauges(registry), true);
+    (void)memory_gauges;
+    return registry;
+}
+
+bool MetricsHttpServer::start(const char* ip, uint16_t& port) {
+    if (listen_fd_ >= 0) return false;
+    listen_fd_ = start_tcp_server(ip, port);
+    if (listen_fd_ < 0) return false;
+    stop_.store(false);
+    thread_ = std::thread([this] { run(); });
+    log_checkpoint("Metrics", "LISTENING", std::string(ip) + ":" + std::to_string(port));
+    return true;
+}
+
+void MetricsHttpServer::stop() {
+    if (!thread_.joinable()) return;
+    stop_.store(true);
+    thread_.join();
+    ::close(listen_fd_);
+    listen_fd_ = -1;
+}
+
+// Scrapes are rare and the page is rendered on demand, so connections are
+// served one at a time, each with a short receive timeout
+void MetricsHttpServer::run() {
+    while (running && !stop_.load()) {
+        pollfd pfd{listen_fd_, POLLIN, 0};
+        if (::poll(&pfd, 1, kHttpIdleWaitMs) <= 0) continue;
+        int cfd = ::accept(listen_fd_, nullptr, nullptr);
+        if (cfd < 0) continue;
+        timeval tv{kHttpRequestTimeoutMs / 1000, (kHttpRequestTimeoutMs % 1000) * 1000};
+        ::setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+        ::setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+        // The request itself does not matter, only that it has been sent in full
+        std::string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < kHttpMaxRequest) {
+            ssize_t n = ::recv(cfd, buf, sizeof buf, 0);
+            if (n <= 0) break;
+            request.append(buf, static_cast<size_t>(n));
+        }
+        if (request.rfind("GET ", 0) == 0) {
+            const std::string body = metrics().render_prometheus();
+            const std::string head = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                     std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+            if (send_all(cfd, head.data(), head.size())) send_all(cfd, body.data(), body.size());
+        } else if (!request.empty()) {
+            static const char kBad[] = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            send_all(cfd, kBad, sizeof kBad - 1);
+        }
+        ::close(cfd);
+    }
+}
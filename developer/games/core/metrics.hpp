@@ -0,0 +1,175 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Process-wide runtime metrics. Recording is a few relaxed atomic adds with no
+// lock and no allocation, so it stays on in production; only registration (once
+// per metric, normally at startup) and rendering take the registry's mutex.
+// Metrics are never removed, so references handed out stay valid.
+
+class MetricCounter {
+public:
+    void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+class MetricGauge {
+public:
+    void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+// What a histogram's integer samples measure; durations are recorded in
+// microseconds and exported in seconds
+enum class MetricUnit { Micros, Bytes };
+
+// HDR-style log-linear histogram: exact below 16, then 16 buckets per power of
+// two, so any quantile is within 1/32 of the true value. Samples above 2^40
+// land in the last bucket (max is still exact).
+class LatencyHistogram {
+public:
+    static constexpr int kSubBits = 4;
+    static constexpr int kSub = 1 << kSubBits;
+    static constexpr int kMaxBits = 40;
+    static constexpr int kBuckets = (kMaxBits - kSubBits + 1) * kSub;
+
+    void record(uint64_t v) {
+        buckets_[bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(v, std::memory_order_relaxed);
+        uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (v > seen && !max_.compare_exchange_weak(seen, v, std::memory_order_relaxed)) {}
+    }
+    void record(std::chrono::steady_clock::duration d) {
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        record(static_cast<uint64_t>(us > 0 ? us : 0));
+    }
+
+    // A consistent-enough copy for reporting; concurrent records may be split
+    // across it, which only matters to the last sample
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        std::vector<uint64_t> buckets;
+        // Middle of the bucket holding the q-th sample, capped at max
+        double quantile(double q) const;
+    };
+    Snapshot snapshot() const;
+
+    static int bucket_of(uint64_t v) {
+        if (v < kSub) return static_cast<int>(v);
+        const int e = 63 - __builtin_clzll(v);
+        if (e >= kMaxBits) return kBuckets - 1;
+        return (e - kSubBits + 1) * kSub + static_cast<int>((v >> (e - kSubBits)) & (kSub - 1));
+    }
+    static uint64_t bucket_low(int i) {
+        if (i < kSub) return static_cast<uint64_t>(i);
+        const int octave = i / kSub;
+        return static_cast<uint64_t>(kSub + i % kSub) << (octave - 1);
+    }
+    static uint64_t bucket_width(int i) { return i < kSub ? 1 : uint64_t{1} << (i / kSub - 1); }
+
+private:
+    std::atomic<uint64_t> buckets_[kBuckets] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+// Times a scope into a histogram
+class MetricTimer {
+public:
+    explicit MetricTimer(LatencyHistogram& h) : h_(h), start_(std::chrono::steady_clock::now()) {}
+    ~MetricTimer() { h_.record(std::chrono::steady_clock::now() - start_); }
+    MetricTimer(const MetricTimer&) = delete;
+    MetricTimer& operator=(const MetricTimer&) = delete;
+
+private:
+    LatencyHistogram& h_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Named metrics, optionally with a Prometheus label set such as
+// `command="User read"`. Asking again for the same name and labels returns the
+// same metric, so per-key metrics can be created on first use.
+class MetricsRegistry {
+public:
+    MetricCounter& counter(const std::string& name, const std::string& help, const std::string& labels = {});
+    MetricGauge& gauge(const std::string& name, const std::string& help, const std::string& labels = {});
+    LatencyHistogram& histogram(const std::string& name, const std::string& help, const std::string& labels = {},
+                                MetricUnit unit = MetricUnit::Micros);
+    // A gauge read when rendering; fn must be safe to call from any thread
+    void gauge_fn(const std::string& name, const std::string& help, std::function<double()> fn);
+
+    // One metric per line: "name{labels} value" for counters and gauges,
+    // "name{labels} count= mean= p50= p90= p99= p999= max=" for histograms
+    // (durations in ms), for the STATS admin commands
+    std::string render_text() const;
+    // Prometheus text exposition format 0.0.4; histograms become summaries
+    std::string render_prometheus() const;
+
+private:
+    enum class Kind { Counter, Gauge, GaugeFn, Histogram };
+    struct Entry {
+        Kind kind;
+        std::string name;
+        std::string help;
+        std::string labels;
+        MetricUnit unit = MetricUnit::Micros;
+        std::unique_ptr<MetricCounter> counter;
+        std::unique_ptr<MetricGauge> gauge;
+        std::unique_ptr<LatencyHistogram> histogram;
+        std::function<double()> fn;
+    };
+    Entry& entry(Kind kind, const std::string& name, const std::string& help, const std::string& labels);
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Entry>> entries_;
+};
+
+// The process's registry. It starts out with the process's memory, so every
+// server's STATS and /metrics show it:
+//   process_resident_bytes     resident set size (/proc/self/statm)
+//   process_heap_bytes         malloc'd and not yet freed, all arenas (mallinfo2)
+//   process_heap_blocks        operator new blocks not yet deleted
+//   process_heap_allocs_total  operator new calls so far
+// The last two come from the global operator new/delete in metrics.cpp, which
+// every binary linking it uses; each call costs one relaxed add on a counter
+// slot of its thread's own.
+MetricsRegistry& metrics();
+
+// Serves GET /metrics (any path, in fact) from metrics().render_prometheus() on
+// its own thread, one short-lived connection at a time
+class MetricsHttpServer {
+public:
+    MetricsHttpServer() = default;
+    MetricsHttpServer(const MetricsHttpServer&) = delete;
+    MetricsHttpServer& operator=(const MetricsHttpServer&) = delete;
+    ~MetricsHttpServer() { stop(); }
+
+    // port 0 picks a free one and writes it back
+    bool start(const char* ip, uint16_t& port);
+    void stop();
+
+private:
+    void run();
+
+    int listen_fd_ = -1;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
@@ -0,0 +1,140 @@
+#include "reactor.hpp"
+
+#include "common.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+uint64_t pack(int fd, uint32_t generation) {
+    return static_cast<uint64_t>(generation) << 32 | static_cast<uint32_t>(fd);
+}
+} // namespace
+
+Reactor::Reactor() {
+    epfd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epfd_ < 0 || wake_fd_ < 0) {
+        log_message(LogLevel::Error, "Reactor", std::string("setup failed: ") + std::strerror(errno));
+        return;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = pack(wake_fd_, 0); // generation 0 is never handed out to a registration
+    ::epoll_ctl(epfd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+}
+
+Reactor::~Reactor() {
+    if (wake_fd_ >= 0) ::close(wake_fd_);
+    if (epfd_ >= 0) ::close(epfd_);
+}
+
+bool Reactor::add(int fd, uint32_t events, IoHandler handler) {
+    if (++generation_ == 0) ++generation_;
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.u64 = pack(fd, generation_);
+    if (::epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) return false;
+    handlers_[fd] = Registration{generation_, std::make_shared<IoHandler>(std::move(handler))};
+    return true;
+}
+
+bool Reactor::modify(int fd, uint32_t events) {
+    auto it = handlers_.find(fd);
+    if (it == handlers_.end()) return false;
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.u64 = pack(fd, it->second.generation);
+    return ::epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void Reactor::remove(int fd) {
+    if (handlers_.erase(fd) == 0) return;
+    ::epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr); // fails harmlessly if fd is already closed
+}
+
+uint64_t Reactor::at(Clock::time_point deadline, Task fn) {
+    const uint64_t id = ++next_timer_;
+    timers_.emplace(id, std::move(fn));
+    wheel_.schedule_at(id, deadline);
+    return id;
+}
+
+void Reactor::post(Task fn) {
+    bool first;
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex_);
+        first = posted_.empty();
+        posted_.push_back(std::move(fn));
+    }
+    // One wakeup per batch: later posts find the loop already due to run them
+    if (first) {
+        uint64_t one = 1;
+        (void)!::write(wake_fd_, &one, sizeof(one));
+    }
+}
+
+void Reactor::stop() {
+    stopping_.store(true, std::memory_order_relaxed);
+    uint64_t one = 1;
+    (void)!::write(wake_fd_, &one, sizeof(one));
+}
+
+void Reactor::run() {
+    while (running && !stopping_.load(std::memory_order_relaxed)) {
+        run_once(kIdleWaitMs);
+        trace_poll_signal();
+    }
+    stopping_.store(false, std::memory_order_relaxed);
+}
+
+void Reactor::run_once(int timeout_ms) {
+    int wait = wheel_.ms_until_next_expiry(Clock::now());
+    if (timeout_ms >= 0 && (wait < 0 || timeout_ms < wait)) wait = timeout_ms;
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex_);
+        if (!posted_.empty()) wait = 0;
+    }
+    epoll_event events[kMaxEvents];
+    int n = ::epoll_wait(epfd_, events, kMaxEvents, wait);
+    if (n < 0) {
+        if (errno != EINTR) log_message(LogLevel::Error, "Reactor", std::string("epoll_wait: ") + std::strerror(errno));
+        n = 0;
+    }
+    TRACE_SCOPE("reactor_round");
+    for (int i = 0; i < n; ++i) {
+        const int fd = static_cast<int>(static_cast<uint32_t>(events[i].data.u64));
+        const uint32_t generation = static_cast<uint32_t>(events[i].data.u64 >> 32);
+        if (generation == 0) {
+            uint64_t count;
+            (void)!::read(wake_fd_, &count, sizeof(count));
+            continue;
+        }
+        auto it = handlers_.find(fd);
+        if (it == handlers_.end() || it->second.generation != generation) continue; // removed this round
+        std::shared_ptr<IoHandler> handler = it->second.handler;
+        (*handler)(events[i].events);
+    }
+    wheel_.advance(Clock::now(), [this](uint64_t id) {
+        auto it = timers_.find(id);
+        if (it == timers_.end()) return; // cancelled
+        Task fn = std::move(it->second);
+        timers_.erase(it);
+        fn();
+    });
+    run_posted();
+}
+
+void Reactor::run_posted() {
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex_);
+        if (posted_.empty()) return;
+        running_posted_.swap(posted_);
+    }
+    for (Task& fn : running_posted_) fn();
+    running_posted_.clear();
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "timer_wheel.hpp"
+
+// Single-threaded event loop for a game server: epoll readiness callbacks per
+// fd, one-shot timers on a TimerWheel, and tasks posted from other threads
+// (woken through an eventfd). Everything except post() and stop() belongs to
+// the thread that runs the loop (or to setup before run()). A callback may
+// add, change or remove any fd, its own included; an fd removed during a round
+// gets no more events from that round, even if its number is reused at once.
+class Reactor {
+public:
+    using Clock = TimerWheel::Clock;
+    using IoHandler = std::function<void(uint32_t events)>;
+    using Task = std::function<void()>;
+
+    Reactor();
+    ~Reactor();
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    // False if the epoll or eventfd could not be created
+    bool ok() const { return epfd_ >= 0 && wake_fd_ >= 0; }
+
+    // events are EPOLLIN/EPOLLOUT/...; level-triggered unless EPOLLET is given.
+    // The reactor never closes an fd.
+    bool add(int fd, uint32_t events, IoHandler handler);
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Runs fn once, no earlier than the deadline (and at most a slot after it);
+    // the id cancels it, a stale id is ignored
+    uint64_t at(Clock::time_point deadline, Task fn);
+    uint64_t after(int delay_ms, Task fn) { return at(Clock::now() + std::chrono::milliseconds(delay_ms), std::move(fn)); }
+    void cancel(uint64_t timer) { timers_.erase(timer); }
+
+    // Any thread: fn runs on the loop's thread in the next round
+    void post(Task fn);
+    // Any thread: run() returns after the current round
+    void stop();
+
+    // Rounds until stop() or the process-wide running flag drops
+    void run();
+    // One round: waits up to timeout_ms for readiness (less if a timer is due
+    // sooner, -1 for no limit), then runs the I/O callbacks, the timers that
+    // are due and the posted tasks
+    void run_once(int timeout_ms);
+
+    size_t fds() const { return handlers_.size(); }
+    size_t timers() const { return timers_.size(); }
+
+private:
+    static constexpr int kMaxEvents = 256;
+    static constexpr int kIdleWaitMs = 500; // how often run() looks at running
+
+    struct Registration {
+        uint32_t generation;
+        std::shared_ptr<IoHandler> handler; // kept alive while it runs, even if removed
+    };
+
+    void run_posted();
+
+    int epfd_ = -1;
+    int wake_fd_ = -1;
+    std::unordered_map<int, Registration> handlers_;
+    uint32_t generation_ = 0;
+    TimerWheel wheel_;
+    std::unordered_map<uint64_t, Task> timers_;
+    uint64_t next_timer_ = 0;
+    std::mutex posted_mutex_;
+    std::vector<Task> posted_;
+    std::vector<Task> running_posted_;
+    std::atomic<bool> stopping_{false};
+};
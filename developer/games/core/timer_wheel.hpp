@@ -0,0 +1,83 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Hashed timer wheel with 1 ms slots and absolute deadlines: O(1) schedule,
+// O(expired) advance, and timers never fire before their deadline or more than
+// one slot after it. Timers are identified by an opaque id; there is no cancel,
+// owners ignore ids that no longer exist.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TimerWheel(size_t slot_count = 1024)
+        : slots_(slot_count), cursor_time_(floor_ms(Clock::now())) {}
+
+    // Fire id once deadline has passed
+    void schedule_at(uint64_t id, Clock::time_point deadline) {
+        int64_t ticks = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::ceil<std::chrono::milliseconds>(deadline) - cursor_time_).count();
+        if (ticks < 1) ticks = 1;
+        size_t slot = (cursor_ + static_cast<size_t>(ticks)) % slots_.size();
+        slots_[slot].push_back(Entry{id, static_cast<uint32_t>((ticks - 1) / static_cast<int64_t>(slots_.size()))});
+        ++count_;
+    }
+
+    void schedule(uint64_t id, int delay_ms) {
+        schedule_at(id, Clock::now() + std::chrono::milliseconds(delay_ms));
+    }
+
+    // Moves the wheel up to now and calls fn(id) for every timer that expired.
+    // fn may schedule new timers.
+    template <typename Fn>
+    void advance(Clock::time_point now, Fn&& fn) {
+        const auto slot = std::chrono::milliseconds(1);
+        while (now - cursor_time_ >= slot) {
+            cursor_time_ += slot;
+            cursor_ = (cursor_ + 1) % slots_.size();
+            if (slots_[cursor_].empty()) continue;
+            std::vector<Entry> due;
+            due.swap(slots_[cursor_]);
+            for (Entry& e : due) {
+                if (e.rounds > 0) {
+                    --e.rounds;
+                    slots_[cursor_].push_back(e);
+                    continue;
+                }
+                --count_;
+                fn(e.id);
+            }
+        }
+    }
+
+    // Milliseconds until the next occupied slot (a reactor's wait timeout),
+    // -1 when nothing is scheduled
+    int ms_until_next_expiry(Clock::time_point now) const {
+        if (count_ == 0) return -1;
+        size_t ahead = 1;
+        for (; ahead < slots_.size(); ++ahead) {
+            if (!slots_[(cursor_ + ahead) % slots_.size()].empty()) break;
+        }
+        auto next = cursor_time_ + std::chrono::milliseconds(ahead);
+        if (next <= now) return 0;
+        return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(next - now).count());
+    }
+
+    size_t size() const { return count_; }
+
+private:
+    struct Entry {
+        uint64_t id;
+        uint32_t rounds;
+    };
+
+    static Clock::time_point floor_ms(Clock::time_point t) {
+        return std::chrono::floor<std::chrono::milliseconds>(t);
+    }
+
+    std::vector<std::vector<Entry>> slots_;
+    size_t cursor_ = 0;
+    Clock::time_point cursor_time_;
+    size_t count_ = 0;
+};
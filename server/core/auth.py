@@ -3,12 +3,12 @@ import sqlite3
 import bcrypt
 import secrets
 from loguru import logger
-from shared.logger import ensure_global_logger, log_dir
+from shared.logger import add_rotating_sink, ensure_global_logger, log_dir
 
 # Module-specific error logging plus shared workflow log
 LOG_DIR = log_dir()
 ensure_global_logger()
-logger.add(LOG_DIR / "auth_errors.log", rotation="1 MB", level="ERROR", filter=lambda r: r["file"] == "auth.py")
+add_rotating_sink(LOG_DIR / "auth_errors.log", max_bytes=1024 * 1024, level="ERROR", filter=lambda r: r["file"] == "auth.py")
 
 
 class Authenticator:
@@ -5,12 +5,12 @@ from pathlib import Path
 from typing import Optional
 from loguru import logger
 from server.core.config import USER_SERVER_HOST, USER_SERVER_HOST_PORT, USER_SERVER_BIND_HOST, PLATFORM_PROTOCOL_VERSION
-from shared.logger import ensure_global_logger, log_dir
+from shared.logger import add_rotating_sink, ensure_global_logger, log_dir
 
 # Module-specific logging
 LOG_DIR = log_dir()
 ensure_global_logger()
-logger.add(LOG_DIR / "game_launcher_errors.log", rotation="1 MB", level="ERROR", filter=lambda r: r["file"] == "game_launcher.py")
+add_rotating_sink(LOG_DIR / "game_launcher_errors.log", max_bytes=1024 * 1024, level="ERROR", filter=lambda r: r["file"] == "game_launcher.py")
 
 @dataclass
 class LaunchResult:
@@ -4,12 +4,12 @@ import bcrypt
 import secrets
 import json
 from loguru import logger
-from shared.logger import ensure_global_logger, log_dir
+from shared.logger import add_rotating_sink, ensure_global_logger, log_dir
 
 # Module-specific error logging plus shared workflow log
 LOG_DIR = log_dir()
 ensure_global_logger()
-logger.add(LOG_DIR / "game_manager_errors.log", rotation="1 MB", level="ERROR", filter=lambda r: r["file"] == "game_manager.py")
+add_rotating_sink(LOG_DIR / "game_manager_errors.log", max_bytes=1024 * 1024, level="ERROR", filter=lambda r: r["file"] == "game_manager.py")
 show_entries = "author, game_name, version, type, description, avg_score, review_count, max_players, game_folder"
 class GameManager:
     def __init__(self):
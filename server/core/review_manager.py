@@ -1,12 +1,12 @@
 from pathlib import Path
 import sqlite3
 from loguru import logger
-from shared.logger import ensure_global_logger, log_dir
+from shared.logger import add_rotating_sink, ensure_global_logger, log_dir
 
 # Module-specific error logging
 LOG_DIR = log_dir()
 ensure_global_logger()
-logger.add(LOG_DIR / "review_manager_errors.log", rotation="1 MB", level="ERROR", filter=lambda r: r["file"] == "review_manager.py")
+add_rotating_sink(LOG_DIR / "review_manager_errors.log", max_bytes=1024 * 1024, level="ERROR", filter=lambda r: r["file"] == "review_manager.py")
 show_entries = "author, game_name, version, type, description, max_players, game_folder"
 
 class ReviewManager:
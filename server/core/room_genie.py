@@ -13,13 +13,13 @@ import uuid
 import shutil
 
 from server.core.review_manager import ReviewManager
-from shared.logger import ensure_global_logger, log_dir
+from shared.logger import add_rotating_sink, ensure_global_logger, log_dir
 
 # Module-specific logging
 LOG_DIR = log_dir()
 ensure_global_logger()
-logger.add(LOG_DIR / "room_genie.log", rotation="1 MB", level="INFO", filter=lambda r: r["file"] == "room_genie.py")
-logger.add(LOG_DIR / "room_genie_errors.log", rotation="1 MB", level="ERROR", filter=lambda r: r["file"] == "room_genie.py")
+add_rotating_sink(LOG_DIR / "room_genie.log", max_bytes=1024 * 1024, level="INFO", filter=lambda r: r["file"] == "room_genie.py")
+add_rotating_sink(LOG_DIR / "room_genie_errors.log", max_bytes=1024 * 1024, level="ERROR", filter=lambda r: r["file"] == "room_genie.py")
 
 @dataclass
 class Room:
@@ -7,13 +7,13 @@ from dataclasses import dataclass, field
 
 from server.core.game_manager import GameManager
 from loguru import logger
-from shared.logger import ensure_global_logger, log_dir
+from shared.logger import add_rotating_sink, ensure_global_logger, log_dir
 
 # Module-specific logging
 LOG_DIR = log_dir()
 ensure_global_logger()
-logger.add(LOG_DIR / "storage_manager.log", rotation="1 MB", level="INFO", filter=lambda r: r["file"] == "storage_manager.py")
-logger.add(LOG_DIR / "storage_manager_errors.log", rotation="1 MB", level="ERROR", filter=lambda r: r["file"] == "storage_manager.py")
+add_rotating_sink(LOG_DIR / "storage_manager.log", max_bytes=1024 * 1024, level="INFO", filter=lambda r: r["file"] == "storage_manager.py")
+add_rotating_sink(LOG_DIR / "storage_manager_errors.log", max_bytes=1024 * 1024, level="ERROR", filter=lambda r: r["file"] == "storage_manager.py")
 @dataclass(order=True)
 class UploadSession:
     file_obj: any
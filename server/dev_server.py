@@ -14,7 +14,7 @@ from server.util.net import create_listener, recv_json_lines, send_json, serve
 from server.util.validator import require_token
 import server.core.config as cfg
 from server.core.review_manager import ReviewManager
-from shared.logger import ensure_global_logger, log_dir
+from shared.logger import add_rotating_sink, ensure_global_logger, log_dir
 
 class DevServer:
     def __init__(self):
@@ -32,7 +32,7 @@ class DevServer:
 
         # Re-add the log file handler if needed (e.g. at the start of your application)
         ensure_global_logger()
-        logger.add(log_file_path, rotation="500 MB")
+        add_rotating_sink(log_file_path, max_bytes=500 * 1024 * 1024)
 
         self.host = cfg.DEV_SERVER_HOST_IP
         self.bind_host = cfg.DEV_SERVER_BIND_HOST
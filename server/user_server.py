@@ -19,7 +19,7 @@ from server.core.config import USER_SERVER_HOST, USER_SERVER_HOST_PORT, USER_SER
 from server.core.protocol import Message, message_to_dict
 from server.core.room_genie import RoomGenie
 from server.core.game_launcher import GameLauncher
-from shared.logger import ensure_global_logger, log_dir
+from shared.logger import add_rotating_sink, ensure_global_logger, log_dir
 
 class user_server:
     def __init__(self):
@@ -35,7 +35,7 @@ class user_server:
 
         # Re-add the log file handler if needed (e.g. at the start of your application)
         ensure_global_logger()
-        logger.add(log_file_path, rotation="500 MB")
+        add_rotating_sink(log_file_path, max_bytes=500 * 1024 * 1024)
         self.host = USER_SERVER_HOST
         self.bind_host = USER_SERVER_BIND_HOST
         self.port = USER_SERVER_HOST_PORT
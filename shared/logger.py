@@ -1,3 +1,4 @@
+import time
 from pathlib import Path
 from loguru import logger
 
@@ -12,11 +13,42 @@ def log_dir() -> Path:
     return base
 
 
+def rotate_when(max_bytes: int, max_age_s: float):
+    """
+    A loguru rotation condition: the file passes max_bytes or has been open
+    for max_age_s seconds. Age counts from when loguru opened the current
+    file (at start or on the last rotation), sizes in encoded bytes.
+    """
+    current = {"file": None, "opened": 0.0}
+
+    def should_rotate(message, file) -> bool:
+        now = time.monotonic()
+        if file is not current["file"]:
+            current["file"] = file
+            current["opened"] = now
+        if file.tell() + len(message.encode("utf-8")) > max_bytes or now - current["opened"] >= max_age_s:
+            current["file"] = None  # the file loguru opens next starts the clock again
+            return True
+        return False
+
+    return should_rotate
+
+
+def add_rotating_sink(path, max_bytes: int = 10 * 1024 * 1024, max_age_s: float = 24 * 3600, keep: int = 8, **kwargs) -> int:
+    """
+    File sink rotated by size and age. Rotated files are gzipped and all but
+    the newest `keep` removed; enqueue=True does the writing, rotating and
+    compressing on loguru's queue thread rather than on the thread that logs.
+    """
+    return logger.add(path, rotation=rotate_when(max_bytes, max_age_s), retention=keep,
+                      compression="gz", enqueue=True, **kwargs)
+
+
 def ensure_global_logger() -> int:
     """
     Add a global log sink if it hasn't been added yet. Returns the sink id.
     """
     global _global_sink_id
     if _global_sink_id is None:
-        _global_sink_id = logger.add(log_dir() / "global.log", rotation="10 MB", level="INFO")
+        _global_sink_id = add_rotating_sink(log_dir() / "global.log", level="INFO")
     return _global_sink_id